@@ -53,6 +53,9 @@ cache_new(cache_init_cb_t init_cb)
 		return NULL;
 	}
 
+	cache->miss_cb = NULL;
+	cache->hits = 0;
+	cache->misses = 0;
 	init_cb(cache);
 	return cache;
 }
@@ -106,6 +109,56 @@ cache_gc(cache_t *cache)
 	pthread_mutex_unlock(&cache->mutex);
 }
 
+/*
+ * Remove all entries, e.g. when a reload invalidates them.
+ */
+void
+cache_flush(cache_t *cache)
+{
+	khiter_t it;
+
+	pthread_mutex_lock(&cache->mutex);
+	for (it = cache->begin_cb(); it != cache->end_cb(); it++) {
+		if (cache->exist_cb(it)) {
+			cache->free_val_cb(cache->get_val_cb(it));
+			cache->free_key_cb(cache->get_key_cb(it));
+			cache->del_cb(it);
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/*
+ * Call cb with all the packed keys and vals while holding the cache lock;
+ * cb must copy what it needs to keep.
+ */
+void
+cache_foreach(cache_t *cache, cache_foreach_cb_t cb, void *arg)
+{
+	khiter_t it;
+
+	pthread_mutex_lock(&cache->mutex);
+	for (it = cache->begin_cb(); it != cache->end_cb(); it++) {
+		if (cache->exist_cb(it)) {
+			cb(cache->get_key_cb(it), cache->get_val_cb(it), arg);
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/*
+ * Return the number of lookups which found a valid entry, including those
+ * served by the miss cb, and of those which did not.
+ */
+void
+cache_stats(cache_t *cache, unsigned long long *hits, unsigned long long *misses)
+{
+	pthread_mutex_lock(&cache->mutex);
+	*hits = cache->hits;
+	*misses = cache->misses;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
 cache_val_t
 cache_get(cache_t *cache, cache_key_t key)
 {
@@ -125,8 +178,25 @@ cache_get(cache_t *cache, cache_key_t key)
 			cache->free_key_cb(cache->get_key_cb(it));
 			cache->del_cb(it);
 		}
+	} else if (cache->miss_cb) {
+		cache_val_t val;
+		if ((val = cache->miss_cb(key))) {
+			int ret;
+			/* the cache takes over key and val */
+			it = cache->put_cb(key, &ret);
+			cache->set_val_cb(it, val);
+			if (!(rval = cache->unpackverify_val_cb(val, 1))) {
+				cache->free_val_cb(val);
+				cache->free_key_cb(key);
+				cache->del_cb(it);
+			}
+			rval ? cache->hits++ : cache->misses++;
+			pthread_mutex_unlock(&cache->mutex);
+			return rval;
+		}
 	}
 	cache->free_key_cb(key);
+	rval ? cache->hits++ : cache->misses++;
 	pthread_mutex_unlock(&cache->mutex);
 	return rval;
 }
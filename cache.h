@@ -50,6 +50,8 @@ typedef cache_val_t (*cache_get_val_cb_t)(cache_iter_t);
 typedef void (*cache_set_val_cb_t)(cache_iter_t, cache_val_t);
 typedef cache_val_t (*cache_unpackverify_val_cb_t)(cache_val_t, int);
 typedef void (*cache_fini_cb_t)(void);
+typedef cache_val_t (*cache_miss_cb_t)(cache_key_t);
+typedef void (*cache_foreach_cb_t)(cache_key_t, cache_val_t, void *);
 
 typedef struct cache {
 	pthread_mutex_t mutex;
@@ -67,6 +69,12 @@ typedef struct cache {
 	cache_set_val_cb_t set_val_cb;
 	cache_unpackverify_val_cb_t unpackverify_val_cb;
 	cache_fini_cb_t fini_cb;
+	/* optional, returns a packed val for a key not in the cache */
+	cache_miss_cb_t miss_cb;
+
+	/* lookups, protected by the mutex */
+	unsigned long long hits;
+	unsigned long long misses;
 } cache_t;
 
 typedef void (*cache_init_cb_t)(struct cache *);
@@ -75,6 +83,9 @@ cache_t * cache_new(cache_init_cb_t) MALLOC;
 int cache_reinit(cache_t *) NONNULL(1) WUNRES;
 void cache_free(cache_t *) NONNULL(1);
 void cache_gc(cache_t *) NONNULL(1);
+void cache_flush(cache_t *) NONNULL(1);
+void cache_foreach(cache_t *, cache_foreach_cb_t, void *) NONNULL(1,2);
+void cache_stats(cache_t *, unsigned long long *, unsigned long long *) NONNULL(1,2,3);
 cache_val_t cache_get(cache_t *, cache_key_t) NONNULL(1) WUNRES;
 void cache_set(cache_t *, cache_key_t, cache_val_t) NONNULL(1);
 void cache_del(cache_t *, cache_key_t) NONNULL(1);
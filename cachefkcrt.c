@@ -35,7 +35,7 @@
  * Cache for generated fake certificates.
  *
  * key: char[SSL_X509_FPRSZ]  fingerprint of original server cert
- * val: X509 *                generated fake certificate
+ * val: crtrec_t *            record of generated fake certificate
  */
 
 static inline khint_t
@@ -103,7 +103,7 @@ cachefkcrt_free_key_cb(cache_key_t key)
 static void
 cachefkcrt_free_val_cb(cache_val_t val)
 {
-	X509_free(val);
+	crtrec_free(val);
 }
 
 static cache_key_t
@@ -127,10 +127,12 @@ cachefkcrt_set_val_cb(cache_iter_t it, cache_val_t val)
 static cache_val_t
 cachefkcrt_unpackverify_val_cb(cache_val_t val, int copy)
 {
-	if (!ssl_x509_is_valid(val))
+	crtrec_t *rec = val;
+
+	if (!ssl_x509_is_valid(rec->crt))
 		return NULL;
 	if (copy) {
-		ssl_x509_refcount_inc(val);
+		crtrec_refcount_inc(rec);
 		return val;
 	}
 	return ((void*)-1);
@@ -174,10 +176,10 @@ cachefkcrt_mkkey(X509 *keycrt)
 }
 
 cache_val_t
-cachefkcrt_mkval(X509 *valcrt)
+cachefkcrt_mkval(crtrec_t *valrec)
 {
-	ssl_x509_refcount_inc(valcrt);
-	return valcrt;
+	crtrec_refcount_inc(valrec);
+	return valrec;
 }
 
 /* vim: set noet ft=c: */
@@ -52,76 +52,177 @@ cachemgr_teardown(void)
 
 START_TEST(cache_fkcrt_01)
 {
-	X509 *c1, *c2;
+	X509 *c1;
+	crtrec_t *r1, *r2;
 
 	c1 = ssl_x509_load(TESTCERT);
 	fail_unless(!!c1, "loading certificate failed");
-	cachemgr_fkcrt_set(c1, c1);
-	c2 = cachemgr_fkcrt_get(c1);
-	fail_unless(!!c2, "cache did not return a certificate");
-	fail_unless(c2 == c1, "cache did not return same pointer");
+	r1 = crtrec_new(c1);
+	fail_unless(!!r1, "creating record failed");
+	cachemgr_fkcrt_set(c1, r1);
+	r2 = cachemgr_fkcrt_get(c1);
+	fail_unless(!!r2, "cache did not return a record");
+	fail_unless(r2 == r1, "cache did not return same pointer");
+	fail_unless(r2->crt == c1, "record does not hold the certificate");
+	crtrec_free(r1);
+	crtrec_free(r2);
 	X509_free(c1);
-	X509_free(c2);
 }
 END_TEST
 
 START_TEST(cache_fkcrt_02)
 {
-	X509 *c1, *c2;
+	X509 *c1;
+	crtrec_t *r2;
 
 	c1 = ssl_x509_load(TESTCERT);
 	fail_unless(!!c1, "loading certificate failed");
-	c2 = cachemgr_fkcrt_get(c1);
-	fail_unless(c2 == NULL, "certificate was already in empty cache");
+	r2 = cachemgr_fkcrt_get(c1);
+	fail_unless(r2 == NULL, "certificate was already in empty cache");
 	X509_free(c1);
 }
 END_TEST
 
 START_TEST(cache_fkcrt_03)
 {
-	X509 *c1, *c2;
+	X509 *c1;
+	crtrec_t *r1, *r2;
 
 	c1 = ssl_x509_load(TESTCERT);
 	fail_unless(!!c1, "loading certificate failed");
-	cachemgr_fkcrt_set(c1, c1);
+	r1 = crtrec_new(c1);
+	fail_unless(!!r1, "creating record failed");
+	cachemgr_fkcrt_set(c1, r1);
 	cachemgr_fkcrt_del(c1);
-	c2 = cachemgr_fkcrt_get(c1);
-	fail_unless(c2 == NULL, "cache returned deleted certificate");
+	r2 = cachemgr_fkcrt_get(c1);
+	fail_unless(r2 == NULL, "cache returned deleted certificate");
+	crtrec_free(r1);
 	X509_free(c1);
 }
 END_TEST
 
-#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
 START_TEST(cache_fkcrt_04)
 {
-	X509 *c1, *c2;
+	X509 *c1;
+	crtrec_t *r1, *r2;
 
 	c1 = ssl_x509_load(TESTCERT);
 	fail_unless(!!c1, "loading certificate failed");
-	fail_unless(c1->references == 1, "refcount != 1");
-	cachemgr_fkcrt_set(c1, c1);
-	fail_unless(c1->references == 2, "refcount != 2");
-	c2 = cachemgr_fkcrt_get(c1);
-	fail_unless(c1->references == 3, "refcount != 3");
-	cachemgr_fkcrt_set(c1, c1);
-	fail_unless(c1->references == 3, "refcount != 3");
+	r1 = crtrec_new(c1);
+	fail_unless(!!r1, "creating record failed");
+	fail_unless(r1->references == 1, "refcount != 1");
+	cachemgr_fkcrt_set(c1, r1);
+	fail_unless(r1->references == 2, "refcount != 2");
+	r2 = cachemgr_fkcrt_get(c1);
+	fail_unless(r1->references == 3, "refcount != 3");
+	cachemgr_fkcrt_set(c1, r1);
+	fail_unless(r1->references == 3, "refcount != 3");
 	cachemgr_fkcrt_del(c1);
-	fail_unless(c1->references == 2, "refcount != 2");
-	cachemgr_fkcrt_set(c1, c1);
-	fail_unless(c1->references == 3, "refcount != 3");
-	X509_free(c1);
-	fail_unless(c1->references == 2, "refcount != 2");
+	fail_unless(r1->references == 2, "refcount != 2");
+	cachemgr_fkcrt_set(c1, r1);
+	fail_unless(r1->references == 3, "refcount != 3");
+	crtrec_free(r1);
+	fail_unless(r1->references == 2, "refcount != 2");
 	cachemgr_fini();
-	fail_unless(c1->references == 1, "refcount != 1");
-	X509_free(c2);
-#if 0
-	/* deliberate access of free'd X509* */
-	fail_unless(c1->references == 0, "refcount != 0");
-#endif
+	fail_unless(r1->references == 1, "refcount != 1");
+	crtrec_free(r2);
+	X509_free(c1);
 	fail_unless(cachemgr_preinit() != -1, "reinit");
 }
 END_TEST
-#endif
+
+static crtrec_t *cache_fkcrt_miss_rec;
+static int cache_fkcrt_misses;
+
+static cache_val_t
+cache_fkcrt_miss_cb(UNUSED cache_key_t key)
+{
+	cache_fkcrt_misses++;
+	if (!cache_fkcrt_miss_rec)
+		return NULL;
+	return cachefkcrt_mkval(cache_fkcrt_miss_rec);
+}
+
+START_TEST(cache_fkcrt_05)
+{
+	X509 *c1;
+	crtrec_t *r1, *r2;
+
+	c1 = ssl_x509_load(TESTCERT);
+	fail_unless(!!c1, "loading certificate failed");
+	r1 = crtrec_new(c1);
+	fail_unless(!!r1, "creating record failed");
+	cachemgr_fkcrt->miss_cb = cache_fkcrt_miss_cb;
+	cache_fkcrt_miss_rec = NULL;
+	cache_fkcrt_misses = 0;
+	r2 = cachemgr_fkcrt_get(c1);
+	fail_unless(r2 == NULL, "miss cb without val returned a record");
+	fail_unless(cache_fkcrt_misses == 1, "miss cb not called");
+	cache_fkcrt_miss_rec = r1;
+	r2 = cachemgr_fkcrt_get(c1);
+	fail_unless(r2 == r1, "cache did not return miss cb record");
+	crtrec_free(r2);
+	r2 = cachemgr_fkcrt_get(c1);
+	fail_unless(r2 == r1, "cache did not keep miss cb record");
+	fail_unless(cache_fkcrt_misses == 2, "miss cb called for cached key");
+	crtrec_free(r2);
+	crtrec_free(r1);
+	X509_free(c1);
+}
+END_TEST
+
+static void
+cache_fkcrt_foreach_cb(UNUSED cache_key_t key, cache_val_t val, void *arg)
+{
+	fail_unless(val == arg, "foreach passed wrong val");
+	cache_fkcrt_misses++;
+}
+
+START_TEST(cache_fkcrt_06)
+{
+	X509 *c1;
+	crtrec_t *r1;
+
+	c1 = ssl_x509_load(TESTCERT);
+	fail_unless(!!c1, "loading certificate failed");
+	r1 = crtrec_new(c1);
+	fail_unless(!!r1, "creating record failed");
+	cache_fkcrt_misses = 0;
+	cache_foreach(cachemgr_fkcrt, cache_fkcrt_foreach_cb, r1);
+	fail_unless(cache_fkcrt_misses == 0, "foreach on empty cache");
+	cachemgr_fkcrt_set(c1, r1);
+	cache_foreach(cachemgr_fkcrt, cache_fkcrt_foreach_cb, r1);
+	fail_unless(cache_fkcrt_misses == 1, "foreach did not visit entry");
+	crtrec_free(r1);
+	X509_free(c1);
+}
+END_TEST
+
+START_TEST(cache_fkcrt_07)
+{
+	X509 *c1;
+	crtrec_t *r1, *r2;
+	unsigned long long hits, misses;
+
+	c1 = ssl_x509_load(TESTCERT);
+	fail_unless(!!c1, "loading certificate failed");
+	r1 = crtrec_new(c1);
+	fail_unless(!!r1, "creating record failed");
+	cache_stats(cachemgr_fkcrt, &hits, &misses);
+	fail_unless(hits == 0 && misses == 0, "stats of new cache not zero");
+	r2 = cachemgr_fkcrt_get(c1);
+	fail_unless(r2 == NULL, "certificate was already in empty cache");
+	cachemgr_fkcrt_set(c1, r1);
+	r2 = cachemgr_fkcrt_get(c1);
+	fail_unless(r2 == r1, "cache returned wrong record");
+	crtrec_free(r2);
+	cache_stats(cachemgr_fkcrt, &hits, &misses);
+	fail_unless(hits == 1, "hit not counted");
+	fail_unless(misses == 1, "miss not counted");
+	crtrec_free(r1);
+	X509_free(c1);
+}
+END_TEST
 
 Suite *
 cachefkcrt_suite(void)
@@ -136,9 +237,10 @@ cachefkcrt_suite(void)
 	tcase_add_test(tc, cache_fkcrt_01);
 	tcase_add_test(tc, cache_fkcrt_02);
 	tcase_add_test(tc, cache_fkcrt_03);
-#if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
 	tcase_add_test(tc, cache_fkcrt_04);
-#endif
+	tcase_add_test(tc, cache_fkcrt_05);
+	tcase_add_test(tc, cache_fkcrt_06);
+	tcase_add_test(tc, cache_fkcrt_07);
 	suite_add_tcase(s, tc);
 
 	return s;
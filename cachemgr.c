@@ -29,9 +29,9 @@
 #include "cachemgr.h"
 
 #include "cachefkcrt.h"
-#include "cachetgcrt.h"
 #include "cachessess.h"
 #include "cachedsess.h"
+#include "cachesnicrt.h"
 #include "log.h"
 #include "attrib.h"
 
@@ -41,9 +41,9 @@
 #include <netinet/in.h>
 
 cache_t *cachemgr_fkcrt;
-cache_t *cachemgr_tgcrt;
 cache_t *cachemgr_ssess;
 cache_t *cachemgr_dsess;
+cache_t *cachemgr_snicrt;
 
 /*
  * Garbage collector thread entry point.
@@ -66,18 +66,18 @@ cachemgr_preinit(void)
 {
 	if (!(cachemgr_fkcrt = cache_new(cachefkcrt_init_cb)))
 		goto out4;
-	if (!(cachemgr_tgcrt = cache_new(cachetgcrt_init_cb)))
-		goto out3;
 	if (!(cachemgr_ssess = cache_new(cachessess_init_cb)))
-		goto out2;
+		goto out3;
 	if (!(cachemgr_dsess = cache_new(cachedsess_init_cb)))
+		goto out2;
+	if (!(cachemgr_snicrt = cache_new(cachesnicrt_init_cb)))
 		goto out1;
 	return 0;
 
 out1:
-	cache_free(cachemgr_ssess);
+	cache_free(cachemgr_dsess);
 out2:
-	cache_free(cachemgr_tgcrt);
+	cache_free(cachemgr_ssess);
 out3:
 	cache_free(cachemgr_fkcrt);
 out4:
@@ -93,12 +93,12 @@ cachemgr_init(void)
 {
 	if (cache_reinit(cachemgr_fkcrt))
 		return -1;
-	if (cache_reinit(cachemgr_tgcrt))
-		return -1;
 	if (cache_reinit(cachemgr_ssess))
 		return -1;
 	if (cache_reinit(cachemgr_dsess))
 		return -1;
+	if (cache_reinit(cachemgr_snicrt))
+		return -1;
 	return 0;
 }
 
@@ -110,9 +110,9 @@ cachemgr_init(void)
 void
 cachemgr_fini(void)
 {
+	cache_free(cachemgr_snicrt);
 	cache_free(cachemgr_dsess);
 	cache_free(cachemgr_ssess);
-	cache_free(cachemgr_tgcrt);
 	cache_free(cachemgr_fkcrt);
 }
 
@@ -125,11 +125,9 @@ cachemgr_fini(void)
 void
 cachemgr_gc(void)
 {
-	pthread_t fkcrt_thr, dsess_thr, ssess_thr;
+	pthread_t fkcrt_thr, dsess_thr, ssess_thr, snicrt_thr;
 	int rv;
 
-	/* the tgcrt cache does not need cleanup */
-
 	rv = pthread_create(&fkcrt_thr, NULL, cachemgr_gc_thread,
 	                    cachemgr_fkcrt);
 	if (rv) {
@@ -148,6 +146,12 @@ cachemgr_gc(void)
 		log_err_level_printf(LOG_CRIT, "cachemgr_gc: pthread_create failed: %s\n",
 		               strerror(rv));
 	}
+	rv = pthread_create(&snicrt_thr, NULL, cachemgr_gc_thread,
+	                    cachemgr_snicrt);
+	if (rv) {
+		log_err_level_printf(LOG_CRIT, "cachemgr_gc: pthread_create failed: %s\n",
+		               strerror(rv));
+	}
 
 	rv = pthread_join(fkcrt_thr, NULL);
 	if (rv) {
@@ -164,6 +168,11 @@ cachemgr_gc(void)
 		log_err_level_printf(LOG_CRIT, "cachemgr_gc: pthread_join failed: %s\n",
 		               strerror(rv));
 	}
+	rv = pthread_join(snicrt_thr, NULL);
+	if (rv) {
+		log_err_level_printf(LOG_CRIT, "cachemgr_gc: pthread_join failed: %s\n",
+		               strerror(rv));
+	}
 }
 
 /* vim: set noet ft=c: */
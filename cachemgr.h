@@ -31,14 +31,14 @@
 
 #include "cache.h"
 #include "cachefkcrt.h"
-#include "cachetgcrt.h"
 #include "cachessess.h"
 #include "cachedsess.h"
+#include "cachesnicrt.h"
 
 extern cache_t *cachemgr_fkcrt;
-extern cache_t *cachemgr_tgcrt;
 extern cache_t *cachemgr_ssess;
 extern cache_t *cachemgr_dsess;
+extern cache_t *cachemgr_snicrt;
 
 int cachemgr_preinit(void) WUNRES;
 int cachemgr_init(void) WUNRES;
@@ -52,13 +52,6 @@ void cachemgr_gc(void);
 #define cachemgr_fkcrt_del(key) \
         cache_del(cachemgr_fkcrt, cachefkcrt_mkkey(key))
 
-#define cachemgr_tgcrt_get(key) \
-        cache_get(cachemgr_tgcrt, cachetgcrt_mkkey(key))
-#define cachemgr_tgcrt_set(key, val) \
-        cache_set(cachemgr_tgcrt, cachetgcrt_mkkey(key), cachetgcrt_mkval(val))
-#define cachemgr_tgcrt_del(key) \
-        cache_del(cachemgr_tgcrt, cachetgcrt_mkkey(key))
-
 #define cachemgr_ssess_get(key, keysz) \
         cache_get(cachemgr_ssess, cachessess_mkkey((key), (keysz)))
 #define cachemgr_ssess_set(val) \
@@ -84,6 +77,14 @@ void cachemgr_gc(void);
 #define cachemgr_dsess_del(addr, addrlen, sni) \
         cache_del(cachemgr_dsess, cachedsess_mkkey((addr), (addrlen), (sni)))
 
+#define cachemgr_snicrt_get(addr, addrlen, sni) \
+        cache_get(cachemgr_snicrt, cachesnicrt_mkkey((addr), (addrlen), (sni)))
+#define cachemgr_snicrt_set(addr, addrlen, sni, val) \
+        cache_set(cachemgr_snicrt, cachesnicrt_mkkey((addr), (addrlen), (sni)), \
+                                   cachesnicrt_mkval(val))
+#define cachemgr_snicrt_del(addr, addrlen, sni) \
+        cache_del(cachemgr_snicrt, cachesnicrt_mkkey((addr), (addrlen), (sni)))
+
 #endif /* !CACHEMGR_H */
 
 /* vim: set noet ft=c: */
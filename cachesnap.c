@@ -0,0 +1,832 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "cachesnap.h"
+
+#include "cachemgr.h"
+#include "privsep.h"
+#include "ssl.h"
+#include "dynbuf.h"
+#include "log.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Snapshots of the forged cert cache and the dst session cache, for warm
+ * restarts.
+ *
+ * A background thread periodically writes all entries into a fresh
+ * CacheSnapshot.tmp opened by the privsep parent, which then renames it over
+ * CacheSnapshot, so a snapshot mapped at startup stays valid meanwhile.  The
+ * file is laid out in host byte order:
+ *
+ *   cachesnap_hdr_t
+ *   cachesnap_ent_t[nfkcrt]   sorted by key
+ *   cachesnap_ent_t[ndsess]   sorted by key
+ *   DER leaf key, then the keys and values of the entries
+ *
+ * fkcrt keys are the SHA-1 fingerprints of the original server certs and the
+ * values DER forged certs; dsess keys are the (addr, port, SNI) keys of the
+ * dsess cache and the values DER sessions.  On a cache miss, the key is
+ * looked up in the mapped snapshot, and the entry found is parsed and put
+ * into the cache, so nothing is parsed at startup.
+ *
+ * Forged certs are only valid for the CA certs and the leaf key they were
+ * forged with, so the fkcrt entries are used only if the snapshot was written
+ * with the same set of CA certs and the same leaf key.  If no leaf key is
+ * configured, the one saved in the snapshot is used instead of generating a
+ * new one.
+ *
+ * The leaf key is saved unencrypted, configured or generated, so the privsep
+ * parent creates each snapshot with mode 0600, see privsep_server_snapfile().
+ */
+
+#define CACHESNAP_MAGIC "SSLPSNAP"
+#define CACHESNAP_VERSION 1
+
+typedef struct cachesnap_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t entsz;
+	uint32_t nfkcrt;
+	uint32_t ndsess;
+	uint32_t keyoff;
+	uint32_t keysz;
+	uint64_t size;
+	// SHA-1 of the leaf key, and of the sorted fingerprints of the CA certs
+	unsigned char keyid[SSL_KEY_IDSZ];
+	unsigned char caid[SSL_X509_FPRSZ];
+} cachesnap_hdr_t;
+
+typedef struct cachesnap_ent {
+	uint32_t keyoff;
+	uint32_t keysz;
+	uint32_t valoff;
+	uint32_t valsz;
+	int64_t expires;
+} cachesnap_ent_t;
+
+typedef struct cachesnap_item {
+	unsigned char *key;
+	size_t keysz;
+	unsigned char *val;
+	size_t valsz;
+	int64_t expires;
+} cachesnap_item_t;
+
+typedef struct cachesnap_items {
+	cachesnap_item_t *items;
+	size_t count;
+	size_t size;
+	// Forged certs are serialized after releasing the cache lock
+	X509 **crts;
+} cachesnap_items_t;
+
+// Mapped snapshot; snap_mutex nests inside the cache locks
+static pthread_mutex_t snap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *snap;
+static size_t snapsz;
+static const cachesnap_ent_t *snap_fkcrt;
+static const cachesnap_ent_t *snap_dsess;
+static uint32_t snap_nfkcrt;
+static uint32_t snap_ndsess;
+
+// Ids and DER leaf key of the running config, protected by snap_mutex
+static unsigned char cur_keyid[SSL_KEY_IDSZ];
+static unsigned char cur_caid[SSL_X509_FPRSZ];
+static unsigned char *cur_key;
+static size_t cur_keysz;
+
+static char *snapfn;
+static int snap_clisock = -1;
+static pthread_t write_thr;
+static int write_thr_started;
+static int write_thr_running;
+
+static int
+cachesnap_fpr_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, SSL_X509_FPRSZ);
+}
+
+/*
+ * Hash the fingerprints of the CA certs of global, in sorted order and
+ * without duplicates.
+ */
+static int
+cachesnap_caid(global_t *global, unsigned char *caid)
+{
+	unsigned char (*fprs)[SSL_X509_FPRSZ];
+	size_t n = 1, i = 0, j = 0;
+	int rv;
+
+	for (proxyspec_t *spec = global->spec; spec; spec = spec->next)
+		n++;
+	if (!(fprs = malloc(n * SSL_X509_FPRSZ)))
+		return -1;
+	if (global->opts->cacrt &&
+	    ssl_x509_fingerprint_sha1(global->opts->cacrt, fprs[i++]) == -1)
+		goto err;
+	for (proxyspec_t *spec = global->spec; spec; spec = spec->next) {
+		if (spec->opts->cacrt &&
+		    ssl_x509_fingerprint_sha1(spec->opts->cacrt, fprs[i++]) == -1)
+			goto err;
+	}
+	qsort(fprs, i, SSL_X509_FPRSZ, cachesnap_fpr_cmp);
+	for (size_t k = 0; k < i; k++) {
+		if (!j || memcmp(fprs[j - 1], fprs[k], SSL_X509_FPRSZ))
+			memmove(fprs[j++], fprs[k], SSL_X509_FPRSZ);
+	}
+	rv = EVP_Digest(fprs, j * SSL_X509_FPRSZ, caid, NULL, EVP_sha1(), NULL) ? 0 : -1;
+	free(fprs);
+	return rv;
+err:
+	free(fprs);
+	return -1;
+}
+
+static int
+cachesnap_keycmp(const unsigned char *key1, size_t keysz1,
+                 const unsigned char *key2, size_t keysz2)
+{
+	if (keysz1 != keysz2)
+		return keysz1 < keysz2 ? -1 : 1;
+	return memcmp(key1, key2, keysz1);
+}
+
+/*
+ * Binary search for key in the sorted entries of the mapped snapshot.
+ */
+static const cachesnap_ent_t *
+cachesnap_find(const cachesnap_ent_t *ents, uint32_t n,
+               const unsigned char *key, size_t keysz)
+{
+	size_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int c = cachesnap_keycmp((unsigned char *)snap + ents[mid].keyoff,
+		                         ents[mid].keysz, key, keysz);
+		if (!c)
+			return &ents[mid];
+		if (c < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/*
+ * Check the header and all the offsets of a snapshot of sz bytes at p.
+ */
+static int
+cachesnap_check(const char *p, size_t sz)
+{
+	const cachesnap_hdr_t *hdr = (const cachesnap_hdr_t *)p;
+	const cachesnap_ent_t *ents;
+	uint64_t tblsz;
+
+	if (sz < sizeof(cachesnap_hdr_t) ||
+	    memcmp(hdr->magic, CACHESNAP_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != CACHESNAP_VERSION ||
+	    hdr->entsz != sizeof(cachesnap_ent_t) ||
+	    hdr->size != sz)
+		return -1;
+	tblsz = ((uint64_t)hdr->nfkcrt + hdr->ndsess) * sizeof(cachesnap_ent_t);
+	if (sizeof(cachesnap_hdr_t) + tblsz > sz ||
+	    (uint64_t)hdr->keyoff + hdr->keysz > sz)
+		return -1;
+	ents = (const cachesnap_ent_t *)(p + sizeof(cachesnap_hdr_t));
+	for (uint64_t i = 0; i < (uint64_t)hdr->nfkcrt + hdr->ndsess; i++) {
+		if ((uint64_t)ents[i].keyoff + ents[i].keysz > sz ||
+		    (uint64_t)ents[i].valoff + ents[i].valsz > sz)
+			return -1;
+		if (i < hdr->nfkcrt && ents[i].keysz != SSL_X509_FPRSZ)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Map the snapshot file, if any, and use its leaf key if none is configured.
+ * An unusable snapshot is ignored.  Must be called before dropping privs and
+ * before generating the leaf key.
+ * Returns -1 on fatal errors, 0 otherwise.
+ */
+int
+cachesnap_load(global_t *global)
+{
+	const cachesnap_hdr_t *hdr;
+	unsigned char keyid[SSL_KEY_IDSZ];
+	unsigned char caid[SSL_X509_FPRSZ];
+	struct stat st;
+	uint32_t nfkcrt;
+	char *p;
+	int fd;
+
+	if ((fd = open(global->cachesnap, O_RDONLY)) == -1) {
+		if (errno != ENOENT) {
+			log_err_level_printf(LOG_WARNING, "Failed to open cache snapshot '%s': %s (%i)\n",
+			               global->cachesnap, strerror(errno), errno);
+		}
+		return 0;
+	}
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(cachesnap_hdr_t)) {
+		log_err_level_printf(LOG_WARNING, "Ignoring invalid cache snapshot '%s'\n",
+		               global->cachesnap);
+		close(fd);
+		return 0;
+	}
+	if (st.st_mode & (S_IRWXG|S_IRWXO)) {
+		log_err_level_printf(LOG_WARNING, "Cache snapshot '%s' holds the leaf key, but is"
+		               " accessible by other users until it is next written\n",
+		               global->cachesnap);
+	}
+	// Stays valid after chroot and privdrop, and after the file is replaced
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		log_err_level_printf(LOG_WARNING, "Failed to map cache snapshot '%s': %s (%i)\n",
+		               global->cachesnap, strerror(errno), errno);
+		return 0;
+	}
+	if (cachesnap_check(p, st.st_size) == -1) {
+		log_err_level_printf(LOG_WARNING, "Ignoring invalid cache snapshot '%s'\n",
+		               global->cachesnap);
+		munmap(p, st.st_size);
+		return 0;
+	}
+	hdr = (const cachesnap_hdr_t *)p;
+	nfkcrt = hdr->nfkcrt;
+
+	if (!global->key && hdr->keysz &&
+	    global_has_ssl_spec(global) && global_has_cakey_spec(global)) {
+		const unsigned char *kp = (const unsigned char *)p + hdr->keyoff;
+		global->key = d2i_AutoPrivateKey(NULL, &kp, hdr->keysz);
+		if (global->key && OPTS_DEBUG(global)) {
+			log_dbg_printf("Using leaf key from cache snapshot\n");
+		}
+	}
+	memset(keyid, 0, sizeof(keyid));
+	if (global->key && ssl_key_identifier_sha1(global->key, keyid) == -1)
+		goto err;
+	if (cachesnap_caid(global, caid) == -1)
+		goto err;
+	if (nfkcrt && (memcmp(hdr->keyid, keyid, sizeof(keyid)) ||
+	               memcmp(hdr->caid, caid, sizeof(caid)))) {
+		log_err_level_printf(LOG_WARNING, "Ignoring forged certs in cache snapshot "
+		               "written for a different leaf key or CA\n");
+		nfkcrt = 0;
+	}
+
+	pthread_mutex_lock(&snap_mutex);
+	snap = p;
+	snapsz = st.st_size;
+	snap_fkcrt = (const cachesnap_ent_t *)(p + sizeof(cachesnap_hdr_t));
+	snap_dsess = snap_fkcrt + hdr->nfkcrt;
+	snap_nfkcrt = nfkcrt;
+	snap_ndsess = hdr->ndsess;
+	pthread_mutex_unlock(&snap_mutex);
+
+	if (OPTS_DEBUG(global)) {
+		log_dbg_printf("Mapped cache snapshot '%s': %u forged certs, %u dst sessions\n",
+		               global->cachesnap, snap_nfkcrt, snap_ndsess);
+	}
+	return 0;
+err:
+	munmap(p, st.st_size);
+	return -1;
+}
+
+/*
+ * Set the leaf key and CA certs which new snapshots are written for.
+ * Returns -1 on error, 0 on success.
+ */
+int
+cachesnap_setkeys(global_t *global)
+{
+	unsigned char keyid[SSL_KEY_IDSZ];
+	unsigned char caid[SSL_X509_FPRSZ];
+	unsigned char *key = NULL;
+	int keysz = 0;
+
+	memset(keyid, 0, sizeof(keyid));
+	if (cachesnap_caid(global, caid) == -1)
+		return -1;
+	if (global->key) {
+		if (ssl_key_identifier_sha1(global->key, keyid) == -1)
+			return -1;
+		if ((keysz = i2d_PrivateKey(global->key, &key)) <= 0)
+			return -1;
+	}
+
+	pthread_mutex_lock(&snap_mutex);
+	if (cur_key)
+		OPENSSL_free(cur_key);
+	cur_key = key;
+	cur_keysz = keysz;
+	memcpy(cur_keyid, keyid, sizeof(cur_keyid));
+	memcpy(cur_caid, caid, sizeof(cur_caid));
+	pthread_mutex_unlock(&snap_mutex);
+	return 0;
+}
+
+/*
+ * Start looking up cache misses in the snapshot, and writing snapshots using
+ * privsep client socket clisock.  Must be called after cachemgr_init().
+ * Returns -1 on error, 0 on success.
+ */
+int
+cachesnap_init(global_t *global, int clisock)
+{
+	if (!(snapfn = strdup(global->cachesnap)))
+		return -1;
+	if (cachesnap_setkeys(global) == -1)
+		return -1;
+	snap_clisock = clisock;
+	cachemgr_fkcrt->miss_cb = cachesnap_fkcrt_miss_cb;
+	cachemgr_dsess->miss_cb = cachesnap_dsess_miss_cb;
+	return 0;
+}
+
+/*
+ * Unmap the snapshot, e.g. when a reload invalidates its forged certs.
+ */
+void
+cachesnap_drop(void)
+{
+	pthread_mutex_lock(&snap_mutex);
+	if (snap) {
+		munmap(snap, snapsz);
+		snap = NULL;
+		snapsz = 0;
+		snap_nfkcrt = snap_ndsess = 0;
+	}
+	pthread_mutex_unlock(&snap_mutex);
+}
+
+cache_val_t
+cachesnap_fkcrt_miss_cb(cache_key_t key)
+{
+	const cachesnap_ent_t *e;
+	crtrec_t *rec = NULL;
+	X509 *crt = NULL;
+
+	pthread_mutex_lock(&snap_mutex);
+	if (snap_nfkcrt &&
+	    (e = cachesnap_find(snap_fkcrt, snap_nfkcrt, key, SSL_X509_FPRSZ)) &&
+	    e->expires > time(NULL)) {
+		const unsigned char *p = (const unsigned char *)snap + e->valoff;
+		crt = d2i_X509(NULL, &p, e->valsz);
+	}
+	pthread_mutex_unlock(&snap_mutex);
+	if (crt) {
+		/* the rest of the record is derived on first use */
+		rec = crtrec_new(crt);
+		X509_free(crt);
+	}
+	return rec;
+}
+
+cache_val_t
+cachesnap_dsess_miss_cb(cache_key_t key)
+{
+	const cachesnap_ent_t *e;
+	dynbuf_t *db = key;
+	dynbuf_t *val = NULL;
+
+	pthread_mutex_lock(&snap_mutex);
+	if (snap_ndsess &&
+	    (e = cachesnap_find(snap_dsess, snap_ndsess, db->buf, db->sz)) &&
+	    e->expires > time(NULL)) {
+		val = dynbuf_new_copy((unsigned char *)snap + e->valoff, e->valsz);
+	}
+	pthread_mutex_unlock(&snap_mutex);
+	return val;
+}
+
+static int
+cachesnap_items_add(cachesnap_items_t *items, unsigned char *key, size_t keysz,
+                    unsigned char *val, size_t valsz, int64_t expires)
+{
+	if (items->count == items->size) {
+		size_t size = items->size ? items->size * 2 : 256;
+		cachesnap_item_t *p = realloc(items->items, size * sizeof(cachesnap_item_t));
+		if (!p)
+			return -1;
+		items->items = p;
+		items->size = size;
+	}
+	items->items[items->count].key = key;
+	items->items[items->count].keysz = keysz;
+	items->items[items->count].val = val;
+	items->items[items->count].valsz = valsz;
+	items->items[items->count].expires = expires;
+	items->count++;
+	return 0;
+}
+
+static void
+cachesnap_items_free(cachesnap_items_t *items)
+{
+	for (size_t i = 0; i < items->count; i++) {
+		free(items->items[i].key);
+		if (items->items[i].val)
+			OPENSSL_free(items->items[i].val);
+	}
+	free(items->items);
+}
+
+static int
+cachesnap_item_cmp(const void *a, const void *b)
+{
+	const cachesnap_item_t *i1 = a, *i2 = b;
+	return cachesnap_keycmp(i1->key, i1->keysz, i2->key, i2->keysz);
+}
+
+/*
+ * Collect the forged certs of the records, keeping a reference; they are
+ * serialized later.
+ */
+static void
+cachesnap_fkcrt_foreach_cb(cache_key_t key, cache_val_t val, void *arg)
+{
+	cachesnap_items_t *items = arg;
+	crtrec_t *rec = val;
+	unsigned char *k;
+
+	if (items->count == items->size) {
+		X509 **crts = realloc(items->crts, (items->size ? items->size * 2 : 256) * sizeof(X509 *));
+		if (!crts)
+			return;
+		items->crts = crts;
+	}
+	if (!(k = malloc(SSL_X509_FPRSZ)))
+		return;
+	memcpy(k, key, SSL_X509_FPRSZ);
+	if (cachesnap_items_add(items, k, SSL_X509_FPRSZ, NULL, 0, 0) == -1) {
+		free(k);
+		return;
+	}
+	ssl_x509_refcount_inc(rec->crt);
+	items->crts[items->count - 1] = rec->crt;
+}
+
+static void
+cachesnap_dsess_foreach_cb(cache_key_t key, cache_val_t val, void *arg)
+{
+	cachesnap_items_t *items = arg;
+	dynbuf_t *kdb = key, *vdb = val;
+	unsigned char *k, *v;
+
+	if (!(k = malloc(kdb->sz)))
+		return;
+	if (!(v = OPENSSL_malloc(vdb->sz))) {
+		free(k);
+		return;
+	}
+	memcpy(k, kdb->buf, kdb->sz);
+	memcpy(v, vdb->buf, vdb->sz);
+	if (cachesnap_items_add(items, k, kdb->sz, v, vdb->sz, 0) == -1) {
+		free(k);
+		OPENSSL_free(v);
+	}
+}
+
+/*
+ * Serialize the collected forged certs, dropping expired ones.
+ */
+static void
+cachesnap_fkcrt_serialize(cachesnap_items_t *items, time_t now)
+{
+	for (size_t i = 0; i < items->count; i++) {
+		cachesnap_item_t *item = &items->items[i];
+		X509 *crt = items->crts[i];
+		int day, sec, sz;
+
+		if (ASN1_TIME_diff(&day, &sec, NULL, X509_get_notAfter(crt)) &&
+		    (day > 0 || (day == 0 && sec > 0)) &&
+		    (sz = i2d_X509(crt, &item->val)) > 0) {
+			item->valsz = sz;
+			item->expires = (int64_t)now + (int64_t)day * 86400 + sec;
+		}
+		X509_free(crt);
+	}
+	free(items->crts);
+	items->crts = NULL;
+}
+
+/*
+ * Set the expiry times of the collected dst sessions.
+ */
+static void
+cachesnap_dsess_serialize(cachesnap_items_t *items, time_t now)
+{
+	for (size_t i = 0; i < items->count; i++) {
+		cachesnap_item_t *item = &items->items[i];
+		const unsigned char *p = item->val;
+		SSL_SESSION *sess = d2i_SSL_SESSION(NULL, &p, item->valsz);
+
+		if (sess) {
+			item->expires = (int64_t)SSL_SESSION_get_time(sess) +
+			                SSL_SESSION_get_timeout(sess);
+			SSL_SESSION_free(sess);
+		}
+		if (item->expires <= now) {
+			OPENSSL_free(item->val);
+			item->val = NULL;
+		}
+	}
+}
+
+/*
+ * Add the entries of the mapped snapshot which are not in the cache, so that
+ * the entries not used since startup are not lost.  Call with snap_mutex
+ * held.
+ */
+static void
+cachesnap_merge(cachesnap_items_t *items, const cachesnap_ent_t *ents,
+                uint32_t n, time_t now)
+{
+	size_t count = items->count;
+
+	for (uint32_t i = 0; i < n; i++) {
+		const cachesnap_ent_t *e = &ents[i];
+		cachesnap_item_t tmp;
+		unsigned char *k, *v;
+
+		if (e->expires <= now)
+			continue;
+		tmp.key = (unsigned char *)snap + e->keyoff;
+		tmp.keysz = e->keysz;
+		// Only the collected entries are sorted and searched
+		if (bsearch(&tmp, items->items, count, sizeof(cachesnap_item_t), cachesnap_item_cmp))
+			continue;
+		if (!(k = malloc(e->keysz)))
+			return;
+		if (!(v = OPENSSL_malloc(e->valsz))) {
+			free(k);
+			return;
+		}
+		memcpy(k, snap + e->keyoff, e->keysz);
+		memcpy(v, snap + e->valoff, e->valsz);
+		if (cachesnap_items_add(items, k, e->keysz, v, e->valsz, e->expires) == -1) {
+			free(k);
+			OPENSSL_free(v);
+			return;
+		}
+	}
+}
+
+/*
+ * Append the entry table of items to buf at *tbloff, and their data at
+ * *dataoff.  Items without a val are skipped.  Returns the number of entries.
+ */
+static uint32_t
+cachesnap_put(char *buf, size_t *tbloff, size_t *dataoff, cachesnap_items_t *items)
+{
+	uint32_t n = 0;
+
+	for (size_t i = 0; i < items->count; i++) {
+		cachesnap_item_t *item = &items->items[i];
+		cachesnap_ent_t e;
+
+		if (!item->val)
+			continue;
+		e.keyoff = *dataoff;
+		e.keysz = item->keysz;
+		memcpy(buf + *dataoff, item->key, item->keysz);
+		*dataoff += item->keysz;
+		e.valoff = *dataoff;
+		e.valsz = item->valsz;
+		memcpy(buf + *dataoff, item->val, item->valsz);
+		*dataoff += item->valsz;
+		e.expires = item->expires;
+		memcpy(buf + *tbloff, &e, sizeof(e));
+		*tbloff += sizeof(e);
+		n++;
+	}
+	return n;
+}
+
+static size_t
+cachesnap_datasz(cachesnap_items_t *items, uint32_t *n)
+{
+	size_t sz = 0;
+
+	*n = 0;
+	for (size_t i = 0; i < items->count; i++) {
+		if (items->items[i].val) {
+			sz += items->items[i].keysz + items->items[i].valsz;
+			(*n)++;
+		}
+	}
+	return sz;
+}
+
+/*
+ * Write a snapshot of the caches, blocking until done.
+ * Returns -1 on error, 0 on success.
+ */
+int
+cachesnap_write(void)
+{
+	cachesnap_items_t fkcrt, dsess;
+	cachesnap_hdr_t hdr;
+	time_t now = time(NULL);
+	uint32_t nfkcrt, ndsess;
+	size_t sz, tbloff, dataoff;
+	char *buf = NULL;
+	int fd, rv = -1;
+
+	if (!snapfn)
+		return 0;
+
+	memset(&fkcrt, 0, sizeof(fkcrt));
+	memset(&dsess, 0, sizeof(dsess));
+	cache_foreach(cachemgr_fkcrt, cachesnap_fkcrt_foreach_cb, &fkcrt);
+	cache_foreach(cachemgr_dsess, cachesnap_dsess_foreach_cb, &dsess);
+	cachesnap_fkcrt_serialize(&fkcrt, now);
+	cachesnap_dsess_serialize(&dsess, now);
+
+	qsort(fkcrt.items, fkcrt.count, sizeof(cachesnap_item_t), cachesnap_item_cmp);
+	qsort(dsess.items, dsess.count, sizeof(cachesnap_item_t), cachesnap_item_cmp);
+
+	pthread_mutex_lock(&snap_mutex);
+	cachesnap_merge(&fkcrt, snap_fkcrt, snap_nfkcrt, now);
+	cachesnap_merge(&dsess, snap_dsess, snap_ndsess, now);
+	pthread_mutex_unlock(&snap_mutex);
+
+	qsort(fkcrt.items, fkcrt.count, sizeof(cachesnap_item_t), cachesnap_item_cmp);
+	qsort(dsess.items, dsess.count, sizeof(cachesnap_item_t), cachesnap_item_cmp);
+
+	pthread_mutex_lock(&snap_mutex);
+	sz = sizeof(cachesnap_hdr_t) + cur_keysz;
+	sz += cachesnap_datasz(&fkcrt, &nfkcrt);
+	sz += cachesnap_datasz(&dsess, &ndsess);
+	sz += ((size_t)nfkcrt + ndsess) * sizeof(cachesnap_ent_t);
+	if (sz > UINT32_MAX || !(buf = malloc(sz))) {
+		pthread_mutex_unlock(&snap_mutex);
+		log_err_level_printf(LOG_WARNING, "Cache snapshot too large: %zu bytes\n", sz);
+		goto out;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CACHESNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = CACHESNAP_VERSION;
+	hdr.entsz = sizeof(cachesnap_ent_t);
+	hdr.nfkcrt = nfkcrt;
+	hdr.ndsess = ndsess;
+	hdr.keyoff = sizeof(cachesnap_hdr_t) + ((size_t)nfkcrt + ndsess) * sizeof(cachesnap_ent_t);
+	hdr.keysz = cur_keysz;
+	hdr.size = sz;
+	memcpy(hdr.keyid, cur_keyid, sizeof(hdr.keyid));
+	memcpy(hdr.caid, cur_caid, sizeof(hdr.caid));
+	memcpy(buf, &hdr, sizeof(hdr));
+	if (cur_keysz)
+		memcpy(buf + hdr.keyoff, cur_key, cur_keysz);
+	pthread_mutex_unlock(&snap_mutex);
+
+	tbloff = sizeof(cachesnap_hdr_t);
+	dataoff = hdr.keyoff + hdr.keysz;
+	cachesnap_put(buf, &tbloff, &dataoff, &fkcrt);
+	cachesnap_put(buf, &tbloff, &dataoff, &dsess);
+
+	if ((fd = privsep_client_snapfile(snap_clisock, snapfn, 0)) == -1) {
+		log_err_level_printf(LOG_WARNING, "Failed to open cache snapshot '%s.tmp': %s (%i)\n",
+		               snapfn, strerror(errno), errno);
+		goto out;
+	}
+	for (size_t off = 0; off < sz;) {
+		ssize_t n = write(fd, buf + off, sz - off);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			log_err_level_printf(LOG_WARNING, "Failed to write cache snapshot '%s.tmp': %s (%i)\n",
+			               snapfn, strerror(errno), errno);
+			close(fd);
+			goto out;
+		}
+		off += n;
+	}
+	close(fd);
+	if (privsep_client_snapfile(snap_clisock, snapfn, 1) == -1) {
+		log_err_level_printf(LOG_WARNING, "Failed to replace cache snapshot '%s': %s (%i)\n",
+		               snapfn, strerror(errno), errno);
+		goto out;
+	}
+	log_dbg_printf("Wrote cache snapshot: %u forged certs, %u dst sessions, %zu bytes\n",
+	               nfkcrt, ndsess, sz);
+	rv = 0;
+out:
+	free(buf);
+	cachesnap_items_free(&fkcrt);
+	cachesnap_items_free(&dsess);
+	return rv;
+}
+
+static void *
+cachesnap_write_thr(UNUSED void *arg)
+{
+	if (cachesnap_write() == -1) {
+		log_err_level_printf(LOG_WARNING, "Failed to write cache snapshot\n");
+	}
+	__atomic_store_n(&write_thr_running, 0, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Write a snapshot in a background thread, unless one is being written.
+ * Call from the main thread only.
+ */
+void
+cachesnap_write_bg(void)
+{
+	int rv;
+
+	if (!snapfn || __atomic_load_n(&write_thr_running, __ATOMIC_ACQUIRE))
+		return;
+	if (write_thr_started) {
+		pthread_join(write_thr, NULL);
+		write_thr_started = 0;
+	}
+	write_thr_running = 1;
+	rv = pthread_create(&write_thr, NULL, cachesnap_write_thr, NULL);
+	if (rv) {
+		log_err_level_printf(LOG_CRIT, "cachesnap_write_bg: pthread_create failed: %s\n",
+		               strerror(rv));
+		write_thr_running = 0;
+		return;
+	}
+	write_thr_started = 1;
+}
+
+/*
+ * Write a last snapshot and release all resources.  Must be called before
+ * cachemgr_fini().
+ */
+void
+cachesnap_fini(void)
+{
+	if (write_thr_started) {
+		pthread_join(write_thr, NULL);
+		write_thr_started = 0;
+	}
+	if (snapfn) {
+		if (cachesnap_write() == -1) {
+			log_err_level_printf(LOG_WARNING, "Failed to write cache snapshot\n");
+		}
+		free(snapfn);
+		snapfn = NULL;
+	}
+	if (snap_clisock != -1) {
+		privsep_client_close(snap_clisock);
+		snap_clisock = -1;
+	}
+	cachesnap_drop();
+	pthread_mutex_lock(&snap_mutex);
+	if (cur_key) {
+		OPENSSL_free(cur_key);
+		cur_key = NULL;
+	}
+	pthread_mutex_unlock(&snap_mutex);
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,222 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "cachesnicrt.h"
+
+#include "dynbuf.h"
+#include "ssl.h"
+#include "khash.h"
+
+#include <netinet/in.h>
+
+/*
+ * Cache for the forged certs last served for an SNI, used to complete the
+ * client handshake before the server handshake.
+ *
+ * key: dynbuf_t *  original destination IP address, port and SNI string
+ * val: crtrec_t *  record of the forged cert, with the original cert data
+ */
+
+static inline khint_t
+kh_dynbuf_hash_func(dynbuf_t *b)
+{
+	khint_t *p = (khint_t *)b->buf;
+	khint_t h = 0;
+	int rem;
+
+	if ((rem = b->sz % sizeof(khint_t))) {
+		memcpy(&h, b->buf + b->sz - rem, rem);
+	}
+
+	while (p < (khint_t*)(b->buf + b->sz - rem)) {
+		h ^= *p++;
+	}
+
+	return h;
+}
+
+#define kh_dynbuf_hash_equal(a, b) \
+        (((a)->sz == (b)->sz) && \
+         (memcmp((a)->buf, (b)->buf, (a)->sz) == 0))
+
+KHASH_INIT(dynbufmap_t, dynbuf_t*, void*, 1, kh_dynbuf_hash_func,
+           kh_dynbuf_hash_equal)
+
+static khash_t(dynbufmap_t) *snicrtmap;
+
+static cache_iter_t
+cachesnicrt_begin_cb(void)
+{
+	return kh_begin(snicrtmap);
+}
+
+static cache_iter_t
+cachesnicrt_end_cb(void)
+{
+	return kh_end(snicrtmap);
+}
+
+static int
+cachesnicrt_exist_cb(cache_iter_t it)
+{
+	return kh_exist(snicrtmap, it);
+}
+
+static void
+cachesnicrt_del_cb(cache_iter_t it)
+{
+	kh_del(dynbufmap_t, snicrtmap, it);
+}
+
+static cache_iter_t
+cachesnicrt_get_cb(cache_key_t key)
+{
+	return kh_get(dynbufmap_t, snicrtmap, key);
+}
+
+static cache_iter_t
+cachesnicrt_put_cb(cache_key_t key, int *ret)
+{
+	return kh_put(dynbufmap_t, snicrtmap, key, ret);
+}
+
+static void
+cachesnicrt_free_key_cb(cache_key_t key)
+{
+	dynbuf_free(key);
+}
+
+static void
+cachesnicrt_free_val_cb(cache_val_t val)
+{
+	crtrec_free(val);
+}
+
+static cache_key_t
+cachesnicrt_get_key_cb(cache_iter_t it)
+{
+	return kh_key(snicrtmap, it);
+}
+
+static cache_val_t
+cachesnicrt_get_val_cb(cache_iter_t it)
+{
+	return kh_val(snicrtmap, it);
+}
+
+static void
+cachesnicrt_set_val_cb(cache_iter_t it, cache_val_t val)
+{
+	kh_val(snicrtmap, it) = val;
+}
+
+static cache_val_t
+cachesnicrt_unpackverify_val_cb(cache_val_t val, int copy)
+{
+	crtrec_t *rec = val;
+
+	/* records without the original cert data cannot be verified against
+	 * the server cert */
+	if (!rec->have_orig || !ssl_x509_is_valid(rec->crt))
+		return NULL;
+	if (copy) {
+		crtrec_refcount_inc(rec);
+		return val;
+	}
+	return ((void*)-1);
+}
+
+static void
+cachesnicrt_fini_cb(void)
+{
+	kh_destroy(dynbufmap_t, snicrtmap);
+}
+
+void
+cachesnicrt_init_cb(cache_t *cache)
+{
+	snicrtmap = kh_init(dynbufmap_t);
+
+	cache->begin_cb                 = cachesnicrt_begin_cb;
+	cache->end_cb                   = cachesnicrt_end_cb;
+	cache->exist_cb                 = cachesnicrt_exist_cb;
+	cache->del_cb                   = cachesnicrt_del_cb;
+	cache->get_cb                   = cachesnicrt_get_cb;
+	cache->put_cb                   = cachesnicrt_put_cb;
+	cache->free_key_cb              = cachesnicrt_free_key_cb;
+	cache->free_val_cb              = cachesnicrt_free_val_cb;
+	cache->get_key_cb               = cachesnicrt_get_key_cb;
+	cache->get_val_cb               = cachesnicrt_get_val_cb;
+	cache->set_val_cb               = cachesnicrt_set_val_cb;
+	cache->unpackverify_val_cb      = cachesnicrt_unpackverify_val_cb;
+	cache->fini_cb                  = cachesnicrt_fini_cb;
+}
+
+cache_key_t
+cachesnicrt_mkkey(const struct sockaddr *addr, UNUSED const socklen_t addrlen,
+                  const char *sni)
+{
+	dynbuf_t tmp, *db;
+	short port;
+	size_t snilen;
+
+	switch (((struct sockaddr_storage *)addr)->ss_family) {
+		case AF_INET:
+			tmp.buf = (unsigned char *)
+			          &((struct sockaddr_in*)addr)->sin_addr;
+			tmp.sz = sizeof(struct in_addr);
+			port = ((struct sockaddr_in*)addr)->sin_port;
+			break;
+		case AF_INET6:
+			tmp.buf = (unsigned char *)
+			          &((struct sockaddr_in6*)addr)->sin6_addr;
+			tmp.sz = sizeof(struct in6_addr);
+			port = ((struct sockaddr_in6*)addr)->sin6_port;
+			break;
+		default:
+			return NULL;
+	}
+
+	snilen = strlen(sni);
+	if (!(db = dynbuf_new_alloc(tmp.sz + sizeof(port) + snilen)))
+		return NULL;
+	memcpy(db->buf, tmp.buf, tmp.sz);
+	memcpy(db->buf + tmp.sz, (char*)&port, sizeof(port));
+	memcpy(db->buf + tmp.sz + sizeof(port), sni, snilen);
+	return db;
+}
+
+cache_val_t
+cachesnicrt_mkval(crtrec_t *rec)
+{
+	crtrec_refcount_inc(rec);
+	return rec;
+}
+
+/* vim: set noet ft=c: */
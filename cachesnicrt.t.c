@@ -0,0 +1,160 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ssl.h"
+#include "cachemgr.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include <check.h>
+
+#define TESTCERT "extra/pki/targets/daniel.roe.ch.pem"
+
+static X509 *crt;
+static struct sockaddr_storage addr;
+static socklen_t addrlen;
+static char sni[] = "daniel.roe.ch";
+static char sni2[] = "www.roe.ch";
+
+static void
+cachemgr_setup(void)
+{
+	if ((ssl_init() == -1) || (cachemgr_preinit() == -1) ||
+	    !(crt = ssl_x509_load(TESTCERT)))
+		exit(EXIT_FAILURE);
+	addrlen = sizeof(struct sockaddr_in);
+	memset(&addr, 0, addrlen);
+	addr.ss_family = AF_INET;
+}
+
+static void
+cachemgr_teardown(void)
+{
+	X509_free(crt);
+	cachemgr_fini();
+	ssl_fini();
+}
+
+static crtrec_t *
+crtrec_new_orig(void)
+{
+	crtrec_t *rec;
+
+	rec = crtrec_new(crt);
+	if (rec && crtrec_set_orig(rec, crt) == -1) {
+		crtrec_free(rec);
+		return NULL;
+	}
+	return rec;
+}
+
+START_TEST(cache_snicrt_01)
+{
+	crtrec_t *r1, *r2;
+
+	r1 = crtrec_new_orig();
+	fail_unless(!!r1, "creating record failed");
+	cachemgr_snicrt_set((struct sockaddr*)&addr, addrlen, sni, r1);
+	fail_unless(r1->references == 2, "cache did not take a reference");
+	r2 = cachemgr_snicrt_get((struct sockaddr*)&addr, addrlen, sni);
+	fail_unless(!!r2, "cache did not return a record");
+	fail_unless(r2 == r1, "cache did not return same pointer");
+	fail_unless(r1->references == 3, "cache did not return a reference");
+	crtrec_free(r2);
+	crtrec_free(r1);
+}
+END_TEST
+
+START_TEST(cache_snicrt_02)
+{
+	crtrec_t *r1, *r2;
+
+	r1 = crtrec_new_orig();
+	fail_unless(!!r1, "creating record failed");
+	cachemgr_snicrt_set((struct sockaddr*)&addr, addrlen, sni, r1);
+	r2 = cachemgr_snicrt_get((struct sockaddr*)&addr, addrlen, sni2);
+	fail_unless(r2 == NULL, "cache returned record for other SNI");
+	((struct sockaddr_in *)&addr)->sin_port = htons(443);
+	r2 = cachemgr_snicrt_get((struct sockaddr*)&addr, addrlen, sni);
+	fail_unless(r2 == NULL, "cache returned record for other port");
+	crtrec_free(r1);
+}
+END_TEST
+
+START_TEST(cache_snicrt_03)
+{
+	crtrec_t *r1, *r2;
+
+	r1 = crtrec_new_orig();
+	fail_unless(!!r1, "creating record failed");
+	cachemgr_snicrt_set((struct sockaddr*)&addr, addrlen, sni, r1);
+	cachemgr_snicrt_del((struct sockaddr*)&addr, addrlen, sni);
+	fail_unless(r1->references == 1, "cache did not release the record");
+	r2 = cachemgr_snicrt_get((struct sockaddr*)&addr, addrlen, sni);
+	fail_unless(r2 == NULL, "cache returned deleted record");
+	crtrec_free(r1);
+}
+END_TEST
+
+START_TEST(cache_snicrt_04)
+{
+	crtrec_t *r1, *r2;
+
+	/* records without the orig cert data cannot be verified */
+	r1 = crtrec_new(crt);
+	fail_unless(!!r1, "creating record failed");
+	cachemgr_snicrt_set((struct sockaddr*)&addr, addrlen, sni, r1);
+	r2 = cachemgr_snicrt_get((struct sockaddr*)&addr, addrlen, sni);
+	fail_unless(r2 == NULL, "cache returned record without orig data");
+	crtrec_free(r1);
+}
+END_TEST
+
+Suite *
+cachesnicrt_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("cachesnicrt");
+
+	tc = tcase_create("cache_snicrt");
+	tcase_add_checked_fixture(tc, cachemgr_setup, cachemgr_teardown);
+	tcase_add_test(tc, cache_snicrt_01);
+	tcase_add_test(tc, cache_snicrt_02);
+	tcase_add_test(tc, cache_snicrt_03);
+	tcase_add_test(tc, cache_snicrt_04);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
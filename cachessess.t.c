@@ -161,6 +161,29 @@ START_TEST(cache_ssess_04)
 END_TEST
 #endif
 
+START_TEST(cache_ssess_05)
+{
+	SSL_SESSION *s1, *s2;
+	const unsigned char* session_id;
+	unsigned int len;
+
+	s1 = ssl_session_from_file(TMP_SESS_FILE);
+	fail_unless(!!s1, "creating session failed");
+	fail_unless(ssl_session_is_valid(s1), "session invalid");
+
+	cachemgr_ssess_set(s1);
+	cache_flush(cachemgr_ssess);
+	session_id = SSL_SESSION_get_id(s1, &len);
+	s2 = cachemgr_ssess_get(session_id, len);
+	fail_unless(s2 == NULL, "cache returned flushed session");
+	cachemgr_ssess_set(s1);
+	s2 = cachemgr_ssess_get(session_id, len);
+	fail_unless(!!s2, "cache returned no session after flush");
+	SSL_SESSION_free(s1);
+	SSL_SESSION_free(s2);
+}
+END_TEST
+
 Suite *
 cachessess_suite(void)
 {
@@ -177,6 +200,7 @@ cachessess_suite(void)
 #if (OPENSSL_VERSION_NUMBER < 0x10100000L) || defined(LIBRESSL_VERSION_NUMBER)
 	tcase_add_test(tc, cache_ssess_04);
 #endif
+	tcase_add_test(tc, cache_ssess_05);
 	suite_add_tcase(s, tc);
 
 	return s;
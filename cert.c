@@ -32,6 +32,8 @@
 
 #include <string.h>
 
+#include <openssl/pem.h>
+
 /*
  * Certificate, including private key and certificate chain.
  */
@@ -134,6 +136,57 @@ cert_new_load(const char *filename)
 	return c;
 }
 
+/*
+ * Load cert_t from PEM data in memory, such as a region of a mapped file.
+ * As with cert_new_load(), the first certificate is the leaf and the rest
+ * are the chain; the key may appear anywhere.
+ */
+cert_t *
+cert_new_load_mem(const void *buf, size_t len)
+{
+	STACK_OF(X509_INFO) *infos;
+	cert_t *c;
+	BIO *bio;
+
+	if (!(bio = BIO_new_mem_buf((void *)buf, len)))
+		return NULL;
+	infos = PEM_X509_INFO_read_bio(bio, NULL, NULL, NULL);
+	BIO_free(bio);
+	if (!infos)
+		return NULL;
+
+	if (!(c = cert_new()))
+		goto out;
+	if (!(c->chain = sk_X509_new_null()))
+		goto err;
+	for (int i = 0; i < sk_X509_INFO_num(infos); i++) {
+		X509_INFO *info = sk_X509_INFO_value(infos, i);
+
+		if (info->x509) {
+			if (!c->crt) {
+				c->crt = info->x509;
+			} else if (!sk_X509_push(c->chain, info->x509)) {
+				goto err;
+			}
+			info->x509 = NULL;
+		}
+		if (info->x_pkey && info->x_pkey->dec_pkey && !c->key) {
+			c->key = info->x_pkey->dec_pkey;
+			info->x_pkey->dec_pkey = NULL;
+		}
+	}
+	if (!c->crt || !c->key)
+		goto err;
+	goto out;
+
+err:
+	cert_free(c);
+	c = NULL;
+out:
+	sk_X509_INFO_pop_free(infos, X509_INFO_free);
+	return c;
+}
+
 /*
  * Increment reference count.
  */
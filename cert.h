@@ -44,6 +44,7 @@ typedef struct cert {
 
 cert_t * cert_new(void) MALLOC;
 cert_t * cert_new_load(const char *) MALLOC;
+cert_t * cert_new_load_mem(const void *, size_t) MALLOC;
 cert_t * cert_new3(EVP_PKEY *, X509 *, STACK_OF(X509) *) MALLOC;
 cert_t * cert_new3_copy(EVP_PKEY *, X509 *, STACK_OF(X509) *) MALLOC;
 void cert_refcount_inc(cert_t *) NONNULL(1);
@@ -0,0 +1,174 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "crtrec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Forged certificate record.
+ */
+
+/*
+ * Create a record of crt, taking a reference on crt.
+ * Returns NULL on out of memory.
+ */
+crtrec_t *
+crtrec_new(X509 *crt)
+{
+	crtrec_t *rec;
+
+	if (!(rec = malloc(sizeof(crtrec_t))))
+		return NULL;
+	memset(rec, 0, sizeof(crtrec_t));
+	if (pthread_mutex_init(&rec->mutex, NULL)) {
+		free(rec);
+		return NULL;
+	}
+	if (ssl_x509_fingerprint_buf(crt, rec->usedfpr) == -1) {
+		pthread_mutex_destroy(&rec->mutex);
+		free(rec);
+		return NULL;
+	}
+	ssl_x509_refcount_inc(crt);
+	rec->crt = crt;
+	rec->references = 1;
+	return rec;
+}
+
+/*
+ * Derive the fingerprint and names of the original server cert origcrt,
+ * unless done before.  All the original certs of a record are the same,
+ * since the fkcrt cache is keyed by their fingerprint; records loaded from
+ * a cache snapshot get these on first use.
+ * Returns -1 on out of memory, 0 otherwise.
+ */
+int
+crtrec_set_orig(crtrec_t *rec, X509 *origcrt)
+{
+	int rv = 0;
+
+	pthread_mutex_lock(&rec->mutex);
+	if (rec->have_orig)
+		goto out;
+	if (ssl_x509_fingerprint_buf(origcrt, rec->origfpr) == -1 ||
+	    !(rec->sans = ssl_x509_names(origcrt)) ||
+	    !(rec->names = ssl_x509_names_to_str(origcrt))) {
+		if (rec->sans) {
+			for (char **p = rec->sans; *p; p++)
+				free(*p);
+			free(rec->sans);
+			rec->sans = NULL;
+		}
+		rv = -1;
+		goto out;
+	}
+	rec->have_orig = 1;
+out:
+	pthread_mutex_unlock(&rec->mutex);
+	return rv;
+}
+
+/*
+ * Returns a reference to the SSL_CTX built for the opts with serial,
+ * or NULL if there is none.
+ */
+SSL_CTX *
+crtrec_get_sslctx(crtrec_t *rec, unsigned long serial)
+{
+	SSL_CTX *sslctx = NULL;
+
+	pthread_mutex_lock(&rec->mutex);
+	if (rec->sslctx && rec->sslctx_serial == serial) {
+		sslctx = rec->sslctx;
+		ssl_ctx_refcount_inc(sslctx);
+	}
+	pthread_mutex_unlock(&rec->mutex);
+	return sslctx;
+}
+
+/*
+ * Keep sslctx built for the opts with serial, replacing the one built for
+ * other opts.  Takes a reference on sslctx.
+ */
+void
+crtrec_set_sslctx(crtrec_t *rec, SSL_CTX *sslctx, unsigned long serial)
+{
+	SSL_CTX *old;
+
+	ssl_ctx_refcount_inc(sslctx);
+	pthread_mutex_lock(&rec->mutex);
+	old = rec->sslctx;
+	rec->sslctx = sslctx;
+	rec->sslctx_serial = serial;
+	pthread_mutex_unlock(&rec->mutex);
+	if (old)
+		SSL_CTX_free(old);
+}
+
+/*
+ * Increment reference count.
+ */
+void
+crtrec_refcount_inc(crtrec_t *rec)
+{
+	pthread_mutex_lock(&rec->mutex);
+	rec->references++;
+	pthread_mutex_unlock(&rec->mutex);
+}
+
+/*
+ * Free record including internal objects.
+ */
+void
+crtrec_free(crtrec_t *rec)
+{
+	pthread_mutex_lock(&rec->mutex);
+	rec->references--;
+	if (rec->references) {
+		pthread_mutex_unlock(&rec->mutex);
+		return;
+	}
+	pthread_mutex_unlock(&rec->mutex);
+	pthread_mutex_destroy(&rec->mutex);
+	if (rec->sans) {
+		for (char **p = rec->sans; *p; p++)
+			free(*p);
+		free(rec->sans);
+	}
+	if (rec->names)
+		free(rec->names);
+	if (rec->sslctx)
+		SSL_CTX_free(rec->sslctx);
+	X509_free(rec->crt);
+	free(rec);
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,75 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CRTREC_H
+#define CRTREC_H
+
+#include "ssl.h"
+#include "attrib.h"
+
+#include <openssl/ssl.h>
+#include <pthread.h>
+
+/*
+ * Record of a forged cert, as kept in the fkcrt cache: the cert and what
+ * conns using it would otherwise derive from it and from the original
+ * server cert on every handshake.  The fields below the mutex are set once
+ * by crtrec_set_orig() and are read-only afterwards, so conns holding a
+ * reference use them without locking.
+ */
+typedef struct crtrec {
+	X509 *crt;
+	/* fingerprint of crt, as by ssl_x509_fingerprint(crt, 0) */
+	char usedfpr[SSL_X509_FPRSZ * 2 + 1];
+
+	/* src SSL_CTX serving crt, for the opts with serial sslctx_serial */
+	SSL_CTX *sslctx;
+	unsigned long sslctx_serial;
+
+	pthread_mutex_t mutex;
+	size_t references;
+
+	/* fingerprint, names joined with slashes and list of names of the
+	 * original server cert */
+	char origfpr[SSL_X509_FPRSZ * 2 + 1];
+	char *names;
+	char **sans;
+	unsigned int have_orig : 1;
+} crtrec_t;
+
+crtrec_t * crtrec_new(X509 *) NONNULL(1) MALLOC;
+int crtrec_set_orig(crtrec_t *, X509 *) NONNULL(1,2) WUNRES;
+SSL_CTX * crtrec_get_sslctx(crtrec_t *, unsigned long) NONNULL(1);
+void crtrec_set_sslctx(crtrec_t *, SSL_CTX *, unsigned long) NONNULL(1,2);
+void crtrec_refcount_inc(crtrec_t *) NONNULL(1);
+void crtrec_free(crtrec_t *) NONNULL(1);
+
+#endif /* !CRTREC_H */
+
+/* vim: set noet ft=c: */
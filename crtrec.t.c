@@ -0,0 +1,160 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ssl.h"
+#include "crtrec.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#define TESTCERT "extra/pki/targets/daniel.roe.ch.pem"
+
+static X509 *crt;
+
+static void
+crtrec_setup(void)
+{
+	if (ssl_init() == -1 || !(crt = ssl_x509_load(TESTCERT)))
+		exit(EXIT_FAILURE);
+}
+
+static void
+crtrec_teardown(void)
+{
+	X509_free(crt);
+	ssl_fini();
+}
+
+START_TEST(crtrec_new_01)
+{
+	crtrec_t *rec;
+	char *fpr;
+
+	rec = crtrec_new(crt);
+	fail_unless(!!rec, "creating record failed");
+	fail_unless(rec->crt == crt, "record does not hold the cert");
+	fail_unless(rec->references == 1, "refcount mismatch");
+	fpr = ssl_x509_fingerprint(crt, 0);
+	fail_unless(!strcmp(rec->usedfpr, fpr), "used fingerprint mismatch");
+	fail_unless(!rec->have_orig && !rec->names && !rec->sans,
+	            "orig cert fields set");
+	free(fpr);
+	crtrec_refcount_inc(rec);
+	fail_unless(rec->references == 2, "refcount not incremented");
+	crtrec_free(rec);
+	fail_unless(rec->references == 1, "refcount not decremented");
+	crtrec_free(rec);
+}
+END_TEST
+
+START_TEST(crtrec_set_orig_01)
+{
+	crtrec_t *rec;
+	char *fpr, *names, *recnames;
+	char **sans;
+
+	rec = crtrec_new(crt);
+	fail_unless(!!rec, "creating record failed");
+	fail_unless(crtrec_set_orig(rec, crt) == 0, "set orig failed");
+	fail_unless(rec->have_orig, "orig cert fields not set");
+
+	fpr = ssl_x509_fingerprint(crt, 0);
+	fail_unless(!strcmp(rec->origfpr, fpr), "orig fingerprint mismatch");
+	free(fpr);
+	names = ssl_x509_names_to_str(crt);
+	fail_unless(!strcmp(rec->names, names), "names mismatch");
+	free(names);
+	sans = ssl_x509_names(crt);
+	char **p = sans, **q = rec->sans;
+	for (; *p && *q; p++, q++) {
+		fail_unless(!strcmp(*p, *q), "sans mismatch");
+		free(*p);
+	}
+	fail_unless(!*p && !*q, "sans count mismatch");
+	free(sans);
+
+	/* derived once */
+	recnames = rec->names;
+	fail_unless(crtrec_set_orig(rec, crt) == 0, "set orig again failed");
+	fail_unless(rec->names == recnames, "names derived again");
+	crtrec_free(rec);
+}
+END_TEST
+
+START_TEST(crtrec_sslctx_01)
+{
+	crtrec_t *rec;
+	SSL_CTX *sslctx1, *sslctx2, *got;
+
+	rec = crtrec_new(crt);
+	fail_unless(!!rec, "creating record failed");
+	fail_unless(!crtrec_get_sslctx(rec, 1), "sslctx in new record");
+
+	sslctx1 = SSL_CTX_new(SSLv23_method());
+	sslctx2 = SSL_CTX_new(SSLv23_method());
+	fail_unless(sslctx1 && sslctx2, "creating sslctx failed");
+	crtrec_set_sslctx(rec, sslctx1, 1);
+	got = crtrec_get_sslctx(rec, 1);
+	fail_unless(got == sslctx1, "sslctx of same serial not returned");
+	SSL_CTX_free(got);
+	fail_unless(!crtrec_get_sslctx(rec, 2), "sslctx of other serial returned");
+
+	crtrec_set_sslctx(rec, sslctx2, 2);
+	fail_unless(!crtrec_get_sslctx(rec, 1), "replaced sslctx returned");
+	got = crtrec_get_sslctx(rec, 2);
+	fail_unless(got == sslctx2, "replacing sslctx not returned");
+	SSL_CTX_free(got);
+
+	SSL_CTX_free(sslctx1);
+	SSL_CTX_free(sslctx2);
+	crtrec_free(rec);
+}
+END_TEST
+
+Suite *
+crtrec_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("crtrec");
+
+	tc = tcase_create("crtrec");
+	tcase_add_checked_fixture(tc, crtrec_setup, crtrec_teardown);
+	tcase_add_test(tc, crtrec_new_01);
+	tcase_add_test(tc, crtrec_set_orig_01);
+	tcase_add_test(tc, crtrec_sslctx_01);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
@@ -92,6 +92,15 @@
  */
 #define DFLT_LEAFKEY_RSABITS 2048
 
+/*
+ * Default limit of the output buffer of each connection end in bytes.
+ * Once reached, reading from the other end stops until half of the buffer is
+ * written out.  Adaptive relay buffers grow the limit up to 16 times for
+ * connections which keep hitting it, and shrink it down to one eighth for
+ * idle connections.
+ */
+#define DFLT_RELAY_BUFSIZE (128*1024)
+
 #endif /* !DEFAULTS_H */
 
 /* vim: set noet ft=c: */
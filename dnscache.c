@@ -0,0 +1,543 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dnscache.h"
+
+#include "log.h"
+#include "khash.h"
+
+#include <netinet/in.h>
+#include <sys/time.h>
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <event2/util.h>
+
+/*
+ * Resolver cache for SNI proxyspecs, shared by all conn handling threads.
+ *
+ * Answers are cached for their TTL, and nonexistent names for
+ * DNSCACHE_NEG_TTL.  Lookups of a name with a query already in flight wait
+ * for that query, whichever thread started it; answers are passed to the
+ * waiting threads through their own event bases.  A hit in the last tenth
+ * of a long enough TTL starts a query in the background to refresh the
+ * entry before it expires.
+ *
+ * Queries run on the evdns base of the thread starting them.  Only the
+ * first address of an answer is used, as with evdns_getaddrinfo() before.
+ *
+ * key: char *               "4:" or "6:" followed by the lowercased name
+ * val: dnscache_entry_t *   answer
+ */
+
+#define DNSCACHE_NAME_MAX 255
+#define DNSCACHE_MAX_ENTRIES 65536
+#define DNSCACHE_MAX_TTL 3600
+#define DNSCACHE_NEG_TTL 10
+#define DNSCACHE_PREFETCH_MIN_TTL 10
+
+typedef struct dnscache_waiter {
+	struct event_base *evbase;
+	dnscache_cb_t cb;
+	void *arg;
+	unsigned short port;
+	int errcode;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	struct dnscache_waiter *next;
+} dnscache_waiter_t;
+
+typedef struct dnscache_entry {
+	// 0 or EVUTIL_EAI_NONAME for negative entries
+	int errcode;
+	// Port is 0
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	time_t ttl;
+	time_t expire;
+	// A query is in flight, to resolve or refresh the entry
+	unsigned int pending : 1;
+	dnscache_waiter_t *waiters;
+} dnscache_entry_t;
+
+KHASH_MAP_INIT_STR(dnsentry_t, dnscache_entry_t *)
+
+typedef struct dnscache_query {
+	char *key;
+	int af;
+	struct event_base *evbase;
+	struct timeval start;
+	// Waiters of a query for a name not cached for lack of room
+	dnscache_waiter_t *waiters;
+	unsigned int cached : 1;
+} dnscache_query_t;
+
+static pthread_mutex_t dnscache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static khash_t(dnsentry_t) *dnscache_map;
+
+// Statistics since the last dnscache_stats() call
+static long long unsigned int stats_hits;
+static long long unsigned int stats_neg_hits;
+static long long unsigned int stats_misses;
+static long long unsigned int stats_coalesced;
+static long long unsigned int stats_prefetches;
+static long long unsigned int stats_errors;
+static long long unsigned int stats_queries;
+static long long unsigned int stats_lat_sum;
+static long long unsigned int stats_lat_max;
+
+int
+dnscache_init(void)
+{
+	pthread_mutex_lock(&dnscache_mutex);
+	if (!dnscache_map)
+		dnscache_map = kh_init(dnsentry_t);
+	pthread_mutex_unlock(&dnscache_mutex);
+	return dnscache_map ? 0 : -1;
+}
+
+static void
+dnscache_waiters_free(dnscache_waiter_t *w)
+{
+	while (w) {
+		dnscache_waiter_t *next = w->next;
+		free(w);
+		w = next;
+	}
+}
+
+static void
+dnscache_entry_del(khiter_t k)
+{
+	dnscache_entry_t *e = kh_val(dnscache_map, k);
+
+	free((char *)kh_key(dnscache_map, k));
+	dnscache_waiters_free(e->waiters);
+	free(e);
+	kh_del(dnsentry_t, dnscache_map, k);
+}
+
+/*
+ * Queries in flight are not freed, their callbacks must not run after
+ * this, i.e. the evdns bases must have been freed.
+ */
+void
+dnscache_fini(void)
+{
+	pthread_mutex_lock(&dnscache_mutex);
+	if (dnscache_map) {
+		for (khiter_t k = kh_begin(dnscache_map); k != kh_end(dnscache_map); k++) {
+			if (kh_exist(dnscache_map, k))
+				dnscache_entry_del(k);
+		}
+		kh_destroy(dnsentry_t, dnscache_map);
+		dnscache_map = NULL;
+	}
+	pthread_mutex_unlock(&dnscache_mutex);
+}
+
+static dnscache_entry_t *
+dnscache_get(const char *key)
+{
+	if (!dnscache_map)
+		return NULL;
+	khiter_t k = kh_get(dnsentry_t, dnscache_map, key);
+	return k != kh_end(dnscache_map) ? kh_val(dnscache_map, k) : NULL;
+}
+
+/*
+ * Drop expired entries with no query in flight.
+ */
+static void
+dnscache_gc(time_t now)
+{
+	for (khiter_t k = kh_begin(dnscache_map); k != kh_end(dnscache_map); k++) {
+		if (kh_exist(dnscache_map, k)) {
+			dnscache_entry_t *e = kh_val(dnscache_map, k);
+			if (!e->pending && now >= e->expire)
+				dnscache_entry_del(k);
+		}
+	}
+}
+
+/*
+ * Returns NULL if out of memory or out of room.
+ */
+static dnscache_entry_t *
+dnscache_put(const char *key, time_t now)
+{
+	dnscache_entry_t *e;
+	char *k_key;
+	khiter_t k;
+	int ret;
+
+	if (!dnscache_map)
+		return NULL;
+	if (kh_size(dnscache_map) >= DNSCACHE_MAX_ENTRIES) {
+		dnscache_gc(now);
+		if (kh_size(dnscache_map) >= DNSCACHE_MAX_ENTRIES)
+			return NULL;
+	}
+
+	if (!(e = malloc(sizeof(dnscache_entry_t))))
+		return NULL;
+	memset(e, 0, sizeof(dnscache_entry_t));
+	if (!(k_key = strdup(key))) {
+		free(e);
+		return NULL;
+	}
+	k = kh_put(dnsentry_t, dnscache_map, k_key, &ret);
+	if (ret == -1) {
+		free(k_key);
+		free(e);
+		return NULL;
+	}
+	kh_val(dnscache_map, k) = e;
+	return e;
+}
+
+static void
+dnscache_set_port(struct sockaddr_storage *addr, unsigned short port)
+{
+	if (addr->ss_family == AF_INET6)
+		((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+	else
+		((struct sockaddr_in *)addr)->sin_port = htons(port);
+}
+
+static dnscache_query_t *
+dnscache_query_new(const char *key, int af, struct event_base *evbase)
+{
+	dnscache_query_t *q = malloc(sizeof(dnscache_query_t));
+	if (!q)
+		return NULL;
+	memset(q, 0, sizeof(dnscache_query_t));
+	if (!(q->key = strdup(key))) {
+		free(q);
+		return NULL;
+	}
+	q->af = af;
+	q->evbase = evbase;
+	q->cached = 1;
+	gettimeofday(&q->start, NULL);
+	return q;
+}
+
+static void
+dnscache_waiter_cb(UNUSED evutil_socket_t fd, UNUSED short what, void *arg)
+{
+	dnscache_waiter_t *w = arg;
+
+	if (w->errcode)
+		w->cb(w->errcode, NULL, 0, w->arg);
+	else
+		w->cb(0, (struct sockaddr *)&w->addr, w->addrlen, w->arg);
+	free(w);
+}
+
+/*
+ * Pass the answer to the waiters, on their own threads.
+ */
+static void
+dnscache_dispatch(dnscache_query_t *q, dnscache_waiter_t *w, int errcode,
+                  struct sockaddr_storage *addr, socklen_t addrlen)
+{
+	struct timeval now = {0, 0};
+
+	while (w) {
+		dnscache_waiter_t *next = w->next;
+
+		w->errcode = errcode;
+		if (!errcode) {
+			memcpy(&w->addr, addr, addrlen);
+			w->addrlen = addrlen;
+			dnscache_set_port(&w->addr, w->port);
+		}
+		if (w->evbase == q->evbase) {
+			dnscache_waiter_cb(-1, 0, w);
+		} else if (event_base_once(w->evbase, -1, EV_TIMEOUT,
+		                           dnscache_waiter_cb, w, &now) == -1) {
+			log_err_level_printf(LOG_CRIT, "Cannot pass DNS answer for '%s' to thread\n", q->key + 2);
+			free(w);
+		}
+		w = next;
+	}
+}
+
+static void
+dnscache_query_cb(int result, char type, int count, int ttl, void *addresses,
+                  void *arg)
+{
+	dnscache_query_t *q = arg;
+	struct sockaddr_storage addr;
+	socklen_t addrlen = 0;
+	dnscache_waiter_t *waiters;
+	struct timeval tv;
+	long long unsigned int lat;
+	time_t now;
+	int errcode;
+
+	gettimeofday(&tv, NULL);
+	now = tv.tv_sec;
+	lat = (tv.tv_sec - q->start.tv_sec) * 1000 + (tv.tv_usec - q->start.tv_usec) / 1000;
+
+	memset(&addr, 0, sizeof(addr));
+	if (result == DNS_ERR_NONE && count > 0 && type == DNS_IPv4_A) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+		sin->sin_family = AF_INET;
+		memcpy(&sin->sin_addr, addresses, sizeof(struct in_addr));
+		addrlen = sizeof(struct sockaddr_in);
+		errcode = 0;
+	} else if (result == DNS_ERR_NONE && count > 0 && type == DNS_IPv6_AAAA) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addr;
+		sin6->sin6_family = AF_INET6;
+		memcpy(&sin6->sin6_addr, addresses, sizeof(struct in6_addr));
+		addrlen = sizeof(struct sockaddr_in6);
+		errcode = 0;
+	} else if (result == DNS_ERR_NONE || result == DNS_ERR_NOTEXIST) {
+		// No such name, or no address of the family
+		errcode = EVUTIL_EAI_NONAME;
+	} else {
+		errcode = EVUTIL_EAI_FAIL;
+	}
+
+	pthread_mutex_lock(&dnscache_mutex);
+	stats_queries++;
+	stats_lat_sum += lat;
+	if (lat > stats_lat_max)
+		stats_lat_max = lat;
+	if (errcode == EVUTIL_EAI_FAIL)
+		stats_errors++;
+
+	waiters = q->waiters;
+	if (q->cached && dnscache_map) {
+		khiter_t k = kh_get(dnsentry_t, dnscache_map, q->key);
+		if (k != kh_end(dnscache_map)) {
+			dnscache_entry_t *e = kh_val(dnscache_map, k);
+			waiters = e->waiters;
+			e->waiters = NULL;
+			e->pending = 0;
+			if (errcode != EVUTIL_EAI_FAIL) {
+				e->errcode = errcode;
+				memcpy(&e->addr, &addr, sizeof(addr));
+				e->addrlen = addrlen;
+				if (errcode)
+					e->ttl = DNSCACHE_NEG_TTL;
+				else
+					e->ttl = ttl < 0 ? 0 : ttl > DNSCACHE_MAX_TTL ? DNSCACHE_MAX_TTL : ttl;
+				e->expire = now + e->ttl;
+			} else if (now >= e->expire) {
+				// Keep refreshed entries until they expire, drop the others
+				dnscache_entry_del(k);
+			}
+		}
+	}
+	pthread_mutex_unlock(&dnscache_mutex);
+
+	dnscache_dispatch(q, waiters, errcode, &addr, addrlen);
+	free(q->key);
+	free(q);
+}
+
+static void
+dnscache_query_start(struct evdns_base *dnsbase, dnscache_query_t *q)
+{
+	struct evdns_request *req;
+
+	if (q->af == AF_INET6)
+		req = evdns_base_resolve_ipv6(dnsbase, q->key + 2, 0, dnscache_query_cb, q);
+	else
+		req = evdns_base_resolve_ipv4(dnsbase, q->key + 2, 0, dnscache_query_cb, q);
+	if (!req)
+		dnscache_query_cb(DNS_ERR_UNKNOWN, 0, 0, 0, NULL, q);
+}
+
+static int
+dnscache_numeric(const char *name, int af, unsigned short port,
+                 struct sockaddr_storage *addr, socklen_t *addrlen)
+{
+	memset(addr, 0, sizeof(struct sockaddr_storage));
+	if (af == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)addr;
+		if (evutil_inet_pton(AF_INET6, name, &sin6->sin6_addr) != 1)
+			return 0;
+		sin6->sin6_family = AF_INET6;
+		*addrlen = sizeof(struct sockaddr_in6);
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+		if (evutil_inet_pton(AF_INET, name, &sin->sin_addr) != 1)
+			return 0;
+		sin->sin_family = AF_INET;
+		*addrlen = sizeof(struct sockaddr_in);
+	}
+	dnscache_set_port(addr, port);
+	return 1;
+}
+
+/*
+ * Resolve name to an address of family af with port.  Calls cb before
+ * returning on cache hits, otherwise on the thread of evbase once the
+ * answer arrives.  Queries run on dnsbase, which must belong to evbase.
+ */
+void
+dnscache_resolve(struct event_base *evbase, struct evdns_base *dnsbase,
+                 const char *name, int af, unsigned short port,
+                 dnscache_cb_t cb, void *arg)
+{
+	char key[DNSCACHE_NAME_MAX + 3];
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	dnscache_entry_t *e;
+	dnscache_waiter_t *w;
+	dnscache_query_t *q = NULL;
+	size_t len;
+	time_t now;
+	int errcode;
+
+	if (af != AF_INET6)
+		af = AF_INET;
+
+	// Numeric hosts need no lookup
+	if (dnscache_numeric(name, af, port, &addr, &addrlen)) {
+		cb(0, (struct sockaddr *)&addr, addrlen, arg);
+		return;
+	}
+
+	len = strlen(name);
+	if (!len || len > DNSCACHE_NAME_MAX) {
+		cb(EVUTIL_EAI_NONAME, NULL, 0, arg);
+		return;
+	}
+	key[0] = af == AF_INET6 ? '6' : '4';
+	key[1] = ':';
+	for (size_t i = 0; i < len; i++)
+		key[i + 2] = tolower((unsigned char)name[i]);
+	key[len + 2] = '\0';
+
+	now = time(NULL);
+	pthread_mutex_lock(&dnscache_mutex);
+	e = dnscache_get(key);
+	if (e && now < e->expire) {
+		errcode = e->errcode;
+		if (!errcode) {
+			stats_hits++;
+			memcpy(&addr, &e->addr, e->addrlen);
+			addrlen = e->addrlen;
+			if (!e->pending && e->ttl >= DNSCACHE_PREFETCH_MIN_TTL &&
+			    now >= e->expire - e->ttl / 10 &&
+			    (q = dnscache_query_new(key, af, evbase))) {
+				e->pending = 1;
+				stats_prefetches++;
+			}
+		} else {
+			stats_neg_hits++;
+		}
+		pthread_mutex_unlock(&dnscache_mutex);
+
+		if (q)
+			dnscache_query_start(dnsbase, q);
+		if (errcode) {
+			cb(errcode, NULL, 0, arg);
+		} else {
+			dnscache_set_port(&addr, port);
+			cb(0, (struct sockaddr *)&addr, addrlen, arg);
+		}
+		return;
+	}
+
+	if (!(w = malloc(sizeof(dnscache_waiter_t))))
+		goto oom;
+	memset(w, 0, sizeof(dnscache_waiter_t));
+	w->evbase = evbase;
+	w->cb = cb;
+	w->arg = arg;
+	w->port = port;
+
+	if (e && e->pending) {
+		// Wait for the query in flight
+		w->next = e->waiters;
+		e->waiters = w;
+		stats_coalesced++;
+		pthread_mutex_unlock(&dnscache_mutex);
+		return;
+	}
+
+	stats_misses++;
+	if (!(q = dnscache_query_new(key, af, evbase))) {
+		free(w);
+		goto oom;
+	}
+	if (e || (e = dnscache_put(key, now))) {
+		e->pending = 1;
+		e->waiters = w;
+	} else {
+		q->cached = 0;
+		q->waiters = w;
+	}
+	pthread_mutex_unlock(&dnscache_mutex);
+
+	dnscache_query_start(dnsbase, q);
+	return;
+oom:
+	pthread_mutex_unlock(&dnscache_mutex);
+	cb(EVUTIL_EAI_MEMORY, NULL, 0, arg);
+}
+
+/*
+ * Statistics line since the last call, latencies are in milliseconds.
+ * Returns NULL if not initialized or out of memory.
+ */
+char *
+dnscache_stats(void)
+{
+	char *s = NULL;
+
+	pthread_mutex_lock(&dnscache_mutex);
+	if (!dnscache_map)
+		goto out;
+	if (asprintf(&s, "DNS: hit=%llu, nhit=%llu, miss=%llu, coal=%llu, pf=%llu, err=%llu, alat=%llu, mlat=%llu, ent=%u\n",
+			stats_hits, stats_neg_hits, stats_misses, stats_coalesced, stats_prefetches, stats_errors,
+			stats_queries ? stats_lat_sum / stats_queries : 0, stats_lat_max, kh_size(dnscache_map)) < 0) {
+		s = NULL;
+		goto out;
+	}
+	stats_hits = stats_neg_hits = stats_misses = stats_coalesced = 0;
+	stats_prefetches = stats_errors = stats_queries = 0;
+	stats_lat_sum = stats_lat_max = 0;
+out:
+	pthread_mutex_unlock(&dnscache_mutex);
+	return s;
+}
+
+/* vim: set noet ft=c: */
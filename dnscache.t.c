@@ -0,0 +1,253 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "dnscache.h"
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <event2/dns_struct.h>
+
+#include <check.h>
+
+/*
+ * Resolves against a stub DNS server on the same event base:
+ * nx.test does not exist, short.test has a TTL of 1 second,
+ * any other name resolves to 192.0.2.1 with a TTL of 300 seconds.
+ */
+
+static struct event_base *evbase;
+static struct evdns_base *dnsbase;
+static struct evdns_server_port *server;
+static evutil_socket_t server_fd;
+static int queries;
+
+static int answers;
+static int answers_wanted;
+static int last_errcode;
+static struct sockaddr_in last_addr;
+
+static void
+dnscache_server_cb(struct evdns_server_request *req, UNUSED void *arg)
+{
+	const char *name = req->questions[0]->name;
+	struct in_addr a;
+
+	queries++;
+	if (!strcasecmp(name, "nx.test")) {
+		evdns_server_request_respond(req, DNS_ERR_NOTEXIST);
+		return;
+	}
+	inet_pton(AF_INET, "192.0.2.1", &a);
+	if (req->questions[0]->type == EVDNS_TYPE_A)
+		evdns_server_request_add_a_reply(req, name, 1, &a,
+		        strcasecmp(name, "short.test") ? 300 : 1);
+	evdns_server_request_respond(req, 0);
+}
+
+static void
+dnscache_test_cb(int errcode, struct sockaddr *addr, socklen_t addrlen,
+                 UNUSED void *arg)
+{
+	last_errcode = errcode;
+	memset(&last_addr, 0, sizeof(last_addr));
+	if (!errcode && addrlen == sizeof(last_addr))
+		memcpy(&last_addr, addr, addrlen);
+	if (++answers >= answers_wanted)
+		event_base_loopbreak(evbase);
+}
+
+static void
+dnscache_wait(int n)
+{
+	struct timeval tv = {5, 0};
+
+	answers_wanted = n;
+	if (answers < n) {
+		event_base_loopexit(evbase, &tv);
+		event_base_dispatch(evbase);
+	}
+}
+
+static void
+dnscache_setup(void)
+{
+	struct sockaddr_in sin;
+	socklen_t sinlen = sizeof(sin);
+	char ns[32];
+
+	evbase = event_base_new();
+	dnsbase = evdns_base_new(evbase, 0);
+	server_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (!evbase || !dnsbase || server_fd == -1)
+		exit(EXIT_FAILURE);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(server_fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+	    getsockname(server_fd, (struct sockaddr *)&sin, &sinlen) == -1)
+		exit(EXIT_FAILURE);
+	evutil_make_socket_nonblocking(server_fd);
+	server = evdns_add_server_port_with_base(evbase, server_fd, 0,
+	                                         dnscache_server_cb, NULL);
+	snprintf(ns, sizeof(ns), "127.0.0.1:%d", ntohs(sin.sin_port));
+	if (!server || evdns_base_nameserver_ip_add(dnsbase, ns) != 0)
+		exit(EXIT_FAILURE);
+	if (dnscache_init() == -1)
+		exit(EXIT_FAILURE);
+
+	queries = answers = answers_wanted = 0;
+	last_errcode = -1;
+}
+
+static void
+dnscache_teardown(void)
+{
+	evdns_close_server_port(server);
+	close(server_fd);
+	evdns_base_free(dnsbase, 0);
+	event_base_free(evbase);
+	dnscache_fini();
+}
+
+START_TEST(dnscache_resolve_01)
+{
+	dnscache_resolve(evbase, dnsbase, "www.test", AF_INET, 443, dnscache_test_cb, NULL);
+	fail_unless(answers == 0, "miss answered synchronously");
+	dnscache_wait(1);
+	fail_unless(answers == 1, "no answer");
+	fail_unless(last_errcode == 0, "resolving failed");
+	fail_unless(last_addr.sin_family == AF_INET, "wrong family");
+	fail_unless(last_addr.sin_addr.s_addr == inet_addr("192.0.2.1"), "wrong addr");
+	fail_unless(ntohs(last_addr.sin_port) == 443, "wrong port");
+	fail_unless(queries == 1, "wrong query count");
+
+	dnscache_resolve(evbase, dnsbase, "WWW.test", AF_INET, 8443, dnscache_test_cb, NULL);
+	fail_unless(answers == 2, "hit not answered synchronously");
+	fail_unless(last_errcode == 0, "hit failed");
+	fail_unless(ntohs(last_addr.sin_port) == 8443, "wrong port on hit");
+	fail_unless(queries == 1, "hit queried");
+}
+END_TEST
+
+START_TEST(dnscache_resolve_02)
+{
+	dnscache_resolve(evbase, dnsbase, "www.test", AF_INET, 443, dnscache_test_cb, NULL);
+	dnscache_resolve(evbase, dnsbase, "www.test", AF_INET, 443, dnscache_test_cb, NULL);
+	dnscache_resolve(evbase, dnsbase, "www.test", AF_INET, 443, dnscache_test_cb, NULL);
+	dnscache_wait(3);
+	fail_unless(answers == 3, "not all waiters answered");
+	fail_unless(last_errcode == 0, "resolving failed");
+	fail_unless(queries == 1, "queries not coalesced");
+}
+END_TEST
+
+START_TEST(dnscache_resolve_03)
+{
+	dnscache_resolve(evbase, dnsbase, "nx.test", AF_INET, 443, dnscache_test_cb, NULL);
+	dnscache_wait(1);
+	fail_unless(last_errcode == EVUTIL_EAI_NONAME, "wrong errcode");
+	dnscache_resolve(evbase, dnsbase, "nx.test", AF_INET, 443, dnscache_test_cb, NULL);
+	fail_unless(answers == 2, "negative hit not answered synchronously");
+	fail_unless(last_errcode == EVUTIL_EAI_NONAME, "wrong errcode on negative hit");
+	fail_unless(queries == 1, "negative hit queried");
+}
+END_TEST
+
+START_TEST(dnscache_resolve_04)
+{
+	dnscache_resolve(evbase, dnsbase, "short.test", AF_INET, 443, dnscache_test_cb, NULL);
+	dnscache_wait(1);
+	fail_unless(last_errcode == 0, "resolving failed");
+	sleep(2);
+	dnscache_resolve(evbase, dnsbase, "short.test", AF_INET, 443, dnscache_test_cb, NULL);
+	fail_unless(answers == 1, "expired entry answered synchronously");
+	dnscache_wait(2);
+	fail_unless(last_errcode == 0, "resolving failed");
+	fail_unless(queries == 2, "expired entry not queried");
+}
+END_TEST
+
+START_TEST(dnscache_resolve_05)
+{
+	dnscache_resolve(evbase, dnsbase, "192.0.2.7", AF_INET, 443, dnscache_test_cb, NULL);
+	fail_unless(answers == 1, "numeric host not answered synchronously");
+	fail_unless(last_addr.sin_addr.s_addr == inet_addr("192.0.2.7"), "wrong addr");
+	fail_unless(queries == 0, "numeric host queried");
+}
+END_TEST
+
+START_TEST(dnscache_stats_01)
+{
+	char *s;
+
+	dnscache_resolve(evbase, dnsbase, "www.test", AF_INET, 443, dnscache_test_cb, NULL);
+	dnscache_wait(1);
+	dnscache_resolve(evbase, dnsbase, "www.test", AF_INET, 443, dnscache_test_cb, NULL);
+
+	s = dnscache_stats();
+	fail_unless(!!s, "no stats");
+	fail_unless(!strncmp(s, "DNS: hit=1, nhit=0, miss=1, coal=0, pf=0, err=0,", 48), "wrong stats");
+	fail_unless(!!strstr(s, "ent=1\n"), "wrong entry count");
+	free(s);
+
+	s = dnscache_stats();
+	fail_unless(!!s, "no stats");
+	fail_unless(!strncmp(s, "DNS: hit=0, nhit=0, miss=0,", 27), "stats not reset");
+	free(s);
+}
+END_TEST
+
+Suite *
+dnscache_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("dnscache");
+
+	tc = tcase_create("dnscache_resolve");
+	tcase_add_checked_fixture(tc, dnscache_setup, dnscache_teardown);
+	tcase_add_test(tc, dnscache_resolve_01);
+	tcase_add_test(tc, dnscache_resolve_02);
+	tcase_add_test(tc, dnscache_resolve_03);
+	tcase_add_test(tc, dnscache_resolve_04);
+	tcase_add_test(tc, dnscache_resolve_05);
+	tcase_add_test(tc, dnscache_stats_01);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,212 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Connection setup benchmark for address formatting.  sslproxy used to
+ * format the client address twice and the original destination once per
+ * connection with getnameinfo(3), strdup'ing each host and port string;
+ * it now keeps the addresses in binary form and formats them with
+ * sys_sockaddr_ntop() into buffers inside the conn ctx, and only when
+ * something actually logs them.
+ *
+ * Usage: addrbench [-n conns] [-6]
+ *   -6  use IPv6 addresses
+ */
+
+#include "sys.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <netdb.h>
+
+/* sys.c logs errors, which none of the code paths used here do */
+int
+log_err_level_printf(int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	(void)level;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return 0;
+}
+
+/* the former pxy_sockaddr_str() */
+static int
+old_sockaddr_str(struct sockaddr *addr, socklen_t addrlen,
+                 char **host, char **port)
+{
+	char hbuf[INET6_ADDRSTRLEN], pbuf[6];
+
+	if (getnameinfo(addr, addrlen, hbuf, sizeof(hbuf), pbuf, sizeof(pbuf),
+	                NI_NUMERICHOST | NI_NUMERICSERV) != 0)
+		return -1;
+	if (!(*host = strdup(hbuf)))
+		return -1;
+	if (!(*port = strdup(pbuf))) {
+		free(*host);
+		return -1;
+	}
+	return 0;
+}
+
+struct conn {
+	char *srchost_str, *srcport_str, *dsthost_str, *dstport_str;
+	char srchost_buf[SYS_HOSTSTRLEN], srcport_buf[SYS_SERVSTRLEN];
+	char dsthost_buf[SYS_HOSTSTRLEN], dstport_buf[SYS_SERVSTRLEN];
+};
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+mkaddr(struct sockaddr_storage *ss, socklen_t *sslen, int v6,
+       unsigned long i, unsigned short port)
+{
+	memset(ss, 0, sizeof(*ss));
+	if (v6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		inet_pton(AF_INET6, "2a01:7c8:aab0:1fb::", &sin6->sin6_addr);
+		sin6->sin6_addr.s6_addr[14] = (i >> 8) & 0xff;
+		sin6->sin6_addr.s6_addr[15] = i & 0xff;
+		*sslen = sizeof(struct sockaddr_in6);
+	} else {
+		struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		sin->sin_addr.s_addr = htonl(0xc0a80000 | (i & 0xffff));
+		*sslen = sizeof(struct sockaddr_in);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long nconns = 1000000, sum;
+	struct sockaddr_storage src, dst;
+	socklen_t srclen, dstlen;
+	struct conn c;
+	int ch, v6 = 0;
+	double t;
+
+	while ((ch = getopt(argc, argv, "n:6")) != -1) {
+		switch (ch) {
+		case 'n':
+			nconns = strtoul(optarg, NULL, 10);
+			break;
+		case '6':
+			v6 = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n conns] [-6]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!nconns) {
+		fprintf(stderr, "conns must be > 0\n");
+		return EXIT_FAILURE;
+	}
+	mkaddr(&dst, &dstlen, v6, 1, 443);
+
+	/* accept: peer formatted twice, the debug print and the ctx copy */
+	sum = 0;
+	t = now();
+	for (unsigned long i = 0; i < nconns; i++) {
+		char *h, *p;
+
+		mkaddr(&src, &srclen, v6, i, 1024 + (i & 0xefff));
+		if (old_sockaddr_str((struct sockaddr *)&src, srclen, &h, &p) == -1)
+			abort();
+		sum += h[0];
+		free(h);
+		free(p);
+		if (old_sockaddr_str((struct sockaddr *)&src, srclen,
+		                     &c.srchost_str, &c.srcport_str) == -1 ||
+		    old_sockaddr_str((struct sockaddr *)&dst, dstlen,
+		                     &c.dsthost_str, &c.dstport_str) == -1)
+			abort();
+		sum += c.srchost_str[0] + c.dsthost_str[0];
+		free(c.srchost_str);
+		free(c.srcport_str);
+		free(c.dsthost_str);
+		free(c.dstport_str);
+	}
+	t = now() - t;
+	printf("getnameinfo+strdup: %lu conns, %.3f s, %.0f ns/conn (%lu)\n",
+	       nconns, t, t * 1e9 / nconns, sum);
+
+	sum = 0;
+	t = now();
+	for (unsigned long i = 0; i < nconns; i++) {
+		mkaddr(&src, &srclen, v6, i, 1024 + (i & 0xefff));
+		if (sys_sockaddr_ntop((struct sockaddr *)&src, srclen,
+		                      c.srchost_buf, sizeof(c.srchost_buf),
+		                      c.srcport_buf, sizeof(c.srcport_buf)) == -1 ||
+		    sys_sockaddr_ntop((struct sockaddr *)&dst, dstlen,
+		                      c.dsthost_buf, sizeof(c.dsthost_buf),
+		                      c.dstport_buf, sizeof(c.dstport_buf)) == -1)
+			abort();
+		sum += c.srchost_buf[0] + c.dsthost_buf[0];
+	}
+	t = now() - t;
+	printf("sys_sockaddr_ntop:  %lu conns, %.3f s, %.0f ns/conn (%lu)\n",
+	       nconns, t, t * 1e9 / nconns, sum);
+
+	/* unlogged conns only keep the binary addresses */
+	sum = 0;
+	t = now();
+	for (unsigned long i = 0; i < nconns; i++) {
+		mkaddr(&src, &srclen, v6, i, 1024 + (i & 0xefff));
+		sum += src.ss_family;
+	}
+	t = now() - t;
+	printf("binary only:        %lu conns, %.3f s, %.0f ns/conn (%lu)\n",
+	       nconns, t, t * 1e9 / nconns, sum);
+	return EXIT_SUCCESS;
+}
+
+/* vim: set noet ft=c: */
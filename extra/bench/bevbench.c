@@ -0,0 +1,236 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Relay benchmark for bufferevent locking.  Conns are confined to their
+ * conn handling thread, so sslproxy creates its bufferevents without
+ * BEV_OPT_THREADSAFE; this measures what the per-bufferevent lock costs on
+ * the relay path with libevent threading enabled.
+ *
+ * A writer thread sends the given number of bytes in bufsize writes over a
+ * socketpair to the relay, which forwards them with the same readcb and
+ * watermark logic as sslproxy over another socketpair to a reader thread.
+ *
+ * Usage: bevbench [-l] [-s megabytes] [-b bufsize]
+ *   -l  create the bufferevents with BEV_OPT_THREADSAFE
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/thread.h>
+
+#define OUTBUF_LIMIT	(128*1024)
+
+static size_t total = 256UL * 1024 * 1024;
+static size_t bufsize = 4096;
+
+static struct bufferevent *src, *dst;
+static size_t relayed;
+static unsigned long readcbs;
+
+static void
+die(const char *msg)
+{
+	perror(msg);
+	exit(EXIT_FAILURE);
+}
+
+static void *
+writer(void *arg)
+{
+	int fd = *(int *)arg;
+	char *buf = calloc(1, bufsize);
+	size_t left = total;
+
+	if (!buf)
+		die("calloc");
+	while (left > 0) {
+		ssize_t n = write(fd, buf, left < bufsize ? left : bufsize);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			die("write");
+		}
+		left -= n;
+	}
+	shutdown(fd, SHUT_WR);
+	free(buf);
+	return NULL;
+}
+
+static void *
+reader(void *arg)
+{
+	int fd = *(int *)arg;
+	char *buf = malloc(65536);
+	size_t got = 0;
+
+	if (!buf)
+		die("malloc");
+	while (got < total) {
+		ssize_t n = read(fd, buf, 65536);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			die("read");
+		}
+		if (n == 0)
+			break;
+		got += n;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void
+dst_writecb(struct bufferevent *bev, void *arg)
+{
+	(void)arg;
+
+	if (evbuffer_get_length(bufferevent_get_output(bev)) < OUTBUF_LIMIT/2)
+		bufferevent_enable(src, EV_READ);
+	if (relayed == total && !evbuffer_get_length(bufferevent_get_output(bev)))
+		event_base_loopbreak(bufferevent_get_base(bev));
+}
+
+static void
+src_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *inbuf = bufferevent_get_input(bev);
+	struct evbuffer *outbuf = bufferevent_get_output(dst);
+	(void)arg;
+
+	readcbs++;
+	relayed += evbuffer_get_length(inbuf);
+	evbuffer_add_buffer(outbuf, inbuf);
+	if (evbuffer_get_length(outbuf) >= OUTBUF_LIMIT)
+		bufferevent_disable(bev, EV_READ);
+}
+
+static void
+eventcb(struct bufferevent *bev, short events, void *arg)
+{
+	(void)bev;
+	(void)arg;
+
+	if (events & BEV_EVENT_ERROR) {
+		fprintf(stderr, "bufferevent error\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct event_base *evbase;
+	struct timeval start, end;
+	pthread_t wthr, rthr;
+	int in[2], out[2];
+	int opts = BEV_OPT_DEFER_CALLBACKS;
+	double secs;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "ls:b:")) != -1) {
+		switch (ch) {
+		case 'l':
+			opts |= BEV_OPT_THREADSAFE;
+			break;
+		case 's':
+			total = strtoul(optarg, NULL, 10) * 1024 * 1024;
+			break;
+		case 'b':
+			bufsize = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: bevbench [-l] [-s megabytes] [-b bufsize]\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!total || !bufsize) {
+		fprintf(stderr, "Invalid size\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* sslproxy enables libevent threading for cross-thread event base access */
+	if (evthread_use_pthreads() == -1)
+		die("evthread_use_pthreads");
+	if (!(evbase = event_base_new()))
+		die("event_base_new");
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) == -1 ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, out) == -1)
+		die("socketpair");
+	evutil_make_socket_nonblocking(in[1]);
+	evutil_make_socket_nonblocking(out[0]);
+
+	src = bufferevent_socket_new(evbase, in[1], opts|BEV_OPT_CLOSE_ON_FREE);
+	dst = bufferevent_socket_new(evbase, out[0], opts|BEV_OPT_CLOSE_ON_FREE);
+	if (!src || !dst)
+		die("bufferevent_socket_new");
+	bufferevent_setcb(src, src_readcb, NULL, eventcb, NULL);
+	bufferevent_setcb(dst, NULL, dst_writecb, eventcb, NULL);
+	bufferevent_enable(src, EV_READ);
+	bufferevent_enable(dst, EV_WRITE);
+
+	gettimeofday(&start, NULL);
+	if (pthread_create(&rthr, NULL, reader, &out[1]) ||
+	    pthread_create(&wthr, NULL, writer, &in[0]))
+		die("pthread_create");
+	event_base_dispatch(evbase);
+	pthread_join(wthr, NULL);
+	pthread_join(rthr, NULL);
+	gettimeofday(&end, NULL);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	printf("%-10s %zu MB in %.3f s: %.1f MB/s, %.2f ns/byte, %lu readcbs, %.0f ns/readcb\n",
+	       (opts & BEV_OPT_THREADSAFE) ? "locked" : "unlocked",
+	       total / (1024 * 1024), secs, total / (1024 * 1024) / secs,
+	       secs * 1e9 / total, readcbs, secs * 1e9 / readcbs);
+
+	bufferevent_free(src);
+	bufferevent_free(dst);
+	close(in[0]);
+	close(out[1]);
+	event_base_free(evbase);
+	return 0;
+}
+
+/* vim: set noet ft=c: */
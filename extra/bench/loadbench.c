@@ -0,0 +1,633 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Load generator for end-to-end interception benchmarks.  Runs a TLS origin
+ * server on a thread of its own, and keeps the given number of TLS clients
+ * busy connecting through a locally running sslproxy, whose proxyspec
+ * forwards to the origin.  Each client connects, completes the handshake
+ * with the forged cert, sends a request, reads the response, and closes the
+ * connection, over and over until the duration is over.
+ *
+ * With -H, clients send HTTP requests and the origin sends HTTP responses of
+ * the given size, otherwise clients send the given number of bytes, which the
+ * origin echoes back.  With -m, the origin presents a newly generated cert on
+ * each connection, so that sslproxy cannot use its forged cert cache.  Full
+ * handshakes are used on the client side.
+ *
+ * Reports new conns/s, handshakes/s, bytes/s received by the clients, setup
+ * latency (connect to the first response byte) and handshake latency
+ * percentiles, and the RSS of the processes given with -p, as a JSON object
+ * with -j, for tracking regressions.
+ *
+ * Usage: loadbench [-Hmj] [-c conns] [-d seconds] [-s bytes] [-t addr:port]
+ *                  [-o port] [-p pid,...] [-n name]
+ */
+
+#include "histo.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <event2/event.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/bufferevent_ssl.h>
+#include <event2/listener.h>
+#include <event2/thread.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+
+#define BODYBUFSIZE	16384
+
+static int nconns = 50;
+static int duration = 10;
+static size_t reqsize = 1024;
+static int http;
+static int miss;
+static int json;
+static const char *name = "loadbench";
+static const char *pids;
+static struct sockaddr_in target;
+static int origin_port = 19443;
+
+static char body[BODYBUFSIZE];
+
+typedef struct bench {
+	struct event_base *evbase;
+	SSL_CTX *sslctx;
+	uint64_t start;
+	uint64_t end;
+	int active;
+	int stopping;
+	unsigned long long conns;
+	unsigned long long handshakes;
+	unsigned long long errors;
+	unsigned long long bytes;
+	histo_t setup;
+	histo_t handshake;
+} bench_t;
+
+typedef struct client {
+	bench_t *bench;
+	struct bufferevent *bev;
+	uint64_t t0;
+	size_t got;
+	unsigned int first : 1;
+	unsigned int hdrdone : 1;
+} client_t;
+
+typedef struct origin {
+	struct event_base *evbase;
+	SSL_CTX *sslctx;
+	EVP_PKEY *key;
+	long serial;
+} origin_t;
+
+typedef struct origin_conn {
+	struct bufferevent *bev;
+	unsigned int replied : 1;
+} origin_conn_t;
+
+static void
+die(const char *msg)
+{
+	perror(msg);
+	exit(EXIT_FAILURE);
+}
+
+static void
+die_ssl(const char *msg)
+{
+	fprintf(stderr, "%s\n", msg);
+	ERR_print_errors_fp(stderr);
+	exit(EXIT_FAILURE);
+}
+
+static void
+add_body(struct evbuffer *out, size_t len)
+{
+	while (len > 0) {
+		size_t n = len < sizeof(body) ? len : sizeof(body);
+		evbuffer_add(out, body, n);
+		len -= n;
+	}
+}
+
+/*
+ * Origin server.
+ */
+
+static EVP_PKEY *
+origin_mkkey(void)
+{
+	EVP_PKEY_CTX *pctx;
+	EVP_PKEY *key = NULL;
+
+	if (!(pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL)) ||
+	    EVP_PKEY_keygen_init(pctx) <= 0 ||
+	    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) <= 0 ||
+	    EVP_PKEY_keygen(pctx, &key) <= 0)
+		die_ssl("Error generating origin key");
+	EVP_PKEY_CTX_free(pctx);
+	return key;
+}
+
+/*
+ * Self-signed cert with a new serial each time, so that each cert has a
+ * fingerprint of its own and misses the forged cert cache of sslproxy.
+ */
+static X509 *
+origin_mkcert(origin_t *o)
+{
+	X509 *crt;
+	X509_NAME *subject;
+
+	if (!(crt = X509_new()))
+		die_ssl("Error creating origin cert");
+	X509_set_version(crt, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(crt), ++o->serial);
+	X509_gmtime_adj(X509_getm_notBefore(crt), -86400);
+	X509_gmtime_adj(X509_getm_notAfter(crt), 30 * 86400);
+	subject = X509_get_subject_name(crt);
+	X509_NAME_add_entry_by_txt(subject, "CN", MBSTRING_ASC, (const unsigned char *)"bench.local", -1, -1, 0);
+	X509_set_issuer_name(crt, subject);
+	X509_set_pubkey(crt, o->key);
+	if (!X509_sign(crt, o->key, EVP_sha256()))
+		die_ssl("Error signing origin cert");
+	return crt;
+}
+
+static void
+origin_conn_free(origin_conn_t *oc)
+{
+	bufferevent_free(oc->bev);
+	free(oc);
+}
+
+static void
+origin_writecb(struct bufferevent *bev, void *arg)
+{
+	origin_conn_t *oc = arg;
+
+	// HTTP responses end with the connection
+	if (oc->replied && !evbuffer_get_length(bufferevent_get_output(bev)))
+		origin_conn_free(oc);
+}
+
+static void
+origin_readcb(struct bufferevent *bev, void *arg)
+{
+	origin_conn_t *oc = arg;
+	struct evbuffer *in = bufferevent_get_input(bev);
+	struct evbuffer *out = bufferevent_get_output(bev);
+
+	if (!http) {
+		evbuffer_add_buffer(out, in);
+		return;
+	}
+	if (oc->replied || evbuffer_search(in, "\r\n\r\n", 4, NULL).pos == -1)
+		return;
+	evbuffer_drain(in, evbuffer_get_length(in));
+	evbuffer_add_printf(out, "HTTP/1.1 200 OK\r\n"
+	                    "Content-Type: application/octet-stream\r\n"
+	                    "Content-Length: %zu\r\n"
+	                    "Connection: close\r\n\r\n", reqsize);
+	add_body(out, reqsize);
+	oc->replied = 1;
+}
+
+static void
+origin_eventcb(struct bufferevent *bev, short events, void *arg)
+{
+	(void)bev;
+
+	if (events & (BEV_EVENT_EOF|BEV_EVENT_ERROR))
+		origin_conn_free(arg);
+}
+
+static void
+origin_acceptcb(struct evconnlistener *listener, evutil_socket_t fd,
+                struct sockaddr *peeraddr, int peeraddrlen, void *arg)
+{
+	origin_t *o = arg;
+	origin_conn_t *oc;
+	SSL *ssl;
+	(void)listener;
+	(void)peeraddr;
+	(void)peeraddrlen;
+
+	if (!(ssl = SSL_new(o->sslctx)))
+		die_ssl("Error creating origin SSL");
+	if (miss) {
+		X509 *crt = origin_mkcert(o);
+		SSL_use_certificate(ssl, crt);
+		X509_free(crt);
+	}
+	if (!(oc = calloc(1, sizeof(origin_conn_t))))
+		die("calloc");
+	oc->bev = bufferevent_openssl_socket_new(o->evbase, fd, ssl,
+	          BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+	if (!oc->bev)
+		die("bufferevent_openssl_socket_new");
+	bufferevent_setcb(oc->bev, origin_readcb, origin_writecb, origin_eventcb, oc);
+	bufferevent_enable(oc->bev, EV_READ|EV_WRITE);
+}
+
+static void *
+origin_thr(void *arg)
+{
+	origin_t *o = arg;
+
+	event_base_dispatch(o->evbase);
+	return NULL;
+}
+
+static void
+origin_start(origin_t *o)
+{
+	struct sockaddr_in sin;
+	X509 *crt;
+	pthread_t thr;
+
+	o->key = origin_mkkey();
+	crt = origin_mkcert(o);
+	if (!(o->sslctx = SSL_CTX_new(TLS_server_method())) ||
+	    SSL_CTX_use_certificate(o->sslctx, crt) != 1 ||
+	    SSL_CTX_use_PrivateKey(o->sslctx, o->key) != 1)
+		die_ssl("Error creating origin SSL_CTX");
+	X509_free(crt);
+
+	if (!(o->evbase = event_base_new()))
+		die("event_base_new");
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = htons(origin_port);
+	if (!evconnlistener_new_bind(o->evbase, origin_acceptcb, o,
+	                             LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE, 1024,
+	                             (struct sockaddr *)&sin, sizeof(sin)))
+		die("evconnlistener_new_bind");
+	if (pthread_create(&thr, NULL, origin_thr, o))
+		die("pthread_create");
+	pthread_detach(thr);
+}
+
+/*
+ * Clients.
+ */
+
+static void client_start(client_t *);
+
+static void
+client_done(client_t *c, int ok)
+{
+	bench_t *b = c->bench;
+
+	if (ok) {
+		b->conns++;
+	} else {
+		b->errors++;
+	}
+	bufferevent_free(c->bev);
+	c->bev = NULL;
+	client_start(c);
+}
+
+static void
+client_readcb(struct bufferevent *bev, void *arg)
+{
+	client_t *c = arg;
+	struct evbuffer *in = bufferevent_get_input(bev);
+	size_t len;
+
+	if (!c->first) {
+		histo_add(&c->bench->setup, histo_now() - c->t0);
+		c->first = 1;
+	}
+	c->bench->bytes += evbuffer_get_length(in);
+	if (http && !c->hdrdone) {
+		struct evbuffer_ptr p = evbuffer_search(in, "\r\n\r\n", 4, NULL);
+		if (p.pos == -1)
+			return;
+		evbuffer_drain(in, p.pos + 4);
+		c->hdrdone = 1;
+	}
+	len = evbuffer_get_length(in);
+	evbuffer_drain(in, len);
+	c->got += len;
+	if (c->got >= reqsize)
+		client_done(c, 1);
+}
+
+static void
+client_eventcb(struct bufferevent *bev, short events, void *arg)
+{
+	client_t *c = arg;
+
+	if (events & BEV_EVENT_CONNECTED) {
+		struct evbuffer *out = bufferevent_get_output(bev);
+
+		c->bench->handshakes++;
+		histo_add(&c->bench->handshake, histo_now() - c->t0);
+		if (http) {
+			evbuffer_add_printf(out, "GET / HTTP/1.1\r\n"
+			                    "Host: bench.local\r\n"
+			                    "Connection: close\r\n\r\n");
+		} else {
+			add_body(out, reqsize);
+		}
+		return;
+	}
+	if (events & (BEV_EVENT_EOF|BEV_EVENT_ERROR))
+		client_done(c, 0);
+}
+
+static void
+client_start(client_t *c)
+{
+	bench_t *b = c->bench;
+	SSL *ssl;
+
+	if (b->stopping) {
+		if (--b->active == 0)
+			event_base_loopbreak(b->evbase);
+		return;
+	}
+
+	if (!(ssl = SSL_new(b->sslctx)))
+		die_ssl("Error creating client SSL");
+	SSL_set_tlsext_host_name(ssl, "bench.local");
+	c->bev = bufferevent_openssl_socket_new(b->evbase, -1, ssl,
+	         BUFFEREVENT_SSL_CONNECTING, BEV_OPT_CLOSE_ON_FREE);
+	if (!c->bev)
+		die("bufferevent_openssl_socket_new");
+	c->got = 0;
+	c->first = 0;
+	c->hdrdone = 0;
+	bufferevent_setcb(c->bev, client_readcb, NULL, client_eventcb, c);
+	bufferevent_enable(c->bev, EV_READ|EV_WRITE);
+	c->t0 = histo_now();
+	if (bufferevent_socket_connect(c->bev, (struct sockaddr *)&target, sizeof(target)) == -1) {
+		// The eventcb is not called if the connect fails right away
+		b->errors++;
+		bufferevent_free(c->bev);
+		c->bev = NULL;
+		b->stopping = 1;
+		client_start(c);
+	}
+}
+
+static void
+bench_stopcb(evutil_socket_t fd, short what, void *arg)
+{
+	bench_t *b = arg;
+	(void)fd;
+	(void)what;
+
+	b->end = histo_now();
+	b->stopping = 1;
+}
+
+static void
+bench_killcb(evutil_socket_t fd, short what, void *arg)
+{
+	bench_t *b = arg;
+	(void)fd;
+	(void)what;
+
+	fprintf(stderr, "%d clients did not finish in time\n", b->active);
+	event_base_loopbreak(b->evbase);
+}
+
+/*
+ * Return the sum of the RSS of the processes in the comma separated list of
+ * pids in kB, or 0 if not available.
+ */
+static unsigned long
+rss_kb(const char *list)
+{
+	unsigned long total = 0;
+	char *s, *p, *save = NULL;
+
+	if (!list || !(s = strdup(list)))
+		return 0;
+	for (p = strtok_r(s, ",", &save); p; p = strtok_r(NULL, ",", &save)) {
+		char cmd[64], line[256];
+		unsigned long kb = 0;
+		FILE *f;
+
+		snprintf(cmd, sizeof(cmd), "/proc/%d/status", atoi(p));
+		if ((f = fopen(cmd, "r"))) {
+			while (fgets(line, sizeof(line), f)) {
+				if (sscanf(line, "VmRSS: %lu", &kb) == 1)
+					break;
+			}
+			fclose(f);
+		} else {
+			snprintf(cmd, sizeof(cmd), "ps -o rss= -p %d", atoi(p));
+			if ((f = popen(cmd, "r"))) {
+				if (fscanf(f, "%lu", &kb) != 1)
+					kb = 0;
+				pclose(f);
+			}
+		}
+		total += kb;
+	}
+	free(s);
+	return total;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "Usage: loadbench [-Hmj] [-c conns] [-d seconds] [-s bytes] [-t addr:port]\n"
+	                "                 [-o port] [-p pid,...] [-n name]\n"
+	                "  -H  HTTP requests and responses instead of echoed bytes\n"
+	                "  -m  new origin cert on each conn, forged cert cache misses\n"
+	                "  -j  print the results as a JSON object\n"
+	                "  -c  concurrent clients (default 50)\n"
+	                "  -d  duration in seconds (default 10)\n"
+	                "  -s  request or response size in bytes (default 1024)\n"
+	                "  -t  sslproxy address to connect to (default 127.0.0.1:18443)\n"
+	                "  -o  port of the origin on 127.0.0.1 (default 19443)\n"
+	                "  -p  pids of the processes to report the RSS of\n"
+	                "  -n  name of the scenario in the results\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	bench_t b;
+	origin_t o;
+	client_t *clients;
+	struct event *stopev, *killev;
+	struct timeval tv;
+	const char *targetstr = "127.0.0.1:18443";
+	char *addr, *port;
+	double secs;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "Hmjc:d:s:t:o:p:n:")) != -1) {
+		switch (ch) {
+		case 'H':
+			http = 1;
+			break;
+		case 'm':
+			miss = 1;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'c':
+			nconns = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 's':
+			reqsize = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			targetstr = optarg;
+			break;
+		case 'o':
+			origin_port = atoi(optarg);
+			break;
+		case 'p':
+			pids = optarg;
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (nconns < 1 || duration < 1 || !reqsize || origin_port < 1 || origin_port > 65535)
+		usage();
+
+	memset(&target, 0, sizeof(target));
+	target.sin_family = AF_INET;
+	if (!(addr = strdup(targetstr)) || !(port = strrchr(addr, ':')))
+		usage();
+	*port++ = '\0';
+	if (inet_pton(AF_INET, addr, &target.sin_addr) != 1)
+		usage();
+	target.sin_port = htons(atoi(port));
+	free(addr);
+
+	memset(body, 'x', sizeof(body));
+	if (evthread_use_pthreads() == -1)
+		die("evthread_use_pthreads");
+
+	memset(&o, 0, sizeof(o));
+	origin_start(&o);
+
+	memset(&b, 0, sizeof(b));
+	if (!(b.evbase = event_base_new()))
+		die("event_base_new");
+	if (!(b.sslctx = SSL_CTX_new(TLS_client_method())))
+		die_ssl("Error creating client SSL_CTX");
+	// Full handshakes only, sslproxy does not verify the client either
+	SSL_CTX_set_verify(b.sslctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_options(b.sslctx, SSL_OP_NO_TICKET);
+	SSL_CTX_set_session_cache_mode(b.sslctx, SSL_SESS_CACHE_OFF);
+
+	tv.tv_sec = duration;
+	tv.tv_usec = 0;
+	if (!(stopev = evtimer_new(b.evbase, bench_stopcb, &b)))
+		die("evtimer_new");
+	evtimer_add(stopev, &tv);
+	tv.tv_sec = duration + 10;
+	if (!(killev = evtimer_new(b.evbase, bench_killcb, &b)))
+		die("evtimer_new");
+	evtimer_add(killev, &tv);
+
+	if (!(clients = calloc(nconns, sizeof(client_t))))
+		die("calloc");
+	b.start = histo_now();
+	b.active = nconns;
+	for (int i = 0; i < nconns; i++) {
+		clients[i].bench = &b;
+		client_start(&clients[i]);
+	}
+	event_base_dispatch(b.evbase);
+	if (!b.end)
+		b.end = histo_now();
+
+	secs = (double)(b.end - b.start) / 1000000;
+	if (json) {
+		printf("{\"name\":\"%s\",\"clients\":%d,\"duration\":%.3f,\"size\":%zu,"
+		       "\"http\":%d,\"miss\":%d,\"conns\":%llu,\"errors\":%llu,"
+		       "\"conns_per_sec\":%.1f,\"handshakes_per_sec\":%.1f,\"bytes_per_sec\":%.0f,"
+		       "\"setup_p50_ms\":%.3f,\"setup_p99_ms\":%.3f,"
+		       "\"handshake_p50_ms\":%.3f,\"handshake_p99_ms\":%.3f,\"rss_kb\":%lu}\n",
+		       name, nconns, secs, reqsize, http, miss, b.conns, b.errors,
+		       b.conns / secs, b.handshakes / secs, b.bytes / secs,
+		       histo_quantile(&b.setup, 0.5) / 1000.0, histo_quantile(&b.setup, 0.99) / 1000.0,
+		       histo_quantile(&b.handshake, 0.5) / 1000.0, histo_quantile(&b.handshake, 0.99) / 1000.0,
+		       rss_kb(pids));
+	} else {
+		printf("%s: %d clients, %.1f s, %zu bytes, %s, cert cache %s\n"
+		       "  conns:      %llu, errors %llu\n"
+		       "  conns/s:    %.1f\n"
+		       "  hs/s:       %.1f\n"
+		       "  bytes/s:    %.0f\n"
+		       "  setup:      p50 %.3f ms, p99 %.3f ms\n"
+		       "  handshake:  p50 %.3f ms, p99 %.3f ms\n"
+		       "  rss:        %lu kB\n",
+		       name, nconns, secs, reqsize, http ? "http" : "raw", miss ? "miss" : "hit",
+		       b.conns, b.errors, b.conns / secs, b.handshakes / secs, b.bytes / secs,
+		       histo_quantile(&b.setup, 0.5) / 1000.0, histo_quantile(&b.setup, 0.99) / 1000.0,
+		       histo_quantile(&b.handshake, 0.5) / 1000.0, histo_quantile(&b.handshake, 0.99) / 1000.0,
+		       rss_kb(pids));
+	}
+
+	free(clients);
+	event_free(stopev);
+	event_free(killev);
+	return b.errors && !b.conns ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,126 @@
+#!/bin/sh
+#
+# End-to-end load benchmark: runs loadbench through sslproxy and the
+# listening program in extra/lp, for a number of scenarios, and appends the
+# results as JSON objects, one per line, to $BENCH_OUT (loadbench.json).
+#
+# Usage: ./loadbench.sh [scenario ...]
+#
+# Scenarios: ssl_hit ssl_miss https_hit ssl_hit_log https_hit_log
+#            ssl_hit_plugin https_hit_plugin ssl_bulk ssl_bulk_plugin
+#
+# The *_plugin scenarios relay through the example plugin in extra/plugin
+# instead of the listening program, for comparison with the divert path.
+# The ssl_bulk* scenarios echo BENCH_BULKSIZE bytes on each of BENCH_BULKCONNS
+# conns, so that the handshakes are amortized and bytes_per_sec measures the
+# relay throughput, which the other scenarios are too small to show.
+#
+# Environment: BENCH_CONNS (50), BENCH_SECS (10), BENCH_SIZE (1024),
+# BENCH_BULKCONNS (4), BENCH_BULKSIZE (16777216),
+# BENCH_PROXYPORT (18443), BENCH_LPPORT (18080), BENCH_ORIGINPORT (19443)
+
+set -e
+
+SSLPROXY="${SSLPROXY:-../../sslproxy}"
+LP="${LP:-../lp/lp}"
+PLUGIN="${PLUGIN:-$(cd ../plugin && pwd)/example-plugin.so}"
+LOADBENCH="${LOADBENCH:-./loadbench}"
+BENCH_OUT="${BENCH_OUT:-loadbench.json}"
+CONNS="${BENCH_CONNS:-50}"
+SECS="${BENCH_SECS:-10}"
+SIZE="${BENCH_SIZE:-1024}"
+BULKCONNS="${BENCH_BULKCONNS:-4}"
+BULKSIZE="${BENCH_BULKSIZE:-16777216}"
+PROXYPORT="${BENCH_PROXYPORT:-18443}"
+LPPORT="${BENCH_LPPORT:-18080}"
+ORIGINPORT="${BENCH_ORIGINPORT:-19443}"
+
+SCENARIOS="${*:-ssl_hit ssl_miss https_hit ssl_hit_log https_hit_log ssl_hit_plugin https_hit_plugin ssl_bulk ssl_bulk_plugin}"
+
+for f in "$SSLPROXY" "$LP" "$LOADBENCH" "$PLUGIN"; do
+	if [ ! -f "$f" ]; then
+		echo "$f not found, run make bench in the top level dir" >&2
+		exit 1
+	fi
+done
+
+# Privileges are not dropped, the processes need access to the tmp dir
+if [ "$(id -u)" = "0" ]; then
+	USEROPT="-u root"
+fi
+
+TMPDIR="$(mktemp -d "${TMPDIR:-/tmp}/loadbench.XXXXXX")"
+SSLPROXY_PID=
+LP_PID=
+
+cleanup() {
+	[ -n "$SSLPROXY_PID" ] && kill "$SSLPROXY_PID" 2>/dev/null || true
+	[ -n "$LP_PID" ] && kill "$LP_PID" 2>/dev/null || true
+	rm -rf "$TMPDIR"
+}
+trap cleanup EXIT INT TERM
+
+openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \
+	-days 30 -subj "/CN=loadbench CA" \
+	-addext basicConstraints=critical,CA:TRUE \
+	-addext keyUsage=critical,keyCertSign,cRLSign \
+	-keyout "$TMPDIR/ca.key" -out "$TMPDIR/ca.crt" >/dev/null 2>&1
+
+"$LP" $USEROPT 127.0.0.1 "$LPPORT" >"$TMPDIR/lp.log" 2>&1 &
+LP_PID=$!
+
+for scenario in $SCENARIOS; do
+	proto=ssl
+	benchopts=
+	conns="$CONNS"
+	size="$SIZE"
+	contentlog=
+	divert="DivertAddr 127.0.0.1
+	DivertPort $LPPORT"
+	case "$scenario" in
+	ssl_hit)	;;
+	ssl_miss)	benchopts="-m" ;;
+	https_hit)	proto=https; benchopts="-H" ;;
+	ssl_hit_log)	contentlog="ContentLog $TMPDIR/content.log" ;;
+	https_hit_log)	proto=https; benchopts="-H"
+			contentlog="ContentLog $TMPDIR/content.log" ;;
+	ssl_hit_plugin)	divert="Plugin $PLUGIN" ;;
+	https_hit_plugin)	proto=https; benchopts="-H"
+			divert="Plugin $PLUGIN" ;;
+	ssl_bulk)	conns="$BULKCONNS"; size="$BULKSIZE" ;;
+	ssl_bulk_plugin)	conns="$BULKCONNS"; size="$BULKSIZE"
+			divert="Plugin $PLUGIN" ;;
+	*)		echo "Unknown scenario: $scenario" >&2; exit 1 ;;
+	esac
+
+	cat >"$TMPDIR/sslproxy.conf" <<CONF
+CACert $TMPDIR/ca.crt
+CAKey $TMPDIR/ca.key
+VerifyPeer no
+$contentlog
+ProxySpec {
+	Proto $proto
+	Addr 127.0.0.1
+	Port $PROXYPORT
+	$divert
+	TargetAddr 127.0.0.1
+	TargetPort $ORIGINPORT
+}
+CONF
+	rm -f "$TMPDIR/content.log"
+	"$SSLPROXY" -f "$TMPDIR/sslproxy.conf" $USEROPT >"$TMPDIR/sslproxy.log" 2>&1 &
+	SSLPROXY_PID=$!
+	sleep 1
+	if ! kill -0 "$SSLPROXY_PID" 2>/dev/null; then
+		cat "$TMPDIR/sslproxy.log" >&2
+		exit 1
+	fi
+
+	"$LOADBENCH" -j $benchopts -n "$scenario" -c "$conns" -d "$SECS" \
+		-s "$size" -t "127.0.0.1:$PROXYPORT" -o "$ORIGINPORT" \
+		-p "$SSLPROXY_PID,$LP_PID" | tee -a "$BENCH_OUT"
+
+	kill "$SSLPROXY_PID"
+	wait "$SSLPROXY_PID" 2>/dev/null || true
+	SSLPROXY_PID=
+done
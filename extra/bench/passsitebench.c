@@ -0,0 +1,186 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Lookup benchmark for PassSite matching: the linear scan over the
+ * passsite list that protossl used to do for every SSL connection, and the
+ * compiled passsite index.
+ *
+ * Builds a list of the given number of sites, then matches SNI plus a
+ * slash-separated common name list against it, half of the lookups hitting
+ * a site near the end of the list and half missing altogether.
+ *
+ * Usage: passsitebench [-n sites] [-l lookups]
+ */
+
+#include "passsite.h"
+
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The per-site checks of the former protossl_pass_site(): site has
+ * surrounding slashes, "/example.com/", and is compared to SNI, to a single
+ * common name, and searched for in the slash-separated common names.
+ */
+static passsite_t *
+linear_match(passsite_t *list, const char *sni, const char *names)
+{
+	char buf[256];
+
+	for (passsite_t *ps = list; ps; ps = ps->next) {
+		size_t len = strlen(ps->site);
+
+		memcpy(buf, ps->site + 1, len - 2);
+		buf[len - 2] = '\0';
+		if (sni && !strcmp(sni, buf))
+			return ps;
+		if (!names)
+			continue;
+		if (!strcmp(names, buf))
+			return ps;
+		// First common name
+		buf[len - 2] = '/';
+		buf[len - 1] = '\0';
+		if (!strncmp(names, buf, len - 1))
+			return ps;
+		// Middle common names
+		if (strstr(names, ps->site))
+			return ps;
+		// Last common name
+		size_t nlen = strlen(names);
+		if (nlen > len - 1 &&
+		    !strncmp(names + nlen - (len - 1), ps->site, len - 1))
+			return ps;
+	}
+	return NULL;
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long nsites = 20000, lookups = 10000, hits;
+	passsite_t *list = NULL, *tail = NULL;
+	passsite_index_t *idx;
+	char sni[2][64], names[2][192];
+	double t;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:l:")) != -1) {
+		switch (ch) {
+		case 'n':
+			nsites = strtoul(optarg, NULL, 10);
+			break;
+		case 'l':
+			lookups = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n sites] [-l lookups]\n",
+			        argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!nsites || !lookups) {
+		fprintf(stderr, "sites and lookups must be > 0\n");
+		return EXIT_FAILURE;
+	}
+
+	idx = passsite_index_new();
+	if (!idx)
+		abort();
+	for (unsigned long i = 0; i < nsites; i++) {
+		passsite_t *ps = calloc(1, sizeof(passsite_t));
+		char buf[64];
+
+		if (!ps)
+			abort();
+		snprintf(buf, sizeof(buf), "/site%lu.example.com/", i);
+		ps->site = strdup(buf);
+		if (!ps->site)
+			abort();
+		/* same order as opts_set_pass_site: prepend */
+		ps->next = list;
+		list = ps;
+		if (!tail)
+			tail = ps;
+		if (passsite_index_add(idx, ps) == -1)
+			abort();
+	}
+
+	/* the first site added is the last one the linear scan visits */
+	snprintf(sni[0], sizeof(sni[0]), "www.example.net");
+	snprintf(names[0], sizeof(names[0]),
+	         "www.example.net/cdn.example.net/%.*s",
+	         (int)strlen(tail->site) - 2, tail->site + 1);
+	snprintf(sni[1], sizeof(sni[1]), "www.example.org");
+	snprintf(names[1], sizeof(names[1]),
+	         "www.example.org/cdn.example.org/static.example.org");
+
+	hits = 0;
+	t = now();
+	for (unsigned long i = 0; i < lookups; i++)
+		hits += !!linear_match(list, sni[i & 1], names[i & 1]);
+	t = now() - t;
+	printf("linear: %lu sites, %lu lookups, %lu hits, %.3f s, %.0f lookups/s\n",
+	       nsites, lookups, hits, t, lookups / t);
+
+	hits = 0;
+	t = now();
+	for (unsigned long i = 0; i < lookups; i++)
+		hits += !!passsite_index_match_names(idx, sni[i & 1],
+		                                     names[i & 1], NULL, NULL,
+		                                     NULL, 0);
+	t = now() - t;
+	printf("index:  %lu sites, %lu lookups, %lu hits, %.3f s, %.0f lookups/s\n",
+	       nsites, lookups, hits, t, lookups / t);
+
+	passsite_index_free(idx);
+	while (list) {
+		passsite_t *next = list->next;
+		free(list->site);
+		free(list);
+		list = next;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* vim: set noet ft=c: */
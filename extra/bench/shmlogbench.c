@@ -0,0 +1,279 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Throughput benchmark for handing content to an external reader: the shared
+ * memory rings of ShmLog, read in place, against a pipe, which copies each
+ * byte into and out of the kernel.
+ *
+ * A writer thread writes records of the given payload size, as a conn
+ * handling thread does for content log chunks, and a reader thread sums up
+ * the payloads, so both modes touch every byte on the reader side.  With
+ * drop-new and drop-oldest, the writer does not wait for the reader, so the
+ * lost records are reported too.  With wait, the writer retries a record
+ * on a drop-new ring until the reader made space, to measure lossless
+ * throughput like the pipe does.
+ *
+ * Usage: shmlogbench [-m shm|pipe] [-p drop-new|drop-oldest|wait]
+ *                    [-s megabytes] [-b recsize] [-r ringsize]
+ */
+
+#include "logshm.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+static size_t total = 1024UL * 1024 * 1024;
+static size_t recsize = 4096;
+static size_t ringsize = 4 * 1024 * 1024;
+static int policy = LOGSHM_DROP_NEW;
+static int wait = 1;
+
+static logshm_ring_t *ring;
+static int pfd[2];
+static volatile int writer_done = 0;
+static uint64_t readsum, readbytes;
+
+static void
+die(const char *msg)
+{
+	perror(msg);
+	exit(EXIT_FAILURE);
+}
+
+static uint64_t
+sum(const unsigned char *buf, size_t sz)
+{
+	uint64_t s = 0;
+
+	for (size_t i = 0; i < sz; i++)
+		s += buf[i];
+	return s;
+}
+
+static void *
+writer(void *arg)
+{
+	unsigned char *buf = malloc(recsize);
+	uint64_t id = 0;
+
+	(void)arg;
+	if (!buf)
+		die("malloc");
+	memset(buf, 'x', recsize);
+	for (size_t sent = 0; sent < total; sent += recsize, id++) {
+		if (ring) {
+			while (logshm_ring_write(ring, id, LOGSHM_REC_DATA, 0, buf, recsize) == -1 && wait)
+				sched_yield();
+		} else {
+			logshm_rec_t rec;
+			struct iovec iov[2] = {{&rec, sizeof(rec)}, {buf, recsize}};
+			size_t len = sizeof(rec) + recsize;
+
+			memset(&rec, 0, sizeof(rec));
+			rec.len = recsize;
+			rec.type = LOGSHM_REC_DATA;
+			rec.id = id;
+			while (len) {
+				ssize_t n = writev(pfd[1], iov, 2);
+				if (n == -1)
+					die("writev");
+				len -= n;
+				for (int i = 0; i < 2; i++) {
+					size_t k = (size_t)n < iov[i].iov_len ? (size_t)n : iov[i].iov_len;
+					iov[i].iov_base = (char *)iov[i].iov_base + k;
+					iov[i].iov_len -= k;
+					n -= k;
+				}
+			}
+		}
+	}
+	if (ring)
+		__atomic_store_n(&writer_done, 1, __ATOMIC_RELEASE);
+	else
+		close(pfd[1]);
+	free(buf);
+	return NULL;
+}
+
+static void *
+reader(void *arg)
+{
+	(void)arg;
+	if (ring) {
+		for (;;) {
+			const logshm_rec_t *rec;
+			uint64_t pos;
+			int done = __atomic_load_n(&writer_done, __ATOMIC_ACQUIRE);
+
+			while ((rec = logshm_ring_peek(ring, &pos))) {
+				uint64_t s = sum(rec->data, rec->len);
+				if (logshm_ring_consume(ring, pos, rec) == 0) {
+					readsum += s;
+					readbytes += rec->len;
+				}
+			}
+			if (done)
+				break;
+		}
+	} else {
+		size_t bufsize = 65536;
+		unsigned char *buf = malloc(bufsize);
+		ssize_t n;
+
+		if (!buf)
+			die("malloc");
+		/* the record headers are read, but not summed up */
+		size_t hdrleft = sizeof(logshm_rec_t), dataleft = 0;
+		while ((n = read(pfd[0], buf, bufsize)) > 0) {
+			unsigned char *p = buf;
+			while (n) {
+				if (hdrleft) {
+					size_t k = (size_t)n < hdrleft ? (size_t)n : hdrleft;
+					hdrleft -= k;
+					p += k;
+					n -= k;
+					if (!hdrleft)
+						dataleft = recsize;
+				} else {
+					size_t k = (size_t)n < dataleft ? (size_t)n : dataleft;
+					readsum += sum(p, k);
+					readbytes += k;
+					dataleft -= k;
+					p += k;
+					n -= k;
+					if (!dataleft)
+						hdrleft = sizeof(logshm_rec_t);
+				}
+			}
+		}
+		if (n == -1)
+			die("read");
+		free(buf);
+	}
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *mode = "shm";
+	char name[64];
+	logshm_t *shm = NULL;
+	struct timeval start, end;
+	pthread_t wthr, rthr;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "m:p:s:b:r:")) != -1) {
+		switch (ch) {
+		case 'm':
+			mode = optarg;
+			break;
+		case 'p':
+			wait = !strcmp(optarg, "wait");
+			policy = wait ? LOGSHM_DROP_NEW : logshm_policy_parse(optarg);
+			break;
+		case 's':
+			total = strtoul(optarg, NULL, 10) * 1024 * 1024;
+			break;
+		case 'b':
+			recsize = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			ringsize = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-m shm|pipe] [-p drop-new|drop-oldest|wait] "
+			                "[-s megabytes] [-b recsize] [-r ringsize]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (strcmp(mode, "shm") && strcmp(mode, "pipe")) {
+		fprintf(stderr, "Unknown mode: %s\n", mode);
+		return EXIT_FAILURE;
+	}
+	if (policy == -1) {
+		fprintf(stderr, "Unknown policy\n");
+		return EXIT_FAILURE;
+	}
+	if (!total || !recsize) {
+		fprintf(stderr, "Size and recsize must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!strcmp(mode, "shm")) {
+		snprintf(name, sizeof(name), "/shmlogbench.%d", getpid());
+		shm = logshm_new(name, 1, ringsize, policy);
+		if (!shm)
+			die("logshm_new");
+		shm_unlink(name);
+		if (recsize > logshm_maxpayload(shm)) {
+			fprintf(stderr, "Recsize exceeds %zu for this ringsize\n", logshm_maxpayload(shm));
+			return EXIT_FAILURE;
+		}
+		ring = logshm_ring(shm, 0);
+	} else if (pipe(pfd) == -1) {
+		die("pipe");
+	}
+
+	gettimeofday(&start, NULL);
+	if (pthread_create(&rthr, NULL, reader, NULL) || pthread_create(&wthr, NULL, writer, NULL)) {
+		fprintf(stderr, "Cannot create threads\n");
+		return EXIT_FAILURE;
+	}
+	pthread_join(wthr, NULL);
+	pthread_join(rthr, NULL);
+	gettimeofday(&end, NULL);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	size_t nrecs = total / recsize + !!(total % recsize);
+	printf("%s%s%s: %zu MB in %zu B records in %.3f s, %.1f MB/s, %.0f records/s, %.1f%% read",
+	       mode, ring ? " " : "", ring ? (wait ? "wait" : logshm_policy_str(policy)) : "",
+	       total / (1024 * 1024), recsize, secs, total / (1024 * 1024) / secs, nrecs / secs,
+	       100.0 * readbytes / (nrecs * recsize));
+	if (readsum != readbytes * 'x')
+		printf(", checksum mismatch");
+	printf("\n");
+	if (shm)
+		logshm_free(shm);
+	return EXIT_SUCCESS;
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,325 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Loopback throughput benchmark for the two relay engines used for
+ * passthrough connections: the user space copy done by the bufferevent
+ * path, and the zero-copy splice(2) relay through a pipe.
+ *
+ * A writer thread sends the given number of bytes over loopback TCP to the
+ * relay, which forwards them over another loopback TCP conn to a reader
+ * thread.  The relay runs on the main thread in a poll(2) loop, using the
+ * same watermark as sslproxy, so only the data path differs between modes.
+ *
+ * Usage: splicebench [-m copy|splice] [-s megabytes] [-b bufsize]
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define OUTBUF_LIMIT	(128*1024)
+
+static size_t total = 1024UL * 1024 * 1024;
+static size_t bufsize = 16384;
+
+static void
+die(const char *msg)
+{
+	perror(msg);
+	exit(EXIT_FAILURE);
+}
+
+static int
+listen_loopback(struct sockaddr_in *sin)
+{
+	socklen_t len = sizeof(*sin);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		die("socket");
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)sin, sizeof(*sin)) == -1)
+		die("bind");
+	if (listen(fd, 1) == -1)
+		die("listen");
+	if (getsockname(fd, (struct sockaddr *)sin, &len) == -1)
+		die("getsockname");
+	return fd;
+}
+
+static int
+connect_loopback(struct sockaddr_in *sin)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		die("socket");
+	if (connect(fd, (struct sockaddr *)sin, sizeof(*sin)) == -1)
+		die("connect");
+	return fd;
+}
+
+static void *
+writer(void *arg)
+{
+	int fd = *(int *)arg;
+	char *buf = malloc(bufsize);
+	size_t left = total;
+
+	if (!buf)
+		die("malloc");
+	memset(buf, 'x', bufsize);
+	while (left) {
+		ssize_t n = write(fd, buf, left < bufsize ? left : bufsize);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			die("write");
+		}
+		left -= n;
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void *
+reader(void *arg)
+{
+	int fd = *(int *)arg;
+	char *buf = malloc(bufsize);
+	size_t got = 0;
+
+	if (!buf)
+		die("malloc");
+	for (;;) {
+		ssize_t n = read(fd, buf, bufsize);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			die("read");
+		}
+		if (n == 0)
+			break;
+		got += n;
+	}
+	if (got != total) {
+		fprintf(stderr, "Short transfer: %zu != %zu\n", got, total);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+/*
+ * Copy relay: read into a user space buffer and write it out, as
+ * evbuffer_add_buffer() between two socket bufferevents ends up doing.
+ */
+static void
+relay_copy(int in, int out)
+{
+	char *buf = malloc(OUTBUF_LIMIT);
+	size_t len = 0, off = 0;
+	int eof = 0;
+
+	if (!buf)
+		die("malloc");
+	while (!eof || len) {
+		struct pollfd pfd[2] = {{in, 0, 0}, {out, 0, 0}};
+		if (!eof && len < OUTBUF_LIMIT)
+			pfd[0].events = POLLIN;
+		if (len)
+			pfd[1].events = POLLOUT;
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			die("poll");
+		}
+		if (pfd[0].revents) {
+			if (off && off == len)
+				off = len = 0;
+			ssize_t n = read(in, buf + len, OUTBUF_LIMIT - len);
+			if (n == 0)
+				eof = 1;
+			else if (n > 0)
+				len += n;
+			else if (errno != EAGAIN && errno != EINTR)
+				die("read");
+		}
+		if (pfd[1].revents || len) {
+			ssize_t n = write(out, buf + off, len - off);
+			if (n > 0) {
+				off += n;
+				if (off == len)
+					off = len = 0;
+			} else if (n == -1 && errno != EAGAIN && errno != EINTR) {
+				die("write");
+			}
+		}
+	}
+	free(buf);
+}
+
+/*
+ * Splice relay: move data from the input socket into a pipe and from the
+ * pipe into the output socket, without copying it to user space.
+ */
+static void
+relay_splice(int in, int out)
+{
+	int p[2];
+	size_t piped = 0, limit;
+	int eof = 0;
+
+	if (pipe2(p, O_NONBLOCK) == -1)
+		die("pipe2");
+	int sz = fcntl(p[1], F_SETPIPE_SZ, OUTBUF_LIMIT);
+	if (sz == -1)
+		sz = fcntl(p[1], F_GETPIPE_SZ);
+	limit = sz > 0 ? (size_t)sz : 65536;
+
+	while (!eof || piped) {
+		struct pollfd pfd[2] = {{in, 0, 0}, {out, 0, 0}};
+		if (!eof && piped < limit)
+			pfd[0].events = POLLIN;
+		if (piped)
+			pfd[1].events = POLLOUT;
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			die("poll");
+		}
+		if (pfd[0].revents) {
+			ssize_t n = splice(in, NULL, p[1], NULL, limit - piped, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+			if (n == 0)
+				eof = 1;
+			else if (n > 0)
+				piped += n;
+			else if (errno != EAGAIN && errno != EINTR)
+				die("splice in");
+		}
+		if (piped) {
+			ssize_t n = splice(p[0], NULL, out, NULL, piped, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+			if (n > 0)
+				piped -= n;
+			else if (n == -1 && errno != EAGAIN && errno != EINTR)
+				die("splice out");
+		}
+	}
+	close(p[0]);
+	close(p[1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *mode = "splice";
+	struct sockaddr_in sin_relay, sin_reader;
+	struct timeval start, end;
+	pthread_t wthr, rthr;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "m:s:b:")) != -1) {
+		switch (ch) {
+		case 'm':
+			mode = optarg;
+			break;
+		case 's':
+			total = strtoul(optarg, NULL, 10) * 1024 * 1024;
+			break;
+		case 'b':
+			bufsize = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-m copy|splice] [-s megabytes] [-b bufsize]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (strcmp(mode, "copy") && strcmp(mode, "splice")) {
+		fprintf(stderr, "Unknown mode: %s\n", mode);
+		return EXIT_FAILURE;
+	}
+	if (!total || !bufsize) {
+		fprintf(stderr, "Size and bufsize must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	int lrelay = listen_loopback(&sin_relay);
+	int lreader = listen_loopback(&sin_reader);
+
+	int wfd = connect_loopback(&sin_relay);
+	int in = accept(lrelay, NULL, NULL);
+	int out = connect_loopback(&sin_reader);
+	int rfd = accept(lreader, NULL, NULL);
+	if (in == -1 || rfd == -1)
+		die("accept");
+	close(lrelay);
+	close(lreader);
+
+	fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK);
+	fcntl(out, F_SETFL, fcntl(out, F_GETFL) | O_NONBLOCK);
+
+	gettimeofday(&start, NULL);
+	if (pthread_create(&rthr, NULL, reader, &rfd) || pthread_create(&wthr, NULL, writer, &wfd)) {
+		fprintf(stderr, "Cannot create threads\n");
+		return EXIT_FAILURE;
+	}
+
+	if (!strcmp(mode, "copy"))
+		relay_copy(in, out);
+	else
+		relay_splice(in, out);
+	close(out);
+	close(in);
+
+	pthread_join(wthr, NULL);
+	pthread_join(rthr, NULL);
+	gettimeofday(&end, NULL);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	printf("%s: %zu MB in %.3f s, %.1f MB/s\n", mode, total / (1024 * 1024), secs, total / (1024 * 1024) / secs);
+	return EXIT_SUCCESS;
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,615 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Extraction tool for the segmented content log store of sslproxy, see
+ * ContentLogStore in sslproxy.conf(5) and logstore.h for the formats.
+ *
+ * Takes the segments to work on in order, typically all the .seg files of the
+ * store dir.  The conns of a proxy run are identified as run:id, where run
+ * is the segment name up to the sequence number.
+ *
+ * -l lists the conns: id, time range, payload bytes, addresses, SNI and user.
+ * -c run:id prints the content of a conn in the format of ContentLog.
+ * -o dir writes the content of each conn, or with -c of the one conn, to a
+ *    separate file in dir, named like the files of ContentLogDir.
+ * -i rebuilds the indexes of the segments, for instance if the proxy died.
+ *
+ * The indexes are used to find the conns, except for the last segment of a
+ * run, whose index is incomplete while it is being written, or if -s is
+ * given; these segments are scanned instead.
+ *
+ * Plain, gzip and zstd compressed segments are read as is; zstd segments
+ * need a build with libzstd.
+ *
+ * Usage: logstoreextract [-s] -l|-i|-c run:id|-o dir segment ...
+ */
+
+#include "logstore.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+
+#define HASHSIZE 4096
+
+typedef struct conn {
+	logstore_idx_t idx;
+	char *meta;          /* storage of the strings of idx */
+	char *fn;            /* -o */
+	FILE *out;
+	struct conn *hnext;
+	struct conn *next;   /* in order of appearance */
+} conn_t;
+
+typedef struct conns {
+	conn_t *hash[HASHSIZE];
+	conn_t *head;
+	conn_t **tail;
+} conns_t;
+
+static char *outdir = NULL;
+
+static void
+conns_init(conns_t *conns)
+{
+	memset(conns, 0, sizeof(conns_t));
+	conns->tail = &conns->head;
+}
+
+static void
+conns_clear(conns_t *conns)
+{
+	conn_t *conn, *next;
+
+	for (conn = conns->head; conn; conn = next) {
+		next = conn->next;
+		if (conn->out)
+			fclose(conn->out);
+		free(conn->meta);
+		free(conn->fn);
+		free(conn);
+	}
+	conns_init(conns);
+}
+
+static conn_t *
+conns_find(conns_t *conns, uint64_t id)
+{
+	conn_t *conn;
+
+	for (conn = conns->hash[id % HASHSIZE]; conn; conn = conn->hnext) {
+		if (conn->idx.id == id)
+			return conn;
+	}
+	return NULL;
+}
+
+/*
+ * Set the metadata strings of conn from tab separated meta.
+ */
+static int
+conn_set_meta(conn_t *conn, const char *meta)
+{
+	char **strs[] = {&conn->idx.src, &conn->idx.dst, &conn->idx.sni,
+	                 &conn->idx.user};
+	char *p;
+
+	free(conn->meta);
+	if (!(conn->meta = p = strdup(meta)))
+		return -1;
+	for (size_t i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+		*strs[i] = p ? strsep(&p, "\t") : (char *)"-";
+	}
+	return 0;
+}
+
+static conn_t *
+conns_add(conns_t *conns, uint64_t id, const char *meta)
+{
+	conn_t *conn;
+
+	if (!(conn = malloc(sizeof(conn_t))))
+		return NULL;
+	memset(conn, 0, sizeof(conn_t));
+	conn->idx.id = id;
+	if (conn_set_meta(conn, meta) == -1) {
+		free(conn);
+		return NULL;
+	}
+	conn->hnext = conns->hash[id % HASHSIZE];
+	conns->hash[id % HASHSIZE] = conn;
+	*conns->tail = conn;
+	conns->tail = &conn->next;
+	return conn;
+}
+
+/*
+ * Return the run of a segment, the file name up to the sequence number.
+ */
+static char *
+seg_run(const char *seg)
+{
+	const char *base = strrchr(seg, '/');
+	const char *end = strrchr(seg, '-');
+
+	base = base ? base + 1 : seg;
+	if (!end || end < base)
+		end = base + strlen(base);
+	return strndup(base, end - base);
+}
+
+/*
+ * Scan a segment for its conns.
+ */
+static int
+seg_scan(const char *seg, conns_t *conns)
+{
+	logstore_rec_t rec;
+	unsigned char *buf = NULL;
+	size_t bufsz = 0;
+	uint64_t off = LOGSTORE_MAGICLEN;
+	ssize_t n;
+	logz_reader_t *f;
+	conn_t *conn;
+
+	if (!(f = logz_reader_open(seg))) {
+		fprintf(stderr, "Cannot open %s: %s\n", seg, strerror(errno));
+		return -1;
+	}
+	if (logstore_seg_check(f) == -1) {
+		fprintf(stderr, "%s is not a segment\n", seg);
+		logz_reader_close(f);
+		return -1;
+	}
+	while ((n = logstore_read_rec(f, &rec, &buf, &bufsz)) > 0) {
+		if (!(conn = conns_find(conns, rec.id))) {
+			conn = conns_add(conns, rec.id,
+			                 rec.type == LOGSTORE_REC_OPEN ?
+			                 (char *)buf : "-\t-\t-\t-");
+			if (!conn)
+				goto oom;
+			conn->idx.first = off;
+			conn->idx.first_ts = rec.ts;
+		}
+		conn->idx.last = off;
+		conn->idx.last_ts = rec.ts;
+		if (rec.type == LOGSTORE_REC_DATA)
+			conn->idx.bytes += rec.len;
+		off += n;
+	}
+	if (n == -1) {
+		if (errno == ENOMEM)
+			goto oom;
+		fprintf(stderr, "%s ends in a partial record at %llu\n", seg,
+		        (long long unsigned int)off);
+	}
+	free(buf);
+	logz_reader_close(f);
+	return 0;
+oom:
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Read the index of a segment.
+ */
+static int
+seg_read_idx(const char *seg, conns_t *conns)
+{
+	char *fn, *line = NULL, *meta;
+	size_t linesz = 0;
+	logstore_idx_t idx;
+	conn_t *conn;
+	FILE *f;
+
+	if (asprintf(&fn, "%s.idx", seg) < 0)
+		return -1;
+	f = fopen(fn, "r");
+	free(fn);
+	if (!f)
+		return -1;
+	while (getline(&line, &linesz, f) != -1) {
+		if (logstore_idx_parse(line, &idx) == -1) {
+			fprintf(stderr, "Skipping malformed line in %s.idx\n",
+			        seg);
+			continue;
+		}
+		if (asprintf(&meta, "%s\t%s\t%s\t%s", idx.src, idx.dst,
+		             idx.sni, idx.user) < 0)
+			goto oom;
+		conn = conns_add(conns, idx.id, meta);
+		free(meta);
+		if (!conn)
+			goto oom;
+		conn->idx.first = idx.first;
+		conn->idx.last = idx.last;
+		conn->idx.first_ts = idx.first_ts;
+		conn->idx.last_ts = idx.last_ts;
+		conn->idx.bytes = idx.bytes;
+	}
+	free(line);
+	fclose(f);
+	return 0;
+oom:
+	fprintf(stderr, "Out of memory\n");
+	exit(EXIT_FAILURE);
+}
+
+/*
+ * Find the conns of a segment, from its index if use_idx and it has one.
+ */
+static int
+seg_conns(const char *seg, int use_idx, conns_t *conns)
+{
+	if (use_idx && seg_read_idx(seg, conns) == 0)
+		return 0;
+	return seg_scan(seg, conns);
+}
+
+static int
+seg_write_idx(const char *seg)
+{
+	conns_t conns;
+	conn_t *conn;
+	char *fn;
+	FILE *f;
+	int rv = 0;
+
+	conns_init(&conns);
+	if (seg_scan(seg, &conns) == -1)
+		return -1;
+	if (asprintf(&fn, "%s.idx", seg) < 0)
+		return -1;
+	if (!(f = fopen(fn, "w"))) {
+		fprintf(stderr, "Cannot open %s: %s\n", fn, strerror(errno));
+		free(fn);
+		conns_clear(&conns);
+		return -1;
+	}
+	for (conn = conns.head; conn; conn = conn->next) {
+		if (logstore_idx_write(f, &conn->idx) == -1)
+			rv = -1;
+	}
+	if (fclose(f) == EOF)
+		rv = -1;
+	if (rv == -1)
+		fprintf(stderr, "Failed to write %s\n", fn);
+	free(fn);
+	conns_clear(&conns);
+	return rv;
+}
+
+static void
+format_ts(char *buf, size_t sz, uint64_t ts, const char *fmt)
+{
+	time_t secs = ts / 1000000000ULL;
+	struct tm tm;
+
+	gmtime_r(&secs, &tm);
+	strftime(buf, sz, fmt, &tm);
+}
+
+static void
+print_conns(const char *run, conns_t *conns)
+{
+	char first[32], last[32];
+
+	for (conn_t *conn = conns->head; conn; conn = conn->next) {
+		format_ts(first, sizeof(first), conn->idx.first_ts,
+		          "%Y-%m-%dT%H:%M:%SZ");
+		format_ts(last, sizeof(last), conn->idx.last_ts,
+		          "%Y-%m-%dT%H:%M:%SZ");
+		printf("%s:%llu\t%s\t%s\t%llu\t%s\t%s\t%s\t%s\n", run,
+		       (long long unsigned int)conn->idx.id, first, last,
+		       (long long unsigned int)conn->idx.bytes,
+		       conn->idx.src, conn->idx.dst, conn->idx.sni,
+		       conn->idx.user);
+	}
+}
+
+/*
+ * Merge the conns of a segment into the conns of the run.
+ */
+static void
+merge_conns(conns_t *run, conns_t *seg)
+{
+	conn_t *conn, *rconn;
+
+	for (conn = seg->head; conn; conn = conn->next) {
+		if (!(rconn = conns_find(run, conn->idx.id))) {
+			char *meta;
+			if (asprintf(&meta, "%s\t%s\t%s\t%s", conn->idx.src,
+			             conn->idx.dst, conn->idx.sni,
+			             conn->idx.user) < 0 ||
+			    !(rconn = conns_add(run, conn->idx.id, meta))) {
+				fprintf(stderr, "Out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+			free(meta);
+			rconn->idx.first_ts = conn->idx.first_ts;
+		}
+		rconn->idx.last_ts = conn->idx.last_ts;
+		rconn->idx.bytes += conn->idx.bytes;
+	}
+}
+
+/*
+ * Split "[host]:port" into a host usable in file names and the port.
+ */
+static void
+split_addr(const char *addr, char *host, size_t hostsz, const char **port)
+{
+	const char *end = strrchr(addr, ']');
+	size_t i = 0;
+
+	*port = end && end[1] == ':' ? end + 2 : "-";
+	if (*addr == '[')
+		addr++;
+	for (; *addr && addr != end && i < hostsz - 1; addr++)
+		host[i++] = *addr == ':' ? '_' : *addr;
+	host[i] = '\0';
+}
+
+/*
+ * Write the payload of a record of conn to its own file in outdir.
+ */
+static int
+emit_file(conns_t *conns, conn_t *conn, const logstore_rec_t *rec,
+          const unsigned char *buf)
+{
+	if (!conn->fn) {
+		char timebuf[24], srchost[64], dsthost[64];
+		const char *srcport, *dstport;
+
+		format_ts(timebuf, sizeof(timebuf), rec->ts, "%Y%m%dT%H%M%SZ");
+		split_addr(conn->idx.src, srchost, sizeof(srchost), &srcport);
+		split_addr(conn->idx.dst, dsthost, sizeof(dsthost), &dstport);
+		if (asprintf(&conn->fn, "%s/%s-%s,%s-%s,%s.log", outdir,
+		             timebuf, srchost, srcport, dsthost, dstport) < 0)
+			return -1;
+	}
+	if (rec->type != LOGSTORE_REC_DATA)
+		return 0;
+	if (!conn->out && !(conn->out = fopen(conn->fn, "a")) &&
+	    errno == EMFILE) {
+		/* too many conns open at once, reopen them as needed */
+		for (conn_t *other = conns->head; other; other = other->next) {
+			if (other->out) {
+				fclose(other->out);
+				other->out = NULL;
+			}
+		}
+		conn->out = fopen(conn->fn, "a");
+	}
+	if (!conn->out) {
+		fprintf(stderr, "Cannot open %s: %s\n", conn->fn,
+		        strerror(errno));
+		return -1;
+	}
+	if (fwrite(buf, 1, rec->len, conn->out) != rec->len) {
+		fprintf(stderr, "Failed to write %s\n", conn->fn);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Print a record of conn in the format of ContentLog.
+ */
+static int
+emit_text(conn_t *conn, const logstore_rec_t *rec, const unsigned char *buf)
+{
+	char timebuf[32];
+	int req = !!(rec->flags & LOGSTORE_REQUEST);
+
+	if (rec->type == LOGSTORE_REC_OPEN)
+		return 0;
+	format_ts(timebuf, sizeof(timebuf), rec->ts, "%Y-%m-%d %H:%M:%S UTC");
+	printf("%s %s -> %s", timebuf, req ? conn->idx.src : conn->idx.dst,
+	       req ? conn->idx.dst : conn->idx.src);
+	if (rec->type == LOGSTORE_REC_CLOSE) {
+		printf(" (EOF)\n");
+		return 0;
+	}
+	printf(" (%u):\n", rec->len);
+	return fwrite(buf, 1, rec->len, stdout) == rec->len ? 0 : -1;
+}
+
+static int
+emit(conns_t *conns, const logstore_rec_t *rec, const unsigned char *buf)
+{
+	conn_t *conn;
+
+	if (!(conn = conns_find(conns, rec->id))) {
+		conn = conns_add(conns, rec->id,
+		                 rec->type == LOGSTORE_REC_OPEN ?
+		                 (const char *)buf : "-\t-\t-\t-");
+		if (!conn)
+			return -1;
+	} else if (rec->type == LOGSTORE_REC_OPEN &&
+	           !strcmp(conn->idx.src, "-")) {
+		if (conn_set_meta(conn, (const char *)buf) == -1)
+			return -1;
+	}
+	if (outdir) {
+		if (emit_file(conns, conn, rec, buf) == -1)
+			return -1;
+		if (rec->type == LOGSTORE_REC_CLOSE && conn->out) {
+			fclose(conn->out);
+			conn->out = NULL;
+		}
+		return 0;
+	}
+	return emit_text(conn, rec, buf);
+}
+
+/*
+ * Extract the records of a segment from off up to and including the record
+ * at last, those of conn id, or all records if all.
+ */
+static int
+seg_extract(const char *seg, int all, uint64_t id, uint64_t off, uint64_t last,
+            conns_t *conns)
+{
+	logstore_rec_t rec;
+	unsigned char *buf = NULL;
+	size_t bufsz = 0;
+	ssize_t n;
+	logz_reader_t *f;
+	int rv = 0;
+
+	if (!(f = logz_reader_open(seg))) {
+		fprintf(stderr, "Cannot open %s: %s\n", seg, strerror(errno));
+		return -1;
+	}
+	if (logstore_seg_check(f) == -1) {
+		fprintf(stderr, "%s is not a segment\n", seg);
+		logz_reader_close(f);
+		return -1;
+	}
+	if (off > LOGSTORE_MAGICLEN && logz_reader_seek(f, off) == -1) {
+		logz_reader_close(f);
+		return -1;
+	}
+	while (off <= last && (n = logstore_read_rec(f, &rec, &buf, &bufsz)) > 0) {
+		if ((all || rec.id == id) && emit(conns, &rec, buf) == -1) {
+			rv = -1;
+			break;
+		}
+		off += n;
+	}
+	free(buf);
+	logz_reader_close(f);
+	return rv;
+}
+
+int
+main(int argc, char *argv[])
+{
+	conns_t runconns, segconns, outconns;
+	char *run = NULL, *nextrun, *wantrun = NULL;
+	uint64_t wantid = 0;
+	int list = 0, index = 0, scan = 0, rv = EXIT_SUCCESS, ch;
+
+	while ((ch = getopt(argc, argv, "lisc:o:")) != -1) {
+		switch (ch) {
+		case 'l':
+			list = 1;
+			break;
+		case 'i':
+			index = 1;
+			break;
+		case 's':
+			scan = 1;
+			break;
+		case 'c': {
+			char *sep = strrchr(optarg, ':'), *end;
+			if (!sep)
+				goto usage;
+			wantrun = strndup(optarg, sep - optarg);
+			wantid = strtoull(sep + 1, &end, 10);
+			if (!wantrun || end == sep + 1 || *end)
+				goto usage;
+			break;
+		}
+		case 'o':
+			outdir = optarg;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind == argc || list + index + (wantrun || outdir) != 1)
+		goto usage;
+
+	conns_init(&runconns);
+	conns_init(&segconns);
+	conns_init(&outconns);
+	for (int i = optind; i < argc; i++) {
+		const char *seg = argv[i];
+		int lastofrun;
+
+		if (!(run = seg_run(seg)) ||
+		    !(nextrun = i + 1 < argc ? seg_run(argv[i + 1]) : strdup(""))) {
+			fprintf(stderr, "Out of memory\n");
+			return EXIT_FAILURE;
+		}
+		lastofrun = !!strcmp(run, nextrun);
+		free(nextrun);
+
+		if (index) {
+			if (seg_write_idx(seg) == -1)
+				rv = EXIT_FAILURE;
+		} else if (list) {
+			if (seg_conns(seg, !scan && !lastofrun, &segconns) == -1)
+				rv = EXIT_FAILURE;
+			merge_conns(&runconns, &segconns);
+			conns_clear(&segconns);
+			if (lastofrun) {
+				print_conns(run, &runconns);
+				conns_clear(&runconns);
+			}
+		} else if (wantrun) {
+			conn_t *conn;
+			if (strcmp(run, wantrun))
+				goto next;
+			if (seg_conns(seg, !scan && !lastofrun, &segconns) == -1)
+				rv = EXIT_FAILURE;
+			if ((conn = conns_find(&segconns, wantid)) &&
+			    seg_extract(seg, 0, wantid, conn->idx.first,
+			                conn->idx.last, &outconns) == -1)
+				rv = EXIT_FAILURE;
+			conns_clear(&segconns);
+		} else {
+			if (seg_extract(seg, 1, 0, LOGSTORE_MAGICLEN, UINT64_MAX,
+			                &outconns) == -1)
+				rv = EXIT_FAILURE;
+			if (lastofrun)
+				conns_clear(&outconns);
+		}
+next:
+		free(run);
+	}
+	conns_clear(&outconns);
+	free(wantrun);
+	return rv;
+
+usage:
+	fprintf(stderr, "Usage: logstoreextract [-s] -l|-i|-c run:id|-o dir "
+	                "segment ...\n");
+	return EXIT_FAILURE;
+}
+
+/* vim: set noet ft=c: */
@@ -134,8 +134,9 @@ main_usage(void)
 "  -D          debug mode: run in foreground, log debug messages on stderr\n"
 "  -V          print version information and exit\n"
 "  -h          print usage information and exit\n"
-"  proxyspec = listenaddr+port\n"
+"  proxyspec = listenaddr+port | /path\n"
 "      e.g.    127.0.0.1 8080 # tcp/4; static\n"
+"              /var/run/lp/lp.sock # unix socket\n"
 "                             # et al\n"
 "Example:\n"
 "  %s  127.0.0.1 8080\n";
@@ -115,6 +115,14 @@ proxyspec_parse(int *argc, char **argv[], proxyspec_t **opts_spec)
 
 				// @todo IPv6?
 				la = **argv;
+				// Absolute paths are AF_UNIX listeners, without a port
+				if (la[0] == '/') {
+					if (sys_sockaddr_unix(&spec->listen_addr,
+					                      &spec->listen_addrlen, la) == -1) {
+						exit(EXIT_FAILURE);
+					}
+					break;
+				}
 				state++;
 				break;
 			case 1:
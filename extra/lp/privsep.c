@@ -37,6 +37,8 @@
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <signal.h>
 #include <unistd.h>
@@ -240,7 +242,9 @@ privsep_server_opensock(const proxyspec_t *spec)
 	int on = 1;
 	int rv;
 
-	fd = socket(spec->listen_addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+	int unix_sock = spec->listen_addr.ss_family == AF_UNIX;
+
+	fd = socket(spec->listen_addr.ss_family, SOCK_STREAM, unix_sock ? 0 : IPPROTO_TCP);
 	if (fd == -1) {
 		log_err_level_printf(LOG_CRIT, "Error from socket(): %s (%i)\n",
 		               strerror(errno), errno);
@@ -272,6 +276,11 @@ privsep_server_opensock(const proxyspec_t *spec)
 		return -1;
 	}
 
+	if (unix_sock) {
+		// Left over by a previous run
+		unlink(((struct sockaddr_un *)&spec->listen_addr)->sun_path);
+	}
+
 	rv = bind(fd, (struct sockaddr *)&spec->listen_addr,
 	          spec->listen_addrlen);
 	if (rv == -1) {
@@ -280,6 +289,13 @@ privsep_server_opensock(const proxyspec_t *spec)
 		return -1;
 	}
 
+	// Like a loopback port, any local user may connect, restrict access with the permissions of the dir
+	if (unix_sock && chmod(((struct sockaddr_un *)&spec->listen_addr)->sun_path, 0666) == -1) {
+		log_err_level_printf(LOG_CRIT, "Error from chmod(): %s\n", strerror(errno));
+		evutil_closesocket(fd);
+		return -1;
+	}
+
 	return fd;
 }
 
@@ -156,17 +156,45 @@ prototcp_parse_sslproxy_line(char *line, pxy_conn_ctx_t *ctx)
 #define MAX_PORT_LEN 5
 
 	// SSLproxy: [127.0.0.1]:34649,[192.168.3.24]:47286,[74.125.206.108]:465,s,soner
+	// SSLproxy: [/var/run/sslproxy/sslproxy.1234.56],[192.168.3.24]:47286,[74.125.206.108]:465,s,soner
 	if (!strncasecmp(line, "SSLproxy:", 9)) {
 		if (OPTS_DEBUG(ctx->opts)) {
 			log_dbg_printf("%s\n", line);
 		}
 
-		char *ip_start = strchr(line, '[') + 1;
-		char *ip_end = strchr(ip_start, ']');
-		char *port_start = strchr(ip_end, ':') + 1;
-		char *port_end = strchr(port_start, ',');
+		char *ip_start = strchr(line, '[');
+		char *ip_end = ip_start ? strchr(++ip_start, ']') : NULL;
 
-		if (!ip_start || !ip_end || !port_start || !port_end) {
+		if (!ip_end) {
+			log_err_level_printf(LOG_ERR, "Unable to find sslproxy addr: %s", line);
+			return -1;
+		}
+
+		// SSLproxy listens on an AF_UNIX socket, the path has no port
+		if (*ip_start == '/') {
+			*ip_end = '\0';
+			if (sys_sockaddr_unix(&ctx->dstaddr, &ctx->dstaddrlen, ip_start) == -1) {
+				log_err_level_printf(LOG_ERR, "Cannot convert sslproxy path to sockaddr: %s\n", ip_start);
+				return -1;
+			}
+			if (OPTS_DEBUG(ctx->opts)) {
+				log_dbg_printf("Connecting to %s\n", ip_start);
+				ctx->dsthost_str = strdup(ip_start);
+				ctx->dstport_str = strdup("");
+				if (!ctx->dsthost_str || !ctx->dstport_str) {
+					log_err_level_printf(LOG_ERR, "Cannot dup path: %s\n", ip_start);
+					return -1;
+				}
+			}
+			*ip_end = ']';
+			ctx->seen_sslproxy_line = 1;
+			return 0;
+		}
+
+		char *port_start = strchr(ip_end, ':');
+		char *port_end = port_start ? strchr(++port_start, ',') : NULL;
+
+		if (!port_end) {
 			log_err_level_printf(LOG_ERR, "Unable to find sslproxy addr: %s", line);
 			return -1;
 		}
@@ -47,6 +47,7 @@
 #include <grp.h>
 #include <fts.h>
 #include <unistd.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -351,10 +352,34 @@ sys_sockaddr_parse(struct sockaddr_storage *addr, socklen_t *addrlen,
 	return af;
 }
 
+/*
+ * Fill addr with the AF_UNIX socket address of path.
+ * Returns -1 if path is too long for a socket address, 0 otherwise.
+ */
+int
+sys_sockaddr_unix(struct sockaddr_storage *addr, socklen_t *addrlen,
+                  const char *path)
+{
+	struct sockaddr_un *sun = (struct sockaddr_un *)addr;
+	size_t len = strlen(path);
+
+	if (len >= sizeof(sun->sun_path)) {
+		log_err_level_printf(LOG_CRIT, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	memset(addr, 0, sizeof(struct sockaddr_storage));
+	sun->sun_family = AF_UNIX;
+	memcpy(sun->sun_path, path, len + 1);
+	*addrlen = sizeof(struct sockaddr_un);
+	return 0;
+}
+
 /*
  * Converts an IPv4/IPv6 sockaddr into printable string representations of the
  * host and the service (port) part.  Writes allocated buffers to *host and
- * *serv which must both be freed by the caller.  Neither *host nor *port are
+ * *serv which must both be freed by the caller.  For AF_UNIX addresses, the
+ * host is the socket path, or "unix" for unnamed sockets, and the service is
+ * empty.  Neither *host nor *port are
  * freed by this function before newly allocating.
  * Returns 0 on success, -1 otherwise.  When -1 is returned, pointers in *host
  * and *serv are invalid and must not be used nor freed by the caller.
@@ -372,6 +397,26 @@ sys_sockaddr_str(struct sockaddr *addr, socklen_t addrlen,
 		log_err_level_printf(LOG_CRIT, "Cannot allocate memory\n");
 		return -1;
 	}
+	if (addr->sa_family == AF_UNIX) {
+		const struct sockaddr_un *sun = (const struct sockaddr_un *)addr;
+		size_t pathsz = (size_t)addrlen > offsetof(struct sockaddr_un, sun_path) ?
+		                addrlen - offsetof(struct sockaddr_un, sun_path) : 0;
+
+		if (pathsz > sizeof(sun->sun_path))
+			pathsz = sizeof(sun->sun_path);
+		**serv = '\0';
+		if (pathsz && sun->sun_path[0]) {
+			*host = strndup(sun->sun_path, pathsz);
+		} else {
+			*host = strdup("unix");
+		}
+		if (!*host) {
+			log_err_level_printf(LOG_CRIT, "Cannot allocate memory\n");
+			free(*serv);
+			return -1;
+		}
+		return 0;
+	}
 	rv = getnameinfo(addr, addrlen,
 	                 tmphost, sizeof(tmphost),
 	                 *serv, 6,
@@ -50,6 +50,8 @@ int sys_isgeteuid(const char *) NONNULL(1) WUNRES;
 int sys_get_af(const char *);
 int sys_sockaddr_parse(struct sockaddr_storage *, socklen_t *,
                        char *, char *, int, int) NONNULL(1,2,3,4) WUNRES;
+int sys_sockaddr_unix(struct sockaddr_storage *, socklen_t *,
+                      const char *) NONNULL(1,2,3) WUNRES;
 int sys_sockaddr_str(struct sockaddr *, socklen_t,
                      char **, char **) NONNULL(1,3,4);
 char * sys_ip46str_sanitize(const char *) NONNULL(1) MALLOC;
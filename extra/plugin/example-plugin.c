@@ -0,0 +1,175 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Example analysis plugin, see plugin.h.  Counts the bytes relayed in each
+ * direction, and relays all data as is without copying it.  The argument is
+ * a comma separated list of:
+ *
+ *   verbose      print the byte counts of each conn to stderr when it closes
+ *   block=str    close conns whose first request chunk contains str
+ *
+ * The totals are printed to stderr on exit.  For example, in a ProxySpec:
+ *
+ *   Plugin /path/to/example-plugin.so verbose,block=/admin
+ */
+
+#include "plugin.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/buffer.h>
+
+typedef struct example {
+	unsigned int verbose : 1;
+	char *block;
+	unsigned long long conns;
+	unsigned long long req_bytes;
+	unsigned long long resp_bytes;
+} example_t;
+
+typedef struct example_conn {
+	example_t *example;
+	unsigned long long id;
+	unsigned long long req_bytes;
+	unsigned long long resp_bytes;
+	unsigned int seen_req : 1;
+} example_conn_t;
+
+static int
+example_conn_open(void *arg, const sslproxy_plugin_conn_t *conn, void **connarg)
+{
+	example_t *example = arg;
+	example_conn_t *ec;
+
+	ec = calloc(1, sizeof(example_conn_t));
+	if (!ec)
+		return -1;
+	ec->example = example;
+	ec->id = conn->id;
+	*connarg = ec;
+	__atomic_add_fetch(&example->conns, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int
+example_conn_data(void *connarg, int req, struct evbuffer *in, struct evbuffer *out)
+{
+	example_conn_t *ec = connarg;
+	size_t len = evbuffer_get_length(in);
+
+	if (req) {
+		if (!ec->seen_req && ec->example->block) {
+			struct evbuffer_ptr p = evbuffer_search(in, ec->example->block,
+			                                        strlen(ec->example->block), NULL);
+			if (p.pos != -1)
+				return -1;
+		}
+		ec->seen_req = 1;
+		ec->req_bytes += len;
+	} else {
+		ec->resp_bytes += len;
+	}
+	return evbuffer_add_buffer(out, in);
+}
+
+static void
+example_conn_close(void *connarg)
+{
+	example_conn_t *ec = connarg;
+	example_t *example = ec->example;
+
+	if (example->verbose) {
+		fprintf(stderr, "example-plugin: conn %llu: req %llu bytes, resp %llu bytes\n",
+		        ec->id, ec->req_bytes, ec->resp_bytes);
+	}
+	__atomic_add_fetch(&example->req_bytes, ec->req_bytes, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&example->resp_bytes, ec->resp_bytes, __ATOMIC_RELAXED);
+	free(ec);
+}
+
+static void
+example_fini(void *arg)
+{
+	example_t *example = arg;
+
+	fprintf(stderr, "example-plugin: %llu conns, req %llu bytes, resp %llu bytes\n",
+	        example->conns, example->req_bytes, example->resp_bytes);
+	free(example->block);
+	free(example);
+}
+
+int
+sslproxy_plugin_init(sslproxy_plugin_t *plugin, const char *arg)
+{
+	example_t *example;
+	char *args, *p, *last = NULL;
+
+	if (plugin->abi != SSLPROXY_PLUGIN_ABI) {
+		fprintf(stderr, "example-plugin: built for ABI %u, sslproxy has %u\n",
+		        SSLPROXY_PLUGIN_ABI, plugin->abi);
+		return -1;
+	}
+
+	example = calloc(1, sizeof(example_t));
+	args = strdup(arg ? arg : "");
+	if (!example || !args)
+		goto err;
+	for (p = strtok_r(args, ",", &last); p; p = strtok_r(NULL, ",", &last)) {
+		if (!strcmp(p, "verbose")) {
+			example->verbose = 1;
+		} else if (!strncmp(p, "block=", 6) && p[6]) {
+			example->block = strdup(p + 6);
+			if (!example->block)
+				goto err;
+		} else {
+			fprintf(stderr, "example-plugin: unknown argument '%s'\n", p);
+			goto err;
+		}
+	}
+	free(args);
+
+	plugin->name = "example";
+	plugin->arg = example;
+	plugin->conn_open = example_conn_open;
+	plugin->conn_data = example_conn_data;
+	plugin->conn_close = example_conn_close;
+	plugin->fini = example_fini;
+	return 0;
+err:
+	if (example)
+		free(example->block);
+	free(example);
+	free(args);
+	return -1;
+}
+
+/* vim: set noet ft=c: */
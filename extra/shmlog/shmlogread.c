@@ -0,0 +1,201 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Reader of the shared memory content log of sslproxy, see ShmLog in
+ * sslproxy.conf(5) and logshm.h for the layout.
+ *
+ * Prints a line for each record: time, ring, conn id, record type, direction
+ * and length, and with -p the payload.  Records are read in place; with the
+ * drop-oldest policy the producer may overwrite a record while it is being
+ * read, so the reader copies it out first and discards it if it has been
+ * overwritten.  On exit, prints the stats of the rings.
+ *
+ * Usage: shmlogread [-p] [-q] /name
+ */
+
+#include "logshm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+static volatile sig_atomic_t done = 0;
+
+static void
+sighandler(int sig)
+{
+	(void)sig;
+	done = 1;
+}
+
+static const char *
+type_str(int type)
+{
+	switch (type) {
+	case LOGSHM_REC_OPEN:
+		return "open";
+	case LOGSHM_REC_DATA:
+		return "data";
+	case LOGSHM_REC_CLOSE:
+		return "close";
+	default:
+		return "?";
+	}
+}
+
+static void
+print_rec(unsigned int ringidx, const logshm_rec_t *rec, int payload)
+{
+	time_t secs = rec->ts / 1000000000ULL;
+	struct tm tm;
+	char timebuf[32];
+
+	gmtime_r(&secs, &tm);
+	strftime(timebuf, sizeof(timebuf), "%Y-%m-%dT%H:%M:%S", &tm);
+	printf("%s.%06uZ ring=%u id=%llu %s %s len=%u\n", timebuf,
+	       (unsigned int)(rec->ts % 1000000000ULL / 1000), ringidx,
+	       (long long unsigned int)rec->id, type_str(rec->type),
+	       rec->type == LOGSHM_REC_OPEN ? "-" :
+	       (rec->flags & LOGSHM_REQUEST) ? "req" : "resp", rec->len);
+	if (payload && (rec->type == LOGSHM_REC_OPEN || rec->type == LOGSHM_REC_DATA)) {
+		fwrite(rec->data, 1, rec->len, stdout);
+		putchar('\n');
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	logshm_hdr_t *hdr;
+	logshm_rec_t *copy = NULL;
+	uint64_t nrecs = 0, nbytes = 0, ntorn = 0;
+	int payload = 0, quiet = 0, ch;
+	size_t size;
+
+	while ((ch = getopt(argc, argv, "pq")) != -1) {
+		switch (ch) {
+		case 'p':
+			payload = 1;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1)
+		goto usage;
+
+	hdr = logshm_attach(argv[optind], &size);
+	if (!hdr) {
+		fprintf(stderr, "Cannot attach to %s: %s\n", argv[optind], strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (hdr->policy == LOGSHM_DROP_OLDEST) {
+		copy = malloc(hdr->ringsize);
+		if (!copy) {
+			fprintf(stderr, "Out of memory\n");
+			return EXIT_FAILURE;
+		}
+	}
+	fprintf(stderr, "Attached to %s of pid %llu: %u rings of %llu bytes, %s\n",
+	        argv[optind], (long long unsigned int)hdr->pid, hdr->nrings,
+	        (long long unsigned int)hdr->ringsize, logshm_policy_str(hdr->policy));
+
+	signal(SIGINT, sighandler);
+	signal(SIGTERM, sighandler);
+	while (!done) {
+		int idle = 1;
+
+		for (unsigned int i = 0; i < hdr->nrings; i++) {
+			logshm_ring_t *ring = logshm_hdr_ring(hdr, i);
+			const logshm_rec_t *rec;
+			uint64_t pos;
+
+			while ((rec = logshm_ring_peek(ring, &pos))) {
+				idle = 0;
+				if (copy) {
+					/* the copy is valid if the record has
+					 * not been overwritten until consumed,
+					 * a torn length must not take us past
+					 * the end of the ring meanwhile */
+					size_t room = hdr->ringsize - (pos & (hdr->ringsize - 1));
+					size_t len = LOGSHM_RECSZ(__atomic_load_n(&rec->len, __ATOMIC_RELAXED));
+					memcpy(copy, rec, len <= room ? len : sizeof(logshm_rec_t));
+					if (logshm_ring_consume(ring, pos, rec) == -1) {
+						ntorn++;
+						continue;
+					}
+					rec = copy;
+				}
+				nrecs++;
+				nbytes += rec->len;
+				if (!quiet)
+					print_rec(i, rec, payload);
+				if (!copy && logshm_ring_consume(ring, pos, rec) == -1)
+					ntorn++;
+			}
+		}
+		if (idle) {
+			struct timespec ts = {0, 1000000};
+			fflush(stdout);
+			nanosleep(&ts, NULL);
+		}
+	}
+	fflush(stdout);
+
+	fprintf(stderr, "Read %llu records, %llu payload bytes, %llu overwritten while reading\n",
+	        (long long unsigned int)nrecs, (long long unsigned int)nbytes,
+	        (long long unsigned int)ntorn);
+	for (unsigned int i = 0; i < hdr->nrings; i++) {
+		logshm_ring_t *ring = logshm_hdr_ring(hdr, i);
+		fprintf(stderr, "Ring %u: %llu records, %llu dropped, %llu overwritten, %llu paused\n", i,
+		        (long long unsigned int)ring->records,
+		        (long long unsigned int)ring->drops,
+		        (long long unsigned int)ring->overwrites,
+		        (long long unsigned int)ring->pauses);
+	}
+	free(copy);
+	logshm_detach(hdr, size);
+	return EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "Usage: %s [-p] [-q] /name\n"
+	                " -p  print payloads\n"
+	                " -q  print stats on exit only\n", argv[0]);
+	return EXIT_FAILURE;
+}
+
+/* vim: set noet ft=c: */
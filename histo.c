@@ -0,0 +1,149 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "histo.h"
+
+#include <time.h>
+
+/*
+ * Monotonic clock in microseconds, for timing conn setup phases.
+ */
+uint64_t
+histo_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Return the index of the bucket counting value v.
+ */
+unsigned int
+histo_bucket(uint64_t v)
+{
+	unsigned int exp;
+
+	if (v < HISTO_SUB)
+		return v;
+	if (v >= (uint64_t)1 << HISTO_MAXEXP)
+		return HISTO_NBUCKETS - 1;
+	exp = 63 - __builtin_clzll(v);
+	return (exp - HISTO_SUBBITS + 1) * HISTO_SUB +
+	       ((v >> (exp - HISTO_SUBBITS)) & (HISTO_SUB - 1));
+}
+
+/*
+ * Return the largest value counted in bucket i.
+ */
+uint64_t
+histo_bucket_max(unsigned int i)
+{
+	unsigned int shift;
+
+	if (i < HISTO_SUB)
+		return i;
+	shift = i / HISTO_SUB - 1;
+	return ((uint64_t)(HISTO_SUB + i % HISTO_SUB + 1) << shift) - 1;
+}
+
+/*
+ * Count value v.  Must be called by the thread owning the histogram only,
+ * which makes the read-modify-write sequences safe without locked
+ * instructions; the stores are atomic for readers on other threads.
+ */
+void
+histo_add(histo_t *h, uint64_t v)
+{
+	unsigned int i = histo_bucket(v);
+
+	__atomic_store_n(&h->count[i], h->count[i] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->sum, h->sum + v, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->total, h->total + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Add the counts of histogram src, which may be updated concurrently by its
+ * owner, to histogram dst.  The total of dst is summed up from the buckets,
+ * so that it matches the buckets even if src is updated meanwhile.
+ */
+void
+histo_merge(histo_t *dst, const histo_t *src)
+{
+	for (unsigned int i = 0; i < HISTO_NBUCKETS; i++) {
+		uint64_t n = __atomic_load_n(&src->count[i], __ATOMIC_RELAXED);
+		dst->count[i] += n;
+		dst->total += n;
+	}
+	dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+}
+
+/*
+ * Return the number of values below bound.  Exact if bound is the smallest
+ * value of a bucket, such as a power of two, approximate otherwise.
+ */
+uint64_t
+histo_count_below(const histo_t *h, uint64_t bound)
+{
+	uint64_t n = 0;
+
+	for (unsigned int i = 0; i < HISTO_NBUCKETS - 1; i++) {
+		if (histo_bucket_max(i) >= bound)
+			break;
+		n += h->count[i];
+	}
+	return n;
+}
+
+/*
+ * Return the value at quantile q, 0.0-1.0, rounded up to the largest value of
+ * its bucket, or 0 if the histogram is empty.
+ */
+uint64_t
+histo_quantile(const histo_t *h, double q)
+{
+	uint64_t rank, n = 0;
+
+	if (!h->total)
+		return 0;
+	rank = (uint64_t)(q * h->total + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > h->total)
+		rank = h->total;
+	for (unsigned int i = 0; i < HISTO_NBUCKETS; i++) {
+		n += h->count[i];
+		if (n >= rank)
+			return histo_bucket_max(i);
+	}
+	return histo_bucket_max(HISTO_NBUCKETS - 1);
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,68 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HISTO_H
+#define HISTO_H
+
+#include "attrib.h"
+
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram in microseconds, HDR style: each power of two
+ * is split into HISTO_SUB buckets, so the relative error of a bucket is below
+ * 1/HISTO_SUB.  Values of 2^HISTO_MAXEXP usec (about 71 minutes) and more are
+ * counted in the last bucket.
+ *
+ * A histogram has a single writer, the thread owning it, which updates it
+ * without locks.  Other threads may read it at any time using histo_merge(),
+ * and see each counter either before or after an update.
+ */
+#define HISTO_SUBBITS 3
+#define HISTO_SUB (1 << HISTO_SUBBITS)
+#define HISTO_MAXEXP 32
+#define HISTO_NBUCKETS ((HISTO_MAXEXP - HISTO_SUBBITS + 1) * HISTO_SUB)
+
+typedef struct histo {
+	uint64_t count[HISTO_NBUCKETS];
+	uint64_t total;
+	uint64_t sum;
+} histo_t;
+
+uint64_t histo_now(void);
+unsigned int histo_bucket(uint64_t) PURE;
+uint64_t histo_bucket_max(unsigned int) PURE;
+void histo_add(histo_t *, uint64_t) NONNULL(1);
+void histo_merge(histo_t *, const histo_t *) NONNULL(1,2);
+uint64_t histo_count_below(const histo_t *, uint64_t) NONNULL(1) PURE;
+uint64_t histo_quantile(const histo_t *, double) NONNULL(1) PURE;
+
+#endif /* !HISTO_H */
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,122 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "histo.h"
+
+#include <string.h>
+
+#include <check.h>
+
+START_TEST(histo_bucket_01)
+{
+	unsigned int prev = 0;
+
+	for (uint64_t v = 0; v < 100000; v++) {
+		unsigned int i = histo_bucket(v);
+		fail_unless(i == prev || i == prev + 1, "buckets not contiguous");
+		fail_unless(v <= histo_bucket_max(i), "value above bucket max");
+		fail_unless(!i || v > histo_bucket_max(i - 1), "value in wrong bucket");
+		prev = i;
+	}
+}
+END_TEST
+
+START_TEST(histo_bucket_02)
+{
+	fail_unless(histo_bucket(7) == 7, "exact bucket mismatch");
+	fail_unless(histo_bucket(1024) == histo_bucket(1151), "sub bucket mismatch");
+	fail_unless(histo_bucket(1152) == histo_bucket(1024) + 1, "next sub bucket mismatch");
+	fail_unless(histo_bucket((uint64_t)1 << HISTO_MAXEXP) == HISTO_NBUCKETS - 1, "overflow not in last bucket");
+	fail_unless(histo_bucket(UINT64_MAX) == HISTO_NBUCKETS - 1, "max not in last bucket");
+	fail_unless(histo_bucket_max(HISTO_NBUCKETS - 1) == ((uint64_t)1 << HISTO_MAXEXP) - 1, "last bucket max mismatch");
+}
+END_TEST
+
+START_TEST(histo_add_01)
+{
+	histo_t h, m;
+
+	memset(&h, 0, sizeof(h));
+	memset(&m, 0, sizeof(m));
+	for (uint64_t v = 1; v <= 1000; v++) {
+		histo_add(&h, v);
+	}
+	fail_unless(h.total == 1000, "total mismatch");
+	fail_unless(h.sum == 500500, "sum mismatch");
+
+	histo_merge(&m, &h);
+	histo_merge(&m, &h);
+	fail_unless(m.total == 2000, "merged total mismatch");
+	fail_unless(m.sum == 1001000, "merged sum mismatch");
+	fail_unless(histo_count_below(&m, 512) == 2 * 511, "count below mismatch");
+	fail_unless(histo_count_below(&m, 4096) == 2000, "count below all mismatch");
+}
+END_TEST
+
+START_TEST(histo_quantile_01)
+{
+	histo_t h;
+	uint64_t q;
+
+	memset(&h, 0, sizeof(h));
+	fail_unless(histo_quantile(&h, 0.5) == 0, "empty quantile not 0");
+	for (uint64_t v = 1; v <= 1000; v++) {
+		histo_add(&h, v);
+	}
+	q = histo_quantile(&h, 0.5);
+	fail_unless(q >= 500 && q < 500 + 500 / HISTO_SUB, "median off");
+	q = histo_quantile(&h, 0.99);
+	fail_unless(q >= 990 && q < 990 + 990 / HISTO_SUB, "p99 off");
+	fail_unless(histo_quantile(&h, 1.0) >= 1000, "max off");
+	fail_unless(histo_quantile(&h, 0.0) == 1, "min off");
+}
+END_TEST
+
+Suite *
+histo_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("histo");
+
+	tc = tcase_create("histo_bucket");
+	tcase_add_test(tc, histo_bucket_01);
+	tcase_add_test(tc, histo_bucket_02);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("histo_add");
+	tcase_add_test(tc, histo_add_01);
+	tcase_add_test(tc, histo_quantile_01);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
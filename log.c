@@ -34,6 +34,10 @@
 #include "privsep.h"
 #include "defaults.h"
 #include "logpkt.h"
+#include "logshm.h"
+#include "logstore.h"
+#include "logz.h"
+#include "pxythrmgr.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -291,6 +295,39 @@ log_masterkey_fini(void)
  * Uses a logger thread.
  */
 
+/*
+ * Close the fd of a log file, writing out its pending compressed data first.
+ */
+static void
+log_close_fd(int fd, const char *what)
+{
+	if (logz_close(fd) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to write to %s: %s\n",
+		               what, strerror(errno));
+	}
+	close(fd);
+}
+
+/*
+ * Compress the writes to fd of the log file fn, if compression is enabled.
+ */
+static int
+log_logz_open(int fd, const char *fn)
+{
+	if (logz_open(fd) == -1) {
+		if (errno == EINVAL) {
+			log_err_level_printf(LOG_CRIT, "Refusing to append compressed logs to '%s',"
+			               " which is not empty and not compressed with the"
+			               " configured LogCompression\n", fn);
+		} else {
+			log_err_level_printf(LOG_CRIT, "Failed to set up log compression for '%s'"
+			               ": %s (%i)\n", fn, strerror(errno), errno);
+		}
+		return -1;
+	}
+	return 0;
+}
+
 logger_t *connect_log = NULL;
 static int connect_fd = -1;
 static char *connect_fn = NULL;
@@ -299,7 +336,8 @@ static int connect_clisock = -1;
 static int
 log_connect_preinit(const char *logfile)
 {
-	connect_fd = open(logfile, O_WRONLY|O_APPEND|O_CREAT, DFLT_FILEMODE);
+	/* opened for reading too, for the compression check of logz_open() */
+	connect_fd = open(logfile, O_RDWR|O_APPEND|O_CREAT, DFLT_FILEMODE);
 	if (connect_fd == -1) {
 		log_err_level_printf(LOG_CRIT, "Failed to open '%s' for writing: %s (%i)\n",
 		               logfile, strerror(errno), errno);
@@ -317,7 +355,7 @@ log_connect_preinit(const char *logfile)
 static int
 log_connect_reopencb(void)
 {
-	close(connect_fd);
+	log_close_fd(connect_fd, "connect log");
 	connect_fd = privsep_client_openfile(connect_clisock,
 	                                     connect_fn,
 	                                     0);
@@ -328,7 +366,7 @@ log_connect_reopencb(void)
 		connect_fn = NULL;
 		return -1;
 	}
-	return 0;
+	return log_logz_open(connect_fd, connect_fn);
 }
 
 /*
@@ -353,8 +391,8 @@ log_connect_writecb(UNUSED int level, UNUSED void *fh, UNUSED unsigned long ctl,
 		log_err_level_printf(LOG_CRIT, "Error from strftime(): buffer too small\n");
 		return -1;
 	}
-	if ((write(connect_fd, timebuf, n) == -1) ||
-	    (write(connect_fd, buf, sz) == -1)) {
+	if ((logz_write(connect_fd, timebuf, n) == -1) ||
+	    (logz_write(connect_fd, buf, sz) == -1)) {
 		log_err_level_printf(LOG_CRIT, "Failed to write to connect log: %s\n",
 		               strerror(errno));
 		return -1;
@@ -365,7 +403,7 @@ log_connect_writecb(UNUSED int level, UNUSED void *fh, UNUSED unsigned long ctl,
 static void
 log_connect_fini(void)
 {
-	close(connect_fd);
+	log_close_fd(connect_fd, "connect log");
 }
 
 static int
@@ -421,6 +459,9 @@ typedef struct log_content_file_ctx {
 			int fd;
 			char *filename;
 		} spec;
+		struct {
+			logstore_conn_t conn;
+		} store;
 	} u;
 } log_content_file_ctx_t;
 
@@ -460,6 +501,123 @@ static uint8_t content_mirror_src_ether[ETHER_ADDR_LEN];
 static uint8_t content_mirror_dst_ether[ETHER_ADDR_LEN];
 #endif /* !WITHOUT_MIRROR */
 
+/*
+ * Shared memory rings for ShmLog, one per conn handling thread.  Unlike the
+ * other content logs, the conn handling threads write to their rings
+ * directly instead of handing the content over to a logger thread.
+ */
+static logshm_t *content_shm = NULL;
+
+/*
+ * Content the ring of the conn had no space for with the pause policy,
+ * written by log_content_shm_flush() once the reader has made space.
+ */
+struct log_content_shm_pending {
+	struct log_content_shm_pending *next;
+	int type;
+	int flags;
+	size_t sz;
+	unsigned char buf[];
+};
+
+/*
+ * Write records to the ring of the conn, splitting payloads which exceed the
+ * max record size.  Records dropped by the overflow policy are counted in the
+ * ring, the conn goes on.  Returns -1 if the pause policy refused a record,
+ * with the number of bytes written before it in done, 0 otherwise.
+ */
+static int
+log_content_shm_put(log_content_ctx_t *ctx, int type, int flags,
+                    const unsigned char *buf, size_t sz, size_t *done)
+{
+	size_t max = logshm_ring_maxpayload(ctx->shm);
+
+	*done = 0;
+	do {
+		size_t n = sz - *done < max ? sz - *done : max;
+		if (logshm_ring_write(ctx->shm, ctx->shm_id, type, flags, buf + *done, n) == -1 &&
+		    errno == ENOBUFS && ctx->shm->policy == LOGSHM_PAUSE)
+			return -1;
+		*done += n;
+	} while (*done < sz);
+	return 0;
+}
+
+/*
+ * Write to the ring of the conn.  Content the pause policy refuses is kept in
+ * order behind any content kept before, see log_content_shm_paused().
+ */
+static void
+log_content_shm_write(log_content_ctx_t *ctx, int type, int flags,
+                      const unsigned char *buf, size_t sz)
+{
+	struct log_content_shm_pending *p, **tail;
+	size_t done = 0;
+
+	if (!ctx->shm_pending &&
+	    log_content_shm_put(ctx, type, flags, buf, sz, &done) == 0)
+		return;
+
+	if (!(p = malloc(sizeof(*p) + sz - done))) {
+		logshm_ring_drop(ctx->shm);
+		return;
+	}
+	p->next = NULL;
+	p->type = type;
+	p->flags = flags;
+	p->sz = sz - done;
+	memcpy(p->buf, buf + done, sz - done);
+	for (tail = &ctx->shm_pending; *tail; tail = &(*tail)->next);
+	*tail = p;
+}
+
+/*
+ * Return 1 if the ring of the conn had no space for its content, in which
+ * case the conn should stop reading until log_content_shm_flush() succeeds.
+ */
+int
+log_content_shm_paused(log_content_ctx_t *ctx)
+{
+	return !!ctx->shm_pending;
+}
+
+/*
+ * Write the content kept by the pause policy.  Returns 0 if all of it has
+ * been written, -1 if the ring is still full.
+ */
+int
+log_content_shm_flush(log_content_ctx_t *ctx)
+{
+	struct log_content_shm_pending *p;
+	size_t done;
+
+	while ((p = ctx->shm_pending)) {
+		if (log_content_shm_put(ctx, p->type, p->flags, p->buf, p->sz, &done) == -1) {
+			memmove(p->buf, p->buf + done, p->sz - done);
+			p->sz -= done;
+			return -1;
+		}
+		ctx->shm_pending = p->next;
+		free(p);
+	}
+	return 0;
+}
+
+/*
+ * Drop the content kept by the pause policy of a conn going away.
+ */
+static void
+log_content_shm_drop(log_content_ctx_t *ctx)
+{
+	struct log_content_shm_pending *p;
+
+	while ((p = ctx->shm_pending)) {
+		ctx->shm_pending = p->next;
+		logshm_ring_drop(ctx->shm);
+		free(p);
+	}
+}
+
 /*
  * Split a pathname into static LHS (including final slashes) and dynamic RHS.
  * Returns -1 on error, 0 on success.
@@ -526,8 +684,8 @@ log_content_split_pathspec(const char *path, char **lhs, char **rhs)
 #define PATH_BUF_INC	1024
 static char * MALLOC NONNULL(1,2,3)
 log_content_format_pathspec(const char *logspec,
-                            char *srchost, char *srcport,
-                            char *dsthost, char *dstport,
+                            const char *srchost, const char *srcport,
+                            const char *dsthost, const char *dstport,
                             char *exec_path, char *user, char *group)
 {
 	/* set up buffer to hold our generated file path */
@@ -678,10 +836,12 @@ log_content_format_pathspec(const char *logspec,
  */
 int
 log_content_open(log_content_ctx_t *ctx, global_t *global,
+                 long long unsigned int id, int thridx,
                  const struct sockaddr *srcaddr, socklen_t srcaddrlen,
                  const struct sockaddr *dstaddr, socklen_t dstaddrlen,
-                 char *srchost, char *srcport,
-                 char *dsthost, char *dstport,
+                 const char *srchost, const char *srcport,
+                 const char *dsthost, const char *dstport,
+                 const char *sni, const char *authuser,
                  char *exec_path, char *user, char *group)
 {
 	char timebuf[24];
@@ -690,7 +850,7 @@ log_content_open(log_content_ctx_t *ctx, global_t *global,
 	char *dsthost_clean = NULL;
 	char *srchost_clean = NULL;
 
-	if (ctx->file || ctx->pcap
+	if (ctx->file || ctx->pcap || ctx->shm
 #ifndef WITHOUT_MIRROR
 	    || ctx->mirror
 #endif /* !WITHOUT_MIRROR */
@@ -741,10 +901,11 @@ log_content_open(log_content_ctx_t *ctx, global_t *global,
 		if (global->contentlog_isdir) {
 			/* per-connection-file content log (-S) */
 			if (asprintf(&ctx->file->u.dir.filename,
-			             "%s/%s-%s,%s-%s,%s.log",
+			             "%s/%s-%s,%s-%s,%s.log%s",
 			             global->contentlog, timebuf,
 			             srchost_clean, srcport,
-			             dsthost_clean, dstport) < 0) {
+			             dsthost_clean, dstport,
+			             logz_suffix()) < 0) {
 				log_err_level_printf(LOG_CRIT, "Failed to format filename:"
 				               " %s (%i)\n",
 				               strerror(errno), errno);
@@ -763,6 +924,16 @@ log_content_open(log_content_ctx_t *ctx, global_t *global,
 			if (!ctx->file->u.spec.filename) {
 				goto errout;
 			}
+		} else if (global->contentlog_isstore) {
+			/* segmented content log store */
+			char src[128], dst[128];
+
+			snprintf(src, sizeof(src), "[%s]:%s", srchost, srcport);
+			snprintf(dst, sizeof(dst), "[%s]:%s", dsthost, dstport);
+			if (logstore_conn_init(&ctx->file->u.store.conn, id,
+			                       src, dst, sni, authuser) == -1) {
+				goto errout;
+			}
 		} else {
 			/* single-file content log (-L) */
 			if (asprintf(&ctx->file->u.single.header_req,
@@ -792,10 +963,11 @@ log_content_open(log_content_ctx_t *ctx, global_t *global,
 		if (global->pcaplog_isdir) {
 			/* per-connection-file pcap log (-Y) */
 			if (asprintf(&ctx->pcap->u.dir.filename,
-			             "%s/%s-%s,%s-%s,%s.pcap",
+			             "%s/%s-%s,%s-%s,%s.pcap%s",
 			             global->pcaplog, timebuf,
 			             srchost_clean, srcport,
-			             dsthost_clean, dstport) < 0) {
+			             dsthost_clean, dstport,
+			             logz_suffix()) < 0) {
 				log_err_level_printf(LOG_CRIT, "Failed to format filename:"
 				               " %s (%i)\n",
 				               strerror(errno), errno);
@@ -848,6 +1020,16 @@ log_content_open(log_content_ctx_t *ctx, global_t *global,
 			goto errout;
 	}
 #endif /* !WITHOUT_MIRROR */
+	if (content_shm) {
+		char buf[256];
+		int len = snprintf(buf, sizeof(buf), "[%s]:%s -> [%s]:%s",
+		                   srchost, srcport, dsthost, dstport);
+
+		ctx->shm = logshm_ring(content_shm, thridx);
+		ctx->shm_id = id;
+		log_content_shm_write(ctx, LOGSHM_REC_OPEN, 0, (unsigned char *)buf,
+		                      len < (int)sizeof(buf) ? (size_t)len : sizeof(buf) - 1);
+	}
 
 	if (srchost_clean)
 		free(srchost_clean);
@@ -888,6 +1070,20 @@ log_content_submit(log_content_ctx_t *ctx, logbuf_t *lb, int is_request)
 	if (!lb)
 		return -1;
 
+	if (ctx->shm) {
+		log_content_shm_write(ctx, LOGSHM_REC_DATA,
+		                      is_request ? LOGSHM_REQUEST : 0,
+		                      lb->buf, lb->sz);
+		if (!content_file_log && !content_pcap_log
+#ifndef WITHOUT_MIRROR
+		    && !content_mirror_log
+#endif /* !WITHOUT_MIRROR */
+		    ) {
+			logbuf_free(lb);
+			return 0;
+		}
+	}
+
 	lbpcap = lbmirror = lb;
 	if (content_file_log) {
 		if (content_pcap_log) {
@@ -957,6 +1153,17 @@ log_content_close(log_content_ctx_t *ctx, int by_requestor)
 	 * closing the file.  The logger_close() call will actually close the
 	 * log.  Some logs prefer to use the close callback for logging the
 	 * close event to the log. */
+	if (ctx->shm) {
+		// The conn cannot wait for the reader anymore, what does not fit is dropped
+		if (log_content_shm_flush(ctx) == 0) {
+			log_content_shm_write(ctx, LOGSHM_REC_CLOSE,
+			                      by_requestor ? LOGSHM_REQUEST : 0, NULL, 0);
+		} else {
+			logshm_ring_drop(ctx->shm);
+		}
+		log_content_shm_drop(ctx);
+		ctx->shm = NULL;
+	}
 	if (content_file_log && ctx->file) {
 		if (logger_submit(content_file_log, ctx->file,
 		                  prepflags, NULL) == -1) {
@@ -1012,7 +1219,7 @@ log_content_file_dir_opencb(void *fh)
 		               strerror(errno), errno);
 		return -1;
 	}
-	return 0;
+	return log_logz_open(ctx->u.dir.fd, ctx->u.dir.filename);
 }
 
 static void
@@ -1023,7 +1230,7 @@ log_content_file_dir_closecb(void *fh, UNUSED unsigned long ctl)
 	if (ctx->u.dir.filename)
 		free(ctx->u.dir.filename);
 	if (ctx->u.dir.fd != 1)
-		close(ctx->u.dir.fd);
+		log_close_fd(ctx->u.dir.fd, "content log");
 	free(ctx);
 }
 
@@ -1033,7 +1240,7 @@ log_content_file_dir_writecb(UNUSED int level, void *fh, UNUSED unsigned long ct
 {
 	log_content_file_ctx_t *ctx = fh;
 
-	if (write(ctx->u.dir.fd, buf, sz) == -1) {
+	if (logz_write(ctx->u.dir.fd, buf, sz) == -1) {
 		log_err_level_printf(LOG_CRIT, "Failed to write to content log: %s\n",
 		               strerror(errno));
 		return -1;
@@ -1053,7 +1260,7 @@ log_content_file_spec_opencb(void *fh)
 		               ctx->u.spec.filename, strerror(errno), errno);
 		return -1;
 	}
-	return 0;
+	return log_logz_open(ctx->u.spec.fd, ctx->u.spec.filename);
 }
 
 static void
@@ -1064,7 +1271,7 @@ log_content_file_spec_closecb(void *fh, UNUSED unsigned long ctl)
 	if (ctx->u.spec.filename)
 		free(ctx->u.spec.filename);
 	if (ctx->u.spec.fd != -1)
-		close(ctx->u.spec.fd);
+		log_close_fd(ctx->u.spec.fd, "content log");
 	free(ctx);
 }
 
@@ -1074,7 +1281,7 @@ log_content_file_spec_writecb(UNUSED int level, void *fh, UNUSED unsigned long c
 {
 	log_content_file_ctx_t *ctx = fh;
 
-	if (write(ctx->u.spec.fd, buf, sz) == -1) {
+	if (logz_write(ctx->u.spec.fd, buf, sz) == -1) {
 		log_err_level_printf(LOG_CRIT, "Failed to write to content log: %s\n",
 		               strerror(errno));
 		return -1;
@@ -1088,7 +1295,8 @@ static char *content_file_single_fn = NULL;
 static int
 log_content_file_single_preinit(const char *logfile)
 {
-	content_file_single_fd = open(logfile, O_WRONLY|O_APPEND|O_CREAT,
+	/* opened for reading too, for the compression check of logz_open() */
+	content_file_single_fd = open(logfile, O_RDWR|O_APPEND|O_CREAT,
 	                       DFLT_FILEMODE);
 	if (content_file_single_fd == -1) {
 		log_err_level_printf(LOG_CRIT, "Failed to open '%s' for writing: %s (%i)\n",
@@ -1112,7 +1320,7 @@ log_content_file_single_fini(void)
 		content_file_single_fn = NULL;
 	}
 	if (content_file_single_fd != -1) {
-		close(content_file_single_fd);
+		log_close_fd(content_file_single_fd, "content log");
 		content_file_single_fd = -1;
 	}
 }
@@ -1120,7 +1328,7 @@ log_content_file_single_fini(void)
 static int
 log_content_file_single_reopencb(void)
 {
-	close(content_file_single_fd);
+	log_close_fd(content_file_single_fd, "content log");
 	content_file_single_fd = privsep_client_openfile(content_file_clisock,
 	                                                 content_file_single_fn,
 	                                                 0);
@@ -1129,7 +1337,7 @@ log_content_file_single_reopencb(void)
 		               content_file_single_fn, strerror(errno), errno);
 		return -1;
 	}
-	return 0;
+	return log_logz_open(content_file_single_fd, content_file_single_fn);
 }
 
 static void
@@ -1152,7 +1360,7 @@ log_content_file_single_writecb(UNUSED int level, void *fh, UNUSED unsigned long
 {
 	UNUSED log_content_file_ctx_t *ctx = fh;
 
-	if (write(content_file_single_fd, buf, sz) == -1) {
+	if (logz_write(content_file_single_fd, buf, sz) == -1) {
 		log_err_level_printf(LOG_CRIT, "Failed to write to content log: %s\n",
 		               strerror(errno));
 		return -1;
@@ -1214,6 +1422,110 @@ out:
 	return lb;
 }
 
+/*
+ * Segmented content log store (ContentLogStore).  The records of all conns
+ * are appended to the segments of a single store writer in the logger
+ * thread, so the conn state lives in the file ctx.
+ */
+static logstore_t *content_file_store = NULL;
+
+static int
+log_content_file_store_openfile(const char *fn, UNUSED void *arg)
+{
+	int fd;
+
+	if ((fd = privsep_client_openfile(content_file_clisock, fn, 0)) == -1) {
+		log_err_level_printf(LOG_CRIT, "Opening log store file '%s' failed: %s (%i)\n",
+		               fn, strerror(errno), errno);
+	}
+	return fd;
+}
+
+static int
+log_content_file_store_preinit(global_t *global)
+{
+	content_file_store = logstore_new(global->contentlog,
+	                                  global->contentlog_segsize,
+	                                  log_content_file_store_openfile,
+	                                  NULL);
+	if (!content_file_store) {
+		log_err_level_printf(LOG_CRIT, "Failed to create log store writer\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void
+log_content_file_store_fini(void)
+{
+	if (content_file_store) {
+		logstore_free(content_file_store);
+		content_file_store = NULL;
+	}
+}
+
+static int
+log_content_file_store_reopencb(void)
+{
+	logstore_rotate(content_file_store);
+	return 0;
+}
+
+static int
+log_content_file_store_opencb(void *fh)
+{
+	log_content_file_ctx_t *ctx = fh;
+
+	if (logstore_write(content_file_store, &ctx->u.store.conn,
+	                   LOGSTORE_REC_OPEN, 0, NULL, 0) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to write to log store: %s\n",
+		               strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void
+log_content_file_store_closecb(void *fh, unsigned long ctl)
+{
+	log_content_file_ctx_t *ctx = fh;
+
+	if (logstore_conn_close(content_file_store, &ctx->u.store.conn,
+	                        !!(ctl & LBFLAG_IS_REQ)) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to write to log store: %s\n",
+		               strerror(errno));
+	}
+	free(ctx);
+}
+
+static ssize_t
+log_content_file_store_writecb(UNUSED int level, void *fh, unsigned long ctl,
+                               const void *buf, size_t sz)
+{
+	log_content_file_ctx_t *ctx = fh;
+
+	if (logstore_write(content_file_store, &ctx->u.store.conn,
+	                   LOGSTORE_REC_DATA,
+	                   (ctl & LBFLAG_IS_REQ) ? LOGSTORE_REQUEST : 0,
+	                   buf, sz) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to write to log store: %s\n",
+		               strerror(errno));
+		return -1;
+	}
+	return sz;
+}
+
+static logbuf_t *
+log_content_file_store_prepcb(UNUSED void *fh, unsigned long prepflags,
+                              logbuf_t *lb)
+{
+	if (prepflags & PREPFLAG_EOF)
+		return lb;
+	logbuf_ctl_set(lb, (prepflags & PREPFLAG_REQUEST) ? LBFLAG_IS_REQ
+	                                                  : LBFLAG_IS_RESP);
+	return lb;
+}
+
 /*
  * Pcap writer for -X/-Y/-y options.
  */
@@ -1222,10 +1534,12 @@ static char *content_pcap_fn = NULL;
 
 /*
  * Initialize pcap content logging.  For single-file mode, pcapfile is the
- * path to the file.  For dir/spec modes, pcapfile is NULL.
+ * path to the file.  For dir/spec modes, pcapfile is NULL.  If the file is
+ * compressed, the header is written in log_init once compression has
+ * started.
  */
 static int
-log_content_pcap_preinit(const char *pcapfile)
+log_content_pcap_preinit(const char *pcapfile, int compressed)
 {
 	if (!pcapfile)
 		return 0;
@@ -1238,7 +1552,7 @@ log_content_pcap_preinit(const char *pcapfile)
 		               pcapfile, strerror(errno), errno);
 		return -1;
 	}
-	if (logpkt_pcap_open_fd(content_pcap_fd) == -1) {
+	if (!compressed && logpkt_pcap_open_fd(content_pcap_fd) == -1) {
 		log_err_level_printf(LOG_CRIT, "Failed to prepare '%s' for PCAP writing"
 		               ": %s (%i)\n",
 		               pcapfile, strerror(errno), errno);
@@ -1263,14 +1577,14 @@ log_content_pcap_fini(void)
 		content_pcap_fn = NULL;
 	}
 	if (content_pcap_fd != -1) {
-		close(content_pcap_fd);
+		log_close_fd(content_pcap_fd, "pcap log");
 		content_pcap_fd = -1;
 	}
 }
 
 static int
 log_content_pcap_reopencb(void) {
-	close(content_pcap_fd);
+	log_close_fd(content_pcap_fd, "pcap log");
 	content_pcap_fd = privsep_client_openfile(content_pcap_clisock,
 	                                          content_pcap_fn,
 	                                          0);
@@ -1279,6 +1593,11 @@ log_content_pcap_reopencb(void) {
 		               content_pcap_fn, strerror(errno), errno);
 		return -1;
 	}
+	if (log_logz_open(content_pcap_fd, content_pcap_fn) == -1) {
+		close(content_pcap_fd);
+		content_pcap_fd = -1;
+		return -1;
+	}
 	if (logpkt_pcap_open_fd(content_pcap_fd) == -1) {
 		log_err_level_printf(LOG_CRIT, "Failed to prepare '%s' for PCAP writing"
 		               ": %s (%i)\n",
@@ -1341,6 +1660,8 @@ log_content_pcap_dir_opencb(void *fh)
 		               ctx->u.dir.filename, strerror(errno), errno);
 		return -1;
 	}
+	if (log_logz_open(ctx->u.dir.fd, ctx->u.dir.filename) == -1)
+		return -1;
 	return logpkt_pcap_open_fd(ctx->u.dir.fd);
 }
 
@@ -1352,7 +1673,7 @@ log_content_pcap_dir_closecb(void *fh, unsigned long ctl)
 	if (ctx->u.dir.filename)
 		free(ctx->u.dir.filename);
 	if (ctx->u.dir.fd != -1)
-		close(ctx->u.dir.fd);
+		log_close_fd(ctx->u.dir.fd, "pcap log");
 	free(ctx);
 }
 
@@ -1376,6 +1697,8 @@ log_content_pcap_spec_opencb(void *fh)
 		               ctx->u.spec.filename, strerror(errno), errno);
 		return -1;
 	}
+	if (log_logz_open(ctx->u.spec.fd, ctx->u.spec.filename) == -1)
+		return -1;
 	return logpkt_pcap_open_fd(ctx->u.spec.fd);
 }
 
@@ -1387,7 +1710,7 @@ log_content_pcap_spec_closecb(void *fh, unsigned long ctl)
 	if (ctx->u.spec.filename)
 		free(ctx->u.spec.filename);
 	if (ctx->u.spec.fd != -1)
-		close(ctx->u.spec.fd);
+		log_close_fd(ctx->u.spec.fd, "pcap log");
 	free(ctx);
 }
 
@@ -1579,6 +1902,14 @@ log_preinit(global_t *global)
 			closecb = log_content_file_spec_closecb;
 			writecb = log_content_file_spec_writecb;
 			prepcb = NULL;
+		} else if (global->contentlog_isstore) {
+			if (log_content_file_store_preinit(global) == -1)
+				goto out;
+			reopencb = log_content_file_store_reopencb;
+			opencb = log_content_file_store_opencb;
+			closecb = log_content_file_store_closecb;
+			writecb = log_content_file_store_writecb;
+			prepcb = log_content_file_store_prepcb;
 		} else {
 			if (log_content_file_single_preinit(global->contentlog) == -1)
 				goto out;
@@ -1592,6 +1923,7 @@ log_preinit(global_t *global)
 		                                    writecb, prepcb,
 		                                    log_exceptcb))) {
 			log_content_file_single_fini();
+			log_content_file_store_fini();
 			goto out;
 		}
 	}
@@ -1599,7 +1931,8 @@ log_preinit(global_t *global)
 		if (log_content_pcap_preinit((global->pcaplog_isdir ||
 		                              global->pcaplog_isspec) ?
 		                              NULL :
-		                              global->pcaplog) == -1)
+		                              global->pcaplog,
+		                              global->logz != LOGZ_NONE) == -1)
 			goto out;
 		if (global->pcaplog_isdir) {
 			reopencb = NULL;
@@ -1645,6 +1978,16 @@ log_preinit(global_t *global)
 		}
 	}
 #endif /* !WITHOUT_MIRROR */
+	if (global->shmlog) {
+		if (!(content_shm = logshm_new(global->shmlog,
+		                               pxy_thrmgr_num_thr(global),
+		                               global->shmlog_size,
+		                               global->shmlog_policy))) {
+			log_err_level_printf(LOG_CRIT, "Failed to create shared memory log '%s': %s (%i)\n",
+			               global->shmlog, strerror(errno), errno);
+			goto out;
+		}
+	}
 	if (global->connectlog) {
 		if (log_connect_preinit(global->connectlog) == -1)
 			goto out;
@@ -1684,6 +2027,7 @@ out:
 	}
 	if (content_file_log) {
 		log_content_file_single_fini();
+		log_content_file_store_fini();
 		logger_free(content_file_log);
 	}
 	if (content_pcap_log) {
@@ -1696,6 +2040,10 @@ out:
 		logger_free(content_mirror_log);
 	}
 #endif /* !WITHOUT_MIRROR */
+	if (content_shm) {
+		logshm_free(content_shm);
+		content_shm = NULL;
+	}
 	if (cert_log) {
 		logger_free(cert_log);
 	}
@@ -1720,6 +2068,7 @@ log_preinit_undo(void)
 	}
 	if (content_file_log) {
 		log_content_file_single_fini();
+		log_content_file_store_fini();
 		logger_free(content_file_log);
 	}
 	if (content_pcap_log) {
@@ -1732,12 +2081,39 @@ log_preinit_undo(void)
 		logger_free(content_mirror_log);
 	}
 #endif /* !WITHOUT_MIRROR */
+	if (content_shm) {
+		logshm_free(content_shm);
+		content_shm = NULL;
+	}
 	if (masterkey_log) {
 		log_masterkey_fini();
 		logger_free(masterkey_log);
 	}
 }
 
+/*
+ * Pin the logging threads to the CPUs in LoggerCPUs, so that they do not
+ * compete with the conn handling threads for CPUs and caches.
+ */
+static void
+log_set_cpus(const char *cpus)
+{
+	logger_t *loggers[] = {err_log, masterkey_log, connect_log,
+	                       content_file_log, content_pcap_log,
+#ifndef WITHOUT_MIRROR
+	                       content_mirror_log,
+#endif /* !WITHOUT_MIRROR */
+	                       cert_log};
+
+	for (size_t i = 0; i < sizeof(loggers) / sizeof(loggers[0]); i++) {
+		if (loggers[i] && logger_set_cpus(loggers[i], cpus) == -1) {
+			log_err_level_printf(LOG_WARNING, "Failed to pin logger thread to CPUs %s: %s (%i)\n",
+			                     cpus, strerror(errno), errno);
+			return;
+		}
+	}
+}
+
 /*
  * Log post-init: start logging threads.
  * Return -1 on errors, 0 otherwise.
@@ -1753,6 +2129,25 @@ log_init(global_t *global, proxy_ctx_t *ctx, int clisock[5])
 		err_shortcut_logger = 1;
 	}
 
+	/* the compression workers are started here rather than in preinit,
+	 * because threads do not survive the privsep fork */
+	if (logz_init(global->logz, global->logz_level, global->logz_threads) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to start log compression\n");
+		return -1;
+	}
+	if ((connect_fd != -1 && log_logz_open(connect_fd, connect_fn) == -1) ||
+	    (content_file_single_fd != -1 &&
+	     log_logz_open(content_file_single_fd, content_file_single_fn) == -1) ||
+	    (content_pcap_fd != -1 &&
+	     log_logz_open(content_pcap_fd, content_pcap_fn) == -1))
+		return -1;
+	if (content_pcap_fd != -1 && logpkt_pcap_open_fd(content_pcap_fd) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to prepare '%s' for PCAP writing"
+		               ": %s (%i)\n",
+		               content_pcap_fn, strerror(errno), errno);
+		return -1;
+	}
+
 	if (masterkey_log) {
 		masterkey_clisock = clisock[0];
 		if (logger_start(masterkey_log) == -1)
@@ -1799,6 +2194,10 @@ log_init(global_t *global, proxy_ctx_t *ctx, int clisock[5])
 	} else {
 		privsep_client_close(clisock[4]);
 	}
+
+	if (global->loggercpus) {
+		log_set_cpus(global->loggercpus);
+	}
 	return 0;
 }
 
@@ -1872,10 +2271,16 @@ log_fini(void)
 #endif /* !WITHOUT_MIRROR */
 	if (content_pcap_log)
 		log_content_pcap_fini();
-	if (content_file_log)
+	if (content_file_log) {
 		log_content_file_single_fini();
+		log_content_file_store_fini();
+	}
 	if (connect_log)
 		log_connect_fini();
+	if (content_shm) {
+		logshm_free(content_shm);
+		content_shm = NULL;
+	}
 
 	if (masterkey_clisock != -1)
 		privsep_client_close(masterkey_clisock);
@@ -1887,6 +2292,8 @@ log_fini(void)
 		privsep_client_close(content_pcap_clisock);
 	if (connect_clisock != -1)
 		privsep_client_close(connect_clisock);
+
+	logz_fini();
 }
 
 int
@@ -82,19 +82,27 @@ typedef struct log_content_ctx log_content_ctx_t;
 struct log_content_file_ctx;
 struct log_content_pcap_ctx;
 struct log_content_mirror_ctx;
+struct log_content_shm_pending;
 struct log_content_ctx {
 	struct log_content_file_ctx *file;
 	struct log_content_pcap_ctx *pcap;
 	struct log_content_mirror_ctx *mirror;
+	struct logshm_ring *shm;
+	long long unsigned int shm_id;
+	struct log_content_shm_pending *shm_pending;
 };
 int log_content_open(log_content_ctx_t *, global_t *,
+                     long long unsigned int, int,
                      const struct sockaddr *, socklen_t,
                      const struct sockaddr *, socklen_t,
-                     char *, char *, char *, char *,
-                     char *, char *, char *) NONNULL(1,2,3) WUNRES;
+                     const char *, const char *, const char *, const char *,
+                     const char *, const char *,
+                     char *, char *, char *) NONNULL(1,2,5) WUNRES;
 int log_content_submit(log_content_ctx_t *, logbuf_t *, int)
                        NONNULL(1,2) WUNRES;
 int log_content_close(log_content_ctx_t *, int) NONNULL(1) WUNRES;
+int log_content_shm_paused(log_content_ctx_t *) NONNULL(1) WUNRES;
+int log_content_shm_flush(log_content_ctx_t *) NONNULL(1) WUNRES;
 int log_content_split_pathspec(const char *, char **,
                                char **) NONNULL(1,2,3) WUNRES;
 
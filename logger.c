@@ -30,6 +30,7 @@
 
 #include "thrqueue.h"
 #include "logbuf.h"
+#include "sys.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -247,6 +248,14 @@ logger_start(logger_t *logger) {
 	return 0;
 }
 
+/*
+ * Restrict the logger's write thread to the CPUs in the CPU list.
+ */
+int
+logger_set_cpus(logger_t *logger, const char *cpus) {
+	return sys_set_thread_cpulist(logger->thr, cpus);
+}
+
 /*
  * Tell the logger's write thread to write all pending write requests
  * and then exit.  Don't wait for the logger to exit.
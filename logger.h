@@ -50,6 +50,7 @@ logger_t * logger_new(logger_reopen_func_t, logger_open_func_t,
                       NONNULL(4,6) MALLOC;
 void logger_free(logger_t *) NONNULL(1);
 int logger_start(logger_t *) NONNULL(1) WUNRES;
+int logger_set_cpus(logger_t *, const char *) NONNULL(1,2) WUNRES;
 void logger_leave(logger_t *) NONNULL(1);
 int logger_join(logger_t *) NONNULL(1);
 int logger_stop(logger_t *) NONNULL(1) WUNRES;
@@ -27,6 +27,7 @@
  */
 
 #include "logpkt.h"
+#include "logz.h"
 
 #include "sys.h"
 #include "log.h"
@@ -200,7 +201,7 @@ logpkt_write_global_pcap_hdr(int fd)
 	hdr.version_minor = 4;
 	hdr.snaplen = MAX_PKTSZ;
 	hdr.network = 1;
-	return write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ? -1 : 0;
+	return logz_write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ? -1 : 0;
 }
 
 /*
@@ -213,6 +214,9 @@ logpkt_write_global_pcap_hdr(int fd)
  * On a return value of 0, the caller can continue to write PCAP records to the
  * file descriptor.  On error, -1 is returned and the file descriptor is in an
  * undefined but still open state.
+ * If the writes to fd are compressed, the header cannot be checked, so a
+ * non-empty file is appended to as is; logz_open() has refused files which
+ * are not compressed with the same algorithm.
  */
 int
 logpkt_pcap_open_fd(int fd) {
@@ -223,6 +227,8 @@ logpkt_pcap_open_fd(int fd) {
 	sz = lseek(fd, 0, SEEK_END);
 	if (sz == -1)
 		return -1;
+	if (logz_enabled())
+		return sz > 0 ? 0 : logpkt_write_global_pcap_hdr(fd);
 
 	if (sz > 0) {
 		if (lseek(fd, 0, SEEK_SET) == -1)
@@ -288,12 +294,12 @@ logpkt_pcap_write(const uint8_t *pkt, size_t pktsz, int fd)
 	rec_hdr.ts_usec = tv.tv_usec;
 	rec_hdr.orig_len = rec_hdr.incl_len = pktsz;
 
-	if (write(fd, &rec_hdr, sizeof(rec_hdr)) != sizeof(rec_hdr)) {
+	if (logz_write(fd, &rec_hdr, sizeof(rec_hdr)) != sizeof(rec_hdr)) {
 		log_err_printf("Error writing pcap record hdr: %s\n",
 		               strerror(errno));
 		return -1;
 	}
-	if (write(fd, pkt, pktsz) != (ssize_t)pktsz) {
+	if (logz_write(fd, pkt, pktsz) != (ssize_t)pktsz) {
 		log_err_printf("Error writing pcap record: %s\n",
 		               strerror(errno));
 		return -1;
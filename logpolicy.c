@@ -0,0 +1,266 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logpolicy.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+static const char *logpolicy_fields[] = {
+	"*", "sni", "dstip", "dstport", "user", "proto"
+};
+
+static const char *logpolicy_protos[] = {
+	"tcp", "ssl", "http", "https", "autossl", "pop3", "pop3s", "smtp", "smtps"
+};
+
+/*
+ * Compile the value of a rule into its canonical form.  Returns -1 with
+ * errno set if the value is not valid for the field.
+ */
+static int
+logpolicy_rule_compile(logpolicy_rule_t *rule, const char *value)
+{
+	unsigned char addr[sizeof(struct in6_addr)];
+	char buf[INET6_ADDRSTRLEN];
+	char *end;
+	unsigned long port;
+	int af;
+
+	switch (rule->field) {
+	case LOGPOLICY_SNI:
+		if (!strncmp(value, "*.", 2) && value[2]) {
+			rule->wildcard = 1;
+			value++;
+		} else if (strchr(value, '*')) {
+			goto inval;
+		}
+		if (!(rule->value = strdup(value)))
+			return -1;
+		for (char *p = rule->value; *p; p++)
+			*p = tolower((unsigned char)*p);
+		return 0;
+	case LOGPOLICY_DSTIP:
+		af = strchr(value, ':') ? AF_INET6 : AF_INET;
+		if (inet_pton(af, value, addr) != 1 ||
+		    !inet_ntop(af, addr, buf, sizeof(buf)))
+			goto inval;
+		return (rule->value = strdup(buf)) ? 0 : -1;
+	case LOGPOLICY_DSTPORT:
+		errno = 0;
+		port = strtoul(value, &end, 10);
+		if (errno || end == value || *end || !port || port > 65535)
+			goto inval;
+		rule->port = port;
+		return 0;
+	case LOGPOLICY_USER:
+		return (rule->value = strdup(value)) ? 0 : -1;
+	case LOGPOLICY_PROTO:
+		for (size_t i = 0; i < sizeof(logpolicy_protos) / sizeof(logpolicy_protos[0]); i++) {
+			if (!strcasecmp(value, logpolicy_protos[i]))
+				return (rule->value = strdup(logpolicy_protos[i])) ? 0 : -1;
+		}
+		goto inval;
+	default:
+		goto inval;
+	}
+inval:
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Create a rule from the action, field and value of a ContentLogRule line.
+ * Action is log, nolog or the number of bytes to log per direction.  Value
+ * must be NULL for the * field, which matches all conns.  Returns NULL with
+ * errno set to EINVAL if the rule is not valid.
+ */
+logpolicy_rule_t *
+logpolicy_rule_new(const char *action, const char *field, const char *value)
+{
+	logpolicy_rule_t *rule;
+	char *end;
+	size_t i;
+
+	if (!(rule = malloc(sizeof(logpolicy_rule_t))))
+		return NULL;
+	memset(rule, 0, sizeof(logpolicy_rule_t));
+
+	if (!strcmp(action, "log")) {
+		rule->limit = LOGPOLICY_FULL;
+	} else if (!strcmp(action, "nolog")) {
+		rule->limit = LOGPOLICY_NOLOG;
+	} else {
+		unsigned long long n;
+		errno = 0;
+		n = strtoull(action, &end, 10);
+		if (errno || end == action || *end || !n || n >= SIZE_MAX)
+			goto inval;
+		rule->limit = n;
+	}
+
+	for (i = 0; i < sizeof(logpolicy_fields) / sizeof(logpolicy_fields[0]); i++) {
+		if (!strcmp(field, logpolicy_fields[i]))
+			break;
+	}
+	if (i == sizeof(logpolicy_fields) / sizeof(logpolicy_fields[0]))
+		goto inval;
+	rule->field = i;
+
+	if (rule->field == LOGPOLICY_ANY) {
+		if (value)
+			goto inval;
+		return rule;
+	}
+	if (!value || !*value)
+		goto inval;
+	if (logpolicy_rule_compile(rule, value) == -1) {
+		free(rule);
+		return NULL;
+	}
+	return rule;
+
+inval:
+	free(rule);
+	errno = EINVAL;
+	return NULL;
+}
+
+logpolicy_rule_t *
+logpolicy_rule_dup(const logpolicy_rule_t *rule)
+{
+	logpolicy_rule_t *dup;
+
+	if (!(dup = malloc(sizeof(logpolicy_rule_t))))
+		return NULL;
+	memcpy(dup, rule, sizeof(logpolicy_rule_t));
+	dup->next = NULL;
+	if (rule->value && !(dup->value = strdup(rule->value))) {
+		free(dup);
+		return NULL;
+	}
+	return dup;
+}
+
+void
+logpolicy_rules_free(logpolicy_rule_t *rule)
+{
+	while (rule) {
+		logpolicy_rule_t *next = rule->next;
+		free(rule->value);
+		free(rule);
+		rule = next;
+	}
+}
+
+char *
+logpolicy_rule_str(const logpolicy_rule_t *rule)
+{
+	char action[24];
+	char *s;
+	int rv;
+
+	if (rule->limit == LOGPOLICY_FULL)
+		snprintf(action, sizeof(action), "log");
+	else if (rule->limit == LOGPOLICY_NOLOG)
+		snprintf(action, sizeof(action), "nolog");
+	else
+		snprintf(action, sizeof(action), "%zu", rule->limit);
+
+	if (rule->field == LOGPOLICY_DSTPORT)
+		rv = asprintf(&s, "%s %s %u", action, logpolicy_fields[rule->field], rule->port);
+	else
+		rv = asprintf(&s, "%s %s%s%s%s", action, logpolicy_fields[rule->field],
+		              rule->value ? " " : "", rule->wildcard ? "*" : "",
+		              rule->value ? rule->value : "");
+	return rv < 0 ? NULL : s;
+}
+
+/*
+ * Names in the domain of a wildcard match, the domain itself does not.
+ */
+static int
+logpolicy_sni_match(const logpolicy_rule_t *rule, const char *sni)
+{
+	size_t len, vlen;
+
+	if (!rule->wildcard)
+		return !strcasecmp(sni, rule->value);
+	len = strlen(sni);
+	vlen = strlen(rule->value);
+	return len > vlen && !strcasecmp(sni + len - vlen, rule->value);
+}
+
+/*
+ * Return the bytes per direction to log of conn: the limit of the first
+ * matching rule, or dflt if none matches.  Rules on fields not known for
+ * the conn do not match.
+ */
+size_t
+logpolicy_match(const logpolicy_rule_t *rule, size_t dflt,
+                const logpolicy_conn_t *conn)
+{
+	for (; rule; rule = rule->next) {
+		switch (rule->field) {
+		case LOGPOLICY_ANY:
+			return rule->limit;
+		case LOGPOLICY_SNI:
+			if (conn->sni && logpolicy_sni_match(rule, conn->sni))
+				return rule->limit;
+			break;
+		case LOGPOLICY_DSTIP:
+			if (conn->dstip && !strcmp(conn->dstip, rule->value))
+				return rule->limit;
+			break;
+		case LOGPOLICY_DSTPORT:
+			if (conn->dstport && strtoul(conn->dstport, NULL, 10) == rule->port)
+				return rule->limit;
+			break;
+		case LOGPOLICY_USER:
+			if (conn->user && !strcmp(conn->user, rule->value))
+				return rule->limit;
+			break;
+		case LOGPOLICY_PROTO:
+			if (conn->proto && !strcmp(conn->proto, rule->value))
+				return rule->limit;
+			break;
+		}
+	}
+	return dflt;
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,91 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOGPOLICY_H
+#define LOGPOLICY_H
+
+#include "attrib.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Content log capture policy.
+ *
+ * ContentLogRule lines select how much of the content of a conn is logged,
+ * by the SNI, the dst address or port, the user, or the proto of the conn.
+ * Rules are compiled into canonical values when the config is loaded, and
+ * evaluated once per conn when its content log is opened; the first rule
+ * which matches decides, otherwise ContentLogLimit.  The result is a byte
+ * cap per direction, so the relay path only compares counters.
+ */
+
+#define LOGPOLICY_ANY     0
+#define LOGPOLICY_SNI     1
+#define LOGPOLICY_DSTIP   2
+#define LOGPOLICY_DSTPORT 3
+#define LOGPOLICY_USER    4
+#define LOGPOLICY_PROTO   5
+
+/* limit of conns not to log, and of conns to log in full */
+#define LOGPOLICY_NOLOG   0
+#define LOGPOLICY_FULL    SIZE_MAX
+
+typedef struct logpolicy_rule {
+	// Bytes to log per direction
+	size_t limit;
+	int field;
+	// Lower case name, numeric address, or NULL for ports and any
+	char *value;
+	unsigned short port;
+	// 1 if value is the .example.com of *.example.com
+	unsigned int wildcard : 1;
+	struct logpolicy_rule *next;
+} logpolicy_rule_t;
+
+/* what the rules are matched against, NULL if not known */
+typedef struct logpolicy_conn {
+	const char *sni;
+	const char *dstip;
+	const char *dstport;
+	const char *user;
+	const char *proto;
+} logpolicy_conn_t;
+
+logpolicy_rule_t *logpolicy_rule_new(const char *, const char *,
+                                     const char *) NONNULL(1,2) MALLOC;
+logpolicy_rule_t *logpolicy_rule_dup(const logpolicy_rule_t *) NONNULL(1) MALLOC;
+void logpolicy_rules_free(logpolicy_rule_t *);
+char *logpolicy_rule_str(const logpolicy_rule_t *) NONNULL(1) MALLOC;
+size_t logpolicy_match(const logpolicy_rule_t *, size_t,
+                       const logpolicy_conn_t *) NONNULL(3) WUNRES;
+
+#endif /* !LOGPOLICY_H */
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,181 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logpolicy.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <check.h>
+
+START_TEST(logpolicy_rule_new_01)
+{
+	logpolicy_rule_t *rule;
+	char *s;
+
+	rule = logpolicy_rule_new("nolog", "sni", "*.Example.COM");
+	fail_unless(!!rule, "sni rule rejected");
+	fail_unless(rule->limit == LOGPOLICY_NOLOG && rule->wildcard &&
+	            !strcmp(rule->value, ".example.com"), "sni not compiled");
+	s = logpolicy_rule_str(rule);
+	fail_unless(!strcmp(s, "nolog sni *.example.com"), "str mismatch");
+	free(s);
+	logpolicy_rules_free(rule);
+
+	rule = logpolicy_rule_new("65536", "dstip", "2001:db8:0::1");
+	fail_unless(!!rule, "dstip rule rejected");
+	fail_unless(rule->limit == 65536 && !strcmp(rule->value, "2001:db8::1"),
+	            "dstip not compiled");
+	logpolicy_rules_free(rule);
+
+	rule = logpolicy_rule_new("log", "*", NULL);
+	fail_unless(!!rule && rule->limit == LOGPOLICY_FULL, "* rule rejected");
+	logpolicy_rules_free(rule);
+
+	rule = logpolicy_rule_new("log", "proto", "HTTPS");
+	fail_unless(!!rule && !strcmp(rule->value, "https"), "proto rule rejected");
+	logpolicy_rules_free(rule);
+}
+END_TEST
+
+START_TEST(logpolicy_rule_new_02)
+{
+	const char *bad[][3] = {
+		{"maybe", "sni", "example.com"},
+		{"0", "sni", "example.com"},
+		{"-1", "sni", "example.com"},
+		{"log", "host", "example.com"},
+		{"log", "sni", "www.*.com"},
+		{"log", "sni", NULL},
+		{"log", "*", "example.com"},
+		{"log", "dstip", "example.com"},
+		{"log", "dstip", "10.0.0.256"},
+		{"log", "dstport", "0"},
+		{"log", "dstport", "65536"},
+		{"log", "dstport", "443x"},
+		{"log", "proto", "ftp"},
+	};
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		errno = 0;
+		fail_unless(!logpolicy_rule_new(bad[i][0], bad[i][1], bad[i][2]) &&
+		            errno == EINVAL, "bad rule %zu accepted", i);
+	}
+}
+END_TEST
+
+static logpolicy_rule_t *
+logpolicy_test_rules(void)
+{
+	const char *lines[][3] = {
+		{"nolog", "sni", "*.googlevideo.com"},
+		{"log", "user", "alice"},
+		{"1024", "dstport", "8443"},
+		{"nolog", "dstip", "10.0.0.1"},
+		{"4096", "proto", "http"},
+	};
+	logpolicy_rule_t *rules = NULL, **tail = &rules;
+
+	for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+		*tail = logpolicy_rule_new(lines[i][0], lines[i][1], lines[i][2]);
+		fail_unless(!!*tail, "rule %zu rejected", i);
+		tail = &(*tail)->next;
+	}
+	return rules;
+}
+
+START_TEST(logpolicy_match_01)
+{
+	logpolicy_rule_t *rules = logpolicy_test_rules();
+	logpolicy_conn_t conn;
+
+	memset(&conn, 0, sizeof(conn));
+	fail_unless(logpolicy_match(rules, 77, &conn) == 77, "default");
+	fail_unless(logpolicy_match(NULL, 77, &conn) == 77, "no rules");
+
+	conn.sni = "r3---sn-abc.GoogleVideo.com";
+	conn.user = "alice";
+	fail_unless(logpolicy_match(rules, 77, &conn) == LOGPOLICY_NOLOG,
+	            "wildcard sni");
+	conn.sni = "googlevideo.com";
+	fail_unless(logpolicy_match(rules, 77, &conn) == LOGPOLICY_FULL,
+	            "domain itself matched wildcard");
+
+	conn.user = NULL;
+	conn.dstip = "10.0.0.1";
+	conn.dstport = "8443";
+	fail_unless(logpolicy_match(rules, 77, &conn) == 1024, "first match");
+	conn.dstport = "443";
+	fail_unless(logpolicy_match(rules, 77, &conn) == LOGPOLICY_NOLOG, "dstip");
+	conn.dstip = "10.0.0.2";
+	conn.proto = "http";
+	fail_unless(logpolicy_match(rules, 77, &conn) == 4096, "proto");
+	conn.proto = "https";
+	fail_unless(logpolicy_match(rules, 77, &conn) == 77, "no match");
+
+	logpolicy_rules_free(rules);
+}
+END_TEST
+
+START_TEST(logpolicy_rule_dup_01)
+{
+	logpolicy_rule_t *rules = logpolicy_test_rules();
+	logpolicy_rule_t *dup = logpolicy_rule_dup(rules);
+
+	fail_unless(!!dup && !dup->next && dup->wildcard &&
+	            dup->value != rules->value &&
+	            !strcmp(dup->value, rules->value), "dup mismatch");
+	logpolicy_rules_free(dup);
+	logpolicy_rules_free(rules);
+}
+END_TEST
+
+Suite *
+logpolicy_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("logpolicy");
+
+	tc = tcase_create("logpolicy_rule_new");
+	tcase_add_test(tc, logpolicy_rule_new_01);
+	tcase_add_test(tc, logpolicy_rule_new_02);
+	tcase_add_test(tc, logpolicy_rule_dup_01);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("logpolicy_match");
+	tcase_add_test(tc, logpolicy_match_01);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,391 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logshm.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+struct logshm {
+	logshm_hdr_t *hdr;
+	size_t size;
+};
+
+#define LOGSHM_ALIGN(x) (((x) + 4095) & ~(size_t)4095)
+
+static uint64_t
+logshm_now(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Create the shared memory object name with nrings rings of ringsize bytes,
+ * replacing any object left over from a previous run, and map it.
+ * Readers of a replaced object keep their mapping of the old one, so they
+ * need to attach again.  Returns NULL with errno set on error.
+ */
+logshm_t *
+logshm_new(const char *name, unsigned int nrings, size_t ringsize, int policy)
+{
+	logshm_t *shm;
+	size_t ringoff, stride;
+	int fd;
+
+	if (!nrings || ringsize < LOGSHM_RINGSIZE_MIN ||
+	    ringsize > LOGSHM_RINGSIZE_MAX || (ringsize & (ringsize - 1)) ||
+	    !logshm_policy_str(policy)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!(shm = malloc(sizeof(logshm_t))))
+		return NULL;
+
+	ringoff = LOGSHM_ALIGN(sizeof(logshm_hdr_t));
+	stride = LOGSHM_ALIGN(sizeof(logshm_ring_t) + ringsize);
+	shm->size = ringoff + nrings * stride;
+
+	if (shm_unlink(name) == -1 && errno != ENOENT)
+		goto errout;
+	/* the content is as sensitive as the content log files */
+	fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+	if (fd == -1)
+		goto errout;
+	if (ftruncate(fd, shm->size) == -1) {
+		int e = errno;
+		close(fd);
+		shm_unlink(name);
+		errno = e;
+		goto errout;
+	}
+	shm->hdr = mmap(NULL, shm->size, PROT_READ|PROT_WRITE, MAP_SHARED,
+	                fd, 0);
+	close(fd);
+	if (shm->hdr == MAP_FAILED) {
+		int e = errno;
+		shm_unlink(name);
+		errno = e;
+		goto errout;
+	}
+
+	/* the object is zero-filled, so all rings start out empty */
+	shm->hdr->version = LOGSHM_VERSION;
+	shm->hdr->nrings = nrings;
+	shm->hdr->policy = policy;
+	shm->hdr->ringsize = ringsize;
+	shm->hdr->ringoff = ringoff;
+	shm->hdr->ringstride = stride;
+	shm->hdr->pid = getpid();
+	for (unsigned int i = 0; i < nrings; i++) {
+		logshm_ring_t *ring = logshm_ring(shm, i);
+		ring->size = ringsize;
+		ring->policy = policy;
+	}
+	__atomic_store_n(&shm->hdr->magic, LOGSHM_MAGIC, __ATOMIC_RELEASE);
+	return shm;
+
+errout:
+	free(shm);
+	return NULL;
+}
+
+/*
+ * Unmap the region.  The object itself is left in place, so that readers can
+ * drain it after the proxy has exited; the next run replaces it.
+ */
+void
+logshm_free(logshm_t *shm)
+{
+	munmap(shm->hdr, shm->size);
+	free(shm);
+}
+
+logshm_ring_t *
+logshm_ring(logshm_t *shm, unsigned int idx)
+{
+	return logshm_hdr_ring(shm->hdr, idx);
+}
+
+/*
+ * Largest payload of a single record; larger payloads need to be split.
+ * Limiting records to a quarter of the ring bounds the space wasted at the
+ * end of the ring and keeps a few records in flight.
+ */
+size_t
+logshm_maxpayload(logshm_t *shm)
+{
+	return shm->hdr->ringsize / 4 - sizeof(logshm_rec_t);
+}
+
+size_t
+logshm_ring_maxpayload(logshm_ring_t *ring)
+{
+	return ring->size / 4 - sizeof(logshm_rec_t);
+}
+
+/*
+ * Return the position after the record or the skipped space at pos.
+ * Only valid for records which cannot be overwritten while reading them.
+ */
+static uint64_t
+logshm_ring_next(logshm_ring_t *ring, uint64_t pos, int *isrec)
+{
+	uint64_t off = pos & (ring->size - 1);
+	uint64_t room = ring->size - off;
+	logshm_rec_t *rec = (logshm_rec_t *)(ring->data + off);
+
+	if (room < sizeof(logshm_rec_t) || rec->type == LOGSHM_REC_PAD) {
+		*isrec = 0;
+		return pos + room;
+	}
+	*isrec = 1;
+	return pos + LOGSHM_RECSZ(rec->len);
+}
+
+/*
+ * Write a record to the ring.  Must only be called by the single producer of
+ * the ring.  Returns 0 if the record was published, -1 with errno set if it
+ * was not: EMSGSIZE if it exceeds logshm_maxpayload(), ENOBUFS if there is no
+ * space for it under the overflow policy of the ring.  Only the drop-new
+ * policy counts the record as dropped, with pause the caller keeps it.
+ */
+int
+logshm_ring_write(logshm_ring_t *ring, uint64_t id, int type, int flags,
+                  const void *buf, size_t sz)
+{
+	uint64_t head = ring->head;
+	uint64_t off = head & (ring->size - 1);
+	uint64_t need = LOGSHM_RECSZ(sz);
+	uint64_t skip = 0;
+	uint64_t tail;
+	logshm_rec_t *rec;
+	int isrec;
+
+	if (need > ring->size / 4) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if (ring->size - off < need)
+		skip = ring->size - off;
+
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	while (head + skip + need - tail > ring->size) {
+		if (ring->policy == LOGSHM_DROP_OLDEST) {
+			/* the consumer may advance tail at the same time,
+			 * in which case the CAS reloads tail and we retry */
+			uint64_t next = logshm_ring_next(ring, tail, &isrec);
+			if (__atomic_compare_exchange_n(&ring->tail, &tail, next, 0,
+			                                __ATOMIC_ACQ_REL,
+			                                __ATOMIC_ACQUIRE)) {
+				tail = next;
+				if (isrec)
+					__atomic_store_n(&ring->overwrites, ring->overwrites + 1, __ATOMIC_RELAXED);
+			}
+		} else if (ring->policy == LOGSHM_PAUSE) {
+			__atomic_store_n(&ring->pauses, ring->pauses + 1, __ATOMIC_RELAXED);
+			errno = ENOBUFS;
+			return -1;
+		} else {
+			logshm_ring_drop(ring);
+			errno = ENOBUFS;
+			return -1;
+		}
+	}
+
+	if (skip >= sizeof(logshm_rec_t)) {
+		rec = (logshm_rec_t *)(ring->data + off);
+		rec->len = skip - sizeof(logshm_rec_t);
+		rec->type = LOGSHM_REC_PAD;
+	}
+	rec = (logshm_rec_t *)(ring->data + ((head + skip) & (ring->size - 1)));
+	rec->len = sz;
+	rec->type = type;
+	rec->flags = flags;
+	rec->id = id;
+	rec->ts = logshm_now(CLOCK_REALTIME);
+	if (sz)
+		memcpy(rec->data, buf, sz);
+	__atomic_store_n(&ring->head, head + skip + need, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->records, ring->records + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/*
+ * Count a record the producer has dropped, such as a record kept with the
+ * pause policy of a conn which closed before there was space for it.
+ */
+void
+logshm_ring_drop(logshm_ring_t *ring)
+{
+	__atomic_store_n(&ring->drops, ring->drops + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Parse an overflow policy name.  Returns the policy or -1 if unknown.
+ */
+int
+logshm_policy_parse(const char *s)
+{
+	if (!strcmp(s, "drop-new"))
+		return LOGSHM_DROP_NEW;
+	if (!strcmp(s, "drop-oldest"))
+		return LOGSHM_DROP_OLDEST;
+	if (!strcmp(s, "pause"))
+		return LOGSHM_PAUSE;
+	return -1;
+}
+
+const char *
+logshm_policy_str(int policy)
+{
+	switch (policy) {
+	case LOGSHM_DROP_NEW:
+		return "drop-new";
+	case LOGSHM_DROP_OLDEST:
+		return "drop-oldest";
+	case LOGSHM_PAUSE:
+		return "pause";
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Map the shared memory object name for reading records.  The mapping is
+ * writable, since consuming records advances the tails of the rings.
+ * Returns NULL with errno set on error, and the size of the mapping in size
+ * otherwise.
+ */
+logshm_hdr_t *
+logshm_attach(const char *name, size_t *size)
+{
+	logshm_hdr_t *hdr;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)st.st_size < sizeof(logshm_hdr_t)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return NULL;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != LOGSHM_MAGIC ||
+	    hdr->version != LOGSHM_VERSION ||
+	    hdr->ringoff + hdr->nrings * hdr->ringstride > (uint64_t)st.st_size) {
+		munmap(hdr, st.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	*size = st.st_size;
+	return hdr;
+}
+
+void
+logshm_detach(logshm_hdr_t *hdr, size_t size)
+{
+	munmap(hdr, size);
+}
+
+logshm_ring_t *
+logshm_hdr_ring(logshm_hdr_t *hdr, unsigned int idx)
+{
+	return (logshm_ring_t *)((char *)hdr + hdr->ringoff +
+	                         (idx % hdr->nrings) * hdr->ringstride);
+}
+
+/*
+ * Return the oldest unconsumed record of the ring in place, and its position
+ * in pos, or NULL if the ring is empty.  The record stays in the ring until
+ * logshm_ring_consume() is called.
+ */
+const logshm_rec_t *
+logshm_ring_peek(logshm_ring_t *ring, uint64_t *pos)
+{
+	for (;;) {
+		uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t off = tail & (ring->size - 1);
+		uint64_t room = ring->size - off;
+		logshm_rec_t *rec = (logshm_rec_t *)(ring->data + off);
+
+		if (tail == head)
+			return NULL;
+		if (room < sizeof(logshm_rec_t) || rec->type == LOGSHM_REC_PAD) {
+			/* the producer may have moved tail meanwhile */
+			__atomic_compare_exchange_n(&ring->tail, &tail, tail + room, 0,
+			                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+			continue;
+		}
+		if (LOGSHM_RECSZ(rec->len) > room) {
+			/* being overwritten with drop-oldest, unless corrupt */
+			if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == tail)
+				return NULL;
+			continue;
+		}
+		*pos = tail;
+		return rec;
+	}
+}
+
+/*
+ * Release the record at pos returned by logshm_ring_peek().  Returns 0 if the
+ * record was intact until now, or -1 if the producer has overwritten it with
+ * drop-oldest meanwhile, in which case anything read from it must be
+ * discarded.  Either way, the next peek returns the next intact record.
+ */
+int
+logshm_ring_consume(logshm_ring_t *ring, uint64_t pos, const logshm_rec_t *rec)
+{
+	return __atomic_compare_exchange_n(&ring->tail, &pos,
+	                                   pos + LOGSHM_RECSZ(rec->len), 0,
+	                                   __ATOMIC_ACQ_REL,
+	                                   __ATOMIC_ACQUIRE) ? 0 : -1;
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,145 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOGSHM_H
+#define LOGSHM_H
+
+#include "attrib.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared memory content log.
+ *
+ * The region is a POSIX shared memory object: a header followed by one ring
+ * per conn handling thread.  Each ring has a single producer, the thread
+ * logging the content of its conns, and a single consumer, an external reader
+ * which maps the object and reads the records in place.  Ring positions are
+ * byte counters that only grow; a record starts at (pos & (ringsize - 1)) and
+ * is never split at the end of the ring.  If the space left at the end is too
+ * short for a record, the producer skips it, with a pad record if it is long
+ * enough for a record header.
+ *
+ * The producer publishes records by advancing head, the consumer frees them
+ * by advancing tail.  With the drop-oldest policy the producer advances tail
+ * too, so the consumer must treat a record as valid only if its consume call
+ * succeeds, see logshm_ring_consume().  With the pause policy a record which
+ * does not fit is refused like with drop-new, but the producer keeps it and
+ * stops reading from the conn until the consumer has made space.
+ */
+
+#define LOGSHM_MAGIC   0x4d485350 /* "PSHM" */
+#define LOGSHM_VERSION 1
+
+/* overflow policies */
+#define LOGSHM_DROP_NEW    0 /* drop the new record */
+#define LOGSHM_DROP_OLDEST 1 /* overwrite the oldest records */
+#define LOGSHM_PAUSE       2 /* keep the record, pause the conn */
+
+/* record types */
+#define LOGSHM_REC_PAD   0
+#define LOGSHM_REC_OPEN  1 /* payload: "[srchost]:port -> [dsthost]:port" */
+#define LOGSHM_REC_DATA  2
+#define LOGSHM_REC_CLOSE 3
+
+/* record flags */
+#define LOGSHM_REQUEST 1 /* client to server, or closed by the client */
+
+typedef struct logshm_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nrings;
+	uint32_t policy;
+	uint64_t ringsize;   /* bytes of records per ring, a power of 2 */
+	uint64_t ringoff;    /* offset of the first ring from the header */
+	uint64_t ringstride; /* bytes from one ring to the next */
+	uint64_t pid;        /* of the producing proxy process */
+} logshm_hdr_t;
+
+typedef struct logshm_ring {
+	uint64_t head;       /* end of the published records */
+	char pad1[56];
+	uint64_t tail;       /* start of the unconsumed records */
+	char pad2[56];
+	uint64_t size;       /* copy of the ringsize of the header */
+	uint32_t policy;     /* copy of the policy of the header */
+	uint32_t pad3;
+	uint64_t records;    /* records published */
+	uint64_t drops;      /* records dropped for lack of space */
+	uint64_t overwrites; /* records overwritten with drop-oldest */
+	uint64_t pauses;     /* records refused with pause */
+	char pad4[16];
+	unsigned char data[];
+} logshm_ring_t;
+
+typedef struct logshm_rec {
+	uint32_t len;        /* of the payload */
+	uint16_t type;
+	uint16_t flags;
+	uint64_t id;         /* conn id */
+	uint64_t ts;         /* CLOCK_REALTIME in nanoseconds */
+	unsigned char data[];
+} logshm_rec_t;
+
+/* ring bytes taken by a record with a payload of len bytes */
+#define LOGSHM_RECSZ(len) \
+	((sizeof(logshm_rec_t) + (size_t)(len) + 7) & ~(size_t)7)
+
+#define LOGSHM_RINGSIZE_MIN 65536
+#define LOGSHM_RINGSIZE_MAX 1073741824
+
+typedef struct logshm logshm_t;
+
+/* producer */
+logshm_t * logshm_new(const char *, unsigned int, size_t, int)
+                      NONNULL(1) MALLOC;
+void logshm_free(logshm_t *) NONNULL(1);
+logshm_ring_t * logshm_ring(logshm_t *, unsigned int) NONNULL(1) WUNRES;
+size_t logshm_maxpayload(logshm_t *) NONNULL(1) WUNRES;
+size_t logshm_ring_maxpayload(logshm_ring_t *) NONNULL(1) WUNRES;
+int logshm_ring_write(logshm_ring_t *, uint64_t, int, int,
+                      const void *, size_t) NONNULL(1);
+void logshm_ring_drop(logshm_ring_t *) NONNULL(1);
+int logshm_policy_parse(const char *) NONNULL(1) WUNRES;
+const char * logshm_policy_str(int) WUNRES;
+
+/* consumer */
+logshm_hdr_t * logshm_attach(const char *, size_t *) NONNULL(1,2) WUNRES;
+void logshm_detach(logshm_hdr_t *, size_t) NONNULL(1);
+logshm_ring_t * logshm_hdr_ring(logshm_hdr_t *, unsigned int)
+                                NONNULL(1) WUNRES;
+const logshm_rec_t * logshm_ring_peek(logshm_ring_t *, uint64_t *)
+                                      NONNULL(1,2) WUNRES;
+int logshm_ring_consume(logshm_ring_t *, uint64_t, const logshm_rec_t *)
+                        NONNULL(1,3) WUNRES;
+
+#endif /* !LOGSHM_H */
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,250 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logshm.h"
+
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <check.h>
+
+#define RINGSIZE LOGSHM_RINGSIZE_MIN
+
+static char shmname[64];
+
+static void
+logshm_setup(void)
+{
+	snprintf(shmname, sizeof(shmname), "/sslproxy-test.%d", getpid());
+}
+
+static void
+logshm_teardown(void)
+{
+	shm_unlink(shmname);
+}
+
+START_TEST(logshm_new_01)
+{
+	logshm_t *shm;
+	logshm_hdr_t *hdr;
+	size_t size;
+
+	shm = logshm_new(shmname, 2, RINGSIZE + 1, LOGSHM_DROP_NEW);
+	fail_unless(!shm && errno == EINVAL, "accepted ringsize not power of 2");
+	shm = logshm_new(shmname, 0, RINGSIZE, LOGSHM_DROP_NEW);
+	fail_unless(!shm && errno == EINVAL, "accepted no rings");
+	shm = logshm_new(shmname, 2, RINGSIZE, 3);
+	fail_unless(!shm && errno == EINVAL, "accepted unknown policy");
+
+	shm = logshm_new(shmname, 3, RINGSIZE, LOGSHM_DROP_OLDEST);
+	fail_unless(!!shm, "failed to create shm");
+	hdr = logshm_attach(shmname, &size);
+	fail_unless(!!hdr, "failed to attach");
+	fail_unless(hdr->nrings == 3, "nrings mismatch");
+	fail_unless(hdr->ringsize == RINGSIZE, "ringsize mismatch");
+	fail_unless(hdr->policy == LOGSHM_DROP_OLDEST, "policy mismatch");
+	fail_unless(logshm_hdr_ring(hdr, 1)->size == RINGSIZE, "ring size mismatch");
+	fail_unless(logshm_hdr_ring(hdr, 4) == logshm_hdr_ring(hdr, 1), "ring index not wrapped");
+	logshm_detach(hdr, size);
+	logshm_free(shm);
+
+	/* the object outlives the producer, and is replaced by the next one */
+	hdr = logshm_attach(shmname, &size);
+	fail_unless(!!hdr, "object removed on free");
+	logshm_detach(hdr, size);
+	shm = logshm_new(shmname, 1, RINGSIZE, LOGSHM_DROP_NEW);
+	fail_unless(!!shm, "failed to replace shm");
+	logshm_free(shm);
+}
+END_TEST
+
+START_TEST(logshm_ring_01)
+{
+	logshm_t *shm;
+	logshm_hdr_t *hdr;
+	logshm_ring_t *ring, *rring;
+	const logshm_rec_t *rec;
+	unsigned char buf[1000];
+	uint64_t pos;
+	size_t size;
+
+	shm = logshm_new(shmname, 1, RINGSIZE, LOGSHM_DROP_NEW);
+	fail_unless(!!shm, "failed to create shm");
+	ring = logshm_ring(shm, 0);
+	hdr = logshm_attach(shmname, &size);
+	fail_unless(!!hdr, "failed to attach");
+	rring = logshm_hdr_ring(hdr, 0);
+
+	fail_unless(!logshm_ring_peek(rring, &pos), "empty ring not empty");
+	fail_unless(logshm_ring_write(ring, 1, LOGSHM_REC_DATA, 0, buf,
+	                              logshm_maxpayload(shm) + 1) == -1 &&
+	            errno == EMSGSIZE, "accepted oversized record");
+
+	/* many times around the ring, so records wrap at the end of the ring */
+	for (unsigned int i = 0; i < 1000; i++) {
+		memset(buf, i, sizeof(buf));
+		fail_unless(logshm_ring_write(ring, i, LOGSHM_REC_DATA,
+		                              LOGSHM_REQUEST, buf, i) == 0,
+		            "write failed");
+		rec = logshm_ring_peek(rring, &pos);
+		fail_unless(!!rec, "record missing");
+		fail_unless(rec->id == i && rec->len == i, "record header mismatch");
+		fail_unless(rec->type == LOGSHM_REC_DATA && rec->flags == LOGSHM_REQUEST, "record type mismatch");
+		fail_unless(!memcmp(rec->data, buf, i), "record data mismatch");
+		fail_unless(logshm_ring_consume(rring, pos, rec) == 0, "consume failed");
+		fail_unless(!logshm_ring_peek(rring, &pos), "consumed record still there");
+	}
+	fail_unless(ring->records == 1000, "record count mismatch");
+	fail_unless(ring->head > 2 * RINGSIZE, "ring did not wrap");
+	fail_unless(!ring->drops && !ring->overwrites, "records lost");
+
+	logshm_detach(hdr, size);
+	logshm_free(shm);
+}
+END_TEST
+
+START_TEST(logshm_ring_02)
+{
+	logshm_t *shm;
+	logshm_ring_t *ring;
+	const logshm_rec_t *rec;
+	unsigned char buf[1000];
+	unsigned int n = 0;
+	uint64_t pos;
+
+	memset(buf, 0, sizeof(buf));
+	shm = logshm_new(shmname, 1, RINGSIZE, LOGSHM_DROP_NEW);
+	fail_unless(!!shm, "failed to create shm");
+	ring = logshm_ring(shm, 0);
+
+	while (logshm_ring_write(ring, n, LOGSHM_REC_DATA, 0, buf, sizeof(buf)) == 0)
+		n++;
+	fail_unless(errno == ENOBUFS, "wrong errno on full ring");
+	fail_unless(n == RINGSIZE / LOGSHM_RECSZ(sizeof(buf)), "full ring count mismatch");
+	fail_unless(ring->drops == 1, "drop not counted");
+
+	/* the oldest records are kept */
+	rec = logshm_ring_peek(ring, &pos);
+	fail_unless(rec && rec->id == 0, "oldest record not kept");
+	fail_unless(logshm_ring_consume(ring, pos, rec) == 0, "consume failed");
+	fail_unless(logshm_ring_write(ring, n, LOGSHM_REC_DATA, 0, buf, sizeof(buf)) == 0,
+	            "write failed after consume");
+
+	logshm_free(shm);
+}
+END_TEST
+
+START_TEST(logshm_ring_03)
+{
+	logshm_t *shm;
+	logshm_ring_t *ring;
+	const logshm_rec_t *rec, *stale;
+	unsigned char buf[1000];
+	unsigned int n = RINGSIZE / LOGSHM_RECSZ(sizeof(buf));
+	uint64_t pos, stalepos;
+
+	memset(buf, 0, sizeof(buf));
+	shm = logshm_new(shmname, 1, RINGSIZE, LOGSHM_DROP_OLDEST);
+	fail_unless(!!shm, "failed to create shm");
+	ring = logshm_ring(shm, 0);
+
+	stale = logshm_ring_peek(ring, &stalepos);
+	fail_unless(!stale, "empty ring not empty");
+	for (unsigned int i = 0; i < n; i++) {
+		fail_unless(logshm_ring_write(ring, i, LOGSHM_REC_DATA, 0, buf, sizeof(buf)) == 0,
+		            "write failed");
+	}
+	stale = logshm_ring_peek(ring, &stalepos);
+	fail_unless(stale && stale->id == 0, "oldest record missing");
+
+	/* overwrite the records the consumer is looking at */
+	for (unsigned int i = n; i < 2 * n; i++) {
+		fail_unless(logshm_ring_write(ring, i, LOGSHM_REC_DATA, 0, buf, sizeof(buf)) == 0,
+		            "write failed on full ring");
+	}
+	fail_unless(ring->overwrites >= n, "overwrites not counted");
+	fail_unless(!ring->drops, "records dropped");
+	fail_unless(logshm_ring_consume(ring, stalepos, stale) == -1, "consumed overwritten record");
+
+	/* the reader resumes with the oldest intact record */
+	rec = logshm_ring_peek(ring, &pos);
+	fail_unless(rec && rec->id == ring->overwrites, "oldest intact record mismatch");
+	for (unsigned int i = rec->id; i < 2 * n; i++) {
+		rec = logshm_ring_peek(ring, &pos);
+		fail_unless(rec && rec->id == i, "record out of order");
+		fail_unless(logshm_ring_consume(ring, pos, rec) == 0, "consume failed");
+	}
+	fail_unless(!logshm_ring_peek(ring, &pos), "ring not empty");
+
+	logshm_free(shm);
+}
+END_TEST
+
+START_TEST(logshm_policy_01)
+{
+	fail_unless(logshm_policy_parse("drop-new") == LOGSHM_DROP_NEW, "drop-new");
+	fail_unless(logshm_policy_parse("drop-oldest") == LOGSHM_DROP_OLDEST, "drop-oldest");
+	fail_unless(logshm_policy_parse("pause") == LOGSHM_PAUSE, "pause");
+	fail_unless(logshm_policy_parse("block") == -1, "accepted block policy");
+	fail_unless(logshm_policy_parse("drop") == -1, "accepted unknown policy");
+	fail_unless(!strcmp(logshm_policy_str(LOGSHM_DROP_OLDEST), "drop-oldest"), "policy str");
+	fail_unless(!logshm_policy_str(-1), "unknown policy str");
+}
+END_TEST
+
+Suite *
+logshm_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("logshm");
+
+	tc = tcase_create("logshm_new");
+	tcase_add_checked_fixture(tc, logshm_setup, logshm_teardown);
+	tcase_add_test(tc, logshm_new_01);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("logshm_ring");
+	tcase_add_checked_fixture(tc, logshm_setup, logshm_teardown);
+	tcase_add_test(tc, logshm_ring_01);
+	tcase_add_test(tc, logshm_ring_02);
+	tcase_add_test(tc, logshm_ring_03);
+	tcase_add_test(tc, logshm_policy_01);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
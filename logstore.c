@@ -0,0 +1,449 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logstore.h"
+#include "logz.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+struct logstore {
+	char *run;
+	uint64_t segsize;
+	uint64_t seq;    /* of the current segment */
+	int fd;          /* of the current segment, -1 if none is open */
+	int idxfd;
+	uint64_t off;
+	logstore_conn_t *conns;
+	logstore_open_func_t openfunc;
+	void *openarg;
+};
+
+/* bound on the payload of a record, to catch garbage when reading */
+#define LOGSTORE_MAXREC (1U << 30)
+
+static uint64_t
+logstore_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Create a segment writer for the store in dir.  Segments are rotated once
+ * they reach segsize bytes.  Segment and index files are opened with
+ * openfunc, so that they can be opened through privsep.
+ */
+logstore_t *
+logstore_new(const char *dir, uint64_t segsize, logstore_open_func_t openfunc,
+             void *openarg)
+{
+	logstore_t *store;
+	char timebuf[24];
+	time_t epoch;
+	struct tm *utc;
+
+	if (time(&epoch) == -1 || !(utc = gmtime(&epoch)) ||
+	    !strftime(timebuf, sizeof(timebuf), "%Y%m%dT%H%M%SZ", utc))
+		return NULL;
+
+	store = malloc(sizeof(logstore_t));
+	if (!store)
+		return NULL;
+	memset(store, 0, sizeof(logstore_t));
+	if (asprintf(&store->run, "%s/%s-%ld", dir, timebuf,
+	             (long)getpid()) < 0) {
+		free(store);
+		return NULL;
+	}
+	store->segsize = segsize;
+	store->fd = -1;
+	store->idxfd = -1;
+	store->openfunc = openfunc;
+	store->openarg = openarg;
+	return store;
+}
+
+/*
+ * Write the index line of conn for the current segment.
+ */
+static int
+logstore_conn_index(logstore_t *store, logstore_conn_t *conn)
+{
+	char *line;
+	int len, rv;
+
+	if (conn->seq != store->seq || store->idxfd == -1)
+		return 0;
+
+	len = asprintf(&line, "%" PRIu64 "\t%" PRIu64 "\t%" PRIu64
+	               "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%s\n",
+	               conn->id, conn->first, conn->last,
+	               conn->first_ts, conn->last_ts, conn->bytes, conn->meta);
+	if (len < 0)
+		return -1;
+	rv = write(store->idxfd, line, len) == len ? 0 : -1;
+	free(line);
+	return rv;
+}
+
+static int
+logstore_seg_close(logstore_t *store)
+{
+	int rv = 0;
+
+	if (store->fd == -1)
+		return 0;
+	for (logstore_conn_t *conn = store->conns; conn; conn = conn->next) {
+		if (logstore_conn_index(store, conn) == -1)
+			rv = -1;
+	}
+	if (logz_close(store->fd) == -1)
+		rv = -1;
+	close(store->fd);
+	store->fd = -1;
+	if (store->idxfd != -1) {
+		close(store->idxfd);
+		store->idxfd = -1;
+	}
+	return rv;
+}
+
+static int
+logstore_seg_open(logstore_t *store)
+{
+	char *fn;
+	int rv;
+
+	store->seq++;
+	if (asprintf(&fn, "%s-%06" PRIu64 ".seg", store->run, store->seq) < 0)
+		return -1;
+	store->fd = store->openfunc(fn, store->openarg);
+	free(fn);
+	if (store->fd == -1)
+		return -1;
+	if (logz_open(store->fd) == -1)
+		goto errout;
+	if (logz_write(store->fd, LOGSTORE_MAGIC, LOGSTORE_MAGICLEN) == -1)
+		goto errout;
+	store->off = LOGSTORE_MAGICLEN;
+
+	if (asprintf(&fn, "%s-%06" PRIu64 ".seg.idx", store->run,
+	             store->seq) < 0)
+		goto errout;
+	store->idxfd = store->openfunc(fn, store->openarg);
+	rv = errno;
+	free(fn);
+	if (store->idxfd == -1) {
+		errno = rv;
+		goto errout;
+	}
+	return 0;
+
+errout:
+	rv = errno;
+	logz_close(store->fd);
+	close(store->fd);
+	store->fd = -1;
+	errno = rv;
+	return -1;
+}
+
+/*
+ * Close the current segment; the next record starts a new one.
+ */
+void
+logstore_rotate(logstore_t *store)
+{
+	logstore_seg_close(store);
+}
+
+/*
+ * Close the current segment and free the writer.  Conns are owned by the
+ * caller; the index lines of open conns are written for the last segment.
+ */
+void
+logstore_free(logstore_t *store)
+{
+	logstore_seg_close(store);
+	free(store->run);
+	free(store);
+}
+
+/*
+ * Append a metadata field to the tab separated meta, replacing control
+ * chars so that the field cannot break the index lines.
+ */
+static char *
+logstore_meta_append(char *p, const char *field)
+{
+	if (!field || !*field) {
+		*p++ = '-';
+		return p;
+	}
+	for (; *field; field++) {
+		*p++ = ((unsigned char)*field < 0x20 || *field == 0x7f)
+		       ? '?' : *field;
+	}
+	return p;
+}
+
+/*
+ * Initialize conn state for a conn with the given metadata, any of which
+ * may be NULL.  Returns -1 if out of memory.
+ */
+int
+logstore_conn_init(logstore_conn_t *conn, uint64_t id, const char *src,
+                   const char *dst, const char *sni, const char *user)
+{
+	size_t sz = 8;
+	char *p;
+
+	sz += src ? strlen(src) : 0;
+	sz += dst ? strlen(dst) : 0;
+	sz += sni ? strlen(sni) : 0;
+	sz += user ? strlen(user) : 0;
+
+	memset(conn, 0, sizeof(logstore_conn_t));
+	conn->id = id;
+	conn->meta = p = malloc(sz);
+	if (!conn->meta)
+		return -1;
+	p = logstore_meta_append(p, src);
+	*p++ = '\t';
+	p = logstore_meta_append(p, dst);
+	*p++ = '\t';
+	p = logstore_meta_append(p, sni);
+	*p++ = '\t';
+	p = logstore_meta_append(p, user);
+	*p = '\0';
+	return 0;
+}
+
+static int
+logstore_write_rec(logstore_t *store, logstore_conn_t *conn, int type,
+                   int flags, const void *buf, size_t sz, uint64_t ts)
+{
+	logstore_rec_t rec;
+	struct iovec iov[2];
+
+	rec.len = sz;
+	rec.type = type;
+	rec.flags = flags;
+	rec.id = conn->id;
+	rec.ts = ts;
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(rec);
+	iov[1].iov_base = (void *)buf;
+	iov[1].iov_len = sz;
+	if (logz_writev(store->fd, iov, sz ? 2 : 1) == -1)
+		return -1;
+
+	conn->last = store->off;
+	conn->last_ts = ts;
+	if (type == LOGSTORE_REC_DATA)
+		conn->bytes += sz;
+	store->off += sizeof(rec) + sz;
+	return 0;
+}
+
+/*
+ * Append a record of conn to the store.  The open record of a conn must be
+ * written first, its payload is the conn metadata; flags are LOGSTORE_REQUEST
+ * for data and close records.  Starts a new segment if the current one is
+ * full.  Returns -1 on errors.
+ */
+int
+logstore_write(logstore_t *store, logstore_conn_t *conn, int type, int flags,
+               const void *buf, size_t sz)
+{
+	uint64_t ts = logstore_now();
+
+	if (sz > LOGSTORE_MAXREC) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if (store->fd != -1 && store->off >= store->segsize)
+		logstore_seg_close(store);
+	if (store->fd == -1 && logstore_seg_open(store) == -1)
+		return -1;
+
+	if (conn->seq != store->seq) {
+		if (!conn->seq) {
+			conn->next = store->conns;
+			if (store->conns)
+				store->conns->prev = conn;
+			store->conns = conn;
+		}
+		conn->seq = store->seq;
+		conn->first = store->off;
+		conn->first_ts = ts;
+		conn->bytes = 0;
+		if (type != LOGSTORE_REC_OPEN &&
+		    logstore_write_rec(store, conn, LOGSTORE_REC_OPEN,
+		                       LOGSTORE_CONTINUED, conn->meta,
+		                       strlen(conn->meta), ts) == -1)
+			return -1;
+	}
+	if (type == LOGSTORE_REC_OPEN) {
+		buf = conn->meta;
+		sz = strlen(conn->meta);
+	}
+	return logstore_write_rec(store, conn, type, flags, buf, sz, ts);
+}
+
+/*
+ * Write the close record and the index line of conn, and free the conn
+ * state.  Returns -1 on errors, the conn state is freed regardless.
+ */
+int
+logstore_conn_close(logstore_t *store, logstore_conn_t *conn, int by_request)
+{
+	int rv = 0;
+
+	if (conn->seq) {
+		if (logstore_write(store, conn, LOGSTORE_REC_CLOSE,
+		                   by_request ? LOGSTORE_REQUEST : 0,
+		                   NULL, 0) == -1)
+			rv = -1;
+		if (logstore_conn_index(store, conn) == -1)
+			rv = -1;
+		if (conn->prev)
+			conn->prev->next = conn->next;
+		else
+			store->conns = conn->next;
+		if (conn->next)
+			conn->next->prev = conn->prev;
+	}
+	free(conn->meta);
+	memset(conn, 0, sizeof(logstore_conn_t));
+	return rv;
+}
+
+/*
+ * Check the magic at the start of a segment.  Returns -1 if f is not a
+ * segment.
+ */
+int
+logstore_seg_check(logz_reader_t *f)
+{
+	char magic[LOGSTORE_MAGICLEN];
+
+	if (logz_read(f, magic, LOGSTORE_MAGICLEN) != LOGSTORE_MAGICLEN ||
+	    memcmp(magic, LOGSTORE_MAGIC, LOGSTORE_MAGICLEN)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read the next record of a segment into rec and the payload into *buf,
+ * which is grown as needed, and NUL terminated for convenience.  Returns
+ * the size of the record, 0 at the end of the segment or -1 if the segment
+ * is truncated or corrupt; the segment being written ends in a partial
+ * record if the proxy is running.
+ */
+ssize_t
+logstore_read_rec(logz_reader_t *f, logstore_rec_t *rec, unsigned char **buf,
+                  size_t *bufsz)
+{
+	ssize_t n;
+
+	n = logz_read(f, rec, sizeof(logstore_rec_t));
+	if (n == 0)
+		return 0;
+	if (n != sizeof(logstore_rec_t) || rec->len > LOGSTORE_MAXREC ||
+	    rec->type < LOGSTORE_REC_OPEN || rec->type > LOGSTORE_REC_CLOSE) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!*buf || *bufsz < (size_t)rec->len + 1) {
+		unsigned char *p = realloc(*buf, rec->len + 1);
+		if (!p)
+			return -1;
+		*buf = p;
+		*bufsz = rec->len + 1;
+	}
+	if (rec->len && logz_read(f, *buf, rec->len) != (ssize_t)rec->len) {
+		errno = EINVAL;
+		return -1;
+	}
+	(*buf)[rec->len] = '\0';
+	return sizeof(logstore_rec_t) + rec->len;
+}
+
+/*
+ * Parse an index line in place.  The strings in idx point into line.
+ * Returns -1 if the line is malformed.
+ */
+int
+logstore_idx_parse(char *line, logstore_idx_t *idx)
+{
+	uint64_t *nums[] = {&idx->id, &idx->first, &idx->last,
+	                    &idx->first_ts, &idx->last_ts, &idx->bytes};
+	char **strs[] = {&idx->src, &idx->dst, &idx->sni, &idx->user};
+	char *field, *end;
+	size_t i;
+
+	line[strcspn(line, "\r\n")] = '\0';
+	for (i = 0; i < sizeof(nums) / sizeof(nums[0]); i++) {
+		if (!(field = strsep(&line, "\t")) || !*field)
+			return -1;
+		errno = 0;
+		*nums[i] = strtoull(field, &end, 10);
+		if (errno || *end)
+			return -1;
+	}
+	for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+		if (!(field = strsep(&line, "\t")))
+			return -1;
+		*strs[i] = field;
+	}
+	return line ? -1 : 0;
+}
+
+int
+logstore_idx_write(FILE *f, const logstore_idx_t *idx)
+{
+	return fprintf(f, "%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64
+	               "\t%" PRIu64 "\t%" PRIu64 "\t%s\t%s\t%s\t%s\n",
+	               idx->id, idx->first, idx->last, idx->first_ts,
+	               idx->last_ts, idx->bytes, idx->src, idx->dst, idx->sni,
+	               idx->user) < 0 ? -1 : 0;
+}
+
+/* vim: set noet ft=c: */
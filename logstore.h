@@ -0,0 +1,143 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOGSTORE_H
+#define LOGSTORE_H
+
+#include "attrib.h"
+#include "logz.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/*
+ * Segmented content log store.
+ *
+ * Records of all conns are appended to segment files in the store dir, named
+ * after the start time and pid of the proxy, the run, and a sequence number:
+ * 20201231T235959Z-1234-000001.seg.  A new segment is started once the
+ * current one reaches the segment size, and on SIGHUP.  Segments start with
+ * LOGSTORE_MAGIC, followed by records: a logstore_rec_t header in host byte
+ * order and the payload.
+ *
+ * The first record of a conn is an open record with the conn metadata as
+ * payload: src, dst, sni and user, tab separated, "-" if not known.  If the
+ * conn goes on in a later segment, the open record is repeated there with
+ * LOGSTORE_CONTINUED, so that each segment is self-contained.
+ *
+ * Each segment has a sidecar index, the same name with .idx, with a line for
+ * each conn with records in the segment: id, offsets of its first and last
+ * record, timestamps of its first and last record, payload bytes and the
+ * metadata, all tab separated.  Lines are written when the conn closes or the
+ * segment ends, so the index of the current segment is incomplete; it can be
+ * rebuilt by scanning the segment.
+ *
+ * With LogCompression, segments are compressed as a sequence of frames; the
+ * sizes and offsets above refer to the uncompressed stream.  Index files are
+ * not compressed.  Segments are read with logz_reader_open(), which reads
+ * plain, gzip and zstd compressed segments.
+ */
+
+#define LOGSTORE_MAGIC    "SSLPSEG1"
+#define LOGSTORE_MAGICLEN 8
+
+/* record types */
+#define LOGSTORE_REC_OPEN  1
+#define LOGSTORE_REC_DATA  2
+#define LOGSTORE_REC_CLOSE 3
+
+/* record flags */
+#define LOGSTORE_REQUEST   1 /* client to server, or closed by the client */
+#define LOGSTORE_CONTINUED 2 /* open record repeated in a later segment */
+
+typedef struct logstore_rec {
+	uint32_t len;  /* of the payload */
+	uint16_t type;
+	uint16_t flags;
+	uint64_t id;   /* conn id, unique within a run */
+	uint64_t ts;   /* CLOCK_REALTIME in nanoseconds */
+} logstore_rec_t;
+
+/* index line */
+typedef struct logstore_idx {
+	uint64_t id;
+	uint64_t first;
+	uint64_t last;
+	uint64_t first_ts;
+	uint64_t last_ts;
+	uint64_t bytes;
+	char *src;
+	char *dst;
+	char *sni;
+	char *user;
+} logstore_idx_t;
+
+/* conn state of the writer, owned by the caller */
+typedef struct logstore_conn {
+	uint64_t id;
+	char *meta;
+	/* span of the conn in the current segment, if seq is current */
+	uint64_t seq;
+	uint64_t first;
+	uint64_t last;
+	uint64_t first_ts;
+	uint64_t last_ts;
+	uint64_t bytes;
+	struct logstore_conn *prev;
+	struct logstore_conn *next;
+} logstore_conn_t;
+
+/* opens a segment or index file for appending, returns the fd or -1 */
+typedef int (*logstore_open_func_t)(const char *, void *);
+
+typedef struct logstore logstore_t;
+
+/* writer, not thread-safe */
+logstore_t * logstore_new(const char *, uint64_t, logstore_open_func_t,
+                          void *) NONNULL(1,3) MALLOC;
+void logstore_free(logstore_t *) NONNULL(1);
+int logstore_conn_init(logstore_conn_t *, uint64_t, const char *,
+                       const char *, const char *, const char *)
+                       NONNULL(1) WUNRES;
+int logstore_write(logstore_t *, logstore_conn_t *, int, int,
+                   const void *, size_t) NONNULL(1,2) WUNRES;
+int logstore_conn_close(logstore_t *, logstore_conn_t *, int) NONNULL(1,2);
+void logstore_rotate(logstore_t *) NONNULL(1);
+
+/* reader */
+int logstore_seg_check(logz_reader_t *) NONNULL(1) WUNRES;
+ssize_t logstore_read_rec(logz_reader_t *, logstore_rec_t *, unsigned char **,
+                          size_t *) NONNULL(1,2,3,4) WUNRES;
+int logstore_idx_parse(char *, logstore_idx_t *) NONNULL(1,2) WUNRES;
+int logstore_idx_write(FILE *, const logstore_idx_t *) NONNULL(1,2);
+
+#endif /* !LOGSTORE_H */
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,367 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logstore.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+static char template[] = "/tmp/sslproxy_test_logstore.XXXXXX";
+static char *basedir;
+static char *segs[8];
+static int nsegs;
+static int nopens;
+
+static void
+logstore_setup(void)
+{
+	basedir = strdup(template);
+	if (!mkdtemp(basedir)) {
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+	nopens = 0;
+	nsegs = 0;
+}
+
+static void
+logstore_teardown(void)
+{
+	DIR *d;
+	struct dirent *de;
+	char *fn;
+
+	if ((d = opendir(basedir))) {
+		while ((de = readdir(d))) {
+			if (de->d_name[0] == '.')
+				continue;
+			if (asprintf(&fn, "%s/%s", basedir, de->d_name) != -1) {
+				unlink(fn);
+				free(fn);
+			}
+		}
+		closedir(d);
+	}
+	rmdir(basedir);
+	free(basedir);
+	for (int i = 0; i < nsegs; i++)
+		free(segs[i]);
+}
+
+static int
+logstore_openfile(const char *fn, void *arg)
+{
+	fail_unless(arg == basedir, "openfile arg mismatch");
+	fail_unless(!strncmp(fn, basedir, strlen(basedir)), "file outside dir");
+	nopens++;
+	return open(fn, O_WRONLY|O_CREAT|O_APPEND, 0600);
+}
+
+static int
+logstore_segcmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Collect the sorted paths of the segments in basedir.
+ */
+static void
+logstore_find_segs(void)
+{
+	DIR *d;
+	struct dirent *de;
+	size_t len;
+
+	d = opendir(basedir);
+	fail_unless(!!d, "cannot open dir");
+	while ((de = readdir(d))) {
+		len = strlen(de->d_name);
+		if (len < 4 || strcmp(de->d_name + len - 4, ".seg"))
+			continue;
+		fail_unless(nsegs < 8, "too many segments");
+		fail_unless(asprintf(&segs[nsegs++], "%s/%s", basedir,
+		                     de->d_name) != -1, "asprintf failed");
+	}
+	closedir(d);
+	qsort(segs, nsegs, sizeof(char *), logstore_segcmp);
+}
+
+static char *
+logstore_read_idx(const char *seg)
+{
+	static char buf[4096];
+	char *fn;
+	ssize_t n;
+	int fd;
+
+	fail_unless(asprintf(&fn, "%s.idx", seg) != -1, "asprintf failed");
+	fd = open(fn, O_RDONLY);
+	free(fn);
+	fail_unless(fd != -1, "index missing");
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	fail_unless(n >= 0, "cannot read index");
+	buf[n] = '\0';
+	return buf;
+}
+
+START_TEST(logstore_conn_init_01)
+{
+	logstore_conn_t conn;
+
+	fail_unless(logstore_conn_init(&conn, 7, "[127.0.0.1]:1234",
+	                               "[::1]:443", "a\tb\nc", NULL) == 0,
+	            "init failed");
+	fail_unless(conn.id == 7, "id mismatch");
+	fail_unless(!strcmp(conn.meta, "[127.0.0.1]:1234\t[::1]:443\ta?b?c\t-"),
+	            "meta mismatch");
+	fail_unless(!conn.seq, "conn already written");
+	free(conn.meta);
+}
+END_TEST
+
+START_TEST(logstore_write_01)
+{
+	logstore_t *store;
+	logstore_conn_t conn;
+	logstore_rec_t rec;
+	logstore_idx_t idx;
+	unsigned char *buf = NULL;
+	size_t bufsz = 0;
+	uint64_t off, closeoff;
+	char *line;
+	logz_reader_t *f;
+
+	store = logstore_new(basedir, 1048576, logstore_openfile, basedir);
+	fail_unless(!!store, "logstore_new failed");
+	fail_unless(!nopens, "opened segment before the first record");
+	fail_unless(logstore_conn_init(&conn, 42, "src", "dst", "example.org",
+	                               "user") == 0, "init failed");
+	fail_unless(logstore_write(store, &conn, LOGSTORE_REC_OPEN, 0,
+	                           NULL, 0) == 0, "open failed");
+	fail_unless(logstore_write(store, &conn, LOGSTORE_REC_DATA,
+	                           LOGSTORE_REQUEST, "GET", 3) == 0,
+	            "write req failed");
+	fail_unless(logstore_write(store, &conn, LOGSTORE_REC_DATA, 0,
+	                           "200 OK", 6) == 0, "write resp failed");
+	closeoff = conn.last + sizeof(logstore_rec_t) + 6;
+	fail_unless(logstore_conn_close(store, &conn, 1) == 0, "close failed");
+	logstore_free(store);
+	fail_unless(nopens == 2, "segment and index not opened once");
+
+	logstore_find_segs();
+	fail_unless(nsegs == 1, "not one segment");
+	f = logz_reader_open(segs[0]);
+	fail_unless(!!f, "cannot open segment");
+	fail_unless(logstore_seg_check(f) == 0, "magic mismatch");
+	off = LOGSTORE_MAGICLEN;
+
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) ==
+	            (ssize_t)(sizeof(rec) + 24), "open record size mismatch");
+	fail_unless(rec.type == LOGSTORE_REC_OPEN && !rec.flags &&
+	            rec.id == 42, "open record mismatch");
+	fail_unless(!strcmp((char *)buf, "src\tdst\texample.org\tuser"),
+	            "open payload mismatch");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) > 0 &&
+	            rec.type == LOGSTORE_REC_DATA &&
+	            rec.flags == LOGSTORE_REQUEST && rec.len == 3 &&
+	            !memcmp(buf, "GET", 3), "request record mismatch");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) > 0 &&
+	            rec.type == LOGSTORE_REC_DATA && !rec.flags &&
+	            rec.len == 6 && !memcmp(buf, "200 OK", 6),
+	            "response record mismatch");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) > 0 &&
+	            rec.type == LOGSTORE_REC_CLOSE &&
+	            rec.flags == LOGSTORE_REQUEST && !rec.len,
+	            "close record mismatch");
+	fail_unless(rec.ts >= 1000000000ULL * 1600000000ULL, "bad timestamp");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) == 0,
+	            "records after close");
+	logz_reader_close(f);
+	free(buf);
+
+	line = logstore_read_idx(segs[0]);
+	fail_unless(!!strchr(line, '\n') && !strchr(line, '\n')[1],
+	            "not one index line");
+	fail_unless(logstore_idx_parse(line, &idx) == 0, "index parse failed");
+	fail_unless(idx.id == 42 && idx.first == off && idx.last == closeoff,
+	            "index offsets mismatch");
+	fail_unless(idx.bytes == 9, "index bytes mismatch");
+	fail_unless(idx.first_ts <= idx.last_ts && idx.last_ts == rec.ts,
+	            "index timestamps mismatch");
+	fail_unless(!strcmp(idx.sni, "example.org") &&
+	            !strcmp(idx.user, "user"), "index metadata mismatch");
+}
+END_TEST
+
+START_TEST(logstore_write_02)
+{
+	logstore_t *store;
+	logstore_conn_t conn1, conn2;
+	logstore_rec_t rec;
+	logstore_idx_t idx;
+	unsigned char *buf = NULL;
+	size_t bufsz = 0;
+	char data[100], *line, *next;
+	logz_reader_t *f;
+	int n;
+
+	memset(data, 'x', sizeof(data));
+	store = logstore_new(basedir, 256, logstore_openfile, basedir);
+	fail_unless(!!store, "logstore_new failed");
+	fail_unless(logstore_conn_init(&conn1, 1, "a", "b", NULL, NULL) == 0 &&
+	            logstore_conn_init(&conn2, 2, "c", "d", NULL, NULL) == 0,
+	            "init failed");
+	fail_unless(logstore_write(store, &conn1, LOGSTORE_REC_OPEN, 0,
+	                           NULL, 0) == 0 &&
+	            logstore_write(store, &conn2, LOGSTORE_REC_OPEN, 0,
+	                           NULL, 0) == 0, "open failed");
+	/* fills the first segment */
+	fail_unless(logstore_write(store, &conn1, LOGSTORE_REC_DATA, 0,
+	                           data, sizeof(data)) == 0 &&
+	            logstore_write(store, &conn1, LOGSTORE_REC_DATA, 0,
+	                           data, sizeof(data)) == 0, "write failed");
+	/* starts the second segment */
+	fail_unless(logstore_write(store, &conn2, LOGSTORE_REC_DATA, 0,
+	                           data, sizeof(data)) == 0, "write failed");
+	fail_unless(logstore_conn_close(store, &conn2, 0) == 0 &&
+	            logstore_conn_close(store, &conn1, 0) == 0, "close failed");
+	/* SIGHUP starts a third segment on the next record */
+	logstore_rotate(store);
+	fail_unless(logstore_conn_init(&conn1, 3, "e", "f", NULL, NULL) == 0,
+	            "init failed");
+	fail_unless(logstore_write(store, &conn1, LOGSTORE_REC_OPEN, 0,
+	                           NULL, 0) == 0, "open failed");
+	logstore_free(store);
+	free(conn1.meta);
+
+	logstore_find_segs();
+	fail_unless(nsegs == 3, "not three segments");
+
+	/* both conns are indexed in the first segment on rotation */
+	line = logstore_read_idx(segs[0]);
+	for (n = 0; (next = strsep(&line, "\n")) && *next; n++) {
+		fail_unless(logstore_idx_parse(next, &idx) == 0,
+		            "index parse failed");
+		fail_unless(idx.bytes == (idx.id == 1 ? 200 : 0),
+		            "index bytes mismatch");
+	}
+	fail_unless(n == 2, "not two index lines");
+
+	/* the second segment repeats the open records of both conns */
+	f = logz_reader_open(segs[1]);
+	fail_unless(!!f, "cannot open segment");
+	fail_unless(logstore_seg_check(f) == 0, "magic mismatch");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) > 0 &&
+	            rec.type == LOGSTORE_REC_OPEN && rec.id == 2 &&
+	            rec.flags == LOGSTORE_CONTINUED &&
+	            !strcmp((char *)buf, "c\td\t-\t-"),
+	            "continued open of conn 2 missing");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) > 0 &&
+	            rec.type == LOGSTORE_REC_DATA && rec.id == 2,
+	            "data of conn 2 missing");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) > 0 &&
+	            rec.type == LOGSTORE_REC_CLOSE && rec.id == 2,
+	            "close of conn 2 missing");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) > 0 &&
+	            rec.type == LOGSTORE_REC_OPEN && rec.id == 1 &&
+	            rec.flags == LOGSTORE_CONTINUED,
+	            "continued open of conn 1 missing");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) > 0 &&
+	            rec.type == LOGSTORE_REC_CLOSE && rec.id == 1,
+	            "close of conn 1 missing");
+	fail_unless(logstore_read_rec(f, &rec, &buf, &bufsz) == 0,
+	            "records after close");
+	logz_reader_close(f);
+	free(buf);
+
+	/* the conn open at exit is indexed in the last segment */
+	line = logstore_read_idx(segs[2]);
+	fail_unless(logstore_idx_parse(line, &idx) == 0 && idx.id == 3,
+	            "open conn not indexed");
+}
+END_TEST
+
+START_TEST(logstore_idx_01)
+{
+	logstore_idx_t idx;
+	char good[] = "5\t8\t40\t100\t200\t7\ts\td\t-\tu\n";
+	char fewer[] = "5\t8\t40\t100\t200\t7\ts\td\t-\n";
+	char more[] = "5\t8\t40\t100\t200\t7\ts\td\t-\tu\tx\n";
+	char nonum[] = "5\t8\tx\t100\t200\t7\ts\td\t-\tu\n";
+	char empty[] = "\n";
+
+	fail_unless(logstore_idx_parse(good, &idx) == 0, "good line rejected");
+	fail_unless(idx.id == 5 && idx.first == 8 && idx.last == 40 &&
+	            idx.first_ts == 100 && idx.last_ts == 200 &&
+	            idx.bytes == 7, "numbers mismatch");
+	fail_unless(!strcmp(idx.src, "s") && !strcmp(idx.dst, "d") &&
+	            !strcmp(idx.sni, "-") && !strcmp(idx.user, "u"),
+	            "strings mismatch");
+	fail_unless(logstore_idx_parse(fewer, &idx) == -1, "accepted fewer");
+	fail_unless(logstore_idx_parse(more, &idx) == -1, "accepted more");
+	fail_unless(logstore_idx_parse(nonum, &idx) == -1, "accepted nonum");
+	fail_unless(logstore_idx_parse(empty, &idx) == -1, "accepted empty");
+}
+END_TEST
+
+Suite *
+logstore_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("logstore");
+
+	tc = tcase_create("logstore_conn_init");
+	tcase_add_test(tc, logstore_conn_init_01);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("logstore_write");
+	tcase_add_checked_fixture(tc, logstore_setup, logstore_teardown);
+	tcase_add_test(tc, logstore_write_01);
+	tcase_add_test(tc, logstore_write_02);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("logstore_idx");
+	tcase_add_test(tc, logstore_idx_01);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
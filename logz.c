@@ -0,0 +1,962 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logz.h"
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif /* HAVE_ZSTD */
+
+typedef struct logz_job logz_job_t;
+
+typedef struct logz_stream {
+	int fd;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;         /* signaled when no jobs are pending */
+	unsigned char *buf;          /* block being filled */
+	size_t sz;
+	size_t cap;
+	time_t since;                /* when the block got its first byte */
+	uint64_t seq_next;           /* seq of the next job submitted */
+	uint64_t seq_write;          /* seq of the next job to write */
+	logz_job_t *done;            /* compressed jobs waiting for earlier ones */
+	unsigned int pending;
+	int error;                   /* errno of a failed frame write */
+	struct logz_stream *prev;
+	struct logz_stream *next;
+} logz_stream_t;
+
+struct logz_job {
+	logz_stream_t *s;
+	uint64_t seq;
+	unsigned char *in;
+	size_t insz;
+	unsigned char *out;
+	size_t outsz;
+	logz_job_t *next;
+};
+
+typedef struct logz_worker {
+	pthread_t thr;
+	z_stream zs;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *cctx;
+#endif /* HAVE_ZSTD */
+} logz_worker_t;
+
+static int logz_algo = LOGZ_NONE;
+static int logz_level;
+
+/* protects the fd table, the stream list and the job queue; when nested,
+ * taken after the mutex of a stream */
+static pthread_mutex_t logz_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logz_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t logz_flushcond = PTHREAD_COND_INITIALIZER;
+static logz_stream_t **logz_fds = NULL;
+static int logz_nfds = 0;
+static logz_stream_t *logz_streams = NULL;
+static logz_job_t *logz_head = NULL;
+static logz_job_t **logz_tail = &logz_head;
+static int logz_done = 0;
+
+static logz_worker_t *logz_workers = NULL;
+static unsigned int logz_nworkers = 0;
+static pthread_t logz_flusher;
+static int logz_flusher_started = 0;
+
+/* stats since the last logz_stats() */
+static unsigned long long logz_stats_in = 0;
+static unsigned long long logz_stats_out = 0;
+static unsigned long long logz_stats_cpu = 0;
+static unsigned long long logz_stats_frames = 0;
+static unsigned long long logz_stats_errors = 0;
+
+/*
+ * Parse a LogCompression value, returns -1 if unknown or not supported by
+ * this build.
+ */
+int
+logz_parse(const char *value)
+{
+	if (!strcasecmp(value, "none"))
+		return LOGZ_NONE;
+	if (!strcasecmp(value, "gzip"))
+		return LOGZ_GZIP;
+#ifdef HAVE_ZSTD
+	if (!strcasecmp(value, "zstd"))
+		return LOGZ_ZSTD;
+#endif /* HAVE_ZSTD */
+	return -1;
+}
+
+const char *
+logz_str(int algo)
+{
+	switch (algo) {
+	case LOGZ_NONE:
+		return "none";
+	case LOGZ_GZIP:
+		return "gzip";
+	case LOGZ_ZSTD:
+		return "zstd";
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * File name suffix of the compressed files, "" if compression is disabled.
+ */
+const char *
+logz_suffix(void)
+{
+	switch (logz_algo) {
+	case LOGZ_GZIP:
+		return ".gz";
+	case LOGZ_ZSTD:
+		return ".zst";
+	default:
+		return "";
+	}
+}
+
+int
+logz_enabled(void)
+{
+	return logz_algo != LOGZ_NONE;
+}
+
+static time_t
+logz_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static uint64_t
+logz_cputime(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif /* CLOCK_THREAD_CPUTIME_ID */
+	return 0;
+}
+
+/*
+ * Compress the input of job into a frame of its own.
+ */
+static int
+logz_compress(logz_worker_t *w, logz_job_t *job)
+{
+	size_t bound;
+
+	switch (logz_algo) {
+	case LOGZ_GZIP:
+		if (deflateReset(&w->zs) != Z_OK)
+			return -1;
+		bound = deflateBound(&w->zs, job->insz);
+		if (!(job->out = malloc(bound)))
+			return -1;
+		w->zs.next_in = job->in;
+		w->zs.avail_in = job->insz;
+		w->zs.next_out = job->out;
+		w->zs.avail_out = bound;
+		if (deflate(&w->zs, Z_FINISH) != Z_STREAM_END)
+			return -1;
+		job->outsz = bound - w->zs.avail_out;
+		return 0;
+#ifdef HAVE_ZSTD
+	case LOGZ_ZSTD:
+		bound = ZSTD_compressBound(job->insz);
+		if (!(job->out = malloc(bound)))
+			return -1;
+		job->outsz = ZSTD_compressCCtx(w->cctx, job->out, bound,
+		                               job->in, job->insz, logz_level);
+		return ZSTD_isError(job->outsz) ? -1 : 0;
+#endif /* HAVE_ZSTD */
+	default:
+		return -1;
+	}
+}
+
+static int
+logz_write_all(int fd, const unsigned char *buf, size_t sz)
+{
+	ssize_t n;
+
+	while (sz) {
+		n = write(fd, buf, sz);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		sz -= n;
+	}
+	return 0;
+}
+
+static void
+logz_job_free(logz_job_t *job)
+{
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+/*
+ * Queue the block of s for compression.  Called with the mutex of s held,
+ * and logz_mutex if locked.
+ */
+static int
+logz_submit(logz_stream_t *s, int locked)
+{
+	logz_job_t *job;
+
+	if (!s->sz)
+		return 0;
+	if (!(job = malloc(sizeof(logz_job_t))))
+		return -1;
+	memset(job, 0, sizeof(logz_job_t));
+	job->s = s;
+	job->seq = s->seq_next++;
+	job->in = s->buf;
+	job->insz = s->sz;
+	s->buf = NULL;
+	s->sz = s->cap = 0;
+	s->pending++;
+
+	if (!locked)
+		pthread_mutex_lock(&logz_mutex);
+	*logz_tail = job;
+	logz_tail = &job->next;
+	pthread_cond_signal(&logz_cond);
+	if (!locked)
+		pthread_mutex_unlock(&logz_mutex);
+	return 0;
+}
+
+/*
+ * Write the compressed frames of s which are next in order.  Called with
+ * the mutex of s held.
+ */
+static void
+logz_stream_drain(logz_stream_t *s)
+{
+	logz_job_t *job;
+
+	while ((job = s->done) && job->seq == s->seq_write) {
+		s->done = job->next;
+		if (!job->out) {
+			if (!s->error)
+				s->error = EIO;
+			__atomic_add_fetch(&logz_stats_errors, 1, __ATOMIC_RELAXED);
+		} else if (logz_write_all(s->fd, job->out, job->outsz) == -1) {
+			if (!s->error)
+				s->error = errno;
+			__atomic_add_fetch(&logz_stats_errors, 1, __ATOMIC_RELAXED);
+		} else {
+			__atomic_add_fetch(&logz_stats_in, job->insz, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&logz_stats_out, job->outsz, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&logz_stats_frames, 1, __ATOMIC_RELAXED);
+		}
+		s->seq_write++;
+		s->pending--;
+		logz_job_free(job);
+	}
+	if (!s->pending)
+		pthread_cond_broadcast(&s->cond);
+}
+
+static void *
+logz_worker_thread(void *arg)
+{
+	logz_worker_t *w = arg;
+	logz_job_t *job, **p;
+	logz_stream_t *s;
+	uint64_t cpu;
+
+	for (;;) {
+		pthread_mutex_lock(&logz_mutex);
+		while (!logz_head && !logz_done)
+			pthread_cond_wait(&logz_cond, &logz_mutex);
+		if (!(job = logz_head)) {
+			pthread_mutex_unlock(&logz_mutex);
+			break;
+		}
+		if (!(logz_head = job->next))
+			logz_tail = &logz_head;
+		pthread_mutex_unlock(&logz_mutex);
+
+		cpu = logz_cputime();
+		if (logz_compress(w, job) == -1) {
+			free(job->out);
+			job->out = NULL;
+		}
+		__atomic_add_fetch(&logz_stats_cpu, logz_cputime() - cpu,
+		                   __ATOMIC_RELAXED);
+
+		/* frames are written in the order of the blocks */
+		s = job->s;
+		pthread_mutex_lock(&s->mutex);
+		for (p = &s->done; *p && (*p)->seq < job->seq; p = &(*p)->next);
+		job->next = *p;
+		*p = job;
+		logz_stream_drain(s);
+		pthread_mutex_unlock(&s->mutex);
+	}
+	return NULL;
+}
+
+/*
+ * Queue the blocks which have been partial for LOGZ_FLUSH_INTERVAL, so that
+ * the logs of quiet conns are not held back.
+ */
+static void *
+logz_flusher_thread(UNUSED void *arg)
+{
+	struct timespec ts;
+	time_t now;
+
+	pthread_mutex_lock(&logz_mutex);
+	while (!logz_done) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += LOGZ_FLUSH_INTERVAL;
+		pthread_cond_timedwait(&logz_flushcond, &logz_mutex, &ts);
+		now = logz_now();
+		for (logz_stream_t *s = logz_streams; s; s = s->next) {
+			/* the lock order is the other way round; a busy
+			 * stream is flushed on the next round */
+			if (pthread_mutex_trylock(&s->mutex))
+				continue;
+			if (s->sz && now - s->since >= LOGZ_FLUSH_INTERVAL)
+				logz_submit(s, 1);
+			pthread_mutex_unlock(&s->mutex);
+		}
+	}
+	pthread_mutex_unlock(&logz_mutex);
+	return NULL;
+}
+
+static void
+logz_worker_fini(logz_worker_t *w)
+{
+	deflateEnd(&w->zs);
+#ifdef HAVE_ZSTD
+	if (w->cctx)
+		ZSTD_freeCCtx(w->cctx);
+#endif /* HAVE_ZSTD */
+}
+
+static int
+logz_worker_init(logz_worker_t *w)
+{
+	memset(w, 0, sizeof(logz_worker_t));
+	/* 16 added to the window bits selects the gzip wrapper */
+	if (deflateInit2(&w->zs, logz_algo == LOGZ_GZIP ? logz_level : 1,
+	                 Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+#ifdef HAVE_ZSTD
+	if (logz_algo == LOGZ_ZSTD && !(w->cctx = ZSTD_createCCtx())) {
+		deflateEnd(&w->zs);
+		return -1;
+	}
+#endif /* HAVE_ZSTD */
+	return 0;
+}
+
+/*
+ * Start the compression workers.  Level is capped to the range of the
+ * algorithm.  Returns -1 on errors.
+ */
+int
+logz_init(int algo, int level, unsigned int nworkers)
+{
+	unsigned int i;
+
+	if (algo == LOGZ_NONE)
+		return 0;
+	logz_algo = algo;
+	if (level < 1)
+		level = 1;
+	if (algo == LOGZ_GZIP && level > 9)
+		level = 9;
+#ifdef HAVE_ZSTD
+	if (algo == LOGZ_ZSTD && level > ZSTD_maxCLevel())
+		level = ZSTD_maxCLevel();
+#endif /* HAVE_ZSTD */
+	logz_level = level;
+	logz_done = 0;
+
+	if (!(logz_workers = calloc(nworkers, sizeof(logz_worker_t))))
+		goto errout;
+	for (i = 0; i < nworkers; i++) {
+		if (logz_worker_init(&logz_workers[i]) == -1)
+			goto errout;
+		if (pthread_create(&logz_workers[i].thr, NULL,
+		                   logz_worker_thread, &logz_workers[i])) {
+			logz_worker_fini(&logz_workers[i]);
+			goto errout;
+		}
+		logz_nworkers++;
+	}
+	if (pthread_create(&logz_flusher, NULL, logz_flusher_thread, NULL))
+		goto errout;
+	logz_flusher_started = 1;
+	return 0;
+
+errout:
+	logz_fini();
+	return -1;
+}
+
+/*
+ * Write out the open streams and stop the workers.
+ */
+void
+logz_fini(void)
+{
+	int fd;
+
+	for (;;) {
+		pthread_mutex_lock(&logz_mutex);
+		fd = logz_streams ? logz_streams->fd : -1;
+		pthread_mutex_unlock(&logz_mutex);
+		if (fd == -1)
+			break;
+		logz_close(fd);
+	}
+
+	pthread_mutex_lock(&logz_mutex);
+	logz_done = 1;
+	pthread_cond_broadcast(&logz_cond);
+	pthread_cond_broadcast(&logz_flushcond);
+	pthread_mutex_unlock(&logz_mutex);
+	if (logz_flusher_started) {
+		pthread_join(logz_flusher, NULL);
+		logz_flusher_started = 0;
+	}
+	for (unsigned int i = 0; i < logz_nworkers; i++) {
+		pthread_join(logz_workers[i].thr, NULL);
+		logz_worker_fini(&logz_workers[i]);
+	}
+	free(logz_workers);
+	logz_workers = NULL;
+	logz_nworkers = 0;
+	free(logz_fds);
+	logz_fds = NULL;
+	logz_nfds = 0;
+	logz_algo = LOGZ_NONE;
+}
+
+static logz_stream_t *
+logz_lookup(int fd)
+{
+	logz_stream_t *s = NULL;
+
+	if (logz_algo == LOGZ_NONE || fd < 0)
+		return NULL;
+	pthread_mutex_lock(&logz_mutex);
+	if (fd < logz_nfds)
+		s = logz_fds[fd];
+	pthread_mutex_unlock(&logz_mutex);
+	return s;
+}
+
+static const unsigned char logz_gzip_magic[] = {0x1f, 0x8b};
+static const unsigned char logz_zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+/*
+ * Check that frames can be appended to the file of fd: it is empty, or it
+ * starts with a frame of the configured algorithm.  Frames appended to plain
+ * text or to frames of the other algorithm would leave a file that neither
+ * zcat nor zstdcat can read.  Pipes and other special files are not checked.
+ */
+static int
+logz_appendable(int fd)
+{
+	unsigned char buf[sizeof(logz_zstd_magic)];
+	const unsigned char *magic;
+	size_t magicsz;
+	struct stat st;
+	ssize_t n;
+
+	if (fstat(fd, &st) == -1)
+		return -1;
+	if (!S_ISREG(st.st_mode) || st.st_size == 0)
+		return 0;
+	if (logz_algo == LOGZ_GZIP) {
+		magic = logz_gzip_magic;
+		magicsz = sizeof(logz_gzip_magic);
+	} else {
+		magic = logz_zstd_magic;
+		magicsz = sizeof(logz_zstd_magic);
+	}
+	n = pread(fd, buf, magicsz, 0);
+	if (n == -1)
+		return -1;
+	if ((size_t)n != magicsz || memcmp(buf, magic, magicsz)) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Compress the writes to fd from now on.  No-op if compression is disabled.
+ * fd must be open for reading too.  Returns -1 on errors, with errno set to
+ * EINVAL if the file is not empty and not compressed with the configured
+ * algorithm.
+ */
+int
+logz_open(int fd)
+{
+	logz_stream_t *s;
+
+	if (logz_algo == LOGZ_NONE)
+		return 0;
+	if (fd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+	if (logz_appendable(fd) == -1)
+		return -1;
+	if (!(s = malloc(sizeof(logz_stream_t))))
+		return -1;
+	memset(s, 0, sizeof(logz_stream_t));
+	s->fd = fd;
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_cond_init(&s->cond, NULL);
+
+	pthread_mutex_lock(&logz_mutex);
+	if (fd >= logz_nfds) {
+		int n = fd + 64;
+		logz_stream_t **fds = realloc(logz_fds, n * sizeof(*fds));
+		if (!fds)
+			goto errout;
+		memset(fds + logz_nfds, 0, (n - logz_nfds) * sizeof(*fds));
+		logz_fds = fds;
+		logz_nfds = n;
+	}
+	if (logz_fds[fd]) {
+		errno = EEXIST;
+		goto errout;
+	}
+	logz_fds[fd] = s;
+	s->next = logz_streams;
+	if (logz_streams)
+		logz_streams->prev = s;
+	logz_streams = s;
+	pthread_mutex_unlock(&logz_mutex);
+	return 0;
+
+errout:
+	pthread_mutex_unlock(&logz_mutex);
+	pthread_mutex_destroy(&s->mutex);
+	pthread_cond_destroy(&s->cond);
+	free(s);
+	return -1;
+}
+
+/*
+ * Write out the pending data of fd and stop compressing its writes; the
+ * caller closes fd.  Returns -1 if writing a frame has failed, with errno
+ * set, 0 otherwise, also if fd is not compressed.
+ */
+int
+logz_close(int fd)
+{
+	logz_stream_t *s;
+	int error;
+
+	if (!(s = logz_lookup(fd)))
+		return 0;
+
+	pthread_mutex_lock(&s->mutex);
+	if (logz_submit(s, 0) == -1 && !s->error)
+		s->error = ENOMEM;
+	while (s->pending)
+		pthread_cond_wait(&s->cond, &s->mutex);
+	error = s->error;
+	pthread_mutex_unlock(&s->mutex);
+
+	pthread_mutex_lock(&logz_mutex);
+	logz_fds[fd] = NULL;
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		logz_streams = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+	pthread_mutex_unlock(&logz_mutex);
+
+	free(s->buf);
+	pthread_mutex_destroy(&s->mutex);
+	pthread_cond_destroy(&s->cond);
+	free(s);
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Append to the block of s, queueing full blocks.  Called with the mutex of
+ * s held.
+ */
+static int
+logz_append(logz_stream_t *s, const unsigned char *buf, size_t sz)
+{
+	size_t n;
+
+	while (sz) {
+		if (s->sz == s->cap) {
+			size_t cap = s->cap ? s->cap * 2 : 4096;
+			unsigned char *p;
+			if (cap > LOGZ_BLOCKSIZE)
+				cap = LOGZ_BLOCKSIZE;
+			if (!(p = realloc(s->buf, cap)))
+				return -1;
+			s->buf = p;
+			s->cap = cap;
+		}
+		if (!s->sz)
+			s->since = logz_now();
+		n = s->cap - s->sz;
+		if (n > sz)
+			n = sz;
+		memcpy(s->buf + s->sz, buf, n);
+		s->sz += n;
+		buf += n;
+		sz -= n;
+		if (s->sz == LOGZ_BLOCKSIZE && logz_submit(s, 0) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Report a failed asynchronous frame write on the next write.
+ */
+static int
+logz_error(logz_stream_t *s)
+{
+	int error = s->error;
+
+	if (error) {
+		s->error = 0;
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Write to fd, compressed if fd has been registered with logz_open().
+ * Returns sz or -1 on errors, including an earlier write of a compressed
+ * frame having failed.
+ */
+ssize_t
+logz_write(int fd, const void *buf, size_t sz)
+{
+	logz_stream_t *s;
+	int rv;
+
+	if (!(s = logz_lookup(fd)))
+		return write(fd, buf, sz);
+
+	pthread_mutex_lock(&s->mutex);
+	rv = logz_error(s);
+	if (rv == 0)
+		rv = logz_append(s, buf, sz);
+	pthread_mutex_unlock(&s->mutex);
+	return rv == -1 ? -1 : (ssize_t)sz;
+}
+
+/*
+ * Write all of the iovecs to fd, compressed if fd has been registered with
+ * logz_open(); retries short writes.  The iovecs may be modified.  Returns
+ * the number of bytes written or -1 on errors.
+ */
+ssize_t
+logz_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	logz_stream_t *s;
+	ssize_t total = 0, n;
+	int rv = 0;
+
+	for (int i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	if ((s = logz_lookup(fd))) {
+		pthread_mutex_lock(&s->mutex);
+		rv = logz_error(s);
+		for (int i = 0; rv == 0 && i < iovcnt; i++)
+			rv = logz_append(s, iov[i].iov_base, iov[i].iov_len);
+		pthread_mutex_unlock(&s->mutex);
+		return rv == -1 ? -1 : total;
+	}
+
+	while (iovcnt > 0) {
+		n = writev(fd, iov, iovcnt);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return total;
+}
+
+struct logz_reader {
+	gzFile gz;
+#ifdef HAVE_ZSTD
+	FILE *f;
+	ZSTD_DStream *ds;
+	unsigned char *in;
+	size_t insz;
+	ZSTD_inBuffer ib;
+	int eof;
+#endif /* HAVE_ZSTD */
+	uint64_t off;
+};
+
+/*
+ * Open a log file for reading, whatever the LogCompression it was written
+ * with: zstd files are decompressed with libzstd, plain and gzip files are
+ * read through zlib.  Returns NULL with errno set on errors, ENOTSUP for
+ * zstd files if not built with libzstd.
+ */
+logz_reader_t *
+logz_reader_open(const char *fn)
+{
+	unsigned char magic[sizeof(logz_zstd_magic)];
+	logz_reader_t *r;
+	FILE *f;
+	size_t n;
+
+	if (!(f = fopen(fn, "r")))
+		return NULL;
+	n = fread(magic, 1, sizeof(magic), f);
+	if (!(r = malloc(sizeof(logz_reader_t)))) {
+		fclose(f);
+		return NULL;
+	}
+	memset(r, 0, sizeof(logz_reader_t));
+	if (n == sizeof(magic) && !memcmp(magic, logz_zstd_magic, n)) {
+#ifdef HAVE_ZSTD
+		r->f = f;
+		r->insz = ZSTD_DStreamInSize();
+		if (!(r->in = malloc(r->insz)) || !(r->ds = ZSTD_createDStream()))
+			goto errout;
+		memcpy(r->in, magic, n);
+		r->ib.src = r->in;
+		r->ib.size = n;
+		return r;
+errout:
+		free(r->in);
+		free(r);
+		fclose(f);
+		errno = ENOMEM;
+		return NULL;
+#else /* !HAVE_ZSTD */
+		free(r);
+		fclose(f);
+		errno = ENOTSUP;
+		return NULL;
+#endif /* !HAVE_ZSTD */
+	}
+	fclose(f);
+	if (!(r->gz = gzopen(fn, "r"))) {
+		free(r);
+		return NULL;
+	}
+	return r;
+}
+
+#ifdef HAVE_ZSTD
+static ssize_t
+logz_read_zstd(logz_reader_t *r, unsigned char *buf, size_t sz)
+{
+	ZSTD_outBuffer ob;
+	size_t got = 0, rv, n;
+
+	while (got < sz) {
+		if (r->ib.pos == r->ib.size && !r->eof) {
+			n = fread(r->in, 1, r->insz, r->f);
+			if (n == 0) {
+				if (ferror(r->f))
+					return -1;
+				r->eof = 1;
+			}
+			r->ib.src = r->in;
+			r->ib.size = n;
+			r->ib.pos = 0;
+		}
+		ob.dst = buf + got;
+		ob.size = sz - got;
+		ob.pos = 0;
+		rv = ZSTD_decompressStream(r->ds, &ob, &r->ib);
+		if (ZSTD_isError(rv)) {
+			errno = EINVAL;
+			return -1;
+		}
+		got += ob.pos;
+		/* a truncated last frame ends the file */
+		if (ob.pos == 0 && r->eof)
+			break;
+	}
+	return got;
+}
+#endif /* HAVE_ZSTD */
+
+/*
+ * Read up to sz bytes of the uncompressed stream.  Reads less than sz only
+ * at the end of the file.  Returns the number of bytes read, 0 at the end of
+ * the file, or -1 on errors.
+ */
+ssize_t
+logz_read(logz_reader_t *r, void *buf, size_t sz)
+{
+	ssize_t n;
+
+#ifdef HAVE_ZSTD
+	if (r->ds) {
+		n = logz_read_zstd(r, buf, sz);
+	} else
+#endif /* HAVE_ZSTD */
+	{
+		n = gzread(r->gz, buf, sz);
+	}
+	if (n > 0)
+		r->off += n;
+	return n;
+}
+
+/*
+ * Move forward to offset off of the uncompressed stream.  Returns -1 if off
+ * is behind the current offset, or on errors.
+ */
+int
+logz_reader_seek(logz_reader_t *r, uint64_t off)
+{
+	unsigned char buf[4096];
+	ssize_t n;
+
+	if (off < r->off) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (r->gz) {
+		if (gzseek(r->gz, off, SEEK_SET) == -1)
+			return -1;
+		r->off = off;
+		return 0;
+	}
+	while (r->off < off) {
+		n = logz_read(r, buf, off - r->off < sizeof(buf) ?
+		                      off - r->off : sizeof(buf));
+		if (n <= 0) {
+			if (n == 0)
+				errno = EINVAL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void
+logz_reader_close(logz_reader_t *r)
+{
+	if (r->gz)
+		gzclose(r->gz);
+#ifdef HAVE_ZSTD
+	if (r->ds) {
+		ZSTD_freeDStream(r->ds);
+		free(r->in);
+		fclose(r->f);
+	}
+#endif /* HAVE_ZSTD */
+	free(r);
+}
+
+/*
+ * Statistics line since the last call: bytes in and out, the compression
+ * ratio, compression CPU time in milliseconds, frames and failed frames.
+ * Returns NULL if compression is disabled or out of memory.
+ */
+char *
+logz_stats(void)
+{
+	unsigned long long in, out, cpu, frames, errors;
+	char *s;
+
+	if (logz_algo == LOGZ_NONE)
+		return NULL;
+	in = __atomic_exchange_n(&logz_stats_in, 0, __ATOMIC_RELAXED);
+	out = __atomic_exchange_n(&logz_stats_out, 0, __ATOMIC_RELAXED);
+	cpu = __atomic_exchange_n(&logz_stats_cpu, 0, __ATOMIC_RELAXED);
+	frames = __atomic_exchange_n(&logz_stats_frames, 0, __ATOMIC_RELAXED);
+	errors = __atomic_exchange_n(&logz_stats_errors, 0, __ATOMIC_RELAXED);
+	if (asprintf(&s, "LOGZ: alg=%s, in=%llu, out=%llu, ratio=%.2f, cpu=%llu, fr=%llu, err=%llu\n",
+			logz_str(logz_algo), in, out, out ? (double)in / out : 0.0,
+			cpu / 1000000, frames, errors) < 0)
+		return NULL;
+	return s;
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,87 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LOGZ_H
+#define LOGZ_H
+
+#include "attrib.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+
+/*
+ * Streaming compression of log files.
+ *
+ * Writes to a file registered with logz_open() are collected in blocks, and
+ * each full block is compressed by a pool of worker threads into a frame of
+ * its own, a gzip member or a zstd frame, which is written to the file in
+ * order.  Concatenated frames form a valid compressed file, and since each
+ * frame can be decompressed on its own, the file is readable up to the last
+ * complete frame after a crash.  Partial blocks are written once they are
+ * LOGZ_FLUSH_INTERVAL seconds old, or when the file is closed.
+ *
+ * The write functions fall back to plain writes for files not registered,
+ * so that the callers do not need to know whether compression is enabled.
+ *
+ * The reader decompresses a file written with any of the algorithms, or
+ * none, as a single stream.
+ */
+
+#define LOGZ_NONE 0
+#define LOGZ_GZIP 1
+#define LOGZ_ZSTD 2
+
+#define LOGZ_BLOCKSIZE      131072
+#define LOGZ_FLUSH_INTERVAL 1
+
+int logz_parse(const char *) NONNULL(1) WUNRES;
+const char *logz_str(int) WUNRES;
+const char *logz_suffix(void) WUNRES;
+
+int logz_init(int, int, unsigned int) WUNRES;
+void logz_fini(void);
+int logz_enabled(void) WUNRES;
+
+int logz_open(int) WUNRES;
+int logz_close(int);
+ssize_t logz_write(int, const void *, size_t) WUNRES;
+ssize_t logz_writev(int, struct iovec *, int) NONNULL(2) WUNRES;
+char *logz_stats(void) MALLOC;
+
+typedef struct logz_reader logz_reader_t;
+
+logz_reader_t *logz_reader_open(const char *) NONNULL(1) MALLOC;
+ssize_t logz_read(logz_reader_t *, void *, size_t) NONNULL(1,2) WUNRES;
+int logz_reader_seek(logz_reader_t *, uint64_t) NONNULL(1) WUNRES;
+void logz_reader_close(logz_reader_t *) NONNULL(1);
+
+#endif /* !LOGZ_H */
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,302 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "logz.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <check.h>
+
+static char template[] = "/tmp/sslproxy_test_logz.XXXXXX";
+static char *fn;
+static int fd;
+
+static void
+logz_setup(void)
+{
+	fn = strdup(template);
+	fd = mkstemp(fn);
+	if (fd == -1) {
+		perror("mkstemp");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+logz_teardown(void)
+{
+	close(fd);
+	unlink(fn);
+	free(fn);
+	logz_fini();
+}
+
+/* compressible, but not trivially */
+static unsigned char *
+logz_testdata(size_t sz)
+{
+	unsigned char *buf = malloc(sz);
+
+	for (size_t i = 0; i < sz; i++)
+		buf[i] = "abcdefghij"[(i * 7 + i / 1000) % 10];
+	return buf;
+}
+
+START_TEST(logz_parse_01)
+{
+	fail_unless(logz_parse("none") == LOGZ_NONE, "none");
+	fail_unless(logz_parse("gzip") == LOGZ_GZIP, "gzip");
+	fail_unless(logz_parse("GZip") == LOGZ_GZIP, "GZip");
+	fail_unless(logz_parse("lz4") == -1, "lz4 accepted");
+#ifdef HAVE_ZSTD
+	fail_unless(logz_parse("zstd") == LOGZ_ZSTD, "zstd");
+#else /* !HAVE_ZSTD */
+	fail_unless(logz_parse("zstd") == -1, "zstd accepted without libzstd");
+#endif /* !HAVE_ZSTD */
+	fail_unless(!strcmp(logz_str(LOGZ_GZIP), "gzip"), "str");
+}
+END_TEST
+
+START_TEST(logz_write_01)
+{
+	char buf[16];
+
+	/* disabled and unregistered fds are written as is */
+	fail_unless(logz_init(LOGZ_NONE, 1, 1) == 0, "init failed");
+	fail_unless(!logz_enabled(), "enabled");
+	fail_unless(!strcmp(logz_suffix(), ""), "suffix");
+	fail_unless(logz_open(fd) == 0, "open failed");
+	fail_unless(logz_write(fd, "plain", 5) == 5, "write failed");
+	fail_unless(logz_close(fd) == 0, "close failed");
+	fail_unless(pread(fd, buf, sizeof(buf), 0) == 5 &&
+	            !memcmp(buf, "plain", 5), "content mismatch");
+}
+END_TEST
+
+START_TEST(logz_write_02)
+{
+	size_t sz = 3 * LOGZ_BLOCKSIZE + 1000;
+	unsigned char *data = logz_testdata(sz);
+	unsigned char *got = malloc(sz + 1);
+	struct iovec iov[2];
+	char *stats;
+	gzFile f;
+	struct stat st;
+
+	fail_unless(logz_init(LOGZ_GZIP, 1, 2) == 0, "init failed");
+	fail_unless(logz_enabled(), "not enabled");
+	fail_unless(!strcmp(logz_suffix(), ".gz"), "suffix");
+	fail_unless(logz_open(fd) == 0, "open failed");
+	fail_unless(logz_open(fd) == -1, "opened twice");
+	for (size_t off = 0; off < sz - 1000; off += 1000) {
+		size_t n = sz - 1000 - off < 1000 ? sz - 1000 - off : 1000;
+		fail_unless(logz_write(fd, data + off, n) == (ssize_t)n,
+		            "write failed");
+	}
+	iov[0].iov_base = data + sz - 1000;
+	iov[0].iov_len = 400;
+	iov[1].iov_base = data + sz - 600;
+	iov[1].iov_len = 600;
+	fail_unless(logz_writev(fd, iov, 2) == 1000, "writev failed");
+	fail_unless(logz_close(fd) == 0, "close failed");
+
+	/* a frame per block, read back as concatenated gzip members */
+	stats = logz_stats();
+	fail_unless(stats && strstr(stats, "fr=4,"), "frames mismatch");
+	free(stats);
+	fail_unless(fstat(fd, &st) == 0 && st.st_size > 0 &&
+	            (size_t)st.st_size < sz / 4, "not compressed");
+	f = gzopen(fn, "r");
+	fail_unless(!!f, "gzopen failed");
+	fail_unless(gzread(f, got, sz + 1) == (int)sz, "size mismatch");
+	fail_unless(!memcmp(got, data, sz), "content mismatch");
+	gzclose(f);
+	free(got);
+	free(data);
+}
+END_TEST
+
+START_TEST(logz_write_03)
+{
+	unsigned char got[16];
+	gzFile f;
+
+	/* pending data of open streams is written out on fini */
+	fail_unless(logz_init(LOGZ_GZIP, 9, 1) == 0, "init failed");
+	fail_unless(logz_open(fd) == 0, "open failed");
+	fail_unless(logz_write(fd, "pending", 7) == 7, "write failed");
+	logz_fini();
+	fail_unless(!logz_enabled(), "still enabled");
+	f = gzopen(fn, "r");
+	fail_unless(!!f, "gzopen failed");
+	fail_unless(gzread(f, got, sizeof(got)) == 7 &&
+	            !memcmp(got, "pending", 7), "content mismatch");
+	gzclose(f);
+}
+END_TEST
+
+START_TEST(logz_write_04)
+{
+	unsigned char got[16];
+	logz_reader_t *r;
+
+	/* compressed frames are not appended to a plain file */
+	fail_unless(write(fd, "plain", 5) == 5, "write failed");
+	fail_unless(logz_init(LOGZ_GZIP, 1, 1) == 0, "init failed");
+	errno = 0;
+	fail_unless(logz_open(fd) == -1 && errno == EINVAL,
+	            "opened non-empty plain file");
+
+	/* but to a file of the same algorithm */
+	fail_unless(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0,
+	            "truncate failed");
+	fail_unless(logz_open(fd) == 0, "open failed");
+	fail_unless(logz_write(fd, "first", 5) == 5, "write failed");
+	fail_unless(logz_close(fd) == 0, "close failed");
+	fail_unless(logz_open(fd) == 0, "reopen of gzip file failed");
+	fail_unless(logz_write(fd, "second", 6) == 6, "write failed");
+	fail_unless(logz_close(fd) == 0, "close failed");
+
+	r = logz_reader_open(fn);
+	fail_unless(!!r, "reader open failed");
+	fail_unless(logz_read(r, got, sizeof(got)) == 11 &&
+	            !memcmp(got, "firstsecond", 11), "content mismatch");
+	fail_unless(logz_read(r, got, sizeof(got)) == 0, "no eof");
+	logz_reader_close(r);
+}
+END_TEST
+
+START_TEST(logz_read_01)
+{
+	unsigned char got[16];
+	logz_reader_t *r;
+
+	/* plain files are read as is */
+	fail_unless(write(fd, "0123456789", 10) == 10, "write failed");
+	r = logz_reader_open(fn);
+	fail_unless(!!r, "reader open failed");
+	fail_unless(logz_read(r, got, 2) == 2 && !memcmp(got, "01", 2),
+	            "read mismatch");
+	fail_unless(logz_reader_seek(r, 6) == 0, "seek failed");
+	fail_unless(logz_reader_seek(r, 1) == -1, "seeked backwards");
+	fail_unless(logz_read(r, got, sizeof(got)) == 4 &&
+	            !memcmp(got, "6789", 4), "read after seek mismatch");
+	logz_reader_close(r);
+}
+END_TEST
+
+#ifdef HAVE_ZSTD
+START_TEST(logz_zstd_01)
+{
+	size_t sz = 3 * LOGZ_BLOCKSIZE + 1000;
+	unsigned char *data = logz_testdata(sz);
+	unsigned char *got = malloc(sz + 1);
+	logz_reader_t *r;
+	struct stat st;
+	ssize_t n;
+	size_t off;
+
+	fail_unless(logz_init(LOGZ_ZSTD, 3, 2) == 0, "init failed");
+	fail_unless(!strcmp(logz_suffix(), ".zst"), "suffix");
+	fail_unless(logz_open(fd) == 0, "open failed");
+	for (off = 0; off < sz; off += 1000) {
+		size_t len = sz - off < 1000 ? sz - off : 1000;
+		fail_unless(logz_write(fd, data + off, len) == (ssize_t)len,
+		            "write failed");
+	}
+	fail_unless(logz_close(fd) == 0, "close failed");
+	fail_unless(fstat(fd, &st) == 0 && st.st_size > 0 &&
+	            (size_t)st.st_size < sz / 4, "not compressed");
+
+	/* a zstd file is not appended to with gzip */
+	logz_fini();
+	fail_unless(logz_init(LOGZ_GZIP, 1, 1) == 0, "init failed");
+	errno = 0;
+	fail_unless(logz_open(fd) == -1 && errno == EINVAL,
+	            "opened zstd file for gzip");
+
+	/* read back as concatenated frames, in small reads and after a seek */
+	r = logz_reader_open(fn);
+	fail_unless(!!r, "reader open failed");
+	for (off = 0; off < sz; off += n) {
+		n = logz_read(r, got + off, 777);
+		fail_unless(n > 0, "short file");
+	}
+	fail_unless(off == sz && !memcmp(got, data, sz), "content mismatch");
+	fail_unless(logz_read(r, got, 1) == 0, "no eof");
+	logz_reader_close(r);
+	r = logz_reader_open(fn);
+	fail_unless(!!r, "reader reopen failed");
+	fail_unless(logz_reader_seek(r, 2 * LOGZ_BLOCKSIZE + 5) == 0,
+	            "seek failed");
+	fail_unless(logz_read(r, got, 100) == 100 &&
+	            !memcmp(got, data + 2 * LOGZ_BLOCKSIZE + 5, 100),
+	            "content after seek mismatch");
+	logz_reader_close(r);
+	free(got);
+	free(data);
+}
+END_TEST
+#endif /* HAVE_ZSTD */
+
+Suite *
+logz_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("logz");
+
+	tc = tcase_create("logz_parse");
+	tcase_add_test(tc, logz_parse_01);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("logz_write");
+	tcase_add_checked_fixture(tc, logz_setup, logz_teardown);
+	tcase_add_test(tc, logz_write_01);
+	tcase_add_test(tc, logz_write_02);
+	tcase_add_test(tc, logz_write_03);
+	tcase_add_test(tc, logz_write_04);
+	tcase_add_test(tc, logz_read_01);
+#ifdef HAVE_ZSTD
+	tcase_add_test(tc, logz_zstd_01);
+#endif /* HAVE_ZSTD */
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
@@ -39,6 +39,9 @@
 #include "nat.h"
 #include "proc.h"
 #include "cachemgr.h"
+#include "tgcrtidx.h"
+#include "cachesnap.h"
+#include "pxyplugin.h"
 #include "sys.h"
 #include "log.h"
 #include "build.h"
@@ -276,60 +279,6 @@ main_usage(void)
 	fprintf(stderr, usagefmt2, build_pkgname, warn);
 }
 
-/*
- * Callback to load a cert/chain/key combo from a single PEM file.
- * A return value of -1 indicates a fatal error to the file walker.
- */
-static int
-main_loadtgcrt(const char *filename, void *arg)
-{
-	global_t *global = arg;
-	cert_t *cert;
-	char **names;
-
-	cert = cert_new_load(filename);
-	if (!cert) {
-		log_err_level_printf(LOG_CRIT, "Failed to load cert and key from PEM file "
-		                "'%s'\n", filename);
-		return -1;
-	}
-	if (X509_check_private_key(cert->crt, cert->key) != 1) {
-		log_err_level_printf(LOG_CRIT, "Cert does not match key in PEM file "
-		                "'%s':\n", filename);
-		ERR_print_errors_fp(stderr);
-		return -1;
-	}
-
-#ifdef DEBUG_CERTIFICATE
-	log_dbg_printf("Loaded '%s':\n", filename);
-	log_dbg_print_free(ssl_x509_to_str(cert->crt));
-	log_dbg_print_free(ssl_x509_to_pem(cert->crt));
-#endif /* DEBUG_CERTIFICATE */
-
-	if (OPTS_DEBUG(global)) {
-		log_dbg_printf("Targets for '%s':", filename);
-	}
-	names = ssl_x509_names(cert->crt);
-	for (char **p = names; *p; p++) {
-		/* be deliberately vulnerable to NULL prefix attacks */
-		char *sep;
-		if ((sep = strchr(*p, '!'))) {
-			*sep = '\0';
-		}
-		if (OPTS_DEBUG(global)) {
-			log_dbg_printf(" '%s'", *p);
-		}
-		cachemgr_tgcrt_set(*p, cert);
-		free(*p);
-	}
-	if (OPTS_DEBUG(global)) {
-		log_dbg_printf("\n");
-	}
-	free(names);
-	cert_free(cert);
-	return 0;
-}
-
 static void
 main_check_opts(opts_t *opts, const char *argv0)
 {
@@ -353,19 +302,27 @@ main_check_opts(opts_t *opts, const char *argv0)
 }
 
 /*
- * Main entry point.
+ * Parse the command line and the config files given with -f into a new
+ * global_t, run the checks of the resulting configuration and set dynamic
+ * defaults.  Exits on errors.  Used both on startup and, with the saved
+ * command line, for reloading the configuration.
  */
-int
-main(int argc, char *argv[])
+static global_t *
+main_load_global(int argc, char *argv[])
 {
-	const char *argv0;
+	const char *argv0 = argv[0];
 	int ch;
 	global_t *global;
 	char *natengine;
-	int pidfd = -1;
-	int rv = EXIT_FAILURE;
 
-	argv0 = argv[0];
+	/* restart option scanning, for reloads */
+#ifdef __BSD__
+	optreset = 1;
+	optind = 1;
+#else /* !__BSD__ */
+	optind = 0;
+#endif /* !__BSD__ */
+
 	global = global_new();
 	if (nat_getdefaultname()) {
 		natengine = strdup(nat_getdefaultname());
@@ -551,6 +508,8 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 	proxyspec_parse(&argc, &argv, natengine, global, argv0);
+	if (natengine)
+		free(natengine);
 
 	// We don't need the tmp strs used to clone global opts into proxyspecs anymore
 	global_free_opts_clone_strs(global);
@@ -576,6 +535,11 @@ main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 	for (proxyspec_t *spec = global->spec; spec; spec = spec->next) {
+		if (spec->upgrade && spec->opts->plugin) {
+			fprintf(stderr, "%s: autossl proxyspecs do not "
+			                "support plugins.\n", argv0);
+			exit(EXIT_FAILURE);
+		}
 		if (spec->connect_addrlen || spec->sni_port)
 			continue;
 		if (!spec->natengine) {
@@ -614,45 +578,6 @@ main(int argc, char *argv[])
 				main_check_opts(spec->opts, argv0);
 		}
 	}
-#ifdef __APPLE__
-	if (global->dropuser && !!strcmp(global->dropuser, "root") &&
-	    nat_used("pf")) {
-		fprintf(stderr, "%s: cannot use 'pf' proxyspec with -u due "
-		                "to Apple bug\n", argv0);
-		exit(EXIT_FAILURE);
-	}
-#endif /* __APPLE__ */
-
-	/* prevent multiple instances running */
-	if (global->pidfile) {
-		pidfd = sys_pidf_open(global->pidfile);
-		if (pidfd == -1) {
-			fprintf(stderr, "%s: cannot open PID file '%s' "
-			                "- process already running?\n",
-			                argv0, global->pidfile);
-			exit(EXIT_FAILURE);
-		}
-	}
-
-	if (global->opts->user_auth || global_has_userauth_spec(global)) {
-		if (!global->userdb_path) {
-			fprintf(stderr, "User auth requires a userdb path\n");
-			exit(EXIT_FAILURE);
-		}
-		// @todo Check if we can really pass the db var into the child process for privsep
-		// https://www.sqlite.org/faq.html:
-		// "Under Unix, you should not carry an open SQLite database across a fork() system call into the child process."
-		if (sqlite3_open(global->userdb_path, &global->userdb)) {
-			fprintf(stderr, "Error opening user db file: %s\n", sqlite3_errmsg(global->userdb));
-			sqlite3_close(global->userdb);
-			exit(EXIT_FAILURE);
-		}
-		if (sqlite3_prepare_v2(global->userdb, "UPDATE users SET atime = ?1 WHERE ip = ?2 AND user = ?3 AND ether = ?4", 200, &global->update_user_atime, NULL)) {
-			fprintf(stderr, "Error preparing update_user_atime sql stmt: %s\n", sqlite3_errmsg(global->userdb));
-			sqlite3_close(global->userdb);
-			exit(EXIT_FAILURE);
-		}
-	}
 
 	/* dynamic defaults */
 	if (!global->opts->ciphers) {
@@ -667,6 +592,20 @@ main(int argc, char *argv[])
 				oom_die(argv0);
 		}
 	}
+	return global;
+}
+
+/* command line saved for reloads */
+static int main_argc;
+static char **main_argv;
+
+/*
+ * Default the user to drop privileges to, and check the user and group.
+ * Exits on errors.
+ */
+static void
+main_set_dropuser(global_t *global, const char *argv0)
+{
 	if (!global->dropuser && !geteuid() && !getuid() &&
 	    sys_isuser(DFLT_DROPUSER)) {
 #ifdef __APPLE__
@@ -697,6 +636,92 @@ main(int argc, char *argv[])
 		fprintf(stderr, "%s: -m depends on -u\n", argv0);
 		exit(EXIT_FAILURE);
 	}
+}
+
+/*
+ * Reload callback of the privsep parent, run in a process forked from it, so
+ * with the privileges and the file system view of startup: parse the saved
+ * command line again, check the result against the startup config in global,
+ * and write the options a reload can change to fd for the proxy.  Config
+ * errors exit the process, which the proxy sees as an empty config.
+ */
+static int
+main_reload_global(global_t *global, int fd)
+{
+	global_t *reloaded;
+
+	reloaded = main_load_global(main_argc, main_argv);
+	main_set_dropuser(reloaded, main_argv[0]);
+	if (proxy_reload_check(global, reloaded) == -1) {
+		close(fd);
+		return -1;
+	}
+	if (global_reload_write(reloaded, fd) == -1) {
+		fprintf(stderr, "%s: failed to pass the reloaded config\n",
+		                main_argv[0]);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Main entry point.
+ */
+int
+main(int argc, char *argv[])
+{
+	const char *argv0;
+	global_t *global;
+	int pidfd = -1;
+	int rv = EXIT_FAILURE;
+
+	argv0 = argv[0];
+	main_argc = argc;
+	main_argv = argv;
+	global = main_load_global(argc, argv);
+	pxy_plugin_freeze();
+
+#ifdef __APPLE__
+	if (global->dropuser && !!strcmp(global->dropuser, "root") &&
+	    nat_used("pf")) {
+		fprintf(stderr, "%s: cannot use 'pf' proxyspec with -u due "
+		                "to Apple bug\n", argv0);
+		exit(EXIT_FAILURE);
+	}
+#endif /* __APPLE__ */
+
+	/* prevent multiple instances running */
+	if (global->pidfile) {
+		pidfd = sys_pidf_open(global->pidfile);
+		if (pidfd == -1) {
+			fprintf(stderr, "%s: cannot open PID file '%s' "
+			                "- process already running?\n",
+			                argv0, global->pidfile);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (global->opts->user_auth || global_has_userauth_spec(global)) {
+		if (!global->userdb_path) {
+			fprintf(stderr, "User auth requires a userdb path\n");
+			exit(EXIT_FAILURE);
+		}
+		// @todo Check if we can really pass the db var into the child process for privsep
+		// https://www.sqlite.org/faq.html:
+		// "Under Unix, you should not carry an open SQLite database across a fork() system call into the child process."
+		if (sqlite3_open(global->userdb_path, &global->userdb)) {
+			fprintf(stderr, "Error opening user db file: %s\n", sqlite3_errmsg(global->userdb));
+			sqlite3_close(global->userdb);
+			exit(EXIT_FAILURE);
+		}
+		if (sqlite3_prepare_v2(global->userdb, "UPDATE users SET atime = ?1 WHERE ip = ?2 AND user = ?3 AND ether = ?4", 200, &global->update_user_atime, NULL)) {
+			fprintf(stderr, "Error preparing update_user_atime sql stmt: %s\n", sqlite3_errmsg(global->userdb));
+			sqlite3_close(global->userdb);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	main_set_dropuser(global, argv0);
 
 	/* Warn about options that require per-connection privileged operations
 	 * to be executed through privsep, but only if dropuser is set and is
@@ -742,6 +767,13 @@ main(int argc, char *argv[])
 		main_version();
 	}
 
+	/* map the cache snapshot, which may provide the leaf key */
+	if (global->cachesnap && cachesnap_load(global) == -1) {
+		fprintf(stderr, "%s: failed to load cache snapshot %s\n",
+		                argv0, global->cachesnap);
+		exit(EXIT_FAILURE);
+	}
+
 	/* generate leaf key */
 	if (global_has_ssl_spec(global) && global_has_cakey_spec(global) && !global->key) {
 		global->key = ssl_key_genrsa(global->leafkey_rsabits);
@@ -858,10 +890,9 @@ main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	/* Load certs before dropping privs but after cachemgr_preinit() */
+	/* Index certs before dropping privs, certs are loaded on first use */
 	if (global->tgcrtdir) {
-		if (sys_dir_eachfile(global->tgcrtdir,
-		                     main_loadtgcrt, global) == -1) {
+		if (tgcrtidx_load(global) == -1) {
 			fprintf(stderr, "%s: failed to load certs from %s\n",
 			                argv0, global->tgcrtdir);
 			exit(EXIT_FAILURE);
@@ -892,11 +923,16 @@ main(int argc, char *argv[])
 	descriptor_table_size = getdtablesize();
 
 	/* Fork into parent monitor process and (potentially unprivileged)
-	 * child process doing the actual work.  We request 6 privsep client
-	 * sockets: five logger threads, and the child process main thread,
-	 * which will become the main proxy thread.  First slot is main thread,
-	 * remaining slots are passed down to log subsystem. */
-	int clisock[6];
+	 * child process doing the actual work.  We request 8 privsep client
+	 * sockets: five logger threads, the child process main thread, which
+	 * will become the main proxy thread, the cache snapshot writer, and
+	 * config reloads on the main thread.
+	 * First slot is main thread, the next five slots are passed down to
+	 * log subsystem, the next one to the cache snapshot writer, and the
+	 * last one is for reloads, so that their answers cannot be taken by
+	 * the requests of conns on the main thread socket. */
+	int clisock[8];
+	privsep_set_reload_cb(main_reload_global);
 	if (privsep_fork(global, clisock,
 	                 sizeof(clisock)/sizeof(clisock[0]), &rv) != 0) {
 		/* parent has exited the monitor loop after waiting for child,
@@ -918,6 +954,7 @@ main(int argc, char *argv[])
 		log_err_level_printf(LOG_CRIT, "Failed to initialize proxy.\n");
 		exit(EXIT_FAILURE);
 	}
+	proxy_set_reload_sock(proxy, clisock[7]);
 
 	/* Drop privs, chroot */
 	if (sys_privdrop(global->dropuser, global->dropgroup,
@@ -945,6 +982,14 @@ main(int argc, char *argv[])
 		log_err_level_printf(LOG_CRIT, "Failed to init cache manager.\n");
 		goto out_cachemgr_failed;
 	}
+	if (global->cachesnap) {
+		if (cachesnap_init(global, clisock[6]) == -1) {
+			log_err_level_printf(LOG_CRIT, "Failed to init cache snapshots.\n");
+			goto out_nat_failed;
+		}
+	} else {
+		privsep_client_close(clisock[6]);
+	}
 	if (nat_init() == -1) {
 		log_err_level_printf(LOG_CRIT, "Failed to init NAT state table lookup.\n");
 		goto out_nat_failed;
@@ -972,16 +1017,20 @@ main(int argc, char *argv[])
 	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "main: EXIT closing privsep clisock=%d\n", clisock[0]);
 #endif /* DEBUG_PROXY */
 	privsep_client_close(clisock[0]);
+	privsep_client_close(clisock[7]);
 
 	proxy_free(proxy);
+	pxy_plugin_fini();
 	nat_fini();
 out_nat_failed:
+	cachesnap_fini();
 	cachemgr_fini();
 out_cachemgr_failed:
 	log_fini();
 out_sslreinit_failed:
 out_log_failed:
 out_parent:
+	tgcrtidx_fini();
 	global_free(global);
 	ssl_fini();
 	return rv;
@@ -66,20 +66,33 @@ main_suite(void)
 }
 
 Suite * opts_suite(void);
+Suite * passsite_suite(void);
 Suite * dynbuf_suite(void);
+Suite * slab_suite(void);
+Suite * histo_suite(void);
 Suite * logbuf_suite(void);
+Suite * logshm_suite(void);
+Suite * logstore_suite(void);
+Suite * logz_suite(void);
+Suite * logpolicy_suite(void);
 Suite * cert_suite(void);
 Suite * cachemgr_suite(void);
+Suite * crtrec_suite(void);
 Suite * cachefkcrt_suite(void);
-Suite * cachetgcrt_suite(void);
+Suite * tgcrtidx_suite(void);
+Suite * dnscache_suite(void);
 Suite * cachedsess_suite(void);
 Suite * cachessess_suite(void);
+Suite * cachesnicrt_suite(void);
 Suite * ssl_suite(void);
 Suite * sys_suite(void);
 Suite * base64_suite(void);
 Suite * url_suite(void);
 Suite * util_suite(void);
 Suite * pxythrmgr_suite(void);
+Suite * pxyconn_suite(void);
+Suite * proxy_suite(void);
+Suite * pxyplugin_suite(void);
 Suite * defaults_suite(void);
 
 int
@@ -91,20 +104,33 @@ main(UNUSED int argc, UNUSED char *argv[])
 	sr = srunner_create(blank_suite());
 	srunner_add_suite(sr, main_suite());
 	srunner_add_suite(sr, opts_suite());
+	srunner_add_suite(sr, passsite_suite());
 	srunner_add_suite(sr, dynbuf_suite());
+	srunner_add_suite(sr, slab_suite());
+	srunner_add_suite(sr, histo_suite());
 	srunner_add_suite(sr, logbuf_suite());
+	srunner_add_suite(sr, logshm_suite());
+	srunner_add_suite(sr, logstore_suite());
+	srunner_add_suite(sr, logz_suite());
+	srunner_add_suite(sr, logpolicy_suite());
 	srunner_add_suite(sr, cert_suite());
 	srunner_add_suite(sr, cachemgr_suite());
+	srunner_add_suite(sr, crtrec_suite());
 	srunner_add_suite(sr, cachefkcrt_suite());
-	srunner_add_suite(sr, cachetgcrt_suite());
+	srunner_add_suite(sr, tgcrtidx_suite());
+	srunner_add_suite(sr, dnscache_suite());
 	srunner_add_suite(sr, cachedsess_suite());
 	srunner_add_suite(sr, cachessess_suite());
+	srunner_add_suite(sr, cachesnicrt_suite());
 	srunner_add_suite(sr, ssl_suite());
 	srunner_add_suite(sr, sys_suite());
 	srunner_add_suite(sr, base64_suite());
 	srunner_add_suite(sr, url_suite());
 	srunner_add_suite(sr, util_suite());
 	srunner_add_suite(sr, pxythrmgr_suite());
+	srunner_add_suite(sr, pxyconn_suite());
+	srunner_add_suite(sr, proxy_suite());
+	srunner_add_suite(sr, pxyplugin_suite());
 	srunner_add_suite(sr, defaults_suite());
 	srunner_run_all(sr, CK_NORMAL);
 	nfail = srunner_ntests_failed(sr);
@@ -29,13 +29,19 @@
 
 #include "opts.h"
 
+#include "pxyplugin.h"
 #include "sys.h"
+#include "logshm.h"
+#include "logz.h"
 #include "log.h"
 #include "defaults.h"
 
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/resource.h>
 
 #ifndef OPENSSL_NO_DH
@@ -58,11 +64,14 @@ oom_die(const char *argv0)
 opts_t *
 opts_new(void)
 {
+	static unsigned long serial;
 	opts_t *opts;
 
 	opts = malloc(sizeof(opts_t));
 	memset(opts, 0, sizeof(opts_t));
 
+	opts->serial = ++serial;
+
 	opts->sslcomp = 1;
 	opts->chain = sk_X509_new_null();
 	opts->sslmethod = SSLv23_method;
@@ -74,6 +83,8 @@ opts_new(void)
 	opts->verify_peer = 1;
 	opts->user_timeout = 300;
 	opts->max_http_header_size = 8192;
+	opts->relay_bufsize = DFLT_RELAY_BUFSIZE;
+	opts->contentlog_rules_tail = &opts->contentlog_rules;
 	return opts;
 }
 
@@ -90,9 +101,20 @@ global_new(void)
 	global->expired_conn_check_period = 10;
 	global->ssl_shutdown_retry_delay = 100;
 	global->stats_period = 1;
+	global->splice = 1;
+	global->dnscache = 0;
+	global->sslproxy_header_search_limit = 65536;
+	global->tgcrt_cache_size = 1024;
+	global->cachesnap_period = 300;
+	global->shmlog_size = 4194304;
+	global->contentlog_segsize = 268435456;
+	global->shmlog_policy = LOGSHM_DROP_NEW;
+	global->logz_level = 1;
+	global->logz_threads = 2;
 
 	global->opts = opts_new();
 	global->opts->global = global;
+	global->refcount = 1;
 	return global;
 }
 
@@ -143,6 +165,10 @@ opts_free(opts_t *opts)
 		free(passsite);
 		passsite = next;
 	}
+	if (opts->passsite_index) {
+		passsite_index_free(opts->passsite_index);
+	}
+	logpolicy_rules_free(opts->contentlog_rules);
 	memset(opts, 0, sizeof(opts_t));
 	free(opts);
 }
@@ -216,6 +242,24 @@ global_free(global_t *global)
 	if (global->tgcrtdir) {
 		free(global->tgcrtdir);
 	}
+	if (global->tgcrtidx) {
+		free(global->tgcrtidx);
+	}
+	if (global->cachesnap) {
+		free(global->cachesnap);
+	}
+	if (global->statssock) {
+		free(global->statssock);
+	}
+	if (global->workercpus) {
+		free(global->workercpus);
+	}
+	if (global->maincpus) {
+		free(global->maincpus);
+	}
+	if (global->loggercpus) {
+		free(global->loggercpus);
+	}
 	if (global->dropuser) {
 		free(global->dropuser);
 	}
@@ -257,6 +301,9 @@ global_free(global_t *global)
 		free(global->mirrortarget);
 	}
 #endif /* !WITHOUT_MIRROR */
+	if (global->shmlog) {
+		free(global->shmlog);
+	}
 	if (global->userdb_path) {
 		free(global->userdb_path);
 	}
@@ -279,6 +326,42 @@ global_free(global_t *global)
 	free(global);
 }
 
+/*
+ * Take a reference to global, may be called from any thread.
+ */
+void
+global_ref(global_t *global)
+{
+	__atomic_add_fetch(&global->refcount, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Drop a reference to global, and free it if that was the last one.
+ * The initial reference belongs to whoever created the global_t.
+ */
+void
+global_unref(global_t *global)
+{
+	if (__atomic_sub_fetch(&global->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		global_free(global);
+	}
+}
+
+/*
+ * Free global if the caller holds the only reference left, which it cannot
+ * hand out again.  Lets the proxy free replaced configs on the main thread,
+ * instead of the conn handling thread dropping the last reference.
+ * Returns 1 if global was freed, 0 otherwise.
+ */
+int
+global_free_unused(global_t *global)
+{
+	if (__atomic_load_n(&global->refcount, __ATOMIC_ACQUIRE) != 1)
+		return 0;
+	global_free(global);
+	return 1;
+}
+
 /*
  * Return 1 if global_t contains a proxyspec that (eventually) uses SSL/TLS,
  * 0 otherwise.  When 0, it is safe to assume that no SSL/TLS operations
@@ -298,6 +381,21 @@ global_has_ssl_spec(global_t *global)
 	return 0;
 }
 
+/*
+ * Return 1 if global_t contains a proxyspec with a DivertPath or ReturnPath,
+ * 0 otherwise.
+ */
+static int
+global_has_unix_spec(global_t *global)
+{
+	for (proxyspec_t *p = global->spec; p; p = p->next) {
+		if (p->conn_dst_addr.ss_family == AF_UNIX ||
+		    p->child_src_addr.ss_family == AF_UNIX)
+			return 1;
+	}
+	return 0;
+}
+
 /*
  * Return 1 if global_t contains a proxyspec with dns, 0 otherwise.
  */
@@ -455,6 +553,21 @@ opts_set_user_auth_url(opts_t *opts, const char *optarg)
 #endif /* DEBUG_OPTS */
 }
 
+/*
+ * Add the PassSite to the compiled index of opts, used for matching.
+ * Returns -1 on out of memory.
+ */
+static int WUNRES
+opts_index_pass_site(opts_t *opts, passsite_t *ps)
+{
+	if (!opts->passsite_index) {
+		opts->passsite_index = passsite_index_new();
+		if (!opts->passsite_index)
+			return -1;
+	}
+	return passsite_index_add(opts->passsite_index, ps);
+}
+
 static opts_t *
 clone_global_opts(global_t *global, const char *argv0)
 {
@@ -464,6 +577,7 @@ clone_global_opts(global_t *global, const char *argv0)
 
 	opts_t *opts = opts_new();
 
+	opts->global = global;
 	opts->sslcomp = global->opts->sslcomp;
 #ifdef HAVE_SSLV2
 	opts->no_ssl2 = global->opts->no_ssl2;
@@ -492,10 +606,16 @@ clone_global_opts(global_t *global, const char *argv0)
 	opts->remove_http_referer = global->opts->remove_http_referer;
 	opts->verify_peer = global->opts->verify_peer;
 	opts->allow_wrong_host = global->opts->allow_wrong_host;
+	opts->optimistic_handshake = global->opts->optimistic_handshake;
+	opts->optimistic_mismatch_log = global->opts->optimistic_mismatch_log;
 	opts->user_auth = global->opts->user_auth;
 	opts->user_timeout = global->opts->user_timeout;
 	opts->validate_proto = global->opts->validate_proto;
 	opts->max_http_header_size = global->opts->max_http_header_size;
+	opts->relay_bufsize = global->opts->relay_bufsize;
+	opts->relay_adaptive = global->opts->relay_adaptive;
+	opts->plugin = global->opts->plugin;
+	opts->contentlog_limit = global->opts->contentlog_limit;
 	
 	if (global->chain_str) {
 		opts_set_chain(opts, argv0, global->chain_str);
@@ -546,9 +666,19 @@ clone_global_opts(global_t *global, const char *argv0)
 
 		ps->next = opts->passsites;
 		opts->passsites = ps;
+		if (opts_index_pass_site(opts, ps) == -1)
+			oom_die(argv0);
 
 		passsite = passsite->next;
 	}
+
+	// The rules of the proxyspec are inserted before these
+	logpolicy_rule_t **tail = &opts->contentlog_rules;
+	for (logpolicy_rule_t *rule = global->opts->contentlog_rules; rule; rule = rule->next) {
+		if (!(*tail = logpolicy_rule_dup(rule)))
+			oom_die(argv0);
+		tail = &(*tail)->next;
+	}
 	return opts;
 }
 
@@ -647,6 +777,56 @@ proxyspec_set_divert_addr(proxyspec_t *spec, char *addr, char *port)
 #endif /* DEBUG_OPTS */
 }
 					
+/*
+ * Unix socket paths are bound and connected to inside the chroot, but passed
+ * as is to the listening program outside of it, so they cannot be combined.
+ */
+static void
+proxyspec_set_divert_path(proxyspec_t *spec, const char *path)
+{
+	if (spec->opts->global->jaildir) {
+		fprintf(stderr, "DivertPath cannot be used with Chroot: %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+	if (sys_sockaddr_unix(&spec->conn_dst_addr,
+						&spec->conn_dst_addrlen, path) == -1) {
+		exit(EXIT_FAILURE);
+	}
+#ifdef DEBUG_OPTS
+	log_dbg_printf("DivertPath: %s\n", path);
+#endif /* DEBUG_OPTS */
+}
+
+/*
+ * The child listeners of the conns are AF_UNIX sockets in dir, named
+ * sslproxy.<pid>.<conn id>, see pxy_setup_child_listener().
+ */
+static void
+proxyspec_set_return_path(proxyspec_t *spec, const char *dir)
+{
+	struct sockaddr_un sun;
+
+	if (dir[0] != '/') {
+		fprintf(stderr, "ReturnPath is not an absolute path: %s\n", dir);
+		exit(EXIT_FAILURE);
+	}
+	if (spec->opts->global->jaildir) {
+		fprintf(stderr, "ReturnPath cannot be used with Chroot: %s\n", dir);
+		exit(EXIT_FAILURE);
+	}
+	if (strlen(dir) + RETURN_PATH_NAME_MAX >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "ReturnPath too long for socket paths: %s\n", dir);
+		exit(EXIT_FAILURE);
+	}
+	if (sys_sockaddr_unix(&spec->child_src_addr,
+						&spec->child_src_addrlen, dir) == -1) {
+		exit(EXIT_FAILURE);
+	}
+#ifdef DEBUG_OPTS
+	log_dbg_printf("ReturnPath: %s\n", dir);
+#endif /* DEBUG_OPTS */
+}
+
 static void
 proxyspec_set_return_addr(proxyspec_t *spec, char *addr)
 {
@@ -775,8 +955,17 @@ proxyspec_parse(int *argc, char **argv[], const char *natengine, global_t *globa
 						ra = **argv + 3;
 					}
 
-					proxyspec_set_divert_addr(spec, da, dp);
-					proxyspec_set_return_addr(spec, ra);
+					// Absolute paths are AF_UNIX socket addresses
+					if (da[0] == '/') {
+						proxyspec_set_divert_path(spec, da);
+					} else {
+						proxyspec_set_divert_addr(spec, da, dp);
+					}
+					if (ra[0] == '/') {
+						proxyspec_set_return_path(spec, ra);
+					} else {
+						proxyspec_set_return_addr(spec, ra);
+					}
 					state++;
 				}
 				break;
@@ -1602,11 +1791,81 @@ opts_set_pass_site(opts_t *opts, char *value, int line_num)
 
 	ps->next = opts->passsites;
 	opts->passsites = ps;
+	if (opts_index_pass_site(opts, ps) == -1) {
+		fprintf(stderr, "Out of memory adding PassSite on line %d\n", line_num);
+		exit(EXIT_FAILURE);
+	}
 #ifdef DEBUG_OPTS
 	log_dbg_printf("PassSite: %s, %s, %s, %s\n", ps->site, STRORDASH(ps->ip), ps->all ? "*" : STRORDASH(ps->user), STRORDASH(ps->keyword));
 #endif /* DEBUG_OPTS */
 }
 
+static int
+opts_set_contentlog_rule(opts_t *opts, char *value, int line_num)
+{
+	// (log|nolog|bytes) (*|sni|dstip|dstport|user|proto) [value]
+	char *argv[3] = {NULL, NULL, NULL};
+	int argc = 0;
+	char *p, *last = NULL;
+
+	for ((p = strtok_r(value, " \t", &last));
+		 p;
+		 (p = strtok_r(NULL, " \t", &last))) {
+		if (argc == 3) {
+			argc++;
+			break;
+		}
+		argv[argc++] = p;
+	}
+
+	logpolicy_rule_t *rule = (argc >= 2 && argc <= 3) ?
+		logpolicy_rule_new(argv[0], argv[1], argv[2]) : NULL;
+	if (!rule) {
+		if (errno == ENOMEM) {
+			fprintf(stderr, "Out of memory adding ContentLogRule on line %d\n", line_num);
+		} else {
+			fprintf(stderr, "Invalid ContentLogRule on line %d, use (log|nolog|bytes) (*|sni|dstip|dstport|user|proto) [value]\n", line_num);
+		}
+		return -1;
+	}
+	rule->next = *opts->contentlog_rules_tail;
+	*opts->contentlog_rules_tail = rule;
+	opts->contentlog_rules_tail = &rule->next;
+#ifdef DEBUG_OPTS
+	char *s = logpolicy_rule_str(rule);
+	log_dbg_printf("ContentLogRule: %s\n", STRORNONE(s));
+	if (s)
+		free(s);
+#endif /* DEBUG_OPTS */
+	return 0;
+}
+
+static void
+opts_set_plugin(opts_t *opts, char *value, int line_num)
+{
+	// path [arg]
+	char *arg = strpbrk(value, " \t");
+
+	if (arg) {
+		*arg++ = '\0';
+		arg += strspn(arg, " \t");
+		if (!*arg)
+			arg = NULL;
+	}
+	if (!*value) {
+		fprintf(stderr, "Plugin requires a path on line %d\n", line_num);
+		exit(EXIT_FAILURE);
+	}
+	opts->plugin = pxy_plugin_load(value, arg);
+	if (!opts->plugin) {
+		fprintf(stderr, "Error loading Plugin on line %d\n", line_num);
+		exit(EXIT_FAILURE);
+	}
+#ifdef DEBUG_OPTS
+	log_dbg_printf("Plugin: %s, %s\n", value, STRORDASH(arg));
+#endif /* DEBUG_OPTS */
+}
+
 void
 global_set_key(global_t *global, const char *argv0, const char *optarg)
 {
@@ -1666,6 +1925,72 @@ global_set_tgcrtdir(global_t *global, const char *argv0, const char *optarg)
 #endif /* DEBUG_OPTS */
 }
 
+void
+global_set_tgcrtidx(global_t *global, const char *argv0, const char *optarg)
+{
+	if (global->tgcrtidx)
+		free(global->tgcrtidx);
+	global->tgcrtidx = strdup(optarg);
+	if (!global->tgcrtidx)
+		oom_die(argv0);
+#ifdef DEBUG_OPTS
+	log_dbg_printf("TargetCertIndex: %s\n", global->tgcrtidx);
+#endif /* DEBUG_OPTS */
+}
+
+void
+global_set_cachesnap(global_t *global, const char *argv0, const char *optarg)
+{
+	if (global->cachesnap)
+		free(global->cachesnap);
+	global->cachesnap = strdup(optarg);
+	if (!global->cachesnap)
+		oom_die(argv0);
+#ifdef DEBUG_OPTS
+	log_dbg_printf("CacheSnapshot: %s\n", global->cachesnap);
+#endif /* DEBUG_OPTS */
+}
+
+void
+global_set_statssock(global_t *global, const char *argv0, const char *optarg)
+{
+	if (global->statssock)
+		free(global->statssock);
+	global->statssock = strdup(optarg);
+	if (!global->statssock)
+		oom_die(argv0);
+#ifdef DEBUG_OPTS
+	log_dbg_printf("StatsSocket: %s\n", global->statssock);
+#endif /* DEBUG_OPTS */
+}
+
+/*
+ * Set the CPU list option in *cpus, if valid.
+ * Returns 0 on success, -1 on invalid CPU lists.
+ */
+static int
+global_set_cpus(char **cpus, const char *argv0, const char *name,
+                const char *optarg, int line_num)
+{
+	int *v;
+
+	if (sys_cpulist_parse(optarg, &v) == -1) {
+		fprintf(stderr, "Invalid %s %s on line %d, use a list of CPU ids and ranges, e.g. 0-3,8\n",
+		        name, optarg, line_num);
+		return -1;
+	}
+	free(v);
+	if (*cpus)
+		free(*cpus);
+	*cpus = strdup(optarg);
+	if (!*cpus)
+		oom_die(argv0);
+#ifdef DEBUG_OPTS
+	log_dbg_printf("%s: %s\n", name, *cpus);
+#endif /* DEBUG_OPTS */
+	return 0;
+}
+
 void
 global_set_certgendir_writegencerts(global_t *global, const char *argv0,
                                   const char *optarg)
@@ -1734,6 +2059,11 @@ global_set_jaildir(global_t *global, const char *argv0, const char *optarg)
 		fprintf(stderr, "%s: '%s' is not a directory\n", argv0, optarg);
 		exit(EXIT_FAILURE);
 	}
+	// See proxyspec_set_divert_path()
+	if (global_has_unix_spec(global)) {
+		fprintf(stderr, "%s: Chroot cannot be used with DivertPath or ReturnPath\n", argv0);
+		exit(EXIT_FAILURE);
+	}
 	if (global->jaildir)
 		free(global->jaildir);
 	global->jaildir = realpath(optarg, NULL);
@@ -1799,6 +2129,7 @@ global_set_contentlog(global_t *global, const char *argv0, const char *optarg)
 	}
 	global->contentlog_isdir = 0;
 	global->contentlog_isspec = 0;
+	global->contentlog_isstore = 0;
 #ifdef DEBUG_OPTS
 	log_dbg_printf("ContentLog: %s\n", global->contentlog);
 #endif /* DEBUG_OPTS */
@@ -1821,11 +2152,35 @@ global_set_contentlogdir(global_t *global, const char *argv0, const char *optarg
 	}
 	global->contentlog_isdir = 1;
 	global->contentlog_isspec = 0;
+	global->contentlog_isstore = 0;
 #ifdef DEBUG_OPTS
 	log_dbg_printf("ContentLogDir: %s\n", global->contentlog);
 #endif /* DEBUG_OPTS */
 }
 
+void
+global_set_contentlogstore(global_t *global, const char *argv0, const char *optarg)
+{
+	if (!sys_isdir(optarg)) {
+		fprintf(stderr, "%s: '%s' is not a directory\n", argv0, optarg);
+		exit(EXIT_FAILURE);
+	}
+	if (global->contentlog)
+		free(global->contentlog);
+	global->contentlog = realpath(optarg, NULL);
+	if (!global->contentlog) {
+		fprintf(stderr, "%s: Failed to realpath '%s': %s (%i)\n",
+		        argv0, optarg, strerror(errno), errno);
+		exit(EXIT_FAILURE);
+	}
+	global->contentlog_isdir = 0;
+	global->contentlog_isspec = 0;
+	global->contentlog_isstore = 1;
+#ifdef DEBUG_OPTS
+	log_dbg_printf("ContentLogStore: %s\n", global->contentlog);
+#endif /* DEBUG_OPTS */
+}
+
 static void
 global_set_logbasedir(const char *argv0, const char *optarg,
                     char **basedir, char **log)
@@ -1896,6 +2251,7 @@ global_set_contentlogpathspec(global_t *global, const char *argv0, const char *o
 	                    &global->contentlog);
 	global->contentlog_isdir = 0;
 	global->contentlog_isspec = 1;
+	global->contentlog_isstore = 0;
 #ifdef DEBUG_OPTS
 	log_dbg_printf("ContentLogPathSpec: basedir=%s, %s\n",
 	               global->contentlog_basedir, global->contentlog);
@@ -2244,6 +2600,47 @@ set_option(opts_t *opts, const char *argv0,
 		}
 #ifdef DEBUG_OPTS
 		log_dbg_printf("MaxHTTPHeaderSize: %u\n", opts->max_http_header_size);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "RelayBufferSize", 16)) {
+		unsigned int i = atoi(value);
+		if (i >= 4096 && i <= 67108864) {
+			opts->relay_bufsize = i;
+		} else {
+			fprintf(stderr, "Invalid RelayBufferSize %s on line %d, use 4096-67108864\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("RelayBufferSize: %u\n", opts->relay_bufsize);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "AdaptiveRelayBuffers", 21)) {
+		yes = check_value_yesno(value, "AdaptiveRelayBuffers", line_num);
+		if (yes == -1) {
+			goto leave;
+		}
+		opts->relay_adaptive = yes;
+#ifdef DEBUG_OPTS
+		log_dbg_printf("AdaptiveRelayBuffers: %u\n", opts->relay_adaptive);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "OptimisticHandshake", 20)) {
+		yes = check_value_yesno(value, "OptimisticHandshake", line_num);
+		if (yes == -1) {
+			goto leave;
+		}
+		opts->optimistic_handshake = yes;
+#ifdef DEBUG_OPTS
+		log_dbg_printf("OptimisticHandshake: %u\n", opts->optimistic_handshake);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "OptimisticMismatch", 19)) {
+		if (!strcmp(value, "terminate")) {
+			opts->optimistic_mismatch_log = 0;
+		} else if (!strcmp(value, "log")) {
+			opts->optimistic_mismatch_log = 1;
+		} else {
+			fprintf(stderr, "Invalid OptimisticMismatch %s on line %d, use terminate or log\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("OptimisticMismatch: %s\n", opts->optimistic_mismatch_log ? "log" : "terminate");
 #endif /* DEBUG_OPTS */
 	} else if (!strncmp(name, "VerifyPeer", 11)) {
 		yes = check_value_yesno(value, "VerifyPeer", line_num);
@@ -2282,8 +2679,26 @@ set_option(opts_t *opts, const char *argv0,
 #ifdef DEBUG_OPTS
 		log_dbg_printf("RemoveHTTPReferer: %u\n", opts->remove_http_referer);
 #endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "Plugin", 7)) {
+		opts_set_plugin(opts, value, line_num);
 	} else if (!strncmp(name, "PassSite", 9)) {
 		opts_set_pass_site(opts, value, line_num);
+	} else if (!strncmp(name, "ContentLogLimit", 16)) {
+		char *end;
+		unsigned long long i = strtoull(value, &end, 10);
+		if (end != value && !*end && i < SIZE_MAX) {
+			opts->contentlog_limit = i;
+		} else {
+			fprintf(stderr, "Invalid ContentLogLimit %s on line %d\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("ContentLogLimit: %zu\n", opts->contentlog_limit);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "ContentLogRule", 15)) {
+		if (opts_set_contentlog_rule(opts, value, line_num) == -1) {
+			goto leave;
+		}
 	} else {
 		fprintf(stderr, "Error in conf: Unknown option "
 		                "'%s' on line %d\n", name, line_num);
@@ -2327,9 +2742,15 @@ set_proxyspec_option(proxyspec_t *spec, const char *argv0, const char *name, cha
 			proxyspec_set_divert_addr(spec, "127.0.0.1", value);
 		}
 	}
+	else if (!strncmp(name, "DivertPath", 11)) {
+		proxyspec_set_divert_path(spec, value);
+	}
 	else if (!strncmp(name, "ReturnAddr", 11)) {
 		proxyspec_set_return_addr(spec, value);
 	}
+	else if (!strncmp(name, "ReturnPath", 11)) {
+		proxyspec_set_return_path(spec, value);
+	}
 	else if (!strncmp(name, "TargetAddr", 11)) {
 		spec->target_addr = strdup(value);
 	}
@@ -2557,6 +2978,32 @@ set_global_option(global_t *global, const char *argv0,
 	/* Compare strlen(s2)+1 chars to match exactly */
 	if (!strncmp(name, "TargetCertDir", 14)) {
 		global_set_tgcrtdir(global, argv0, value);
+	} else if (!strncmp(name, "TargetCertIndex", 16)) {
+		global_set_tgcrtidx(global, argv0, value);
+	} else if (!strncmp(name, "TargetCertCacheSize", 20)) {
+		unsigned int i = atoi(value);
+		if (i >= 1 && i <= 1000000) {
+			global->tgcrt_cache_size = i;
+		} else {
+			fprintf(stderr, "Invalid TargetCertCacheSize %s on line %d, use 1-1000000\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("TargetCertCacheSize: %u\n", global->tgcrt_cache_size);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "CacheSnapshot", 14)) {
+		global_set_cachesnap(global, argv0, value);
+	} else if (!strncmp(name, "CacheSnapshotPeriod", 20)) {
+		unsigned int i = atoi(value);
+		if (i >= 10 && i <= 86400) {
+			global->cachesnap_period = i;
+		} else {
+			fprintf(stderr, "Invalid CacheSnapshotPeriod %s on line %d, use 10-86400\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("CacheSnapshotPeriod: %u\n", global->cachesnap_period);
+#endif /* DEBUG_OPTS */
 	} else if (!strncmp(name, "WriteGenCertsDir", 17)) {
 		global_set_certgendir_writegencerts(global, argv0, value);
 	} else if (!strncmp(name, "WriteAllCertsDir", 17)) {
@@ -2577,6 +3024,21 @@ set_global_option(global_t *global, const char *argv0,
 		global_set_contentlogdir(global, argv0, value);
 	} else if (!strncmp(name, "ContentLogPathSpec", 19)) {
 		global_set_contentlogpathspec(global, argv0, value);
+	} else if (!strncmp(name, "ContentLogStore", 16)) {
+		global_set_contentlogstore(global, argv0, value);
+	} else if (!strncmp(name, "ContentLogSegmentSize", 22)) {
+		char *end;
+		unsigned long long i = strtoull(value, &end, 10);
+		if (end != value && !*end && i >= 1048576 && i <= 1099511627776ULL) {
+			global->contentlog_segsize = i;
+		} else {
+			fprintf(stderr, "Invalid ContentLogSegmentSize %s on line %d, use 1048576-1099511627776\n",
+			        value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("ContentLogSegmentSize: %llu\n", global->contentlog_segsize);
+#endif /* DEBUG_OPTS */
 #ifdef HAVE_LOCAL_PROCINFO
 	} else if (!strncmp(name, "LogProcInfo", 11)) {
 		yes = check_value_yesno(value, "LogProcInfo", line_num);
@@ -2602,6 +3064,79 @@ set_global_option(global_t *global, const char *argv0,
 	} else if (!strncmp(name, "MirrorTarget", 13)) {
 		global_set_mirrortarget(global, argv0, value);
 #endif /* !WITHOUT_MIRROR */
+	} else if (!strncmp(name, "ShmLog", 7)) {
+		// shm_open(3) names are a slash followed by a file name
+		if (value[0] != '/' || !value[1] || strchr(value + 1, '/') || strlen(value) > NAME_MAX) {
+			fprintf(stderr, "Invalid ShmLog %s on line %d, use /name\n", value, line_num);
+			goto leave;
+		}
+		if (global->shmlog)
+			free(global->shmlog);
+		global->shmlog = strdup(value);
+		if (!global->shmlog)
+			oom_die(argv0);
+#ifdef DEBUG_OPTS
+		log_dbg_printf("ShmLog: %s\n", global->shmlog);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "ShmLogSize", 11)) {
+		char *end;
+		unsigned long long i = strtoull(value, &end, 10);
+		if (end != value && !*end && i >= LOGSHM_RINGSIZE_MIN && i <= LOGSHM_RINGSIZE_MAX && !(i & (i - 1))) {
+			global->shmlog_size = i;
+		} else {
+			fprintf(stderr, "Invalid ShmLogSize %s on line %d, use a power of 2 in %d-%d\n",
+			        value, line_num, LOGSHM_RINGSIZE_MIN, LOGSHM_RINGSIZE_MAX);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("ShmLogSize: %zu\n", global->shmlog_size);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "ShmLogOverflow", 15)) {
+		int policy = logshm_policy_parse(value);
+		if (policy == -1) {
+			fprintf(stderr, "Invalid ShmLogOverflow %s on line %d, use drop-new, drop-oldest or pause\n", value, line_num);
+			goto leave;
+		}
+		global->shmlog_policy = policy;
+#ifdef DEBUG_OPTS
+		log_dbg_printf("ShmLogOverflow: %s\n", logshm_policy_str(global->shmlog_policy));
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "LogCompression", 15)) {
+		int algo = logz_parse(value);
+		if (algo == -1) {
+#ifdef HAVE_ZSTD
+			fprintf(stderr, "Invalid LogCompression %s on line %d, use none, gzip or zstd\n", value, line_num);
+#else /* !HAVE_ZSTD */
+			fprintf(stderr, "Invalid LogCompression %s on line %d, use none or gzip (built without zstd)\n", value, line_num);
+#endif /* !HAVE_ZSTD */
+			goto leave;
+		}
+		global->logz = algo;
+#ifdef DEBUG_OPTS
+		log_dbg_printf("LogCompression: %s\n", logz_str(global->logz));
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "LogCompressionLevel", 20)) {
+		int i = atoi(value);
+		if (i >= 1 && i <= 19) {
+			global->logz_level = i;
+		} else {
+			fprintf(stderr, "Invalid LogCompressionLevel %s on line %d, use 1-19\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("LogCompressionLevel: %d\n", global->logz_level);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "LogCompressionThreads", 22)) {
+		unsigned int i = atoi(value);
+		if (i >= 1 && i <= 64) {
+			global->logz_threads = i;
+		} else {
+			fprintf(stderr, "Invalid LogCompressionThreads %s on line %d, use 1-64\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("LogCompressionThreads: %u\n", global->logz_threads);
+#endif /* DEBUG_OPTS */
 	} else if (!strncmp(name, "Daemon", 7)) {
 		yes = check_value_yesno(value, "Daemon", line_num);
 		if (yes == -1) {
@@ -2645,6 +3180,17 @@ set_global_option(global_t *global, const char *argv0,
 		}
 #ifdef DEBUG_OPTS
 		log_dbg_printf("ConnIdleTimeout: %u\n", global->conn_idle_timeout);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "SSLproxyHeaderSearchLimit", 26)) {
+		unsigned int i = atoi(value);
+		if (i >= 1024 && i <= 1048576) {
+			global->sslproxy_header_search_limit = i;
+		} else {
+			fprintf(stderr, "Invalid SSLproxyHeaderSearchLimit %s on line %d, use 1024-1048576\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("SSLproxyHeaderSearchLimit: %u\n", global->sslproxy_header_search_limit);
 #endif /* DEBUG_OPTS */
 	} else if (!strncmp(name, "ExpiredConnCheckPeriod", 23)) {
 		unsigned int i = atoi(value);
@@ -2687,6 +3233,70 @@ set_global_option(global_t *global, const char *argv0,
 		}
 #ifdef DEBUG_OPTS
 		log_dbg_printf("StatsPeriod: %u\n", global->stats_period);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "StatsSocket", 12)) {
+		global_set_statssock(global, argv0, value);
+	} else if (!strncmp(name, "ThreadBufferBudget", 19)) {
+		char *end;
+		unsigned long long i = strtoull(value, &end, 10);
+		if (end != value && !*end && (!i || i >= 1048576)) {
+			global->thr_buf_budget = i;
+		} else {
+			fprintf(stderr, "Invalid ThreadBufferBudget %s on line %d, use 0 or at least 1048576\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("ThreadBufferBudget: %zu\n", global->thr_buf_budget);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "Splice", 7)) {
+		yes = check_value_yesno(value, "Splice", line_num);
+		if (yes == -1) {
+			goto leave;
+		}
+		global->splice = yes;
+#ifdef DEBUG_OPTS
+		log_dbg_printf("Splice: %u\n", global->splice);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "DNSCache", 9)) {
+		yes = check_value_yesno(value, "DNSCache", line_num);
+		if (yes == -1) {
+			goto leave;
+		}
+		global->dnscache = yes;
+#ifdef DEBUG_OPTS
+		log_dbg_printf("DNSCache: %u\n", global->dnscache);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "Threads", 8)) {
+		unsigned int i = atoi(value);
+		if (i >= 1 && i <= 1024) {
+			global->conn_thr_count = i;
+		} else {
+			fprintf(stderr, "Invalid Threads %s on line %d, use 1-1024\n", value, line_num);
+			goto leave;
+		}
+#ifdef DEBUG_OPTS
+		log_dbg_printf("Threads: %u\n", global->conn_thr_count);
+#endif /* DEBUG_OPTS */
+	} else if (!strncmp(name, "WorkerCPUs", 11)) {
+		if (global_set_cpus(&global->workercpus, argv0, name, value, line_num) == -1) {
+			goto leave;
+		}
+	} else if (!strncmp(name, "MainCPUs", 9)) {
+		if (global_set_cpus(&global->maincpus, argv0, name, value, line_num) == -1) {
+			goto leave;
+		}
+	} else if (!strncmp(name, "LoggerCPUs", 11)) {
+		if (global_set_cpus(&global->loggercpus, argv0, name, value, line_num) == -1) {
+			goto leave;
+		}
+	} else if (!strncmp(name, "NUMAAware", 10)) {
+		yes = check_value_yesno(value, "NUMAAware", line_num);
+		if (yes == -1) {
+			goto leave;
+		}
+		global->numa = yes;
+#ifdef DEBUG_OPTS
+		log_dbg_printf("NUMAAware: %u\n", global->numa);
 #endif /* DEBUG_OPTS */
 	} else if (!strncmp(name, "OpenFilesLimit", 15)) {
 		global_set_open_files_limit(value, line_num);
@@ -2796,4 +3406,594 @@ leave:
 	return retval;
 }
 
+/*
+ * A reload parses the config in a process forked from the privileged parent,
+ * which has the privileges and the file system view of startup, see
+ * privsep.c.  That process passes the options a reload can change to the
+ * proxy over a pipe, and the proxy takes the options set up on startup from
+ * the running config.  Both ends run the same image, so the scalar fields of
+ * the structs are passed as they are, including the function pointers, while
+ * strings, certs, keys, plugins and lists are passed by content.
+ */
+
+// Written last, tells a complete config from one cut short
+#define GLOBAL_RELOAD_END 0x52454c44
+// Longest string or DER encoded cert or key accepted
+#define GLOBAL_RELOAD_MAXBUF (16 * 1024 * 1024)
+
+static int WUNRES
+global_reload_put(FILE *f, const void *buf, size_t len)
+{
+	return !len || fwrite(buf, len, 1, f) == 1 ? 0 : -1;
+}
+
+static int WUNRES
+global_reload_put_buf(FILE *f, const void *buf, uint32_t len)
+{
+	if (global_reload_put(f, &len, sizeof(len)) == -1)
+		return -1;
+	return global_reload_put(f, buf, len);
+}
+
+/*
+ * Strings are passed with their NUL, so that NULL is told apart by length 0.
+ */
+static int WUNRES
+global_reload_put_str(FILE *f, const char *s)
+{
+	return global_reload_put_buf(f, s, s ? strlen(s) + 1 : 0);
+}
+
+/*
+ * Pass and free the DER encoding made by an i2d function.
+ */
+static int WUNRES
+global_reload_put_der(FILE *f, unsigned char *der, int len)
+{
+	int rv;
+
+	if (len < 0)
+		return -1;
+	rv = global_reload_put_buf(f, der, len);
+	if (der)
+		OPENSSL_free(der);
+	return rv;
+}
+
+static int WUNRES
+global_reload_put_x509(FILE *f, X509 *crt)
+{
+	unsigned char *der = NULL;
+	int len = crt ? i2d_X509(crt, &der) : 0;
+
+	return global_reload_put_der(f, der, len);
+}
+
+static int WUNRES
+global_reload_put_pkey(FILE *f, EVP_PKEY *key)
+{
+	unsigned char *der = NULL;
+	int len = key ? i2d_PrivateKey(key, &der) : 0;
+
+	return global_reload_put_der(f, der, len);
+}
+
+#ifndef OPENSSL_NO_DH
+static int WUNRES
+global_reload_put_dh(FILE *f, DH *dh)
+{
+	unsigned char *der = NULL;
+	int len = dh ? i2d_DHparams(dh, &der) : 0;
+
+	return global_reload_put_der(f, der, len);
+}
+#endif /* !OPENSSL_NO_DH */
+
+static int WUNRES
+global_reload_get(FILE *f, void *buf, size_t len)
+{
+	return !len || fread(buf, len, 1, f) == 1 ? 0 : -1;
+}
+
+/*
+ * Read a buffer into *buf, which is set to NULL if the buffer is empty.
+ */
+static int WUNRES
+global_reload_get_buf(FILE *f, unsigned char **buf, uint32_t *len)
+{
+	*buf = NULL;
+	if (global_reload_get(f, len, sizeof(*len)) == -1 ||
+	    *len > GLOBAL_RELOAD_MAXBUF)
+		return -1;
+	if (!*len)
+		return 0;
+	if (!(*buf = malloc(*len)))
+		return -1;
+	if (global_reload_get(f, *buf, *len) == -1) {
+		free(*buf);
+		*buf = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static int WUNRES
+global_reload_get_str(FILE *f, char **s)
+{
+	uint32_t len;
+
+	if (global_reload_get_buf(f, (unsigned char **)s, &len) == -1)
+		return -1;
+	if (*s && (*s)[len - 1] != '\0') {
+		free(*s);
+		*s = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static int WUNRES
+global_reload_get_x509(FILE *f, X509 **crt)
+{
+	unsigned char *der;
+	const unsigned char *p;
+	uint32_t len;
+
+	*crt = NULL;
+	if (global_reload_get_buf(f, &der, &len) == -1)
+		return -1;
+	if (!der)
+		return 0;
+	p = der;
+	*crt = d2i_X509(NULL, &p, len);
+	free(der);
+	return *crt ? 0 : -1;
+}
+
+static int WUNRES
+global_reload_get_pkey(FILE *f, EVP_PKEY **key)
+{
+	unsigned char *der;
+	const unsigned char *p;
+	uint32_t len;
+
+	*key = NULL;
+	if (global_reload_get_buf(f, &der, &len) == -1)
+		return -1;
+	if (!der)
+		return 0;
+	p = der;
+	*key = d2i_AutoPrivateKey(NULL, &p, len);
+	free(der);
+	return *key ? 0 : -1;
+}
+
+#ifndef OPENSSL_NO_DH
+static int WUNRES
+global_reload_get_dh(FILE *f, DH **dh)
+{
+	unsigned char *der;
+	const unsigned char *p;
+	uint32_t len;
+
+	*dh = NULL;
+	if (global_reload_get_buf(f, &der, &len) == -1)
+		return -1;
+	if (!der)
+		return 0;
+	p = der;
+	*dh = d2i_DHparams(NULL, &p, len);
+	free(der);
+	return *dh ? 0 : -1;
+}
+#endif /* !OPENSSL_NO_DH */
+
+static int WUNRES
+opts_reload_write(opts_t *opts, FILE *f)
+{
+	passsite_t *ps;
+	logpolicy_rule_t *rule;
+	uint32_t n;
+
+	if (global_reload_put(f, opts, sizeof(opts_t)) == -1)
+		return -1;
+	if (global_reload_put_str(f, opts->ciphers) == -1 ||
+	    global_reload_put_str(f, opts->crlurl) == -1 ||
+	    global_reload_put_str(f, opts->user_auth_url) == -1)
+		return -1;
+#ifndef OPENSSL_NO_ECDH
+	if (global_reload_put_str(f, opts->ecdhcurve) == -1)
+		return -1;
+#endif /* !OPENSSL_NO_ECDH */
+	if (global_reload_put_x509(f, opts->cacrt) == -1 ||
+	    global_reload_put_pkey(f, opts->cakey) == -1 ||
+	    global_reload_put_x509(f, opts->clientcrt) == -1 ||
+	    global_reload_put_pkey(f, opts->clientkey) == -1)
+		return -1;
+#ifndef OPENSSL_NO_DH
+	if (global_reload_put_dh(f, opts->dh) == -1)
+		return -1;
+#endif /* !OPENSSL_NO_DH */
+
+	n = sk_X509_num(opts->chain);
+	if (global_reload_put(f, &n, sizeof(n)) == -1)
+		return -1;
+	for (uint32_t i = 0; i < n; i++) {
+		if (global_reload_put_x509(f, sk_X509_value(opts->chain, i)) == -1)
+			return -1;
+	}
+
+	// The plugins loaded on startup are looked up by path and arg
+	if (global_reload_put_str(f, opts->plugin ? opts->plugin->path : NULL) == -1 ||
+	    global_reload_put_str(f, opts->plugin ? opts->plugin->arg : NULL) == -1)
+		return -1;
+
+	// PassSites are added to the head of the list and to the index as
+	// they are read, so pass them last first to keep the index order
+	n = 0;
+	for (ps = opts->passsites; ps; ps = ps->next)
+		n++;
+	if (global_reload_put(f, &n, sizeof(n)) == -1)
+		return -1;
+	for (uint32_t i = n; i > 0; i--) {
+		ps = opts->passsites;
+		for (uint32_t j = 1; j < i; j++)
+			ps = ps->next;
+		if (global_reload_put(f, ps, sizeof(passsite_t)) == -1 ||
+		    global_reload_put_str(f, ps->site) == -1 ||
+		    global_reload_put_str(f, ps->ip) == -1 ||
+		    global_reload_put_str(f, ps->user) == -1 ||
+		    global_reload_put_str(f, ps->keyword) == -1)
+			return -1;
+	}
+
+	n = 0;
+	for (rule = opts->contentlog_rules; rule; rule = rule->next)
+		n++;
+	if (global_reload_put(f, &n, sizeof(n)) == -1)
+		return -1;
+	for (rule = opts->contentlog_rules; rule; rule = rule->next) {
+		if (global_reload_put(f, rule, sizeof(logpolicy_rule_t)) == -1 ||
+		    global_reload_put_str(f, rule->value) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+static opts_t *
+opts_reload_read(FILE *f)
+{
+	opts_t *opts;
+	STACK_OF(X509) *chain;
+	unsigned long serial;
+	char *path = NULL, *arg = NULL;
+	uint32_t n;
+
+	opts = opts_new();
+	if (!opts)
+		return NULL;
+
+	// Keep the serial and the chain of the new opts, and take the scalar
+	// options as passed, clearing the pointers set up below
+	serial = opts->serial;
+	chain = opts->chain;
+	if (global_reload_get(f, opts, sizeof(opts_t)) == -1) {
+		memset(opts, 0, sizeof(opts_t));
+		opts->chain = chain;
+		goto err;
+	}
+	opts->serial = serial;
+	opts->chain = chain;
+	opts->ciphers = NULL;
+	opts->crlurl = NULL;
+	opts->user_auth_url = NULL;
+#ifndef OPENSSL_NO_ECDH
+	opts->ecdhcurve = NULL;
+#endif /* !OPENSSL_NO_ECDH */
+	opts->cacrt = NULL;
+	opts->cakey = NULL;
+	opts->clientcrt = NULL;
+	opts->clientkey = NULL;
+#ifndef OPENSSL_NO_DH
+	opts->dh = NULL;
+#endif /* !OPENSSL_NO_DH */
+	opts->plugin = NULL;
+	opts->passsites = NULL;
+	opts->passsite_index = NULL;
+	opts->contentlog_rules = NULL;
+	opts->contentlog_rules_tail = &opts->contentlog_rules;
+	opts->global = NULL;
+
+	if (global_reload_get_str(f, &opts->ciphers) == -1 ||
+	    global_reload_get_str(f, &opts->crlurl) == -1 ||
+	    global_reload_get_str(f, &opts->user_auth_url) == -1)
+		goto err;
+#ifndef OPENSSL_NO_ECDH
+	if (global_reload_get_str(f, &opts->ecdhcurve) == -1)
+		goto err;
+#endif /* !OPENSSL_NO_ECDH */
+	if (global_reload_get_x509(f, &opts->cacrt) == -1 ||
+	    global_reload_get_pkey(f, &opts->cakey) == -1 ||
+	    global_reload_get_x509(f, &opts->clientcrt) == -1 ||
+	    global_reload_get_pkey(f, &opts->clientkey) == -1)
+		goto err;
+#ifndef OPENSSL_NO_DH
+	if (global_reload_get_dh(f, &opts->dh) == -1)
+		goto err;
+#endif /* !OPENSSL_NO_DH */
+
+	if (global_reload_get(f, &n, sizeof(n)) == -1)
+		goto err;
+	for (uint32_t i = 0; i < n; i++) {
+		X509 *crt;
+		if (global_reload_get_x509(f, &crt) == -1 || !crt)
+			goto err;
+		if (!sk_X509_push(opts->chain, crt)) {
+			X509_free(crt);
+			goto err;
+		}
+	}
+
+	if (global_reload_get_str(f, &path) == -1 ||
+	    global_reload_get_str(f, &arg) == -1)
+		goto err;
+	if (path) {
+		opts->plugin = pxy_plugin_load(path, arg);
+		if (!opts->plugin)
+			goto err;
+		free(path);
+		path = NULL;
+	}
+	if (arg) {
+		free(arg);
+		arg = NULL;
+	}
+
+	if (global_reload_get(f, &n, sizeof(n)) == -1)
+		goto err;
+	for (uint32_t i = 0; i < n; i++) {
+		passsite_t *ps = malloc(sizeof(passsite_t));
+		if (!ps)
+			goto err;
+		if (global_reload_get(f, ps, sizeof(passsite_t)) == -1) {
+			free(ps);
+			goto err;
+		}
+		ps->site = ps->ip = ps->user = ps->keyword = NULL;
+		ps->next = opts->passsites;
+		opts->passsites = ps;
+		if (global_reload_get_str(f, &ps->site) == -1 || !ps->site ||
+		    global_reload_get_str(f, &ps->ip) == -1 ||
+		    global_reload_get_str(f, &ps->user) == -1 ||
+		    global_reload_get_str(f, &ps->keyword) == -1 ||
+		    opts_index_pass_site(opts, ps) == -1)
+			goto err;
+	}
+
+	if (global_reload_get(f, &n, sizeof(n)) == -1)
+		goto err;
+	for (uint32_t i = 0; i < n; i++) {
+		logpolicy_rule_t *rule = malloc(sizeof(logpolicy_rule_t));
+		if (!rule)
+			goto err;
+		if (global_reload_get(f, rule, sizeof(logpolicy_rule_t)) == -1) {
+			free(rule);
+			goto err;
+		}
+		rule->value = NULL;
+		rule->next = NULL;
+		*opts->contentlog_rules_tail = rule;
+		opts->contentlog_rules_tail = &rule->next;
+		if (global_reload_get_str(f, &rule->value) == -1)
+			goto err;
+	}
+	return opts;
+err:
+	if (path)
+		free(path);
+	if (arg)
+		free(arg);
+	opts_free(opts);
+	return NULL;
+}
+
+/*
+ * Write the options of global which a reload can change to fd, and close it.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+global_reload_write(global_t *global, int fd)
+{
+	FILE *f;
+	unsigned int log_stats = global->log_stats;
+	unsigned int splice = global->splice;
+	uint32_t n, end = GLOBAL_RELOAD_END;
+	int rv = -1;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		return -1;
+	}
+	if (global_reload_put(f, &global->conn_idle_timeout, sizeof(global->conn_idle_timeout)) == -1 ||
+	    global_reload_put(f, &global->expired_conn_check_period, sizeof(global->expired_conn_check_period)) == -1 ||
+	    global_reload_put(f, &global->sslproxy_header_search_limit, sizeof(global->sslproxy_header_search_limit)) == -1 ||
+	    global_reload_put(f, &global->ssl_shutdown_retry_delay, sizeof(global->ssl_shutdown_retry_delay)) == -1 ||
+	    global_reload_put(f, &global->stats_period, sizeof(global->stats_period)) == -1 ||
+	    global_reload_put(f, &global->thr_buf_budget, sizeof(global->thr_buf_budget)) == -1 ||
+	    global_reload_put(f, &global->tgcrt_cache_size, sizeof(global->tgcrt_cache_size)) == -1 ||
+	    global_reload_put(f, &global->leafkey_rsabits, sizeof(global->leafkey_rsabits)) == -1 ||
+	    global_reload_put(f, &log_stats, sizeof(log_stats)) == -1 ||
+	    global_reload_put(f, &splice, sizeof(splice)) == -1 ||
+	    global_reload_put_pkey(f, global->key) == -1 ||
+	    opts_reload_write(global->opts, f) == -1)
+		goto out;
+
+	n = 0;
+	for (proxyspec_t *spec = global->spec; spec; spec = spec->next)
+		n++;
+	if (global_reload_put(f, &n, sizeof(n)) == -1)
+		goto out;
+	for (proxyspec_t *spec = global->spec; spec; spec = spec->next) {
+		if (global_reload_put(f, spec, sizeof(proxyspec_t)) == -1 ||
+		    global_reload_put_str(f, spec->natengine) == -1 ||
+		    opts_reload_write(spec->opts, f) == -1)
+			goto out;
+	}
+	if (global_reload_put(f, &end, sizeof(end)) == -1)
+		goto out;
+	rv = 0;
+out:
+	if (fclose(f) == EOF)
+		rv = -1;
+	return rv;
+}
+
+/*
+ * Copy the options of running which a reload cannot change into global, see
+ * proxy_reload_check().  The strings are copied in a second pass, so that
+ * global never points to the strings of running, even on failure.
+ */
+static int WUNRES
+global_reload_copy(global_t *global, global_t *running)
+{
+	char **strs[] = {
+		&global->certgendir,
+		&global->tgcrtdir,
+		&global->tgcrtidx,
+		&global->cachesnap,
+		&global->dropuser,
+		&global->dropgroup,
+		&global->jaildir,
+		&global->pidfile,
+		&global->connectlog,
+		&global->contentlog,
+		&global->contentlog_basedir,
+		&global->masterkeylog,
+		&global->pcaplog,
+		&global->pcaplog_basedir,
+#ifndef WITHOUT_MIRROR
+		&global->mirrorif,
+		&global->mirrortarget,
+#endif /* !WITHOUT_MIRROR */
+		&global->shmlog,
+		&global->statssock,
+		&global->workercpus,
+		&global->maincpus,
+		&global->loggercpus,
+		&global->userdb_path,
+#ifndef OPENSSL_NO_ENGINE
+		&global->openssl_engine,
+#endif /* !OPENSSL_NO_ENGINE */
+	};
+	const char *vals[sizeof(strs) / sizeof(strs[0])];
+	size_t i;
+
+	// Shares the userdb and its statement, which global_free() leaves open
+	memcpy(global, running, sizeof(global_t));
+	global->refcount = 1;
+	global->conffile = NULL;
+	global->spec = NULL;
+	global->opts = NULL;
+	global->key = NULL;
+	global->cacrt_str = NULL;
+	global->cakey_str = NULL;
+	global->chain_str = NULL;
+	global->clientcrt_str = NULL;
+	global->clientkey_str = NULL;
+	global->crl_str = NULL;
+	global->dh_str = NULL;
+	for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+		vals[i] = *strs[i];
+		*strs[i] = NULL;
+	}
+	for (i = 0; i < sizeof(strs) / sizeof(strs[0]); i++) {
+		if (vals[i] && !(*strs[i] = strdup(vals[i])))
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read a config written by global_reload_write() from fd, and close it.  The
+ * options a reload cannot change are those of running.
+ * Returns the new global_t, or NULL on failure.
+ */
+global_t *
+global_reload_read(global_t *running, int fd)
+{
+	global_t *global;
+	FILE *f;
+	unsigned int log_stats, splice;
+	uint32_t n, end;
+	proxyspec_t **tail;
+
+	f = fdopen(fd, "r");
+	if (!f) {
+		close(fd);
+		return NULL;
+	}
+	global = malloc(sizeof(global_t));
+	if (!global) {
+		fclose(f);
+		return NULL;
+	}
+	if (global_reload_copy(global, running) == -1)
+		goto err;
+
+	if (global_reload_get(f, &global->conn_idle_timeout, sizeof(global->conn_idle_timeout)) == -1 ||
+	    global_reload_get(f, &global->expired_conn_check_period, sizeof(global->expired_conn_check_period)) == -1 ||
+	    global_reload_get(f, &global->sslproxy_header_search_limit, sizeof(global->sslproxy_header_search_limit)) == -1 ||
+	    global_reload_get(f, &global->ssl_shutdown_retry_delay, sizeof(global->ssl_shutdown_retry_delay)) == -1 ||
+	    global_reload_get(f, &global->stats_period, sizeof(global->stats_period)) == -1 ||
+	    global_reload_get(f, &global->thr_buf_budget, sizeof(global->thr_buf_budget)) == -1 ||
+	    global_reload_get(f, &global->tgcrt_cache_size, sizeof(global->tgcrt_cache_size)) == -1 ||
+	    global_reload_get(f, &global->leafkey_rsabits, sizeof(global->leafkey_rsabits)) == -1 ||
+	    global_reload_get(f, &log_stats, sizeof(log_stats)) == -1 ||
+	    global_reload_get(f, &splice, sizeof(splice)) == -1 ||
+	    global_reload_get_pkey(f, &global->key) == -1)
+		goto err;
+	global->log_stats = !!log_stats;
+	global->splice = !!splice;
+
+	if (!(global->opts = opts_reload_read(f)))
+		goto err;
+	global->opts->global = global;
+
+	if (global_reload_get(f, &n, sizeof(n)) == -1)
+		goto err;
+	tail = &global->spec;
+	for (uint32_t i = 0; i < n; i++) {
+		proxyspec_t *spec = malloc(sizeof(proxyspec_t));
+		if (!spec)
+			goto err;
+		if (global_reload_get(f, spec, sizeof(proxyspec_t)) == -1) {
+			free(spec);
+			goto err;
+		}
+		spec->natengine = NULL;
+		spec->next = NULL;
+		spec->addr = NULL;
+		spec->divert_addr = NULL;
+		spec->target_addr = NULL;
+		spec->opts = NULL;
+		spec->listen_spec = NULL;
+		*tail = spec;
+		tail = &spec->next;
+		if (global_reload_get_str(f, &spec->natengine) == -1 ||
+		    !(spec->opts = opts_reload_read(f)))
+			goto err;
+		spec->opts->global = global;
+	}
+	if (global_reload_get(f, &end, sizeof(end)) == -1 ||
+	    end != GLOBAL_RELOAD_END)
+		goto err;
+	fclose(f);
+	return global;
+err:
+	fclose(f);
+	global_free(global);
+	return NULL;
+}
+
 /* vim: set noet ft=c: */
@@ -33,6 +33,9 @@
 #include "proc.h"
 #include "nat.h"
 #include "ssl.h"
+#include "passsite.h"
+#include "logpolicy.h"
+#include "sys.h"
 #include "attrib.h"
 
 #include <sys/types.h>
@@ -45,6 +48,12 @@
 #define STRORDASH(x)	(((x)&&*(x))?(x):"-")
 #define STRORNONE(x)	(((x)&&*(x))?(x):"")
 
+/*
+ * Longest name of the child listener sockets in ReturnPath dirs, including
+ * the slash: /sslproxy.<pid>.<conn id>
+ */
+#define RETURN_PATH_NAME_MAX	(1 + 9 + 10 + 1 + 20)
+
 typedef struct global global_t;
 
 typedef struct opts {
@@ -89,12 +98,32 @@ typedef struct opts {
 	unsigned int remove_http_referer: 1;
 	unsigned int verify_peer: 1;
 	unsigned int allow_wrong_host: 1;
+	// Complete the client handshake with the forged cert last served for the SNI, in parallel with
+	// the server handshake, and go on with conns whose server cert is not the one it was forged for
+	// if optimistic_mismatch_log is set, instead of terminating them
+	unsigned int optimistic_handshake : 1;
+	unsigned int optimistic_mismatch_log : 1;
 	unsigned int user_auth: 1;
 	char *user_auth_url;
 	unsigned int user_timeout;
 	unsigned int validate_proto : 1;
 	unsigned int max_http_header_size;
+	// Output buffer limit of conn ends in bytes, adapted to the traffic of each conn if relay_adaptive is set
+	unsigned int relay_bufsize;
+	unsigned int relay_adaptive : 1;
+	// Plugin relaying the conns instead of the listening program, NULL if none
+	struct pxy_plugin *plugin;
 	struct passsite *passsites;
+	// PassSite list compiled for lookups by name
+	passsite_index_t *passsite_index;
+	// Content log capture rules, the ones of the proxyspec before the inherited global ones,
+	// and where the next rule of the proxyspec goes
+	logpolicy_rule_t *contentlog_rules;
+	logpolicy_rule_t **contentlog_rules_tail;
+	// Bytes per direction to log of conns no rule matches, 0 for no limit
+	size_t contentlog_limit;
+	// Unique per opts, tells apart the src SSL_CTX built for different opts
+	unsigned long serial;
 	global_t *global;
 } opts_t;
 
@@ -134,23 +163,20 @@ typedef struct proxyspec {
 
 	// Each proxyspec has its own opts
 	opts_t *opts;
-} proxyspec_t;
 
-typedef struct passsite {
-	char *site;
-	// Filter definition fields
-	char *ip;
-	char *user;
-	unsigned int all : 1; /* 1 for all users */
-	char *keyword;
-	struct passsite *next;
-} passsite_t;
+	// Set on the specs of a reloaded config: the spec of the initial config the listener was opened for,
+	// privsep requests must pass that one, since the privsep parent only knows the specs of the initial config
+	const struct proxyspec *listen_spec;
+} proxyspec_t;
 
 struct global {
+	// Conns hold a reference to the global_t they were set up with, so that a reload does not free it under them
+	unsigned int refcount;
 	unsigned int debug : 1;
 	unsigned int detach : 1;
 	unsigned int contentlog_isdir : 1;
 	unsigned int contentlog_isspec : 1;
+	unsigned int contentlog_isstore : 1;
 	unsigned int pcaplog_isdir : 1;
 	unsigned int pcaplog_isspec : 1;
 #ifdef HAVE_LOCAL_PROCINFO
@@ -159,6 +185,12 @@ struct global {
 	unsigned int certgen_writeall : 1;
 	char *certgendir;
 	char *tgcrtdir;
+	// Prebuilt index of tgcrtdir, and max target certs kept parsed
+	char *tgcrtidx;
+	unsigned int tgcrt_cache_size;
+	// Snapshot file of the forged cert and dst session caches, and seconds between snapshots
+	char *cachesnap;
+	unsigned int cachesnap_period;
 	char *dropuser;
 	char *dropgroup;
 	char *jaildir;
@@ -167,6 +199,12 @@ struct global {
 	char *connectlog;
 	char *contentlog;
 	char *contentlog_basedir; /* static part of logspec for privsep srv */
+	// Bytes after which the segments of the content log store are rotated
+	unsigned long long contentlog_segsize;
+	// Compression of the connect, content and pcap logs, level and number of workers
+	int logz;
+	int logz_level;
+	unsigned int logz_threads;
 	char *masterkeylog;
 	char *pcaplog;
 	char *pcaplog_basedir; /* static part of pcap logspec for privsep srv */
@@ -174,12 +212,34 @@ struct global {
 	char *mirrorif;
 	char *mirrortarget;
 #endif /* !WITHOUT_MIRROR */
+	// Shared memory object of the content log rings, NULL if disabled, and bytes per ring
+	char *shmlog;
+	size_t shmlog_size;
+	int shmlog_policy;
 	unsigned int conn_idle_timeout;
 	unsigned int expired_conn_check_period;
+	// Bytes of child streams to search for the SSLproxy header
+	unsigned int sslproxy_header_search_limit;
 	unsigned int ssl_shutdown_retry_delay;
 	unsigned int stats_period;
+	// Path of the stats socket, NULL if disabled
+	char *statssock;
+	// Bytes buffered by the conns of a thread before they stop reading, 0 for no limit
+	size_t thr_buf_budget;
 	unsigned int statslog: 1;
 	unsigned int log_stats: 1;
+	// Relay passthrough conns with splice(2) where supported
+	unsigned int splice : 1;
+	// Share DNS answers for SNI proxyspecs between threads
+	unsigned int dnscache : 1;
+	// Place conns on the conn handling threads of the NUMA node they come in on
+	unsigned int numa : 1;
+	// Number of conn handling threads, 0 for twice the number of CPU cores
+	unsigned int conn_thr_count;
+	// CPU lists to pin the conn handling, main and logger threads to, NULL if not pinned
+	char *workercpus;
+	char *maincpus;
+	char *loggercpus;
 	char *userdb_path;
 	sqlite3 *userdb;
 	struct sqlite3_stmt *update_user_atime;
@@ -210,7 +270,7 @@ struct global {
 };
 
 typedef struct userdbkeys {
-	char ip[46];
+	char ip[SYS_HOSTSTRLEN];
 	char user[32];
 	char ether[18];
 } userdbkeys_t;
@@ -251,6 +311,11 @@ void opts_set_pass_site(opts_t *, char *, int);
 global_t * global_new(void) MALLOC;
 void global_free_opts_clone_strs(global_t *) NONNULL(1);
 void global_free(global_t *) NONNULL(1);
+void global_ref(global_t *) NONNULL(1);
+void global_unref(global_t *) NONNULL(1);
+int global_free_unused(global_t *) NONNULL(1) WUNRES;
+int global_reload_write(global_t *, int) NONNULL(1) WUNRES;
+global_t *global_reload_read(global_t *, int) NONNULL(1) MALLOC;
 int global_has_ssl_spec(global_t *) NONNULL(1) WUNRES;
 int global_has_dns_spec(global_t *) NONNULL(1) WUNRES;
 int global_has_userauth_spec(global_t *) NONNULL(1) WUNRES;
@@ -265,6 +330,8 @@ void global_set_contentlogdir(global_t *, const char *, const char *)
      NONNULL(1,2,3);
 void global_set_contentlogpathspec(global_t *, const char *, const char *)
      NONNULL(1,2,3);
+void global_set_contentlogstore(global_t *, const char *, const char *)
+     NONNULL(1,2,3);
 #ifdef HAVE_LOCAL_PROCINFO
 void global_set_lprocinfo(global_t *) NONNULL(1);
 #endif /* HAVE_LOCAL_PROCINFO */
@@ -291,6 +358,9 @@ void global_set_key(global_t *, const char *, const char *) NONNULL(1,2,3);
 void global_set_openssl_engine(global_t *, const char *, const char *)
      NONNULL(1,2,3);
 void global_set_tgcrtdir(global_t *, const char *, const char *) NONNULL(1,2,3);
+void global_set_tgcrtidx(global_t *, const char *, const char *) NONNULL(1,2,3);
+void global_set_cachesnap(global_t *, const char *, const char *) NONNULL(1,2,3);
+void global_set_statssock(global_t *, const char *, const char *) NONNULL(1,2,3);
 void global_set_certgendir_writeall(global_t *, const char *, const char *)
      NONNULL(1,2,3);
 void global_set_certgendir_writegencerts(global_t *, const char *, const char *)
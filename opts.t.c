@@ -30,10 +30,12 @@
 #include "opts.h"
 
 #include <check.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 
 static char *argv01[] = {
 	"https", "127.0.0.1", "10443", "up:8080", "127.0.0.2", "443"
@@ -89,6 +91,9 @@ static char *argv14[] = {
 	"https", "127.0.0.1", "10443", "up:8080",
 	"autossl", "127.0.0.1", "10025", "up:9199", "127.0.0.2", "25"
 };
+static char *argv15[] = {
+	"tcp", "127.0.0.1", "10025", "up:8080", "ua:/tmp/lp.sock", "ra:/tmp"
+};
 
 #ifdef __linux__
 #define NATENGINE "netfilter"
@@ -536,6 +541,195 @@ START_TEST(proxyspec_parse_18)
 }
 END_TEST
 
+START_TEST(proxyspec_parse_19)
+{
+	global_t *global = global_new();
+	proxyspec_t *spec = NULL;
+	struct sockaddr_un *sun;
+	int argc = 6;
+	char **argv = argv15;
+
+	proxyspec_parse(&argc, &argv, NATENGINE, global, "sslproxy");
+	spec = global->spec;
+	fail_unless(!!spec, "failed to parse spec");
+	fail_unless(spec->conn_dst_addr.ss_family == AF_UNIX, "divert addr not unix");
+	sun = (struct sockaddr_un *)&spec->conn_dst_addr;
+	fail_unless(!strcmp(sun->sun_path, "/tmp/lp.sock"), "wrong divert path");
+	fail_unless(spec->child_src_addr.ss_family == AF_UNIX, "return addr not unix");
+	sun = (struct sockaddr_un *)&spec->child_src_addr;
+	fail_unless(!strcmp(sun->sun_path, "/tmp"), "wrong return path");
+	global_free(global);
+}
+END_TEST
+
+START_TEST(proxyspec_parse_20)
+{
+	global_t *global = global_new();
+	int argc = 6;
+	char **argv = argv15;
+
+	global_set_jaildir(global, "sslproxy", "/tmp");
+	close(2);
+	proxyspec_parse(&argc, &argv, NATENGINE, global, "sslproxy");
+	global_free(global);
+}
+END_TEST
+
+/*
+ * Load a conf file with the given contents into a new global_t.
+ */
+static global_t *
+opts_load_conf(const char *conf)
+{
+	global_t *global = global_new();
+	char conffile[] = "/tmp/sslproxy_test_opts.XXXXXX";
+	char *natengine = NULL;
+	FILE *f;
+	int fd, rv;
+
+	fd = mkstemp(conffile);
+	fail_unless(fd != -1, "mkstemp failed");
+	f = fdopen(fd, "w");
+	fail_unless(!!f, "fdopen failed");
+	fputs(conf, f);
+	fclose(f);
+
+	global->conffile = strdup(conffile);
+	rv = global_load_conffile(global, "sslproxy", &natengine);
+	unlink(conffile);
+	free(natengine);
+	fail_unless(rv == 0, "failed to load conf file");
+	return global;
+}
+
+START_TEST(proxyspec_unix_path_01)
+{
+	global_t *global;
+	proxyspec_t *spec;
+	struct sockaddr_un *sun;
+
+	global = opts_load_conf("ProxySpec {\n"
+	                        "Proto tcp\n"
+	                        "Addr 127.0.0.1\n"
+	                        "Port 10025\n"
+	                        "DivertPort 8080\n"
+	                        "DivertPath /tmp/lp.sock\n"
+	                        "ReturnPath /tmp\n"
+	                        "}\n");
+	spec = global->spec;
+	fail_unless(!!spec, "failed to parse spec");
+	fail_unless(spec->conn_dst_addr.ss_family == AF_UNIX, "divert addr not unix");
+	sun = (struct sockaddr_un *)&spec->conn_dst_addr;
+	fail_unless(!strcmp(sun->sun_path, "/tmp/lp.sock"), "wrong divert path");
+	fail_unless(spec->child_src_addr.ss_family == AF_UNIX, "return addr not unix");
+	sun = (struct sockaddr_un *)&spec->child_src_addr;
+	fail_unless(!strcmp(sun->sun_path, "/tmp"), "wrong return path");
+	global_free(global);
+}
+END_TEST
+
+START_TEST(proxyspec_unix_path_02)
+{
+	close(2);
+	opts_load_conf("Chroot /tmp\n"
+	               "ProxySpec {\n"
+	               "Proto tcp\n"
+	               "Addr 127.0.0.1\n"
+	               "Port 10025\n"
+	               "DivertPort 8080\n"
+	               "DivertPath /tmp/lp.sock\n"
+	               "}\n");
+}
+END_TEST
+
+START_TEST(proxyspec_unix_path_03)
+{
+	close(2);
+	opts_load_conf("ProxySpec {\n"
+	               "Proto tcp\n"
+	               "Addr 127.0.0.1\n"
+	               "Port 10025\n"
+	               "DivertPort 8080\n"
+	               "ReturnPath /tmp\n"
+	               "}\n"
+	               "Chroot /tmp\n");
+}
+END_TEST
+
+START_TEST(proxyspec_unix_path_04)
+{
+	close(2);
+	opts_load_conf("ProxySpec {\n"
+	               "Proto tcp\n"
+	               "Addr 127.0.0.1\n"
+	               "Port 10025\n"
+	               "DivertPort 8080\n"
+	               "ReturnPath tmp\n"
+	               "}\n");
+}
+END_TEST
+
+START_TEST(proxyspec_contentlog_rule_01)
+{
+	global_t *global = global_new();
+	char *natengine = NULL;
+	proxyspec_t *spec;
+	char *s;
+	int rv;
+
+	rv = global_set_option(global, "sslproxy", "ContentLogLimit=65536", &natengine);
+	fail_unless(rv == 0, "ContentLogLimit rejected");
+	rv = global_set_option(global, "sslproxy", "ContentLogRule=nolog proto http", &natengine);
+	fail_unless(rv == 0, "ContentLogRule rejected");
+	rv = global_set_option(global, "sslproxy", "ContentLogRule=log sni *.example.com", &natengine);
+	fail_unless(rv == 0, "ContentLogRule rejected");
+	rv = global_set_option(global, "sslproxy", "ContentLogRule=log dstport 0", &natengine);
+	fail_unless(rv == -1, "bad ContentLogRule accepted");
+
+	spec = proxyspec_new(global, "sslproxy");
+	fail_unless(spec->opts->contentlog_limit == 65536, "limit not inherited");
+	fail_unless(!!spec->opts->contentlog_rules &&
+	            !!spec->opts->contentlog_rules->next &&
+	            !spec->opts->contentlog_rules->next->next, "rules not inherited");
+	s = logpolicy_rule_str(spec->opts->contentlog_rules);
+	fail_unless(!strcmp(s, "nolog proto http"), "first rule mismatch");
+	free(s);
+	s = logpolicy_rule_str(spec->opts->contentlog_rules->next);
+	fail_unless(!strcmp(s, "log sni *.example.com"), "second rule mismatch");
+	free(s);
+
+	proxyspec_free(spec);
+	global_free(global);
+	free(natengine);
+}
+END_TEST
+
+START_TEST(proxyspec_optimistic_01)
+{
+	global_t *global = global_new();
+	char *natengine = NULL;
+	proxyspec_t *spec;
+	int rv;
+
+	fail_unless(!global->opts->optimistic_handshake, "optimistic by default");
+	fail_unless(!global->opts->optimistic_mismatch_log, "mismatch logged by default");
+	rv = global_set_option(global, "sslproxy", "OptimisticHandshake=yes", &natengine);
+	fail_unless(rv == 0, "OptimisticHandshake rejected");
+	rv = global_set_option(global, "sslproxy", "OptimisticMismatch=log", &natengine);
+	fail_unless(rv == 0, "OptimisticMismatch rejected");
+	rv = global_set_option(global, "sslproxy", "OptimisticMismatch=ignore", &natengine);
+	fail_unless(rv == -1, "bad OptimisticMismatch accepted");
+
+	spec = proxyspec_new(global, "sslproxy");
+	fail_unless(spec->opts->optimistic_handshake, "optimistic not inherited");
+	fail_unless(spec->opts->optimistic_mismatch_log, "mismatch policy not inherited");
+
+	proxyspec_free(spec);
+	global_free(global);
+	free(natengine);
+}
+END_TEST
+
 START_TEST(proxyspec_set_proto_01)
 {
 	global_t *global = global_new();
@@ -945,6 +1139,14 @@ opts_suite(void)
 	tcase_add_exit_test(tc, proxyspec_parse_17, EXIT_FAILURE);
 #endif /* !DOCKER */
 	tcase_add_test(tc, proxyspec_parse_18);
+	tcase_add_test(tc, proxyspec_parse_19);
+	tcase_add_exit_test(tc, proxyspec_parse_20, EXIT_FAILURE);
+	tcase_add_test(tc, proxyspec_unix_path_01);
+	tcase_add_exit_test(tc, proxyspec_unix_path_02, EXIT_FAILURE);
+	tcase_add_exit_test(tc, proxyspec_unix_path_03, EXIT_FAILURE);
+	tcase_add_exit_test(tc, proxyspec_unix_path_04, EXIT_FAILURE);
+	tcase_add_test(tc, proxyspec_contentlog_rule_01);
+	tcase_add_test(tc, proxyspec_optimistic_01);
 	tcase_add_test(tc, proxyspec_set_proto_01);
 	suite_add_tcase(s, tc);
 
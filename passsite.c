@@ -0,0 +1,477 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "passsite.h"
+
+#include "khash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compiled PassSite list.
+ *
+ * Sites are matched against the SNI and each common name of the original
+ * server certificate.  Every site is stored in an exact-match hash table
+ * keyed by name.  Sites of the form *.example.com are also stored in a trie
+ * of reversed labels (com -> example), and match any name with exactly one
+ * more label on the left, as certificate wildcards do.  So a name is
+ * matched in O(label count), regardless of the number of sites.
+ *
+ * All the PassSite lines of a site share a filter node, which indexes
+ * the client ip and user filters by hash and keeps the filters for all
+ * users (*) with a description keyword in a list.
+ */
+
+/* Longest DNS name, longer names cannot match */
+#define PASSSITE_NAME_MAX 253
+
+typedef struct passsite_list {
+	passsite_t *ps;
+	struct passsite_list *next;
+} passsite_list_t;
+
+KHASH_MAP_INIT_STR(psip_t, passsite_t *)
+KHASH_MAP_INIT_STR(psuser_t, passsite_list_t *)
+
+typedef struct passsite_filter {
+	// Site without filters, or for all users without keyword
+	passsite_t *any;
+	khash_t(psip_t) *ips;
+	khash_t(psuser_t) *users;
+	// For all users with keyword
+	passsite_list_t *all;
+} passsite_filter_t;
+
+KHASH_MAP_INIT_STR(pssite_t, passsite_filter_t *)
+
+typedef struct passsite_label passsite_label_t;
+
+KHASH_MAP_INIT_STR(pslabel_t, passsite_label_t *)
+
+struct passsite_label {
+	khash_t(pslabel_t) *children;
+	// Filters of *. followed by the labels down to this node
+	passsite_filter_t *wildcard;
+};
+
+struct passsite_index {
+	khash_t(pssite_t) *exact;
+	passsite_label_t *root;
+	size_t count;
+};
+
+static void
+passsite_list_free(passsite_list_t *l)
+{
+	while (l) {
+		passsite_list_t *next = l->next;
+		free(l);
+		l = next;
+	}
+}
+
+static void
+passsite_filter_free(passsite_filter_t *f)
+{
+	khiter_t k;
+
+	if (f->ips) {
+		for (k = kh_begin(f->ips); k != kh_end(f->ips); k++) {
+			if (kh_exist(f->ips, k))
+				free((char *)kh_key(f->ips, k));
+		}
+		kh_destroy(psip_t, f->ips);
+	}
+	if (f->users) {
+		for (k = kh_begin(f->users); k != kh_end(f->users); k++) {
+			if (kh_exist(f->users, k)) {
+				free((char *)kh_key(f->users, k));
+				passsite_list_free(kh_val(f->users, k));
+			}
+		}
+		kh_destroy(psuser_t, f->users);
+	}
+	passsite_list_free(f->all);
+	free(f);
+}
+
+static void
+passsite_label_free(passsite_label_t *n)
+{
+	if (n->children) {
+		for (khiter_t k = kh_begin(n->children); k != kh_end(n->children); k++) {
+			if (kh_exist(n->children, k)) {
+				free((char *)kh_key(n->children, k));
+				passsite_label_free(kh_val(n->children, k));
+			}
+		}
+		kh_destroy(pslabel_t, n->children);
+	}
+	if (n->wildcard)
+		passsite_filter_free(n->wildcard);
+	free(n);
+}
+
+passsite_index_t *
+passsite_index_new(void)
+{
+	passsite_index_t *idx = malloc(sizeof(passsite_index_t));
+	if (!idx)
+		return NULL;
+	memset(idx, 0, sizeof(passsite_index_t));
+
+	idx->exact = kh_init(pssite_t);
+	idx->root = malloc(sizeof(passsite_label_t));
+	if (!idx->exact || !idx->root) {
+		if (idx->exact)
+			kh_destroy(pssite_t, idx->exact);
+		free(idx->root);
+		free(idx);
+		return NULL;
+	}
+	memset(idx->root, 0, sizeof(passsite_label_t));
+	return idx;
+}
+
+void
+passsite_index_free(passsite_index_t *idx)
+{
+	for (khiter_t k = kh_begin(idx->exact); k != kh_end(idx->exact); k++) {
+		if (kh_exist(idx->exact, k)) {
+			free((char *)kh_key(idx->exact, k));
+			passsite_filter_free(kh_val(idx->exact, k));
+		}
+	}
+	kh_destroy(pssite_t, idx->exact);
+	passsite_label_free(idx->root);
+	free(idx);
+}
+
+size_t
+passsite_index_count(passsite_index_t *idx)
+{
+	return idx->count;
+}
+
+static int
+passsite_list_prepend(passsite_list_t **head, passsite_t *ps)
+{
+	passsite_list_t *l = malloc(sizeof(passsite_list_t));
+	if (!l)
+		return -1;
+	l->ps = ps;
+	l->next = *head;
+	*head = l;
+	return 0;
+}
+
+static int
+passsite_filter_add(passsite_filter_t *f, passsite_t *ps)
+{
+	khiter_t k;
+	char *key;
+	int ret;
+
+	if (!ps->ip && !ps->user && !ps->keyword) {
+		// Keep the first one, they are all the same
+		if (!f->any)
+			f->any = ps;
+		return 0;
+	}
+
+	if (ps->ip) {
+		if (!f->ips && !(f->ips = kh_init(psip_t)))
+			return -1;
+		if (kh_get(psip_t, f->ips, ps->ip) != kh_end(f->ips))
+			return 0;
+		if (!(key = strdup(ps->ip)))
+			return -1;
+		k = kh_put(psip_t, f->ips, key, &ret);
+		if (ret == -1) {
+			free(key);
+			return -1;
+		}
+		kh_val(f->ips, k) = ps;
+		return 0;
+	}
+
+	if (ps->all) {
+		return passsite_list_prepend(&f->all, ps);
+	}
+
+	if (!f->users && !(f->users = kh_init(psuser_t)))
+		return -1;
+	k = kh_get(psuser_t, f->users, ps->user);
+	if (k == kh_end(f->users)) {
+		if (!(key = strdup(ps->user)))
+			return -1;
+		k = kh_put(psuser_t, f->users, key, &ret);
+		if (ret == -1) {
+			free(key);
+			return -1;
+		}
+		kh_val(f->users, k) = NULL;
+	}
+	return passsite_list_prepend(&kh_val(f->users, k), ps);
+}
+
+static passsite_filter_t *
+passsite_filter_new(void)
+{
+	passsite_filter_t *f = malloc(sizeof(passsite_filter_t));
+	if (f)
+		memset(f, 0, sizeof(passsite_filter_t));
+	return f;
+}
+
+static passsite_filter_t *
+passsite_exact_get(passsite_index_t *idx, const char *name)
+{
+	khiter_t k = kh_get(pssite_t, idx->exact, name);
+	if (k != kh_end(idx->exact))
+		return kh_val(idx->exact, k);
+
+	char *key = strdup(name);
+	passsite_filter_t *f = passsite_filter_new();
+	int ret;
+	if (!key || !f)
+		goto err;
+	k = kh_put(pssite_t, idx->exact, key, &ret);
+	if (ret == -1)
+		goto err;
+	kh_val(idx->exact, k) = f;
+	return f;
+err:
+	free(key);
+	free(f);
+	return NULL;
+}
+
+/*
+ * Walk down the trie along the reversed labels of suffix, creating the
+ * missing nodes.  Modifies suffix.
+ */
+static passsite_label_t *
+passsite_label_get(passsite_index_t *idx, char *suffix)
+{
+	passsite_label_t *n = idx->root;
+	char *end = suffix + strlen(suffix);
+
+	while (end > suffix) {
+		char *dot = end;
+		while (dot > suffix && *(dot - 1) != '.')
+			dot--;
+		const char *label = dot;
+
+		if (!n->children && !(n->children = kh_init(pslabel_t)))
+			return NULL;
+		khiter_t k = kh_get(pslabel_t, n->children, label);
+		if (k == kh_end(n->children)) {
+			char *key = strdup(label);
+			passsite_label_t *child = malloc(sizeof(passsite_label_t));
+			int ret;
+			if (!key || !child) {
+				free(key);
+				free(child);
+				return NULL;
+			}
+			memset(child, 0, sizeof(passsite_label_t));
+			k = kh_put(pslabel_t, n->children, key, &ret);
+			if (ret == -1) {
+				free(key);
+				free(child);
+				return NULL;
+			}
+			kh_val(n->children, k) = child;
+		}
+		n = kh_val(n->children, k);
+
+		// Skip the dot, and terminate the next label
+		end = dot > suffix ? dot - 1 : suffix;
+		*end = '\0';
+	}
+	return n;
+}
+
+/*
+ * Add a PassSite, which should stay valid as long as the index.
+ * Site has surrounding slashes: "/example.com/".
+ * Returns -1 on out of memory.
+ */
+int
+passsite_index_add(passsite_index_t *idx, passsite_t *ps)
+{
+	size_t len = strlen(ps->site);
+	if (len < 3)
+		return 0;
+
+	char name[len - 1];
+	memcpy(name, ps->site + 1, len - 2);
+	name[len - 2] = '\0';
+
+	// Wildcard sites match literal wildcard common names too
+	passsite_filter_t *f = passsite_exact_get(idx, name);
+	if (!f || passsite_filter_add(f, ps) == -1)
+		return -1;
+
+	if (name[0] == '*' && name[1] == '.' && name[2] && !strchr(name + 2, '*')) {
+		passsite_label_t *n = passsite_label_get(idx, name + 2);
+		if (!n)
+			return -1;
+		if (!n->wildcard && !(n->wildcard = passsite_filter_new()))
+			return -1;
+		if (passsite_filter_add(n->wildcard, ps) == -1)
+			return -1;
+	}
+
+	idx->count++;
+	return 0;
+}
+
+/*
+ * Same semantics as the PassSite filter fields: no filter or * without
+ * keyword always match; client ip filters match the src address; user and
+ * keyword filters require user auth, keywords match the user description.
+ */
+static passsite_t *
+passsite_filter_match(passsite_filter_t *f, const char *ip, const char *user,
+                      const char *desc, int user_auth)
+{
+	if (f->any)
+		return f->any;
+
+	if (ip && f->ips) {
+		khiter_t k = kh_get(psip_t, f->ips, ip);
+		if (k != kh_end(f->ips))
+			return kh_val(f->ips, k);
+	}
+
+	if (!user_auth)
+		return NULL;
+
+	if (desc) {
+		for (passsite_list_t *l = f->all; l; l = l->next) {
+			if (strcasestr(desc, l->ps->keyword))
+				return l->ps;
+		}
+	}
+
+	if (user && f->users) {
+		khiter_t k = kh_get(psuser_t, f->users, user);
+		if (k != kh_end(f->users)) {
+			for (passsite_list_t *l = kh_val(f->users, k); l; l = l->next) {
+				if (!l->ps->keyword || (desc && strcasestr(desc, l->ps->keyword)))
+					return l->ps;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Match a single name of length len, which need not be null-terminated.
+ * Returns the matching PassSite, or NULL.
+ */
+passsite_t *
+passsite_index_match(passsite_index_t *idx, const char *name, size_t len,
+                     const char *ip, const char *user, const char *desc,
+                     int user_auth)
+{
+	char buf[PASSSITE_NAME_MAX + 1];
+	passsite_t *ps;
+
+	if (!len || len > PASSSITE_NAME_MAX)
+		return NULL;
+	memcpy(buf, name, len);
+	buf[len] = '\0';
+
+	khiter_t k = kh_get(pssite_t, idx->exact, buf);
+	if (k != kh_end(idx->exact)) {
+		ps = passsite_filter_match(kh_val(idx->exact, k), ip, user, desc, user_auth);
+		if (ps)
+			return ps;
+	}
+
+	// Walk the reversed labels down to the leftmost one, which a wildcard stands for
+	passsite_label_t *n = idx->root;
+	char *end = buf + len;
+	while (n->children) {
+		char *dot = end;
+		while (dot > buf && *(dot - 1) != '.')
+			dot--;
+		if (dot == buf)
+			break;
+
+		k = kh_get(pslabel_t, n->children, dot);
+		if (k == kh_end(n->children))
+			return NULL;
+		n = kh_val(n->children, k);
+
+		end = dot - 1;
+		*end = '\0';
+		if (end == buf)
+			return NULL;
+		if (n->wildcard && !memchr(buf, '.', end - buf)) {
+			return passsite_filter_match(n->wildcard, ip, user, desc, user_auth);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Match the SNI and the slash separated common names, in that order.
+ */
+passsite_t *
+passsite_index_match_names(passsite_index_t *idx, const char *sni,
+                           const char *names, const char *ip,
+                           const char *user, const char *desc, int user_auth)
+{
+	passsite_t *ps;
+
+	if (sni && (ps = passsite_index_match(idx, sni, strlen(sni), ip, user, desc, user_auth)))
+		return ps;
+
+	if (!names)
+		return NULL;
+
+	const char *p = names;
+	while (*p) {
+		const char *q = strchr(p, '/');
+		size_t len = q ? (size_t)(q - p) : strlen(p);
+		if (len && (ps = passsite_index_match(idx, p, len, ip, user, desc, user_auth)))
+			return ps;
+		if (!q)
+			break;
+		p = q + 1;
+	}
+	return NULL;
+}
+
+/* vim: set noet ft=c: */
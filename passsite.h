@@ -0,0 +1,63 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PASSSITE_H
+#define PASSSITE_H
+
+#include "attrib.h"
+
+#include <stddef.h>
+
+typedef struct passsite {
+	char *site;
+	// Filter definition fields
+	char *ip;
+	char *user;
+	unsigned int all : 1; /* 1 for all users */
+	char *keyword;
+	struct passsite *next;
+} passsite_t;
+
+typedef struct passsite_index passsite_index_t;
+
+passsite_index_t *passsite_index_new(void) MALLOC;
+void passsite_index_free(passsite_index_t *) NONNULL(1);
+int passsite_index_add(passsite_index_t *, passsite_t *) NONNULL(1,2) WUNRES;
+size_t passsite_index_count(passsite_index_t *) NONNULL(1) WUNRES;
+passsite_t *passsite_index_match(passsite_index_t *, const char *, size_t,
+                                 const char *, const char *, const char *,
+                                 int) NONNULL(1,2) WUNRES;
+passsite_t *passsite_index_match_names(passsite_index_t *, const char *,
+                                       const char *, const char *,
+                                       const char *, const char *,
+                                       int) NONNULL(1) WUNRES;
+
+#endif /* !PASSSITE_H */
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,139 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "opts.h"
+#include "passsite.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+static opts_t *
+passsite_opts(int user_auth, const char *sites[])
+{
+	opts_t *opts = opts_new();
+	opts->user_auth = user_auth;
+	for (const char **p = sites; *p; p++) {
+		char *s = strdup(*p);
+		opts_set_pass_site(opts, s, 0);
+		free(s);
+	}
+	return opts;
+}
+
+#define MATCH(opts, sni, names, ip, user, desc) \
+	passsite_index_match_names((opts)->passsite_index, sni, names, ip, user, desc, (opts)->user_auth)
+
+START_TEST(passsite_match_01)
+{
+	const char *sites[] = {"example.com", "example.org", NULL};
+	opts_t *opts = passsite_opts(0, sites);
+
+	fail_unless(passsite_index_count(opts->passsite_index) == 2, "count not 2");
+	fail_unless(!!MATCH(opts, "example.com", NULL, NULL, NULL, NULL), "sni not matched");
+	fail_unless(!!MATCH(opts, NULL, "example.org", NULL, NULL, NULL), "single name not matched");
+	fail_unless(!!MATCH(opts, NULL, "example.org/www.example.net", NULL, NULL, NULL), "first name not matched");
+	fail_unless(!!MATCH(opts, NULL, "a.net/example.org/www.example.net", NULL, NULL, NULL), "middle name not matched");
+	fail_unless(!!MATCH(opts, NULL, "a.net/example.com", NULL, NULL, NULL), "last name not matched");
+	fail_unless(!MATCH(opts, "www.example.com", "example.co/xample.com/example.com.tr", NULL, NULL, NULL), "partial name matched");
+	fail_unless(!MATCH(opts, NULL, NULL, NULL, NULL, NULL), "no names matched");
+
+	opts_free(opts);
+}
+END_TEST
+
+START_TEST(passsite_match_02)
+{
+	const char *sites[] = {"*.example.com", NULL};
+	opts_t *opts = passsite_opts(0, sites);
+
+	fail_unless(!!MATCH(opts, "www.example.com", NULL, NULL, NULL, NULL), "wildcard sni not matched");
+	fail_unless(!!MATCH(opts, NULL, "a.net/mail.example.com", NULL, NULL, NULL), "wildcard name not matched");
+	fail_unless(!!MATCH(opts, NULL, "*.example.com", NULL, NULL, NULL), "literal wildcard name not matched");
+	fail_unless(!MATCH(opts, "example.com", NULL, NULL, NULL, NULL), "wildcard matched base domain");
+	fail_unless(!MATCH(opts, "a.b.example.com", NULL, NULL, NULL, NULL), "wildcard matched two labels");
+	fail_unless(!MATCH(opts, ".example.com", NULL, NULL, NULL, NULL), "wildcard matched empty label");
+	fail_unless(!MATCH(opts, "www.example.org", NULL, NULL, NULL, NULL), "wildcard matched other domain");
+
+	opts_free(opts);
+}
+END_TEST
+
+START_TEST(passsite_match_03)
+{
+	const char *sites[] = {"example.com 192.168.0.1", NULL};
+	opts_t *opts = passsite_opts(0, sites);
+
+	passsite_t *ps = MATCH(opts, "example.com", NULL, "192.168.0.1", NULL, NULL);
+	fail_unless(!!ps, "ip not matched");
+	fail_unless(!strcmp(ps->ip, "192.168.0.1"), "wrong passsite matched");
+	fail_unless(!MATCH(opts, "example.com", NULL, "192.168.0.2", NULL, NULL), "other ip matched");
+	fail_unless(!MATCH(opts, "example.com", NULL, NULL, NULL, NULL), "null ip matched");
+
+	opts_free(opts);
+}
+END_TEST
+
+START_TEST(passsite_match_04)
+{
+	const char *sites[] = {"example.com root", "example.com root admin", "*.example.org * guest", NULL};
+	opts_t *opts = passsite_opts(1, sites);
+
+	fail_unless(!!MATCH(opts, "example.com", NULL, NULL, "root", NULL), "user not matched");
+	fail_unless(!MATCH(opts, "example.com", NULL, NULL, "daemon", "admin"), "other user matched");
+	fail_unless(!MATCH(opts, "www.example.org", NULL, NULL, "daemon", NULL), "keyword matched without desc");
+	fail_unless(!!MATCH(opts, "www.example.org", NULL, NULL, "daemon", "Guest account"), "keyword not matched");
+
+	opts->user_auth = 0;
+	fail_unless(!MATCH(opts, "example.com", NULL, NULL, "root", NULL), "user matched without user auth");
+
+	opts_free(opts);
+}
+END_TEST
+
+Suite *
+passsite_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("passsite");
+
+	tc = tcase_create("passsite_match");
+	tcase_add_test(tc, passsite_match_01);
+	tcase_add_test(tc, passsite_match_02);
+	tcase_add_test(tc, passsite_match_03);
+	tcase_add_test(tc, passsite_match_04);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,121 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+/*
+ * ABI of in-process analysis plugins, loaded with the Plugin option.
+ *
+ * This header is all a plugin needs, besides the libevent evbuffer API; it
+ * does not depend on any other sslproxy header.  A plugin is a shared object
+ * exporting a function named SSLPROXY_PLUGIN_INIT of type
+ * sslproxy_plugin_init_t.  sslproxy calls it once after loading the plugin,
+ * with a zeroed sslproxy_plugin_t whose abi field is set to the ABI version
+ * sslproxy was built with, and the argument given after the path in the
+ * Plugin option, or NULL.  The init function checks the ABI version, fills
+ * in the callbacks it implements and returns 0, or returns -1 to abort
+ * startup.  It runs before sslproxy forks and drops privileges, so it must
+ * not start threads; open files there, not in the conn callbacks.  Plugins
+ * are only loaded at startup: a config reload may use the plugins loaded
+ * with the same path and argument, but is refused if it names a new one.
+ *
+ * The conns of the proxyspecs with a plugin are relayed between the client
+ * and the server directly, instead of through the listening program.  The
+ * conn callbacks run on the worker thread of the conn, so callbacks for
+ * different conns run concurrently; the per-conn state returned by conn_open
+ * is only ever accessed by one thread at a time.  Callbacks must not block.
+ *
+ * Fields are only ever appended to the structs below, and the ABI version is
+ * bumped on any incompatible change.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+struct evbuffer;
+
+#define SSLPROXY_PLUGIN_ABI	1
+#define SSLPROXY_PLUGIN_INIT	"sslproxy_plugin_init"
+
+/*
+ * Conn info passed to conn_open, valid during the call only.
+ */
+typedef struct sslproxy_plugin_conn {
+	// Unique id of the conn, and index of its worker thread
+	unsigned long long id;
+	int thridx;
+	// Proto of the proxyspec: tcp, ssl, http, https, pop3, pop3s, smtp, smtps
+	const char *proto;
+	// Original client and server addresses
+	const struct sockaddr *srcaddr;
+	socklen_t srcaddrlen;
+	const struct sockaddr *dstaddr;
+	socklen_t dstaddrlen;
+	// Server name indicated by the client, NULL if none
+	const char *sni;
+	// Authenticated user of the conn, NULL if none
+	const char *user;
+} sslproxy_plugin_conn_t;
+
+typedef struct sslproxy_plugin {
+	// ABI version sslproxy was built with, set before init is called
+	unsigned int abi;
+	// Name of the plugin for log messages, defaults to the path
+	const char *name;
+	// Global plugin state, passed to conn_open and fini
+	void *arg;
+
+	// A conn is connected to the server.  Sets *connarg to the per-conn
+	// state passed to the other conn callbacks.  Returns 0 to relay the
+	// conn, -1 to close it.
+	int (*conn_open)(void *arg, const sslproxy_plugin_conn_t *conn, void **connarg);
+
+	// Data is read on the conn, from the client if req is 1, from the
+	// server otherwise.  in holds the data read and not consumed yet, out
+	// is the output buffer of the other end.  Move the data to relay from
+	// in to out, e.g. all of it with evbuffer_add_buffer(out, in), which
+	// does not copy; drain or rewrite it to drop or modify it.  Data left
+	// in in is passed again along with the next data read.  Returns 0, or
+	// -1 to close the conn.  If NULL, all data is relayed as is.
+	int (*conn_data)(void *connarg, int req, struct evbuffer *in, struct evbuffer *out);
+
+	// The conn is closed, free the per-conn state.  Called for each conn
+	// conn_open has returned 0 for.
+	void (*conn_close)(void *connarg);
+
+	// sslproxy exits, free the global state
+	void (*fini)(void *arg);
+} sslproxy_plugin_t;
+
+typedef int (*sslproxy_plugin_init_t)(sslproxy_plugin_t *, const char *);
+
+#endif /* !PLUGIN_H */
+
+/* vim: set noet ft=c: */
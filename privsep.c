@@ -68,6 +68,9 @@
 #define PRIVSEP_REQ_CERTFILE	4	/* open cert file in certgendir */
 #define PRIVSEP_REQ_OPENSOCK_CHILD	5	/* open child socket and pass fd */
 #define PRIVSEP_REQ_UPDATE_ATIME	6	/* update ip,user atime */
+#define PRIVSEP_REQ_SNAPFILE	7	/* open tmp cache snapshot file */
+#define PRIVSEP_REQ_SNAPFILE_DONE	8	/* rename tmp cache snapshot file */
+#define PRIVSEP_REQ_RELOAD	9	/* parse config for reload, pass pipe */
 /* response byte */
 #define PRIVSEP_ANS_SUCCESS	0	/* success */
 #define PRIVSEP_ANS_UNK_CMD	1	/* unknown command */
@@ -84,6 +87,9 @@
  * will not actually send any privsep requests to the parent process. */
 static int privsep_fastpath;
 
+/* parses the config for a reload, see privsep_set_reload_cb() */
+static privsep_reload_cb_t privsep_reloadcb;
+
 /* communication with signal handler */
 static volatile sig_atomic_t received_sighup;
 static volatile sig_atomic_t received_sigint;
@@ -91,6 +97,7 @@ static volatile sig_atomic_t received_sigquit;
 static volatile sig_atomic_t received_sigterm;
 static volatile sig_atomic_t received_sigchld;
 static volatile sig_atomic_t received_sigusr1;
+static volatile sig_atomic_t received_sigusr2;
 /* write end of pipe used for unblocking select */
 static volatile sig_atomic_t selfpipe_wrfd;
 
@@ -124,6 +131,9 @@ privsep_server_signal_handler(int sig)
 	case SIGUSR1:
 		received_sigusr1 = 1;
 		break;
+	case SIGUSR2:
+		received_sigusr2 = 1;
+		break;
 	}
 	if (selfpipe_wrfd != -1) {
 		ssize_t n;
@@ -378,6 +388,110 @@ privsep_server_certfile(const char *fn)
 	return fd;
 }
 
+static int WUNRES
+privsep_server_snapfile_verify(global_t *global, const char *fn)
+{
+	/* Only the configured cache snapshot file */
+	if (!global->cachesnap || strcmp(fn, global->cachesnap))
+		return -1;
+	return 0;
+}
+
+/*
+ * Open a fresh fn.tmp for writing a cache snapshot, or if done, rename it to
+ * fn.  Returns the fd, or 0 if done, and -1 on error.
+ */
+static int WUNRES
+privsep_server_snapfile(const char *fn, int done)
+{
+	char tmpfn[strlen(fn) + 5];
+	int fd;
+
+	snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", fn);
+	if (done) {
+		if (rename(tmpfn, fn) == -1) {
+			log_err_level_printf(LOG_CRIT, "Failed to rename '%s': %s (%i)\n",
+			               tmpfn, strerror(errno), errno);
+			return -1;
+		}
+		return 0;
+	}
+
+	/* the snapshot may contain the leaf key */
+	unlink(tmpfn);
+	fd = open(tmpfn, O_WRONLY|O_CREAT|O_EXCL, 0600);
+	if (fd == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to open '%s': %s (%i)\n",
+		               tmpfn, strerror(errno), errno);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Fork a process to parse the config for a reload, which runs the reload
+ * callback with the privileges and outside the chroot of this process, and
+ * writes the result to a pipe.  The process is forked from an intermediate
+ * process exiting right away, so that it does not need to be waited for, and
+ * its exit does not end the monitor loop, see privsep_server().
+ * Returns the read end of the pipe, or -1 on error.
+ */
+static int WUNRES
+privsep_server_reload(global_t *global)
+{
+	int pipev[2];
+	pid_t pid;
+	int status;
+
+	if (!privsep_reloadcb) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	if (pipe(pipev) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to create reload pipe: %s (%i)\n",
+		               strerror(errno), errno);
+		return -1;
+	}
+	pid = fork();
+	if (pid == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to fork: %s (%i)\n",
+		               strerror(errno), errno);
+		close(pipev[0]);
+		close(pipev[1]);
+		return -1;
+	} else if (pid == 0) {
+		close(pipev[0]);
+		pid = fork();
+		if (pid == 0) {
+			selfpipe_wrfd = -1;
+			signal(SIGHUP, SIG_DFL);
+			signal(SIGINT, SIG_DFL);
+			signal(SIGTERM, SIG_DFL);
+			signal(SIGQUIT, SIG_DFL);
+			signal(SIGUSR1, SIG_DFL);
+			signal(SIGUSR2, SIG_DFL);
+			signal(SIGCHLD, SIG_DFL);
+			_exit(privsep_reloadcb(global, pipev[1]) == -1 ?
+			      EXIT_FAILURE : EXIT_SUCCESS);
+		}
+		_exit(pid == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+	close(pipev[1]);
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			status = -1;
+			break;
+		}
+	}
+	if (status != 0) {
+		log_err_level_printf(LOG_CRIT, "Failed to fork reload process\n");
+		close(pipev[0]);
+		errno = ECHILD;
+		return -1;
+	}
+	return pipev[0];
+}
+
 static int WUNRES
 privsep_server_update_atime(global_t *global, const userdbkeys_t *keys)
 {
@@ -413,6 +527,7 @@ privsep_server_handle_req(global_t *global, int srvsock)
 	char ans[PRIVSEP_MAX_ANS_SIZE];
 	ssize_t n;
 	int mkpath = 0;
+	int done = 0;
 
 	if ((n = sys_recvmsgfd(srvsock, req, sizeof(req),
 	                       NULL)) == -1) {
@@ -620,6 +735,100 @@ privsep_server_handle_req(global_t *global, int srvsock)
 		/* not reached */
 		break;
 	}
+	case PRIVSEP_REQ_RELOAD: {
+		int fd;
+
+		if ((fd = privsep_server_reload(global)) == -1) {
+			ans[0] = PRIVSEP_ANS_SYS_ERR;
+			*((int*)&ans[1]) = errno;
+			if (sys_sendmsgfd(srvsock, ans, 1 + sizeof(int),
+			                  -1) == -1) {
+				log_err_level_printf(LOG_CRIT, "Sending message failed: %s (%i"
+				               ")\n", strerror(errno), errno);
+				return -1;
+			}
+			return 0;
+		} else {
+			ans[0] = PRIVSEP_ANS_SUCCESS;
+			if (sys_sendmsgfd(srvsock, ans, 1, fd) == -1) {
+				close(fd);
+				log_err_level_printf(LOG_CRIT, "Sending message failed: %s (%i"
+				               ")\n", strerror(errno), errno);
+				return -1;
+			}
+			close(fd);
+			return 0;
+		}
+		/* not reached */
+		break;
+	}
+	case PRIVSEP_REQ_SNAPFILE_DONE:
+		done = 1;
+		/* fall through */
+	case PRIVSEP_REQ_SNAPFILE: {
+		char *fn;
+		int fd;
+
+		if (n < 2) {
+			ans[0] = PRIVSEP_ANS_INVALID;
+			if (sys_sendmsgfd(srvsock, ans, 1, -1) == -1) {
+				log_err_level_printf(LOG_CRIT, "Sending message failed: %s (%i"
+				               ")\n", strerror(errno), errno);
+				return -1;
+			}
+			return 0;
+		}
+		if (!(fn = malloc(n))) {
+			ans[0] = PRIVSEP_ANS_SYS_ERR;
+			*((int*)&ans[1]) = errno;
+			if (sys_sendmsgfd(srvsock, ans, 1 + sizeof(int),
+			                  -1) == -1) {
+				log_err_level_printf(LOG_CRIT, "Sending message failed: %s (%i"
+				               ")\n", strerror(errno), errno);
+				return -1;
+			}
+			return 0;
+		}
+		memcpy(fn, req + 1, n - 1);
+		fn[n - 1] = '\0';
+		if (privsep_server_snapfile_verify(global, fn) == -1) {
+			free(fn);
+			ans[0] = PRIVSEP_ANS_DENIED;
+			if (sys_sendmsgfd(srvsock, ans, 1, -1) == -1) {
+				log_err_level_printf(LOG_CRIT, "Sending message failed: %s (%i"
+				               ")\n", strerror(errno), errno);
+				return -1;
+			}
+			return 0;
+		}
+		if ((fd = privsep_server_snapfile(fn, done)) == -1) {
+			free(fn);
+			ans[0] = PRIVSEP_ANS_SYS_ERR;
+			*((int*)&ans[1]) = errno;
+			if (sys_sendmsgfd(srvsock, ans, 1 + sizeof(int),
+			                  -1) == -1) {
+				log_err_level_printf(LOG_CRIT, "Sending message failed: %s (%i"
+				               ")\n", strerror(errno), errno);
+				return -1;
+			}
+			return 0;
+		} else {
+			free(fn);
+			ans[0] = PRIVSEP_ANS_SUCCESS;
+			if (sys_sendmsgfd(srvsock, ans, 1, done ? -1 : fd) == -1) {
+				if (!done)
+					close(fd);
+				log_err_level_printf(LOG_CRIT, "Sending message failed: %s (%i"
+				               ")\n", strerror(errno), errno);
+				return -1;
+			}
+			if (!done)
+				close(fd);
+			return 0;
+		}
+		/* not reached */
+		break;
+	}
 	case PRIVSEP_REQ_CERTFILE: {
 		char *fn;
 		int fd;
@@ -701,11 +910,12 @@ privsep_server_handle_req(global_t *global, int srvsock)
  * Caller is responsible for freeing memory after returning, if necessary.
  * childpid is the pid of the child process to forward signals to.
  *
- * Returns 0 on a successful clean exit and -1 on errors.
+ * Returns 0 on a successful clean exit, after the child process has exited
+ * and its status has been stored in childstatus, and -1 on errors.
  */
 static int
 privsep_server(global_t *global, int sigpipe, int srvsock[], size_t nsrvsock,
-               pid_t childpid)
+               pid_t childpid, int *childstatus)
 {
 	int srveof[nsrvsock];
 	size_t i = 0;
@@ -793,6 +1003,15 @@ privsep_server(global_t *global, int sigpipe, int srvsock[], size_t nsrvsock,
 				}
 				received_sigusr1 = 0;
 			}
+			if (received_sigusr2) {
+				if (kill(childpid, SIGUSR2) == -1) {
+					log_err_level_printf(LOG_CRIT, "kill(%i,SIGUSR2) "
+					               "failed: %s (%i)\n",
+					               childpid,
+					               strerror(errno), errno);
+				}
+				received_sigusr2 = 0;
+			}
 			if (received_sigint) {
 				/* if we don't detach from the TTY, the
 				 * child process receives SIGINT directly */
@@ -814,8 +1033,13 @@ privsep_server(global_t *global, int sigpipe, int srvsock[], size_t nsrvsock,
 				 * on the disconnected socket ends here
 				 * unless we attempt to write or read, so
 				 * we depend on SIGCHLD to notify us of
-				 * our child erroring out or crashing */
-				break;
+				 * our child erroring out or crashing;
+				 * the intermediate reload processes exit
+				 * too, so check that it was the child */
+				received_sigchld = 0;
+				if (waitpid(childpid, childstatus,
+				            WNOHANG) == childpid)
+					break;
 			}
 		}
 
@@ -1046,6 +1270,61 @@ privsep_client_certfile(int clisock, const char *fn)
 	return fd;
 }
 
+/*
+ * Open a fresh temporary file for writing the cache snapshot fn, or if done,
+ * move the written temporary file to fn.  Returns the fd, or 0 if done, and
+ * -1 on error.
+ */
+int
+privsep_client_snapfile(int clisock, const char *fn, int done)
+{
+	char ans[PRIVSEP_MAX_ANS_SIZE];
+	char req[1 + strlen(fn)];
+	int fd = -1;
+	ssize_t n;
+
+	if (privsep_fastpath)
+		return privsep_server_snapfile(fn, done);
+
+	req[0] = done ? PRIVSEP_REQ_SNAPFILE_DONE : PRIVSEP_REQ_SNAPFILE;
+	memcpy(req + 1, fn, sizeof(req) - 1);
+
+	if (sys_sendmsgfd(clisock, req, sizeof(req), -1) == -1) {
+		return -1;
+	}
+
+	if ((n = sys_recvmsgfd(clisock, ans, sizeof(ans), done ? NULL : &fd)) == -1) {
+		return -1;
+	}
+
+	if (n < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	switch (ans[0]) {
+	case PRIVSEP_ANS_SUCCESS:
+		break;
+	case PRIVSEP_ANS_DENIED:
+		errno = EACCES;
+		return -1;
+	case PRIVSEP_ANS_SYS_ERR:
+		if (n < (ssize_t)(1 + sizeof(int))) {
+			errno = EINVAL;
+			return -1;
+		}
+		errno = *((int*)&ans[1]);
+		return -1;
+	case PRIVSEP_ANS_UNK_CMD:
+	case PRIVSEP_ANS_INVALID:
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	return done ? 0 : fd;
+}
+
 int
 privsep_client_close(int clisock)
 {
@@ -1062,6 +1341,69 @@ privsep_client_close(int clisock)
 	return 0;
 }
 
+/*
+ * Set the callback which parses the config for a reload, see
+ * privsep_server_reload().  It writes the config to fd, and closes it.
+ */
+void
+privsep_set_reload_cb(privsep_reload_cb_t cb)
+{
+	privsep_reloadcb = cb;
+}
+
+/*
+ * Have the parent parse the config for a reload.  Unlike the other requests,
+ * this is never served in the client process, since the config is parsed
+ * with the privileges and outside the chroot of the parent, even if those
+ * are the same as the ones of the child.
+ * Returns the fd to read the config from, see global_reload_read(), or -1.
+ */
+int
+privsep_client_reload(int clisock)
+{
+	char ans[PRIVSEP_MAX_ANS_SIZE];
+	char req[1];
+	int fd = -1;
+	ssize_t n;
+
+	req[0] = PRIVSEP_REQ_RELOAD;
+
+	if (sys_sendmsgfd(clisock, req, sizeof(req), -1) == -1) {
+		return -1;
+	}
+
+	if ((n = sys_recvmsgfd(clisock, ans, sizeof(ans), &fd)) == -1) {
+		return -1;
+	}
+
+	if (n < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	switch (ans[0]) {
+	case PRIVSEP_ANS_SUCCESS:
+		break;
+	case PRIVSEP_ANS_DENIED:
+		errno = EACCES;
+		return -1;
+	case PRIVSEP_ANS_SYS_ERR:
+		if (n < (ssize_t)(1 + sizeof(int))) {
+			errno = EINVAL;
+			return -1;
+		}
+		errno = *((int*)&ans[1]);
+		return -1;
+	case PRIVSEP_ANS_UNK_CMD:
+	case PRIVSEP_ANS_INVALID:
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	return fd;
+}
+
 int
 privsep_client_update_atime(int clisock, const userdbkeys_t *keys)
 {
@@ -1139,6 +1481,7 @@ privsep_fork(global_t *global, int clisock[], size_t nclisock, int *parent_rv)
 	received_sigint = 0;
 	received_sigchld = 0;
 	received_sigusr1 = 0;
+	received_sigusr2 = 0;
 
 	if (pipe(selfpipev) == -1) {
 		log_err_level_printf(LOG_CRIT, "Failed to create self-pipe: %s (%i)\n",
@@ -1240,6 +1583,11 @@ privsep_fork(global_t *global, int clisock[], size_t nclisock, int *parent_rv)
 		               strerror(errno), errno);
 		return -1;
 	}
+	if (signal(SIGUSR2, privsep_server_signal_handler) == SIG_ERR) {
+		log_err_level_printf(LOG_CRIT, "Failed to install SIGUSR2 handler: %s (%i)\n",
+		               strerror(errno), errno);
+		return -1;
+	}
 	if (signal(SIGCHLD, privsep_server_signal_handler) == SIG_ERR) {
 		log_err_level_printf(LOG_CRIT, "Failed to install SIGCHLD handler: %s (%i)\n",
 		               strerror(errno), errno);
@@ -1253,9 +1601,13 @@ privsep_fork(global_t *global, int clisock[], size_t nclisock, int *parent_rv)
 	int socksrv[nclisock];
 	for (size_t i = 0; i < nclisock; i++)
 		socksrv[i] = sockcliv[i][0];
-	if (privsep_server(global, selfpipev[0], socksrv, nclisock, pid) == -1) {
+	int status;
+	pid_t wpid = pid;
+	if (privsep_server(global, selfpipev[0], socksrv, nclisock, pid,
+	                   &status) == -1) {
 		log_err_level_printf(LOG_CRIT, "Privsep server failed: %s (%i)\n",
 		               strerror(errno), errno);
+		wpid = -1;
 		/* fall through */
 	}
 #ifdef DEBUG_PRIVSEP_SERVER
@@ -1268,9 +1620,8 @@ privsep_fork(global_t *global, int clisock[], size_t nclisock, int *parent_rv)
 	close(selfpipev[0]);
 	close(selfpipev[1]);
 
-	int status;
-	pid_t wpid;
-	wpid = wait(&status);
+	if (wpid == -1)
+		wpid = waitpid(pid, &status, 0);
 	if (wpid != pid) {
 		/* should never happen, warn if it does anyway */
 		log_err_printf("Child pid %lld != expected %lld from wait(2)\n",
@@ -32,7 +32,13 @@
 #include "attrib.h"
 #include "opts.h"
 
+/*
+ * Parses the config for a reload and writes it to the fd, see privsep.c.
+ */
+typedef int (*privsep_reload_cb_t)(global_t *, int);
+
 int privsep_fork(global_t *, int[], size_t, int *);
+void privsep_set_reload_cb(privsep_reload_cb_t);
 
 int privsep_client_openfile(int, const char *, int);
 int privsep_client_opensock(int, const proxyspec_t *spec);
@@ -40,6 +46,8 @@ int privsep_client_opensock_child(int, const proxyspec_t *spec);
 int privsep_client_certfile(int, const char *);
 int privsep_client_close(int);
 int privsep_client_update_atime(int, const userdbkeys_t *);
+int privsep_client_snapfile(int, const char *, int);
+int privsep_client_reload(int);
 #endif /* !PRIVSEP_H */
 
 /* vim: set noet ft=c: */
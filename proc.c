@@ -43,6 +43,27 @@
 #include <arpa/inet.h>
 #endif /* __FreeBSD__ */
 
+#ifdef __linux__
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#endif /* __linux__ */
+
 #include "proc.h"
 
 #include "log.h"
@@ -57,6 +78,10 @@
 #include <libproc.h>
 #endif /* HAVE_DARWIN_LIBPROC */
 
+#ifdef __linux__
+#include "khash.h"
+#endif /* __linux__ */
+
 
 /*
  * Local process lookup.
@@ -456,6 +481,509 @@ proc_darwin_get_info(pid_t pid, char **path, uid_t *uid, gid_t *gid) {
 
 #endif /* HAVE_DARWIN_LIBPROC */
 
+#ifdef __linux__
+
+/*
+ * Linux: the socket inode of a connection is looked up by its source address
+ * with NETLINK_SOCK_DIAG, and mapped to the owning process using a cache of
+ * socket inodes filled from /proc/<pid>/fd.
+ *
+ * On a cache miss, the fd dirs of the processes which owned recently looked
+ * up sockets are scanned first, then the processes reported as forked or
+ * exec'd by the proc connector, if it is available (it needs CAP_NET_ADMIN),
+ * and finally all processes of the socket owner.  The full scan resumes where
+ * the previous one left off, and all scans of one lookup stop after
+ * PROC_LINUX_SCAN_BUDGET ms, in which case the lookup fails.  Entries not seen
+ * during the last two full scans are purged.
+ *
+ * Not thread-safe; only the local process lookup thread calls these.
+ *
+ * key: uint64_t             socket inode
+ * val: proc_linux_inode_t   owning pid and scan generation
+ */
+
+#define PROC_LINUX_SCAN_BUDGET 50
+#define PROC_LINUX_MAX_INODES 65536
+#define PROC_LINUX_HOT_PIDS 16
+#define PROC_LINUX_NEW_PIDS 64
+#define PROC_LINUX_MAX_CANDIDATES 4
+
+typedef struct proc_linux_inode {
+	pid_t pid;
+	unsigned int gen;
+} proc_linux_inode_t;
+
+KHASH_MAP_INIT_INT64(inode_t, proc_linux_inode_t)
+
+static khash_t(inode_t) *proc_linux_inodes;
+static unsigned int proc_linux_gen = 1;
+static DIR *proc_linux_scan_dir;
+
+// Owners of recently looked up sockets, most recent first
+static pid_t proc_linux_hot_pids[PROC_LINUX_HOT_PIDS];
+// Forked or exec'd processes reported by the proc connector since the last miss
+static pid_t proc_linux_new_pids[PROC_LINUX_NEW_PIDS];
+static unsigned int proc_linux_new_pid_count;
+
+static int proc_linux_diag_fd = -1;
+// -1 if not opened yet, -2 if not available
+static int proc_linux_cn_fd = -1;
+
+static long long
+proc_linux_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+proc_linux_add_inode(uint64_t inode, pid_t pid)
+{
+	khiter_t k;
+	int ret;
+
+	if (kh_size(proc_linux_inodes) >= PROC_LINUX_MAX_INODES) {
+		kh_clear(inode_t, proc_linux_inodes);
+	}
+	k = kh_put(inode_t, proc_linux_inodes, inode, &ret);
+	if (ret == -1)
+		return;
+	kh_val(proc_linux_inodes, k).pid = pid;
+	kh_val(proc_linux_inodes, k).gen = proc_linux_gen;
+}
+
+/*
+ * Purge the entries not seen during the last two full scans.
+ */
+static void
+proc_linux_purge_inodes(void)
+{
+	for (khiter_t k = kh_begin(proc_linux_inodes); k != kh_end(proc_linux_inodes); ++k) {
+		if (kh_exist(proc_linux_inodes, k) && kh_val(proc_linux_inodes, k).gen + 1 < proc_linux_gen) {
+			kh_del(inode_t, proc_linux_inodes, k);
+		}
+	}
+}
+
+/*
+ * Add the socket inodes of the process to the cache.
+ * Returns 1 if one of them is the inode looked for, 0 otherwise.
+ */
+static int
+proc_linux_scan_pid(pid_t pid, const uint64_t *inodes, int ninodes)
+{
+	char path[64], link[64];
+	struct dirent *de;
+	int dfd, found = 0;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+	if (!(dir = opendir(path)))
+		return 0;
+	dfd = dirfd(dir);
+	while ((de = readdir(dir))) {
+		unsigned long long inode;
+		ssize_t n;
+
+		if (de->d_name[0] == '.')
+			continue;
+		n = readlinkat(dfd, de->d_name, link, sizeof(link) - 1);
+		if (n <= 0)
+			continue;
+		link[n] = '\0';
+		if (sscanf(link, "socket:[%llu]", &inode) != 1)
+			continue;
+		proc_linux_add_inode(inode, pid);
+		for (int i = 0; i < ninodes; i++) {
+			if (inodes[i] == inode)
+				found = 1;
+		}
+	}
+	closedir(dir);
+	return found;
+}
+
+static void
+proc_linux_add_hot_pid(pid_t pid)
+{
+	int i;
+
+	for (i = 0; i < PROC_LINUX_HOT_PIDS - 1; i++) {
+		if (proc_linux_hot_pids[i] == pid)
+			break;
+	}
+	memmove(&proc_linux_hot_pids[1], &proc_linux_hot_pids[0], i * sizeof(pid_t));
+	proc_linux_hot_pids[0] = pid;
+}
+
+/*
+ * Subscribe to fork and exec events of the proc connector.
+ * Failure is not an error, the lookups just do not get the hint then.
+ */
+static void
+proc_linux_open_cn(void)
+{
+	struct sockaddr_nl sa;
+	char req[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(enum proc_cn_mcast_op))] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh = (struct nlmsghdr *)req;
+	struct cn_msg *cn = NLMSG_DATA(nlh);
+	enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+	int fd;
+
+	fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (fd == -1)
+		goto out;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = CN_IDX_PROC;
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1)
+		goto out;
+
+	memset(req, 0, sizeof(req));
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*cn) + sizeof(op));
+	nlh->nlmsg_type = NLMSG_DONE;
+	cn->id.idx = CN_IDX_PROC;
+	cn->id.val = CN_VAL_PROC;
+	cn->len = sizeof(op);
+	memcpy(cn->data, &op, sizeof(op));
+	if (send(fd, req, nlh->nlmsg_len, 0) == -1)
+		goto out;
+
+	proc_linux_cn_fd = fd;
+	log_dbg_printf("Local process lookup uses proc connector events\n");
+	return;
+out:
+	log_dbg_printf("Local process lookup without proc connector events: %s (%i)\n",
+	               strerror(errno), errno);
+	if (fd != -1)
+		close(fd);
+	proc_linux_cn_fd = -2;
+}
+
+/*
+ * Collect the processes forked or exec'd since the last call.
+ */
+static void
+proc_linux_read_cn(void)
+{
+	char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+	ssize_t n;
+
+	while ((n = recv(proc_linux_cn_fd, buf, sizeof(buf), 0)) > 0) {
+		for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+			struct cn_msg *cn = NLMSG_DATA(nlh);
+			struct proc_event *ev = (struct proc_event *)cn->data;
+			pid_t pid;
+
+			if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*cn) + sizeof(*ev)))
+				continue;
+			if (ev->what == PROC_EVENT_FORK && ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid) {
+				pid = ev->event_data.fork.child_tgid;
+			} else if (ev->what == PROC_EVENT_EXEC) {
+				pid = ev->event_data.exec.process_tgid;
+			} else {
+				continue;
+			}
+			// Keep the most recent ones if there are too many
+			if (proc_linux_new_pid_count == PROC_LINUX_NEW_PIDS) {
+				memmove(&proc_linux_new_pids[0], &proc_linux_new_pids[1], (PROC_LINUX_NEW_PIDS - 1) * sizeof(pid_t));
+				proc_linux_new_pid_count--;
+			}
+			proc_linux_new_pids[proc_linux_new_pid_count++] = pid;
+		}
+	}
+}
+
+/*
+ * Find the inodes and owner uid of the TCP sockets with the given source
+ * address, using a socket dump filtered by source port in the kernel.  There
+ * may be more than one match, for example an outgoing conn of sslproxy itself
+ * bound to the same local port.
+ * Returns the number of inodes found, or -1 on error.
+ */
+static int
+proc_linux_diag_inodes(struct sockaddr *src_addr, uint64_t *inodes, uid_t *uid)
+{
+	struct sockaddr_nl sa;
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req_v2 req;
+		struct nlattr nla;
+		struct inet_diag_bc_op bc[4];
+	} msg;
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	unsigned char addr[16];
+	int family, addrlen, ninodes = 0;
+	unsigned short port;
+
+	if (src_addr->sa_family == AF_INET) {
+		struct sockaddr_in *sai = (struct sockaddr_in *)src_addr;
+		family = AF_INET;
+		addrlen = 4;
+		memcpy(addr, &sai->sin_addr, 4);
+		port = ntohs(sai->sin_port);
+	} else if (src_addr->sa_family == AF_INET6) {
+		struct sockaddr_in6 *sai = (struct sockaddr_in6 *)src_addr;
+		port = ntohs(sai->sin6_port);
+		if (IN6_IS_ADDR_V4MAPPED(&sai->sin6_addr)) {
+			// IPv4 client of an IPv6 listener
+			family = AF_INET;
+			addrlen = 4;
+			memcpy(addr, &sai->sin6_addr.s6_addr[12], 4);
+		} else {
+			family = AF_INET6;
+			addrlen = 16;
+			memcpy(addr, &sai->sin6_addr, 16);
+		}
+	} else {
+		return -1;
+	}
+
+	if (proc_linux_diag_fd == -1) {
+		proc_linux_diag_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+		if (proc_linux_diag_fd == -1) {
+			log_err_printf("Failed to open sock_diag socket: %s (%i)\n",
+			               strerror(errno), errno);
+			return -1;
+		}
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.nlh.nlmsg_len = sizeof(msg);
+	msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	msg.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	msg.req.sdiag_family = family;
+	msg.req.sdiag_protocol = IPPROTO_TCP;
+	msg.req.idiag_states = (1 << TCP_ESTABLISHED) | (1 << TCP_CLOSE_WAIT) | (1 << TCP_SYN_SENT);
+	// sport >= port && sport <= port, jumping past the end rejects
+	msg.nla.nla_len = NLA_HDRLEN + sizeof(msg.bc);
+	msg.nla.nla_type = INET_DIAG_REQ_BYTECODE;
+	msg.bc[0].code = INET_DIAG_BC_S_GE;
+	msg.bc[0].yes = 2 * sizeof(struct inet_diag_bc_op);
+	msg.bc[0].no = 4 * sizeof(struct inet_diag_bc_op) + 4;
+	msg.bc[1].no = port;
+	msg.bc[2].code = INET_DIAG_BC_S_LE;
+	msg.bc[2].yes = 2 * sizeof(struct inet_diag_bc_op);
+	msg.bc[2].no = 2 * sizeof(struct inet_diag_bc_op) + 4;
+	msg.bc[3].no = port;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (sendto(proc_linux_diag_fd, &msg, sizeof(msg), 0, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		log_err_printf("Failed to send sock_diag request: %s (%i)\n",
+		               strerror(errno), errno);
+		return -1;
+	}
+
+	for (;;) {
+		ssize_t n = recv(proc_linux_diag_fd, buf, sizeof(buf), 0);
+		if (n <= 0) {
+			log_err_printf("Failed to receive sock_diag reply: %s (%i)\n",
+			               strerror(errno), errno);
+			return -1;
+		}
+		for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+			struct inet_diag_msg *dm;
+
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return ninodes;
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(nlh);
+				log_err_printf("sock_diag error: %s (%i)\n",
+				               strerror(-err->error), -err->error);
+				return -1;
+			}
+			if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY ||
+			    nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*dm)))
+				continue;
+			dm = NLMSG_DATA(nlh);
+			if (ntohs(dm->id.idiag_sport) != port ||
+			    memcmp(dm->id.idiag_src, addr, addrlen) != 0 ||
+			    !dm->idiag_inode ||
+			    ninodes == PROC_LINUX_MAX_CANDIDATES)
+				continue;
+			*uid = dm->idiag_uid;
+			inodes[ninodes++] = dm->idiag_inode;
+		}
+	}
+}
+
+/*
+ * Look up the inodes in the cache, and return the pid of the first one cached
+ * which is not owned by sslproxy itself, or -1.
+ */
+static pid_t
+proc_linux_find_inodes(const uint64_t *inodes, int ninodes)
+{
+	pid_t self = getpid();
+
+	for (int i = 0; i < ninodes; i++) {
+		khiter_t k = kh_get(inode_t, proc_linux_inodes, inodes[i]);
+		if (k != kh_end(proc_linux_inodes) && kh_val(proc_linux_inodes, k).pid != self) {
+			return kh_val(proc_linux_inodes, k).pid;
+		}
+	}
+	return -1;
+}
+
+int
+proc_linux_pid_for_addr(pid_t *result, struct sockaddr *src_addr,
+                        UNUSED socklen_t src_addrlen)
+{
+	uint64_t inodes[PROC_LINUX_MAX_CANDIDATES];
+	long long deadline;
+	struct dirent *de;
+	uid_t uid = -1;
+	int ninodes;
+	pid_t pid;
+
+	*result = -1;
+
+	if (!proc_linux_inodes && !(proc_linux_inodes = kh_init(inode_t)))
+		return -1;
+	if (proc_linux_cn_fd == -1)
+		proc_linux_open_cn();
+
+	if ((ninodes = proc_linux_diag_inodes(src_addr, inodes, &uid)) <= 0)
+		return ninodes;
+
+	if ((pid = proc_linux_find_inodes(inodes, ninodes)) != -1)
+		goto found;
+
+	deadline = proc_linux_now_ms() + PROC_LINUX_SCAN_BUDGET;
+
+	for (int i = 0; i < PROC_LINUX_HOT_PIDS && proc_linux_hot_pids[i]; i++) {
+		proc_linux_scan_pid(proc_linux_hot_pids[i], inodes, ninodes);
+	}
+	if ((pid = proc_linux_find_inodes(inodes, ninodes)) != -1)
+		goto found;
+
+	if (proc_linux_cn_fd >= 0) {
+		proc_linux_read_cn();
+		for (unsigned int i = 0; i < proc_linux_new_pid_count; i++) {
+			proc_linux_scan_pid(proc_linux_new_pids[i], inodes, ninodes);
+		}
+		proc_linux_new_pid_count = 0;
+		if ((pid = proc_linux_find_inodes(inodes, ninodes)) != -1)
+			goto found;
+	}
+
+	// Resume the full scan, wrapping around once
+	for (int pass = 0; pass < 2; pass++) {
+		if (!proc_linux_scan_dir && !(proc_linux_scan_dir = opendir("/proc"))) {
+			log_err_printf("Failed to open /proc: %s (%i)\n",
+			               strerror(errno), errno);
+			return -1;
+		}
+		while ((de = readdir(proc_linux_scan_dir))) {
+			struct stat st;
+			char *end;
+
+			pid = strtol(de->d_name, &end, 10);
+			if (*end || pid <= 0)
+				continue;
+			// Only processes of the socket owner can own the socket
+			if (fstatat(dirfd(proc_linux_scan_dir), de->d_name, &st, 0) == -1 ||
+			    st.st_uid != uid)
+				continue;
+			if (proc_linux_scan_pid(pid, inodes, ninodes) &&
+			    (pid = proc_linux_find_inodes(inodes, ninodes)) != -1)
+				goto found;
+			if (proc_linux_now_ms() >= deadline) {
+				log_dbg_printf("Local process lookup over budget\n");
+				return 0;
+			}
+		}
+		closedir(proc_linux_scan_dir);
+		proc_linux_scan_dir = NULL;
+		proc_linux_gen++;
+		proc_linux_purge_inodes();
+	}
+	return 0;
+
+found:
+	proc_linux_add_hot_pid(pid);
+	*result = pid;
+	return 0;
+}
+
+int
+proc_linux_get_info(pid_t pid, char **path, uid_t *uid, gid_t *gid)
+{
+	char fn[64], buf[PATH_MAX];
+	ssize_t n;
+	FILE *f;
+
+	*path = NULL;
+	*uid = -1;
+	*gid = -1;
+
+	snprintf(fn, sizeof(fn), "/proc/%d/exe", (int)pid);
+	if ((n = readlink(fn, buf, sizeof(buf) - 1)) > 0) {
+		buf[n] = '\0';
+		*path = strdup(buf);
+	} else {
+		// No access to the exe link of processes of other users if not root
+		snprintf(fn, sizeof(fn), "/proc/%d/comm", (int)pid);
+		if ((f = fopen(fn, "r"))) {
+			if (fgets(buf, sizeof(buf), f)) {
+				buf[strcspn(buf, "\n")] = '\0';
+				*path = strdup(buf);
+			}
+			fclose(f);
+		}
+	}
+
+	snprintf(fn, sizeof(fn), "/proc/%d/status", (int)pid);
+	if (!(f = fopen(fn, "r"))) {
+		if (errno != ENOENT) {
+			log_err_printf("Failed to get proc status: %s (%i)\n",
+			               strerror(errno), errno);
+		}
+		free(*path);
+		*path = NULL;
+		return -1;
+	}
+	while (fgets(buf, sizeof(buf), f)) {
+		unsigned int id;
+
+		if (sscanf(buf, "Uid: %u", &id) == 1) {
+			*uid = id;
+		} else if (sscanf(buf, "Gid: %u", &id) == 1) {
+			*gid = id;
+			break;
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+void
+proc_linux_fini(void)
+{
+	if (proc_linux_inodes) {
+		kh_destroy(inode_t, proc_linux_inodes);
+		proc_linux_inodes = NULL;
+	}
+	if (proc_linux_scan_dir) {
+		closedir(proc_linux_scan_dir);
+		proc_linux_scan_dir = NULL;
+	}
+	if (proc_linux_diag_fd != -1) {
+		close(proc_linux_diag_fd);
+		proc_linux_diag_fd = -1;
+	}
+	if (proc_linux_cn_fd >= 0) {
+		close(proc_linux_cn_fd);
+	}
+	proc_linux_cn_fd = -1;
+}
+
+#endif /* __linux__ */
+
 /* vim: set noet ft=c: */
 
 
@@ -36,7 +36,7 @@
 
 #include <event2/util.h>
 
-#if defined(HAVE_DARWIN_LIBPROC) || defined(__FreeBSD__)
+#if defined(HAVE_DARWIN_LIBPROC) || defined(__FreeBSD__) || defined(__linux__)
 #define HAVE_LOCAL_PROCINFO
 #endif
 
@@ -45,6 +45,7 @@
 #define LOCAL_PROCINFO_STR "Darwin libproc"
 #define proc_pid_for_addr(a,b,c)	proc_darwin_pid_for_addr(a,b,c)
 #define proc_get_info(a,b,c,d)		proc_darwin_get_info(a,b,c,d)
+#define proc_fini()
 #endif /* LOCAL_PROCINFO_STR */
 int proc_darwin_pid_for_addr(pid_t *, struct sockaddr *, socklen_t) WUNRES NONNULL(1,2);
 int proc_darwin_get_info(pid_t, char **, uid_t *, gid_t *) WUNRES NONNULL(2,3,4);
@@ -55,11 +56,24 @@ int proc_darwin_get_info(pid_t, char **, uid_t *, gid_t *) WUNRES NONNULL(2,3,4)
 #define LOCAL_PROCINFO_STR "FreeBSD sysctl"
 #define proc_pid_for_addr(a,b,c)	proc_freebsd_pid_for_addr(a,b,c)
 #define proc_get_info(a,b,c,d)		proc_freebsd_get_info(a,b,c,d)
+#define proc_fini()
 #endif /* LOCAL_PROCINFO_STR */
 int proc_freebsd_pid_for_addr(pid_t *, struct sockaddr *, socklen_t) WUNRES NONNULL(1,2);
 int proc_freebsd_get_info(pid_t, char **, uid_t *, gid_t *) WUNRES NONNULL(2,3,4);
 #endif /* __FreeBSD__ */
 
+#ifdef __linux__
+#ifndef LOCAL_PROCINFO_STR
+#define LOCAL_PROCINFO_STR "Linux sock_diag"
+#define proc_pid_for_addr(a,b,c)	proc_linux_pid_for_addr(a,b,c)
+#define proc_get_info(a,b,c,d)		proc_linux_get_info(a,b,c,d)
+#define proc_fini()			proc_linux_fini()
+#endif /* LOCAL_PROCINFO_STR */
+int proc_linux_pid_for_addr(pid_t *, struct sockaddr *, socklen_t) WUNRES NONNULL(1,2);
+int proc_linux_get_info(pid_t, char **, uid_t *, gid_t *) WUNRES NONNULL(2,3,4);
+void proc_linux_fini(void);
+#endif /* __linux__ */
+
 #endif /* !PROC_H */
 
 /* vim: set noet ft=c: */
@@ -312,8 +312,8 @@ protoautossl_enable_src(pxy_conn_ctx_t *ctx)
 
 	// srvdst is xferred to the first child conn, so save the srvdst ssl info for logging
 	if (ctx->srvdst.bev && !autossl_ctx->clienthello_search && ctx->srvdst.ssl) {
-		ctx->sslctx->srvdst_ssl_version = strdup(SSL_get_version(ctx->srvdst.ssl));
-		ctx->sslctx->srvdst_ssl_cipher = strdup(SSL_get_cipher(ctx->srvdst.ssl));
+		ctx->sslctx->srvdst_ssl_version = slab_arena_strdup(&ctx->arena, SSL_get_version(ctx->srvdst.ssl));
+		ctx->sslctx->srvdst_ssl_cipher = slab_arena_strdup(&ctx->arena, SSL_get_cipher(ctx->srvdst.ssl));
 	}
 
 	// Skip child listener setup if completing autossl upgrade, after finding clienthello
@@ -359,8 +359,8 @@ protoautossl_enable_conn_src_child(pxy_conn_child_ctx_t *ctx)
 
 	// srvdst is xferred to the first child conn, so save the ssl info for logging
 	if (ctx->dst.bev && !autossl_ctx->clienthello_search && ctx->dst.ssl) {
-		ctx->conn->sslctx->srvdst_ssl_version = strdup(SSL_get_version(ctx->dst.ssl));
-		ctx->conn->sslctx->srvdst_ssl_cipher = strdup(SSL_get_cipher(ctx->dst.ssl));
+		ctx->conn->sslctx->srvdst_ssl_version = slab_arena_strdup(&ctx->conn->arena, SSL_get_version(ctx->dst.ssl));
+		ctx->conn->sslctx->srvdst_ssl_cipher = slab_arena_strdup(&ctx->conn->arena, SSL_get_cipher(ctx->dst.ssl));
 	}
 
 #ifdef DEBUG_PROXY
@@ -460,22 +460,7 @@ protoautossl_bev_readcb_src_child(struct bufferevent *bev, pxy_conn_child_ctx_t
 	struct evbuffer *outbuf = bufferevent_get_output(ctx->dst.bev);
 
 	if (!ctx->removed_sslproxy_header) {
-		size_t packet_size = evbuffer_get_length(inbuf);
-		unsigned char *packet = pxy_malloc_packet(packet_size, ctx->conn);
-		if (!packet) {
-			return;
-		}
-
-		evbuffer_remove(inbuf, packet, packet_size);
-		pxy_try_remove_sslproxy_header(ctx, packet, &packet_size);
-		evbuffer_add(outbuf, packet, packet_size);
-
-#ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protoautossl_bev_readcb_src_child: NEW packet, size=%zu, child fd=%d, fd=%d:\n%.*s\n",
-				packet_size, ctx->fd, ctx->conn->fd, (int)packet_size, packet);
-#endif /* DEBUG_PROXY */
-
-		free(packet);
+		pxy_remove_sslproxy_header(ctx, inbuf, outbuf);
 	} else {
 		evbuffer_add_buffer(outbuf, inbuf);
 	}
@@ -660,8 +645,7 @@ protoautossl_bev_eventcb_child(struct bufferevent *bev, short events, void *arg)
 static void NONNULL(1)
 protoautossl_free(pxy_conn_ctx_t *ctx)
 {
-	protoautossl_ctx_t *autossl_ctx = ctx->protoctx->arg;
-	free(autossl_ctx);
+	slab_free(ctx->thr->slab, ctx->protoctx->arg, sizeof(protoautossl_ctx_t));
 	protossl_free(ctx);
 }
 
@@ -678,7 +662,7 @@ protoautossl_setup(pxy_conn_ctx_t *ctx)
 
 	ctx->protoctx->proto_free = protoautossl_free;
 
-	ctx->protoctx->arg = malloc(sizeof(protoautossl_ctx_t));
+	ctx->protoctx->arg = slab_alloc(ctx->thr->slab, sizeof(protoautossl_ctx_t));
 	if (!ctx->protoctx->arg) {
 		return PROTO_ERROR;
 	}
@@ -686,9 +670,9 @@ protoautossl_setup(pxy_conn_ctx_t *ctx)
 	protoautossl_ctx_t *autossl_ctx = ctx->protoctx->arg;
 	autossl_ctx->clienthello_search = 1;
 
-	ctx->sslctx = malloc(sizeof(ssl_ctx_t));
+	ctx->sslctx = slab_alloc(ctx->thr->slab, sizeof(ssl_ctx_t));
 	if (!ctx->sslctx) {
-		free(ctx->protoctx->arg);
+		slab_free(ctx->thr->slab, ctx->protoctx->arg, sizeof(protoautossl_ctx_t));
 		return PROTO_ERROR;
 	}
 	memset(ctx->sslctx, 0, sizeof(ssl_ctx_t));
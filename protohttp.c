@@ -98,10 +98,10 @@ protohttp_log_connect(pxy_conn_ctx_t *ctx)
 		              " %s"
 #endif /* HAVE_LOCAL_PROCINFO */
 		              "%s user:%s\n",
-		              STRORDASH(ctx->srchost_str),
-		              STRORDASH(ctx->srcport_str),
-		              STRORDASH(ctx->dsthost_str),
-		              STRORDASH(ctx->dstport_str),
+		              STRORDASH(pxy_conn_srchost_str(ctx)),
+		              STRORDASH(pxy_conn_srcport_str(ctx)),
+		              STRORDASH(pxy_conn_dsthost_str(ctx)),
+		              STRORDASH(pxy_conn_dstport_str(ctx)),
 		              STRORDASH(http_ctx->http_host),
 		              STRORDASH(http_ctx->http_method),
 		              STRORDASH(http_ctx->http_uri),
@@ -121,10 +121,10 @@ protohttp_log_connect(pxy_conn_ctx_t *ctx)
 		              " %s"
 #endif /* HAVE_LOCAL_PROCINFO */
 		              "%s user:%s\n",
-		              STRORDASH(ctx->srchost_str),
-		              STRORDASH(ctx->srcport_str),
-		              STRORDASH(ctx->dsthost_str),
-		              STRORDASH(ctx->dstport_str),
+		              STRORDASH(pxy_conn_srchost_str(ctx)),
+		              STRORDASH(pxy_conn_srcport_str(ctx)),
+		              STRORDASH(pxy_conn_dsthost_str(ctx)),
+		              STRORDASH(pxy_conn_dstport_str(ctx)),
 		              STRORDASH(http_ctx->http_host),
 		              STRORDASH(http_ctx->http_method),
 		              STRORDASH(http_ctx->http_uri),
@@ -965,8 +965,8 @@ protohttp_bev_readcb_child(struct bufferevent *bev, void *arg)
 	}
 }
 
-static void NONNULL(1)
-protohttp_free_ctx(protohttp_ctx_t *http_ctx)
+static void NONNULL(2)
+protohttp_free_ctx(slab_t *slab, protohttp_ctx_t *http_ctx)
 {
 	if (http_ctx->http_method) {
 		free(http_ctx->http_method);
@@ -989,21 +989,21 @@ protohttp_free_ctx(protohttp_ctx_t *http_ctx)
 	if (http_ctx->http_content_length) {
 		free(http_ctx->http_content_length);
 	}
-	free(http_ctx);
+	slab_free(slab, http_ctx, sizeof(protohttp_ctx_t));
 }
 
 static void NONNULL(1)
 protohttp_free(pxy_conn_ctx_t *ctx)
 {
 	protohttp_ctx_t *http_ctx = ctx->protoctx->arg;
-	protohttp_free_ctx(http_ctx);
+	protohttp_free_ctx(ctx->conn->thr->slab, http_ctx);
 }
 
 static void NONNULL(1)
 protohttps_free(pxy_conn_ctx_t *ctx)
 {
 	protohttp_ctx_t *http_ctx = ctx->protoctx->arg;
-	protohttp_free_ctx(http_ctx);
+	protohttp_free_ctx(ctx->thr->slab, http_ctx);
 	protossl_free(ctx);
 }
 
@@ -1011,7 +1011,7 @@ static void NONNULL(1)
 protohttp_free_child(pxy_conn_child_ctx_t *ctx)
 {
 	protohttp_ctx_t *http_ctx = ctx->protoctx->arg;
-	protohttp_free_ctx(http_ctx);
+	protohttp_free_ctx(ctx->conn->thr->slab, http_ctx);
 }
 
 protocol_t
@@ -1022,7 +1022,7 @@ protohttp_setup(pxy_conn_ctx_t *ctx)
 	ctx->protoctx->bev_readcb = protohttp_bev_readcb;
 	ctx->protoctx->proto_free = protohttp_free;
 
-	ctx->protoctx->arg = malloc(sizeof(protohttp_ctx_t));
+	ctx->protoctx->arg = slab_alloc(ctx->conn->thr->slab, sizeof(protohttp_ctx_t));
 	if (!ctx->protoctx->arg) {
 		return PROTO_ERROR;
 	}
@@ -1043,15 +1043,15 @@ protohttps_setup(pxy_conn_ctx_t *ctx)
 
 	ctx->protoctx->proto_free = protohttps_free;
 
-	ctx->protoctx->arg = malloc(sizeof(protohttp_ctx_t));
+	ctx->protoctx->arg = slab_alloc(ctx->conn->thr->slab, sizeof(protohttp_ctx_t));
 	if (!ctx->protoctx->arg) {
 		return PROTO_ERROR;
 	}
 	memset(ctx->protoctx->arg, 0, sizeof(protohttp_ctx_t));
 
-	ctx->sslctx = malloc(sizeof(ssl_ctx_t));
+	ctx->sslctx = slab_alloc(ctx->thr->slab, sizeof(ssl_ctx_t));
 	if (!ctx->sslctx) {
-		free(ctx->protoctx->arg);
+		slab_free(ctx->thr->slab, ctx->protoctx->arg, sizeof(protohttp_ctx_t));
 		return PROTO_ERROR;
 	}
 	memset(ctx->sslctx, 0, sizeof(ssl_ctx_t));
@@ -1068,7 +1068,7 @@ protohttp_setup_child(pxy_conn_child_ctx_t *ctx)
 	ctx->protoctx->bev_readcb = protohttp_bev_readcb_child;
 	ctx->protoctx->proto_free = protohttp_free_child;
 
-	ctx->protoctx->arg = malloc(sizeof(protohttp_ctx_t));
+	ctx->protoctx->arg = slab_alloc(ctx->conn->thr->slab, sizeof(protohttp_ctx_t));
 	if (!ctx->protoctx->arg) {
 		return PROTO_ERROR;
 	}
@@ -1088,7 +1088,7 @@ protohttps_setup_child(pxy_conn_child_ctx_t *ctx)
 
 	ctx->protoctx->proto_free = protohttp_free_child;
 
-	ctx->protoctx->arg = malloc(sizeof(protohttp_ctx_t));
+	ctx->protoctx->arg = slab_alloc(ctx->conn->thr->slab, sizeof(protohttp_ctx_t));
 	if (!ctx->protoctx->arg) {
 		return PROTO_ERROR;
 	}
@@ -29,6 +29,7 @@
 
 #include "protopassthrough.h"
 #include "prototcp.h"
+#include "pxysplice.h"
 
 #include <sys/param.h>
 
@@ -52,9 +53,9 @@ protopassthrough_log_dbg_connect_type(pxy_conn_ctx_t *ctx)
 		 * since src was already connected from the
 		 * beginning */
 		log_dbg_printf("PASSTHROUGH connected to [%s]:%s\n",
-					   STRORDASH(ctx->dsthost_str), STRORDASH(ctx->dstport_str));
+					   STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)));
 		log_dbg_printf("PASSTHROUGH connected from [%s]:%s\n",
-					   STRORDASH(ctx->srchost_str), STRORDASH(ctx->srcport_str));
+					   STRORDASH(pxy_conn_srchost_str(ctx)), STRORDASH(pxy_conn_srcport_str(ctx)));
 	}
 }
 
@@ -247,6 +248,13 @@ protopassthrough_enable_src(pxy_conn_ctx_t *ctx)
 	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protopassthrough_enable_src: ENTER, fd=%d\n", ctx->fd);
 #endif /* DEBUG_PROXY */
 
+#ifdef HAVE_SPLICE
+	// Relay in the kernel if we never need to see the data, otherwise fall back to bufferevents
+	if (pxy_splice_eligible(ctx) && pxy_splice_engage(ctx) == 0) {
+		return 0;
+	}
+#endif /* HAVE_SPLICE */
+
 	if (prototcp_setup_src(ctx) == -1) {
 		return -1;
 	}
@@ -451,10 +459,6 @@ protopassthrough_bev_eventcb(struct bufferevent *bev, short events, void *arg)
 
 	if (events & BEV_EVENT_CONNECTED) {
 		if (ctx->connected) {
-			// @attention dstaddr may not have been set by the original proto.
-			if (pxy_set_dstaddr(ctx) == -1) {
-				return;
-			}
 #ifdef HAVE_LOCAL_PROCINFO
 			if (protopassthrough_prepare_logging(ctx) == -1) {
 				return;
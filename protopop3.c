@@ -86,14 +86,28 @@ protopop3_validate(pxy_conn_ctx_t *ctx, char *packet, size_t packet_size)
 	return 0;
 }
 
+static void NONNULL(1)
+protopop3_free(pxy_conn_ctx_t *ctx)
+{
+	slab_free(ctx->thr->slab, ctx->protoctx->arg, sizeof(protopop3_ctx_t));
+}
+
+static void NONNULL(1)
+protopop3s_free(pxy_conn_ctx_t *ctx)
+{
+	protopop3_free(ctx);
+	protossl_free(ctx);
+}
+
 protocol_t
 protopop3_setup(pxy_conn_ctx_t *ctx)
 {
 	ctx->protoctx->proto = PROTO_POP3;
 
+	ctx->protoctx->proto_free = protopop3_free;
 	ctx->protoctx->validatecb = protopop3_validate;
 
-	ctx->protoctx->arg = malloc(sizeof(protopop3_ctx_t));
+	ctx->protoctx->arg = slab_alloc(ctx->thr->slab, sizeof(protopop3_ctx_t));
 	if (!ctx->protoctx->arg) {
 		return PROTO_ERROR;
 	}
@@ -112,18 +126,18 @@ protopop3s_setup(pxy_conn_ctx_t *ctx)
 	
 	ctx->protoctx->bev_eventcb = protossl_bev_eventcb;
 
-	ctx->protoctx->proto_free = protossl_free;
+	ctx->protoctx->proto_free = protopop3s_free;
 	ctx->protoctx->validatecb = protopop3_validate;
 
-	ctx->protoctx->arg = malloc(sizeof(protopop3_ctx_t));
+	ctx->protoctx->arg = slab_alloc(ctx->thr->slab, sizeof(protopop3_ctx_t));
 	if (!ctx->protoctx->arg) {
 		return PROTO_ERROR;
 	}
 	memset(ctx->protoctx->arg, 0, sizeof(protopop3_ctx_t));
 
-	ctx->sslctx = malloc(sizeof(ssl_ctx_t));
+	ctx->sslctx = slab_alloc(ctx->thr->slab, sizeof(ssl_ctx_t));
 	if (!ctx->sslctx) {
-		free(ctx->protoctx->arg);
+		slab_free(ctx->thr->slab, ctx->protoctx->arg, sizeof(protopop3_ctx_t));
 		return PROTO_ERROR;
 	}
 	memset(ctx->sslctx, 0, sizeof(ssl_ctx_t));
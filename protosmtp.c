@@ -87,14 +87,28 @@ protosmtp_validate(pxy_conn_ctx_t *ctx, char *packet, size_t packet_size)
 	return 0;
 }
 
+static void NONNULL(1)
+protosmtp_free(pxy_conn_ctx_t *ctx)
+{
+	slab_free(ctx->thr->slab, ctx->protoctx->arg, sizeof(protosmtp_ctx_t));
+}
+
+static void NONNULL(1)
+protosmtps_free(pxy_conn_ctx_t *ctx)
+{
+	protosmtp_free(ctx);
+	protossl_free(ctx);
+}
+
 protocol_t
 protosmtp_setup(pxy_conn_ctx_t *ctx)
 {
 	ctx->protoctx->proto = PROTO_SMTP;
 
+	ctx->protoctx->proto_free = protosmtp_free;
 	ctx->protoctx->validatecb = protosmtp_validate;
 
-	ctx->protoctx->arg = malloc(sizeof(protosmtp_ctx_t));
+	ctx->protoctx->arg = slab_alloc(ctx->thr->slab, sizeof(protosmtp_ctx_t));
 	if (!ctx->protoctx->arg) {
 		return PROTO_ERROR;
 	}
@@ -113,18 +127,18 @@ protosmtps_setup(pxy_conn_ctx_t *ctx)
 	
 	ctx->protoctx->bev_eventcb = protossl_bev_eventcb;
 
-	ctx->protoctx->proto_free = protossl_free;
+	ctx->protoctx->proto_free = protosmtps_free;
 	ctx->protoctx->validatecb = protosmtp_validate;
 
-	ctx->protoctx->arg = malloc(sizeof(protosmtp_ctx_t));
+	ctx->protoctx->arg = slab_alloc(ctx->thr->slab, sizeof(protosmtp_ctx_t));
 	if (!ctx->protoctx->arg) {
 		return PROTO_ERROR;
 	}
 	memset(ctx->protoctx->arg, 0, sizeof(protosmtp_ctx_t));
 
-	ctx->sslctx = malloc(sizeof(ssl_ctx_t));
+	ctx->sslctx = slab_alloc(ctx->thr->slab, sizeof(ssl_ctx_t));
 	if (!ctx->sslctx) {
-		free(ctx->protoctx->arg);
+		slab_free(ctx->thr->slab, ctx->protoctx->arg, sizeof(protosmtp_ctx_t));
 		return PROTO_ERROR;
 	}
 	memset(ctx->sslctx, 0, sizeof(ssl_ctx_t));
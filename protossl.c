@@ -32,7 +32,10 @@
 #include "protopassthrough.h"
 
 #include "pxysslshut.h"
+#include "pxyplugin.h"
 #include "cachemgr.h"
+#include "tgcrtidx.h"
+#include "dnscache.h"
 
 #include <string.h>
 #include <sys/param.h>
@@ -368,8 +371,9 @@ protossl_srcsslctx_create(pxy_conn_ctx_t *ctx, X509 *crt, STACK_OF(X509) *chain,
 	                                       sizeof(ssl_session_context));
 #endif /* USE_SSL_SESSION_ID_CONTEXT */
 #ifndef OPENSSL_NO_TLSEXT
+	/* the callback finds the conn in the app data of the SSL, since the
+	 * SSL_CTX is shared by the conns using the same forged cert */
 	SSL_CTX_set_tlsext_servername_callback(sslctx, protossl_ossl_servername_cb);
-	SSL_CTX_set_tlsext_servername_arg(sslctx, ctx);
 #endif /* !OPENSSL_NO_TLSEXT */
 #ifndef OPENSSL_NO_DH
 	if (ctx->spec->opts->dh) {
@@ -469,50 +473,150 @@ protossl_srccert_write(pxy_conn_ctx_t *ctx)
 	}
 }
 
+/*
+ * Returns the fingerprint of crt allocated from the conn arena,
+ * or NULL and sets enomem on error.
+ */
+static char * NONNULL(1,2)
+protossl_fingerprint(pxy_conn_ctx_t *ctx, X509 *crt)
+{
+	char *fpr = slab_arena_alloc(&ctx->arena, SSL_X509_FPRSZ * 2 + 1);
+
+	if (!fpr || ssl_x509_fingerprint_buf(crt, fpr) == -1) {
+		ctx->enomem = 1;
+		return NULL;
+	}
+	return fpr;
+}
+
+/*
+ * Returns the names of crt joined with slashes, allocated from the conn
+ * arena, or NULL and sets enomem on error.
+ */
+static const char * NONNULL(1,2)
+protossl_names(pxy_conn_ctx_t *ctx, X509 *crt)
+{
+	char *names, *s;
+
+	if (!(names = ssl_x509_names_to_str(crt))) {
+		ctx->enomem = 1;
+		return NULL;
+	}
+	if (!(s = slab_arena_strdup(&ctx->arena, names)))
+		ctx->enomem = 1;
+	free(names);
+	return s;
+}
+
+/*
+ * Stage 0 of the src SSL setup: look up the record of the forged cert for
+ * the original server cert, which carries the fingerprints, the names and
+ * the SSL_CTX the later stages would otherwise derive again for each conn.
+ * Returns -1 on out of memory.
+ */
+static int NONNULL(1)
+protossl_srcssl_crtrec(pxy_conn_ctx_t *ctx)
+{
+	if (!ctx->sslctx->origcrt || !ctx->global->key)
+		return 0;
+
+	ctx->sslctx->crtrec = cachemgr_fkcrt_get(ctx->sslctx->origcrt);
+	if (OPTS_DEBUG(ctx->global)) {
+		log_dbg_printf("Certificate cache: %s\n",
+		               ctx->sslctx->crtrec ? "HIT" : "MISS");
+	}
+	if (ctx->sslctx->crtrec &&
+	    crtrec_set_orig(ctx->sslctx->crtrec, ctx->sslctx->origcrt) == -1) {
+		ctx->enomem = 1;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Forge a cert for the original server cert, with sn as additional name
+ * unless NULL, and put its record into the fkcrt cache in place of the
+ * record of the conn, if any.
+ * Returns the record, or NULL and sets enomem on error.
+ */
+static crtrec_t * NONNULL(1)
+protossl_crtrec_forge(pxy_conn_ctx_t *ctx, X509 *crt, const char *sn)
+{
+	crtrec_t *rec;
+	X509 *newcrt;
+
+	newcrt = ssl_x509_forge(ctx->spec->opts->cacrt,
+	                        ctx->spec->opts->cakey,
+	                        crt,
+	                        ctx->global->key,
+	                        sn,
+	                        ctx->spec->opts->crlurl);
+	if (!newcrt) {
+		ctx->enomem = 1;
+		return NULL;
+	}
+	rec = crtrec_new(newcrt);
+	X509_free(newcrt);
+	if (!rec || crtrec_set_orig(rec, ctx->sslctx->origcrt) == -1) {
+		if (rec)
+			crtrec_free(rec);
+		ctx->enomem = 1;
+		return NULL;
+	}
+	cachemgr_fkcrt_set(ctx->sslctx->origcrt, rec);
+	if (ctx->sslctx->crtrec) {
+		/* the log strings taken from the replaced record go with it */
+		crtrec_t *old = ctx->sslctx->crtrec;
+		if (ctx->sslctx->ssl_names == old->names)
+			ctx->sslctx->ssl_names = rec->names;
+		if (ctx->sslctx->origcrtfpr == old->origfpr)
+			ctx->sslctx->origcrtfpr = rec->origfpr;
+		if (ctx->sslctx->usedcrtfpr == old->usedfpr)
+			ctx->sslctx->usedcrtfpr = rec->usedfpr;
+		crtrec_free(old);
+	}
+	ctx->sslctx->crtrec = rec;
+	return rec;
+}
+
+/*
+ * Returns 1 if crt is the cert of the forged cert record of the conn,
+ * 0 otherwise.
+ */
+static int NONNULL(1,2)
+protossl_crtrec_is_used(pxy_conn_ctx_t *ctx, X509 *crt)
+{
+	return ctx->sslctx->crtrec && ctx->sslctx->crtrec->crt == crt;
+}
+
 static cert_t *
 protossl_srccert_create(pxy_conn_ctx_t *ctx)
 {
 	cert_t *cert = NULL;
+	uint64_t start = histo_now();
 
 	if (ctx->global->tgcrtdir) {
 		if (ctx->sslctx->sni) {
-			cert = cachemgr_tgcrt_get(ctx->sslctx->sni);
-			if (!cert) {
-				char *wildcarded;
-				wildcarded = ssl_wildcardify(ctx->sslctx->sni);
-				if (!wildcarded) {
-					ctx->enomem = 1;
-					return NULL;
-				}
-				cert = cachemgr_tgcrt_get(wildcarded);
-				free(wildcarded);
-			}
+			cert = tgcrtidx_get(ctx->sslctx->sni);
 			if (cert && OPTS_DEBUG(ctx->global)) {
 				log_dbg_printf("Target cert by SNI\n");
 			}
 		} else if (ctx->sslctx->origcrt) {
-			char **names = ssl_x509_names(ctx->sslctx->origcrt);
-			for (char **p = names; *p; p++) {
-				if (!cert) {
-					cert = cachemgr_tgcrt_get(*p);
-				}
-				if (!cert) {
-					char *wildcarded;
-					wildcarded = ssl_wildcardify(*p);
-					if (!wildcarded) {
-						ctx->enomem = 1;
-					} else {
-						cert = cachemgr_tgcrt_get(
-						       wildcarded);
-						free(wildcarded);
-					}
-				}
-				free(*p);
-			}
-			free(names);
-			if (ctx->enomem) {
+			char **names = ctx->sslctx->crtrec ? ctx->sslctx->crtrec->sans :
+			               ssl_x509_names(ctx->sslctx->origcrt);
+			if (!names) {
+				ctx->enomem = 1;
 				return NULL;
 			}
+			for (char **p = names; *p && !cert; p++) {
+				cert = tgcrtidx_get(*p);
+			}
+			if (!ctx->sslctx->crtrec) {
+				for (char **p = names; *p; p++) {
+					free(*p);
+				}
+				free(names);
+			}
 			if (cert && OPTS_DEBUG(ctx->global)) {
 				log_dbg_printf("Target cert by origcrt\n");
 			}
@@ -524,159 +628,138 @@ protossl_srccert_create(pxy_conn_ctx_t *ctx)
 	}
 
 	if (!cert && ctx->sslctx->origcrt && ctx->global->key) {
-		cert = cert_new();
-
-		cert->crt = cachemgr_fkcrt_get(ctx->sslctx->origcrt);
-		if (cert->crt) {
-			if (OPTS_DEBUG(ctx->global))
-				log_dbg_printf("Certificate cache: HIT\n");
-		} else {
-			if (OPTS_DEBUG(ctx->global))
-				log_dbg_printf("Certificate cache: MISS\n");
-			cert->crt = ssl_x509_forge(ctx->spec->opts->cacrt,
-			                           ctx->spec->opts->cakey,
-			                           ctx->sslctx->origcrt,
-			                           ctx->global->key,
-			                           NULL,
-			                           ctx->spec->opts->crlurl);
-			cachemgr_fkcrt_set(ctx->sslctx->origcrt, cert->crt);
+		if (!ctx->sslctx->crtrec) {
+			if (!protossl_crtrec_forge(ctx, ctx->sslctx->origcrt, NULL))
+				return NULL;
+			ctx->thr->srcssl_stages[PXY_SRCSSL_FORGE]++;
 		}
+		if (!(cert = cert_new())) {
+			ctx->enomem = 1;
+			return NULL;
+		}
+		cert_set_crt(cert, ctx->sslctx->crtrec->crt);
 		cert_set_key(cert, ctx->global->key);
 		cert_set_chain(cert, ctx->spec->opts->chain);
 		ctx->sslctx->generated_cert = 1;
 	}
 
+	if (cert) {
+		pxy_thrmgr_phase_done(ctx, PXY_PHASE_CERT, start);
+		ctx->thr->srcssl_stages[PXY_SRCSSL_CERT]++;
+	}
+
 	if ((WANT_CONNECT_LOG(ctx) || ctx->global->certgendir) && ctx->sslctx->origcrt) {
-		ctx->sslctx->origcrtfpr = ssl_x509_fingerprint(ctx->sslctx->origcrt, 0);
-		if (!ctx->sslctx->origcrtfpr)
-			ctx->enomem = 1;
+		ctx->sslctx->origcrtfpr = ctx->sslctx->crtrec ? ctx->sslctx->crtrec->origfpr :
+		                          protossl_fingerprint(ctx, ctx->sslctx->origcrt);
 	}
 	if ((WANT_CONNECT_LOG(ctx) || ctx->global->certgen_writeall) &&
 	    cert && cert->crt) {
-		ctx->sslctx->usedcrtfpr = ssl_x509_fingerprint(cert->crt, 0);
-		if (!ctx->sslctx->usedcrtfpr)
-			ctx->enomem = 1;
+		ctx->sslctx->usedcrtfpr = protossl_crtrec_is_used(ctx, cert->crt) ?
+		                          ctx->sslctx->crtrec->usedfpr :
+		                          protossl_fingerprint(ctx, cert->crt);
 	}
 
 	return cert;
 }
 
-static int NONNULL(1,2)
-protossl_pass_user(pxy_conn_ctx_t *ctx, passsite_t *passsite)
+/*
+ * Stage 1 of the src SSL setup: extract the names of crt, which are needed
+ * by the connect log and the PassSite decision.
+ * Returns -1 on out of memory.
+ */
+static int NONNULL(1)
+protossl_srcssl_names(pxy_conn_ctx_t *ctx, X509 *crt)
 {
-#ifdef DEBUG_PROXY
-	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_pass_user: ENTER, %s, %s, %s, %s, fd=%d\n", passsite->site, STRORDASH(passsite->ip), passsite->all ? "*" : STRORDASH(passsite->user), STRORDASH(passsite->keyword), ctx->fd);
-#endif /* DEBUG_PROXY */
-
-	// No filter or * (all) without desc keyword defined
-	if (!passsite->ip && !passsite->user && !passsite->keyword) {
-		return 1;
-	}
-
-#ifdef DEBUG_PROXY
-	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_pass_user: Filter ip: %s, fd=%d\n", STRORDASH(ctx->srchost_str), ctx->fd);
-#endif /* DEBUG_PROXY */
-
-	// Client ip filter defined
-	if (passsite->ip && ctx->srchost_str && !strcmp(ctx->srchost_str, passsite->ip)) {
-		return 1;
-	}
-
-#ifdef DEBUG_PROXY
-	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_pass_user: Filter user: %s, %s, fd=%d\n", STRORDASH(ctx->user), STRORDASH(ctx->desc), ctx->fd);
-#endif /* DEBUG_PROXY */
+	if (!crt || ctx->sslctx->ssl_names ||
+	    (!WANT_CONNECT_LOG(ctx) && !ctx->spec->opts->passsites))
+		return 0;
 
-	// Make sure ctx->user and ctx->desc are set, otherwise if the user did not log in yet, they may be NULL
-	// User and/or description keyword filters defined
-	if (ctx->spec->opts->user_auth && (passsite->all || (passsite->user && ctx->user && !strcmp(ctx->user, passsite->user))) &&
-			(!passsite->keyword || (ctx->desc && strcasestr(ctx->desc, passsite->keyword)))) {
-		return 1;
+	if (ctx->sslctx->crtrec && crt == ctx->sslctx->origcrt) {
+		ctx->sslctx->ssl_names = ctx->sslctx->crtrec->names;
+	} else if (!(ctx->sslctx->ssl_names = protossl_names(ctx, crt))) {
+		return -1;
 	}
+	ctx->thr->srcssl_stages[PXY_SRCSSL_NAMES]++;
 	return 0;
 }
 
-static int NONNULL(1,2)
-protossl_pass_site(pxy_conn_ctx_t *ctx, char *site)
+/*
+ * Stage 2 of the src SSL setup: decide whether to pass the site through,
+ * by the SNI and the names extracted so far.
+ * Returns 1 if the site should be passed through, 0 otherwise.
+ */
+static int NONNULL(1)
+protossl_srcssl_passsite(pxy_conn_ctx_t *ctx)
 {
-#ifdef DEBUG_PROXY
-	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_pass_site: ENTER, %s, %s, %s, fd=%d\n", site, STRORDASH(ctx->sslctx->sni), STRORDASH(ctx->sslctx->ssl_names), ctx->fd);
-#endif /* DEBUG_PROXY */
-
-	int rv = 0;
-
-	// site has surrounding slashes: "/example.com/"
-	size_t len = strlen(site);
-
-	// Replace slash with null
-	site[len - 1] = '\0';
-	// Skip the first slash
-	char *s = site + 1;
-
-	// @attention Make sure sni is not null
-	// SNI: "example.com"
-	if (ctx->sslctx->sni && !strcmp(ctx->sslctx->sni, s)) {
-#ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_pass_site: Match with sni: %s, fd=%d\n", ctx->sslctx->sni, ctx->fd);
-#endif /* DEBUG_PROXY */
-
-		rv = 1;
-		goto out2;
-	}
+	if (!ctx->spec->opts->passsite_index)
+		return 0;
 
-	// @attention Make sure ssl_names is not null
-	if (!ctx->sslctx->ssl_names) {
-		goto out2;
-	}
+	// Make sure ctx->user and ctx->desc are set, otherwise if the user did not log in yet, they may be NULL
+	passsite_t *passsite = passsite_index_match_names(ctx->spec->opts->passsite_index,
+			ctx->sslctx->sni, ctx->sslctx->ssl_names, pxy_conn_srchost_str(ctx), ctx->user, ctx->desc, ctx->spec->opts->user_auth);
+	if (!passsite)
+		return 0;
 
-	// Single common name: "example.com"
-	if (!strcmp(ctx->sslctx->ssl_names, s)) {
-#ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_pass_site: Match with single common name: %s, fd=%d\n", ctx->sslctx->ssl_names, ctx->fd);
-#endif /* DEBUG_PROXY */
+	// Do not print the surrounding slashes
+	log_err_level_printf(LOG_WARNING, "Found pass site: %.*s for user %s and keyword %s\n", (int)strlen(passsite->site) - 2, passsite->site + 1,
+			passsite->ip ? passsite->ip : (passsite->all ? "*" : STRORDASH(passsite->user)), STRORDASH(passsite->keyword));
+	// Differentiate passsite from passthrough option by raising the passsite flag
+	ctx->passsite = 1;
+	ctx->thr->srcssl_stages[PXY_SRCSSL_PASS]++;
+	return 1;
+}
 
-		rv = 1;
-		goto out2;
+/*
+ * Create the src SSL serving crt.  Forged certs are served with the SSL_CTX
+ * kept in their record.
+ * Returns NULL on error.
+ */
+static SSL * NONNULL(1,2,4)
+protossl_srcssl_new(pxy_conn_ctx_t *ctx, X509 *crt, STACK_OF(X509) *chain,
+                    EVP_PKEY *key)
+{
+	SSL_CTX *sslctx = NULL;
+	int used = protossl_crtrec_is_used(ctx, crt);
+	if (used) {
+		sslctx = crtrec_get_sslctx(ctx->sslctx->crtrec, ctx->spec->opts->serial);
 	}
-
-	// Insert slash at the end
-	site[len - 1] = '/';
-
-	// First common name: "example.com/"
-	if (strstr(ctx->sslctx->ssl_names, s) == ctx->sslctx->ssl_names) {
-#ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_pass_site: Match with the first common name: %s, %s, fd=%d\n", ctx->sslctx->ssl_names, s, ctx->fd);
-#endif /* DEBUG_PROXY */
-
-		rv = 1;
-		goto out;
+	if (!sslctx) {
+		sslctx = protossl_srcsslctx_create(ctx, crt, chain, key);
+		if (sslctx && used) {
+			crtrec_set_sslctx(ctx->sslctx->crtrec, sslctx, ctx->spec->opts->serial);
+		}
 	}
-
-	// Middle common name: "/example.com/"
-	if (strstr(ctx->sslctx->ssl_names, site)) {
-#ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_pass_site: Match with a middle common name: %s, %s, fd=%d\n", ctx->sslctx->ssl_names, site, ctx->fd);
-#endif /* DEBUG_PROXY */
-
-		rv = 1;
-		goto out;
+	if (!sslctx)
+		return NULL;
+	ctx->thr->srcssl_stages[PXY_SRCSSL_CTX]++;
+	SSL *ssl = SSL_new(sslctx);
+	SSL_CTX_free(sslctx); /* SSL_new() increments refcount */
+	if (!ssl) {
+		ctx->enomem = 1;
+		return NULL;
 	}
+	SSL_set_app_data(ssl, ctx);
+#ifdef SSL_MODE_RELEASE_BUFFERS
+	/* lower memory footprint for idle connections */
+	SSL_set_mode(ssl, SSL_get_mode(ssl) | SSL_MODE_RELEASE_BUFFERS);
+#endif /* SSL_MODE_RELEASE_BUFFERS */
+	return ssl;
+}
 
-	// Replace slash with null
-	site[len - 1] = '\0';
-
-	// Last common name: "/example.com"
-	if (strstr(ctx->sslctx->ssl_names, site) == ctx->sslctx->ssl_names + strlen(ctx->sslctx->ssl_names) - strlen(site)) {
-#ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_pass_site: Match with the last common name: %s, %s, fd=%d\n", ctx->sslctx->ssl_names, site, ctx->fd);
-#endif /* DEBUG_PROXY */
+/*
+ * Remember the forged cert record of the conn as the cert to serve in the
+ * optimistic handshakes for the SNI and the destination of the conn, if crt
+ * is the cert of the record.
+ */
+static void NONNULL(1,2)
+protossl_snicrt_set(pxy_conn_ctx_t *ctx, X509 *crt)
+{
+	if (!ctx->spec->opts->optimistic_handshake || ctx->sslctx->optimistic ||
+	    !ctx->sslctx->sni || !protossl_crtrec_is_used(ctx, crt))
+		return;
 
-		rv = 1;
-	}
-out2:
-	// Restore the last modification
-	site[len - 1] = '/';
-out:
-	return rv;
+	cachemgr_snicrt_set((struct sockaddr *)&ctx->dstaddr, ctx->dstaddrlen,
+	                    ctx->sslctx->sni, ctx->sslctx->crtrec);
 }
 
 /*
@@ -684,6 +767,12 @@ out:
  * destination SSL certificate.
  * Returns NULL if no suitable certificate could be found or the site should 
  * be passed through.
+ *
+ * The setup runs in stages: name extraction, PassSite decision, cert
+ * selection and SSL_CTX creation, so that passed through sites do not
+ * forge certs or pollute the forged cert cache.  Without an original
+ * server cert, the names come from the selected cert, so the PassSite
+ * decision is taken again after cert selection.
  */
 static SSL *
 protossl_srcssl_create(pxy_conn_ctx_t *ctx, SSL *origssl)
@@ -705,6 +794,12 @@ protossl_srcssl_create(pxy_conn_ctx_t *ctx, SSL *origssl)
 		}
 	}
 
+	if (protossl_srcssl_crtrec(ctx) == -1 ||
+	    protossl_srcssl_names(ctx, ctx->sslctx->origcrt) == -1)
+		return NULL;
+	if (protossl_srcssl_passsite(ctx))
+		return NULL;
+
 	cert = protossl_srccert_create(ctx);
 	if (!cert)
 		return NULL;
@@ -714,43 +809,19 @@ protossl_srcssl_create(pxy_conn_ctx_t *ctx, SSL *origssl)
 		protossl_debug_crt(cert->crt);
 	}
 
-	if (WANT_CONNECT_LOG(ctx) || ctx->spec->opts->passsites) {
-		ctx->sslctx->ssl_names = ssl_x509_names_to_str(ctx->sslctx->origcrt ?
-		                                       ctx->sslctx->origcrt :
-		                                       cert->crt);
-		if (!ctx->sslctx->ssl_names)
-			ctx->enomem = 1;
-	}
-
-	passsite_t *passsite = ctx->spec->opts->passsites;
-	while (passsite) {
-		if (protossl_pass_user(ctx, passsite) && protossl_pass_site(ctx, passsite->site)) {
-			// Do not print the surrounding slashes
-			log_err_level_printf(LOG_WARNING, "Found pass site: %.*s for user %s and keyword %s\n", (int)strlen(passsite->site) - 2, passsite->site + 1,
-					passsite->ip ? passsite->ip : (passsite->all ? "*" : STRORDASH(passsite->user)), STRORDASH(passsite->keyword));
+	if (!ctx->sslctx->origcrt) {
+		if (protossl_srcssl_names(ctx, cert->crt) == -1 ||
+		    protossl_srcssl_passsite(ctx)) {
 			cert_free(cert);
-			// Differentiate passsite from passthrough option by raising the passsite flag
-			ctx->passsite = 1;
 			return NULL;
 		}
-		passsite = passsite->next;
 	}
 
-	SSL_CTX *sslctx = protossl_srcsslctx_create(ctx, cert->crt, cert->chain,
-	                                       cert->key);
-	cert_free(cert);
-	if (!sslctx)
-		return NULL;
-	SSL *ssl = SSL_new(sslctx);
-	SSL_CTX_free(sslctx); /* SSL_new() increments refcount */
-	if (!ssl) {
-		ctx->enomem = 1;
-		return NULL;
+	SSL *ssl = protossl_srcssl_new(ctx, cert->crt, cert->chain, cert->key);
+	if (ssl) {
+		protossl_snicrt_set(ctx, cert->crt);
 	}
-#ifdef SSL_MODE_RELEASE_BUFFERS
-	/* lower memory footprint for idle connections */
-	SSL_set_mode(ssl, SSL_get_mode(ssl) | SSL_MODE_RELEASE_BUFFERS);
-#endif /* SSL_MODE_RELEASE_BUFFERS */
+	cert_free(cert);
 	return ssl;
 }
 
@@ -765,9 +836,9 @@ protossl_srcssl_create(pxy_conn_ctx_t *ctx, SSL *origssl)
  * indicate to it.
  */
 static int
-protossl_ossl_servername_cb(SSL *ssl, UNUSED int *al, void *arg)
+protossl_ossl_servername_cb(SSL *ssl, UNUSED int *al, UNUSED void *arg)
 {
-	pxy_conn_ctx_t *ctx = arg;
+	pxy_conn_ctx_t *ctx = SSL_get_app_data(ssl);
 	const char *sn;
 	X509 *sslcrt;
 
@@ -807,7 +878,9 @@ protossl_ossl_servername_cb(SSL *ssl, UNUSED int *al, void *arg)
 	/* generate a new certificate with sn as additional altSubjectName
 	 * and replace it both in the current SSL ctx and in the cert cache */
 	if (ctx->spec->opts->allow_wrong_host && !ctx->sslctx->immutable_cert &&
+	    ctx->sslctx->origcrt &&
 	    !ssl_x509_names_match((sslcrt = SSL_get_certificate(ssl)), sn)) {
+		crtrec_t *rec;
 		X509 *newcrt;
 		SSL_CTX *newsslctx;
 
@@ -815,14 +888,9 @@ protossl_ossl_servername_cb(SSL *ssl, UNUSED int *al, void *arg)
 			log_dbg_printf("Certificate cache: UPDATE "
 			               "(SNI mismatch)\n");
 		}
-		newcrt = ssl_x509_forge(ctx->spec->opts->cacrt, ctx->spec->opts->cakey,
-		                        sslcrt, ctx->global->key,
-		                        sn, ctx->spec->opts->crlurl);
-		if (!newcrt) {
-			ctx->enomem = 1;
+		if (!(rec = protossl_crtrec_forge(ctx, sslcrt, sn)))
 			return SSL_TLSEXT_ERR_NOACK;
-		}
-		cachemgr_fkcrt_set(ctx->sslctx->origcrt, newcrt);
+		newcrt = rec->crt;
 		ctx->sslctx->generated_cert = 1;
 		if (OPTS_DEBUG(ctx->global)) {
 			log_dbg_printf("===> Updated forged server "
@@ -830,33 +898,21 @@ protossl_ossl_servername_cb(SSL *ssl, UNUSED int *al, void *arg)
 			protossl_debug_crt(newcrt);
 		}
 		if (WANT_CONNECT_LOG(ctx) || ctx->spec->opts->passsites) {
-			if (ctx->sslctx->ssl_names) {
-				free(ctx->sslctx->ssl_names);
-			}
-			ctx->sslctx->ssl_names = ssl_x509_names_to_str(newcrt);
-			if (!ctx->sslctx->ssl_names) {
-				ctx->enomem = 1;
-			}
+			ctx->sslctx->ssl_names = protossl_names(ctx, newcrt);
 		}
 		if (WANT_CONNECT_LOG(ctx) || ctx->global->certgendir) {
-			if (ctx->sslctx->usedcrtfpr) {
-				free(ctx->sslctx->usedcrtfpr);
-			}
-			ctx->sslctx->usedcrtfpr = ssl_x509_fingerprint(newcrt, 0);
-			if (!ctx->sslctx->usedcrtfpr) {
-				ctx->enomem = 1;
-			}
+			ctx->sslctx->usedcrtfpr = rec->usedfpr;
 		}
 
 		newsslctx = protossl_srcsslctx_create(ctx, newcrt, ctx->spec->opts->chain,
 		                                 ctx->global->key);
 		if (!newsslctx) {
-			X509_free(newcrt);
 			return SSL_TLSEXT_ERR_NOACK;
 		}
+		crtrec_set_sslctx(rec, newsslctx, ctx->spec->opts->serial);
 		SSL_set_SSL_CTX(ssl, newsslctx); /* decr's old incr new refc */
 		SSL_CTX_free(newsslctx);
-		X509_free(newcrt);
+		protossl_snicrt_set(ctx, newcrt);
 	} else if (OPTS_DEBUG(ctx->global)) {
 		log_dbg_printf("Certificate cache: KEEP (SNI match or "
 		               "target mode)\n");
@@ -978,11 +1034,12 @@ protossl_bufferevent_setup(pxy_conn_ctx_t *ctx, evutil_socket_t fd, SSL *ssl)
 #endif /* DEBUG_PROXY */
 
 	struct bufferevent *bev = bufferevent_openssl_socket_new(ctx->evbase, fd, ssl,
-			((fd == -1) ? BUFFEREVENT_SSL_CONNECTING : BUFFEREVENT_SSL_ACCEPTING), BEV_OPT_DEFER_CALLBACKS|BEV_OPT_THREADSAFE);
+			((fd == -1) ? BUFFEREVENT_SSL_CONNECTING : BUFFEREVENT_SSL_ACCEPTING), BEV_OPT_DEFER_CALLBACKS);
 	if (!bev) {
 		log_err_level_printf(LOG_CRIT, "Error creating bufferevent socket\n");
 		return NULL;
 	}
+	pxy_bufferevent_account(bev, ctx->thr);
 #if LIBEVENT_VERSION_NUMBER >= 0x02010000
 #ifdef DEBUG_PROXY
 	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_bufferevent_setup: bufferevent_openssl_set_allow_dirty_shutdown\n");
@@ -1008,11 +1065,12 @@ protossl_bufferevent_setup_child(pxy_conn_child_ctx_t *ctx, evutil_socket_t fd,
 #endif /* DEBUG_PROXY */
 
 	struct bufferevent *bev = bufferevent_openssl_socket_new(ctx->conn->evbase, fd, ssl,
-			((fd == -1) ? BUFFEREVENT_SSL_CONNECTING : BUFFEREVENT_SSL_ACCEPTING), BEV_OPT_DEFER_CALLBACKS|BEV_OPT_THREADSAFE);
+			((fd == -1) ? BUFFEREVENT_SSL_CONNECTING : BUFFEREVENT_SSL_ACCEPTING), BEV_OPT_DEFER_CALLBACKS);
 	if (!bev) {
 		log_err_level_printf(LOG_CRIT, "Error creating bufferevent socket\n");
 		return NULL;
 	}
+	pxy_bufferevent_account(bev, ctx->conn->thr);
 
 #if LIBEVENT_VERSION_NUMBER >= 0x02010000
 #ifdef DEBUG_PROXY
@@ -1046,6 +1104,9 @@ protossl_bufferevent_free_and_close_fd(struct bufferevent *bev, pxy_conn_ctx_t *
 #endif /* DEBUG_PROXY */
 
 	SSL *ssl = bufferevent_openssl_get_ssl(bev); /* does not inc refc */
+	// The SSL may outlive the conn during shutdown
+	SSL_set_info_callback(ssl, NULL);
+	pxy_bufferevent_unaccount(bev, ctx->thr);
 
 	// @todo Do we need to NULL all cbs?
 	// @see https://stackoverflow.com/questions/31688709/knowing-all-callbacks-have-run-with-libevent-and-bufferevent-free
@@ -1057,14 +1118,8 @@ protossl_bufferevent_free_and_close_fd(struct bufferevent *bev, pxy_conn_ctx_t *
 void
 protossl_free(pxy_conn_ctx_t *ctx)
 {
-	if (ctx->sslctx->ssl_names) {
-		free(ctx->sslctx->ssl_names);
-	}
-	if (ctx->sslctx->origcrtfpr) {
-		free(ctx->sslctx->origcrtfpr);
-	}
-	if (ctx->sslctx->usedcrtfpr) {
-		free(ctx->sslctx->usedcrtfpr);
+	if (ctx->sslctx->crtrec) {
+		crtrec_free(ctx->sslctx->crtrec);
 	}
 	if (ctx->sslctx->origcrt) {
 		X509_free(ctx->sslctx->origcrt);
@@ -1072,13 +1127,9 @@ protossl_free(pxy_conn_ctx_t *ctx)
 	if (ctx->sslctx->sni) {
 		free(ctx->sslctx->sni);
 	}
-	if (ctx->sslctx->srvdst_ssl_version) {
-		free(ctx->sslctx->srvdst_ssl_version);
-	}
-	if (ctx->sslctx->srvdst_ssl_cipher) {
-		free(ctx->sslctx->srvdst_ssl_cipher);
-	}
-	free(ctx->sslctx);
+	// The names, fingerprints and srvdst ssl info are allocated from the conn arena
+	// or belong to the forged cert record
+	slab_free(ctx->thr->slab, ctx->sslctx, sizeof(ssl_ctx_t));
 	// It is necessary to NULL the sslctx to prevent passthrough mode trying to access it (signal 11 crash)
 	ctx->sslctx = NULL;
 }
@@ -1106,10 +1157,58 @@ protossl_sni_resolve_cb(int errcode, struct evutil_addrinfo *ai, void *arg)
 	memcpy(&ctx->dstaddr, ai->ai_addr, ai->ai_addrlen);
 	ctx->dstaddrlen = ai->ai_addrlen;
 	evutil_freeaddrinfo(ai);
+	pxy_thrmgr_phase_done(ctx, PXY_PHASE_DNS, ctx->ts_phase);
+	pxy_conn_connect(ctx);
+}
+
+static void
+protossl_sni_dnscache_cb(int errcode, struct sockaddr *addr, socklen_t addrlen, void *arg)
+{
+	pxy_conn_ctx_t *ctx = arg;
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_sni_dnscache_cb: ENTER, fd=%d\n", ctx->fd);
+#endif /* DEBUG_PROXY */
+
+	if (errcode) {
+		log_err_printf("Cannot resolve SNI hostname '%s': %s\n", ctx->sslctx->sni, evutil_gai_strerror(errcode));
+		evutil_closesocket(ctx->fd);
+		pxy_conn_ctx_free(ctx, 1);
+		return;
+	}
+
+	memcpy(&ctx->dstaddr, addr, addrlen);
+	ctx->dstaddrlen = addrlen;
+	pxy_thrmgr_phase_done(ctx, PXY_PHASE_DNS, ctx->ts_phase);
 	pxy_conn_connect(ctx);
 }
 #endif /* !OPENSSL_NO_TLSEXT */
 
+#ifndef OPENSSL_NO_TLSEXT
+/*
+ * Decide PassSites from the SNI before connecting to the server.  Users are
+ * identified only after the server connection is established, so only the
+ * sites without filters or with client ip filters are decided here.  The
+ * rest are matched against the SNI and the common names of the server
+ * certificate after the server handshake, in protossl_srcssl_create().
+ */
+static void NONNULL(1)
+protossl_passsite_sni(pxy_conn_ctx_t *ctx)
+{
+	if (!ctx->spec->opts->passsite_index || !ctx->sslctx->sni)
+		return;
+
+	passsite_t *passsite = passsite_index_match(ctx->spec->opts->passsite_index,
+			ctx->sslctx->sni, strlen(ctx->sslctx->sni), pxy_conn_srchost_str(ctx), NULL, NULL, 0);
+	if (passsite) {
+		// Do not print the surrounding slashes
+		log_err_level_printf(LOG_WARNING, "Found pass site by SNI: %.*s for user %s\n", (int)strlen(passsite->site) - 2, passsite->site + 1,
+				passsite->ip ? passsite->ip : "*");
+		ctx->passsite = 1;
+		ctx->thr->srcssl_stages[PXY_SRCSSL_PASSSNI]++;
+	}
+}
+#endif /* !OPENSSL_NO_TLSEXT */
+
 /*
  * The src fd is readable.  This is used to sneak-preview the SNI on SSL
  * connections.  If ctx->ev is NULL, it was called manually for a non-SSL
@@ -1138,8 +1237,7 @@ protossl_fd_readcb(MAYBE_UNUSED evutil_socket_t fd, UNUSED short what, void *arg
 			goto out;
 
 		// @attention Add the conn to pending ssl conns list before adding (activating) the event
-		// Because the event may (and does) fire before this thrmgr thread adds the conn to pending ssl conns list,
-		// and since the pending flag is not set yet, the conn remains in the pending list
+		// So that the conn can be expired by thr timercb even if event_add() fails below
 		pxy_thrmgr_add_pending_ssl_conn(ctx);
 
 		if (event_add(ctx->ev, NULL) == -1) {
@@ -1152,10 +1250,9 @@ protossl_fd_readcb(MAYBE_UNUSED evutil_socket_t fd, UNUSED short what, void *arg
 			// It is ok if event_add() fails, hence readcb never fires, because we can expire and close the conn as it is in the pending list now
 			//goto out;
 		}
-		// @attention This is the thrmgr thread, do not do anything else with the conn after adding the event, just return
+		// Conn setup continues in the next readcb, when the client sends its ClientHello
 		return;
 	}
-	// From this point on is the connection handling thread (not the thrmgr thread)
 
 	pxy_thrmgr_remove_pending_ssl_conn(ctx);
 
@@ -1222,8 +1319,16 @@ protossl_fd_readcb(MAYBE_UNUSED evutil_socket_t fd, UNUSED short what, void *arg
 	}
 	event_free(ctx->ev);
 	ctx->ev = NULL;
+	ctx->ts_phase = pxy_thrmgr_phase_done(ctx, PXY_PHASE_SNI, ctx->ts_phase);
+
+	protossl_passsite_sni(ctx);
 
 	if (ctx->sslctx->sni && !ctx->dstaddrlen && ctx->spec->sni_port) {
+		if (ctx->global->dnscache) {
+			dnscache_resolve(ctx->evbase, ctx->dnsbase, ctx->sslctx->sni, ctx->af, ctx->spec->sni_port, protossl_sni_dnscache_cb, ctx);
+			return;
+		}
+
 		char sniport[6];
 		struct evutil_addrinfo hints;
 
@@ -1246,6 +1351,21 @@ out:
 	pxy_conn_ctx_free(ctx, 1);
 }
 
+/*
+ * Info callback of the srvdst SSL; the handshake starts once the TCP
+ * connection is established, which ends the connect phase.  Called again for
+ * the session tickets of TLS 1.3, hence the check.
+ */
+static void
+protossl_srvdst_info_cb(const SSL *ssl, int where, UNUSED int ret)
+{
+	pxy_conn_ctx_t *ctx = SSL_get_app_data(ssl);
+
+	if ((where & SSL_CB_HANDSHAKE_START) && ctx && !(ctx->phases & (1 << PXY_PHASE_CONNECT))) {
+		ctx->ts_phase = pxy_thrmgr_phase_done(ctx, PXY_PHASE_CONNECT, ctx->ts_phase);
+	}
+}
+
 int
 protossl_setup_srvdst_ssl(pxy_conn_ctx_t *ctx)
 {
@@ -1255,6 +1375,8 @@ protossl_setup_srvdst_ssl(pxy_conn_ctx_t *ctx)
 		pxy_conn_term(ctx, 1);
 		return -1;
 	}
+	SSL_set_app_data(ctx->srvdst.ssl, ctx);
+	SSL_set_info_callback(ctx->srvdst.ssl, protossl_srvdst_info_cb);
 	return 0;
 }
 
@@ -1281,7 +1403,7 @@ int
 protossl_setup_srvdst_new_bev_ssl_connecting(pxy_conn_ctx_t *ctx)
 {
 	ctx->srvdst.bev = bufferevent_openssl_filter_new(ctx->evbase, ctx->srvdst.bev, ctx->srvdst.ssl,
-			BUFFEREVENT_SSL_CONNECTING, BEV_OPT_DEFER_CALLBACKS|BEV_OPT_THREADSAFE);
+			BUFFEREVENT_SSL_CONNECTING, BEV_OPT_DEFER_CALLBACKS);
 	if (!ctx->srvdst.bev) {
 		log_err_level_printf(LOG_CRIT, "Error creating srvdst bufferevent\n");
 		SSL_free(ctx->srvdst.ssl);
@@ -1289,10 +1411,61 @@ protossl_setup_srvdst_new_bev_ssl_connecting(pxy_conn_ctx_t *ctx)
 		pxy_conn_term(ctx, 1);
 		return -1;
 	}
+	pxy_bufferevent_account(ctx->srvdst.bev, ctx->thr);
 	ctx->srvdst.free = protossl_bufferevent_free_and_close_fd;
 	return 0;
 }
 
+/*
+ * Start the client handshake with the forged cert last served for the SNI
+ * and the destination, in parallel with the server handshake.  The src
+ * callbacks do not read, so the client data waits until the server cert is
+ * verified in protossl_enable_src().  PassSite, passthrough and target certs
+ * need the server cert to decide on the cert to serve, so they rule this
+ * out.  Without a cached cert, the src is set up after the server handshake
+ * as usual.
+ */
+static void NONNULL(1)
+protossl_optimistic_start(pxy_conn_ctx_t *ctx)
+{
+	crtrec_t *rec;
+	SSL *ssl;
+
+	if (!ctx->spec->opts->optimistic_handshake || !ctx->sslctx->sni ||
+	    ctx->spec->opts->passsite_index || ctx->spec->opts->passthrough ||
+	    ctx->global->tgcrtdir || !ctx->global->key)
+		return;
+
+	rec = cachemgr_snicrt_get((struct sockaddr *)&ctx->dstaddr,
+	                          ctx->dstaddrlen, ctx->sslctx->sni);
+	if (OPTS_DEBUG(ctx->global)) {
+		log_dbg_printf("SNI certificate cache: %s\n", rec ? "HIT" : "MISS");
+	}
+	if (!rec)
+		return;
+
+	ctx->sslctx->crtrec = rec;
+	ssl = protossl_srcssl_new(ctx, rec->crt, ctx->spec->opts->chain,
+	                          ctx->global->key);
+	if (ssl) {
+		ctx->src.bev = protossl_bufferevent_setup(ctx, ctx->fd, ssl);
+		if (!ctx->src.bev) {
+			SSL_free(ssl);
+		}
+	}
+	if (!ctx->src.bev) {
+		ctx->sslctx->crtrec = NULL;
+		crtrec_free(rec);
+		return;
+	}
+	ctx->src.ssl = ssl;
+	ctx->src.free = protossl_bufferevent_free_and_close_fd;
+	ctx->sslctx->optimistic = 1;
+	ctx->sslctx->ts_optimistic = histo_now();
+	ctx->thr->srcssl_stages[PXY_SRCSSL_OPTIMISTIC]++;
+	bufferevent_setcb(ctx->src.bev, NULL, NULL, pxy_bev_eventcb, ctx);
+}
+
 int
 protossl_conn_connect(pxy_conn_ctx_t *ctx)
 {
@@ -1302,11 +1475,24 @@ protossl_conn_connect(pxy_conn_ctx_t *ctx)
 	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "protossl_conn_connect: ENTER, fd=%d\n", fd);
 #endif /* DEBUG_PROXY */
 
+	if (ctx->passsite) {
+		// The SNI has decided on passthrough, so neither connect to the server
+		// over SSL nor forge a cert, just switch to passthrough mode before connecting
+		if (ctx->protoctx->proto_free) {
+			ctx->protoctx->proto_free(ctx);
+			ctx->protoctx->proto_free = NULL;
+		}
+		ctx->proto = protopassthrough_setup(ctx);
+		return ctx->protoctx->connectcb(ctx);
+	}
+
 	/* create server-side socket and eventbuffer */
 	if (protossl_setup_srvdst(ctx) == -1) {
 		return -1;
 	}
 
+	protossl_optimistic_start(ctx);
+
 	// Conn setup is successful, so add the conn to the conn list of its thread now
 	pxy_thrmgr_add_conn(ctx);
 
@@ -1441,7 +1627,7 @@ int
 protossl_setup_src_new_bev_ssl_accepting(pxy_conn_ctx_t *ctx)
 {
 	ctx->src.bev = bufferevent_openssl_filter_new(ctx->evbase, ctx->src.bev, ctx->src.ssl,
-			BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_DEFER_CALLBACKS|BEV_OPT_THREADSAFE);
+			BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_DEFER_CALLBACKS);
 	if (!ctx->src.bev) {
 		log_err_level_printf(LOG_CRIT, "Error creating src bufferevent\n");
 		SSL_free(ctx->src.ssl);
@@ -1449,6 +1635,7 @@ protossl_setup_src_new_bev_ssl_accepting(pxy_conn_ctx_t *ctx)
 		pxy_conn_term(ctx, 1);
 		return -1;
 	}
+	pxy_bufferevent_account(ctx->src.bev, ctx->thr);
 	ctx->src.free = protossl_bufferevent_free_and_close_fd;
 	return 0;
 }
@@ -1457,7 +1644,7 @@ int
 protossl_setup_dst_new_bev_ssl_connecting_child(pxy_conn_child_ctx_t *ctx)
 {
 	ctx->dst.bev = bufferevent_openssl_filter_new(ctx->conn->evbase, ctx->dst.bev, ctx->dst.ssl,
-			BUFFEREVENT_SSL_CONNECTING, BEV_OPT_DEFER_CALLBACKS|BEV_OPT_THREADSAFE);
+			BUFFEREVENT_SSL_CONNECTING, BEV_OPT_DEFER_CALLBACKS);
 	if (!ctx->dst.bev) {
 		log_err_level_printf(LOG_CRIT, "Error creating dst bufferevent\n");
 		SSL_free(ctx->dst.ssl);
@@ -1465,25 +1652,85 @@ protossl_setup_dst_new_bev_ssl_connecting_child(pxy_conn_child_ctx_t *ctx)
 		pxy_conn_term(ctx->conn, 1);
 		return -1;
 	}
+	pxy_bufferevent_account(ctx->dst.bev, ctx->conn->thr);
 	ctx->dst.free = protossl_bufferevent_free_and_close_fd;
 	return 0;
 }
 
+/*
+ * Verify that the server cert of an optimistic conn is the one the cert
+ * served to the client was forged for, and take the log strings from the
+ * record of the cert.  Otherwise, the cert is not served in optimistic
+ * handshakes any more, and the conn is terminated unless OptimisticMismatch
+ * is log.
+ * Returns -1 if the conn is terminated, 0 otherwise.
+ */
+static int NONNULL(1)
+protossl_optimistic_verify(pxy_conn_ctx_t *ctx)
+{
+	crtrec_t *rec = ctx->sslctx->crtrec;
+	char *fpr = NULL;
+
+	cachemgr_dsess_set((struct sockaddr*)&ctx->dstaddr,
+	                   ctx->dstaddrlen, ctx->sslctx->sni,
+	                   SSL_get0_session(ctx->srvdst.ssl));
+
+	ctx->sslctx->origcrt = SSL_get_peer_certificate(ctx->srvdst.ssl);
+	if (ctx->sslctx->origcrt &&
+	    !(fpr = protossl_fingerprint(ctx, ctx->sslctx->origcrt)))
+		return -1;
+
+	ctx->sslctx->generated_cert = 1;
+	ctx->sslctx->usedcrtfpr = rec->usedfpr;
+	if (fpr && !strcmp(fpr, rec->origfpr)) {
+		ctx->sslctx->origcrtfpr = rec->origfpr;
+		ctx->sslctx->ssl_names = rec->names;
+		return 0;
+	}
+
+	log_err_level_printf(LOG_WARNING, "Server cert for SNI %s is not the one "
+	                     "the optimistic handshake cert was forged for%s\n",
+	                     ctx->sslctx->sni,
+	                     ctx->spec->opts->optimistic_mismatch_log ? "" : "; terminating");
+	cachemgr_snicrt_del((struct sockaddr *)&ctx->dstaddr, ctx->dstaddrlen,
+	                    ctx->sslctx->sni);
+	ctx->thr->srcssl_stages[PXY_SRCSSL_MISMATCH]++;
+	if (!ctx->spec->opts->optimistic_mismatch_log) {
+		pxy_conn_term(ctx, 1);
+		return -1;
+	}
+
+	ctx->sslctx->origcrtfpr = fpr;
+	if (ctx->sslctx->origcrt && WANT_CONNECT_LOG(ctx) &&
+	    !(ctx->sslctx->ssl_names = protossl_names(ctx, ctx->sslctx->origcrt)))
+		return -1;
+	return 0;
+}
+
 static int NONNULL(1)
 protossl_enable_src(pxy_conn_ctx_t *ctx)
 {
 	int rv;
-	if ((rv = protossl_setup_src(ctx)) != 0) {
+	if (ctx->sslctx->optimistic) {
+		// The client handshake started with the cert cached for the SNI
+		if (protossl_optimistic_verify(ctx) == -1) {
+			return -1;
+		}
+	} else if ((rv = protossl_setup_src(ctx)) != 0) {
 		// Might have switched to passthrough mode
 		return rv;
 	}
 	bufferevent_setcb(ctx->src.bev, pxy_bev_readcb, pxy_bev_writecb, pxy_bev_eventcb, ctx);
 
 	// Save the srvdst ssl info for logging
-	ctx->sslctx->srvdst_ssl_version = strdup(SSL_get_version(ctx->srvdst.ssl));
-	ctx->sslctx->srvdst_ssl_cipher = strdup(SSL_get_cipher(ctx->srvdst.ssl));
+	ctx->sslctx->srvdst_ssl_version = slab_arena_strdup(&ctx->arena, SSL_get_version(ctx->srvdst.ssl));
+	ctx->sslctx->srvdst_ssl_cipher = slab_arena_strdup(&ctx->arena, SSL_get_cipher(ctx->srvdst.ssl));
 
-	if (pxy_setup_child_listener(ctx) == -1) {
+	if (ctx->spec->opts->plugin) {
+		if (pxy_plugin_engage(ctx) == -1) {
+			return -1;
+		}
+	} else if (pxy_setup_child_listener(ctx) == -1) {
 		return -1;
 	}
 
@@ -1491,6 +1738,9 @@ protossl_enable_src(pxy_conn_ctx_t *ctx)
 	log_dbg_level_printf(LOG_DBG_MODE_FINER, "protossl_enable_src: Enabling src, %s, child_fd=%d, fd=%d\n", ctx->sslproxy_header, ctx->child_fd, ctx->fd);
 #endif /* DEBUG_PROXY */
 
+	// The client handshake starts now, unless it is optimistic
+	ctx->ts_phase = histo_now();
+
 	// Now open the gates
 	bufferevent_enable(ctx->src.bev, EV_READ|EV_WRITE);
 	return 0;
@@ -1524,18 +1774,23 @@ protossl_bev_eventcb_connected_srvdst(UNUSED struct bufferevent *bev, pxy_conn_c
 	ctx->srvdst_connected = 1;
 	bufferevent_enable(ctx->srvdst.bev, EV_WRITE);
 	
-	if (prototcp_setup_dst(ctx) == -1) {
-		return;
-	}
-	bufferevent_setcb(ctx->dst.bev, pxy_bev_readcb, pxy_bev_writecb, pxy_bev_eventcb, ctx);
-	bufferevent_enable(ctx->dst.bev, EV_READ|EV_WRITE);
-	if (bufferevent_socket_connect(ctx->dst.bev, (struct sockaddr *)&ctx->spec->conn_dst_addr, ctx->spec->conn_dst_addrlen) == -1) {
+	if (ctx->spec->opts->plugin) {
+		// The plugin relays to srvdst, there is no listening program to connect to
+		ctx->dst_connected = 1;
+	} else {
+		if (prototcp_setup_dst(ctx) == -1) {
+			return;
+		}
+		bufferevent_setcb(ctx->dst.bev, pxy_bev_readcb, pxy_bev_writecb, pxy_bev_eventcb, ctx);
+		bufferevent_enable(ctx->dst.bev, EV_READ|EV_WRITE);
+		if (bufferevent_socket_connect(ctx->dst.bev, (struct sockaddr *)&ctx->spec->conn_dst_addr, ctx->spec->conn_dst_addrlen) == -1) {
 #ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINE, "protossl_bev_eventcb_connected_srvdst: FAILED bufferevent_socket_connect for dst, fd=%d\n", ctx->fd);
+			log_dbg_level_printf(LOG_DBG_MODE_FINE, "protossl_bev_eventcb_connected_srvdst: FAILED bufferevent_socket_connect for dst, fd=%d\n", ctx->fd);
 #endif /* DEBUG_PROXY */
 
-		pxy_conn_term(ctx, 1);
-		return;
+			pxy_conn_term(ctx, 1);
+			return;
+		}
 	}
 
 	if (ctx->srvdst_connected && ctx->dst_connected && !ctx->connected) {
@@ -1652,7 +1907,7 @@ protossl_setup(pxy_conn_ctx_t *ctx)
 
 	ctx->protoctx->proto_free = protossl_free;
 
-	ctx->sslctx = malloc(sizeof(ssl_ctx_t));
+	ctx->sslctx = slab_alloc(ctx->thr->slab, sizeof(ssl_ctx_t));
 	if (!ctx->sslctx) {
 		return PROTO_ERROR;
 	}
@@ -29,6 +29,7 @@
 
 #include "prototcp.h"
 #include "protopassthrough.h"
+#include "pxyplugin.h"
 
 #include <sys/param.h>
 #include <string.h>
@@ -52,7 +53,7 @@ prototcp_bufferevent_setup(pxy_conn_ctx_t *ctx, evutil_socket_t fd)
 #endif /* DEBUG_PROXY */
 
 	// @todo Do we really need to defer callbacks? BEV_OPT_DEFER_CALLBACKS seems responsible for the issue with srvdst: We get writecb sometimes, no eventcb for CONNECTED event
-	struct bufferevent *bev = bufferevent_socket_new(ctx->evbase, fd, BEV_OPT_DEFER_CALLBACKS|BEV_OPT_THREADSAFE);
+	struct bufferevent *bev = bufferevent_socket_new(ctx->evbase, fd, BEV_OPT_DEFER_CALLBACKS);
 	if (!bev) {
 		log_err_level_printf(LOG_CRIT, "Error creating bufferevent socket\n");
 #ifdef DEBUG_PROXY
@@ -61,6 +62,7 @@ prototcp_bufferevent_setup(pxy_conn_ctx_t *ctx, evutil_socket_t fd)
 
 		return NULL;
 	}
+	pxy_bufferevent_account(bev, ctx->thr);
 
 	// @attention Do not set callbacks here, srvdst does not set r cb
 	//bufferevent_setcb(bev, pxy_bev_readcb, pxy_bev_writecb, pxy_bev_eventcb, ctx);
@@ -76,7 +78,7 @@ prototcp_bufferevent_setup_child(pxy_conn_child_ctx_t *ctx, evutil_socket_t fd)
 	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "prototcp_bufferevent_setup_child: ENTER, fd=%d\n", fd);
 #endif /* DEBUG_PROXY */
 
-	struct bufferevent *bev = bufferevent_socket_new(ctx->conn->evbase, fd, BEV_OPT_DEFER_CALLBACKS|BEV_OPT_THREADSAFE);
+	struct bufferevent *bev = bufferevent_socket_new(ctx->conn->evbase, fd, BEV_OPT_DEFER_CALLBACKS);
 	if (!bev) {
 		log_err_level_printf(LOG_CRIT, "Error creating bufferevent socket\n");
 #ifdef DEBUG_PROXY
@@ -85,6 +87,7 @@ prototcp_bufferevent_setup_child(pxy_conn_child_ctx_t *ctx, evutil_socket_t fd)
 
 		return NULL;
 	}
+	pxy_bufferevent_account(bev, ctx->conn->thr);
 
 	bufferevent_setcb(bev, pxy_bev_readcb_child, pxy_bev_writecb_child, pxy_bev_eventcb_child, ctx);
 
@@ -97,7 +100,7 @@ prototcp_bufferevent_setup_child(pxy_conn_child_ctx_t *ctx, evutil_socket_t fd)
  * Free bufferenvent and close underlying socket properly.
  */
 static void
-prototcp_bufferevent_free_and_close_fd(struct bufferevent *bev, UNUSED pxy_conn_ctx_t *ctx)
+prototcp_bufferevent_free_and_close_fd(struct bufferevent *bev, pxy_conn_ctx_t *ctx)
 {
 	evutil_socket_t fd = bufferevent_getfd(bev);
 
@@ -106,6 +109,7 @@ prototcp_bufferevent_free_and_close_fd(struct bufferevent *bev, UNUSED pxy_conn_
 			evbuffer_get_length(bufferevent_get_input(bev)), evbuffer_get_length(bufferevent_get_output(bev)), fd);
 #endif /* DEBUG_PROXY */
 
+	pxy_bufferevent_unaccount(bev, ctx->thr);
 	bufferevent_free(bev);
 	evutil_closesocket(fd);
 }
@@ -393,22 +397,7 @@ prototcp_bev_readcb_src_child(struct bufferevent *bev, pxy_conn_child_ctx_t *ctx
 	struct evbuffer *outbuf = bufferevent_get_output(ctx->dst.bev);
 
 	if (!ctx->removed_sslproxy_header) {
-		size_t packet_size = evbuffer_get_length(inbuf);
-		unsigned char *packet = pxy_malloc_packet(packet_size, ctx->conn);
-		if (!packet) {
-			return;
-		}
-
-		evbuffer_remove(inbuf, packet, packet_size);
-		pxy_try_remove_sslproxy_header(ctx, packet, &packet_size);
-		evbuffer_add(outbuf, packet, packet_size);
-
-#ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINEST, "prototcp_bev_readcb_src_child: NEW packet, size=%zu, child fd=%d, fd=%d:\n%.*s\n",
-				packet_size, ctx->fd, ctx->conn->fd, (int)packet_size, packet);
-#endif /* DEBUG_PROXY */
-
-		free(packet);
+		pxy_remove_sslproxy_header(ctx, inbuf, outbuf);
 	} else {
 		evbuffer_add_buffer(outbuf, inbuf);
 	}
@@ -628,7 +617,11 @@ prototcp_enable_src(pxy_conn_ctx_t *ctx)
 	}
 	bufferevent_setcb(ctx->src.bev, pxy_bev_readcb, pxy_bev_writecb, pxy_bev_eventcb, ctx);
 
-	if (pxy_setup_child_listener(ctx) == -1) {
+	if (ctx->spec->opts->plugin) {
+		if (pxy_plugin_engage(ctx) == -1) {
+			return -1;
+		}
+	} else if (pxy_setup_child_listener(ctx) == -1) {
 		return -1;
 	}
 
@@ -677,18 +670,23 @@ prototcp_bev_eventcb_connected_srvdst(UNUSED struct bufferevent *bev, pxy_conn_c
 	ctx->srvdst_connected = 1;
 	bufferevent_enable(ctx->srvdst.bev, EV_WRITE);
 
-	if (prototcp_setup_dst(ctx) == -1) {
-		return;
-	}
-	bufferevent_setcb(ctx->dst.bev, pxy_bev_readcb, pxy_bev_writecb, pxy_bev_eventcb, ctx);
-	bufferevent_enable(ctx->dst.bev, EV_READ|EV_WRITE);
-	if (bufferevent_socket_connect(ctx->dst.bev, (struct sockaddr *)&ctx->spec->conn_dst_addr, ctx->spec->conn_dst_addrlen) == -1) {
+	if (ctx->spec->opts->plugin) {
+		// The plugin relays to srvdst, there is no listening program to connect to
+		ctx->dst_connected = 1;
+	} else {
+		if (prototcp_setup_dst(ctx) == -1) {
+			return;
+		}
+		bufferevent_setcb(ctx->dst.bev, pxy_bev_readcb, pxy_bev_writecb, pxy_bev_eventcb, ctx);
+		bufferevent_enable(ctx->dst.bev, EV_READ|EV_WRITE);
+		if (bufferevent_socket_connect(ctx->dst.bev, (struct sockaddr *)&ctx->spec->conn_dst_addr, ctx->spec->conn_dst_addrlen) == -1) {
 #ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINE, "prototcp_bev_eventcb_connected_srvdst: FAILED bufferevent_socket_connect for dst, fd=%d\n", ctx->fd);
+			log_dbg_level_printf(LOG_DBG_MODE_FINE, "prototcp_bev_eventcb_connected_srvdst: FAILED bufferevent_socket_connect for dst, fd=%d\n", ctx->fd);
 #endif /* DEBUG_PROXY */
 
-		pxy_conn_term(ctx, 1);
-		return;
+			pxy_conn_term(ctx, 1);
+			return;
+		}
 	}
 
 	if (ctx->srvdst_connected && ctx->dst_connected && !ctx->connected) {
@@ -32,8 +32,13 @@
 #include "pxythrmgr.h"
 #include "pxyconn.h"
 #include "cachemgr.h"
+#include "cachesnap.h"
+#include "pxystats.h"
 #include "opts.h"
 #include "log.h"
+#include "ssl.h"
+#include "cache.h"
+#include "sys.h"
 #include "attrib.h"
 
 #include <sys/types.h>
@@ -44,6 +49,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <event2/event.h>
 #include <event2/listener.h>
@@ -57,15 +63,31 @@
  * Proxy engine, built around libevent 2.x.
  */
 
-static int signals[] = { SIGTERM, SIGQUIT, SIGHUP, SIGINT, SIGPIPE, SIGUSR1 };
+static int signals[] = { SIGTERM, SIGQUIT, SIGHUP, SIGINT, SIGPIPE, SIGUSR1, SIGUSR2 };
+
+/*
+ * Config replaced by a reload, kept until its conns are gone.
+ */
+typedef struct proxy_retired {
+	global_t *global;
+	struct proxy_retired *next;
+} proxy_retired_t;
 
 struct proxy_ctx {
 	pxy_thrmgr_ctx_t *thrmgr;
 	struct event_base *evbase;
 	struct event *sev[sizeof(signals)/sizeof(int)];
 	struct event *gcev;
+	struct event *snapev;
+	pxy_stats_t *stats;
 	struct proxy_listener_ctx *lctx;
 	global_t *global;
+	// Config of the last reload, new conns on matched listeners use it
+	global_t *reloaded;
+	// Configs replaced by later reloads, freed on the main thread once unused
+	proxy_retired_t *retired;
+	// Privsep client socket for reloads, -1 if reloads are not supported
+	evutil_socket_t reloadsock;
 	int loopbreak_reason;
 };
 
@@ -199,7 +221,340 @@ proxy_listener_setup(struct event_base *evbase, pxy_thrmgr_ctx_t *thrmgr,
 }
 
 /*
- * Signal handler for SIGTERM, SIGQUIT, SIGINT, SIGHUP, SIGPIPE and SIGUSR1.
+ * Return 1 if the option strings differ, 0 otherwise.
+ */
+static int
+proxy_reload_strdiff(const char *s1, const char *s2)
+{
+	if (!s1 || !s2)
+		return s1 != s2;
+	return !!strcmp(s1, s2);
+}
+
+/*
+ * Check that the reloaded config does not change the options which are set
+ * up once on startup, before dropping privileges or starting the threads.
+ * Returns 0 if the reload can be applied, -1 otherwise.
+ */
+int
+proxy_reload_check(global_t *old, global_t *new)
+{
+	const char *opt = NULL;
+
+	if (proxy_reload_strdiff(old->dropuser, new->dropuser))
+		opt = "User";
+	else if (proxy_reload_strdiff(old->dropgroup, new->dropgroup))
+		opt = "Group";
+	else if (proxy_reload_strdiff(old->jaildir, new->jaildir))
+		opt = "Chroot";
+	else if (proxy_reload_strdiff(old->pidfile, new->pidfile))
+		opt = "PidFile";
+	else if (old->detach != new->detach)
+		opt = "Daemon";
+	else if (proxy_reload_strdiff(old->connectlog, new->connectlog))
+		opt = "ConnectLog";
+	else if (proxy_reload_strdiff(old->contentlog, new->contentlog) ||
+	         old->contentlog_isdir != new->contentlog_isdir ||
+	         old->contentlog_isspec != new->contentlog_isspec ||
+	         old->contentlog_isstore != new->contentlog_isstore ||
+	         old->contentlog_segsize != new->contentlog_segsize)
+		opt = "ContentLog";
+	else if (proxy_reload_strdiff(old->pcaplog, new->pcaplog) ||
+	         old->pcaplog_isdir != new->pcaplog_isdir ||
+	         old->pcaplog_isspec != new->pcaplog_isspec)
+		opt = "PcapLog";
+	else if (proxy_reload_strdiff(old->masterkeylog, new->masterkeylog))
+		opt = "MasterKeyLog";
+	else if (proxy_reload_strdiff(old->certgendir, new->certgendir) ||
+	         old->certgen_writeall != new->certgen_writeall)
+		opt = "WriteGenCertsDir";
+	else if (proxy_reload_strdiff(old->tgcrtdir, new->tgcrtdir) ||
+	         proxy_reload_strdiff(old->tgcrtidx, new->tgcrtidx))
+		opt = "TargetCertDir";
+	else if (proxy_reload_strdiff(old->cachesnap, new->cachesnap) ||
+	         old->cachesnap_period != new->cachesnap_period)
+		opt = "CacheSnapshot";
+#ifndef WITHOUT_MIRROR
+	else if (proxy_reload_strdiff(old->mirrorif, new->mirrorif) ||
+	         proxy_reload_strdiff(old->mirrortarget, new->mirrortarget))
+		opt = "MirrorIf";
+#endif /* !WITHOUT_MIRROR */
+	else if (proxy_reload_strdiff(old->shmlog, new->shmlog) ||
+	         old->shmlog_size != new->shmlog_size ||
+	         old->shmlog_policy != new->shmlog_policy)
+		opt = "ShmLog";
+	else if (proxy_reload_strdiff(old->userdb_path, new->userdb_path) ||
+	         (!old->userdb && (new->opts->user_auth || global_has_userauth_spec(new))))
+		opt = "UserDBPath";
+#ifdef HAVE_LOCAL_PROCINFO
+	else if (old->lprocinfo != new->lprocinfo)
+		opt = "LogProcInfo";
+#endif /* HAVE_LOCAL_PROCINFO */
+	else if (old->logz != new->logz ||
+	         old->logz_level != new->logz_level ||
+	         old->logz_threads != new->logz_threads)
+		opt = "LogCompression";
+	else if (old->statslog != new->statslog)
+		opt = "LogStats";
+	else if (proxy_reload_strdiff(old->statssock, new->statssock))
+		opt = "StatsSocket";
+	else if (old->conn_thr_count != new->conn_thr_count)
+		opt = "Threads";
+	else if (proxy_reload_strdiff(old->workercpus, new->workercpus))
+		opt = "WorkerCPUs";
+	else if (proxy_reload_strdiff(old->maincpus, new->maincpus))
+		opt = "MainCPUs";
+	else if (proxy_reload_strdiff(old->loggercpus, new->loggercpus))
+		opt = "LoggerCPUs";
+	else if (old->numa != new->numa)
+		opt = "NUMAAware";
+	else if (old->dnscache != new->dnscache ||
+	         (global_has_dns_spec(new) && !global_has_dns_spec(old)))
+		opt = "DNS";
+#ifndef OPENSSL_NO_ENGINE
+	else if (proxy_reload_strdiff(old->openssl_engine, new->openssl_engine))
+		opt = "OpenSSLEngine";
+#endif /* !OPENSSL_NO_ENGINE */
+
+	if (opt) {
+		log_err_level_printf(LOG_WARNING, "Reload changes %s, which needs a restart; "
+		               "keeping the running config\n", opt);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Return 1 if the leaf keys are the same, 0 otherwise.
+ */
+static int
+proxy_reload_keyeq(EVP_PKEY *key1, EVP_PKEY *key2)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	return EVP_PKEY_eq(key1, key2) == 1;
+#else /* OPENSSL_VERSION_NUMBER < 0x30000000L */
+	return EVP_PKEY_cmp(key1, key2) == 1;
+#endif /* OPENSSL_VERSION_NUMBER < 0x30000000L */
+}
+
+/*
+ * Return 1 if the CA cert is used by the global opts or a proxyspec of
+ * global, 0 otherwise.
+ */
+static int
+proxy_reload_has_cacrt(global_t *global, X509 *crt)
+{
+	if (global->opts->cacrt && !X509_cmp(global->opts->cacrt, crt))
+		return 1;
+	for (proxyspec_t *spec = global->spec; spec; spec = spec->next) {
+		if (spec->opts->cacrt && !X509_cmp(spec->opts->cacrt, crt))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Return 1 if the reloaded config signs forged certs with a CA the old one
+ * does not use, 0 otherwise.
+ */
+static int
+proxy_reload_cacrt_changed(global_t *old, global_t *new)
+{
+	if (new->opts->cacrt && !proxy_reload_has_cacrt(old, new->opts->cacrt))
+		return 1;
+	for (proxyspec_t *spec = new->spec; spec; spec = spec->next) {
+		if (spec->opts->cacrt && !proxy_reload_has_cacrt(old, spec->opts->cacrt))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Find the spec of the reloaded config for the listener of spec: same listen
+ * address, NAT engine and child listener address, since the privsep parent
+ * opens sockets for the specs of the initial config only.
+ */
+static proxyspec_t *
+proxy_reload_find_spec(global_t *new, proxyspec_t *spec)
+{
+	for (proxyspec_t *nspec = new->spec; nspec; nspec = nspec->next) {
+		if (nspec->listen_spec ||
+		    nspec->listen_addrlen != spec->listen_addrlen ||
+		    memcmp(&nspec->listen_addr, &spec->listen_addr, spec->listen_addrlen) ||
+		    nspec->child_src_addrlen != spec->child_src_addrlen ||
+		    memcmp(&nspec->child_src_addr, &spec->child_src_addr, spec->child_src_addrlen) ||
+		    proxy_reload_strdiff(nspec->natengine, spec->natengine))
+			continue;
+		return nspec;
+	}
+	return NULL;
+}
+
+/*
+ * Swap the reloaded config in for new conns.  Conns hold a reference to the
+ * config they were set up with, so existing conns go on with their old opts.
+ * Returns 0 on success, -1 if the running config is kept.
+ */
+static int
+proxy_reload_apply(proxy_ctx_t *ctx, global_t *new)
+{
+	global_t *old = ctx->global;
+	proxy_listener_ctx_t *lctx, **prev;
+	int matched = 0, removed = 0, added = 0, flush = 0;
+
+	for (lctx = ctx->lctx; lctx; lctx = lctx->next) {
+		proxyspec_t *nspec = proxy_reload_find_spec(new, lctx->spec);
+		if (nspec) {
+			nspec->listen_spec = lctx->spec->listen_spec ? lctx->spec->listen_spec : lctx->spec;
+			matched++;
+		}
+	}
+	if (!matched) {
+		log_err_level_printf(LOG_WARNING, "Reload leaves no listeners; keeping the running config\n");
+		return -1;
+	}
+
+	/* keep the leaf key unless a different one is configured, so that
+	 * the forged certs in the cache remain valid */
+	if (!new->key) {
+		if (ctx->reloaded && ctx->reloaded->key) {
+			new->key = ctx->reloaded->key;
+		} else if (old->key) {
+			new->key = old->key;
+		}
+		if (new->key) {
+			ssl_key_refcount_inc(new->key);
+		} else if (global_has_ssl_spec(new) && global_has_cakey_spec(new)) {
+			new->key = ssl_key_genrsa(new->leafkey_rsabits);
+			if (!new->key) {
+				log_err_level_printf(LOG_WARNING, "Error generating leaf key; keeping the running config\n");
+				return -1;
+			}
+		}
+	} else {
+		EVP_PKEY *key = ctx->reloaded ? ctx->reloaded->key : old->key;
+		flush = !key || !proxy_reload_keyeq(key, new->key);
+	}
+	if (flush || proxy_reload_cacrt_changed(ctx->reloaded ? ctx->reloaded : old, new)) {
+		/* forged certs and the sessions resumed with them are stale */
+		cache_flush(cachemgr_fkcrt);
+		cache_flush(cachemgr_snicrt);
+		cache_flush(cachemgr_ssess);
+		cachesnap_drop();
+		flush = 1;
+	}
+	if (old->cachesnap && cachesnap_setkeys(new) == -1) {
+		log_err_level_printf(LOG_WARNING, "Failed to set cache snapshot keys\n");
+	}
+
+	prev = &ctx->lctx;
+	while ((lctx = *prev)) {
+		proxyspec_t *nspec;
+		for (nspec = new->spec; nspec; nspec = nspec->next) {
+			if (nspec->listen_spec && nspec->listen_spec ==
+			    (lctx->spec->listen_spec ? lctx->spec->listen_spec : lctx->spec))
+				break;
+		}
+		if (!nspec) {
+			*prev = lctx->next;
+			lctx->next = NULL;
+			proxy_listener_ctx_free(lctx);
+			removed++;
+			continue;
+		}
+		lctx->spec = nspec;
+		lctx->global = new;
+		prev = &lctx->next;
+	}
+
+	for (proxyspec_t *nspec = new->spec; nspec; nspec = nspec->next) {
+		if (nspec->listen_spec)
+			continue;
+		char *specstr = proxyspec_str(nspec);
+		log_err_level_printf(LOG_WARNING, "Reload cannot open new listeners, "
+		               "restart to listen on: %s\n", STRORNONE(specstr));
+		if (specstr)
+			free(specstr);
+		added++;
+	}
+
+	if (ctx->reloaded) {
+		proxy_retired_t *retired = malloc(sizeof(proxy_retired_t));
+		if (retired) {
+			retired->global = ctx->reloaded;
+			retired->next = ctx->retired;
+			ctx->retired = retired;
+		} else {
+			/* leak it rather than free it on a conn handling thread */
+			log_err_level_printf(LOG_WARNING, "Out of memory retiring the replaced config\n");
+		}
+	}
+	ctx->reloaded = new;
+
+	log_err_printf("Reloaded config: %d listeners kept, %d removed, "
+	               "%d need a restart, forged cert cache %s\n",
+	               matched, removed, added, flush ? "flushed" : "kept");
+	return 0;
+}
+
+/*
+ * Free the configs replaced by reloads which no conn uses anymore.  Conns
+ * drop their references on the conn handling threads, but as the proxy holds
+ * one to each config, they are only ever freed here, on the main thread.
+ */
+static void
+proxy_free_retired(proxy_ctx_t *ctx)
+{
+	proxy_retired_t **prev = &ctx->retired, *retired;
+
+	while ((retired = *prev)) {
+		if (global_free_unused(retired->global)) {
+			*prev = retired->next;
+			free(retired);
+		} else {
+			prev = &retired->next;
+		}
+	}
+}
+
+/*
+ * Reload the config on SIGUSR2.  The config is parsed in a process forked
+ * from the privileged parent, with config errors reported there, and read
+ * from the pipe privsep passes.  The running config supplies the options
+ * which are set up on startup, see proxy_reload_check().
+ */
+static void
+proxy_reload(proxy_ctx_t *ctx)
+{
+	global_t *new;
+	int fd;
+
+	if (ctx->reloadsock == -1) {
+		log_err_level_printf(LOG_WARNING, "Received SIGUSR2, but reload is not supported; ignoring.\n");
+		return;
+	}
+
+	log_err_printf("Reloading config\n");
+	fd = privsep_client_reload(ctx->reloadsock);
+	if (fd == -1) {
+		log_err_level_printf(LOG_WARNING, "Failed to request reload: %s (%i); "
+		               "keeping the running config\n", strerror(errno), errno);
+		return;
+	}
+	new = global_reload_read(ctx->global, fd);
+	if (!new) {
+		log_err_level_printf(LOG_WARNING, "Reload failed, see the errors above; "
+		               "keeping the running config\n");
+		return;
+	}
+	if (proxy_reload_apply(ctx, new) == -1) {
+		global_unref(new);
+	}
+}
+
+/*
+ * Signal handler for SIGTERM, SIGQUIT, SIGINT, SIGHUP, SIGPIPE, SIGUSR1 and
+ * SIGUSR2.
  */
 static void
 proxy_signal_cb(evutil_socket_t fd, UNUSED short what, void *arg)
@@ -224,6 +579,9 @@ proxy_signal_cb(evutil_socket_t fd, UNUSED short what, void *arg)
 			log_dbg_printf("Reopened log files\n");
 		}
 		break;
+	case SIGUSR2:
+		proxy_reload(ctx);
+		break;
 	case SIGPIPE:
 		log_err_level_printf(LOG_WARNING, "Received SIGPIPE; ignoring.\n");
 		break;
@@ -245,11 +603,21 @@ proxy_gc_cb(UNUSED evutil_socket_t fd, UNUSED short what, void *arg)
 		log_dbg_printf("Garbage collecting caches started.\n");
 
 	cachemgr_gc();
+	proxy_free_retired(ctx);
 
 	if (OPTS_DEBUG(ctx->global))
 		log_dbg_printf("Garbage collecting caches done.\n");
 }
 
+/*
+ * Cache snapshot handler.
+ */
+static void
+proxy_snap_cb(UNUSED evutil_socket_t fd, UNUSED short what, UNUSED void *arg)
+{
+	cachesnap_write_bg();
+}
+
 /*
  * Set up the core event loop.
  * Socket clisock is the privsep client socket used for binding to ports.
@@ -263,7 +631,10 @@ proxy_new(global_t *global, int clisock)
 	struct evdns_base *dnsbase;
 	int rc;
 
-	/* adds locking, only required if accessed from separate threads */
+	/* adds locking, only required if accessed from separate threads;
+	 * bufferevents are confined to their conn handling thread and do not
+	 * use locking, but event bases are still accessed across threads,
+	 * e.g. for loopbreak on exit and for dnscache callbacks */
 	evthread_use_pthreads();
 
 #ifndef PURIFY
@@ -280,6 +651,7 @@ proxy_new(global_t *global, int clisock)
 	memset(ctx, 0, sizeof(proxy_ctx_t));
 
 	ctx->global = global;
+	ctx->reloadsock = -1;
 	ctx->evbase = event_base_new();
 	if (!ctx->evbase) {
 		log_err_level_printf(LOG_CRIT, "Error getting event base\n");
@@ -353,11 +725,28 @@ proxy_new(global_t *global, int clisock)
 		goto leave4;
 	evtimer_add(ctx->gcev, &gc_delay);
 
+	if (global->cachesnap) {
+		struct timeval snap_delay = {global->cachesnap_period, 0};
+		ctx->snapev = event_new(ctx->evbase, -1, EV_PERSIST, proxy_snap_cb, ctx);
+		if (!ctx->snapev)
+			goto leave4;
+		evtimer_add(ctx->snapev, &snap_delay);
+	}
+
+	if (global->statssock) {
+		ctx->stats = pxy_stats_new(ctx->evbase, ctx->thrmgr, global->statssock);
+		if (!ctx->stats)
+			goto leave4;
+	}
+
 	// @attention Do not close privsep sock, we open new sockets for child conns
 	//privsep_client_close(clisock);
 	return ctx;
 
 leave4:
+	if (ctx->snapev) {
+		event_free(ctx->snapev);
+	}
 	if (ctx->gcev) {
 		event_free(ctx->gcev);
 	}
@@ -401,6 +790,14 @@ proxy_run(proxy_ctx_t *ctx)
 		log_err_level_printf(LOG_CRIT, "Failed to start thread manager\n");
 		return -1;
 	}
+	/* after starting the conn handling threads, which would inherit the
+	 * CPUs of the main thread otherwise; the helper threads started later
+	 * inherit them */
+	if (ctx->global->maincpus &&
+	    sys_set_thread_cpulist(pthread_self(), ctx->global->maincpus) == -1) {
+		log_err_level_printf(LOG_WARNING, "Failed to pin main thread to CPUs %s: %s (%i)\n",
+		                     ctx->global->maincpus, strerror(errno), errno);
+	}
 	if (OPTS_DEBUG(ctx->global)) {
 		log_dbg_printf("Starting main event loop.\n");
 	}
@@ -432,6 +829,12 @@ proxy_free(proxy_ctx_t *ctx)
 	if (ctx->gcev) {
 		event_free(ctx->gcev);
 	}
+	if (ctx->snapev) {
+		event_free(ctx->snapev);
+	}
+	if (ctx->stats) {
+		pxy_stats_free(ctx->stats);
+	}
 	if (ctx->lctx) {
 		proxy_listener_ctx_free(ctx->lctx);
 	}
@@ -446,7 +849,26 @@ proxy_free(proxy_ctx_t *ctx)
 	if (ctx->evbase) {
 		event_base_free(ctx->evbase);
 	}
+	// Conns are gone by now, so this frees the reloaded configs
+	if (ctx->reloaded) {
+		global_unref(ctx->reloaded);
+	}
+	while (ctx->retired) {
+		proxy_retired_t *retired = ctx->retired;
+		ctx->retired = retired->next;
+		global_unref(retired->global);
+		free(retired);
+	}
 	free(ctx);
 }
 
+/*
+ * Set the privsep client socket to request reloads on SIGUSR2 with.
+ */
+void
+proxy_set_reload_sock(proxy_ctx_t *ctx, evutil_socket_t reloadsock)
+{
+	ctx->reloadsock = reloadsock;
+}
+
 /* vim: set noet ft=c: */
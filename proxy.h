@@ -53,6 +53,8 @@ proxy_ctx_t * proxy_new(global_t *, int) NONNULL(1) MALLOC;
 int proxy_run(proxy_ctx_t *) NONNULL(1);
 void proxy_loopbreak(proxy_ctx_t *, int) NONNULL(1);
 void proxy_free(proxy_ctx_t *) NONNULL(1);
+void proxy_set_reload_sock(proxy_ctx_t *, evutil_socket_t) NONNULL(1);
+int proxy_reload_check(global_t *, global_t *) NONNULL(1,2) WUNRES;
 void proxy_listener_errorcb(struct evconnlistener *, UNUSED void *);
 
 #endif /* !PROXY_H */
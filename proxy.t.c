@@ -0,0 +1,265 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "proxy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/wait.h>
+
+#include <check.h>
+
+static global_t *old;
+static global_t *new;
+
+static void
+proxy_setup(void)
+{
+	old = global_new();
+	new = global_new();
+}
+
+static void
+proxy_teardown(void)
+{
+	global_free(old);
+	global_free(new);
+}
+
+static void
+proxy_set_option(const char *optarg)
+{
+	char *natengine = NULL;
+
+	fail_unless(global_set_option(old, "sslproxy", optarg, &natengine) == 0, "set old option failed");
+	fail_unless(global_set_option(new, "sslproxy", optarg, &natengine) == 0, "set new option failed");
+}
+
+START_TEST(proxy_reload_check_01)
+{
+	proxy_set_option("ConnectLog=/tmp/connect.log");
+	proxy_set_option("Threads=4");
+	proxy_set_option("PidFile=/tmp/sslproxy.pid");
+	proxy_set_option("Daemon=yes");
+	old->dropuser = strdup("nobody");
+	new->dropuser = strdup("nobody");
+	old->jaildir = strdup("/var/empty");
+	new->jaildir = strdup("/var/empty");
+	fail_unless(proxy_reload_check(old, new) == 0, "same config refused");
+}
+END_TEST
+
+START_TEST(proxy_reload_check_02)
+{
+	char *natengine = NULL;
+
+	proxy_set_option("ConnectLog=/tmp/connect.log");
+	fail_unless(global_set_option(new, "sslproxy", "ConnIdleTimeout=60", &natengine) == 0, "set option failed");
+	fail_unless(global_set_option(new, "sslproxy", "DenyOCSP=yes", &natengine) == 0, "set option failed");
+	fail_unless(proxy_reload_check(old, new) == 0, "reloadable options refused");
+}
+END_TEST
+
+START_TEST(proxy_reload_check_03)
+{
+	new->dropuser = strdup("nobody");
+	fail_unless(proxy_reload_check(old, new) == -1, "user change accepted");
+	free(new->dropuser);
+	new->dropuser = NULL;
+	new->dropgroup = strdup("nogroup");
+	fail_unless(proxy_reload_check(old, new) == -1, "group change accepted");
+	free(new->dropgroup);
+	new->dropgroup = NULL;
+	new->jaildir = strdup("/var/empty");
+	fail_unless(proxy_reload_check(old, new) == -1, "chroot change accepted");
+	free(new->jaildir);
+	new->jaildir = NULL;
+	fail_unless(proxy_reload_check(old, new) == 0, "same config refused");
+}
+END_TEST
+
+START_TEST(proxy_reload_check_04)
+{
+	char *natengine = NULL;
+
+	fail_unless(global_set_option(new, "sslproxy", "PidFile=/tmp/sslproxy.pid", &natengine) == 0, "set option failed");
+	fail_unless(proxy_reload_check(old, new) == -1, "pidfile change accepted");
+}
+END_TEST
+
+START_TEST(proxy_reload_check_05)
+{
+	char *natengine = NULL;
+
+	fail_unless(global_set_option(new, "sslproxy", "Daemon=yes", &natengine) == 0, "set option failed");
+	fail_unless(proxy_reload_check(old, new) == -1, "daemon change accepted");
+}
+END_TEST
+
+START_TEST(proxy_reload_check_06)
+{
+	char *natengine = NULL;
+
+	proxy_set_option("ConnectLog=/tmp/connect.log");
+	fail_unless(global_set_option(new, "sslproxy", "ConnectLog=/tmp/connect2.log", &natengine) == 0, "set option failed");
+	fail_unless(proxy_reload_check(old, new) == -1, "connect log change accepted");
+}
+END_TEST
+
+START_TEST(proxy_reload_check_07)
+{
+	char *natengine = NULL;
+
+	fail_unless(global_set_option(new, "sslproxy", "Threads=2", &natengine) == 0, "set option failed");
+	fail_unless(proxy_reload_check(old, new) == -1, "threads change accepted");
+}
+END_TEST
+
+static void
+proxy_write_conffile(const char *conffile, const char *jail, unsigned int timeout)
+{
+	FILE *f;
+
+	f = fopen(conffile, "w");
+	fail_unless(!!f, "cannot create conf file");
+	fprintf(f, "Chroot %s\n"
+	           "ConnIdleTimeout %u\n"
+	           "PassSite example.com\n"
+	           "PassSite example.org\n"
+	           "ProxySpec tcp 127.0.0.1 10025 up:8080\n", jail, timeout);
+	fclose(f);
+}
+
+static global_t *
+proxy_load_conffile(const char *conffile)
+{
+	global_t *global;
+	char *natengine = NULL;
+
+	global = global_new();
+	fail_unless(!!global, "global_new failed");
+	global->conffile = strdup(conffile);
+	fail_unless(global_load_conffile(global, "sslproxy", &natengine) == 0, "load conf file failed");
+	free(natengine);
+	return global;
+}
+
+/*
+ * The reloaded config is parsed outside of the chroot, and the proxy reads
+ * it back from a stream, so reading it must not need any file in the jail.
+ */
+START_TEST(proxy_reload_chroot_01)
+{
+	char jail[] = "/tmp/sslproxy.t.XXXXXX";
+	char conffile[PATH_MAX], stream[PATH_MAX];
+	global_t *running, *reloaded;
+	int fd, status;
+	pid_t pid;
+
+	fail_unless(!!mkdtemp(jail), "mkdtemp failed");
+	snprintf(conffile, sizeof(conffile), "%s/sslproxy.conf", jail);
+	snprintf(stream, sizeof(stream), "%s/reload", jail);
+
+	proxy_write_conffile(conffile, jail, 60);
+	running = proxy_load_conffile(conffile);
+	proxy_write_conffile(conffile, jail, 99);
+	reloaded = proxy_load_conffile(conffile);
+	fail_unless(proxy_reload_check(running, reloaded) == 0, "reload with chroot refused");
+
+	fd = open(stream, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	fail_unless(fd != -1, "cannot create stream file");
+	fail_unless(global_reload_write(reloaded, fd) == 0, "global_reload_write failed");
+	fd = open(stream, O_RDONLY);
+	fail_unless(fd != -1, "cannot open stream file");
+	unlink(stream);
+	unlink(conffile);
+
+	pid = fork();
+	fail_unless(pid != -1, "fork failed");
+	if (pid == 0) {
+		global_t *global;
+
+		if (geteuid() == 0 && (chroot(jail) == -1 || chdir("/") == -1))
+			_exit(2);
+		global = global_reload_read(running, fd);
+		if (!global)
+			_exit(3);
+		if (global->conn_idle_timeout != 99 ||
+		    strcmp(global->jaildir, running->jaildir) ||
+		    !global->opts->passsites ||
+		    !global->opts->passsites->next ||
+		    strcmp(global->opts->passsites->site, reloaded->opts->passsites->site) ||
+		    !global->spec || global->spec->next ||
+		    global->spec->listen_addrlen != reloaded->spec->listen_addrlen ||
+		    memcmp(&global->spec->listen_addr, &reloaded->spec->listen_addr, reloaded->spec->listen_addrlen))
+			_exit(4);
+		_exit(0);
+	}
+	close(fd);
+	fail_unless(waitpid(pid, &status, 0) == pid, "waitpid failed");
+	fail_unless(WIFEXITED(status), "reader did not exit");
+	fail_unless(WEXITSTATUS(status) == 0, "reloaded config not read back");
+
+	global_free(running);
+	global_free(reloaded);
+	rmdir(jail);
+}
+END_TEST
+
+Suite *
+proxy_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("proxy");
+
+	tc = tcase_create("proxy_reload_check");
+	tcase_add_checked_fixture(tc, proxy_setup, proxy_teardown);
+	tcase_add_test(tc, proxy_reload_check_01);
+	tcase_add_test(tc, proxy_reload_check_02);
+	tcase_add_test(tc, proxy_reload_check_03);
+	tcase_add_test(tc, proxy_reload_check_04);
+	tcase_add_test(tc, proxy_reload_check_05);
+	tcase_add_test(tc, proxy_reload_check_06);
+	tcase_add_test(tc, proxy_reload_check_07);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("proxy_reload_chroot");
+	tcase_add_test(tc, proxy_reload_chroot_01);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
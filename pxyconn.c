@@ -36,6 +36,8 @@
 #include "protosmtp.h"
 #include "protoautossl.h"
 #include "protopassthrough.h"
+#include "pxysplice.h"
+#include "pxyplugin.h"
 
 #include "privsep.h"
 #include "sys.h"
@@ -45,6 +47,8 @@
 
 #include <string.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <sys/param.h>
 #include <assert.h>
 
@@ -64,12 +68,6 @@
 #include <net/if_dl.h>
 #endif /* __OpenBSD__ */
 
-/*
- * Maximum size of data to buffer per connection direction before
- * temporarily stopping to read data from the other end.
- */
-#define OUTBUF_LIMIT	(128*1024)
-
 int descriptor_table_size = 0;
 
 // @attention The order of names should match the order in protocol enum
@@ -90,7 +88,7 @@ char *protocol_names[] = {
 static protocol_t NONNULL(1)
 pxy_setup_proto(pxy_conn_ctx_t *ctx)
 {
-	ctx->protoctx = malloc(sizeof(proto_ctx_t));
+	ctx->protoctx = slab_alloc(ctx->thr->slab, sizeof(proto_ctx_t));
 	if (!ctx->protoctx) {
 		return PROTO_ERROR;
 	}
@@ -127,7 +125,7 @@ pxy_setup_proto(pxy_conn_ctx_t *ctx)
 	}
 
 	if (proto == PROTO_ERROR) {
-		free(ctx->protoctx);
+		slab_free(ctx->thr->slab, ctx->protoctx, sizeof(proto_ctx_t));
 	}
 	return proto;
 }
@@ -135,7 +133,7 @@ pxy_setup_proto(pxy_conn_ctx_t *ctx)
 static protocol_t NONNULL(1)
 pxy_setup_proto_child(pxy_conn_child_ctx_t *ctx)
 {
-	ctx->protoctx = malloc(sizeof(proto_child_ctx_t));
+	ctx->protoctx = slab_alloc(ctx->conn->thr->slab, sizeof(proto_child_ctx_t));
 	if (!ctx->protoctx) {
 		return PROTO_ERROR;
 	}
@@ -172,7 +170,7 @@ pxy_setup_proto_child(pxy_conn_child_ctx_t *ctx)
 	}
 
 	if (proto == PROTO_ERROR) {
-		free(ctx->protoctx);
+		slab_free(ctx->conn->thr->slab, ctx->protoctx, sizeof(proto_child_ctx_t));
 	}
 	return proto;
 }
@@ -187,12 +185,17 @@ pxy_conn_ctx_new(evutil_socket_t fd,
 	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_conn_ctx_new: ENTER, fd=%d\n", fd);
 #endif /* DEBUG_PROXY */
 
-	pxy_conn_ctx_t *ctx = malloc(sizeof(pxy_conn_ctx_t));
+	// Choose the conn handling thread first, because the conn ctxs are allocated from its slab
+	pxy_thr_ctx_t *thr = pxy_thrmgr_select(thrmgr, fd);
+
+	pxy_conn_ctx_t *ctx = slab_alloc(thr->slab, sizeof(pxy_conn_ctx_t));
 	if (!ctx) {
 		return NULL;
 	}
 	memset(ctx, 0, sizeof(pxy_conn_ctx_t));
 
+	ctx->ts_accept = histo_now();
+	ctx->outbuf_limit = spec->opts->relay_bufsize;
 	ctx->id = thrmgr->conn_count++;
 
 #ifdef DEBUG_PROXY
@@ -205,13 +208,17 @@ pxy_conn_ctx_new(evutil_socket_t fd,
 	ctx->thrmgr = thrmgr;
 	ctx->spec = spec;
 
+	pxy_thrmgr_attach(ctx, thr);
+	slab_arena_init(&ctx->arena, thr->slab);
+
 	ctx->proto = pxy_setup_proto(ctx);
 	if (ctx->proto == PROTO_ERROR) {
-		free(ctx);
+		slab_free(thr->slab, ctx, sizeof(pxy_conn_ctx_t));
 		return NULL;
 	}
 
 	ctx->global = global;
+	global_ref(global);
 	ctx->clisock = clisock;
 
 	ctx->ctime = time(NULL);
@@ -219,8 +226,6 @@ pxy_conn_ctx_new(evutil_socket_t fd,
 
 	ctx->next = NULL;
 
-	pxy_thrmgr_attach(ctx);
-
 #ifdef HAVE_LOCAL_PROCINFO
 	ctx->lproc.pid = -1;
 #endif /* HAVE_LOCAL_PROCINFO */
@@ -236,7 +241,7 @@ pxy_conn_ctx_new_child(evutil_socket_t fd, pxy_conn_ctx_t *conn)
 	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_conn_ctx_new_child: ENTER, child fd=%d, fd=%d\n", fd, conn->fd);
 #endif /* DEBUG_PROXY */
 
-	pxy_conn_child_ctx_t *ctx = malloc(sizeof(pxy_conn_child_ctx_t));
+	pxy_conn_child_ctx_t *ctx = slab_alloc(conn->thr->slab, sizeof(pxy_conn_child_ctx_t));
 	if (!ctx) {
 		return NULL;
 	}
@@ -247,7 +252,7 @@ pxy_conn_ctx_new_child(evutil_socket_t fd, pxy_conn_ctx_t *conn)
 	ctx->conn = conn;
 
 	if (pxy_setup_proto_child(ctx) == PROTO_ERROR) {
-		free(ctx);
+		slab_free(conn->thr->slab, ctx, sizeof(pxy_conn_child_ctx_t));
 		return NULL;
 	}
 
@@ -273,8 +278,8 @@ pxy_conn_ctx_free_child(pxy_conn_child_ctx_t *ctx)
 	if (ctx->protoctx->proto_free) {
 		ctx->protoctx->proto_free(ctx);
 	}
-	free(ctx->protoctx);
-	free(ctx);
+	slab_free(ctx->conn->thr->slab, ctx->protoctx, sizeof(proto_child_ctx_t));
+	slab_free(ctx->conn->thr->slab, ctx, sizeof(pxy_conn_child_ctx_t));
 }
 
 static void NONNULL(1)
@@ -374,6 +379,10 @@ pxy_conn_free_children(pxy_conn_ctx_t *ctx)
 		evconnlistener_free(ctx->child_evcl);
 		ctx->child_evcl = NULL;
 	}
+	if (ctx->child_path) {
+		unlink(ctx->child_path);
+		ctx->child_path = NULL;
+	}
 }
 
 void
@@ -389,19 +398,25 @@ pxy_conn_ctx_free(pxy_conn_ctx_t *ctx, int by_requestor)
 		}
 	}
 
-	if (ctx->spec->opts->user_auth && ctx->srchost_str && ctx->user && ctx->ether) {
+	if (ctx->spec->opts->user_auth && pxy_conn_srchost_str(ctx) && ctx->user && ctx->ether) {
 		// Update userdb atime if idle time is more than 50% of user timeout, which is expected to reduce update frequency
 		unsigned int idletime = ctx->idletime + (time(NULL) - ctx->ctime);
 		if (idletime > (ctx->spec->opts->user_timeout / 2)) {
 			userdbkeys_t keys;
 			// Zero out for NULL termination
 			memset(&keys, 0, sizeof(userdbkeys_t));
+			// keys.ip is sized to srchost_buf, but check anyway rather than update the atime of a truncated ip
+			const char *srchost = pxy_conn_srchost_str(ctx);
+			size_t srchostlen = strlen(srchost);
+			if (srchostlen < sizeof(keys.ip))
+				memcpy(keys.ip, srchost, srchostlen);
 			// Leave room for NULL to make sure the strings are always NULL terminated
-			strncpy(keys.ip, ctx->srchost_str, sizeof(keys.ip) - 1);
 			strncpy(keys.user, ctx->user, sizeof(keys.user) - 1);
 			strncpy(keys.ether, ctx->ether, sizeof(keys.ether) - 1);
 
-			if (privsep_client_update_atime(ctx->clisock, &keys) == -1) {
+			if (srchostlen >= sizeof(keys.ip)) {
+				log_err_level_printf(LOG_WARNING, "Source host too long to update user atime: %s\n", srchost);
+			} else if (privsep_client_update_atime(ctx->clisock, &keys) == -1) {
 #ifdef DEBUG_PROXY
 				log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_conn_ctx_free: Error updating user atime: %s, fd=%d\n", sqlite3_errmsg(ctx->global->userdb), ctx->fd);
 #endif /* DEBUG_PROXY */
@@ -423,18 +438,6 @@ pxy_conn_ctx_free(pxy_conn_ctx_t *ctx, int by_requestor)
 		pxy_thrmgr_detach(ctx);
 	}
 
-	if (ctx->srchost_str) {
-		free(ctx->srchost_str);
-	}
-	if (ctx->srcport_str) {
-		free(ctx->srcport_str);
-	}
-	if (ctx->dsthost_str) {
-		free(ctx->dsthost_str);
-	}
-	if (ctx->dstport_str) {
-		free(ctx->dstport_str);
-	}
 #ifdef HAVE_LOCAL_PROCINFO
 	if (ctx->lproc.exec_path) {
 		free(ctx->lproc.exec_path);
@@ -449,25 +452,24 @@ pxy_conn_ctx_free(pxy_conn_ctx_t *ctx, int by_requestor)
 	if (ctx->ev) {
 		event_free(ctx->ev);
 	}
-	if (ctx->sslproxy_header) {
-		free(ctx->sslproxy_header);
+	if (ctx->shm_ev) {
+		event_free(ctx->shm_ev);
+	}
+	if (ctx->plugin) {
+		pxy_plugin_close(ctx);
 	}
 	// If the proto doesn't have special args, proto_free() callback is NULL
 	if (ctx->protoctx->proto_free) {
 		ctx->protoctx->proto_free(ctx);
 	}
-	free(ctx->protoctx);
+	slab_free(ctx->thr->slab, ctx->protoctx, sizeof(proto_ctx_t));
 
-	if (ctx->user) {
-		free(ctx->user);
-	}
-	if (ctx->ether) {
-		free(ctx->ether);
-	}
-	if (ctx->desc) {
-		free(ctx->desc);
-	}
-	free(ctx);
+	// The proxy keeps its own reference to configs replaced by a reload
+	global_unref(ctx->global);
+
+	// Frees all strings allocated from the conn arena, such as the sslproxy header, and user
+	slab_arena_free(&ctx->arena);
+	slab_free(ctx->thr->slab, ctx, sizeof(pxy_conn_ctx_t));
 }
 
 void
@@ -477,6 +479,13 @@ pxy_conn_free(pxy_conn_ctx_t *ctx, int by_requestor)
 	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_conn_free: ENTER, fd=%d\n", ctx->fd);
 #endif /* DEBUG_PROXY */
 
+#ifdef HAVE_SPLICE
+	// Free the splice relay events before closing the fds they watch
+	if (ctx->splice) {
+		pxy_splice_free(ctx);
+	}
+#endif /* HAVE_SPLICE */
+
 	// We always assign NULL to bevs after freeing them
 	if (ctx->src.bev) {
 		ctx->src.free(ctx->src.bev, ctx);
@@ -554,10 +563,10 @@ pxy_log_connect_nonhttp(pxy_conn_ctx_t *ctx)
 #endif /* HAVE_LOCAL_PROCINFO */
 		              " user:%s\n",
 		              ctx->proto == PROTO_PASSTHROUGH ? "passthrough" : (ctx->proto == PROTO_POP3 ? "pop3" : (ctx->proto == PROTO_SMTP ? "smtp" : "tcp")),
-		              STRORDASH(ctx->srchost_str),
-		              STRORDASH(ctx->srcport_str),
-		              STRORDASH(ctx->dsthost_str),
-		              STRORDASH(ctx->dstport_str),
+		              STRORDASH(pxy_conn_srchost_str(ctx)),
+		              STRORDASH(pxy_conn_srcport_str(ctx)),
+		              STRORDASH(pxy_conn_dsthost_str(ctx)),
+		              STRORDASH(pxy_conn_dstport_str(ctx)),
 #ifdef HAVE_LOCAL_PROCINFO
 		              lpi,
 #endif /* HAVE_LOCAL_PROCINFO */
@@ -572,10 +581,10 @@ pxy_log_connect_nonhttp(pxy_conn_ctx_t *ctx)
 #endif /* HAVE_LOCAL_PROCINFO */
 		              " user:%s\n",
 		              ctx->proto == PROTO_AUTOSSL ? "autossl" : (ctx->proto == PROTO_POP3S ? "pop3s" : (ctx->proto == PROTO_SMTPS ? "smtps" : "ssl")),
-		              STRORDASH(ctx->srchost_str),
-		              STRORDASH(ctx->srcport_str),
-		              STRORDASH(ctx->dsthost_str),
-		              STRORDASH(ctx->dstport_str),
+		              STRORDASH(pxy_conn_srchost_str(ctx)),
+		              STRORDASH(pxy_conn_srcport_str(ctx)),
+		              STRORDASH(pxy_conn_dsthost_str(ctx)),
+		              STRORDASH(pxy_conn_dstport_str(ctx)),
 		              STRORDASH(ctx->sslctx->sni),
 		              STRORDASH(ctx->sslctx->ssl_names),
 		              SSL_get_version(ctx->src.ssl),
@@ -617,66 +626,196 @@ out:
 	return;
 }
 
-int
-pxy_log_content_inbuf(pxy_conn_ctx_t *ctx, struct evbuffer *inbuf, int req)
+/*
+ * Interval of the retries to write the content kept for a full ShmLog ring.
+ * The reader cannot signal the proxy, so the conn polls the ring.
+ */
+#define PXY_SHM_RETRY_USEC 10000
+
+static void
+pxy_shm_enable_read(pxy_conn_ctx_t *ctx, pxy_conn_desc_t *desc, pxy_conn_desc_t *other)
 {
-	size_t sz = evbuffer_get_length(inbuf);
-	unsigned char *buf = malloc(sz);
-	if (!buf) {
+	// Leave it to the watermark if the other end is still full, see pxy_try_unset_watermark()
+	if (desc->bev && !desc->closed &&
+	    (!other->bev || evbuffer_get_length(bufferevent_get_output(other->bev)) < ctx->outbuf_limit)) {
+		bufferevent_enable(desc->bev, EV_READ);
+	}
+}
+
+static void
+pxy_shm_resume_cb(UNUSED evutil_socket_t fd, UNUSED short what, void *arg)
+{
+	pxy_conn_ctx_t *ctx = arg;
+	struct timeval retry = {0, PXY_SHM_RETRY_USEC};
+
+	if (log_content_shm_flush(&ctx->logctx) == -1) {
+		evtimer_add(ctx->shm_ev, &retry);
+		return;
+	}
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINE, "pxy_shm_resume_cb: ShmLog ring has space, resuming, fd=%d\n", ctx->fd);
+#endif /* DEBUG_PROXY */
+	ctx->shm_paused = 0;
+	pxy_shm_enable_read(ctx, &ctx->src, &ctx->dst);
+	pxy_shm_enable_read(ctx, &ctx->dst, &ctx->src);
+}
+
+/*
+ * Stop reading from both ends of the conn while the pause policy of ShmLog
+ * keeps content its ring has no space for, and retry writing it from a timer
+ * on the thread of the conn.  The conn never waits for the reader.
+ */
+static int NONNULL(1)
+pxy_shm_pause(pxy_conn_ctx_t *ctx)
+{
+	struct timeval retry = {0, PXY_SHM_RETRY_USEC};
+
+	if (ctx->shm_paused)
+		return 0;
+	if (!ctx->shm_ev && !(ctx->shm_ev = evtimer_new(ctx->thr->evbase, pxy_shm_resume_cb, ctx))) {
 		ctx->enomem = 1;
 		return -1;
 	}
-	if (evbuffer_copyout(inbuf, buf, sz) == -1) {
-		free(buf);
-		return -1;
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINE, "pxy_shm_pause: ShmLog ring full, pausing, fd=%d\n", ctx->fd);
+#endif /* DEBUG_PROXY */
+	ctx->shm_paused = 1;
+	if (ctx->src.bev)
+		bufferevent_disable(ctx->src.bev, EV_READ);
+	if (ctx->dst.bev)
+		bufferevent_disable(ctx->dst.bev, EV_READ);
+	evtimer_add(ctx->shm_ev, &retry);
+	return 0;
+}
+
+int
+pxy_log_content_inbuf(pxy_conn_ctx_t *ctx, struct evbuffer *inbuf, int req)
+{
+	size_t sz = evbuffer_get_length(inbuf);
+
+	// Bytes beyond the cap of the capture policy are not copied
+	if (ctx->content_limit) {
+		size_t left = ctx->content_limit - ctx->content_logged[req];
+		if (sz > left) {
+			ctx->thr->content_skipped_bytes += sz - left;
+			sz = left;
+		}
+		if (!sz)
+			return 0;
+		ctx->content_logged[req] += sz;
 	}
+	ctx->thr->content_logged_bytes += sz;
+
 	logbuf_t *lb = logbuf_new_alloc(sz, NULL);
 	if (!lb) {
-		free(buf);
 		ctx->enomem = 1;
 		return -1;
 	}
-	memcpy(lb->buf, buf, lb->sz);
-	free(buf);
+	if (evbuffer_copyout(inbuf, lb->buf, sz) == -1) {
+		logbuf_free(lb);
+		return -1;
+	}
 	if (log_content_submit(&ctx->logctx, lb, req) == -1) {
 		logbuf_free(lb);
 		log_err_level_printf(LOG_WARNING, "Content log submission failed\n");
 		return -1;
 	}
+	if (log_content_shm_paused(&ctx->logctx)) {
+		return pxy_shm_pause(ctx);
+	}
 	return 0;
 }
 
 #ifdef HAVE_LOCAL_PROCINFO
+/*
+ * Look up the local process owning the conn.
+ * Runs on the local process lookup thread of thrmgr, before the conn is handed
+ * over to its conn handling thread, because the lookup may take long.
+ */
+void
+pxy_conn_lookup_local_procinfo(pxy_conn_ctx_t *ctx)
+{
+	/* fetch process info */
+	if (proc_pid_for_addr(&ctx->lproc.pid,
+			(struct sockaddr*)&ctx->srcaddr,
+			ctx->srcaddrlen) == 0 &&
+		ctx->lproc.pid != -1 &&
+		proc_get_info(ctx->lproc.pid,
+					  &ctx->lproc.exec_path,
+					  &ctx->lproc.uid,
+					  &ctx->lproc.gid) == 0) {
+		/* fetch user/group names */
+		ctx->lproc.user = sys_user_str(
+						ctx->lproc.uid);
+		ctx->lproc.group = sys_group_str(
+						ctx->lproc.gid);
+		if (!ctx->lproc.user ||
+			!ctx->lproc.group) {
+			ctx->lproc.enomem = 1;
+		}
+	}
+}
+
 int
 pxy_prepare_logging_local_procinfo(pxy_conn_ctx_t *ctx)
 {
-	if (ctx->global->lprocinfo) {
-		/* fetch process info */
-		if (proc_pid_for_addr(&ctx->lproc.pid,
-				(struct sockaddr*)&ctx->lproc.srcaddr,
-				ctx->lproc.srcaddrlen) == 0 &&
-			ctx->lproc.pid != -1 &&
-			proc_get_info(ctx->lproc.pid,
-						  &ctx->lproc.exec_path,
-						  &ctx->lproc.uid,
-						  &ctx->lproc.gid) == 0) {
-			/* fetch user/group names */
-			ctx->lproc.user = sys_user_str(
-							ctx->lproc.uid);
-			ctx->lproc.group = sys_group_str(
-							ctx->lproc.gid);
-			if (!ctx->lproc.user ||
-				!ctx->lproc.group) {
-				ctx->enomem = 1;
-				pxy_conn_term(ctx, 1);
-				return -1;
-			}
-		}
+	// The process info has been looked up before conn setup, only the result is checked here
+	if (ctx->lproc.enomem) {
+		ctx->enomem = 1;
+		pxy_conn_term(ctx, 1);
+		return -1;
 	}
 	return 0;
 }
 #endif /* HAVE_LOCAL_PROCINFO */
 
+/*
+ * Name of the proto of a proxyspec, as used in the config, for the content
+ * log policy and the plugins.
+ */
+const char *
+pxy_proto_str(protocol_t proto)
+{
+	switch (proto) {
+	case PROTO_HTTP:	return "http";
+	case PROTO_HTTPS:	return "https";
+	case PROTO_POP3:	return "pop3";
+	case PROTO_POP3S:	return "pop3s";
+	case PROTO_SMTP:	return "smtp";
+	case PROTO_SMTPS:	return "smtps";
+	case PROTO_AUTOSSL:	return "autossl";
+	case PROTO_SSL:		return "ssl";
+	default:		return "tcp";
+	}
+}
+
+/*
+ * Apply the content log capture policy of the proxyspec, once the SNI, dst
+ * and user of the conn are known.
+ */
+static void
+pxy_content_log_policy(pxy_conn_ctx_t *ctx)
+{
+	opts_t *opts = ctx->spec->opts;
+	size_t limit = opts->contentlog_limit ? opts->contentlog_limit : LOGPOLICY_FULL;
+
+	if (opts->contentlog_rules) {
+		logpolicy_conn_t conn = {
+			.sni = ctx->sslctx ? ctx->sslctx->sni : NULL,
+			.dstip = pxy_conn_dsthost_str(ctx),
+			.dstport = pxy_conn_dstport_str(ctx),
+			.user = ctx->user,
+			.proto = pxy_proto_str(ctx->proto),
+		};
+		limit = logpolicy_match(opts->contentlog_rules, limit, &conn);
+	}
+	if (limit == LOGPOLICY_NOLOG) {
+		ctx->content_nolog = 1;
+	} else if (limit != LOGPOLICY_FULL) {
+		ctx->content_limit = limit;
+	}
+}
+
 static int
 pxy_prepare_logging(pxy_conn_ctx_t *ctx)
 {
@@ -689,13 +828,17 @@ pxy_prepare_logging(pxy_conn_ctx_t *ctx)
 	}
 #endif /* HAVE_LOCAL_PROCINFO */
 	if (WANT_CONTENT_LOG(ctx)) {
-		if (log_content_open(&ctx->logctx, ctx->global,
+		pxy_content_log_policy(ctx);
+	}
+	if (WANT_CONTENT_LOG(ctx)) {
+		if (log_content_open(&ctx->logctx, ctx->global, ctx->id, ctx->thr->thridx,
 							(struct sockaddr *)&ctx->srcaddr,
 							ctx->srcaddrlen,
 							(struct sockaddr *)&ctx->dstaddr,
 							ctx->dstaddrlen,
-							 STRORDASH(ctx->srchost_str), STRORDASH(ctx->srcport_str),
-							 STRORDASH(ctx->dsthost_str), STRORDASH(ctx->dstport_str),
+							 STRORDASH(pxy_conn_srchost_str(ctx)), STRORDASH(pxy_conn_srcport_str(ctx)),
+							 STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)),
+							 ctx->sslctx ? ctx->sslctx->sni : NULL, ctx->user,
 #ifdef HAVE_LOCAL_PROCINFO
 							 ctx->lproc.exec_path,
 							 ctx->lproc.user,
@@ -722,7 +865,7 @@ pxy_log_dbg_connect_type(pxy_conn_ctx_t *ctx, pxy_conn_desc_t *this)
 			/* for SSL, we get two connect events */
 			log_dbg_printf("%s connected to [%s]:%s %s %s\n",
 						   protocol_names[ctx->proto],
-						   STRORDASH(ctx->dsthost_str), STRORDASH(ctx->dstport_str),
+						   STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)),
 						   SSL_get_version(this->ssl), SSL_get_cipher(this->ssl));
 			keystr = ssl_ssl_masterkey_to_str(this->ssl);
 			if (keystr) {
@@ -736,10 +879,10 @@ pxy_log_dbg_connect_type(pxy_conn_ctx_t *ctx, pxy_conn_desc_t *this)
 			 * looking closely at the output */
 			log_dbg_printf("%s connected to [%s]:%s\n",
 						   protocol_names[ctx->proto],
-						   STRORDASH(ctx->dsthost_str), STRORDASH(ctx->dstport_str));
+						   STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)));
 			log_dbg_printf("%s connected from [%s]:%s\n",
 						   protocol_names[ctx->proto],
-						   STRORDASH(ctx->srchost_str), STRORDASH(ctx->srcport_str));
+						   STRORDASH(pxy_conn_srchost_str(ctx)), STRORDASH(pxy_conn_srcport_str(ctx)));
 		}
 	}
 }
@@ -789,10 +932,10 @@ pxy_log_dbg_disconnect(pxy_conn_ctx_t *ctx)
 	if (OPTS_DEBUG(ctx->global)) {
 		log_dbg_printf("%s disconnected to [%s]:%s, fd=%d\n",
 					   protocol_names[ctx->proto],
-					   STRORDASH(ctx->dsthost_str), STRORDASH(ctx->dstport_str), ctx->fd);
+					   STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)), ctx->fd);
 		log_dbg_printf("%s disconnected from [%s]:%s, fd=%d\n",
 					   protocol_names[ctx->proto],
-					   STRORDASH(ctx->srchost_str), STRORDASH(ctx->srcport_str), ctx->fd);
+					   STRORDASH(pxy_conn_srchost_str(ctx)), STRORDASH(pxy_conn_srcport_str(ctx)), ctx->fd);
 	}
 }
 
@@ -803,10 +946,10 @@ pxy_log_dbg_disconnect_child(pxy_conn_child_ctx_t *ctx)
 	if (OPTS_DEBUG(ctx->conn->global)) {
 		log_dbg_printf("Child %s disconnected to [%s]:%s, child fd=%d, fd=%d\n",
 					   protocol_names[ctx->conn->proto],
-					   STRORDASH(ctx->conn->dsthost_str), STRORDASH(ctx->conn->dstport_str), ctx->fd, ctx->conn->fd);
+					   STRORDASH(pxy_conn_dsthost_str(ctx->conn)), STRORDASH(pxy_conn_dstport_str(ctx->conn)), ctx->fd, ctx->conn->fd);
 		log_dbg_printf("Child %s disconnected from [%s]:%s, child fd=%d, fd=%d\n",
 					   protocol_names[ctx->conn->proto],
-					   STRORDASH(ctx->conn->srchost_str), STRORDASH(ctx->conn->srcport_str), ctx->fd, ctx->conn->fd);
+					   STRORDASH(pxy_conn_srchost_str(ctx->conn)), STRORDASH(pxy_conn_srcport_str(ctx->conn)), ctx->fd, ctx->conn->fd);
 	}
 }
 
@@ -865,20 +1008,78 @@ pxy_get_event_name(struct bufferevent *bev, pxy_conn_ctx_t *ctx)
 }
 #endif /* DEBUG_PROXY */
 
+/*
+ * Keep track of the bytes in the output buffer of bev in the buffered count
+ * of the thread.  The filter bufferevents of SSL conn ends and the socket
+ * bufferevents underneath both hold data, so both are accounted.
+ */
+static void
+pxy_outbuf_cb(UNUSED struct evbuffer *buf, const struct evbuffer_cb_info *info, void *arg)
+{
+	pxy_thr_ctx_t *thr = arg;
+
+	thr->buffered += info->n_added;
+	thr->buffered -= info->n_deleted;
+}
+
+void
+pxy_bufferevent_account(struct bufferevent *bev, pxy_thr_ctx_t *thr)
+{
+	evbuffer_add_cb(bufferevent_get_output(bev), pxy_outbuf_cb, thr);
+}
+
+/*
+ * Remove the bytes still in the output buffers of bev and the bufferevents
+ * underneath from the buffered count of the thread before freeing bev,
+ * since freeing the buffers does not run their callbacks.
+ */
+void
+pxy_bufferevent_unaccount(struct bufferevent *bev, pxy_thr_ctx_t *thr)
+{
+	for (; bev; bev = bufferevent_get_underlying(bev)) {
+		struct evbuffer *outbuf = bufferevent_get_output(bev);
+		if (evbuffer_remove_cb(outbuf, pxy_outbuf_cb, thr) == 0) {
+			thr->buffered -= evbuffer_get_length(outbuf);
+		}
+	}
+}
+
 void
 pxy_try_set_watermark(struct bufferevent *bev, pxy_conn_ctx_t *ctx, struct bufferevent *other)
 {
-	if (evbuffer_get_length(bufferevent_get_output(other)) >= OUTBUF_LIMIT) {
+	size_t len = evbuffer_get_length(bufferevent_get_output(other));
+	size_t lowat;
+
+	if (len >= ctx->outbuf_limit) {
+		if (ctx->spec->opts->relay_adaptive && ++ctx->outbuf_hits >= OUTBUF_GROW_HITS &&
+		    ctx->outbuf_limit < ctx->spec->opts->relay_bufsize * OUTBUF_GROW) {
+			// The conn keeps filling its buffer, e.g. a bulk transfer on a high BDP path
+			ctx->outbuf_limit *= 2;
+			ctx->outbuf_hits = 0;
 #ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINE, "pxy_try_set_watermark: %s, fd=%d\n", pxy_get_event_name(bev, ctx), ctx->fd);
+			log_dbg_level_printf(LOG_DBG_MODE_FINE, "pxy_try_set_watermark: Grow outbuf limit to %u, fd=%d\n", ctx->outbuf_limit, ctx->fd);
 #endif /* DEBUG_PROXY */
-
-		/* temporarily disable data source;
-		 * set an appropriate watermark. */
-		bufferevent_setwatermark(other, EV_WRITE, OUTBUF_LIMIT/2, OUTBUF_LIMIT);
-		bufferevent_disable(bev, EV_READ);
+			if (len < ctx->outbuf_limit)
+				return;
+		}
+		lowat = ctx->outbuf_limit / 2;
 		ctx->thr->set_watermarks++;
+	} else if (ctx->global->thr_buf_budget && len && ctx->thr->buffered >= ctx->global->thr_buf_budget) {
+		// Over the budget of the thread, each conn may buffer only as much as a single read until its buffer is empty
+		lowat = 0;
+		ctx->thr->budget_waits++;
+	} else {
+		return;
 	}
+
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINE, "pxy_try_set_watermark: %s, fd=%d\n", pxy_get_event_name(bev, ctx), ctx->fd);
+#endif /* DEBUG_PROXY */
+
+	/* temporarily disable data source;
+	 * set an appropriate watermark. */
+	bufferevent_setwatermark(other, EV_WRITE, lowat, ctx->outbuf_limit);
+	bufferevent_disable(bev, EV_READ);
 }
 
 void
@@ -892,11 +1093,29 @@ pxy_try_unset_watermark(struct bufferevent *bev, pxy_conn_ctx_t *ctx, pxy_conn_d
 		/* data source temporarily disabled;
 		 * re-enable and reset watermark to 0. */
 		bufferevent_setwatermark(bev, EV_WRITE, 0, 0);
-		bufferevent_enable(other->bev, EV_READ);
+		// Stays disabled while the ShmLog ring of the conn is full, see pxy_shm_pause()
+		if (!ctx->shm_paused || (other != &ctx->src && other != &ctx->dst)) {
+			bufferevent_enable(other->bev, EV_READ);
+		}
 		ctx->thr->unset_watermarks++;
 	}
 }
 
+/*
+ * Halve the output buffer limit of an idle conn with adaptive relay buffers,
+ * so that idle conns do not buffer much if they burst.
+ */
+void
+pxy_shrink_outbuf_limit(pxy_conn_ctx_t *ctx)
+{
+	unsigned int min = ctx->spec->opts->relay_bufsize / OUTBUF_SHRINK;
+
+	if (ctx->spec->opts->relay_adaptive && ctx->outbuf_limit > min) {
+		ctx->outbuf_limit = MAX(ctx->outbuf_limit / 2, min);
+		ctx->outbuf_hits = 0;
+	}
+}
+
 void
 pxy_discard_inbuf(struct bufferevent *bev)
 {
@@ -922,20 +1141,80 @@ pxy_insert_sslproxy_header(pxy_conn_ctx_t *ctx, unsigned char *packet, size_t *p
 	ctx->sent_sslproxy_header = 1;
 }
 
+/*
+ * Check whether the first len bytes of inbuf are a prefix of the SSLproxy
+ * header line, i.e. the start of a header split across reads.
+ */
+static int NONNULL(1,2)
+pxy_sslproxy_header_is_prefix(struct evbuffer *inbuf, const char *header, size_t header_len, size_t len)
+{
+	unsigned char *data;
+
+	if (len >= header_len + 2 || !(data = evbuffer_pullup(inbuf, len))) {
+		return 0;
+	}
+	if (memcmp(data, header, len < header_len ? len : header_len)) {
+		return 0;
+	}
+	return len <= header_len || !memcmp(data + header_len, "\r\n", len - header_len);
+}
+
+/*
+ * Move inbuf to outbuf, removing the SSLproxy header line sent back by the
+ * listening program.  The header is searched for on the evbuffer itself,
+ * and only in the first SSLproxyHeaderSearchLimit bytes of the stream.
+ * Data is held back in inbuf only while the whole stream read so far may be
+ * the start of a header split across reads, so that relayed data never
+ * stalls waiting for a header which cannot follow anymore.  Once the header
+ * is removed or the limit is reached, the callers relay with
+ * evbuffer_add_buffer() only.
+ */
 void
-pxy_try_remove_sslproxy_header(pxy_conn_child_ctx_t *ctx, unsigned char *packet, size_t *packet_size)
+pxy_remove_sslproxy_header(pxy_conn_child_ctx_t *ctx, struct evbuffer *inbuf, struct evbuffer *outbuf)
 {
-	// @attention Cannot use string manipulation functions; we are dealing with binary arrays here, not NULL-terminated strings
-	unsigned char *pos = memmem(packet, *packet_size, ctx->conn->sslproxy_header, ctx->conn->sslproxy_header_len);
-	if (pos) {
+	const char *header = ctx->conn->sslproxy_header;
+	size_t header_len = ctx->conn->sslproxy_header_len;
+	size_t limit = ctx->conn->global->sslproxy_header_search_limit;
+	size_t len = evbuffer_get_length(inbuf);
+	struct evbuffer_ptr end, pos;
+	size_t search_len;
+
+	// Search for headers starting before the limit, with their \r\n
+	search_len = limit - ctx->sslproxy_header_searched + header_len + 2;
+	if (search_len > len) {
+		search_len = len;
+	}
+
+	evbuffer_ptr_set(inbuf, &end, search_len, EVBUFFER_PTR_SET);
+	pos = evbuffer_search_range(inbuf, header, header_len, NULL, &end);
+	if (pos.pos != -1 && len - pos.pos >= header_len + 2) {
+#ifdef DEBUG_PROXY
+		log_dbg_level_printf(LOG_DBG_MODE_FINER, "pxy_remove_sslproxy_header: REMOVE, pos=%zu, child fd=%d, fd=%d\n",
+				ctx->sslproxy_header_searched + pos.pos, ctx->fd, ctx->conn->fd);
+#endif /* DEBUG_PROXY */
+
+		evbuffer_remove_buffer(inbuf, outbuf, pos.pos);
+		evbuffer_drain(inbuf, header_len + 2);
+		ctx->removed_sslproxy_header = 1;
+		evbuffer_add_buffer(outbuf, inbuf);
+		return;
+	}
+
+	// Wait for the rest of a header at offset 0 of the stream
+	if (!ctx->sslproxy_header_searched && pxy_sslproxy_header_is_prefix(inbuf, header, header_len, len)) {
+		return;
+	}
+
+	if (ctx->sslproxy_header_searched + len >= limit) {
 #ifdef DEBUG_PROXY
-		log_dbg_level_printf(LOG_DBG_MODE_FINER, "pxy_try_remove_sslproxy_header: REMOVE, child fd=%d, fd=%d\n", ctx->fd, ctx->conn->fd);
+		log_dbg_level_printf(LOG_DBG_MODE_FINER, "pxy_remove_sslproxy_header: Giving up after %zu bytes, child fd=%d, fd=%d\n",
+				ctx->sslproxy_header_searched + len, ctx->fd, ctx->conn->fd);
 #endif /* DEBUG_PROXY */
 
-		memmove(pos, pos + ctx->conn->sslproxy_header_len + 2, *packet_size - (pos - packet) - (ctx->conn->sslproxy_header_len + 2));
-		*packet_size -= ctx->conn->sslproxy_header_len + 2;
 		ctx->removed_sslproxy_header = 1;
 	}
+	ctx->sslproxy_header_searched += len;
+	evbuffer_add_buffer(outbuf, inbuf);
 }
 
 #if defined(__APPLE__) || defined(__FreeBSD__)
@@ -1112,6 +1391,10 @@ pxy_listener_acceptcb_child(UNUSED struct evconnlistener *listener, evutil_socke
 	}
 	conn->thr->max_load = MAX(conn->thr->max_load, conn->thr->load);
 
+	// The listening program connects back after receiving the first bytes from the parent
+	if (!conn->child_count && conn->ts_firstbyte) {
+		pxy_thrmgr_phase_done(conn, PXY_PHASE_CHILD, conn->ts_firstbyte);
+	}
 	conn->child_count++;
 	// Prepend child ctx to conn ctx child list
 	// @attention If the last child is deleted, the children list may become null again
@@ -1138,14 +1421,7 @@ pxy_listener_acceptcb_child(UNUSED struct evconnlistener *listener, evutil_socke
 	bufferevent_enable(ctx->dst.bev, EV_READ|EV_WRITE);
 
 	if (OPTS_DEBUG(conn->global)) {
-		char *host, *port;
-		if (sys_sockaddr_str((struct sockaddr *)&conn->dstaddr, conn->dstaddrlen, &host, &port) == 0) {
-			log_dbg_printf("Child connecting to [%s]:%s\n", host, port);
-			free(host);
-			free(port);
-		} else {
-			log_dbg_printf("Child connecting to [?]:?\n");
-		}
+		log_dbg_printf("Child connecting to [%s]:%s\n", STRORDASH(pxy_conn_dsthost_str(conn)), STRORDASH(pxy_conn_dstport_str(conn)));
 	}
 
 	/* initiate connection, except for the first child conn which uses the parent's srvdst as dst */
@@ -1169,13 +1445,68 @@ out:
 	}
 }
 
+/*
+ * Open the AF_UNIX child listener socket of the conn in the ReturnPath dir.
+ * Binding AF_UNIX sockets needs no privileges, only write access to the dir,
+ * so the socket is opened here instead of by the privsep parent.
+ * Returns -1 on error, with errno set.
+ */
+static evutil_socket_t NONNULL(1)
+pxy_opensock_child_unix(pxy_conn_ctx_t *ctx)
+{
+	struct sockaddr_un sun;
+	evutil_socket_t fd;
+	size_t len;
+	int e;
+
+	// ReturnPath leaves room for the name, see proxyspec_set_return_path()
+	memcpy(&sun, &ctx->spec->child_src_addr, sizeof(sun));
+	len = strlen(sun.sun_path);
+	snprintf(sun.sun_path + len, sizeof(sun.sun_path) - len, "/sslproxy.%ld.%llu", (long)getpid(), ctx->id);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+	if (evutil_make_socket_nonblocking(fd) == -1)
+		goto err;
+	// Left over by a previous instance with the same pid
+	unlink(sun.sun_path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		goto err;
+	// Like a loopback port, any local user may connect, restrict access with the permissions of the dir
+	if (chmod(sun.sun_path, 0666) == -1) {
+		e = errno;
+		unlink(sun.sun_path);
+		errno = e;
+		goto err;
+	}
+
+	ctx->child_path = slab_arena_strdup(&ctx->arena, sun.sun_path);
+	if (!ctx->child_path) {
+		unlink(sun.sun_path);
+		errno = ENOMEM;
+		goto err;
+	}
+	return fd;
+err:
+	e = errno;
+	evutil_closesocket(fd);
+	errno = e;
+	return -1;
+}
+
 int
 pxy_setup_child_listener(pxy_conn_ctx_t *ctx)
 {
 	// @attention Defer child setup and evcl creation until after parent init is complete, otherwise (1) causes multithreading issues (proxy_listener_acceptcb is
 	// running on a different thread from the conn, and we only have thrmgr mutex), and (2) we need to clean up less upon errors.
 	// Child evcls use the evbase of the parent thread, otherwise we would get multithreading issues.
-	if ((ctx->child_fd = privsep_client_opensock_child(ctx->clisock, ctx->spec)) == -1) {
+	if (ctx->spec->child_src_addr.ss_family == AF_UNIX) {
+		ctx->child_fd = pxy_opensock_child_unix(ctx);
+	} else {
+		ctx->child_fd = privsep_client_opensock_child(ctx->clisock, ctx->spec->listen_spec ? ctx->spec->listen_spec : ctx->spec);
+	}
+	if (ctx->child_fd == -1) {
 		log_err_level_printf(LOG_CRIT, "Error opening child socket: %s (%i)\n", strerror(errno), errno);
 		pxy_conn_term(ctx, 1);
 		return -1;
@@ -1193,6 +1524,10 @@ pxy_setup_child_listener(pxy_conn_ctx_t *ctx)
 		// @attention Cannot call proxy_listener_ctx_free() on child_evcl, child_evcl does not have any ctx with next listener
 		// @attention Close child fd separately, because child evcl does not exist yet, hence fd would not be closed by calling pxy_conn_free()
 		evutil_closesocket(ctx->child_fd);
+		if (ctx->child_path) {
+			unlink(ctx->child_path);
+			ctx->child_path = NULL;
+		}
 		pxy_conn_term(ctx, 1);
 		return -1;
 	}
@@ -1204,42 +1539,51 @@ pxy_setup_child_listener(pxy_conn_ctx_t *ctx)
 	log_dbg_level_printf(LOG_DBG_MODE_FINER, "pxy_setup_child_listener: Finished setting up child, NEW child_fd=%d, fd=%d\n", ctx->child_fd, ctx->fd);	
 #endif /* DEBUG_PROXY */
 
-	struct sockaddr_in child_listener_addr;
-	socklen_t child_listener_len = sizeof(child_listener_addr);
-
-	if (getsockname(ctx->child_fd, (struct sockaddr *)&child_listener_addr, &child_listener_len) < 0) {
-		log_err_level_printf(LOG_CRIT, "Error in getsockname: %s\n", strerror(errno));
-		// @todo If getsockname() fails, should we really terminate the connection?
-		// @attention Do not close the child fd here, because child evcl exists now, hence pxy_conn_free() will close it while freeing child_evcl
-		pxy_conn_term(ctx, 1);
-		return -1;
-	}
-
-	// @attention Children are assumed to be listening on an IPv4 address
+	// @attention Children are assumed to be listening on an IPv4 address or an AF_UNIX path
 	// @todo IPv6?
 	char addr[INET_ADDRSTRLEN];
-	if (!inet_ntop(AF_INET, &child_listener_addr.sin_addr, addr, INET_ADDRSTRLEN)) {
-		pxy_conn_term(ctx, 1);
-		return -1;
-	}
+	// : and the max decimal digits of short
+	char port[7] = "";
+	const char *child_addr = addr;
 
-	if (pxy_set_dstaddr(ctx) == -1) {
-		return -1;
+	if (ctx->child_path) {
+		child_addr = ctx->child_path;
+	} else {
+		struct sockaddr_in child_listener_addr;
+		socklen_t child_listener_len = sizeof(child_listener_addr);
+
+		if (getsockname(ctx->child_fd, (struct sockaddr *)&child_listener_addr, &child_listener_len) < 0) {
+			log_err_level_printf(LOG_CRIT, "Error in getsockname: %s\n", strerror(errno));
+			// @todo If getsockname() fails, should we really terminate the connection?
+			// @attention Do not close the child fd here, because child evcl exists now, hence pxy_conn_free() will close it while freeing child_evcl
+			pxy_conn_term(ctx, 1);
+			return -1;
+		}
+		if (!inet_ntop(AF_INET, &child_listener_addr.sin_addr, addr, INET_ADDRSTRLEN)) {
+			pxy_conn_term(ctx, 1);
+			return -1;
+		}
+		snprintf(port, sizeof(port), ":%u", ntohs(child_listener_addr.sin_port));
 	}
 
+	const char *srchost = STRORNONE(pxy_conn_srchost_str(ctx));
+	const char *srcport = STRORNONE(pxy_conn_srcport_str(ctx));
+	const char *dsthost = STRORNONE(pxy_conn_dsthost_str(ctx));
+	const char *dstport = STRORNONE(pxy_conn_dstport_str(ctx));
+
 	int user_len = 0;
 	if (ctx->spec->opts->user_auth && ctx->user) {
 		// +1 for comma
 		user_len = strlen(ctx->user) + 1;
 	}
 	// SSLproxy: [127.0.0.1]:34649,[192.168.3.24]:47286,[74.125.206.108]:465,s,soner
-	// @todo Port may be less than 5 chars
-	// SSLproxy:        +   + [ + addr         + ] + : + p + , + [ + srchost_str              + ] + : + srcport_str              + , + [ + dsthost_str              + ] + : + dstport_str              + , + s + , + user
-	// SSLPROXY_KEY_LEN + 1 + 1 + strlen(addr) + 1 + 1 + 5 + 1 + 1 + strlen(ctx->srchost_str) + 1 + 1 + strlen(ctx->srcport_str) + 1 + 1 + strlen(ctx->dsthost_str) + 1 + 1 + strlen(ctx->dstport_str) + 1 + 1 + 1 + strlen(ctx->user)
-	ctx->sslproxy_header_len = SSLPROXY_KEY_LEN + strlen(addr) + strlen(ctx->srchost_str) + strlen(ctx->srcport_str) + strlen(ctx->dsthost_str) + strlen(ctx->dstport_str) + 19 + user_len;
+	// SSLproxy: [/var/run/sslproxy/sslproxy.1234.56],[192.168.3.24]:47286,[74.125.206.108]:465,s,soner
+	// SSLproxy:        +   + [ + addr         + ] + port         + , + [ + srchost          + ] + : + srcport          + , + [ + dsthost          + ] + : + dstport          + , + s + , + user
+	// SSLPROXY_KEY_LEN + 1 + 1 + strlen(addr) + 1 + strlen(port) + 1 + 1 + strlen(srchost) + 1 + 1 + strlen(srcport) + 1 + 1 + strlen(dsthost) + 1 + 1 + strlen(dstport) + 1 + 1 + 1 + strlen(ctx->user)
+	ctx->sslproxy_header_len = SSLPROXY_KEY_LEN + strlen(child_addr) + strlen(port) + strlen(srchost) + strlen(srcport) + strlen(dsthost) + strlen(dstport) + 13 + user_len;
 
 	// +1 for NULL
-	ctx->sslproxy_header = malloc(ctx->sslproxy_header_len + 1);
+	ctx->sslproxy_header = slab_arena_alloc(&ctx->arena, ctx->sslproxy_header_len + 1);
 	if (!ctx->sslproxy_header) {
 		pxy_conn_term(ctx, 1);
 		return -1;
@@ -1247,9 +1591,9 @@ pxy_setup_child_listener(pxy_conn_ctx_t *ctx)
 
 	// printf(3): "snprintf() will write at most size-1 of the characters (the size'th character then gets the terminating NULL)"
 	// So, +1 for NULL
-	snprintf(ctx->sslproxy_header, ctx->sslproxy_header_len + 1, "%s [%s]:%u,[%s]:%s,[%s]:%s,%s%s%s",
-			SSLPROXY_KEY, addr, ntohs(child_listener_addr.sin_port), STRORNONE(ctx->srchost_str), STRORNONE(ctx->srcport_str),
-			STRORNONE(ctx->dsthost_str), STRORNONE(ctx->dstport_str), ctx->spec->ssl ? "s":"p", user_len ? "," : "", user_len ? ctx->user : "");
+	snprintf(ctx->sslproxy_header, ctx->sslproxy_header_len + 1, "%s [%s]%s,[%s]:%s,[%s]:%s,%s%s%s",
+			SSLPROXY_KEY, child_addr, port, srchost, srcport,
+			dsthost, dstport, ctx->spec->ssl ? "s":"p", user_len ? "," : "", user_len ? ctx->user : "");
 	return 0;
 }
 
@@ -1355,22 +1699,75 @@ pxy_try_consume_last_input_child(struct bufferevent *bev, pxy_conn_child_ctx_t *
 			return -1;
 		}
 		ctx->protoctx->bev_readcb(bev, ctx);
+
+		// Release the start of an SSLproxy header held back by the readcb,
+		// the rest of it cannot arrive anymore
+		if (bev == ctx->src.bev && !ctx->removed_sslproxy_header && !ctx->dst.closed &&
+				evbuffer_get_length(bufferevent_get_input(bev))) {
+			ctx->removed_sslproxy_header = 1;
+			evbuffer_add_buffer(bufferevent_get_output(ctx->dst.bev), bufferevent_get_input(bev));
+		}
 	}
 	return 0;
 }
 
-int
-pxy_set_dstaddr(pxy_conn_ctx_t *ctx)
+/*
+ * The src and dst addrs are kept in binary form in the conn ctx, and formatted
+ * into the inline buffers of the conn ctx on first use, i.e. only if a log line
+ * or the sslproxy header needs them.
+ * The accessors return NULL if the addr is not known yet, e.g. the dst addr
+ * before the SNI lookup, or cannot be formatted.
+ */
+static int NONNULL(1)
+pxy_conn_format_srcaddr(pxy_conn_ctx_t *ctx)
 {
-	if (sys_sockaddr_str((struct sockaddr *)&ctx->dstaddr, ctx->dstaddrlen, &ctx->dsthost_str, &ctx->dstport_str) != 0) {
-		// sys_sockaddr_str() may fail due to either malloc() or getnameinfo()
-		ctx->enomem = 1;
-		pxy_conn_term(ctx, 1);
-		return -1;
+	if (!ctx->srcaddr_str_set) {
+		if (!ctx->srcaddrlen || sys_sockaddr_ntop((struct sockaddr *)&ctx->srcaddr, ctx->srcaddrlen,
+				ctx->srchost_buf, sizeof(ctx->srchost_buf), ctx->srcport_buf, sizeof(ctx->srcport_buf)) == -1) {
+			return -1;
+		}
+		ctx->srcaddr_str_set = 1;
 	}
 	return 0;
 }
 
+static int NONNULL(1)
+pxy_conn_format_dstaddr(pxy_conn_ctx_t *ctx)
+{
+	if (!ctx->dstaddr_str_set) {
+		if (!ctx->dstaddrlen || sys_sockaddr_ntop((struct sockaddr *)&ctx->dstaddr, ctx->dstaddrlen,
+				ctx->dsthost_buf, sizeof(ctx->dsthost_buf), ctx->dstport_buf, sizeof(ctx->dstport_buf)) == -1) {
+			return -1;
+		}
+		ctx->dstaddr_str_set = 1;
+	}
+	return 0;
+}
+
+const char *
+pxy_conn_srchost_str(pxy_conn_ctx_t *ctx)
+{
+	return pxy_conn_format_srcaddr(ctx) == -1 ? NULL : ctx->srchost_buf;
+}
+
+const char *
+pxy_conn_srcport_str(pxy_conn_ctx_t *ctx)
+{
+	return pxy_conn_format_srcaddr(ctx) == -1 ? NULL : ctx->srcport_buf;
+}
+
+const char *
+pxy_conn_dsthost_str(pxy_conn_ctx_t *ctx)
+{
+	return pxy_conn_format_dstaddr(ctx) == -1 ? NULL : ctx->dsthost_buf;
+}
+
+const char *
+pxy_conn_dstport_str(pxy_conn_ctx_t *ctx)
+{
+	return pxy_conn_format_dstaddr(ctx) == -1 ? NULL : ctx->dstport_buf;
+}
+
 int
 pxy_bev_readcb_preexec_logging_and_stats(struct bufferevent *bev, pxy_conn_ctx_t *ctx)
 {
@@ -1387,6 +1784,8 @@ pxy_bev_readcb_preexec_logging_and_stats(struct bufferevent *bev, pxy_conn_ctx_t
 		if (WANT_CONTENT_LOG(ctx->conn)) {
 			// HTTP content logging at this point may record certain header lines twice, if we have not seen all headers yet
 			return pxy_log_content_inbuf(ctx, inbuf, (bev == ctx->src.bev));
+		} else if (ctx->content_nolog) {
+			ctx->thr->content_skipped_bytes += inbuf_size;
 		}
 	}
 	return 0;
@@ -1412,6 +1811,9 @@ pxy_bev_readcb(struct bufferevent *bev, void *arg)
 	}
 
 	ctx->atime = time(NULL);
+	if (!ctx->ts_firstbyte) {
+		ctx->ts_firstbyte = pxy_thrmgr_phase_done(ctx, PXY_PHASE_FIRSTBYTE, ctx->ts_accept);
+	}
 	ctx->protoctx->bev_readcb(bev, ctx);
 
 out:
@@ -1434,6 +1836,8 @@ pxy_bev_readcb_preexec_logging_and_stats_child(struct bufferevent *bev, pxy_conn
 
 	if (WANT_CONTENT_LOG(ctx->conn)) {
 		return pxy_log_content_inbuf(ctx->conn, inbuf, (bev == ctx->src.bev));
+	} else if (ctx->conn->content_nolog) {
+		ctx->conn->thr->content_skipped_bytes += inbuf_size;
 	}
 	return 0;
 }
@@ -1515,13 +1919,23 @@ pxy_bev_eventcb_postexec_logging_and_stats(struct bufferevent *bev, short events
 		if (ctx->proto != PROTO_PASSTHROUGH) {
 			if (bev == ctx->src.bev) {
 				// @todo When do we reach here? If proto is autossl? Otherwise, src is connected in acceptcb.
-				pxy_log_connect_src(ctx);
+				if (ctx->connected) {
+					pxy_log_connect_src(ctx);
+				} else {
+					// The optimistic SSL handshake of src completes before the server one,
+					// log src once the server side info is known
+					ctx->log_connect_src = 1;
+				}
 			} else if (ctx->connected) {
 				if (pxy_prepare_logging(ctx) == -1) {
 					return -1;
 				}
 				// Doesn't log connect if proto is http, http proto does its own connect logging
 				pxy_log_connect_srvdst(ctx);
+				if (ctx->log_connect_src) {
+					ctx->log_connect_src = 0;
+					pxy_log_connect_src(ctx);
+				}
 			}
 		}
 
@@ -1543,6 +1957,21 @@ pxy_bev_eventcb_postexec_logging_and_stats(struct bufferevent *bev, short events
 	return 0;
 }
 
+/*
+ * Record the connect or handshake phase ended by the connected event on bev.
+ * The srvdst connect phase of SSL conns ends at the start of the handshake,
+ * see protossl_srvdst_info_cb().
+ */
+static void NONNULL(1,2)
+pxy_bev_eventcb_connected_phase(struct bufferevent *bev, pxy_conn_ctx_t *ctx)
+{
+	if (bev == ctx->srvdst.bev) {
+		ctx->ts_phase = pxy_thrmgr_phase_done(ctx, ctx->srvdst.ssl ? PXY_PHASE_SRVTLS : PXY_PHASE_CONNECT, ctx->ts_phase);
+	} else if (bev == ctx->src.bev && ctx->src.ssl) {
+		pxy_thrmgr_phase_done(ctx, PXY_PHASE_CLITLS, ctx->sslctx->optimistic ? ctx->sslctx->ts_optimistic : ctx->ts_phase);
+	}
+}
+
 /*
  * Callback for meta events on the up- and downstream connection bufferevents.
  * Called when EOF has been reached, a connection has been made, and on errors.
@@ -1554,6 +1983,10 @@ pxy_bev_eventcb(struct bufferevent *bev, short events, void *arg)
 
 	ctx->atime = time(NULL);
 
+	if (events & BEV_EVENT_CONNECTED) {
+		pxy_bev_eventcb_connected_phase(bev, ctx);
+	}
+
 	if (events & BEV_EVENT_ERROR) {
 		log_err_printf("Client-side BEV_EVENT_ERROR\n");
 		ctx->thr->errors++;
@@ -1625,16 +2058,10 @@ pxy_conn_connect(pxy_conn_ctx_t *ctx)
 	}
 
 	if (OPTS_DEBUG(ctx->global)) {
-		char *host, *port;
-		if (sys_sockaddr_str((struct sockaddr *)&ctx->dstaddr, ctx->dstaddrlen, &host, &port) == 0) {
-			log_dbg_printf("Connecting to [%s]:%s\n", host, port);
-			free(host);
-			free(port);
-		} else {
-			log_dbg_printf("Connecting to [?]:?\n");
-		}
+		log_dbg_printf("Connecting to [%s]:%s\n", STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)));
 	}
 
+	ctx->ts_phase = histo_now();
 	if (ctx->protoctx->connectcb(ctx) == -1) {
 		// @attention Do not try to close conns or do anything else with conn ctx on the thrmgr thread after setting event callbacks and/or socket connect.
 		// The return value of -1 from connectcb indicates that there was a fatal error before event callbacks were set, so we can terminate the connection.
@@ -1672,7 +2099,7 @@ identify_user(UNUSED evutil_socket_t fd, UNUSED short what, void *arg)
 
 		// @todo Do we really need to reset the stmt, as we always reset while returning?
 		sqlite3_reset(ctx->thr->get_user);
-		sqlite3_bind_text(ctx->thr->get_user, 1, ctx->srchost_str, -1, NULL);
+		sqlite3_bind_text(ctx->thr->get_user, 1, pxy_conn_srchost_str(ctx), -1, NULL);
 		rc = sqlite3_step(ctx->thr->get_user);
 
 		// Retry in case we cannot acquire db file or database: SQLITE_BUSY or SQLITE_LOCKED respectively
@@ -1724,9 +2151,9 @@ identify_user(UNUSED evutil_socket_t fd, UNUSED short what, void *arg)
 			log_dbg_level_printf(LOG_DBG_MODE_FINEST, "identify_user: Passed timeout test, idletime=%u, fd=%d\n", ctx->idletime, ctx->fd);
 #endif /* DEBUG_PROXY */
 
-			ctx->user = strdup((char *)sqlite3_column_text(ctx->thr->get_user, 0));
+			ctx->user = slab_arena_strdup(&ctx->arena, (char *)sqlite3_column_text(ctx->thr->get_user, 0));
 			// Desc is needed for PassSite filtering
-			ctx->desc = strdup((char *)sqlite3_column_text(ctx->thr->get_user, 3));
+			ctx->desc = slab_arena_strdup(&ctx->arena, (char *)sqlite3_column_text(ctx->thr->get_user, 3));
 
 #ifdef DEBUG_PROXY
 			log_dbg_level_printf(LOG_DBG_MODE_FINEST, "identify_user: Conn user=%s, desc=%s, fd=%d\n", ctx->user, ctx->desc, ctx->fd);
@@ -1764,6 +2191,11 @@ static int NONNULL(1)
 get_client_ether(pxy_conn_ctx_t *ctx)
 {
 	int rv = 0;
+	const char *srchost = pxy_conn_srchost_str(ctx);
+
+	if (!srchost) {
+		return -1;
+	}
 
 	FILE *arp_cache = fopen(ARP_CACHE, "r");
 	if (!arp_cache) {
@@ -1782,8 +2214,8 @@ get_client_ether(pxy_conn_ctx_t *ctx)
 	char ip[46], ether[18];
 	//192.168.0.1     0x1         0x2         00:50:56:2c:bf:e0     *        enp3s0f1
 	while (fscanf(arp_cache, "%45s %*s %*s %17s %*s %*s", ip, ether) == 2) {
-		if (!strncasecmp(ip, ctx->srchost_str, 45)) {
-			ctx->ether = strdup(ether);
+		if (!strncasecmp(ip, srchost, 45)) {
+			ctx->ether = slab_arena_strdup(&ctx->arena, ether);
 			rv = 1;
 #ifdef DEBUG_PROXY
 			log_dbg_level_printf(LOG_DBG_MODE_FINEST, "Arp entry for %s: %s\n", ip, ether);
@@ -1893,7 +2325,7 @@ get_client_ether(in_addr_t addr, pxy_conn_ctx_t *ctx)
 			// Record the first unexpired complete entry
 			if (!ctx->ether && (found_entry - expired) == 1) {
 				// Dup before assignment because we free local var ether below
-				ctx->ether = strdup(ether);
+				ctx->ether = slab_arena_strdup(&ctx->arena, ether);
 #ifdef DEBUG_PROXY
 				log_dbg_level_printf(LOG_DBG_MODE_FINEST, "Arp entry for %s: %s\n", inet_ntoa(sin->sin_addr), ether);
 #endif /* DEBUG_PROXY */
@@ -2006,6 +2438,7 @@ pxy_conn_setup(evutil_socket_t fd,
 			log_err_printf("Connection not found in NAT state table, aborting connection\n");
 			goto out;
 		}
+		ctx->ts_nat = histo_now();
 	} else if (spec->connect_addrlen > 0) {
 		/* static forwarding */
 		ctx->dstaddrlen = spec->connect_addrlen;
@@ -2019,25 +2452,21 @@ pxy_conn_setup(evutil_socket_t fd,
 		}
 	}
 
-	if (sys_sockaddr_str(peeraddr, peeraddrlen, &ctx->srchost_str, &ctx->srcport_str) != 0) {
-		log_err_level_printf(LOG_CRIT, "Aborting connection setup (out of memory)!\n");
-		goto out;
-	}
+	// Keep the src addr in binary form, it is formatted only if a log line or the sslproxy header needs it
+	// Also used by pcap logging, mirroring, user auth, and lprocinfo
+	ctx->srcaddrlen = peeraddrlen;
+	memcpy(&ctx->srcaddr, peeraddr, ctx->srcaddrlen);
 
-	/* prepare logging part 1 and user auth */
-	if (global->pcaplog || spec->opts->user_auth
-#ifndef WITHOUT_MIRROR
-		|| global->mirrorif
-#endif /* !WITHOUT_MIRROR */
 #ifdef HAVE_LOCAL_PROCINFO
-		|| global->lprocinfo
-#endif /* HAVE_LOCAL_PROCINFO */
-		) {
-		ctx->srcaddrlen = peeraddrlen;
-		memcpy(&ctx->srcaddr, peeraddr, ctx->srcaddrlen);
+	// The lookup thread hands the conn over when done
+	if (global->lprocinfo && (WANT_CONNECT_LOG(ctx) || WANT_CONTENT_LOG(ctx))) {
+		pxy_thrmgr_lproc_lookup(ctx);
+		return;
 	}
+#endif /* HAVE_LOCAL_PROCINFO */
 
-	ctx->protoctx->fd_readcb(ctx->fd, 0, ctx);
+	// Run the rest of conn setup on the conn handling thread, the listener thread must not touch the conn after this
+	pxy_thrmgr_handoff_conn(ctx);
 	return;
 
 out:
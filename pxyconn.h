@@ -39,15 +39,27 @@
 #include "attrib.h"
 #include "pxythrmgr.h"
 #include "log.h"
+#include "sys.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
 
+/*
+ * Adaptive relay buffers: the output buffer limit of a conn doubles after it
+ * is reached this many times, up to OUTBUF_GROW times RelayBufferSize, and
+ * halves on each expired conn check the conn is idle, down to RelayBufferSize
+ * divided by OUTBUF_SHRINK.
+ */
+#define OUTBUF_GROW_HITS	4
+#define OUTBUF_GROW	16
+#define OUTBUF_SHRINK	8
+
 #define WANT_CONNECT_LOG(ctx)	((ctx)->global->connectlog||!(ctx)->global->detach||(ctx)->global->statslog)
-#define WANT_CONTENT_LOG(ctx)	((ctx)->global->contentlog&&((ctx)->proto!=PROTO_PASSTHROUGH))
+#define WANT_CONTENT_LOG(ctx)	(((ctx)->global->contentlog||(ctx)->global->shmlog)&&((ctx)->proto!=PROTO_PASSTHROUGH)&&!(ctx)->content_nolog)
 
 #define SSLPROXY_KEY		"SSLproxy:"
 #define SSLPROXY_KEY_LEN	strlen(SSLPROXY_KEY)
@@ -113,16 +125,23 @@ typedef struct proto_ctx proto_ctx_t;
 typedef struct proto_child_ctx proto_child_ctx_t;
 
 struct ssl_ctx {
-	/* log strings related to SSL */
-	char *ssl_names;
-	char *origcrtfpr;
-	char *usedcrtfpr;
+	/* log strings related to SSL, from the forged cert record or the arena */
+	const char *ssl_names;
+	const char *origcrtfpr;
+	const char *usedcrtfpr;
+
+	/* record of the forged cert for origcrt, NULL if none */
+	struct crtrec *crtrec;
 
 	/* ssl */
 	unsigned int sni_peek_retries : 6;       /* max 64 SNI parse retries */
 	unsigned int immutable_cert : 1;  /* 1 if the cert cannot be changed */
 	unsigned int generated_cert : 1;     /* 1 if we generated a new cert */
 	unsigned int have_sslerr : 1;           /* 1 if we have an ssl error */
+	unsigned int optimistic : 1;  /* 1 if src started with the SNI cert */
+
+	/* start of the optimistic client handshake */
+	uint64_t ts_optimistic;
 
 	/* server name indicated by client in SNI TLS extension */
 	char *sni;
@@ -175,8 +194,9 @@ struct proto_child_ctx {
 #ifdef HAVE_LOCAL_PROCINFO
 /* local process data - filled in iff pid != -1 */
 typedef struct pxy_conn_lproc_desc {
-	struct sockaddr_storage srcaddr;
-	socklen_t srcaddrlen;
+	// Time the conn was queued for the lookup, see pxy_thrmgr_lproc_lookup()
+	struct timeval queued;
+	unsigned int enomem : 1;
 
 	pid_t pid;
 	uid_t uid;
@@ -211,14 +231,24 @@ struct pxy_conn_ctx {
 	// For ssl specific fields, NULL for non-ssl conns
 	ssl_ctx_t *sslctx;
 
-	/* log strings from socket */
-	char *srchost_str;
-	char *srcport_str;
-	char *dsthost_str;
-	char *dstport_str;
+	/* log strings from socket, formatted from srcaddr and dstaddr on first use,
+	 * use the pxy_conn_*_str() accessors instead of these buffers */
+	char srchost_buf[SYS_HOSTSTRLEN];
+	char srcport_buf[SYS_SERVSTRLEN];
+	char dsthost_buf[SYS_HOSTSTRLEN];
+	char dstport_buf[SYS_SERVSTRLEN];
+	unsigned int srcaddr_str_set : 1;
+	unsigned int dstaddr_str_set : 1;
 
 	/* content log context */
 	log_content_ctx_t logctx;
+	// Bytes per direction to log by the capture policy, 0 for no limit, and the bytes logged so far, by req
+	size_t content_limit;
+	size_t content_logged[2];
+	unsigned int content_nolog : 1;     /* 1 if the policy excludes the conn */
+	// Set while reading is paused for the full ShmLog ring of the conn, retried with shm_ev
+	unsigned int shm_paused : 1;
+	struct event *shm_ev;
 
 	/* status flags */
 	unsigned int connected : 1;       /* 0 until both ends are connected */
@@ -227,12 +257,20 @@ struct pxy_conn_ctx {
 	unsigned int dst_connected : 1;          /* 0 until dst is connected */
 	unsigned int term : 1;                     /* 0 until term requested */
 	unsigned int term_requestor : 1;          /* 1 client, 0 server side */
+	unsigned int log_connect_src : 1;  /* 1 to log src once connected */
 
 	unsigned int srvdst_xferred : 1;     /* 1 if srvdst xferred to child */
 	struct pxy_conn_desc srvdst;
 
 	struct event *ev;
 
+	// Zero-copy relay between src and srvdst, NULL unless engaged
+	struct pxy_splice *splice;
+
+	// Plugin relaying the conn instead of the listening program, and its per-conn state, NULL unless engaged
+	struct pxy_plugin *plugin;
+	void *plugin_conn;
+
 	/* original source and destination address, and family */
 	struct sockaddr_storage srcaddr;
 	socklen_t srcaddrlen;
@@ -264,8 +302,10 @@ struct pxy_conn_ctx {
 	// fd of event listener for children, explicitly closed on error (not for stats only)
 	evutil_socket_t child_fd;
 	struct evconnlistener *child_evcl;
+	// Path of the child listener socket if it is an AF_UNIX socket, unlinked on free
+	char *child_path;
 
-	// SSLproxy specific info: ip:port addr child is listening on, orig client addr, and orig server addr
+	// SSLproxy specific info: ip:port addr or path child is listening on, orig client addr, and orig server addr
 	// SSLproxy header is never sent to the Internet, always removed by child conns
 	char *sslproxy_header;
 	size_t sslproxy_header_len;
@@ -286,6 +326,18 @@ struct pxy_conn_ctx {
 	// Conn last access time, used to determine expired conns
 	// Updated on entry to callback functions, parent or child
 	time_t atime;
+
+	// Monotonic usec timestamps for the phase latency histograms: accept, end of NAT lookup (0 if none),
+	// start of the phase in progress, and first byte relayed; phases is the bitmask of recorded phases
+	uint64_t ts_accept;
+	uint64_t ts_nat;
+	uint64_t ts_phase;
+	uint64_t ts_firstbyte;
+	unsigned int phases;
+
+	// Output buffer limit of the conn ends, and the number of times it was reached since it was last adapted
+	unsigned int outbuf_limit;
+	unsigned int outbuf_hits;
 	
 	// Per-thread conn list, used to determine idle and expired conns, and to close them
 	pxy_conn_ctx_t *next;
@@ -293,6 +345,9 @@ struct pxy_conn_ctx {
 	// Expired conns are link-listed using this pointer, a temporary list used in conn thr timercb only
 	pxy_conn_ctx_t *next_expired;
 
+	// Conns handed over to their thread by the listener thread are link-listed using this pointer
+	pxy_conn_ctx_t *next_handoff;
+
 	// Number of times we try to acquire user db before giving up
 	unsigned int identify_user_count;
 	// User owner of conn
@@ -315,6 +370,10 @@ struct pxy_conn_ctx {
 	/* local process information */
 	pxy_conn_lproc_desc_t lproc;
 #endif /* HAVE_LOCAL_PROCINFO */
+
+	// Strings living as long as the conn, such as sslproxy header, user, ether, and desc,
+	// are allocated from this arena, and are freed all at once with the conn
+	slab_arena_t arena;
 };
 
 /* child connection state consisting of two connection descriptors,
@@ -342,7 +401,8 @@ struct pxy_conn_child_ctx {
 	evutil_socket_t dst_fd;
 
 	// Child conns remove the SSLproxy header inserted by parent
-	int removed_sslproxy_header;   /* 1 after SSLproxy header is removed */
+	int removed_sslproxy_header;   /* 1 after SSLproxy header is removed, or search given up */
+	size_t sslproxy_header_searched; /* bytes relayed while searching for the header */
 
 	// Children of the conn are link-listed using this pointer
 	// We identify child conns with their src fds, so the src fd of child is used as its id while removing it from this list
@@ -350,6 +410,7 @@ struct pxy_conn_child_ctx {
 };
 
 #ifdef HAVE_LOCAL_PROCINFO
+void pxy_conn_lookup_local_procinfo(pxy_conn_ctx_t *) NONNULL(1);
 int pxy_prepare_logging_local_procinfo(pxy_conn_ctx_t *) NONNULL(1);
 #endif /* HAVE_LOCAL_PROCINFO */
 
@@ -362,13 +423,20 @@ void pxy_log_dbg_evbuf_info(pxy_conn_ctx_t *, pxy_conn_desc_t *, pxy_conn_desc_t
 
 unsigned char *pxy_malloc_packet(size_t, pxy_conn_ctx_t *) MALLOC NONNULL(2) WUNRES;
 
-int pxy_set_dstaddr(pxy_conn_ctx_t *) NONNULL(1);
+const char *pxy_conn_srchost_str(pxy_conn_ctx_t *) NONNULL(1);
+const char *pxy_conn_srcport_str(pxy_conn_ctx_t *) NONNULL(1);
+const char *pxy_conn_dsthost_str(pxy_conn_ctx_t *) NONNULL(1);
+const char *pxy_conn_dstport_str(pxy_conn_ctx_t *) NONNULL(1);
+const char *pxy_proto_str(protocol_t) WUNRES;
 
 void pxy_insert_sslproxy_header(pxy_conn_ctx_t *, unsigned char *, size_t *) NONNULL(1,2,3);
-void pxy_try_remove_sslproxy_header(pxy_conn_child_ctx_t *, unsigned char *, size_t *) NONNULL(1,2,3);
+void pxy_remove_sslproxy_header(pxy_conn_child_ctx_t *, struct evbuffer *, struct evbuffer *) NONNULL(1,2,3);
 
 void pxy_try_set_watermark(struct bufferevent *, pxy_conn_ctx_t *, struct bufferevent *) NONNULL(1,2,3);
 void pxy_try_unset_watermark(struct bufferevent *, pxy_conn_ctx_t *, pxy_conn_desc_t *) NONNULL(1,2,3);
+void pxy_shrink_outbuf_limit(pxy_conn_ctx_t *) NONNULL(1);
+void pxy_bufferevent_account(struct bufferevent *, pxy_thr_ctx_t *) NONNULL(1,2);
+void pxy_bufferevent_unaccount(struct bufferevent *, pxy_thr_ctx_t *) NONNULL(1,2);
 
 int pxy_try_close_conn_end(pxy_conn_desc_t *, pxy_conn_ctx_t *) NONNULL(1,2);
 
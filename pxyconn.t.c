@@ -0,0 +1,306 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pxyconn.h"
+#include "pxythrmgr.h"
+#include "logshm.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+
+#include <check.h>
+
+#define HDR "SSLproxy: [127.0.0.1]:34649,[192.168.3.24]:47286,[74.125.206.108]:465,s"
+
+static global_t global;
+static pxy_conn_ctx_t conn;
+static pxy_conn_child_ctx_t child;
+static struct evbuffer *inbuf;
+static struct evbuffer *outbuf;
+
+static void
+pxyconn_setup(void)
+{
+	memset(&global, 0, sizeof(global));
+	memset(&conn, 0, sizeof(conn));
+	memset(&child, 0, sizeof(child));
+	global.sslproxy_header_search_limit = 1024;
+	conn.global = &global;
+	conn.sslproxy_header = HDR;
+	conn.sslproxy_header_len = strlen(HDR);
+	child.conn = &conn;
+	inbuf = evbuffer_new();
+	outbuf = evbuffer_new();
+}
+
+static void
+pxyconn_teardown(void)
+{
+	evbuffer_free(inbuf);
+	evbuffer_free(outbuf);
+}
+
+static void
+pxyconn_read(const char *s)
+{
+	evbuffer_add(inbuf, s, strlen(s));
+	if (!child.removed_sslproxy_header)
+		pxy_remove_sslproxy_header(&child, inbuf, outbuf);
+	else
+		evbuffer_add_buffer(outbuf, inbuf);
+}
+
+static int
+pxyconn_outbuf_is(const char *s)
+{
+	size_t len = evbuffer_get_length(outbuf);
+
+	return len == strlen(s) && !memcmp(evbuffer_pullup(outbuf, -1), s, len);
+}
+
+START_TEST(pxy_remove_sslproxy_header_01)
+{
+	pxyconn_read(HDR "\r\nGET / HTTP/1.1\r\n");
+	fail_unless(child.removed_sslproxy_header, "header not removed");
+	fail_unless(pxyconn_outbuf_is("GET / HTTP/1.1\r\n"), "wrong output");
+	fail_unless(!evbuffer_get_length(inbuf), "inbuf not empty");
+}
+END_TEST
+
+START_TEST(pxy_remove_sslproxy_header_02)
+{
+	pxyconn_read("EHLO x\r\n" HDR "\r\nMAIL FROM:<a@b>\r\n");
+	fail_unless(child.removed_sslproxy_header, "header not removed");
+	fail_unless(pxyconn_outbuf_is("EHLO x\r\nMAIL FROM:<a@b>\r\n"), "wrong output");
+}
+END_TEST
+
+START_TEST(pxy_remove_sslproxy_header_03)
+{
+	pxyconn_read("SSLpr");
+	fail_unless(!child.removed_sslproxy_header, "header removed early");
+	fail_unless(!evbuffer_get_length(outbuf), "header start relayed");
+	pxyconn_read("oxy: [127.0.0.1]:34649,[192.168.3.24]");
+	fail_unless(!evbuffer_get_length(outbuf), "header start relayed");
+	pxyconn_read(":47286,[74.125.206.108]:465,s");
+	fail_unless(!evbuffer_get_length(outbuf), "header without crlf relayed");
+	pxyconn_read("\r");
+	fail_unless(!evbuffer_get_length(outbuf), "header without lf relayed");
+	pxyconn_read("\nabc");
+	fail_unless(child.removed_sslproxy_header, "header not removed");
+	fail_unless(pxyconn_outbuf_is("abc"), "wrong output");
+}
+END_TEST
+
+START_TEST(pxy_remove_sslproxy_header_04)
+{
+	pxyconn_read("xyzSSL");
+	fail_unless(pxyconn_outbuf_is("xyzSSL"), "data after offset 0 held back");
+	fail_unless(!evbuffer_get_length(inbuf), "inbuf not empty");
+	pxyconn_read("foo");
+	fail_unless(!child.removed_sslproxy_header, "search given up early");
+	fail_unless(pxyconn_outbuf_is("xyzSSLfoo"), "wrong output");
+}
+END_TEST
+
+START_TEST(pxy_remove_sslproxy_header_05)
+{
+	char data[600];
+
+	memset(data, 'a', sizeof(data) - 1);
+	data[sizeof(data) - 1] = '\0';
+	pxyconn_read(data);
+	fail_unless(!child.removed_sslproxy_header, "search given up early");
+	pxyconn_read(data);
+	fail_unless(child.removed_sslproxy_header, "search not given up");
+	fail_unless(evbuffer_get_length(outbuf) == 2 * strlen(data), "data lost");
+	// Relayed as is after giving up
+	pxyconn_read(HDR "\r\n");
+	fail_unless(evbuffer_get_length(outbuf) == 2 * strlen(data) + strlen(HDR) + 2, "header removed after limit");
+}
+END_TEST
+
+START_TEST(pxy_remove_sslproxy_header_06)
+{
+	pxyconn_read("GET / HTTP/1.1\r\nHost: S");
+	fail_unless(pxyconn_outbuf_is("GET / HTTP/1.1\r\nHost: S"), "request not relayed");
+	fail_unless(!evbuffer_get_length(inbuf), "inbuf not empty");
+	pxyconn_read("S");
+	fail_unless(pxyconn_outbuf_is("GET / HTTP/1.1\r\nHost: SS"), "request not relayed");
+}
+END_TEST
+
+START_TEST(pxy_remove_sslproxy_header_07)
+{
+	pxyconn_read("abc" HDR);
+	fail_unless(!child.removed_sslproxy_header, "header removed without crlf");
+	fail_unless(pxyconn_outbuf_is("abc" HDR), "header without crlf held back");
+	fail_unless(!evbuffer_get_length(inbuf), "inbuf not empty");
+}
+END_TEST
+
+START_TEST(pxy_remove_sslproxy_header_08)
+{
+	pxyconn_read("S");
+	fail_unless(!evbuffer_get_length(outbuf), "header start relayed");
+	pxyconn_read("MTP");
+	fail_unless(pxyconn_outbuf_is("SMTP"), "non-header start held back");
+	fail_unless(!evbuffer_get_length(inbuf), "inbuf not empty");
+}
+END_TEST
+
+static int
+pxyconn_reading(struct bufferevent *bev)
+{
+	return !!(bufferevent_get_enabled(bev) & EV_READ);
+}
+
+/*
+ * Consume the records of ring, returns the payload bytes of the data records.
+ */
+static size_t
+pxyconn_shm_consume(logshm_ring_t *ring)
+{
+	const logshm_rec_t *rec;
+	uint64_t pos;
+	size_t sz = 0;
+
+	while ((rec = logshm_ring_peek(ring, &pos))) {
+		if (rec->type == LOGSHM_REC_DATA)
+			sz += rec->len;
+		fail_unless(logshm_ring_consume(ring, pos, rec) == 0, "consume failed");
+	}
+	return sz;
+}
+
+START_TEST(pxy_shm_pause_01)
+{
+	char shmname[64];
+	logshm_t *shm;
+	logshm_ring_t *ring;
+	pxy_thr_ctx_t thr;
+	unsigned char buf[4096];
+	size_t logged = 0, consumed;
+	int sv[2], dv[2];
+
+	snprintf(shmname, sizeof(shmname), "/sslproxy-test.%d", getpid());
+	shm = logshm_new(shmname, 1, LOGSHM_RINGSIZE_MIN, LOGSHM_PAUSE);
+	fail_unless(!!shm, "failed to create shm");
+	ring = logshm_ring(shm, 0);
+
+	memset(&thr, 0, sizeof(thr));
+	thr.evbase = event_base_new();
+	fail_unless(!!thr.evbase, "failed to create evbase");
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair failed");
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, dv) == 0, "socketpair failed");
+	conn.thr = &thr;
+	conn.outbuf_limit = 65536;
+	conn.src.bev = bufferevent_socket_new(thr.evbase, sv[0], BEV_OPT_CLOSE_ON_FREE);
+	conn.dst.bev = bufferevent_socket_new(thr.evbase, dv[0], BEV_OPT_CLOSE_ON_FREE);
+	bufferevent_enable(conn.src.bev, EV_READ|EV_WRITE);
+	bufferevent_enable(conn.dst.bev, EV_READ|EV_WRITE);
+	conn.logctx.shm = ring;
+	conn.logctx.shm_id = 1;
+
+	// The ring fills up, the content which does not fit is kept and reads pause
+	memset(buf, 'x', sizeof(buf));
+	for (int i = 0; i < 100 && !conn.shm_paused; i++) {
+		evbuffer_add(inbuf, buf, sizeof(buf));
+		fail_unless(pxy_log_content_inbuf(&conn, inbuf, i % 2) == 0, "content log failed");
+		evbuffer_drain(inbuf, sizeof(buf));
+		logged += sizeof(buf);
+	}
+	fail_unless(conn.shm_paused, "full ring did not pause the conn");
+	fail_unless(!pxyconn_reading(conn.src.bev), "src still reading");
+	fail_unless(!pxyconn_reading(conn.dst.bev), "dst still reading");
+	fail_unless(ring->pauses > 0, "pause not counted");
+	fail_unless(!ring->drops, "content dropped");
+
+	// The retry finds the ring still full
+	event_base_loop(thr.evbase, EVLOOP_ONCE);
+	fail_unless(conn.shm_paused, "resumed while the ring is full");
+	fail_unless(!pxyconn_reading(conn.src.bev), "src reading while the ring is full");
+
+	// Once the reader has made space, the kept content is written and reads resume
+	consumed = pxyconn_shm_consume(ring);
+	event_base_loop(thr.evbase, EVLOOP_ONCE);
+	fail_unless(!conn.shm_paused, "not resumed after the reader made space");
+	fail_unless(pxyconn_reading(conn.src.bev), "src not reading after resume");
+	fail_unless(pxyconn_reading(conn.dst.bev), "dst not reading after resume");
+	consumed += pxyconn_shm_consume(ring);
+	fail_unless(consumed == logged, "content lost");
+	fail_unless(!ring->drops, "content dropped");
+
+	fail_unless(log_content_close(&conn.logctx, 1) == 0, "close failed");
+	bufferevent_free(conn.src.bev);
+	bufferevent_free(conn.dst.bev);
+	close(sv[1]);
+	close(dv[1]);
+	event_free(conn.shm_ev);
+	event_base_free(thr.evbase);
+	logshm_free(shm);
+	shm_unlink(shmname);
+}
+END_TEST
+
+Suite *
+pxyconn_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("pxyconn");
+
+	tc = tcase_create("pxy_remove_sslproxy_header");
+	tcase_add_checked_fixture(tc, pxyconn_setup, pxyconn_teardown);
+	tcase_add_test(tc, pxy_remove_sslproxy_header_01);
+	tcase_add_test(tc, pxy_remove_sslproxy_header_02);
+	tcase_add_test(tc, pxy_remove_sslproxy_header_03);
+	tcase_add_test(tc, pxy_remove_sslproxy_header_04);
+	tcase_add_test(tc, pxy_remove_sslproxy_header_05);
+	tcase_add_test(tc, pxy_remove_sslproxy_header_06);
+	tcase_add_test(tc, pxy_remove_sslproxy_header_07);
+	tcase_add_test(tc, pxy_remove_sslproxy_header_08);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("pxy_shm_pause");
+	tcase_add_checked_fixture(tc, pxyconn_setup, pxyconn_teardown);
+	tcase_add_test(tc, pxy_shm_pause_01);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
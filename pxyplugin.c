@@ -0,0 +1,269 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pxyplugin.h"
+
+#include "prototcp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+/*
+ * In-process relay through analysis plugins, see plugin.h for the ABI.
+ *
+ * Conns of proxyspecs with a plugin skip the listening program: once the
+ * server is connected, srvdst becomes the dst of the conn, just like the
+ * first child conn takes it over in divert mode, no child listener is set
+ * up, and the plugin takes the place of the readcb of the proto, moving the
+ * data read on one end to the output buffer of the other.  This saves the
+ * two extra sockets per conn and the SSLproxy header insertion and removal.
+ * The rest of the conn handling, i.e. the writecbs, eventcbs, watermarks,
+ * and logging, is that of the proto.
+ */
+
+// Loaded plugins, only modified while parsing the config on the main thread
+static pxy_plugin_t *pxy_plugins = NULL;
+// Set once the startup config is loaded, reloads may only reuse plugins
+static int pxy_plugins_frozen = 0;
+
+static void
+pxy_plugin_free(pxy_plugin_t *plugin)
+{
+	if (plugin->handle) {
+		dlclose(plugin->handle);
+	}
+	if (plugin->path) {
+		free(plugin->path);
+	}
+	if (plugin->arg) {
+		free(plugin->arg);
+	}
+	free(plugin);
+}
+
+/*
+ * Load the plugin at path and initialize it with arg, which may be NULL.
+ * Returns the plugin already loaded with the same path and arg, if any.
+ * After pxy_plugin_freeze(), no new plugins are loaded.
+ * Prints the error and returns NULL on failure.
+ */
+pxy_plugin_t *
+pxy_plugin_load(const char *path, const char *arg)
+{
+	pxy_plugin_t *plugin;
+	sslproxy_plugin_init_t init;
+
+	for (plugin = pxy_plugins; plugin; plugin = plugin->next) {
+		if (!strcmp(plugin->path, path) &&
+		    (plugin->arg ? arg && !strcmp(plugin->arg, arg) : !arg))
+			return plugin;
+	}
+
+	if (pxy_plugins_frozen) {
+		fprintf(stderr, "Plugin %s %s is not loaded, loading a plugin needs a restart\n",
+		        path, arg ? arg : "");
+		return NULL;
+	}
+
+	plugin = malloc(sizeof(pxy_plugin_t));
+	if (!plugin) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	memset(plugin, 0, sizeof(pxy_plugin_t));
+	plugin->path = strdup(path);
+	if (arg) {
+		plugin->arg = strdup(arg);
+	}
+	if (!plugin->path || (arg && !plugin->arg)) {
+		fprintf(stderr, "Out of memory\n");
+		goto err;
+	}
+
+	plugin->handle = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+	if (!plugin->handle) {
+		fprintf(stderr, "Error loading plugin: %s\n", dlerror());
+		goto err;
+	}
+	// ISO C does not allow casting void * to a function pointer, see dlsym(3)
+	*(void **)&init = dlsym(plugin->handle, SSLPROXY_PLUGIN_INIT);
+	if (!init) {
+		fprintf(stderr, "Plugin %s does not export %s\n", path, SSLPROXY_PLUGIN_INIT);
+		goto err;
+	}
+
+	plugin->ops.abi = SSLPROXY_PLUGIN_ABI;
+	if (init(&plugin->ops, plugin->arg) == -1) {
+		fprintf(stderr, "Plugin %s failed to initialize\n", path);
+		goto err;
+	}
+	if (!plugin->ops.name) {
+		plugin->ops.name = plugin->path;
+	}
+#ifdef DEBUG_OPTS
+	log_dbg_printf("Loaded plugin %s (%s)\n", plugin->ops.name, path);
+#endif /* DEBUG_OPTS */
+
+	plugin->next = pxy_plugins;
+	pxy_plugins = plugin;
+	return plugin;
+err:
+	pxy_plugin_free(plugin);
+	return NULL;
+}
+
+/*
+ * Refuse to load any new plugins, so that plugin init functions only ever run
+ * before forking and dropping privileges.  Config reloads then can only use
+ * the plugins loaded at startup.
+ */
+void
+pxy_plugin_freeze(void)
+{
+	pxy_plugins_frozen = 1;
+}
+
+/*
+ * Finalize and unload all plugins, on exit only.
+ */
+void
+pxy_plugin_fini(void)
+{
+	while (pxy_plugins) {
+		pxy_plugin_t *plugin = pxy_plugins;
+		pxy_plugins = plugin->next;
+		if (plugin->ops.fini) {
+			plugin->ops.fini(plugin->ops.arg);
+		}
+		pxy_plugin_free(plugin);
+	}
+	pxy_plugins_frozen = 0;
+}
+
+static void NONNULL(1)
+pxy_plugin_bev_readcb(struct bufferevent *bev, void *arg)
+{
+	pxy_conn_ctx_t *ctx = arg;
+	int req = (bev == ctx->src.bev);
+	pxy_conn_desc_t *other = req ? &ctx->dst : &ctx->src;
+
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_plugin_bev_readcb: ENTER, %s, size=%zu, fd=%d\n",
+			req ? "src" : "dst", evbuffer_get_length(bufferevent_get_input(bev)), ctx->fd);
+#endif /* DEBUG_PROXY */
+
+	if (other->closed) {
+		pxy_discard_inbuf(bev);
+		return;
+	}
+
+	if (req && prototcp_try_send_userauth_msg(bev, ctx)) {
+		return;
+	}
+
+	struct evbuffer *inbuf = bufferevent_get_input(bev);
+	struct evbuffer *outbuf = bufferevent_get_output(other->bev);
+
+	if (ctx->plugin->ops.conn_data) {
+		if (ctx->plugin->ops.conn_data(ctx->plugin_conn, req, inbuf, outbuf) == -1) {
+#ifdef DEBUG_PROXY
+			log_dbg_level_printf(LOG_DBG_MODE_FINE, "pxy_plugin_bev_readcb: Plugin closes conn, fd=%d\n", ctx->fd);
+#endif /* DEBUG_PROXY */
+			pxy_conn_term(ctx, req);
+			return;
+		}
+	} else {
+		evbuffer_add_buffer(outbuf, inbuf);
+	}
+	pxy_try_set_watermark(bev, ctx, other->bev);
+}
+
+/*
+ * Relay the conn through its plugin instead of the listening program, in
+ * place of setting up the child listener, once the server is connected and
+ * the src is set up.  Returns -1 and terminates the conn if the plugin
+ * refuses it.
+ */
+int
+pxy_plugin_engage(pxy_conn_ctx_t *ctx)
+{
+	pxy_plugin_t *plugin = ctx->spec->opts->plugin;
+	void *connarg = NULL;
+
+	if (plugin->ops.conn_open) {
+		sslproxy_plugin_conn_t conn;
+
+		memset(&conn, 0, sizeof(conn));
+		conn.id = ctx->id;
+		conn.thridx = ctx->thr->thridx;
+		conn.proto = pxy_proto_str(ctx->proto);
+		conn.srcaddr = (struct sockaddr *)&ctx->srcaddr;
+		conn.srcaddrlen = ctx->srcaddrlen;
+		conn.dstaddr = (struct sockaddr *)&ctx->dstaddr;
+		conn.dstaddrlen = ctx->dstaddrlen;
+		conn.sni = ctx->sslctx ? ctx->sslctx->sni : NULL;
+		conn.user = ctx->user;
+
+		if (plugin->ops.conn_open(plugin->ops.arg, &conn, &connarg) == -1) {
+#ifdef DEBUG_PROXY
+			log_dbg_level_printf(LOG_DBG_MODE_FINE, "pxy_plugin_engage: Plugin refuses conn, fd=%d\n", ctx->fd);
+#endif /* DEBUG_PROXY */
+			pxy_conn_term(ctx, 1);
+			return -1;
+		}
+	}
+	ctx->plugin = plugin;
+	ctx->plugin_conn = connarg;
+
+	// srvdst is the dst of the conn from now on, and is freed as the dst
+	ctx->dst = ctx->srvdst;
+	ctx->srvdst_xferred = 1;
+	ctx->protoctx->bev_readcb = pxy_plugin_bev_readcb;
+	bufferevent_setcb(ctx->dst.bev, pxy_bev_readcb, pxy_bev_writecb, pxy_bev_eventcb, ctx);
+	bufferevent_enable(ctx->dst.bev, EV_READ|EV_WRITE);
+
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINER, "pxy_plugin_engage: Relaying through plugin %s, fd=%d\n", plugin->ops.name, ctx->fd);
+#endif /* DEBUG_PROXY */
+	return 0;
+}
+
+void
+pxy_plugin_close(pxy_conn_ctx_t *ctx)
+{
+	if (ctx->plugin->ops.conn_close) {
+		ctx->plugin->ops.conn_close(ctx->plugin_conn);
+	}
+	ctx->plugin = NULL;
+	ctx->plugin_conn = NULL;
+}
+
+/* vim: set noet ft=c: */
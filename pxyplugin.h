@@ -0,0 +1,58 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PXYPLUGIN_H
+#define PXYPLUGIN_H
+
+#include "pxyconn.h"
+#include "plugin.h"
+
+/*
+ * A loaded plugin.  Plugins are loaded while parsing the config, and stay
+ * loaded until exit, so that conns never outlive the code of their plugin,
+ * even across reloads.
+ */
+typedef struct pxy_plugin {
+	char *path;
+	char *arg;
+	void *handle;
+	sslproxy_plugin_t ops;
+	struct pxy_plugin *next;
+} pxy_plugin_t;
+
+pxy_plugin_t *pxy_plugin_load(const char *, const char *) NONNULL(1) WUNRES;
+void pxy_plugin_freeze(void);
+void pxy_plugin_fini(void);
+
+int pxy_plugin_engage(pxy_conn_ctx_t *) NONNULL(1) WUNRES;
+void pxy_plugin_close(pxy_conn_ctx_t *) NONNULL(1);
+
+#endif /* !PXYPLUGIN_H */
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,305 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pxyplugin.h"
+#include "pxythrmgr.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+
+#include <check.h>
+
+#define PLUGIN "extra/plugin/example-plugin.so"
+
+static void
+pxyplugin_teardown(void)
+{
+	pxy_plugin_fini();
+}
+
+START_TEST(pxy_plugin_load_01)
+{
+	pxy_plugin_t *p1, *p2, *p3;
+
+	p1 = pxy_plugin_load(PLUGIN, NULL);
+	fail_unless(!!p1, "load failed");
+	fail_unless(!strcmp(p1->ops.name, "example"), "wrong name");
+	fail_unless(!!p1->ops.conn_open && !!p1->ops.conn_data &&
+	            !!p1->ops.conn_close && !!p1->ops.fini, "callbacks not set");
+	fail_unless(p1->ops.abi == SSLPROXY_PLUGIN_ABI, "abi changed");
+	p2 = pxy_plugin_load(PLUGIN, NULL);
+	fail_unless(p1 == p2, "plugin loaded twice");
+	p3 = pxy_plugin_load(PLUGIN, "verbose");
+	fail_unless(!!p3, "load with arg failed");
+	fail_unless(p3 != p1, "arg ignored");
+	fail_unless(!strcmp(p3->arg, "verbose"), "wrong arg");
+	fail_unless(pxy_plugin_load(PLUGIN, "verbose") == p3, "plugin with arg loaded twice");
+}
+END_TEST
+
+START_TEST(pxy_plugin_load_02)
+{
+	fail_unless(!pxy_plugin_load(PLUGIN, "no_such_arg"), "init failure not detected");
+	fail_unless(!pxy_plugin_load("extra/plugin/no-such-plugin.so", NULL), "missing plugin loaded");
+	fail_unless(!pxy_plugin_load("extra/engine/dummy-engine.so", NULL), "non-plugin loaded");
+}
+END_TEST
+
+START_TEST(pxy_plugin_load_03)
+{
+	pxy_plugin_t *p1;
+
+	p1 = pxy_plugin_load(PLUGIN, NULL);
+	fail_unless(!!p1, "load failed");
+	pxy_plugin_freeze();
+	fail_unless(pxy_plugin_load(PLUGIN, NULL) == p1, "loaded plugin not reused");
+	fail_unless(!pxy_plugin_load(PLUGIN, "verbose"), "plugin loaded after freeze");
+}
+END_TEST
+
+/*
+ * Stub plugin which upper-cases the requests and relays the responses as is.
+ */
+typedef struct stub {
+	int refuse;
+	int opened;
+	int closed;
+	unsigned long long id;
+	int thridx;
+	const char *proto;
+	size_t reqbytes;
+	size_t respbytes;
+} stub_t;
+
+static stub_t stub;
+
+static int
+stub_conn_open(void *arg, const sslproxy_plugin_conn_t *c, void **connarg)
+{
+	stub_t *st = arg;
+
+	st->opened++;
+	st->id = c->id;
+	st->thridx = c->thridx;
+	st->proto = c->proto;
+	*connarg = st;
+	return st->refuse ? -1 : 0;
+}
+
+static int
+stub_conn_data(void *connarg, int req, struct evbuffer *in, struct evbuffer *out)
+{
+	stub_t *st = connarg;
+	size_t len = evbuffer_get_length(in);
+	unsigned char *p;
+
+	if (!req) {
+		st->respbytes += len;
+		evbuffer_add_buffer(out, in);
+		return 0;
+	}
+	st->reqbytes += len;
+	p = evbuffer_pullup(in, len);
+	for (size_t i = 0; i < len; i++)
+		p[i] = toupper(p[i]);
+	evbuffer_add_buffer(out, in);
+	return 0;
+}
+
+static void
+stub_conn_close(void *connarg)
+{
+	((stub_t *)connarg)->closed++;
+}
+
+static void
+stub_writecb(UNUSED struct bufferevent *bev, UNUSED void *arg)
+{
+}
+
+static global_t global;
+static opts_t opts;
+static proxyspec_t spec;
+static pxy_plugin_t plugin;
+static proto_ctx_t protoctx;
+static pxy_thr_ctx_t thr;
+static pxy_conn_ctx_t conn;
+static int sv[2], dv[2];
+
+static void
+pxyplugin_relay_setup(void)
+{
+	memset(&stub, 0, sizeof(stub));
+	memset(&global, 0, sizeof(global));
+	memset(&opts, 0, sizeof(opts));
+	memset(&spec, 0, sizeof(spec));
+	memset(&plugin, 0, sizeof(plugin));
+	memset(&protoctx, 0, sizeof(protoctx));
+	memset(&thr, 0, sizeof(thr));
+	memset(&conn, 0, sizeof(conn));
+
+	plugin.ops.abi = SSLPROXY_PLUGIN_ABI;
+	plugin.ops.name = "stub";
+	plugin.ops.arg = &stub;
+	plugin.ops.conn_open = stub_conn_open;
+	plugin.ops.conn_data = stub_conn_data;
+	plugin.ops.conn_close = stub_conn_close;
+	opts.plugin = &plugin;
+	spec.opts = &opts;
+	protoctx.bev_writecb = stub_writecb;
+	thr.thridx = 3;
+	thr.evbase = event_base_new();
+	fail_unless(!!thr.evbase, "failed to create evbase");
+
+	conn.id = 42;
+	conn.conn = &conn;
+	conn.global = &global;
+	conn.spec = &spec;
+	conn.thr = &thr;
+	conn.protoctx = &protoctx;
+	conn.proto = PROTO_TCP;
+	conn.connected = 1;
+	conn.outbuf_limit = 65536;
+
+	// The client and the server ends of the conn are the other sides of the pairs
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0, "socketpair failed");
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, dv) == 0, "socketpair failed");
+	conn.src.bev = bufferevent_socket_new(thr.evbase, sv[0], BEV_OPT_CLOSE_ON_FREE);
+	conn.srvdst.bev = bufferevent_socket_new(thr.evbase, dv[0], BEV_OPT_CLOSE_ON_FREE);
+	fail_unless(conn.src.bev && conn.srvdst.bev, "failed to create bevs");
+	bufferevent_setcb(conn.src.bev, pxy_bev_readcb, pxy_bev_writecb, NULL, &conn);
+	bufferevent_enable(conn.src.bev, EV_READ|EV_WRITE);
+}
+
+static void
+pxyplugin_relay_teardown(void)
+{
+	bufferevent_free(conn.src.bev);
+	// srvdst is the dst once the plugin is engaged
+	bufferevent_free(conn.srvdst.bev);
+	close(sv[1]);
+	close(dv[1]);
+	event_base_free(thr.evbase);
+}
+
+/*
+ * Run the event loop until len bytes have arrived on fd, returns the number
+ * of bytes read into buf.
+ */
+static size_t
+pxyplugin_relay_recv(int fd, char *buf, size_t len)
+{
+	size_t got = 0;
+	ssize_t n;
+
+	for (int i = 0; i < 1000 && got < len; i++) {
+		event_base_loop(thr.evbase, EVLOOP_NONBLOCK);
+		n = recv(fd, buf + got, len - got, MSG_DONTWAIT);
+		if (n > 0)
+			got += n;
+		else
+			usleep(1000);
+	}
+	return got;
+}
+
+START_TEST(pxy_plugin_relay_01)
+{
+	char buf[64];
+
+	fail_unless(pxy_plugin_engage(&conn) == 0, "engage failed");
+	fail_unless(stub.opened == 1, "conn_open not called");
+	fail_unless(stub.id == 42 && stub.thridx == 3, "wrong conn info");
+	fail_unless(!strcmp(stub.proto, "tcp"), "wrong proto");
+	fail_unless(conn.plugin == &plugin && conn.plugin_conn == &stub, "plugin not set");
+	fail_unless(conn.dst.bev == conn.srvdst.bev && conn.srvdst_xferred, "srvdst not the dst");
+
+	// Requests pass through the plugin, which modifies them
+	fail_unless(write(sv[1], "hello, server", 13) == 13, "write failed");
+	fail_unless(pxyplugin_relay_recv(dv[1], buf, 13) == 13, "request not relayed");
+	fail_unless(!memcmp(buf, "HELLO, SERVER", 13), "request not modified");
+
+	// Responses are relayed as the plugin returns them
+	fail_unless(write(dv[1], "hello, client", 13) == 13, "write failed");
+	fail_unless(pxyplugin_relay_recv(sv[1], buf, 13) == 13, "response not relayed");
+	fail_unless(!memcmp(buf, "hello, client", 13), "response modified");
+
+	fail_unless(stub.reqbytes == 13 && stub.respbytes == 13, "wrong byte counts");
+	fail_unless(conn.thr->intif_in_bytes == 13 && conn.thr->intif_out_bytes == 13,
+	            "wrong thread stats");
+	fail_unless(!conn.term, "conn terminated");
+
+	pxy_plugin_close(&conn);
+	fail_unless(stub.closed == 1, "conn_close not called");
+	fail_unless(!conn.plugin && !conn.plugin_conn, "plugin not cleared");
+}
+END_TEST
+
+START_TEST(pxy_plugin_relay_02)
+{
+	stub.refuse = 1;
+	fail_unless(pxy_plugin_engage(&conn) == -1, "refused conn engaged");
+	fail_unless(stub.opened == 1, "conn_open not called");
+	fail_unless(conn.term && conn.term_requestor, "refused conn not terminated");
+	fail_unless(!conn.plugin && !conn.srvdst_xferred, "refused conn relayed");
+	fail_unless(!stub.closed, "conn_close called for refused conn");
+}
+END_TEST
+
+Suite *
+pxyplugin_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+	s = suite_create("pxyplugin");
+
+	tc = tcase_create("pxy_plugin_load");
+	tcase_add_checked_fixture(tc, NULL, pxyplugin_teardown);
+	tcase_add_test(tc, pxy_plugin_load_01);
+	tcase_add_test(tc, pxy_plugin_load_02);
+	tcase_add_test(tc, pxy_plugin_load_03);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("pxy_plugin_relay");
+	tcase_add_checked_fixture(tc, pxyplugin_relay_setup, pxyplugin_relay_teardown);
+	tcase_add_test(tc, pxy_plugin_relay_01);
+	tcase_add_test(tc, pxy_plugin_relay_02);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
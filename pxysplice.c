@@ -0,0 +1,419 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pxysplice.h"
+
+#ifdef HAVE_SPLICE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <event2/event.h>
+
+/*
+ * Zero-copy relay for connections whose payload user space never needs to
+ * see, i.e. passthrough connections without content logging.  Instead of
+ * reading into and writing out of evbuffers, each direction moves data from
+ * the input socket into a pipe and from the pipe into the output socket with
+ * splice(2), so the payload never leaves the kernel.
+ *
+ * The pipe plays the role of the output evbuffer of the bufferevent path:
+ * when it holds the output buffer limit of the conn, or the kernel refuses to
+ * take more, we stop reading from the input socket, and resume once it is
+ * half empty again, just like pxy_try_set_watermark() and
+ * pxy_try_unset_watermark().
+ *
+ * Any data the bufferevents have already read or queued before the relay
+ * engages is flushed first, so the byte stream is never reordered.
+ */
+
+typedef struct pxy_splice pxy_splice_t;
+
+typedef struct pxy_splice_dir {
+	pxy_splice_t *splice;
+	evutil_socket_t in;
+	evutil_socket_t out;
+	int pipe[2];
+	// Bytes currently sitting in the pipe, and the pipe capacity
+	size_t piped;
+	size_t limit;
+	// Bytes already read by the bufferevents before we engaged
+	struct evbuffer *pending;
+	struct event *rev;
+	struct event *wev;
+	// Byte counters of this direction
+	long long unsigned int in_bytes;
+	long long unsigned int out_bytes;
+	unsigned int eof : 1;
+	unsigned int full : 1;
+	unsigned int throttled : 1;
+	unsigned int is_up : 1;
+} pxy_splice_dir_t;
+
+struct pxy_splice {
+	pxy_conn_ctx_t *ctx;
+	// src to srvdst
+	pxy_splice_dir_t up;
+	// srvdst to src
+	pxy_splice_dir_t down;
+};
+
+static void pxy_splice_readcb(evutil_socket_t, short, void *);
+static void pxy_splice_writecb(evutil_socket_t, short, void *);
+
+/*
+ * Passthrough connections without content logging never need their payload
+ * in user space.  User auth needs the bufferevent path to send the login
+ * redirect message, so those connections are not eligible.
+ */
+int
+pxy_splice_eligible(pxy_conn_ctx_t *ctx)
+{
+	return ctx->global->splice && !WANT_CONTENT_LOG(ctx) &&
+	       !(ctx->spec->opts->user_auth && !ctx->user) &&
+	       ctx->srvdst.bev && !ctx->srvdst.ssl && !ctx->src.bev;
+}
+
+static void NONNULL(1)
+pxy_splice_dir_free(pxy_splice_dir_t *d)
+{
+	if (d->rev) {
+		event_free(d->rev);
+		d->rev = NULL;
+	}
+	if (d->wev) {
+		event_free(d->wev);
+		d->wev = NULL;
+	}
+	if (d->pipe[0] != -1) {
+		close(d->pipe[0]);
+		d->pipe[0] = -1;
+	}
+	if (d->pipe[1] != -1) {
+		close(d->pipe[1]);
+		d->pipe[1] = -1;
+	}
+	if (d->pending) {
+		evbuffer_free(d->pending);
+		d->pending = NULL;
+	}
+}
+
+static int NONNULL(1,2)
+pxy_splice_dir_init(pxy_splice_dir_t *d, pxy_splice_t *splice,
+                    evutil_socket_t in, evutil_socket_t out, int is_up)
+{
+	d->splice = splice;
+	d->in = in;
+	d->out = out;
+	d->is_up = is_up;
+	d->pipe[0] = -1;
+	d->pipe[1] = -1;
+
+	if (pipe2(d->pipe, O_NONBLOCK|O_CLOEXEC) == -1) {
+		log_err_level_printf(LOG_WARNING, "Cannot create splice pipe: %s (%i)\n", strerror(errno), errno);
+		return -1;
+	}
+
+	// Try to make the pipe as large as the output evbuffer limit, but the default size works too
+	int sz = fcntl(d->pipe[1], F_SETPIPE_SZ, splice->ctx->outbuf_limit);
+	if (sz == -1) {
+		sz = fcntl(d->pipe[1], F_GETPIPE_SZ);
+	}
+	d->limit = (sz > 0) ? (size_t)sz : 65536;
+
+	d->pending = evbuffer_new();
+	d->rev = event_new(splice->ctx->evbase, in, EV_READ|EV_PERSIST, pxy_splice_readcb, d);
+	d->wev = event_new(splice->ctx->evbase, out, EV_WRITE|EV_PERSIST, pxy_splice_writecb, d);
+	if (!d->pending || !d->rev || !d->wev) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Move bytes from the input socket into the pipe, at most one splice() per
+ * read event to keep the event loop fair among connections.
+ * Returns -1 on fatal error.
+ */
+static int NONNULL(1)
+pxy_splice_fill(pxy_splice_dir_t *d)
+{
+	if (d->piped >= d->limit) {
+		d->full = 1;
+		return 0;
+	}
+
+	ssize_t n = splice(d->in, NULL, d->pipe[1], NULL, d->limit - d->piped, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+	if (n > 0) {
+		d->piped += n;
+		d->in_bytes += n;
+		if (d->is_up) {
+			d->splice->ctx->thr->intif_in_bytes += n;
+		} else {
+			d->splice->ctx->thr->extif_in_bytes += n;
+		}
+	} else if (n == 0) {
+		d->eof = 1;
+	} else if (errno == EAGAIN) {
+		// The input was readable, so the pipe must have run out of buffer slots
+		if (d->piped) {
+			d->full = 1;
+		}
+	} else if (errno != EINTR) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Write out any pending evbuffer data first, then move as much as possible
+ * from the pipe into the output socket.
+ * Returns -1 on fatal error.
+ */
+static int NONNULL(1)
+pxy_splice_flush(pxy_splice_dir_t *d)
+{
+	while (evbuffer_get_length(d->pending)) {
+		int n = evbuffer_write(d->pending, d->out);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EINTR) {
+				return 0;
+			}
+			return -1;
+		}
+		d->out_bytes += n;
+		if (d->is_up) {
+			d->splice->ctx->thr->extif_out_bytes += n;
+		} else {
+			d->splice->ctx->thr->intif_out_bytes += n;
+		}
+	}
+
+	while (d->piped) {
+		ssize_t n = splice(d->pipe[0], NULL, d->out, NULL, d->piped, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			d->piped -= n;
+			d->full = 0;
+			d->out_bytes += n;
+			if (d->is_up) {
+				d->splice->ctx->thr->extif_out_bytes += n;
+			} else {
+				d->splice->ctx->thr->intif_out_bytes += n;
+			}
+		} else if (n == -1 && errno == EINTR) {
+			continue;
+		} else if (n == -1 && errno == EAGAIN) {
+			break;
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int NONNULL(1)
+pxy_splice_drained(pxy_splice_dir_t *d)
+{
+	return !d->piped && !evbuffer_get_length(d->pending);
+}
+
+/*
+ * Once EOF on one end has been relayed, and nothing is left to write to
+ * that end either, terminate the conn, as the bufferevent path does with
+ * pxy_try_close_conn_end() and pxy_try_disconnect().
+ */
+static void NONNULL(1)
+pxy_splice_try_term(pxy_splice_t *splice)
+{
+	if (!pxy_splice_drained(&splice->up) || !pxy_splice_drained(&splice->down)) {
+		return;
+	}
+	if (splice->up.eof || splice->down.eof) {
+#ifdef DEBUG_PROXY
+		log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_splice_try_term: EOF on %s relayed, terminate conn, fd=%d\n",
+				splice->up.eof ? "src" : "srvdst", splice->ctx->fd);
+#endif /* DEBUG_PROXY */
+		pxy_conn_term(splice->ctx, splice->up.eof);
+	}
+}
+
+/*
+ * Rearm the read and write events according to the pipe fill level.
+ */
+static void NONNULL(1)
+pxy_splice_update(pxy_splice_dir_t *d)
+{
+	pxy_conn_ctx_t *ctx = d->splice->ctx;
+	if (pxy_splice_drained(d)) {
+		event_del(d->wev);
+	} else {
+		event_add(d->wev, NULL);
+	}
+
+	if (d->eof) {
+		event_del(d->rev);
+		return;
+	}
+
+	if (!d->throttled && (d->full || d->piped >= d->limit)) {
+#ifdef DEBUG_PROXY
+		log_dbg_level_printf(LOG_DBG_MODE_FINE, "pxy_splice_update: Throttle %s, piped=%zu, fd=%d\n", d->is_up ? "src" : "srvdst", d->piped, ctx->fd);
+#endif /* DEBUG_PROXY */
+		event_del(d->rev);
+		d->throttled = 1;
+		ctx->thr->set_watermarks++;
+	} else if (d->throttled && !d->full && d->piped <= d->limit / 2) {
+#ifdef DEBUG_PROXY
+		log_dbg_level_printf(LOG_DBG_MODE_FINE, "pxy_splice_update: Unthrottle %s, piped=%zu, fd=%d\n", d->is_up ? "src" : "srvdst", d->piped, ctx->fd);
+#endif /* DEBUG_PROXY */
+		event_add(d->rev, NULL);
+		d->throttled = 0;
+		ctx->thr->unset_watermarks++;
+	}
+}
+
+static void NONNULL(1)
+pxy_splice_postexec(pxy_splice_dir_t *d, int rv)
+{
+	pxy_conn_ctx_t *ctx = d->splice->ctx;
+
+	if (rv == -1) {
+		log_err_level_printf(LOG_WARNING, "Splice relay error on %s: %s (%i)\n", d->is_up ? "src" : "srvdst", strerror(errno), errno);
+		ctx->thr->errors++;
+		pxy_conn_term(ctx, d->is_up);
+	} else {
+		pxy_splice_update(d);
+		pxy_splice_try_term(d->splice);
+	}
+
+	if (ctx->term || ctx->enomem) {
+		pxy_conn_free(ctx, ctx->term ? ctx->term_requestor : d->is_up);
+	}
+}
+
+static void
+pxy_splice_readcb(UNUSED evutil_socket_t fd, UNUSED short what, void *arg)
+{
+	pxy_splice_dir_t *d = arg;
+	int rv;
+
+	d->splice->ctx->atime = time(NULL);
+
+	rv = pxy_splice_fill(d);
+	if (rv == 0) {
+		rv = pxy_splice_flush(d);
+	}
+	pxy_splice_postexec(d, rv);
+}
+
+static void
+pxy_splice_writecb(UNUSED evutil_socket_t fd, UNUSED short what, void *arg)
+{
+	pxy_splice_dir_t *d = arg;
+
+	d->splice->ctx->atime = time(NULL);
+	pxy_splice_postexec(d, pxy_splice_flush(d));
+}
+
+/*
+ * Switch an eligible connection from the bufferevent path to the splice
+ * relay.  Called once srvdst is connected, before src bufferevent is set up.
+ * srvdst bufferevent keeps owning its fd, but is disabled for good.
+ * Returns -1 if the relay cannot be set up, in which case the caller should
+ * fall back to the bufferevent path.
+ */
+int
+pxy_splice_engage(pxy_conn_ctx_t *ctx)
+{
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_splice_engage: ENTER, fd=%d\n", ctx->fd);
+#endif /* DEBUG_PROXY */
+
+	evutil_socket_t srvdst_fd = bufferevent_getfd(ctx->srvdst.bev);
+
+	pxy_splice_t *splice = malloc(sizeof(pxy_splice_t));
+	if (!splice) {
+		return -1;
+	}
+	memset(splice, 0, sizeof(pxy_splice_t));
+	splice->ctx = ctx;
+
+	if (pxy_splice_dir_init(&splice->up, splice, ctx->fd, srvdst_fd, 1) == -1 ||
+		pxy_splice_dir_init(&splice->down, splice, srvdst_fd, ctx->fd, 0) == -1) {
+		pxy_splice_dir_free(&splice->up);
+		pxy_splice_dir_free(&splice->down);
+		free(splice);
+		return -1;
+	}
+
+	// From this point on the bufferevent of srvdst is only a holder of its fd
+	bufferevent_disable(ctx->srvdst.bev, EV_READ|EV_WRITE);
+	bufferevent_setcb(ctx->srvdst.bev, NULL, NULL, NULL, NULL);
+
+	struct evbuffer *inbuf = bufferevent_get_input(ctx->srvdst.bev);
+	ctx->thr->extif_in_bytes += evbuffer_get_length(inbuf);
+	evbuffer_add_buffer(splice->down.pending, inbuf);
+	evbuffer_add_buffer(splice->up.pending, bufferevent_get_output(ctx->srvdst.bev));
+
+	ctx->splice = splice;
+
+	event_add(splice->up.rev, NULL);
+	event_add(splice->down.rev, NULL);
+	pxy_splice_update(&splice->up);
+	pxy_splice_update(&splice->down);
+
+	if (OPTS_DEBUG(ctx->global)) {
+		log_dbg_printf("SPLICE relay engaged, pipe=%zu/%zu, fd=%d\n", splice->up.limit, splice->down.limit, ctx->fd);
+	}
+	return 0;
+}
+
+void
+pxy_splice_free(pxy_conn_ctx_t *ctx)
+{
+	pxy_splice_t *splice = ctx->splice;
+
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINER, "pxy_splice_free: up=%llu/%llu, down=%llu/%llu, fd=%d\n",
+			splice->up.in_bytes, splice->up.out_bytes, splice->down.in_bytes, splice->down.out_bytes, ctx->fd);
+#endif /* DEBUG_PROXY */
+
+	pxy_splice_dir_free(&splice->up);
+	pxy_splice_dir_free(&splice->down);
+	free(splice);
+	ctx->splice = NULL;
+}
+
+#endif /* HAVE_SPLICE */
+
+/* vim: set noet ft=c: */
@@ -0,0 +1,441 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pxystats.h"
+
+#include "cache.h"
+#include "cachemgr.h"
+#include "log.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <event2/bufferevent.h>
+#include <event2/listener.h>
+
+/*
+ * Stats socket: a local AF_UNIX socket serving the conn setup phase latency
+ * histograms, src SSL setup stage counts, cache hit and miss counts, and
+ * queue depths of the threads, in the Prometheus text exposition format.
+ * Clients sending an HTTP GET request get an HTTP response, e.g. curl
+ * --unix-socket, other clients get the plain text after closing their write
+ * side or after a short wait, e.g. socat.
+ *
+ * The socket is served by the main thread, which reads the per-thread
+ * histograms without locking, see histo.h.
+ */
+
+/* seconds to wait for a request before sending the plain text */
+#define PXY_STATS_TIMEOUT 1
+/* max size of a request */
+#define PXY_STATS_REQMAX 8192
+/* histogram buckets exposed, powers of two in usec */
+#define PXY_STATS_MINEXP 4
+#define PXY_STATS_MAXEXP 25
+
+struct pxy_stats {
+	pxy_thrmgr_ctx_t *thrmgr;
+	struct evconnlistener *evcl;
+	char *path;
+};
+
+typedef struct pxy_stats_client {
+	pxy_thrmgr_ctx_t *thrmgr;
+	struct bufferevent *bev;
+} pxy_stats_client_t;
+
+static const double pxy_stats_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+static int
+pxy_stats_print_phases(pxy_thrmgr_ctx_t *thrmgr, struct evbuffer *out)
+{
+	histo_t *h;
+
+	if (!(h = calloc(PXY_PHASE_MAX, sizeof(histo_t))))
+		return -1;
+	for (int i = 0; i < thrmgr->num_thr; i++) {
+		for (int p = 0; p < PXY_PHASE_MAX; p++) {
+			histo_merge(&h[p], &thrmgr->thr[i]->phase_histo[p]);
+		}
+	}
+
+	evbuffer_add_printf(out,
+		"# HELP sslproxy_phase_duration_seconds Conn setup phase latencies.\n"
+		"# TYPE sslproxy_phase_duration_seconds histogram\n");
+	for (int p = 0; p < PXY_PHASE_MAX; p++) {
+		for (int e = PXY_STATS_MINEXP; e <= PXY_STATS_MAXEXP; e++) {
+			// Timestamps are truncated to usec, so a value below 2^e usec is a duration below 2^e usec
+			evbuffer_add_printf(out, "sslproxy_phase_duration_seconds_bucket{phase=\"%s\",le=\"%.6f\"} %llu\n",
+				pxy_phase_names[p], (double)((uint64_t)1 << e) / 1000000,
+				(long long unsigned int)histo_count_below(&h[p], (uint64_t)1 << e));
+		}
+		evbuffer_add_printf(out, "sslproxy_phase_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n"
+			"sslproxy_phase_duration_seconds_sum{phase=\"%s\"} %.6f\n"
+			"sslproxy_phase_duration_seconds_count{phase=\"%s\"} %llu\n",
+			pxy_phase_names[p], (long long unsigned int)h[p].total,
+			pxy_phase_names[p], (double)h[p].sum / 1000000,
+			pxy_phase_names[p], (long long unsigned int)h[p].total);
+	}
+
+	evbuffer_add_printf(out,
+		"# HELP sslproxy_phase_duration_quantile_seconds Conn setup phase latency quantiles, at the resolution of the histograms.\n"
+		"# TYPE sslproxy_phase_duration_quantile_seconds gauge\n");
+	for (int p = 0; p < PXY_PHASE_MAX; p++) {
+		for (size_t q = 0; q < sizeof(pxy_stats_quantiles) / sizeof(pxy_stats_quantiles[0]); q++) {
+			evbuffer_add_printf(out, "sslproxy_phase_duration_quantile_seconds{phase=\"%s\",quantile=\"%g\"} %.6f\n",
+				pxy_phase_names[p], pxy_stats_quantiles[q],
+				(double)histo_quantile(&h[p], pxy_stats_quantiles[q]) / 1000000);
+		}
+	}
+	free(h);
+	return 0;
+}
+
+static void
+pxy_stats_print_srcssl_stages(pxy_thrmgr_ctx_t *thrmgr, struct evbuffer *out)
+{
+	evbuffer_add_printf(out,
+		"# HELP sslproxy_srcssl_stage_total SSL conns reaching each stage of the client side SSL setup.\n"
+		"# TYPE sslproxy_srcssl_stage_total counter\n");
+	for (int s = 0; s < PXY_SRCSSL_MAX; s++) {
+		size_t count = 0;
+		for (int i = 0; i < thrmgr->num_thr; i++) {
+			// Written by the thread without locking, an approximate value is fine
+			count += __atomic_load_n(&thrmgr->thr[i]->srcssl_stages[s], __ATOMIC_RELAXED);
+		}
+		evbuffer_add_printf(out, "sslproxy_srcssl_stage_total{stage=\"%s\"} %zu\n", pxy_srcssl_stage_names[s], count);
+	}
+}
+
+static void
+pxy_stats_print_caches(struct evbuffer *out)
+{
+	struct {
+		const char *name;
+		cache_t *cache;
+	} caches[] = {
+		{ "fkcrt", cachemgr_fkcrt },
+		{ "ssess", cachemgr_ssess },
+		{ "dsess", cachemgr_dsess },
+		{ "snicrt", cachemgr_snicrt },
+	};
+	unsigned long long hits[sizeof(caches) / sizeof(caches[0])];
+	unsigned long long misses[sizeof(caches) / sizeof(caches[0])];
+
+	for (size_t i = 0; i < sizeof(caches) / sizeof(caches[0]); i++) {
+		hits[i] = misses[i] = 0;
+		if (caches[i].cache) {
+			cache_stats(caches[i].cache, &hits[i], &misses[i]);
+		}
+	}
+
+	evbuffer_add_printf(out,
+		"# HELP sslproxy_cache_hits_total Cache lookups finding an entry.\n"
+		"# TYPE sslproxy_cache_hits_total counter\n");
+	for (size_t i = 0; i < sizeof(caches) / sizeof(caches[0]); i++) {
+		evbuffer_add_printf(out, "sslproxy_cache_hits_total{cache=\"%s\"} %llu\n", caches[i].name, hits[i]);
+	}
+	evbuffer_add_printf(out,
+		"# HELP sslproxy_cache_misses_total Cache lookups not finding an entry.\n"
+		"# TYPE sslproxy_cache_misses_total counter\n");
+	for (size_t i = 0; i < sizeof(caches) / sizeof(caches[0]); i++) {
+		evbuffer_add_printf(out, "sslproxy_cache_misses_total{cache=\"%s\"} %llu\n", caches[i].name, misses[i]);
+	}
+}
+
+static void
+pxy_stats_print_threads(pxy_thrmgr_ctx_t *thrmgr, struct evbuffer *out)
+{
+	static const char *names[] = {
+		"sslproxy_thread_conns", "Conns handled by the thread.",
+		"sslproxy_thread_pending_ssl_conns", "SSL conns waiting for the ClientHello.",
+		"sslproxy_thread_handoff_queue", "Accepted conns waiting for the thread to set them up.",
+		"sslproxy_thread_buffered_bytes", "Bytes in the output buffers of the conns of the thread.",
+	};
+	size_t vals[4];
+
+	for (size_t n = 0; n < 4; n++) {
+		evbuffer_add_printf(out, "# HELP %s %s\n# TYPE %s gauge\n", names[2 * n], names[2 * n + 1], names[2 * n]);
+		for (int i = 0; i < thrmgr->num_thr; i++) {
+			pxy_thr_ctx_t *tctx = thrmgr->thr[i];
+
+			pthread_mutex_lock(&tctx->mutex);
+			vals[0] = tctx->load;
+			vals[1] = tctx->pending_ssl_conn_count;
+			pthread_mutex_unlock(&tctx->mutex);
+			pthread_mutex_lock(&tctx->handoff_mutex);
+			vals[2] = tctx->handoff_count;
+			pthread_mutex_unlock(&tctx->handoff_mutex);
+			// Written by the thread without locking, an approximate value is fine
+			vals[3] = __atomic_load_n(&tctx->buffered, __ATOMIC_RELAXED);
+
+			evbuffer_add_printf(out, "%s{thread=\"%d\"} %zu\n", names[2 * n], i, vals[n]);
+		}
+	}
+
+#ifdef HAVE_LOCAL_PROCINFO
+	if (thrmgr->global->lprocinfo) {
+		size_t count;
+
+		pthread_mutex_lock(&thrmgr->lproc_mutex);
+		count = thrmgr->lproc_count;
+		pthread_mutex_unlock(&thrmgr->lproc_mutex);
+		evbuffer_add_printf(out,
+			"# HELP sslproxy_lproc_queue Conns waiting for the local process lookup.\n"
+			"# TYPE sslproxy_lproc_queue gauge\n"
+			"sslproxy_lproc_queue %zu\n", count);
+	}
+#endif /* HAVE_LOCAL_PROCINFO */
+}
+
+/*
+ * Print the stats in the Prometheus text exposition format to out.
+ * Must be called on the main thread, after starting the thread manager.
+ * Returns -1 on failure, 0 on success.
+ */
+int
+pxy_stats_print(pxy_thrmgr_ctx_t *thrmgr, struct evbuffer *out)
+{
+	// conn_count is updated by the listeners, which run on the main thread
+	evbuffer_add_printf(out,
+		"# HELP sslproxy_conns_total Conns accepted.\n"
+		"# TYPE sslproxy_conns_total counter\n"
+		"sslproxy_conns_total %llu\n", thrmgr->conn_count);
+
+	if (thrmgr->thr) {
+		if (pxy_stats_print_phases(thrmgr, out) == -1)
+			return -1;
+		pxy_stats_print_srcssl_stages(thrmgr, out);
+		pxy_stats_print_threads(thrmgr, out);
+	}
+	pxy_stats_print_caches(out);
+	return 0;
+}
+
+static void
+pxy_stats_client_free(pxy_stats_client_t *client)
+{
+	bufferevent_free(client->bev);
+	free(client);
+}
+
+static void
+pxy_stats_client_writecb(UNUSED struct bufferevent *bev, void *arg)
+{
+	pxy_stats_client_free(arg);
+}
+
+/*
+ * The client has gone away, or has not read the response in time.
+ */
+static void
+pxy_stats_client_write_eventcb(UNUSED struct bufferevent *bev, UNUSED short events, void *arg)
+{
+	pxy_stats_client_free(arg);
+}
+
+static void
+pxy_stats_client_respond(pxy_stats_client_t *client, int http)
+{
+	struct evbuffer *out = bufferevent_get_output(client->bev);
+	struct evbuffer *body;
+	struct timeval timeout = {PXY_STATS_TIMEOUT, 0};
+
+	bufferevent_disable(client->bev, EV_READ);
+	bufferevent_setcb(client->bev, NULL, pxy_stats_client_writecb, pxy_stats_client_write_eventcb, client);
+	bufferevent_set_timeouts(client->bev, NULL, &timeout);
+
+	if (!(body = evbuffer_new()) || pxy_stats_print(client->thrmgr, body) == -1) {
+		log_err_level_printf(LOG_WARNING, "Error printing stats\n");
+		if (body)
+			evbuffer_free(body);
+		pxy_stats_client_free(client);
+		return;
+	}
+	if (http) {
+		evbuffer_add_printf(out, "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n\r\n", evbuffer_get_length(body));
+	}
+	evbuffer_add_buffer(out, body);
+	evbuffer_free(body);
+	bufferevent_enable(client->bev, EV_WRITE);
+}
+
+static void
+pxy_stats_client_readcb(struct bufferevent *bev, void *arg)
+{
+	pxy_stats_client_t *client = arg;
+	struct evbuffer *in = bufferevent_get_input(bev);
+	size_t len = evbuffer_get_length(in);
+	unsigned char method[4];
+
+	if (len < sizeof(method))
+		return;
+	evbuffer_copyout(in, method, sizeof(method));
+	if (memcmp(method, "GET ", sizeof(method))) {
+		evbuffer_drain(in, len);
+		pxy_stats_client_respond(client, 0);
+		return;
+	}
+	// Read the whole request, so that closing the socket does not reset it
+	if (evbuffer_search(in, "\r\n\r\n", 4, NULL).pos == -1) {
+		if (len > PXY_STATS_REQMAX) {
+			pxy_stats_client_free(client);
+		}
+		return;
+	}
+	evbuffer_drain(in, len);
+	pxy_stats_client_respond(client, 1);
+}
+
+static void
+pxy_stats_client_eventcb(UNUSED struct bufferevent *bev, short events, void *arg)
+{
+	pxy_stats_client_t *client = arg;
+
+	// Clients not sending a request get the plain text
+	if ((events & BEV_EVENT_EOF) || (events & BEV_EVENT_TIMEOUT)) {
+		pxy_stats_client_respond(client, 0);
+		return;
+	}
+	pxy_stats_client_free(client);
+}
+
+static void
+pxy_stats_acceptcb(struct evconnlistener *listener, evutil_socket_t fd,
+                   UNUSED struct sockaddr *peeraddr, UNUSED int peeraddrlen,
+                   void *arg)
+{
+	pxy_stats_t *ctx = arg;
+	pxy_stats_client_t *client;
+	struct timeval timeout = {PXY_STATS_TIMEOUT, 0};
+
+	if (!(client = malloc(sizeof(pxy_stats_client_t)))) {
+		evutil_closesocket(fd);
+		return;
+	}
+	client->thrmgr = ctx->thrmgr;
+	client->bev = bufferevent_socket_new(evconnlistener_get_base(listener), fd, BEV_OPT_CLOSE_ON_FREE);
+	if (!client->bev) {
+		evutil_closesocket(fd);
+		free(client);
+		return;
+	}
+	bufferevent_setcb(client->bev, pxy_stats_client_readcb, NULL, pxy_stats_client_eventcb, client);
+	bufferevent_set_timeouts(client->bev, &timeout, NULL);
+	bufferevent_enable(client->bev, EV_READ);
+}
+
+/*
+ * Open the stats socket at path and serve it on evbase.  Must be called before
+ * dropping privileges; a stale socket at path is replaced, and the socket is
+ * accessible to the user running sslproxy only.
+ * Returns NULL on failure.
+ */
+pxy_stats_t *
+pxy_stats_new(struct event_base *evbase, pxy_thrmgr_ctx_t *thrmgr, const char *path)
+{
+	pxy_stats_t *ctx;
+	struct sockaddr_un sun;
+	struct stat st;
+	evutil_socket_t fd;
+	mode_t mask;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		log_err_level_printf(LOG_CRIT, "Stats socket path too long: %s\n", path);
+		return NULL;
+	}
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+
+	if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+		unlink(path);
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		log_err_level_printf(LOG_CRIT, "Error creating stats socket: %s (%i)\n", strerror(errno), errno);
+		return NULL;
+	}
+	if (evutil_make_socket_nonblocking(fd) == -1) {
+		log_err_level_printf(LOG_CRIT, "Error making stats socket nonblocking\n");
+		evutil_closesocket(fd);
+		return NULL;
+	}
+	mask = umask(0177);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		log_err_level_printf(LOG_CRIT, "Error binding stats socket %s: %s (%i)\n", path, strerror(errno), errno);
+		umask(mask);
+		evutil_closesocket(fd);
+		return NULL;
+	}
+	umask(mask);
+
+	if (!(ctx = malloc(sizeof(pxy_stats_t))))
+		goto err;
+	memset(ctx, 0, sizeof(pxy_stats_t));
+	ctx->thrmgr = thrmgr;
+	if (!(ctx->path = strdup(path)))
+		goto err;
+	ctx->evcl = evconnlistener_new(evbase, pxy_stats_acceptcb, ctx,
+	                               LEV_OPT_CLOSE_ON_FREE|LEV_OPT_CLOSE_ON_EXEC, 16, fd);
+	if (!ctx->evcl) {
+		log_err_level_printf(LOG_CRIT, "Error creating stats listener: %s\n", strerror(errno));
+		goto err;
+	}
+	return ctx;
+err:
+	if (ctx) {
+		if (ctx->path)
+			free(ctx->path);
+		free(ctx);
+	}
+	unlink(path);
+	evutil_closesocket(fd);
+	return NULL;
+}
+
+void
+pxy_stats_free(pxy_stats_t *ctx)
+{
+	evconnlistener_free(ctx->evcl);
+	// Fails after dropping privileges if the directory is not writable, the next start replaces the socket
+	unlink(ctx->path);
+	free(ctx->path);
+	free(ctx);
+}
+
+/* vim: set noet ft=c: */
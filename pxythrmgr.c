@@ -32,10 +32,15 @@
 #include "sys.h"
 #include "log.h"
 #include "pxyconn.h"
+#include "dnscache.h"
+#include "logz.h"
 
 #include <string.h>
 #include <event2/bufferevent.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <assert.h>
 #include <sys/param.h>
 
@@ -48,6 +53,14 @@
  * The attach and detach functions are thread-safe.
  */
 
+const char *pxy_phase_names[PXY_PHASE_MAX] = {
+	"accept", "nat", "sni", "dns", "connect", "srvtls", "cert", "clitls", "child", "firstbyte"
+};
+
+const char *pxy_srcssl_stage_names[PXY_SRCSSL_MAX] = {
+	"passsni", "names", "pass", "cert", "forge", "ctx", "optimistic", "mismatch"
+};
+
 static void
 pxy_thrmgr_get_thr_expired_conns(pxy_thr_ctx_t *tctx, pxy_conn_ctx_t **expired_conns)
 {
@@ -62,6 +75,8 @@ pxy_thrmgr_get_thr_expired_conns(pxy_thr_ctx_t *tctx, pxy_conn_ctx_t **expired_c
 			if (elapsed_time > (time_t)tctx->thrmgr->global->conn_idle_timeout) {
 				ctx->next_expired = *expired_conns;
 				*expired_conns = ctx;
+			} else if (elapsed_time >= (time_t)tctx->thrmgr->global->expired_conn_check_period) {
+				pxy_shrink_outbuf_limit(ctx);
 			}
 			ctx = ctx->next;
 		}
@@ -82,14 +97,14 @@ pxy_thrmgr_get_thr_expired_conns(pxy_thr_ctx_t *tctx, pxy_conn_ctx_t **expired_c
 #ifdef DEBUG_PROXY
 				log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_thrmgr_get_expired_conns: thr=%d, fd=%d, child_fd=%d, time=%lld, src_addr=%s:%s, dst_addr=%s:%s, user=%s, valid=%d, pc=%d\n",
 					ctx->thr->thridx, ctx->fd, ctx->child_fd, (long long)(now - ctx->atime),
-					STRORDASH(ctx->srchost_str), STRORDASH(ctx->srcport_str), STRORDASH(ctx->dsthost_str), STRORDASH(ctx->dstport_str),
+					STRORDASH(pxy_conn_srchost_str(ctx)), STRORDASH(pxy_conn_srcport_str(ctx)), STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)),
 					STRORDASH(ctx->user), ctx->protoctx->is_valid, ctx->sslctx ? ctx->sslctx->pending : 0);
 #endif /* DEBUG_PROXY */
 
 				char *msg;
 				if (asprintf(&msg, "EXPIRED: thr=%d, time=%lld, src_addr=%s:%s, dst_addr=%s:%s, user=%s, valid=%d\n", 
 						ctx->thr->thridx, (long long)(now - ctx->atime),
-						STRORDASH(ctx->srchost_str), STRORDASH(ctx->srcport_str), STRORDASH(ctx->dsthost_str), STRORDASH(ctx->dstport_str),
+						STRORDASH(pxy_conn_srchost_str(ctx)), STRORDASH(pxy_conn_srcport_str(ctx)), STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)),
 						STRORDASH(ctx->user), ctx->protoctx->is_valid) < 0) {
 					break;
 				}
@@ -158,7 +173,7 @@ pxy_thrmgr_print_thr_info(pxy_thr_ctx_t *tctx)
 				tctx->thridx, idx, ctx->fd, ctx->child_fd, ctx->dst_fd, ctx->srvdst_fd, ctx->child_src_fd, ctx->child_dst_fd,
 				ctx->src.closed, ctx->dst.closed, ctx->srvdst.closed, ctx->children ? ctx->children->src.closed : 0, ctx->children ? ctx->children->dst.closed : 0,
 				ctx->children ? 1:0, ctx->child_count, (long long)atime, (long long)ctime,
-				STRORDASH(ctx->srchost_str), STRORDASH(ctx->srcport_str), STRORDASH(ctx->dsthost_str), STRORDASH(ctx->dstport_str),
+				STRORDASH(pxy_conn_srchost_str(ctx)), STRORDASH(pxy_conn_srcport_str(ctx)), STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)),
 				STRORDASH(ctx->user), ctx->protoctx->is_valid, ctx->sslctx ? ctx->sslctx->pending : 0);
 #endif /* DEBUG_PROXY */
 
@@ -166,7 +181,7 @@ pxy_thrmgr_print_thr_info(pxy_thr_ctx_t *tctx)
 			if (atime >= (time_t)tctx->thrmgr->global->expired_conn_check_period) {
 				if (asprintf(&smsg, "IDLE: thr=%d, id=%u, ce=%d cc=%d, at=%lld ct=%lld, src_addr=%s:%s, dst_addr=%s:%s, user=%s, valid=%d, pc=%d\n",
 						tctx->thridx, idx, ctx->children ? 1:0, ctx->child_count, (long long)atime, (long long)ctime,
-						STRORDASH(ctx->srchost_str), STRORDASH(ctx->srcport_str), STRORDASH(ctx->dsthost_str), STRORDASH(ctx->dstport_str),
+						STRORDASH(pxy_conn_srchost_str(ctx)), STRORDASH(pxy_conn_srcport_str(ctx)), STRORDASH(pxy_conn_dsthost_str(ctx)), STRORDASH(pxy_conn_dstport_str(ctx)),
 						STRORDASH(ctx->user), ctx->protoctx->is_valid, ctx->sslctx ? ctx->sslctx->pending : 0) < 0) {
 					return;
 				}
@@ -207,9 +222,21 @@ pxy_thrmgr_print_thr_info(pxy_thr_ctx_t *tctx)
 		}
 	}
 
-	if (asprintf(&smsg, "STATS: thr=%d, mld=%zu, mfd=%d, mat=%lld, mct=%lld, iib=%llu, iob=%llu, eib=%llu, eob=%llu, swm=%zu, uwm=%zu, to=%zu, err=%zu, pc=%llu, si=%u\n",
+	// CPU time used by the thread since the last stats print in msec, this runs on the thread itself
+	long long unsigned int cputime = 0;
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		uint64_t now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+		cputime = (now - tctx->cputime) / 1000;
+		tctx->cputime = now;
+	}
+#endif /* CLOCK_THREAD_CPUTIME_ID */
+
+	if (asprintf(&smsg, "STATS: thr=%d, mld=%zu, mfd=%d, mat=%lld, mct=%lld, iib=%llu, iob=%llu, eib=%llu, eob=%llu, swm=%zu, uwm=%zu, to=%zu, err=%zu, pc=%llu, si=%u, cpu=%llu, buf=%zu, bw=%zu, clb=%llu, csb=%llu\n",
 			tctx->thridx, tctx->max_load, tctx->max_fd, (long long)max_atime, (long long)max_ctime, tctx->intif_in_bytes, tctx->intif_out_bytes, tctx->extif_in_bytes, tctx->extif_out_bytes,
-			tctx->set_watermarks, tctx->unset_watermarks, tctx->timedout_conns, tctx->errors, tctx->pending_ssl_conn_count, tctx->stats_id) < 0) {
+			tctx->set_watermarks, tctx->unset_watermarks, tctx->timedout_conns, tctx->errors, tctx->pending_ssl_conn_count, tctx->stats_id, cputime, tctx->buffered, tctx->budget_waits,
+			tctx->content_logged_bytes, tctx->content_skipped_bytes) < 0) {
 		return;
 	}
 
@@ -223,17 +250,38 @@ pxy_thrmgr_print_thr_info(pxy_thr_ctx_t *tctx)
 	free(smsg);
 	smsg = NULL;
 
+	// The resolver cache is shared, report it once
+	if (!tctx->thridx && (smsg = dnscache_stats())) {
+		if (log_stats(smsg) == -1) {
+			log_err_level_printf(LOG_WARNING, "Stats logging failed\n");
+		}
+		free(smsg);
+		smsg = NULL;
+	}
+
+	// So is the log compression pool
+	if (!tctx->thridx && (smsg = logz_stats())) {
+		if (log_stats(smsg) == -1) {
+			log_err_level_printf(LOG_WARNING, "Stats logging failed\n");
+		}
+		free(smsg);
+		smsg = NULL;
+	}
+
 	tctx->stats_id++;
 
 	tctx->timedout_conns = 0;
 	tctx->errors = 0;
 	tctx->set_watermarks = 0;
 	tctx->unset_watermarks = 0;
+	tctx->budget_waits = 0;
 
 	tctx->intif_in_bytes = 0;
 	tctx->intif_out_bytes = 0;
 	tctx->extif_in_bytes = 0;
 	tctx->extif_out_bytes = 0;
+	tctx->content_logged_bytes = 0;
+	tctx->content_skipped_bytes = 0;
 
 	// Reset these stats with the current values (do not reset to 0 directly, there may be active conns)
 	tctx->max_fd = max_fd;
@@ -292,6 +340,40 @@ pxy_thrmgr_timer_cb(UNUSED evutil_socket_t fd, UNUSED short what, UNUSED void *a
 	pthread_mutex_unlock(&ctx->mutex);
 }
 
+/*
+ * Wakeup callback of the conn handling thread; sets up the conns handed over
+ * by the listener thread, so that conn setup runs on the thread owning the conn.
+ */
+static void
+pxy_thrmgr_wakeup_cb(evutil_socket_t fd, UNUSED short what, void *arg)
+{
+	pxy_thr_ctx_t *ctx = arg;
+	pxy_conn_ctx_t *conn, *next;
+	char buf[64];
+
+	// Drain the pipe before taking the queue, otherwise we may miss the wakeup for a conn queued in between
+	while (read(fd, buf, sizeof(buf)) > 0);
+
+	pthread_mutex_lock(&ctx->handoff_mutex);
+	conn = ctx->handoff_conns;
+	ctx->handoff_conns = NULL;
+	ctx->handoff_conns_tail = NULL;
+	ctx->handoff_count = 0;
+	pthread_mutex_unlock(&ctx->handoff_mutex);
+
+	while (conn) {
+		next = conn->next_handoff;
+		conn->next_handoff = NULL;
+		// The listener thread does not touch the histograms, so record its phases here
+		if (conn->ts_nat) {
+			histo_add(&ctx->phase_histo[PXY_PHASE_NAT], conn->ts_nat - conn->ts_accept);
+		}
+		conn->ts_phase = pxy_thrmgr_phase_done(conn, PXY_PHASE_ACCEPT, conn->ts_accept);
+		conn->protoctx->fd_readcb(conn->fd, 0, conn);
+		conn = next;
+	}
+}
+
 /*
  * Thread entry point; runs the event loop of the event base.
  * Does not exit until the libevent loop is broken explicitly.
@@ -303,6 +385,13 @@ pxy_thrmgr_thr(void *arg)
 	struct timeval timer_delay = {ctx->thrmgr->global->expired_conn_check_period, 0};
 	struct event *ev;
 
+	// Pin the thread before its event loop runs; its evbase, dnsbase and slab are set up by the main thread,
+	// so pinning keeps the thread on its CPU, but does not place that memory on its NUMA node
+	if (ctx->cpu != -1 && sys_set_thread_cpus(pthread_self(), &ctx->cpu, 1) == -1) {
+		log_err_level_printf(LOG_WARNING, "Failed to pin thread %d to CPU %d: %s (%i)\n",
+		                     ctx->thridx, ctx->cpu, strerror(errno), errno);
+	}
+
 	ev = event_new(ctx->evbase, -1, EV_PERSIST, pxy_thrmgr_timer_cb, ctx);
 	if (!ev)
 		return NULL;
@@ -314,6 +403,176 @@ pxy_thrmgr_thr(void *arg)
 	return NULL;
 }
 
+#ifdef HAVE_LOCAL_PROCINFO
+/*
+ * Conns waiting longer than this many ms for the local process lookup are
+ * handed over without it, so that a backlog of lookups delays conn setup
+ * by a bounded time only.
+ */
+#define PXY_THRMGR_LPROC_BUDGET 200
+
+/*
+ * Local process lookup thread entry point; looks up the local processes
+ * owning the queued conns, and hands the conns over to their conn handling
+ * threads.  Lookups may need to scan the process table, so they run here
+ * instead of on the listener or conn handling threads.
+ */
+static void *
+pxy_thrmgr_lproc_thr(void *arg)
+{
+	pxy_thrmgr_ctx_t *ctx = arg;
+	pxy_conn_ctx_t *conn;
+	struct timeval now, waited;
+
+	pthread_mutex_lock(&ctx->lproc_mutex);
+	for (;;) {
+		while (!ctx->lproc_conns && !ctx->lproc_exit) {
+			pthread_cond_wait(&ctx->lproc_cond, &ctx->lproc_mutex);
+		}
+		if (ctx->lproc_exit)
+			break;
+
+		conn = ctx->lproc_conns;
+		ctx->lproc_conns = conn->next_handoff;
+		ctx->lproc_count--;
+		if (!ctx->lproc_conns) {
+			ctx->lproc_conns_tail = NULL;
+		}
+		pthread_mutex_unlock(&ctx->lproc_mutex);
+
+		evutil_gettimeofday(&now, NULL);
+		evutil_timersub(&now, &conn->lproc.queued, &waited);
+		if (waited.tv_sec * 1000 + waited.tv_usec / 1000 < PXY_THRMGR_LPROC_BUDGET) {
+			pxy_conn_lookup_local_procinfo(conn);
+		} else {
+			log_dbg_printf("Local process lookup skipped after %lld ms in queue, fd=%d\n",
+			               (long long)waited.tv_sec * 1000 + waited.tv_usec / 1000, conn->fd);
+		}
+		pxy_thrmgr_handoff_conn(conn);
+
+		pthread_mutex_lock(&ctx->lproc_mutex);
+	}
+	pthread_mutex_unlock(&ctx->lproc_mutex);
+
+	proc_fini();
+	return NULL;
+}
+
+/*
+ * Start the local process lookup thread.
+ * Returns -1 on failure, 0 on success.
+ */
+static int
+pxy_thrmgr_lproc_run(pxy_thrmgr_ctx_t *ctx)
+{
+	if (pthread_mutex_init(&ctx->lproc_mutex, NULL)) {
+		log_dbg_printf("Failed to initialize lproc mutex\n");
+		return -1;
+	}
+	if (pthread_cond_init(&ctx->lproc_cond, NULL)) {
+		log_dbg_printf("Failed to initialize lproc cond\n");
+		pthread_mutex_destroy(&ctx->lproc_mutex);
+		return -1;
+	}
+	if (pthread_create(&ctx->lproc_thr, NULL, pxy_thrmgr_lproc_thr, ctx)) {
+		log_dbg_printf("Failed to start lproc thread\n");
+		pthread_cond_destroy(&ctx->lproc_cond);
+		pthread_mutex_destroy(&ctx->lproc_mutex);
+		return -1;
+	}
+	log_dbg_printf("Started local process lookup thread\n");
+	return 0;
+}
+
+/*
+ * Stop the local process lookup thread, if started.
+ */
+static void
+pxy_thrmgr_lproc_free(pxy_thrmgr_ctx_t *ctx)
+{
+	if (!ctx->global->lprocinfo)
+		return;
+
+	pthread_mutex_lock(&ctx->lproc_mutex);
+	ctx->lproc_exit = 1;
+	pthread_cond_signal(&ctx->lproc_cond);
+	pthread_mutex_unlock(&ctx->lproc_mutex);
+	pthread_join(ctx->lproc_thr, NULL);
+	pthread_cond_destroy(&ctx->lproc_cond);
+	pthread_mutex_destroy(&ctx->lproc_mutex);
+}
+#endif /* HAVE_LOCAL_PROCINFO */
+
+/*
+ * Free the wakeup event and pipe of the thread, and the handoff mutex.
+ * Must be called before freeing the event base of the thread.
+ */
+static void
+pxy_thrmgr_free_wakeup(pxy_thr_ctx_t *ctx)
+{
+	if (ctx->wakeup_ev) {
+		event_free(ctx->wakeup_ev);
+		ctx->wakeup_ev = NULL;
+	}
+	if (ctx->wakeup_pipe[0] != -1) {
+		close(ctx->wakeup_pipe[0]);
+		close(ctx->wakeup_pipe[1]);
+		ctx->wakeup_pipe[0] = -1;
+		ctx->wakeup_pipe[1] = -1;
+	}
+	pthread_mutex_destroy(&ctx->handoff_mutex);
+}
+
+/*
+ * Choose the CPUs of the conn handling threads: the CPUs in WorkerCPUs in
+ * turn, or with NUMAAware, the CPUs the process may run on in turn.  With
+ * NUMAAware, also map the CPUs to their NUMA nodes, for pxy_thrmgr_select().
+ * Returns -1 on failure, 0 on success.
+ */
+static int NONNULL(1)
+pxy_thrmgr_place(pxy_thrmgr_ctx_t *ctx)
+{
+	int *cpus = NULL, ncpus = 0, cores = sys_get_cpu_cores();
+
+	if (!ctx->global->workercpus && !ctx->global->numa)
+		return 0;
+	if (ctx->global->workercpus)
+		ncpus = sys_cpulist_parse(ctx->global->workercpus, &cpus);
+	else
+		ncpus = sys_get_affinity_cpus(&cpus);
+	if (ncpus == -1)
+		return -1;
+
+	if (!(ctx->thr_cpu = malloc(ctx->num_thr * sizeof(int)))) {
+		free(cpus);
+		return -1;
+	}
+	ctx->cpu_node_count = cores;
+	for (int idx = 0; idx < ctx->num_thr; idx++) {
+		ctx->thr_cpu[idx] = cpus[idx % ncpus];
+		ctx->cpu_node_count = MAX(ctx->cpu_node_count, ctx->thr_cpu[idx] + 1);
+	}
+	free(cpus);
+
+	if (ctx->global->numa) {
+		if (!(ctx->cpu_node = malloc(ctx->cpu_node_count * sizeof(int))))
+			return -1;
+		for (int cpu = 0; cpu < ctx->cpu_node_count; cpu++) {
+			ctx->cpu_node[cpu] = sys_get_cpu_node(cpu);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Number of conn handling threads the thread manager starts for global.
+ */
+int
+pxy_thrmgr_num_thr(global_t *global)
+{
+	return global->conn_thr_count ? (int)global->conn_thr_count : 2 * (int)sys_get_cpu_cores();
+}
+
 /*
  * Create new thread manager but do not start any threads yet.
  * This gets called before forking to background.
@@ -328,7 +587,11 @@ pxy_thrmgr_new(global_t *global)
 	memset(ctx, 0, sizeof(pxy_thrmgr_ctx_t));
 
 	ctx->global = global;
-	ctx->num_thr = 2 * sys_get_cpu_cores();
+	ctx->num_thr = pxy_thrmgr_num_thr(global);
+	if (pxy_thrmgr_place(ctx) == -1) {
+		free(ctx);
+		return NULL;
+	}
 	return ctx;
 }
 
@@ -344,6 +607,10 @@ pxy_thrmgr_run(pxy_thrmgr_ctx_t *ctx)
 	int idx = -1, dns = 0;
 
 	dns = global_has_dns_spec(ctx->global);
+	if (dns && ctx->global->dnscache && dnscache_init() == -1) {
+		log_dbg_printf("Failed to initialize dnscache\n");
+		return -1;
+	}
 
 	if (!(ctx->thr = malloc(ctx->num_thr * sizeof(pxy_thr_ctx_t*)))) {
 		log_dbg_printf("Failed to allocate memory\n");
@@ -357,6 +624,8 @@ pxy_thrmgr_run(pxy_thrmgr_ctx_t *ctx)
 			goto leave;
 		}
 		memset(ctx->thr[idx], 0, sizeof(pxy_thr_ctx_t));
+		ctx->thr[idx]->wakeup_pipe[0] = -1;
+		ctx->thr[idx]->wakeup_pipe[1] = -1;
 		ctx->thr[idx]->evbase = event_base_new();
 		if (!ctx->thr[idx]->evbase) {
 			log_dbg_printf("Failed to create evbase %d\n", idx);
@@ -378,6 +647,8 @@ pxy_thrmgr_run(pxy_thrmgr_ctx_t *ctx)
 		ctx->thr[idx]->thridx = idx;
 		ctx->thr[idx]->timeout_count = 0;
 		ctx->thr[idx]->thrmgr = ctx;
+		ctx->thr[idx]->cpu = ctx->thr_cpu ? ctx->thr_cpu[idx] : -1;
+		ctx->thr[idx]->node = ctx->cpu_node ? ctx->cpu_node[ctx->thr[idx]->cpu] : -1;
 
 		if ((ctx->global->opts->user_auth || global_has_userauth_spec(ctx->global)) && sqlite3_prepare_v2(ctx->global->userdb, "SELECT user,ether,atime,desc FROM users WHERE ip = ?1", 100, &ctx->thr[idx]->get_user, NULL)) {
 			log_err_level_printf(LOG_CRIT, "Error preparing get_user sql stmt: %s\n", sqlite3_errmsg(ctx->global->userdb));
@@ -387,6 +658,28 @@ pxy_thrmgr_run(pxy_thrmgr_ctx_t *ctx)
 			log_dbg_printf("Failed to initialize thr mutex\n");
 			goto leave;
 		}
+		if (!(ctx->thr[idx]->slab = slab_new())) {
+			log_dbg_printf("Failed to create thr slab %d\n", idx);
+			goto leave;
+		}
+		if (pthread_mutex_init(&ctx->thr[idx]->handoff_mutex, NULL)) {
+			log_dbg_printf("Failed to initialize thr handoff mutex\n");
+			goto leave;
+		}
+		if (pipe(ctx->thr[idx]->wakeup_pipe) == -1 ||
+		    evutil_make_socket_nonblocking(ctx->thr[idx]->wakeup_pipe[0]) == -1 ||
+		    evutil_make_socket_nonblocking(ctx->thr[idx]->wakeup_pipe[1]) == -1 ||
+		    evutil_make_socket_closeonexec(ctx->thr[idx]->wakeup_pipe[0]) == -1 ||
+		    evutil_make_socket_closeonexec(ctx->thr[idx]->wakeup_pipe[1]) == -1) {
+			log_dbg_printf("Failed to create wakeup pipe %d\n", idx);
+			goto leave;
+		}
+		ctx->thr[idx]->wakeup_ev = event_new(ctx->thr[idx]->evbase, ctx->thr[idx]->wakeup_pipe[0],
+		                                     EV_READ|EV_PERSIST, pxy_thrmgr_wakeup_cb, ctx->thr[idx]);
+		if (!ctx->thr[idx]->wakeup_ev || event_add(ctx->thr[idx]->wakeup_ev, NULL) == -1) {
+			log_dbg_printf("Failed to create wakeup event %d\n", idx);
+			goto leave;
+		}
 	}
 
 	log_dbg_printf("Initialized %d connection handling threads\n",
@@ -404,6 +697,14 @@ pxy_thrmgr_run(pxy_thrmgr_ctx_t *ctx)
 	log_dbg_printf("Started %d connection handling threads\n",
 	               ctx->num_thr);
 
+#ifdef HAVE_LOCAL_PROCINFO
+	if (ctx->global->lprocinfo && pxy_thrmgr_lproc_run(ctx) == -1) {
+		// The conn handling threads are running already
+		ctx->global->lprocinfo = 0;
+		return -1;
+	}
+#endif /* HAVE_LOCAL_PROCINFO */
+
 	return 0;
 
 leave_thr:
@@ -418,6 +719,7 @@ leave_thr:
 leave:
 	while (idx >= 0) {
 		if (ctx->thr[idx]) {
+			pxy_thrmgr_free_wakeup(ctx->thr[idx]);
 			if (ctx->thr[idx]->dnsbase) {
 				evdns_base_free(ctx->thr[idx]->dnsbase, 0);
 			}
@@ -428,6 +730,9 @@ leave:
 				sqlite3_finalize(ctx->thr[idx]->get_user);
 			}
 			pthread_mutex_destroy(&ctx->thr[idx]->mutex);
+			if (ctx->thr[idx]->slab) {
+				slab_free_all(ctx->thr[idx]->slab);
+			}
 			free(ctx->thr[idx]);
 		}
 		idx--;
@@ -445,6 +750,9 @@ leave:
 void
 pxy_thrmgr_free(pxy_thrmgr_ctx_t *ctx)
 {
+#ifdef HAVE_LOCAL_PROCINFO
+	pxy_thrmgr_lproc_free(ctx);
+#endif /* HAVE_LOCAL_PROCINFO */
 	if (ctx->thr) {
 		for (int idx = 0; idx < ctx->num_thr; idx++) {
 			event_base_loopbreak(ctx->thr[idx]->evbase);
@@ -454,6 +762,7 @@ pxy_thrmgr_free(pxy_thrmgr_ctx_t *ctx)
 			pthread_join(ctx->thr[idx]->thr, NULL);
 		}
 		for (int idx = 0; idx < ctx->num_thr; idx++) {
+			pxy_thrmgr_free_wakeup(ctx->thr[idx]);
 			if (ctx->thr[idx]->dnsbase) {
 				evdns_base_free(ctx->thr[idx]->dnsbase, 0);
 			}
@@ -464,10 +773,20 @@ pxy_thrmgr_free(pxy_thrmgr_ctx_t *ctx)
 				sqlite3_finalize(ctx->thr[idx]->get_user);
 			}
 			pthread_mutex_destroy(&ctx->thr[idx]->mutex);
+			if (ctx->thr[idx]->slab) {
+				slab_free_all(ctx->thr[idx]->slab);
+			}
 			free(ctx->thr[idx]);
 		}
 		free(ctx->thr);
 	}
+	if (ctx->thr_cpu) {
+		free(ctx->thr_cpu);
+	}
+	if (ctx->cpu_node) {
+		free(ctx->cpu_node);
+	}
+	dnscache_fini();
 	free(ctx);
 }
 
@@ -609,53 +928,86 @@ pxy_thrmgr_remove_conn_unlocked(pxy_conn_ctx_t *ctx)
 }
 
 /*
- * Attach a new connection to a thread.  Chooses the thread with the fewest
- * currently active connections, returns the appropriate event bases.
- * No need to be so accurate about balancing thread loads, so uses 
- * thread-level mutexes, instead of a thrmgr level mutex.
- * Returns the index of the chosen thread (for passing to _detach later).
- * This function cannot fail.
+ * Return the index of the thread with the fewest currently active conns
+ * among the threads on the cpu and the NUMA node, -1 for any, or -1 if none.
  */
-void
-pxy_thrmgr_attach(pxy_conn_ctx_t *ctx)
+static int NONNULL(1)
+pxy_thrmgr_select_least_loaded(pxy_thrmgr_ctx_t *tmctx, int cpu, int node)
 {
-#ifdef DEBUG_PROXY
-	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_thrmgr_attach: ENTER, fd=%d\n", ctx->fd);
-#endif /* DEBUG_PROXY */
+	int thridx = -1;
+	size_t minload = 0;
 
-	int thridx = 0;
-	size_t minload;
-
-	pxy_thrmgr_ctx_t *tmctx = ctx->thrmgr;
-	pthread_mutex_lock(&tmctx->thr[0]->mutex);
-	minload = tmctx->thr[0]->load;
-	pthread_mutex_unlock(&tmctx->thr[0]->mutex);
-
-#ifdef DEBUG_THREAD
-	log_dbg_printf("===> Proxy connection handler thread status:\n"
-	               "thr[0]: %zu\n", minload);
-#endif /* DEBUG_THREAD */
-	for (int idx = 1; idx < tmctx->num_thr; idx++) {
+	for (int idx = 0; idx < tmctx->num_thr; idx++) {
+		if ((cpu != -1 && tmctx->thr[idx]->cpu != cpu) ||
+		    (node != -1 && tmctx->thr[idx]->node != node))
+			continue;
 		pthread_mutex_lock(&tmctx->thr[idx]->mutex);
 #ifdef DEBUG_THREAD
 		log_dbg_printf("thr[%d]: %zu\n", idx, tmctx->thr[idx]->load);
 #endif /* DEBUG_THREAD */
-		if (minload > tmctx->thr[idx]->load) {
+		if (thridx == -1 || minload > tmctx->thr[idx]->load) {
 			minload = tmctx->thr[idx]->load;
 			thridx = idx;
 		}
 		pthread_mutex_unlock(&tmctx->thr[idx]->mutex);
 	}
+	return thridx;
+}
 
-	// Defer adding the conn to the conn list of its thread until after a successful conn setup while returning from pxy_conn_connect()
-	// otherwise pxy_thrmgr_timer_cb() may try to access the conn ctx while it is being freed on failure (signal 6 crash)
-	ctx->thr = tmctx->thr[thridx];
-	ctx->evbase = ctx->thr->evbase;
-	ctx->dnsbase = ctx->thr->dnsbase;
+/*
+ * Choose the thread for a new connection, the one with the fewest
+ * currently active connections.
+ * With NUMAAware, prefer the threads on the CPU which received the packets
+ * of the conn, then the threads on the NUMA node of that CPU, so that the
+ * conn is handled close to the RX queue of the NIC.
+ * No need to be so accurate about balancing thread loads, so uses 
+ * thread-level mutexes, instead of a thrmgr level mutex.
+ * The conn ctxs are allocated from the slab of the chosen thread,
+ * hence this is separate from attaching the conn.
+ * This function cannot fail.
+ */
+pxy_thr_ctx_t *
+pxy_thrmgr_select(pxy_thrmgr_ctx_t *tmctx, evutil_socket_t fd)
+{
+	int thridx = -1;
+
+#ifdef DEBUG_THREAD
+	log_dbg_printf("===> Proxy connection handler thread status:\n");
+#endif /* DEBUG_THREAD */
+	if (tmctx->cpu_node) {
+		int cpu = sys_get_incoming_cpu(fd);
+		if (cpu >= 0 && cpu < tmctx->cpu_node_count) {
+			thridx = pxy_thrmgr_select_least_loaded(tmctx, cpu, -1);
+			if (thridx == -1 && tmctx->cpu_node[cpu] != -1)
+				thridx = pxy_thrmgr_select_least_loaded(tmctx, -1, tmctx->cpu_node[cpu]);
+		}
+	}
+	if (thridx == -1)
+		thridx = pxy_thrmgr_select_least_loaded(tmctx, -1, -1);
 
 #ifdef DEBUG_THREAD
 	log_dbg_printf("thridx: %d\n", thridx);
 #endif /* DEBUG_THREAD */
+	return tmctx->thr[thridx];
+}
+
+/*
+ * Attach a new connection to the thread chosen by pxy_thrmgr_select(),
+ * sets the appropriate event bases.
+ * This function cannot fail.
+ */
+void
+pxy_thrmgr_attach(pxy_conn_ctx_t *ctx, pxy_thr_ctx_t *thr)
+{
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_thrmgr_attach: ENTER, fd=%d\n", ctx->fd);
+#endif /* DEBUG_PROXY */
+
+	// Defer adding the conn to the conn list of its thread until after a successful conn setup while returning from pxy_conn_connect()
+	// otherwise pxy_thrmgr_timer_cb() may try to access the conn ctx while it is being freed on failure (signal 6 crash)
+	ctx->thr = thr;
+	ctx->evbase = thr->evbase;
+	ctx->dnsbase = thr->dnsbase;
 }
 
 void
@@ -670,6 +1022,68 @@ pxy_thrmgr_attach_child(pxy_conn_ctx_t *ctx)
 	pthread_mutex_unlock(&ctx->thr->mutex);
 }
 
+/*
+ * Hand over the conn attached by the listener thread to its conn handling
+ * thread, which then runs the conn setup on its own event base. Since the conn
+ * is never touched by the listener thread again, the bufferevents of the conn
+ * are confined to a single thread and do not need locking.
+ */
+void
+pxy_thrmgr_handoff_conn(pxy_conn_ctx_t *ctx)
+{
+#ifdef DEBUG_PROXY
+	log_dbg_level_printf(LOG_DBG_MODE_FINEST, "pxy_thrmgr_handoff_conn: ENTER, fd=%d\n", ctx->fd);
+#endif /* DEBUG_PROXY */
+
+	pxy_thr_ctx_t *thr = ctx->thr;
+	int wakeup;
+
+	ctx->next_handoff = NULL;
+
+	pthread_mutex_lock(&thr->handoff_mutex);
+	wakeup = !thr->handoff_conns;
+	if (thr->handoff_conns_tail) {
+		thr->handoff_conns_tail->next_handoff = ctx;
+	} else {
+		thr->handoff_conns = ctx;
+	}
+	thr->handoff_conns_tail = ctx;
+	thr->handoff_count++;
+	pthread_mutex_unlock(&thr->handoff_mutex);
+
+	// A wakeup is pending already if the queue was not empty
+	if (wakeup && write(thr->wakeup_pipe[1], "", 1) == -1 && errno != EAGAIN) {
+		log_err_level_printf(LOG_CRIT, "Error waking up thr %d: %s\n", thr->thridx, strerror(errno));
+	}
+}
+
+#ifdef HAVE_LOCAL_PROCINFO
+/*
+ * Queue the conn for the local process lookup thread, which hands the conn
+ * over to its conn handling thread after the lookup.  Called by the listener
+ * thread instead of pxy_thrmgr_handoff_conn().
+ */
+void
+pxy_thrmgr_lproc_lookup(pxy_conn_ctx_t *ctx)
+{
+	pxy_thrmgr_ctx_t *tmctx = ctx->thr->thrmgr;
+
+	evutil_gettimeofday(&ctx->lproc.queued, NULL);
+	ctx->next_handoff = NULL;
+
+	pthread_mutex_lock(&tmctx->lproc_mutex);
+	if (tmctx->lproc_conns_tail) {
+		tmctx->lproc_conns_tail->next_handoff = ctx;
+	} else {
+		tmctx->lproc_conns = ctx;
+	}
+	tmctx->lproc_conns_tail = ctx;
+	tmctx->lproc_count++;
+	pthread_cond_signal(&tmctx->lproc_cond);
+	pthread_mutex_unlock(&tmctx->lproc_mutex);
+}
+#endif /* HAVE_LOCAL_PROCINFO */
+
 /*
  * Detach a connection from a thread by index.
  * This function cannot fail.
@@ -711,4 +1125,22 @@ pxy_thrmgr_detach_child(pxy_conn_ctx_t *ctx)
 	pthread_mutex_unlock(&ctx->thr->mutex);
 }
 
+/*
+ * Record the latency of a conn setup phase which started at start, once per
+ * conn, in the histograms of the conn handling thread.  Must be called on the
+ * conn handling thread.  Returns the current time, i.e. the start of the next
+ * phase.
+ */
+uint64_t
+pxy_thrmgr_phase_done(pxy_conn_ctx_t *ctx, enum pxy_phase phase, uint64_t start)
+{
+	uint64_t now = histo_now();
+
+	if (!(ctx->phases & (1 << phase))) {
+		ctx->phases |= 1 << phase;
+		histo_add(&ctx->thr->phase_histo[phase], now - start);
+	}
+	return now;
+}
+
 /* vim: set noet ft=c: */
@@ -32,6 +32,9 @@
 
 #include "opts.h"
 #include "attrib.h"
+#include "slab.h"
+#include "proc.h"
+#include "histo.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -46,6 +49,38 @@ extern int descriptor_table_size;
 typedef struct pxy_conn_ctx pxy_conn_ctx_t;
 typedef struct pxy_thrmgr_ctx pxy_thrmgr_ctx_t;
 
+// Conn setup phases timed in the phase latency histograms of the threads
+enum pxy_phase {
+	PXY_PHASE_ACCEPT,    /* accept to setup start on the conn handling thread */
+	PXY_PHASE_NAT,       /* NAT state table lookup */
+	PXY_PHASE_SNI,       /* waiting for and peeking the ClientHello */
+	PXY_PHASE_DNS,       /* resolving the SNI hostname */
+	PXY_PHASE_CONNECT,   /* upstream TCP connect */
+	PXY_PHASE_SRVTLS,    /* upstream TLS handshake */
+	PXY_PHASE_CERT,      /* cert cache lookup or forging */
+	PXY_PHASE_CLITLS,    /* client TLS handshake */
+	PXY_PHASE_CHILD,     /* first byte to the listening program to child accept */
+	PXY_PHASE_FIRSTBYTE, /* accept to the first byte relayed */
+	PXY_PHASE_MAX
+};
+
+extern const char *pxy_phase_names[PXY_PHASE_MAX];
+
+// Stages of the src SSL setup reached by the conns of the threads
+enum pxy_srcssl_stage {
+	PXY_SRCSSL_PASSSNI,  /* passed through by PassSite before connecting */
+	PXY_SRCSSL_NAMES,    /* names of the server cert extracted */
+	PXY_SRCSSL_PASS,     /* passed through by PassSite after the server handshake */
+	PXY_SRCSSL_CERT,     /* cert selected from the caches or forged */
+	PXY_SRCSSL_FORGE,    /* cert forged */
+	PXY_SRCSSL_CTX,      /* SSL_CTX created */
+	PXY_SRCSSL_OPTIMISTIC, /* client handshake started with the cert cached for the SNI */
+	PXY_SRCSSL_MISMATCH, /* server cert not the one the optimistic cert was forged for */
+	PXY_SRCSSL_MAX
+};
+
+extern const char *pxy_srcssl_stage_names[PXY_SRCSSL_MAX];
+
 typedef struct pxy_thr_ctx {
 	pthread_t thr;
 	int thridx;
@@ -54,6 +89,9 @@ typedef struct pxy_thr_ctx {
 	struct event_base *evbase;
 	struct evdns_base *dnsbase;
 	int running;
+	// CPU the thread is pinned to and its NUMA node, -1 if not pinned or not known
+	int cpu;
+	int node;
 
 	// Per-thread locking is necessary during connection setup and termination
 	// to prevent multithreading issues between thrmgr thread and conn handling threads
@@ -66,14 +104,27 @@ typedef struct pxy_thr_ctx {
 	size_t errors;
 	size_t set_watermarks;
 	size_t unset_watermarks;
+	// Times conns stopped reading because of ThreadBufferBudget
+	size_t budget_waits;
+	// Bytes in the output buffers of the conns, updated by evbuffer callbacks on this thread only
+	size_t buffered;
 	long long unsigned int intif_in_bytes;
 	long long unsigned int intif_out_bytes;
 	long long unsigned int extif_in_bytes;
 	long long unsigned int extif_out_bytes;
+	// Content bytes logged, and skipped by the capture policy
+	long long unsigned int content_logged_bytes;
+	long long unsigned int content_skipped_bytes;
 	// Each stats has an id, incremented on each stats print
 	unsigned short stats_id;
 	// Used to print statistics, compared against stats_period
 	unsigned int timeout_count;
+	// Conn setup phase latencies, updated by this thread only, read by the stats socket
+	histo_t phase_histo[PXY_PHASE_MAX];
+	// Src SSL setup stage counts, updated by this thread only, read by the stats socket
+	size_t srcssl_stages[PXY_SRCSSL_MAX];
+	// CPU time of the thread in usec at the last stats print
+	uint64_t cputime;
 
 	// List of active connections on the thread
 	pxy_conn_ctx_t *conns;
@@ -85,17 +136,48 @@ typedef struct pxy_thr_ctx {
 	// We keep track of conns at that stage using this list, to close them if they time out
 	pxy_conn_ctx_t *pending_ssl_conns;
 	long long unsigned int pending_ssl_conn_count;
+
+	// Conn ctxs and their proto and ssl ctxs are allocated from this slab
+	slab_t *slab;
+
+	// Conns accepted by the listener thread wait in this queue until the conn handling thread sets them up,
+	// so that their bufferevents are only ever touched by the thread owning them
+	// The handoff mutex protects the queue only, the listener thread writes to the wakeup pipe if the queue was empty
+	pthread_mutex_t handoff_mutex;
+	pxy_conn_ctx_t *handoff_conns;
+	pxy_conn_ctx_t *handoff_conns_tail;
+	size_t handoff_count;
+	evutil_socket_t wakeup_pipe[2];
+	struct event *wakeup_ev;
 } pxy_thr_ctx_t;
 
 struct pxy_thrmgr_ctx {
 	int num_thr;
 	global_t *global;
 	pxy_thr_ctx_t **thr;
+	// CPUs of the threads, and the NUMA nodes of the CPUs with NUMAAware,
+	// determined before dropping privileges, since /sys may not be available later
+	int *thr_cpu;
+	int *cpu_node;
+	int cpu_node_count;
 	// Provides unique conn id, always goes up, never down
 	// There is no risk of collision if/when it rolls back to 0
 	long long unsigned int conn_count;
+
+#ifdef HAVE_LOCAL_PROCINFO
+	// With LogProcInfo, conns accepted by the listener thread wait in this queue for the local process lookup,
+	// which runs on a thread of its own, then the lookup thread hands them over to their conn handling threads
+	pthread_t lproc_thr;
+	pthread_mutex_t lproc_mutex;
+	pthread_cond_t lproc_cond;
+	pxy_conn_ctx_t *lproc_conns;
+	pxy_conn_ctx_t *lproc_conns_tail;
+	size_t lproc_count;
+	unsigned int lproc_exit : 1;
+#endif /* HAVE_LOCAL_PROCINFO */
 };
 
+int pxy_thrmgr_num_thr(global_t *) NONNULL(1) WUNRES;
 pxy_thrmgr_ctx_t * pxy_thrmgr_new(global_t *) MALLOC;
 int pxy_thrmgr_run(pxy_thrmgr_ctx_t *) NONNULL(1) WUNRES;
 void pxy_thrmgr_free(pxy_thrmgr_ctx_t *) NONNULL(1);
@@ -105,13 +187,20 @@ void pxy_thrmgr_remove_pending_ssl_conn(pxy_conn_ctx_t *) NONNULL(1);
 
 void pxy_thrmgr_add_conn(pxy_conn_ctx_t *) NONNULL(1);
 
-void pxy_thrmgr_attach(pxy_conn_ctx_t *) NONNULL(1);
+pxy_thr_ctx_t *pxy_thrmgr_select(pxy_thrmgr_ctx_t *, evutil_socket_t) NONNULL(1);
+void pxy_thrmgr_attach(pxy_conn_ctx_t *, pxy_thr_ctx_t *) NONNULL(1,2);
 void pxy_thrmgr_attach_child(pxy_conn_ctx_t *) NONNULL(1);
+void pxy_thrmgr_handoff_conn(pxy_conn_ctx_t *) NONNULL(1);
+#ifdef HAVE_LOCAL_PROCINFO
+void pxy_thrmgr_lproc_lookup(pxy_conn_ctx_t *) NONNULL(1);
+#endif /* HAVE_LOCAL_PROCINFO */
 void pxy_thrmgr_detach_unlocked(pxy_conn_ctx_t *) NONNULL(1);
 void pxy_thrmgr_detach(pxy_conn_ctx_t *) NONNULL(1);
 void pxy_thrmgr_detach_child_unlocked(pxy_conn_ctx_t *) NONNULL(1);
 void pxy_thrmgr_detach_child(pxy_conn_ctx_t *) NONNULL(1);
 
+uint64_t pxy_thrmgr_phase_done(pxy_conn_ctx_t *, enum pxy_phase, uint64_t) NONNULL(1);
+
 #endif /* !PXYTHRMGR_H */
 
 /* vim: set noet ft=c: */
@@ -0,0 +1,273 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "slab.h"
+
+#include <string.h>
+#include <pthread.h>
+
+/*
+ * Size class allocator for the small fixed-size structs of conns, such as
+ * conn ctxs and their proto and ssl ctxs.  Each conn handling thread owns a
+ * slab, so allocations do not contend with other threads in malloc.
+ *
+ * Objects are carved out of 64 KiB chunks and recycled through a free list
+ * per size class.  Freed objects are kept for reuse and chunks are only
+ * released by slab_free_all(), so the memory held is bounded by the peak
+ * number of conns on the thread.  Objects larger than the largest size class
+ * are passed through to malloc(3).
+ *
+ * The listener thread allocates the ctxs of new conns from the slab of the
+ * conn handling thread, hence the mutex; it is never contended by more than
+ * those two threads.
+ */
+
+#define SLAB_CHUNK_SIZE	(64*1024)
+#define SLAB_ALIGN	16
+
+/* Size classes grow by 1.5x to keep the internal fragmentation low */
+static const size_t slab_class_size[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+#define SLAB_CLASSES	(sizeof(slab_class_size)/sizeof(slab_class_size[0]))
+#define SLAB_MAX_SIZE	2048
+
+typedef struct slab_obj {
+	struct slab_obj *next;
+} slab_obj_t;
+
+typedef struct slab_chunk {
+	struct slab_chunk *next;
+	/* keep the objects following the header aligned */
+	char pad[SLAB_ALIGN - sizeof(struct slab_chunk *)];
+} slab_chunk_t;
+
+struct slab {
+	pthread_mutex_t mutex;
+	slab_obj_t *free[SLAB_CLASSES];
+	/* the unused tail of the last chunk, shared by all size classes */
+	char *next;
+	size_t left;
+	slab_chunk_t *chunks;
+};
+
+static unsigned int
+slab_class(size_t sz)
+{
+	unsigned int i = 0;
+
+	while (slab_class_size[i] < sz)
+		i++;
+	return i;
+}
+
+/*
+ * Create a new empty slab.
+ */
+slab_t *
+slab_new(void)
+{
+	slab_t *slab;
+
+	if (!(slab = malloc(sizeof(slab_t))))
+		return NULL;
+	memset(slab, 0, sizeof(slab_t));
+	if (pthread_mutex_init(&slab->mutex, NULL)) {
+		free(slab);
+		return NULL;
+	}
+	return slab;
+}
+
+/*
+ * Free the slab and all the memory allocated from it.
+ */
+void
+slab_free_all(slab_t *slab)
+{
+	slab_chunk_t *chunk;
+
+	while ((chunk = slab->chunks)) {
+		slab->chunks = chunk->next;
+		free(chunk);
+	}
+	pthread_mutex_destroy(&slab->mutex);
+	free(slab);
+}
+
+/*
+ * Allocate sz bytes from the slab; like malloc(3), the memory is not zeroed.
+ * If slab is NULL, falls back to malloc(3).
+ * Returns NULL on failure.
+ */
+void *
+slab_alloc(slab_t *slab, size_t sz)
+{
+	slab_obj_t *obj;
+	unsigned int i;
+
+	if (!slab || sz > SLAB_MAX_SIZE)
+		return malloc(sz);
+
+	i = slab_class(sz);
+	pthread_mutex_lock(&slab->mutex);
+	if ((obj = slab->free[i])) {
+		slab->free[i] = obj->next;
+		pthread_mutex_unlock(&slab->mutex);
+		return obj;
+	}
+	if (slab->left < slab_class_size[i]) {
+		slab_chunk_t *chunk = malloc(SLAB_CHUNK_SIZE);
+		if (!chunk) {
+			pthread_mutex_unlock(&slab->mutex);
+			return NULL;
+		}
+		// The tail of the previous chunk is wasted, it is smaller than the object
+		chunk->next = slab->chunks;
+		slab->chunks = chunk;
+		slab->next = (char *)chunk + sizeof(slab_chunk_t);
+		slab->left = SLAB_CHUNK_SIZE - sizeof(slab_chunk_t);
+	}
+	obj = (slab_obj_t *)slab->next;
+	slab->next += slab_class_size[i];
+	slab->left -= slab_class_size[i];
+	pthread_mutex_unlock(&slab->mutex);
+	return obj;
+}
+
+/*
+ * Return ptr of size sz to the slab it was allocated from.
+ * The size must be the one passed to slab_alloc().
+ */
+void
+slab_free(slab_t *slab, void *ptr, size_t sz)
+{
+	slab_obj_t *obj = ptr;
+	unsigned int i;
+
+	if (!slab || sz > SLAB_MAX_SIZE) {
+		free(ptr);
+		return;
+	}
+
+	i = slab_class(sz);
+	pthread_mutex_lock(&slab->mutex);
+	obj->next = slab->free[i];
+	slab->free[i] = obj;
+	pthread_mutex_unlock(&slab->mutex);
+}
+
+/*
+ * Per-conn bump arena, allocating chunks from the slab of the conn handling
+ * thread.  Strings allocated from the arena are never freed one by one, all
+ * of them are released at once by slab_arena_free() when the conn is freed.
+ * So the arena must only be used for strings set a bounded number of times
+ * during the lifetime of the conn.
+ */
+
+#define SLAB_ARENA_CHUNK_SIZE	512
+
+struct slab_arena_chunk {
+	slab_arena_chunk_t *next;
+	size_t sz;
+};
+
+void
+slab_arena_init(slab_arena_t *arena, slab_t *slab)
+{
+	memset(arena, 0, sizeof(slab_arena_t));
+	arena->slab = slab;
+}
+
+/*
+ * Allocate sz bytes from the arena, aligned for any scalar type.
+ * Returns NULL on failure.
+ */
+void *
+slab_arena_alloc(slab_arena_t *arena, size_t sz)
+{
+	void *ptr;
+
+	sz = (sz + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (arena->left < sz) {
+		slab_arena_chunk_t *chunk;
+		size_t chunksz = sizeof(slab_arena_chunk_t) + sz;
+
+		if (chunksz < SLAB_ARENA_CHUNK_SIZE)
+			chunksz = SLAB_ARENA_CHUNK_SIZE;
+		if (!(chunk = slab_alloc(arena->slab, chunksz)))
+			return NULL;
+		chunk->sz = chunksz;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		// An oversized chunk is used up by this allocation, keep the room in the current chunk for next ones
+		if (chunksz - sizeof(slab_arena_chunk_t) - sz < arena->left)
+			return (char *)chunk + sizeof(slab_arena_chunk_t);
+		arena->next = (char *)chunk + sizeof(slab_arena_chunk_t);
+		arena->left = chunksz - sizeof(slab_arena_chunk_t);
+	}
+	ptr = arena->next;
+	arena->next += sz;
+	arena->left -= sz;
+	return ptr;
+}
+
+/*
+ * Copy the string s into the arena.
+ * Returns NULL on failure.
+ */
+char *
+slab_arena_strdup(slab_arena_t *arena, const char *s)
+{
+	size_t sz = strlen(s) + 1;
+	char *str;
+
+	if (!(str = slab_arena_alloc(arena, sz)))
+		return NULL;
+	memcpy(str, s, sz);
+	return str;
+}
+
+/*
+ * Release all memory allocated from the arena, and reset it for reuse.
+ */
+void
+slab_arena_free(slab_arena_t *arena)
+{
+	slab_arena_chunk_t *chunk;
+
+	while ((chunk = arena->chunks)) {
+		arena->chunks = chunk->next;
+		slab_free(arena->slab, chunk, chunk->sz);
+	}
+	arena->next = NULL;
+	arena->left = 0;
+}
+
+/* vim: set noet ft=c: */
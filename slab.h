@@ -0,0 +1,65 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "attrib.h"
+
+#include <stdlib.h>
+
+typedef struct slab slab_t;
+
+slab_t * slab_new(void) MALLOC;
+void slab_free_all(slab_t *) NONNULL(1);
+void * slab_alloc(slab_t *, size_t) MALLOC;
+void slab_free(slab_t *, void *, size_t);
+
+typedef struct slab_arena_chunk slab_arena_chunk_t;
+
+/*
+ * Bump arena for strings living as long as their owner, e.g. a conn.
+ * Not thread-safe, the owner must not be used by more than one thread at a time.
+ * A zeroed arena is valid and allocates from the heap.
+ */
+typedef struct slab_arena {
+	slab_t *slab;
+	slab_arena_chunk_t *chunks;
+	char *next;
+	size_t left;
+} slab_arena_t;
+
+void slab_arena_init(slab_arena_t *, slab_t *) NONNULL(1);
+void * slab_arena_alloc(slab_arena_t *, size_t) NONNULL(1) MALLOC;
+char * slab_arena_strdup(slab_arena_t *, const char *) NONNULL(1,2) MALLOC;
+void slab_arena_free(slab_arena_t *) NONNULL(1);
+
+#endif /* !SLAB_H */
+
+/* vim: set noet ft=c: */
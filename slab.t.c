@@ -0,0 +1,204 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "slab.h"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <check.h>
+
+START_TEST(slab_alloc_01)
+{
+	slab_t *slab;
+	char *p1, *p2, *p3;
+
+	slab = slab_new();
+	fail_unless(!!slab, "slab not allocated");
+	p1 = slab_alloc(slab, 712);
+	p2 = slab_alloc(slab, 712);
+	fail_unless(p1 && p2, "alloc failed");
+	fail_unless(p1 != p2, "same object returned twice");
+	fail_unless(!((uintptr_t)p1 % 16) && !((uintptr_t)p2 % 16), "object not aligned");
+	fail_unless(p2 - p1 >= 712 || p1 - p2 >= 712, "objects overlap");
+	memset(p1, 'a', 712);
+	memset(p2, 'b', 712);
+	fail_unless(p1[711] == 'a', "object overwritten");
+	slab_free(slab, p1, 712);
+	p3 = slab_alloc(slab, 700);
+	fail_unless(p3 == p1, "freed object not reused in same size class");
+	slab_free(slab, p2, 712);
+	slab_free(slab, p3, 700);
+	slab_free_all(slab);
+}
+END_TEST
+
+START_TEST(slab_alloc_02)
+{
+	slab_t *slab;
+	char *p1, *p2;
+
+	slab = slab_new();
+	fail_unless(!!slab, "slab not allocated");
+	p1 = slab_alloc(slab, 80);
+	slab_free(slab, p1, 80);
+	p2 = slab_alloc(slab, 8);
+	fail_unless(p2 != p1, "object reused across size classes");
+	slab_free(slab, p2, 8);
+	/* larger than the largest size class, passed to malloc */
+	p1 = slab_alloc(slab, 100000);
+	fail_unless(!!p1, "large alloc failed");
+	memset(p1, 0, 100000);
+	slab_free(slab, p1, 100000);
+	slab_free_all(slab);
+}
+END_TEST
+
+START_TEST(slab_alloc_03)
+{
+	slab_t *slab;
+	void *p[1000];
+	int i;
+
+	slab = slab_new();
+	fail_unless(!!slab, "slab not allocated");
+	/* spans several chunks */
+	for (i = 0; i < 1000; i++) {
+		p[i] = slab_alloc(slab, 200);
+		fail_unless(!!p[i], "alloc failed");
+		memset(p[i], i & 0xff, 200);
+	}
+	for (i = 0; i < 1000; i++) {
+		fail_unless(((unsigned char *)p[i])[199] == (i & 0xff), "object overwritten");
+		slab_free(slab, p[i], 200);
+	}
+	slab_free_all(slab);
+}
+END_TEST
+
+START_TEST(slab_alloc_04)
+{
+	char *p;
+
+	/* no slab, falls back to malloc */
+	p = slab_alloc(NULL, 64);
+	fail_unless(!!p, "alloc failed");
+	slab_free(NULL, p, 64);
+}
+END_TEST
+
+START_TEST(slab_arena_01)
+{
+	slab_t *slab;
+	slab_arena_t arena;
+	char *s1, *s2;
+
+	slab = slab_new();
+	fail_unless(!!slab, "slab not allocated");
+	slab_arena_init(&arena, slab);
+	s1 = slab_arena_strdup(&arena, "192.168.0.1");
+	s2 = slab_arena_strdup(&arena, "8443");
+	fail_unless(s1 && s2, "strdup failed");
+	fail_unless(!strcmp(s1, "192.168.0.1"), "string mismatch");
+	fail_unless(!strcmp(s2, "8443"), "string mismatch");
+	fail_unless(s2 > s1 && s2 - s1 < 32, "strings not bump allocated");
+	fail_unless(!((uintptr_t)s2 % sizeof(void *)), "string not aligned");
+	slab_arena_free(&arena);
+	fail_unless(!arena.chunks, "chunks not freed");
+	slab_free_all(slab);
+}
+END_TEST
+
+START_TEST(slab_arena_02)
+{
+	slab_t *slab;
+	slab_arena_t arena;
+	char *s1, *s2, *s3;
+	char big[4000];
+
+	slab = slab_new();
+	fail_unless(!!slab, "slab not allocated");
+	slab_arena_init(&arena, slab);
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	s1 = slab_arena_strdup(&arena, "a");
+	s2 = slab_arena_strdup(&arena, big);
+	s3 = slab_arena_strdup(&arena, "b");
+	fail_unless(s1 && s2 && s3, "strdup failed");
+	fail_unless(!strcmp(s2, big), "big string mismatch");
+	/* the oversized string does not use up the current chunk */
+	fail_unless(s3 > s1 && s3 - s1 < 32, "current chunk not kept");
+	fail_unless(!strcmp(s1, "a") && !strcmp(s3, "b"), "string mismatch");
+	slab_arena_free(&arena);
+	slab_free_all(slab);
+}
+END_TEST
+
+START_TEST(slab_arena_03)
+{
+	slab_arena_t arena;
+	char *s;
+	int i;
+
+	/* zeroed arena allocates from the heap */
+	memset(&arena, 0, sizeof(arena));
+	for (i = 0; i < 100; i++) {
+		s = slab_arena_strdup(&arena, "0123456789abcdef0123456789abcdef");
+		fail_unless(!!s, "strdup failed");
+	}
+	slab_arena_free(&arena);
+	fail_unless(!arena.chunks && !arena.left, "arena not reset");
+}
+END_TEST
+
+Suite *
+slab_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("slab");
+
+	tc = tcase_create("slab_alloc");
+	tcase_add_test(tc, slab_alloc_01);
+	tcase_add_test(tc, slab_alloc_02);
+	tcase_add_test(tc, slab_alloc_03);
+	tcase_add_test(tc, slab_alloc_04);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("slab_arena");
+	tcase_add_test(tc, slab_arena_01);
+	tcase_add_test(tc, slab_arena_02);
+	tcase_add_test(tc, slab_arena_03);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */
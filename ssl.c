@@ -1494,6 +1494,29 @@ ssl_x509_fingerprint(X509 *crt, int colons)
 	return ssl_sha1_to_str(fpr, colons);
 }
 
+/*
+ * Writes the result of ssl_x509_fingerprint_sha1() as hex characters without
+ * colons to buf, which must have room for SSL_X509_FPRSZ*2+1 bytes.
+ * Same output as ssl_x509_fingerprint(crt, 0), without allocating memory.
+ * Returns 0 on success, -1 on error.
+ */
+int
+ssl_x509_fingerprint_buf(X509 *crt, char *buf)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	unsigned char fpr[SSL_X509_FPRSZ];
+
+	if (ssl_x509_fingerprint_sha1(crt, fpr) == -1)
+		return -1;
+
+	for (int i = 0; i < SSL_X509_FPRSZ; i++) {
+		buf[2 * i] = hex[fpr[i] >> 4];
+		buf[2 * i + 1] = hex[fpr[i] & 0x0f];
+	}
+	buf[2 * SSL_X509_FPRSZ] = '\0';
+	return 0;
+}
+
 #ifndef OPENSSL_NO_DH
 /*
  * Increment the reference count of DH parameters in a thread-safe
@@ -1539,6 +1562,19 @@ ssl_x509_refcount_inc(X509 *crt)
 #endif /* !OPENSSL_THREADS */
 }
 
+/*
+ * Increment the reference count of an SSL_CTX in a thread-safe manner.
+ */
+void
+ssl_ctx_refcount_inc(SSL_CTX *sslctx)
+{
+#if defined(OPENSSL_THREADS) && ((OPENSSL_VERSION_NUMBER < 0x10100000L) || (defined(LIBRESSL_VERSION_NUMBER) && LIBRESSL_VERSION_NUMBER < 0x20701000L))
+	CRYPTO_add(&sslctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+#else /* !OPENSSL_THREADS */
+	SSL_CTX_up_ref(sslctx);
+#endif /* !OPENSSL_THREADS */
+}
+
 /*
  * Match a URL/URI hostname against a single certificate DNS name
  * using RFC 6125 rules (6.4.3 Checking of Wildcard Certificates):
@@ -243,6 +243,7 @@ char * ssl_x509_subject_cn(X509 *, size_t *) NONNULL(1,2) MALLOC;
 #define SSL_X509_FPRSZ 20
 int ssl_x509_fingerprint_sha1(X509 *, unsigned char *) NONNULL(1,2);
 char * ssl_x509_fingerprint(X509 *, int) NONNULL(1) MALLOC;
+int ssl_x509_fingerprint_buf(X509 *, char *) NONNULL(1,2);
 char ** ssl_x509_names(X509 *) NONNULL(1) MALLOC;
 int ssl_x509_names_match(X509 *, const char *) NONNULL(1,2);
 char * ssl_x509_names_to_str(X509 *) NONNULL(1) MALLOC;
@@ -252,6 +253,7 @@ int ssl_x509_is_valid(X509 *) NONNULL(1) WUNRES;
 char * ssl_x509_to_str(X509 *) NONNULL(1) MALLOC;
 char * ssl_x509_to_pem(X509 *) NONNULL(1) MALLOC;
 void ssl_x509_refcount_inc(X509 *) NONNULL(1);
+void ssl_ctx_refcount_inc(SSL_CTX *) NONNULL(1);
 
 int ssl_x509chain_load(X509 **, STACK_OF(X509) **, const char *) NONNULL(2,3);
 int ssl_x509chain_use(SSL_CTX *, X509 *, STACK_OF(X509) *)
@@ -588,6 +588,23 @@ START_TEST(ssl_x509_names_01)
 }
 END_TEST
 
+START_TEST(ssl_x509_fingerprint_buf_01)
+{
+	X509 *c;
+	char *fpr;
+	char buf[SSL_X509_FPRSZ * 2 + 1];
+
+	c = ssl_x509_load(TESTCERT);
+	fail_unless(!!c, "loading certificate failed");
+	fpr = ssl_x509_fingerprint(c, 0);
+	fail_unless(!!fpr, "no fingerprint");
+	fail_unless(ssl_x509_fingerprint_buf(c, buf) == 0, "failed");
+	fail_unless(!strcmp(fpr, buf), "fingerprint mismatch");
+	free(fpr);
+	X509_free(c);
+}
+END_TEST
+
 START_TEST(ssl_x509_names_to_str_01)
 {
 	X509 *c;
@@ -832,6 +849,11 @@ ssl_suite(void)
 	tcase_add_test(tc, ssl_x509_names_01);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("ssl_x509_fingerprint_buf");
+	tcase_add_checked_fixture(tc, ssl_setup, ssl_teardown);
+	tcase_add_test(tc, ssl_x509_fingerprint_buf_01);
+	suite_add_tcase(s, tc);
+
 	tc = tcase_create("ssl_x509_names_to_str");
 	tcase_add_checked_fixture(tc, ssl_setup, ssl_teardown);
 	tcase_add_test(tc, ssl_x509_names_to_str_01);
@@ -41,16 +41,27 @@
 #include <sys/time.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <pwd.h>
 #include <grp.h>
 #include <fts.h>
 #include <unistd.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#ifdef __FreeBSD__
+#include <pthread_np.h>
+#include <sys/cpuset.h>
+#endif /* __FreeBSD__ */
+#ifdef __linux__
+#include <sched.h>
+#endif /* __linux__ */
 
 #ifndef _SC_NPROCESSORS_ONLN
 #include <sys/sysctl.h>
@@ -457,10 +468,108 @@ sys_sockaddr_parse(struct sockaddr_storage *addr, socklen_t *addrlen,
 	return af;
 }
 
+/*
+ * Fill addr with the AF_UNIX socket address of path.
+ * Returns -1 if path is too long for a socket address, 0 otherwise.
+ */
+int
+sys_sockaddr_unix(struct sockaddr_storage *addr, socklen_t *addrlen,
+                  const char *path)
+{
+	struct sockaddr_un *sun = (struct sockaddr_un *)addr;
+	size_t len = strlen(path);
+
+	if (len >= sizeof(sun->sun_path)) {
+		log_err_level_printf(LOG_CRIT, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	memset(addr, 0, sizeof(struct sockaddr_storage));
+	sun->sun_family = AF_UNIX;
+	memcpy(sun->sun_path, path, len + 1);
+	*addrlen = sizeof(struct sockaddr_un);
+	return 0;
+}
+
+/*
+ * Writes the decimal representation of v to buf, returns the end of it.
+ * Buf must have room for 5 chars, no terminator is written.
+ */
+static char *
+sys_utoa(char *buf, unsigned int v)
+{
+	char tmp[5];
+	int i = 0;
+
+	do {
+		tmp[i++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (i)
+		*buf++ = tmp[--i];
+	return buf;
+}
+
+/*
+ * Converts an IPv4/IPv6 sockaddr into printable string representations of the
+ * host and the service (port) part, written to the caller provided buffers
+ * host and serv.  Produces the same output as getnameinfo(3) with
+ * NI_NUMERICHOST|NI_NUMERICSERV, without the overhead of the resolver
+ * library; IPv4 addresses and ports are formatted inline, IPv6 addresses
+ * by inet_ntop(3), or by getnameinfo(3) if they have a scope id.
+ * Hostsz should be at least SYS_HOSTSTRLEN and servsz SYS_SERVSTRLEN.
+ * Returns 0 on success, -1 otherwise.
+ */
+int
+sys_sockaddr_ntop(const struct sockaddr *addr, socklen_t addrlen,
+                  char *host, size_t hostsz, char *serv, size_t servsz)
+{
+	unsigned short port;
+
+	if (servsz < SYS_SERVSTRLEN)
+		return -1;
+
+	if (addr->sa_family == AF_INET && addrlen >= sizeof(struct sockaddr_in)) {
+		const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+		const unsigned char *a = (const unsigned char *)&sin->sin_addr;
+		char *p = host;
+
+		/* 4 * 3 digits, 3 dots and terminator */
+		if (hostsz < INET_ADDRSTRLEN)
+			return -1;
+		for (int i = 0; i < 4; i++) {
+			p = sys_utoa(p, a[i]);
+			*p++ = (i < 3) ? '.' : '\0';
+		}
+		port = ntohs(sin->sin_port);
+	} else if (addr->sa_family == AF_INET6 && addrlen >= sizeof(struct sockaddr_in6)) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+
+		if (sin6->sin6_scope_id) {
+			int rv = getnameinfo(addr, addrlen, host, hostsz, NULL, 0, NI_NUMERICHOST);
+			if (rv != 0) {
+				log_err_level_printf(LOG_CRIT, "Cannot get nameinfo for socket address: %s\n",
+				               gai_strerror(rv));
+				return -1;
+			}
+		} else if (!inet_ntop(AF_INET6, &sin6->sin6_addr, host, hostsz)) {
+			return -1;
+		}
+		port = ntohs(sin6->sin6_port);
+	} else {
+		log_err_level_printf(LOG_CRIT, "Cannot format socket address of family %d\n", addr->sa_family);
+		return -1;
+	}
+
+	*sys_utoa(serv, port) = '\0';
+	return 0;
+}
+
 /*
  * Converts an IPv4/IPv6 sockaddr into printable string representations of the
  * host and the service (port) part.  Writes allocated buffers to *host and
- * *serv which must both be freed by the caller.  Neither *host nor *port are
+ * *serv which must both be freed by the caller.  For AF_UNIX addresses, the
+ * host is the socket path, or "unix" for unnamed sockets, and the service is
+ * empty.  Neither *host nor *port are
  * freed by this function before newly allocating.
  * Returns 0 on success, -1 otherwise.  When -1 is returned, pointers in *host
  * and *serv are invalid and must not be used nor freed by the caller.
@@ -469,22 +578,35 @@ int
 sys_sockaddr_str(struct sockaddr *addr, socklen_t addrlen,
                  char **host, char **serv)
 {
-	char tmphost[INET6_ADDRSTRLEN];
-	int rv;
+	char tmphost[SYS_HOSTSTRLEN];
 	size_t hostsz;
 
-	*serv = malloc(6); /* max decimal digits of short plus terminator */
+	*serv = malloc(SYS_SERVSTRLEN);
 	if (!*serv) {
 		log_err_level_printf(LOG_CRIT, "Cannot allocate memory\n");
 		return -1;
 	}
-	rv = getnameinfo(addr, addrlen,
-	                 tmphost, sizeof(tmphost),
-	                 *serv, 6,
-	                 NI_NUMERICHOST | NI_NUMERICSERV);
-	if (rv != 0) {
-		log_err_level_printf(LOG_CRIT, "Cannot get nameinfo for socket address: %s\n",
-		               gai_strerror(rv));
+	if (addr->sa_family == AF_UNIX) {
+		const struct sockaddr_un *sun = (const struct sockaddr_un *)addr;
+		size_t pathsz = (size_t)addrlen > offsetof(struct sockaddr_un, sun_path) ?
+		                addrlen - offsetof(struct sockaddr_un, sun_path) : 0;
+
+		if (pathsz > sizeof(sun->sun_path))
+			pathsz = sizeof(sun->sun_path);
+		**serv = '\0';
+		if (pathsz && sun->sun_path[0]) {
+			*host = strndup(sun->sun_path, pathsz);
+		} else {
+			*host = strdup("unix");
+		}
+		if (!*host) {
+			log_err_level_printf(LOG_CRIT, "Cannot allocate memory\n");
+			free(*serv);
+			return -1;
+		}
+		return 0;
+	}
+	if (sys_sockaddr_ntop(addr, addrlen, tmphost, sizeof(tmphost), *serv, SYS_SERVSTRLEN) == -1) {
 		free(*serv);
 		return -1;
 	}
@@ -753,6 +875,210 @@ sys_get_cpu_cores(void)
 #endif /* !_SC_NPROCESSORS_ONLN */
 }
 
+/*
+ * Parse a list of CPU ids and ranges of CPU ids, e.g. "0-3,8,10-11", into a
+ * newly allocated array of CPU ids in *cpus.  Returns the number of CPU ids,
+ * or -1 on syntax errors or memory allocation failure.
+ */
+int
+sys_cpulist_parse(const char *list, int **cpus)
+{
+	const char *p = list;
+	int *v = NULL;
+	int n = 0;
+
+	*cpus = NULL;
+	while (*p) {
+		char *end;
+		long first, last;
+
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0 || first >= SYS_CPU_MAX)
+			goto leave;
+		last = first;
+		p = end;
+		if (*p == '-') {
+			p++;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first || last >= SYS_CPU_MAX)
+				goto leave;
+			p = end;
+		}
+		if (*p == ',') {
+			if (!*++p)
+				goto leave;
+		} else if (*p) {
+			goto leave;
+		}
+		int *nv = realloc(v, (n + last - first + 1) * sizeof(int));
+		if (!nv)
+			goto leave;
+		v = nv;
+		for (long cpu = first; cpu <= last; cpu++) {
+			v[n++] = cpu;
+		}
+	}
+	if (!n)
+		goto leave;
+	*cpus = v;
+	return n;
+leave:
+	free(v);
+	return -1;
+}
+
+/*
+ * Get the CPUs the process may run on, e.g. as restricted by taskset or
+ * cpusets, into a newly allocated array of CPU ids in *cpus.  Without an
+ * affinity API, all online CPUs are returned.  Returns the number of CPU ids,
+ * or -1 on failure.
+ */
+int
+sys_get_affinity_cpus(int **cpus)
+{
+	int *v;
+	int n = 0;
+#if defined(__linux__) || defined(__FreeBSD__)
+#ifdef __linux__
+	cpu_set_t set;
+
+	if (sched_getaffinity(0, sizeof(set), &set) == -1)
+		return -1;
+#else /* __FreeBSD__ */
+	cpuset_t set;
+
+	if (cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1, sizeof(set), &set) == -1)
+		return -1;
+#endif /* __FreeBSD__ */
+	if (!(v = malloc(CPU_COUNT(&set) * sizeof(int))))
+		return -1;
+	for (int cpu = 0; cpu < CPU_SETSIZE && cpu < SYS_CPU_MAX; cpu++) {
+		if (CPU_ISSET(cpu, &set))
+			v[n++] = cpu;
+	}
+#else /* !__linux__ && !__FreeBSD__ */
+	int cores = sys_get_cpu_cores();
+
+	if (!(v = malloc(cores * sizeof(int))))
+		return -1;
+	for (; n < cores; n++) {
+		v[n] = n;
+	}
+#endif /* !__linux__ && !__FreeBSD__ */
+	if (!n) {
+		free(v);
+		return -1;
+	}
+	*cpus = v;
+	return n;
+}
+
+/*
+ * Restrict the thread to run on the given CPUs.
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+int
+sys_set_thread_cpus(pthread_t thr, const int *cpus, int n)
+{
+#if defined(__linux__) || defined(__FreeBSD__)
+#ifdef __linux__
+	cpu_set_t set;
+#else /* __FreeBSD__ */
+	cpuset_t set;
+#endif /* __FreeBSD__ */
+	int rv;
+
+	CPU_ZERO(&set);
+	for (int i = 0; i < n; i++) {
+		if (cpus[i] >= CPU_SETSIZE) {
+			errno = EINVAL;
+			return -1;
+		}
+		CPU_SET(cpus[i], &set);
+	}
+	rv = pthread_setaffinity_np(thr, sizeof(set), &set);
+	if (rv) {
+		errno = rv;
+		return -1;
+	}
+	return 0;
+#else /* !__linux__ && !__FreeBSD__ */
+	(void)thr;
+	(void)cpus;
+	(void)n;
+	errno = ENOTSUP;
+	return -1;
+#endif /* !__linux__ && !__FreeBSD__ */
+}
+
+/*
+ * Restrict the thread to run on the CPUs in the CPU list.
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+int
+sys_set_thread_cpulist(pthread_t thr, const char *list)
+{
+	int *cpus, n, rv;
+
+	if ((n = sys_cpulist_parse(list, &cpus)) == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+	rv = sys_set_thread_cpus(thr, cpus, n);
+	free(cpus);
+	return rv;
+}
+
+/*
+ * Return the NUMA node of the CPU, or -1 if not known.
+ */
+int
+sys_get_cpu_node(int cpu)
+{
+#ifdef __linux__
+	char path[64];
+	struct dirent *ent;
+	DIR *dir;
+	int node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	if (!(dir = opendir(path)))
+		return -1;
+	while ((ent = readdir(dir))) {
+		if (!strncmp(ent->d_name, "node", 4) &&
+		    sscanf(ent->d_name + 4, "%d", &node) == 1)
+			break;
+		node = -1;
+	}
+	closedir(dir);
+	return node;
+#else /* !__linux__ */
+	(void)cpu;
+	return -1;
+#endif /* !__linux__ */
+}
+
+/*
+ * Return the CPU which processed the packets of the accepted socket, which is
+ * the CPU of the RX queue of the NIC with RSS and matching IRQ affinities,
+ * or -1 if not supported.
+ */
+int
+sys_get_incoming_cpu(evutil_socket_t fd)
+{
+#ifdef SO_INCOMING_CPU
+	int cpu;
+	socklen_t len = sizeof(cpu);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == -1)
+		return -1;
+	return cpu;
+#else /* !SO_INCOMING_CPU */
+	(void)fd;
+	return -1;
+#endif /* !SO_INCOMING_CPU */
+}
+
 /*
  * Send a message and optional file descriptor on a connected AF_UNIX
  * SOCKET_DGRAM socket s.  Returns the return value of sendmsg().
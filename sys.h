@@ -33,7 +33,17 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <net/if.h>
 #include <stdint.h>
+#include <pthread.h>
+
+#include <event2/util.h>
+
+/* Buffer sizes for sys_sockaddr_ntop(), including the terminator;
+ * room for a scoped IPv6 address, and the max decimal digits of short */
+#define SYS_HOSTSTRLEN	(INET6_ADDRSTRLEN + IF_NAMESIZE)
+#define SYS_SERVSTRLEN	6
 
 int sys_privdrop(const char *, const char *, const char *) WUNRES;
 
@@ -52,6 +62,10 @@ char * sys_group_str(gid_t) MALLOC;
 int sys_get_af(const char *);
 int sys_sockaddr_parse(struct sockaddr_storage *, socklen_t *,
                        char *, char *, int, int) NONNULL(1,2,3,4) WUNRES;
+int sys_sockaddr_unix(struct sockaddr_storage *, socklen_t *,
+                      const char *) NONNULL(1,2,3) WUNRES;
+int sys_sockaddr_ntop(const struct sockaddr *, socklen_t,
+                      char *, size_t, char *, size_t) NONNULL(1,3,5) WUNRES;
 int sys_sockaddr_str(struct sockaddr *, socklen_t,
                      char **, char **) NONNULL(1,3,4);
 char * sys_ip46str_sanitize(const char *) NONNULL(1) MALLOC;
@@ -66,6 +80,16 @@ int sys_dir_eachfile(const char *, sys_dir_eachfile_cb_t, void *) NONNULL(1,2) W
 
 uint32_t sys_get_cpu_cores(void) WUNRES;
 
+/* upper bound of the CPU ids in CPU lists */
+#define SYS_CPU_MAX 1024
+
+int sys_cpulist_parse(const char *, int **) NONNULL(1,2) WUNRES;
+int sys_get_affinity_cpus(int **) NONNULL(1) WUNRES;
+int sys_set_thread_cpus(pthread_t, const int *, int) NONNULL(2) WUNRES;
+int sys_set_thread_cpulist(pthread_t, const char *) NONNULL(2) WUNRES;
+int sys_get_cpu_node(int) WUNRES;
+int sys_get_incoming_cpu(evutil_socket_t) WUNRES;
+
 ssize_t sys_sendmsgfd(int, void *, size_t, int) NONNULL(2) WUNRES;
 ssize_t sys_recvmsgfd(int, void *, size_t, int *) NONNULL(2) WUNRES;
 
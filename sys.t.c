@@ -38,6 +38,9 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
 
 #include <check.h>
 
@@ -244,6 +247,49 @@ START_TEST(sys_get_cpu_cores_01)
 }
 END_TEST
 
+START_TEST(sys_cpulist_parse_01)
+{
+	int *cpus;
+	int n;
+
+	n = sys_cpulist_parse("0-3,8,10-11", &cpus);
+	fail_unless(n == 7, "Wrong number of CPUs");
+	fail_unless(cpus[0] == 0 && cpus[3] == 3, "Wrong CPUs in range");
+	fail_unless(cpus[4] == 8, "Wrong single CPU");
+	fail_unless(cpus[5] == 10 && cpus[6] == 11, "Wrong CPUs in last range");
+	free(cpus);
+}
+END_TEST
+
+START_TEST(sys_cpulist_parse_02)
+{
+	int *cpus;
+
+	fail_unless(sys_cpulist_parse("", &cpus) == -1, "Accepted empty list");
+	fail_unless(sys_cpulist_parse("3-1", &cpus) == -1, "Accepted reverse range");
+	fail_unless(sys_cpulist_parse("0,", &cpus) == -1, "Accepted trailing comma");
+	fail_unless(sys_cpulist_parse("0-", &cpus) == -1, "Accepted open range");
+	fail_unless(sys_cpulist_parse("a", &cpus) == -1, "Accepted non-numeric");
+	fail_unless(sys_cpulist_parse("1024", &cpus) == -1, "Accepted CPU id out of range");
+	fail_unless(!cpus, "Returned CPUs on error");
+}
+END_TEST
+
+START_TEST(sys_get_affinity_cpus_01)
+{
+	int *cpus = NULL;
+	int n;
+
+	n = sys_get_affinity_cpus(&cpus);
+	fail_unless(n > 0, "No CPUs");
+	fail_unless(n <= SYS_CPU_MAX, "Too many CPUs");
+	for (int i = 1; i < n; i++) {
+		fail_unless(cpus[i - 1] < cpus[i], "CPUs not in order");
+	}
+	free(cpus);
+}
+END_TEST
+
 void *
 thrmain(void *arg)
 {
@@ -314,6 +360,97 @@ START_TEST(sys_ip46str_sanitize_03)
 }
 END_TEST
 
+/*
+ * Compare sys_sockaddr_ntop() to getnameinfo(3) for the given address.
+ */
+static void
+sys_sockaddr_ntop_cmp(const char *addrstr, int af, unsigned short port)
+{
+	struct sockaddr_storage ss;
+	socklen_t sslen;
+	char host[SYS_HOSTSTRLEN], serv[SYS_SERVSTRLEN];
+	char ghost[SYS_HOSTSTRLEN], gserv[SYS_SERVSTRLEN];
+
+	memset(&ss, 0, sizeof(ss));
+	if (af == AF_INET) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		fail_unless(inet_pton(AF_INET, addrstr, &sin->sin_addr) == 1, "inet_pton failed");
+		sslen = sizeof(struct sockaddr_in);
+	} else {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		fail_unless(inet_pton(AF_INET6, addrstr, &sin6->sin6_addr) == 1, "inet_pton failed");
+		sslen = sizeof(struct sockaddr_in6);
+	}
+	fail_unless(sys_sockaddr_ntop((struct sockaddr *)&ss, sslen, host, sizeof(host), serv, sizeof(serv)) == 0,
+	            "sys_sockaddr_ntop failed");
+	fail_unless(getnameinfo((struct sockaddr *)&ss, sslen, ghost, sizeof(ghost), gserv, sizeof(gserv),
+	                        NI_NUMERICHOST | NI_NUMERICSERV) == 0, "getnameinfo failed");
+	fail_unless(!strcmp(host, ghost), "host mismatch");
+	fail_unless(!strcmp(serv, gserv), "serv mismatch");
+}
+
+START_TEST(sys_sockaddr_ntop_01)
+{
+	sys_sockaddr_ntop_cmp("127.0.0.1", AF_INET, 8443);
+	sys_sockaddr_ntop_cmp("0.0.0.0", AF_INET, 0);
+	sys_sockaddr_ntop_cmp("255.255.255.255", AF_INET, 65535);
+	sys_sockaddr_ntop_cmp("10.0.100.9", AF_INET, 80);
+}
+END_TEST
+
+START_TEST(sys_sockaddr_ntop_02)
+{
+	sys_sockaddr_ntop_cmp("::1", AF_INET6, 443);
+	sys_sockaddr_ntop_cmp("::", AF_INET6, 0);
+	sys_sockaddr_ntop_cmp("2a01:7c8:aab0:1fb::1", AF_INET6, 65535);
+	sys_sockaddr_ntop_cmp("::ffff:192.168.3.24", AF_INET6, 47286);
+	sys_sockaddr_ntop_cmp("fe80:1:2:3:4:5:6:7", AF_INET6, 1);
+}
+END_TEST
+
+START_TEST(sys_sockaddr_ntop_03)
+{
+	struct sockaddr_in sin;
+	char host[SYS_HOSTSTRLEN], serv[SYS_SERVSTRLEN];
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+	fail_unless(sys_sockaddr_ntop((struct sockaddr *)&sin, sizeof(sin), host, 8, serv, sizeof(serv)) == -1,
+	            "short host buffer accepted");
+	fail_unless(sys_sockaddr_ntop((struct sockaddr *)&sin, sizeof(sin), host, sizeof(host), serv, 4) == -1,
+	            "short serv buffer accepted");
+	sin.sin_family = AF_UNIX;
+	fail_unless(sys_sockaddr_ntop((struct sockaddr *)&sin, sizeof(sin), host, sizeof(host), serv, sizeof(serv)) == -1,
+	            "unknown family accepted");
+}
+END_TEST
+
+START_TEST(sys_sockaddr_unix_01)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	char *host, *serv;
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path) + 1];
+
+	fail_unless(sys_sockaddr_unix(&addr, &addrlen, "/var/run/lp.sock") == 0, "Rejected path");
+	fail_unless(addr.ss_family == AF_UNIX, "Wrong family");
+	fail_unless(sys_sockaddr_str((struct sockaddr *)&addr, addrlen, &host, &serv) == 0, "Cannot format path");
+	fail_unless(!strcmp(host, "/var/run/lp.sock"), "Wrong host: %s", host);
+	fail_unless(!strcmp(serv, ""), "Wrong serv: %s", serv);
+	free(host);
+	free(serv);
+
+	memset(path, 'a', sizeof(path) - 1);
+	path[0] = '/';
+	path[sizeof(path) - 1] = '\0';
+	fail_unless(sys_sockaddr_unix(&addr, &addrlen, path) == -1, "Accepted too long path");
+}
+END_TEST
 
 Suite *
 sys_suite(void)
@@ -352,6 +489,12 @@ sys_suite(void)
 	tcase_add_test(tc, sys_get_cpu_cores_01);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("sys_cpulist_parse");
+	tcase_add_test(tc, sys_cpulist_parse_01);
+	tcase_add_test(tc, sys_cpulist_parse_02);
+	tcase_add_test(tc, sys_get_affinity_cpus_01);
+	suite_add_tcase(s, tc);
+
 	tc = tcase_create("pthread_create");
 	tcase_add_test(tc, pthread_create_01);
 	suite_add_tcase(s, tc);
@@ -370,6 +513,16 @@ sys_suite(void)
 	tcase_add_test(tc, sys_ip46str_sanitize_03);
 	suite_add_tcase(s, tc);
 
+	tc = tcase_create("sys_sockaddr_ntop");
+	tcase_add_test(tc, sys_sockaddr_ntop_01);
+	tcase_add_test(tc, sys_sockaddr_ntop_02);
+	tcase_add_test(tc, sys_sockaddr_ntop_03);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("sys_sockaddr_unix");
+	tcase_add_test(tc, sys_sockaddr_unix_01);
+	suite_add_tcase(s, tc);
+
 	return s;
 }
 
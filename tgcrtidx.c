@@ -0,0 +1,820 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tgcrtidx.h"
+
+#include "ssl.h"
+#include "sys.h"
+#include "log.h"
+#include "dynbuf.h"
+#include "khash.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/pem.h>
+
+/*
+ * Index of the target certs in TargetCertDir.
+ *
+ * The PEM files are concatenated into a single blob, each preceded by one
+ * tag line per name of its leaf cert:
+ *
+ *   #tgcrt www.example.com
+ *   #tgcrt *.example.com
+ *   -----BEGIN CERTIFICATE-----
+ *   ...
+ *
+ * The blob is built by scanning the directory with worker threads, which
+ * only parse the leaf cert of each file for its names.  If TargetCertIndex
+ * is set, the blob is written to that file after a header line:
+ *
+ *   #tgcrtidx <version> <files> <entries> <blob size>
+ *
+ * and mapped from it, also on the following startups instead of scanning
+ * the directory again.  An index which does not match its header is
+ * refused.  An index older than TargetCertDir or any file in it, or built
+ * from a different number of files, is built again.  Otherwise the blob
+ * stays in memory, which is only fine for small directories.
+ *
+ * Names map to blob offsets.  Certs and keys are parsed on first use, and
+ * at most TargetCertCacheSize of them are kept parsed, least recently used
+ * first out.  Wildcard names are also hashed without their leading '*', so
+ * the wildcard of a hostname is looked up from the first dot of the
+ * hostname itself, without building the wildcarded name.
+ */
+
+#define TGCRTIDX_TAG "#tgcrt "
+#define TGCRTIDX_TAGSZ (sizeof(TGCRTIDX_TAG) - 1)
+
+#define TGCRTIDX_MAGIC "#tgcrtidx "
+#define TGCRTIDX_MAGICSZ (sizeof(TGCRTIDX_MAGIC) - 1)
+#define TGCRTIDX_VERSION 1
+/* Upper bound on the length of the header line */
+#define TGCRTIDX_HDRSZ 128
+
+/* Upper bound on the threads scanning TargetCertDir */
+#define TGCRTIDX_MAX_THREADS 16
+
+typedef struct tgcrtidx_entry {
+	// PEM data in blob
+	size_t off;
+	size_t len;
+	cert_t *cert;
+	struct tgcrtidx_entry *prev;
+	struct tgcrtidx_entry *next;
+	unsigned int bad : 1;
+} tgcrtidx_entry_t;
+
+KHASH_MAP_INIT_STR(tgname_t, tgcrtidx_entry_t *)
+
+static char *blob;
+static size_t blobsz;
+// Mapped index file, blob points past its header line
+static void *map;
+static size_t mapsz;
+static tgcrtidx_entry_t *entries;
+static size_t entries_count;
+static khash_t(tgname_t) *exactmap;
+static khash_t(tgname_t) *wildmap;
+
+static pthread_mutex_t lru_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Most recently used first
+static tgcrtidx_entry_t *lru_head;
+static tgcrtidx_entry_t *lru_tail;
+static unsigned int lru_count;
+static unsigned int lru_size;
+
+typedef struct tgcrtidx_file {
+	char *path;
+	dynbuf_t *pem;
+	char **names;
+	const char *err;
+} tgcrtidx_file_t;
+
+typedef struct tgcrtidx_stat {
+	size_t files;
+	time_t mtime;
+} tgcrtidx_stat_t;
+
+typedef struct tgcrtidx_scan {
+	tgcrtidx_file_t *files;
+	size_t count;
+	size_t size;
+	size_t next;
+	pthread_mutex_t mutex;
+} tgcrtidx_scan_t;
+
+static int
+tgcrtidx_scan_add_cb(const char *filename, void *arg)
+{
+	tgcrtidx_scan_t *scan = arg;
+
+	if (scan->count == scan->size) {
+		size_t size = scan->size ? scan->size * 2 : 256;
+		tgcrtidx_file_t *files = realloc(scan->files, size * sizeof(tgcrtidx_file_t));
+		if (!files)
+			return -1;
+		scan->files = files;
+		scan->size = size;
+	}
+	tgcrtidx_file_t *f = &scan->files[scan->count];
+	memset(f, 0, sizeof(tgcrtidx_file_t));
+	if (!(f->path = strdup(filename)))
+		return -1;
+	scan->count++;
+	return 0;
+}
+
+/*
+ * Read a PEM file and get the names of its leaf cert.  The key is not
+ * parsed here, it is only checked for presence.
+ */
+static void
+tgcrtidx_scan_file(tgcrtidx_file_t *f)
+{
+	X509 *crt;
+	BIO *bio;
+
+	if (!(f->pem = dynbuf_new_file(f->path))) {
+		f->err = "Failed to read PEM file";
+		return;
+	}
+	if (!memmem(f->pem->buf, f->pem->sz, "PRIVATE KEY-----", 16)) {
+		f->err = "Failed to load cert and key from PEM file";
+		return;
+	}
+	if (!(bio = BIO_new_mem_buf(f->pem->buf, f->pem->sz))) {
+		f->err = "Out of memory reading PEM file";
+		return;
+	}
+	crt = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+	BIO_free(bio);
+	if (!crt) {
+		f->err = "Failed to load cert and key from PEM file";
+		return;
+	}
+	f->names = ssl_x509_names(crt);
+	X509_free(crt);
+	if (!f->names) {
+		f->err = "Out of memory reading PEM file";
+		return;
+	}
+	for (char **p = f->names; *p; p++) {
+		/* be deliberately vulnerable to NULL prefix attacks */
+		char *sep;
+		if ((sep = strchr(*p, '!'))) {
+			*sep = '\0';
+		}
+	}
+}
+
+static void *
+tgcrtidx_scan_thr(void *arg)
+{
+	tgcrtidx_scan_t *scan = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&scan->mutex);
+		size_t i = scan->next++;
+		pthread_mutex_unlock(&scan->mutex);
+		if (i >= scan->count)
+			break;
+		tgcrtidx_scan_file(&scan->files[i]);
+	}
+	return NULL;
+}
+
+static void
+tgcrtidx_file_free(tgcrtidx_file_t *f)
+{
+	if (f->pem)
+		dynbuf_free(f->pem);
+	f->pem = NULL;
+	if (f->names) {
+		for (char **p = f->names; *p; p++)
+			free(*p);
+		free(f->names);
+	}
+	f->names = NULL;
+}
+
+/*
+ * Scan the PEM files in dir in parallel, and concatenate them with their
+ * tag lines into a newly allocated blob.
+ */
+static int
+tgcrtidx_build(global_t *global, char **buf, size_t *bufsz, size_t *files)
+{
+	tgcrtidx_scan_t scan;
+	pthread_t thrs[TGCRTIDX_MAX_THREADS];
+	size_t nthrs, sz, i;
+	char *p;
+	int rv = -1;
+
+	memset(&scan, 0, sizeof(tgcrtidx_scan_t));
+	if (pthread_mutex_init(&scan.mutex, NULL))
+		return -1;
+	if (sys_dir_eachfile(global->tgcrtdir, tgcrtidx_scan_add_cb, &scan) == -1)
+		goto out;
+
+	nthrs = sys_get_cpu_cores();
+	if (nthrs > TGCRTIDX_MAX_THREADS)
+		nthrs = TGCRTIDX_MAX_THREADS;
+	if (nthrs > scan.count)
+		nthrs = scan.count;
+	// The calling thread is one of the scanners
+	for (i = 1; i < nthrs; i++) {
+		if (pthread_create(&thrs[i], NULL, tgcrtidx_scan_thr, &scan))
+			break;
+	}
+	nthrs = i;
+	tgcrtidx_scan_thr(&scan);
+	for (i = 1; i < nthrs; i++)
+		pthread_join(thrs[i], NULL);
+
+	sz = 0;
+	for (i = 0; i < scan.count; i++) {
+		tgcrtidx_file_t *f = &scan.files[i];
+		if (f->err) {
+			log_err_level_printf(LOG_CRIT, "%s '%s'\n", f->err, f->path);
+			goto out;
+		}
+		for (char **n = f->names; *n; n++) {
+			if (**n && !strchr(*n, '\n'))
+				sz += TGCRTIDX_TAGSZ + strlen(*n) + 1;
+		}
+		sz += f->pem->sz + 1;
+	}
+
+	if (!sz || !(*buf = malloc(sz))) {
+		if (!sz)
+			log_err_level_printf(LOG_CRIT, "No PEM files in '%s'\n", global->tgcrtdir);
+		goto out;
+	}
+	p = *buf;
+	for (i = 0; i < scan.count; i++) {
+		tgcrtidx_file_t *f = &scan.files[i];
+		if (OPTS_DEBUG(global)) {
+			log_dbg_printf("Targets for '%s':", f->path);
+		}
+		for (char **n = f->names; *n; n++) {
+			size_t len = strlen(*n);
+			if (!len || memchr(*n, '\n', len))
+				continue;
+			if (OPTS_DEBUG(global)) {
+				log_dbg_printf(" '%s'", *n);
+			}
+			memcpy(p, TGCRTIDX_TAG, TGCRTIDX_TAGSZ);
+			p += TGCRTIDX_TAGSZ;
+			memcpy(p, *n, len);
+			p += len;
+			*p++ = '\n';
+		}
+		if (OPTS_DEBUG(global)) {
+			log_dbg_printf("\n");
+		}
+		memcpy(p, f->pem->buf, f->pem->sz);
+		p += f->pem->sz;
+		// Make sure the next tag starts on a new line
+		*p++ = '\n';
+		// Release file data as we go, blob pages are touched as we copy
+		tgcrtidx_file_free(f);
+	}
+	*bufsz = p - *buf;
+	*files = scan.count;
+	rv = 0;
+out:
+	for (i = 0; i < scan.count; i++) {
+		tgcrtidx_file_free(&scan.files[i]);
+		free(scan.files[i].path);
+	}
+	free(scan.files);
+	pthread_mutex_destroy(&scan.mutex);
+	return rv;
+}
+
+static int
+tgcrtidx_stat_cb(const char *filename, void *arg)
+{
+	tgcrtidx_stat_t *ts = arg;
+	struct stat st;
+
+	if (stat(filename, &st) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to stat '%s': %s (%i)\n",
+		               filename, strerror(errno), errno);
+		return -1;
+	}
+	ts->files++;
+	if (st.st_mtime > ts->mtime)
+		ts->mtime = st.st_mtime;
+	return 0;
+}
+
+/*
+ * Get the number of files in TargetCertDir, and the newest mtime of the
+ * directory and its files.  Does not read the files.
+ */
+static int
+tgcrtidx_stat(global_t *global, tgcrtidx_stat_t *ts)
+{
+	struct stat st;
+
+	if (stat(global->tgcrtdir, &st) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to stat TargetCertDir '%s': %s (%i)\n",
+		               global->tgcrtdir, strerror(errno), errno);
+		return -1;
+	}
+	ts->files = 0;
+	ts->mtime = st.st_mtime;
+	return sys_dir_eachfile(global->tgcrtdir, tgcrtidx_stat_cb, ts);
+}
+
+static int
+tgcrtidx_write(const char *filename, const char *hdr, const char *buf, size_t sz)
+{
+	char tmpname[strlen(filename) + 5];
+	FILE *f;
+	int fd, rv;
+
+	snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+	/* the index holds the private keys of the target certs, so never
+	 * reuse or follow a file left at the tmp path */
+	unlink(tmpname);
+	fd = open(tmpname, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW, 0600);
+	if (fd == -1 || !(f = fdopen(fd, "w"))) {
+		log_err_level_printf(LOG_CRIT, "Failed to open '%s' for writing: %s (%i)\n",
+		               tmpname, strerror(errno), errno);
+		if (fd != -1) {
+			close(fd);
+			unlink(tmpname);
+		}
+		return -1;
+	}
+	rv = fputs(hdr, f) == EOF || fwrite(buf, 1, sz, f) != sz ||
+	     fflush(f) == EOF || fsync(fd) == -1;
+	if (fclose(f) == EOF || rv) {
+		log_err_level_printf(LOG_CRIT, "Failed to write '%s': %s (%i)\n",
+		               tmpname, strerror(errno), errno);
+		unlink(tmpname);
+		return -1;
+	}
+	if (rename(tmpname, filename) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to rename '%s': %s (%i)\n",
+		               tmpname, strerror(errno), errno);
+		unlink(tmpname);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Map the index file and check its header.  Sets *files and *n to the
+ * number of files and entries the index was built from, and *mtime to the
+ * mtime of the index.
+ */
+static int
+tgcrtidx_map(const char *filename, size_t *files, size_t *n, time_t *mtime)
+{
+	struct stat st;
+	const char *nl;
+	unsigned int version;
+	size_t sz;
+	void *p;
+	int fd, hdrsz;
+
+	if ((fd = open(filename, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to open TargetCertIndex '%s': %s (%i)\n",
+		               filename, strerror(errno), errno);
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+	if (!st.st_size) {
+		log_err_level_printf(LOG_CRIT, "Empty TargetCertIndex '%s'\n", filename);
+		close(fd);
+		return -1;
+	}
+	// Stays valid after chroot and privdrop, and is shared with page cache
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		log_err_level_printf(LOG_CRIT, "Failed to map TargetCertIndex '%s': %s (%i)\n",
+		               filename, strerror(errno), errno);
+		return -1;
+	}
+	map = p;
+	mapsz = st.st_size;
+	*mtime = st.st_mtime;
+
+	nl = memchr(map, '\n', mapsz < TGCRTIDX_HDRSZ ? mapsz : TGCRTIDX_HDRSZ);
+	if (!nl || memcmp(map, TGCRTIDX_MAGIC, TGCRTIDX_MAGICSZ) ||
+	    sscanf((char *)map + TGCRTIDX_MAGICSZ, "%u %zu %zu %zu", &version, files, n, &sz) != 4) {
+		log_err_level_printf(LOG_CRIT, "Not a TargetCertIndex '%s'\n", filename);
+		return -1;
+	}
+	if (version != TGCRTIDX_VERSION) {
+		log_err_level_printf(LOG_CRIT, "Unsupported version %u of TargetCertIndex '%s'\n",
+		               version, filename);
+		return -1;
+	}
+	hdrsz = nl + 1 - (char *)map;
+	if (sz != mapsz - hdrsz) {
+		log_err_level_printf(LOG_CRIT, "Size of TargetCertIndex '%s' does not match "
+		               "its header, %zu instead of %zu bytes\n",
+		               filename, mapsz - hdrsz, sz);
+		return -1;
+	}
+	blob = (char *)map + hdrsz;
+	blobsz = sz;
+	return 0;
+}
+
+static void
+tgcrtidx_unmap(void)
+{
+	if (map)
+		munmap(map, mapsz);
+	map = NULL;
+	mapsz = 0;
+	blob = NULL;
+	blobsz = 0;
+}
+
+static int
+tgcrtidx_put(khash_t(tgname_t) *map, const char *name, size_t len,
+             tgcrtidx_entry_t *e)
+{
+	char *key;
+	khiter_t k;
+	int ret;
+
+	if (!(key = malloc(len + 1)))
+		return -1;
+	memcpy(key, name, len);
+	key[len] = '\0';
+	k = kh_put(tgname_t, map, key, &ret);
+	if (ret == -1) {
+		free(key);
+		return -1;
+	}
+	if (!ret) {
+		// Last file wins, as with the target cert cache before
+		free(key);
+	}
+	kh_val(map, k) = e;
+	return 0;
+}
+
+/*
+ * Walk the tag lines of blob and index the names of each entry.
+ */
+static int
+tgcrtidx_parse(void)
+{
+	const char *p, *end = blob + blobsz;
+	tgcrtidx_entry_t *e;
+	int intags;
+	size_t n;
+
+	// Count the entries first, hashes keep pointers into entries
+	n = 0;
+	intags = 0;
+	for (p = blob; p < end; ) {
+		const char *nl = memchr(p, '\n', end - p);
+		const char *next = nl ? nl + 1 : end;
+		int istag = (size_t)(end - p) > TGCRTIDX_TAGSZ &&
+		            !memcmp(p, TGCRTIDX_TAG, TGCRTIDX_TAGSZ);
+		if (istag && !intags)
+			n++;
+		intags = istag;
+		p = next;
+	}
+	if (!n || !(entries = calloc(n, sizeof(tgcrtidx_entry_t))))
+		return -1;
+	if (!(exactmap = kh_init(tgname_t)) || !(wildmap = kh_init(tgname_t)))
+		return -1;
+
+	e = NULL;
+	intags = 0;
+	for (p = blob; p < end; ) {
+		const char *nl = memchr(p, '\n', end - p);
+		const char *eol = nl ? nl : end;
+		const char *next = nl ? nl + 1 : end;
+		int istag = (size_t)(end - p) > TGCRTIDX_TAGSZ &&
+		            !memcmp(p, TGCRTIDX_TAG, TGCRTIDX_TAGSZ);
+		if (istag) {
+			if (!intags) {
+				if (e)
+					e->len = (p - blob) - e->off;
+				e = &entries[entries_count++];
+			}
+			const char *name = p + TGCRTIDX_TAGSZ;
+			size_t len = eol - name;
+			if (len && tgcrtidx_put(exactmap, name, len, e) == -1)
+				return -1;
+			// "*" and "*.example.com" match by the first dot of the hostname
+			if (len && name[0] == '*' && (len == 1 || name[1] == '.') &&
+			    tgcrtidx_put(wildmap, name + 1, len - 1, e) == -1)
+				return -1;
+			e->off = next - blob;
+		}
+		intags = istag;
+		p = next;
+	}
+	if (e)
+		e->len = blobsz - e->off;
+	return 0;
+}
+
+/*
+ * Build the index of TargetCertDir, and write it to TargetCertIndex if set.
+ */
+static int
+tgcrtidx_load_build(global_t *global, tgcrtidx_stat_t *ts)
+{
+	char hdr[TGCRTIDX_HDRSZ];
+	size_t files, n;
+	time_t mtime;
+
+	if (tgcrtidx_build(global, &blob, &blobsz, &files) == -1)
+		return -1;
+	if (tgcrtidx_parse() == -1) {
+		log_err_level_printf(LOG_CRIT, "Failed to index target certs\n");
+		return -1;
+	}
+	if (!global->tgcrtidx) {
+		log_err_level_printf(LOG_WARNING, "Keeping %zu bytes of target certs from "
+		               "TargetCertDir '%s' in memory, set TargetCertIndex "
+		               "to map them from a file instead\n",
+		               blobsz, global->tgcrtdir);
+		return 0;
+	}
+
+	// Files added while scanning are picked up on the next startup
+	if (ts && ts->files != files)
+		files = 0;
+	snprintf(hdr, sizeof(hdr), TGCRTIDX_MAGIC "%u %zu %zu %zu\n",
+	         TGCRTIDX_VERSION, files, entries_count, blobsz);
+	if (tgcrtidx_write(global->tgcrtidx, hdr, blob, blobsz) == -1)
+		return -1;
+
+	// Map the index written instead of keeping the blob in memory
+	tgcrtidx_fini();
+	if (tgcrtidx_map(global->tgcrtidx, &files, &n, &mtime) == -1 ||
+	    tgcrtidx_parse() == -1 || entries_count != n) {
+		log_err_level_printf(LOG_CRIT, "Failed to index target certs\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Build or map the index of TargetCertDir.
+ * Must be called before dropping privs.
+ */
+int
+tgcrtidx_load(global_t *global)
+{
+	tgcrtidx_stat_t ts;
+	struct stat st;
+	size_t files, n;
+	time_t mtime;
+
+	lru_size = global->tgcrt_cache_size;
+
+	if (global->tgcrtidx && stat(global->tgcrtidx, &st) == 0) {
+		if (tgcrtidx_stat(global, &ts) == -1 ||
+		    tgcrtidx_map(global->tgcrtidx, &files, &n, &mtime) == -1)
+			return -1;
+		if (ts.mtime >= mtime || ts.files != files) {
+			log_err_level_printf(LOG_WARNING, "TargetCertIndex '%s' is older than "
+			               "TargetCertDir '%s', building it again\n",
+			               global->tgcrtidx, global->tgcrtdir);
+			tgcrtidx_unmap();
+			if (tgcrtidx_load_build(global, &ts) == -1)
+				return -1;
+		} else {
+			if (tgcrtidx_parse() == -1 || entries_count != n) {
+				log_err_level_printf(LOG_CRIT, "Failed to index target certs "
+				               "of TargetCertIndex '%s'\n", global->tgcrtidx);
+				return -1;
+			}
+			if (OPTS_DEBUG(global)) {
+				log_dbg_printf("Mapped TargetCertIndex '%s'\n", global->tgcrtidx);
+			}
+		}
+	} else if (global->tgcrtidx) {
+		if (tgcrtidx_stat(global, &ts) == -1 ||
+		    tgcrtidx_load_build(global, &ts) == -1)
+			return -1;
+	} else {
+		if (tgcrtidx_load_build(global, NULL) == -1)
+			return -1;
+	}
+
+	if (OPTS_DEBUG(global)) {
+		log_dbg_printf("Indexed %zu target certs, %u names, %u wildcards\n",
+		               entries_count, kh_size(exactmap), kh_size(wildmap));
+	}
+	return 0;
+}
+
+static void
+tgcrtidx_lru_unlink(tgcrtidx_entry_t *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		lru_head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		lru_tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void
+tgcrtidx_lru_push(tgcrtidx_entry_t *e)
+{
+	e->prev = NULL;
+	e->next = lru_head;
+	if (lru_head)
+		lru_head->prev = e;
+	else
+		lru_tail = e;
+	lru_head = e;
+}
+
+/*
+ * Return a parsed cert of entry, with refcount incremented.
+ */
+static cert_t *
+tgcrtidx_entry_cert(tgcrtidx_entry_t *e, const char *name)
+{
+	cert_t *cert;
+
+	pthread_mutex_lock(&lru_mutex);
+	if (e->bad) {
+		pthread_mutex_unlock(&lru_mutex);
+		return NULL;
+	}
+	if (e->cert) {
+		if (e != lru_head) {
+			tgcrtidx_lru_unlink(e);
+			tgcrtidx_lru_push(e);
+		}
+		cert = e->cert;
+		cert_refcount_inc(cert);
+		pthread_mutex_unlock(&lru_mutex);
+		return cert;
+	}
+	pthread_mutex_unlock(&lru_mutex);
+
+	// Parse without holding the lock, other threads may use cached certs
+	cert = cert_new_load_mem(blob + e->off, e->len);
+	if (!cert) {
+		log_err_level_printf(LOG_CRIT, "Failed to load cert and key of target "
+		                "'%s'\n", name);
+	} else if (X509_check_private_key(cert->crt, cert->key) != 1) {
+		log_err_level_printf(LOG_CRIT, "Cert does not match key of target "
+		                "'%s'\n", name);
+		cert_free(cert);
+		cert = NULL;
+	}
+
+	pthread_mutex_lock(&lru_mutex);
+	if (!cert) {
+		e->bad = 1;
+	} else if (e->cert) {
+		// Another thread parsed it meanwhile
+		cert_free(cert);
+		cert = e->cert;
+	} else {
+		e->cert = cert;
+		tgcrtidx_lru_push(e);
+		if (++lru_count > lru_size) {
+			tgcrtidx_entry_t *old = lru_tail;
+			tgcrtidx_lru_unlink(old);
+			cert_free(old->cert);
+			old->cert = NULL;
+			lru_count--;
+		}
+	}
+	if (cert)
+		cert_refcount_inc(cert);
+	pthread_mutex_unlock(&lru_mutex);
+	return cert;
+}
+
+/*
+ * Look up the target cert for name, by exact name first, then by the
+ * wildcard of name, as ssl_wildcardify() would have built it.
+ * Returned cert must be freed using cert_free() by the caller.
+ * Thread-safe.
+ */
+cert_t *
+tgcrtidx_get(const char *name)
+{
+	const char *dot;
+	cert_t *cert;
+	khiter_t k;
+
+	if (!entries)
+		return NULL;
+
+	// A bad cert of the exact name falls back to the wildcard
+	k = kh_get(tgname_t, exactmap, name);
+	if (k != kh_end(exactmap) &&
+	    (cert = tgcrtidx_entry_cert(kh_val(exactmap, k), name)))
+		return cert;
+
+	dot = strchr(name, '.');
+	k = kh_get(tgname_t, wildmap, dot ? dot : "");
+	if (k != kh_end(wildmap))
+		return tgcrtidx_entry_cert(kh_val(wildmap, k), name);
+	return NULL;
+}
+
+size_t
+tgcrtidx_count(void)
+{
+	return entries_count;
+}
+
+static void
+tgcrtidx_map_free(khash_t(tgname_t) *map)
+{
+	for (khiter_t k = kh_begin(map); k != kh_end(map); k++) {
+		if (kh_exist(map, k))
+			free((char *)kh_key(map, k));
+	}
+	kh_destroy(tgname_t, map);
+}
+
+void
+tgcrtidx_fini(void)
+{
+	if (exactmap) {
+		tgcrtidx_map_free(exactmap);
+		exactmap = NULL;
+	}
+	if (wildmap) {
+		tgcrtidx_map_free(wildmap);
+		wildmap = NULL;
+	}
+	if (entries) {
+		for (size_t i = 0; i < entries_count; i++) {
+			if (entries[i].cert)
+				cert_free(entries[i].cert);
+		}
+		free(entries);
+		entries = NULL;
+	}
+	entries_count = 0;
+	lru_head = lru_tail = NULL;
+	lru_count = 0;
+	if (map) {
+		tgcrtidx_unmap();
+	} else if (blob) {
+		free(blob);
+		blob = NULL;
+		blobsz = 0;
+	}
+}
+
+/* vim: set noet ft=c: */
@@ -3,6 +3,7 @@
  * https://www.roe.ch/SSLsplit
  *
  * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
  * All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
@@ -26,18 +27,18 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#ifndef CACHETGCRT_H
-#define CACHETGCRT_H
+#ifndef TGCRTIDX_H
+#define TGCRTIDX_H
 
-#include "cache.h"
-#include "attrib.h"
+#include "opts.h"
 #include "cert.h"
+#include "attrib.h"
 
-void cachetgcrt_init_cb(struct cache *) NONNULL(1);
-
-cache_key_t cachetgcrt_mkkey(const char *) NONNULL(1) WUNRES;
-cache_val_t cachetgcrt_mkval(cert_t *) NONNULL(1) WUNRES;
+int tgcrtidx_load(global_t *) NONNULL(1) WUNRES;
+cert_t * tgcrtidx_get(const char *) NONNULL(1) WUNRES;
+size_t tgcrtidx_count(void) WUNRES;
+void tgcrtidx_fini(void);
 
-#endif /* !CACHETGCRT_H */
+#endif /* !TGCRTIDX_H */
 
 /* vim: set noet ft=c: */
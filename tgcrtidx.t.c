@@ -0,0 +1,325 @@
+/*-
+ * SSLsplit - transparent SSL/TLS interception
+ * https://www.roe.ch/SSLsplit
+ *
+ * Copyright (c) 2009-2019, Daniel Roethlisberger <daniel@roe.ch>.
+ * Copyright (c) 2017-2019, Soner Tari <sonertari@gmail.com>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDER AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tgcrtidx.h"
+#include "ssl.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <check.h>
+
+#define TARGETDIR "extra/pki/targets"
+
+static global_t *global;
+
+static void
+tgcrtidx_setup(void)
+{
+	if (ssl_init() == -1)
+		exit(EXIT_FAILURE);
+	global = global_new();
+	global->tgcrtdir = strdup(TARGETDIR);
+}
+
+static void
+tgcrtidx_teardown(void)
+{
+	tgcrtidx_fini();
+	global_free(global);
+	ssl_fini();
+}
+
+START_TEST(tgcrtidx_get_01)
+{
+	cert_t *c1, *c2;
+
+	fail_unless(tgcrtidx_load(global) == 0, "load failed");
+	fail_unless(tgcrtidx_count() == 2, "wrong count");
+
+	c1 = tgcrtidx_get("daniel.roe.ch");
+	fail_unless(!!c1, "exact name not found");
+	fail_unless(!!c1->crt && !!c1->key, "cert not loaded");
+	fail_unless(sk_X509_num(c1->chain) == 1, "chain not loaded");
+	c2 = tgcrtidx_get("daniel.roe.ch");
+	fail_unless(c1 == c2, "cert not cached");
+	fail_unless(c1->references == 3, "refcount mismatch");
+	cert_free(c1);
+	cert_free(c2);
+}
+END_TEST
+
+START_TEST(tgcrtidx_get_02)
+{
+	cert_t *c1, *c2;
+
+	fail_unless(tgcrtidx_load(global) == 0, "load failed");
+
+	c1 = tgcrtidx_get("www.roe.ch");
+	fail_unless(!!c1, "wildcard name not found");
+	c2 = tgcrtidx_get("*.roe.ch");
+	fail_unless(c1 == c2, "literal wildcard name not found");
+	cert_free(c1);
+	cert_free(c2);
+
+	fail_unless(!tgcrtidx_get("roe.ch"), "wildcard matched base domain");
+	fail_unless(!tgcrtidx_get("a.b.roe.ch"), "wildcard matched two labels");
+	fail_unless(!tgcrtidx_get("www.example.com"), "unknown name found");
+	fail_unless(!tgcrtidx_get("localhost"), "dotless name found");
+}
+END_TEST
+
+START_TEST(tgcrtidx_lru_01)
+{
+	cert_t *c1, *c2, *c3;
+
+	global->tgcrt_cache_size = 1;
+	fail_unless(tgcrtidx_load(global) == 0, "load failed");
+
+	c1 = tgcrtidx_get("daniel.roe.ch");
+	fail_unless(!!c1, "exact name not found");
+	c2 = tgcrtidx_get("www.roe.ch");
+	fail_unless(!!c2, "wildcard name not found");
+	fail_unless(c1->references == 1, "evicted cert still referenced");
+	c3 = tgcrtidx_get("daniel.roe.ch");
+	fail_unless(!!c3, "evicted cert not reloaded");
+	fail_unless(c3 != c1, "evicted cert returned");
+	fail_unless(c2->references == 1, "evicted cert still referenced");
+	cert_free(c1);
+	cert_free(c2);
+	cert_free(c3);
+}
+END_TEST
+
+static void
+tgcrtidx_tmpname(char *name)
+{
+	int fd;
+
+	fd = mkstemp(name);
+	fail_unless(fd != -1, "mkstemp failed");
+	close(fd);
+	unlink(name);
+}
+
+static void
+tgcrtidx_write_file(const char *name, const char *data, size_t sz)
+{
+	FILE *f;
+
+	f = fopen(name, "w");
+	fail_unless(!!f, "cannot create file");
+	fail_unless(fwrite(data, 1, sz, f) == sz, "cannot write file");
+	fclose(f);
+}
+
+/*
+ * Write an index with a header, its blob made of a bad entry for name,
+ * followed by the wildcard.roe.ch entry.
+ */
+static void
+tgcrtidx_write_index(const char *idx, const char *name, const char *hdrfmt)
+{
+	char buf[16384], blob[16384];
+	FILE *f;
+	size_t pemsz;
+	int n, sz;
+
+	f = fopen(TARGETDIR "/wildcard.roe.ch.pem", "r");
+	fail_unless(!!f, "cannot open PEM");
+	n = snprintf(blob, sizeof(blob), "#tgcrt %s\nbogus\n#tgcrt *.roe.ch\n", name);
+	pemsz = fread(blob + n, 1, sizeof(blob) - n - 1, f);
+	fclose(f);
+	fail_unless(pemsz > 0, "cannot read PEM");
+	blob[n + pemsz] = '\n';
+	sz = snprintf(buf, sizeof(buf), hdrfmt, n + pemsz + 1);
+	memcpy(buf + sz, blob, n + pemsz + 1);
+	tgcrtidx_write_file(idx, buf, sz + n + pemsz + 1);
+}
+
+START_TEST(tgcrtidx_index_01)
+{
+	char idx[] = "/tmp/sslproxy_test_tgcrtidx.XXXXXX";
+	struct stat st1, st2;
+	cert_t *c;
+
+	tgcrtidx_tmpname(idx);
+	global->tgcrtidx = strdup(idx);
+
+	fail_unless(tgcrtidx_load(global) == 0, "building index failed");
+	fail_unless(access(idx, R_OK) == 0, "index not written");
+	fail_unless(stat(idx, &st1) == 0, "stat index failed");
+	tgcrtidx_fini();
+
+	// The index is not written again if it is up to date
+	fail_unless(tgcrtidx_load(global) == 0, "mapping index failed");
+	fail_unless(tgcrtidx_count() == 2, "wrong count");
+	fail_unless(stat(idx, &st2) == 0, "stat index failed");
+	fail_unless(st1.st_ino == st2.st_ino, "up to date index built again");
+	c = tgcrtidx_get("www.roe.ch");
+	fail_unless(!!c, "wildcard name not found");
+	fail_unless(!!c->crt && !!c->key, "cert not loaded");
+	cert_free(c);
+	unlink(idx);
+}
+END_TEST
+
+START_TEST(tgcrtidx_index_03)
+{
+	char idx[] = "/tmp/sslproxy_test_tgcrtidx.XXXXXX";
+	struct timeval tv[2];
+	struct stat st1, st2;
+
+	tgcrtidx_tmpname(idx);
+	global->tgcrtidx = strdup(idx);
+
+	fail_unless(tgcrtidx_load(global) == 0, "building index failed");
+	tgcrtidx_fini();
+
+	// An index older than TargetCertDir is built again
+	memset(tv, 0, sizeof(tv));
+	fail_unless(utimes(idx, tv) == 0, "utimes failed");
+	fail_unless(stat(idx, &st1) == 0, "stat index failed");
+	fail_unless(tgcrtidx_load(global) == 0, "building stale index failed");
+	fail_unless(tgcrtidx_count() == 2, "wrong count");
+	fail_unless(stat(idx, &st2) == 0, "stat index failed");
+	fail_unless(st1.st_ino != st2.st_ino, "stale index not built again");
+	fail_unless(st2.st_mtime > 0, "stale index not built again");
+	unlink(idx);
+}
+END_TEST
+
+START_TEST(tgcrtidx_index_04)
+{
+	char idx[] = "/tmp/sslproxy_test_tgcrtidx.XXXXXX";
+
+	tgcrtidx_tmpname(idx);
+	global->tgcrtidx = strdup(idx);
+
+	tgcrtidx_write_file(idx, "#tgcrt daniel.roe.ch\n", 21);
+	fail_unless(tgcrtidx_load(global) == -1, "index without header accepted");
+	tgcrtidx_fini();
+
+	tgcrtidx_write_index(idx, "www.roe.ch", "#tgcrtidx 99 2 2 %zu\n");
+	fail_unless(tgcrtidx_load(global) == -1, "index of other version accepted");
+	tgcrtidx_fini();
+
+	tgcrtidx_write_index(idx, "www.roe.ch", "#tgcrtidx 1 2 2 1%zu\n");
+	fail_unless(tgcrtidx_load(global) == -1, "truncated index accepted");
+	tgcrtidx_fini();
+
+	tgcrtidx_write_index(idx, "www.roe.ch", "#tgcrtidx 1 2 3 %zu\n");
+	fail_unless(tgcrtidx_load(global) == -1, "index with wrong entry count accepted");
+	unlink(idx);
+}
+END_TEST
+
+START_TEST(tgcrtidx_index_05)
+{
+	char idx[] = "/tmp/sslproxy_test_tgcrtidx.XXXXXX";
+	cert_t *c;
+
+	tgcrtidx_tmpname(idx);
+	global->tgcrtidx = strdup(idx);
+
+	tgcrtidx_write_index(idx, "www.roe.ch", "#tgcrtidx 1 2 2 %zu\n");
+	fail_unless(tgcrtidx_load(global) == 0, "mapping index failed");
+	fail_unless(tgcrtidx_count() == 2, "wrong count");
+
+	// A bad cert of the exact name falls back to the wildcard
+	c = tgcrtidx_get("www.roe.ch");
+	fail_unless(!!c, "wildcard not used for bad exact name");
+	fail_unless(!!c->crt && !!c->key, "cert not loaded");
+	cert_free(c);
+	c = tgcrtidx_get("www.roe.ch");
+	fail_unless(!!c, "wildcard not used for bad exact name again");
+	cert_free(c);
+	unlink(idx);
+}
+END_TEST
+
+START_TEST(tgcrtidx_index_02)
+{
+	char idx[] = "/tmp/sslproxy_test_tgcrtidx.XXXXXX";
+	char victim[] = "/tmp/sslproxy_test_tgcrtidx.XXXXXX";
+	char tmp[sizeof(idx) + 4];
+	struct stat st;
+	int fd;
+
+	fd = mkstemp(idx);
+	fail_unless(fd != -1, "mkstemp failed");
+	close(fd);
+	unlink(idx);
+	fd = mkstemp(victim);
+	fail_unless(fd != -1, "mkstemp failed");
+	close(fd);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", idx);
+	fail_unless(symlink(victim, tmp) == 0, "symlink failed");
+	global->tgcrtidx = strdup(idx);
+
+	fail_unless(tgcrtidx_load(global) == 0, "building index failed");
+	fail_unless(stat(victim, &st) == 0, "stat victim failed");
+	fail_unless(st.st_size == 0, "symlink at tmp path was followed");
+	fail_unless(lstat(idx, &st) == 0, "index not written");
+	fail_unless(S_ISREG(st.st_mode), "index is not a regular file");
+	fail_unless((st.st_mode & 0777) == 0600, "index is not private");
+	fail_unless(access(tmp, F_OK) == -1, "tmp file left behind");
+	unlink(idx);
+	unlink(victim);
+}
+END_TEST
+
+Suite *
+tgcrtidx_suite(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("tgcrtidx");
+
+	tc = tcase_create("tgcrtidx_get");
+	tcase_add_checked_fixture(tc, tgcrtidx_setup, tgcrtidx_teardown);
+	tcase_add_test(tc, tgcrtidx_get_01);
+	tcase_add_test(tc, tgcrtidx_get_02);
+	tcase_add_test(tc, tgcrtidx_lru_01);
+	tcase_add_test(tc, tgcrtidx_index_01);
+	tcase_add_test(tc, tgcrtidx_index_02);
+	tcase_add_test(tc, tgcrtidx_index_03);
+	tcase_add_test(tc, tgcrtidx_index_04);
+	tcase_add_test(tc, tgcrtidx_index_05);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
+
+/* vim: set noet ft=c: */